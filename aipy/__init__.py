@@ -13,14 +13,47 @@ Modifications by: Dale Gary, Sijie Yu
 
 from __future__ import print_function, division, absolute_import
 
-from . import phs, const, coord, deconv
-from . import fit, healpix, img
-from . import interp, cal, map, miriad
-import scipy.optimize as optimize
-from . import rfi, amp, scripting, src, _src, utils
-from . import dsp
-from . import pol, twodgauss #added by dfm
-import ephem
+import importlib
+
+# Submodules (and scipy.optimize and ephem, which used to be imported here
+# too) load on first access as attributes, so that "import aipy" costs next
+# to nothing and "from aipy import miriad" loads miriad alone.
+_submodules = ('phs', 'const', 'coord', 'deconv', 'fit', 'healpix', 'img',
+    'interp', 'cal', 'map', 'miriad', 'rfi', 'amp', 'scripting', 'src',
+    '_src', 'utils', 'dsp', 'pol', 'twodgauss')
+_modules = {'optimize': 'scipy.optimize', 'ephem': 'ephem'}
+__all__ = list(_submodules) + list(_modules)
+
+def __getattr__(name):
+    if name in _submodules:
+        mod = importlib.import_module('.' + name, __name__)
+    elif name in _modules:
+        mod = importlib.import_module(_modules[name])
+    else:
+        raise AttributeError("module %r has no attribute %r" % (__name__, name))
+    globals()[name] = mod
+    return mod
+
+def __dir__():
+    return sorted(set(globals()) | set(_submodules) | set(_modules))
+
+def set_num_threads(n):
+    """Set the number of native threads the parallel loops of the extension
+    modules (imaging, gridding, cleaning, phasing, RFI flagging, MIRIAD
+    i/o and gains, ...) run on when their nthreads is 0, the default: n, or
+    one per core for n <= 0 (as at start-up, unless the AIPY_NUM_THREADS
+    environment variable says otherwise).  All modules share one pool of
+    threads, and a loop started from inside another runs on one thread, so
+    this also bounds what they use together.  A function's own nthreads
+    argument, if given, overrides it for that call.  Returns the number
+    before."""
+    from . import _pool
+    return _pool.set_num_threads(n)
+
+def get_num_threads():
+    """Return the number of native threads of set_num_threads."""
+    from . import _pool
+    return _pool.get_num_threads()
 
 try:
     from importlib.metadata import PackageNotFoundError, version
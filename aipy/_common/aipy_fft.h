@@ -0,0 +1,105 @@
+/* Unnormalised complex FFTs of any length, shared by the C++ modules.
+   FftPlan transforms one length (radix-2, or Bluestein on a radix-2 plan);
+   Fft2d transforms C-contiguous 2d arrays. */
+
+#ifndef __AIPY_FFT_H
+#define __AIPY_FFT_H
+
+#include <cmath>
+#include <complex>
+#include <vector>
+#include <algorithm>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+typedef std::complex<double> cplx_t;
+
+// x * y without the inf/nan recovery of operator* (a libgcc call per
+// product unless built with -ffast-math); the same for finite values
+static inline cplx_t cmul(const cplx_t &x, const cplx_t &y) {
+    return cplx_t(x.real() * y.real() - x.imag() * y.imag(),
+                  x.real() * y.imag() + x.imag() * y.real());
+}
+
+// An unnormalised, in-place complex FFT of one length, planned once and
+// reused: iterative radix-2 for powers of two, Bluestein's algorithm (on a
+// power-of-two plan) for other lengths.
+struct FftPlan {
+    long n, m;                      // transform length, power-of-two length
+    std::vector<cplx_t> tw;         // exp(-2 pi i k / m), k < m/2
+    std::vector<long> rev;          // bit-reversal permutation of m
+    std::vector<cplx_t> chirp, chirp_f, work;  // Bluestein only
+
+    FftPlan(long len) : n(len), m(1) {
+        while (m < n) m <<= 1;
+        if (m != n) { m = 1; while (m < 2*n - 1) m <<= 1; }
+        tw.resize(m / 2 > 0 ? m / 2 : 1);
+        for (long k=0; k < m / 2; k++) tw[k] = std::polar(1., -2 * M_PI * k / m);
+        rev.resize(m);
+        rev[0] = 0;
+        for (long k=1, bits=0; k < m; k++) {
+            long bit = m >> 1;
+            for (; bits & bit; bit >>= 1) bits ^= bit;
+            bits ^= bit;
+            rev[k] = bits;
+        }
+        if (m == n) return;
+        chirp.resize(n);
+        for (long k=0; k < n; k++)   // k^2 mod 2n keeps the angle accurate
+            chirp[k] = std::polar(1., -M_PI * (double) ((k * k) % (2 * n)) / n);
+        chirp_f.assign(m, 0.);
+        chirp_f[0] = 1.;
+        for (long k=1; k < n; k++) chirp_f[k] = chirp_f[m-k] = std::conj(chirp[k]);
+        pow2(&chirp_f[0], 0);
+        work.resize(m);
+    }
+    // Radix-2 transform of length m; inv selects the +i exponent
+    void pow2(cplx_t *x, int inv) const {
+        for (long k=0; k < m; k++) if (k < rev[k]) std::swap(x[k], x[rev[k]]);
+        for (long len=2; len <= m; len <<= 1) {
+            long half = len / 2, step = m / len;
+            for (long i=0; i < m; i += len) {
+                for (long j=0; j < half; j++) {
+                    cplx_t w = inv ? std::conj(tw[j*step]) : tw[j*step];
+                    cplx_t u = x[i+j], v = cmul(x[i+j+half], w);
+                    x[i+j] = u + v;
+                    x[i+j+half] = u - v;
+                }
+            }
+        }
+    }
+    void exec(cplx_t *x, int inv) {
+        if (m == n) { pow2(x, inv); return; }
+        for (long k=0; k < n; k++) work[k] = cmul(inv ? std::conj(x[k]) : x[k], chirp[k]);
+        std::fill(work.begin() + n, work.end(), cplx_t(0.));
+        pow2(&work[0], 0);
+        for (long k=0; k < m; k++) work[k] = cmul(work[k], chirp_f[k]);
+        pow2(&work[0], 1);
+        for (long k=0; k < n; k++) {
+            x[k] = cmul(work[k], chirp[k]) / (double) m;
+            if (inv) x[k] = std::conj(x[k]);
+        }
+    }
+};
+
+// Unnormalised 2d FFT of a C-contiguous dim1 x dim2 array (rows, then
+// columns through a scratch buffer)
+struct Fft2d {
+    long dim1, dim2;
+    FftPlan p1, p2;
+    std::vector<cplx_t> col;
+    Fft2d(long d1, long d2) : dim1(d1), dim2(d2), p1(d1), p2(d2), col(d1) {}
+    void exec(cplx_t *x, int inv) {
+        for (long n1=0; n1 < dim1; n1++) p2.exec(x + n1*dim2, inv);
+        if (dim1 == 1) return;
+        for (long n2=0; n2 < dim2; n2++) {
+            for (long n1=0; n1 < dim1; n1++) col[n1] = x[n1*dim2+n2];
+            p1.exec(&col[0], inv);
+            for (long n1=0; n1 < dim1; n1++) x[n1*dim2+n2] = col[n1];
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,105 @@
+/* The native thread pool shared by the extension modules.  The workers
+   and the thread count aipy.set_num_threads sets live in aipy._pool, whose
+   C API a module picks up at import with aipy_pool_import(); one source
+   file per module defines AIPY_POOL_MAIN before including this header to
+   hold the pointer to it.  A parallel loop claims its items off a shared
+   counter, with the calling thread taking part, so it needs no thread of
+   its own to finish; one run from inside another (on a pool thread, or
+   while the caller takes part) runs on the calling thread alone rather
+   than oversubscribing the cores.  Without the C API (a module loaded on
+   its own) loops run serially. */
+
+#ifndef __AIPY_POOL_H
+#define __AIPY_POOL_H
+
+#include <Python.h>
+
+#define AIPY_POOL_VERSION 1
+#define AIPY_POOL_CAPSULE "aipy._pool._C_API"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    int version;
+    // Participants a loop over n items asked for nthreads (<= 0 for the
+    // aipy.set_num_threads setting) will have, at least 1; a loop asked
+    // for that many again runs on exactly that many
+    int (*nthreads)(long n, int nthreads);
+    // Calls fn(ctx, k, tid) for every k < n, tid being the participant
+    // (< nthreads(n, nthreads)) making the call, and returns when all have
+    // returned.  Needs no GIL.
+    void (*run)(long n, int nthreads, void (*fn)(void *, long, int), void *ctx);
+} aipy_pool_api;
+
+#ifdef AIPY_POOL_MAIN
+aipy_pool_api *aipy_pool_ptr = NULL;
+#else
+extern aipy_pool_api *aipy_pool_ptr;
+#endif
+
+// Picks up the C API of aipy._pool for this module; 0 or -1 with a Python
+// exception set.  Call with the GIL held, from the module's init.
+static inline int aipy_pool_import(void) {
+    // PyCapsule_Import only imports the package, not the module
+    PyObject *mod = PyImport_ImportModule("aipy._pool");
+    if (mod == NULL) return -1;
+    Py_DECREF(mod);
+    aipy_pool_api *api = (aipy_pool_api *) PyCapsule_Import(AIPY_POOL_CAPSULE, 0);
+    if (api == NULL) return -1;
+    if (api->version != AIPY_POOL_VERSION) {
+        PyErr_Format(PyExc_ImportError, "aipy._pool has C API version %d, not %d",
+                     api->version, AIPY_POOL_VERSION);
+        return -1;
+    }
+    aipy_pool_ptr = api;
+    return 0;
+}
+
+static inline int aipy_pool_nthreads(long n, int nthreads) {
+    if (aipy_pool_ptr != NULL) return aipy_pool_ptr->nthreads(n, nthreads);
+    return 1;
+}
+
+#ifdef __cplusplus
+}
+
+#include <atomic>
+#include <exception>
+
+template <class F>
+struct aipy_pool_job {
+    F *fn;
+    std::atomic<bool> failed;
+    std::exception_ptr err;     // the first exception, set with failed
+    static void call(void *ctx, long k, int tid) {
+        aipy_pool_job *job = (aipy_pool_job *) ctx;
+        if (job->failed.load(std::memory_order_relaxed)) return;  // skip what remains
+        try {
+            (*job->fn)(k, tid);
+        } catch (...) {
+            if (!job->failed.exchange(true)) job->err = std::current_exception();
+        }
+    }
+};
+
+// Runs fn(k, tid) for k < n on nthreads participants (<= 0 for the
+// aipy.set_num_threads setting), tid numbering the one making the call.
+// Per-thread scratch is sized by nt = aipy_pool_nthreads(n, nthreads),
+// with nt then passed here for nthreads (the setting may change between
+// the calls).  An exception thrown by fn is rethrown here once all
+// participants are done.
+template <class F>
+static void aipy_parallel(long n, int nthreads, F fn) {
+    aipy_pool_job<F> job;
+    job.fn = &fn;
+    job.failed = false;
+    if (n <= 0) return;
+    if (aipy_pool_ptr != NULL) aipy_pool_ptr->run(n, nthreads, aipy_pool_job<F>::call, &job);
+    else for (long k=0; k < n; k++) aipy_pool_job<F>::call(&job, k, 0);
+    if (job.failed) std::rethrow_exception(job.err);
+}
+#endif
+
+#endif
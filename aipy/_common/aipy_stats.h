@@ -0,0 +1,73 @@
+/*
+ * Switchable work counters behind the stats() functions of the extension
+ * modules.  Counters are only touched while switched on, and then with the
+ * GIL held (after Py_END_ALLOW_THREADS), so counting costs a test of a
+ * flag when off and needs no atomics when on.
+ */
+
+#ifndef _AIPY_STATS_H_
+#define _AIPY_STATS_H_
+
+#include <Python.h>
+#include <time.h>
+
+#define AIPY_STATS_MAX 16
+
+typedef struct {
+    int on;
+    int n;
+    const char *names[AIPY_STATS_MAX];
+    long long vals[AIPY_STATS_MAX];
+} aipy_stats;
+
+// Nanoseconds on a monotonic clock, or 0 while s is off
+static inline long long aipy_stats_clock(const aipy_stats *s) {
+    struct timespec ts;
+    if (!s->on) return 0;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+#define AIPY_STATS_ADD(s,i,v) \
+    do { if ((s).on) (s).vals[i] += (long long) (v); } while (0)
+
+// Adds the time since t0 (from aipy_stats_clock) to counter i
+#define AIPY_STATS_TIME(s,i,t0) \
+    do { if ((t0) != 0) AIPY_STATS_ADD(s, i, aipy_stats_clock(&(s)) - (t0)); } while (0)
+
+// Parses the (enable=None, reset=False) arguments of a stats() function:
+// *enable is -1 for None, else 0 or 1
+static inline int aipy_stats_args(PyObject *args, PyObject *kwargs, int *enable, int *reset) {
+    static char *kwlist[] = {(char *) "enable", (char *) "reset", NULL};
+    PyObject *eobj = Py_None;
+    *reset = 0;
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|Oi", kwlist, &eobj, reset))
+        return -1;
+    *enable = -1;
+    if (eobj != Py_None && (*enable = PyObject_IsTrue(eobj)) < 0) return -1;
+    return 0;
+}
+
+// The body of stats(enable=None, reset=False): switches s on or off if
+// enable is given, and returns a dict of the counters as they were before
+// reset zeroes them
+static inline PyObject *aipy_stats_call(aipy_stats *s, PyObject *args, PyObject *kwargs) {
+    PyObject *d, *v;
+    int enable, reset, i;
+    if (aipy_stats_args(args, kwargs, &enable, &reset) != 0) return NULL;
+    if (enable >= 0) s->on = enable;
+    if ((d = PyDict_New()) == NULL) return NULL;
+    for (i=0; i < s->n; i++) {
+        if ((v = PyLong_FromLongLong(s->vals[i])) == NULL
+                || PyDict_SetItemString(d, s->names[i], v) != 0) {
+            Py_XDECREF(v);
+            Py_DECREF(d);
+            return NULL;
+        }
+        Py_DECREF(v);
+        if (reset) s->vals[i] = 0;
+    }
+    return d;
+}
+
+#endif
@@ -7,8 +7,21 @@
 
 #include <Python.h>
 #include <cmath>
+#include <cfloat>
+#include <complex>
+#include <new>
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
 #include "numpy/arrayobject.h"
 #include "aipy_compat.h"
+#include "aipy_fft.h"
+#include "aipy_stats.h"
+#define AIPY_POOL_MAIN
+#include "aipy_pool.h"
 
 #define QUOTE(s) # s
 
@@ -43,9 +56,188 @@
         return NULL; }
 
 
+// Optional vectorised versions of Clean<T>::sub_run_r/sub_run_c.  These are
+// NULL (use the scalar loops) unless clean_simd_init() finds a supported ISA.
+template<typename T> struct CleanSimd {
+    typedef void (*run_r_t)(T *, const T *, const char *, int, T, int, long,
+        T &, long &, T &, T &);
+    typedef void (*run_c_t)(T *, const T *, const char *, int, T, T, long,
+        T &, long &, T &, T &, T &);
+    static run_r_t run_r;
+    static run_c_t run_c;
+};
+template<typename T> typename CleanSimd<T>::run_r_t CleanSimd<T>::run_r = NULL;
+template<typename T> typename CleanSimd<T>::run_c_t CleanSimd<T>::run_c = NULL;
+
+// One record of the optional clean history; the layout matches
+// _deconv.history_dtype.  pos/peak are the residual peak found after the
+// step (where the next component goes), step is the component just added.
+struct CleanRecord {
+    npy_int64 iter, pos[2];
+    double peak[2], score, step[2];
+};
+
+// Writes every Nth iteration of a clean loop into a preallocated record
+// array, dropping records once it is full.  iter counts all iterations of
+// the run, including those after a maxiter counter reset.
+struct CleanHistory {
+    CleanRecord *rec;
+    long size, count, every, iter;
+    template<typename T> void add(long p1, long p2, T peakr, T peaki,
+            T score, T stepr, T stepi) {
+        long it = iter++;
+        if (it % every != 0 || count >= size) return;
+        CleanRecord &r = rec[count++];
+        r.iter = it; r.pos[0] = p1; r.pos[1] = p2;
+        r.peak[0] = (double) peakr; r.peak[1] = (double) peaki;
+        r.score = (double) score;
+        r.step[0] = (double) stepr; r.step[1] = (double) stepi;
+    }
+};
+
+// The pixels of a sparsely filled mask, for searching peaks only there.
+// idx lists their flat indices in order; idx[row[r]:row[r+1]] are in row r.
+#define SPARSE_MASK_FILL .25
+struct SparseMask {
+    std::vector<long> idx, row;
+    std::vector<char> zeros;    // an unmasked row, for the dense update
+    // Build from a dim1 x dim2 byte mask if at most SPARSE_MASK_FILL of it
+    // is set; returns whether it did
+    int init(const char *mask, int dim1, int dim2, int cplx) {
+        long npix = (long) dim1*dim2, cnt = 0;
+        for (long n=0; n < npix; n++) cnt += mask[n] != 0;
+        if (cnt > SPARSE_MASK_FILL * npix) return 0;
+        idx.reserve(cnt);
+        row.resize(dim1 + 1);
+        for (int n1=0; n1 < dim1; n1++) {
+            row[n1] = (long) idx.size();
+            for (long n=(long) n1*dim2; n < (long) (n1+1)*dim2; n++)
+                if (mask[n]) idx.push_back(n);
+        }
+        row[dim1] = (long) idx.size();
+        zeros.assign(cplx ? 2*dim2 : dim2, 0);
+        return 1;
+    }
+};
+
+// Collects the components a clean run adds (flat pixel index and step),
+// so that they can be returned as a list rather than read back out of mdl.
+// Components the loop undoes are dropped again.
+struct CleanComponents {
+    std::vector<long> pos;
+    std::vector<double> flux;   // (real, imag) per component
+    void add(long p, double re, double im) {
+        pos.push_back(p);
+        flux.push_back(re); flux.push_back(im);
+    }
+    void pop(size_t n) {
+        pos.resize(pos.size() - std::min(n, pos.size()));
+        flux.resize(2 * pos.size());
+    }
+    // Drop zero steps; if merge, also sum repeated positions, leaving the
+    // components sorted by pixel index
+    void compact(int merge) {
+        size_t n = pos.size(), k = 0;
+        std::vector<size_t> order(n);
+        for (size_t j=0; j < n; j++) order[j] = j;
+        if (merge) std::stable_sort(order.begin(), order.end(),
+            [this](size_t a, size_t b) { return pos[a] < pos[b]; });
+        std::vector<long> p(n);
+        std::vector<double> f(2*n);
+        for (size_t j=0; j < n; j++) {
+            size_t o = order[j];
+            if (merge && k > 0 && p[k-1] == pos[o]) {
+                f[2*k-2] += flux[2*o]; f[2*k-1] += flux[2*o+1];
+                if (f[2*k-2] == 0 && f[2*k-1] == 0) k--;
+                continue;
+            }
+            if (flux[2*o] == 0 && flux[2*o+1] == 0) continue;
+            p[k] = pos[o]; f[2*k] = flux[2*o]; f[2*k+1] = flux[2*o+1];
+            k++;
+        }
+        p.resize(k); f.resize(2*k);
+        pos.swap(p); flux.swap(f);
+    }
+    // Returns (rv, pos, flux): pos is an (n, rank) int array of pixel
+    // indices and flux a float (or complex) array of the n steps
+    PyObject *build(int rv, int rank, long dim2, int cplx) const {
+        npy_intp n = (npy_intp) pos.size(), d[2] = {n, rank};
+        PyArrayObject *pa = (PyArrayObject *) PyArray_SimpleNew(2, d, NPY_LONG);
+        PyArrayObject *fa = (PyArrayObject *) PyArray_SimpleNew(1, d,
+            cplx ? NPY_CDOUBLE : NPY_DOUBLE);
+        if (pa == NULL || fa == NULL) {
+            Py_XDECREF(pa); Py_XDECREF(fa);
+            return NULL;
+        }
+        long *pd = (long *) PyArray_DATA(pa);
+        double *fd = (double *) PyArray_DATA(fa);
+        for (npy_intp j=0; j < n; j++) {
+            if (rank == 2) { pd[2*j] = pos[j] / dim2; pd[2*j+1] = pos[j] % dim2; }
+            else pd[j] = pos[j];
+            if (cplx) { fd[2*j] = flux[2*j]; fd[2*j+1] = flux[2*j+1]; }
+            else fd[j] = flux[2*j];
+        }
+        return Py_BuildValue("iNN", rv, (PyObject *) pa, (PyObject *) fa);
+    }
+};
+
 // A template for implementing addition loops for different data types
 template<typename T> struct Clean {
 
+    // With stop_if_div=0, the loops below remember the best state seen so far
+    // as a log of the components (position, step) added since then, and
+    // restore it on exit by undoing those, rather than keeping full-image
+    // snapshots of mdl and res.
+
+    // Undo one component of the strided loops: mdl -= step at (a1,a2), and
+    // add ker*step back onto res shifted to (a1,a2)
+    static void undo_2d_r(PyArrayObject *res, PyArrayObject *mdl,
+            PyArrayObject *ker, int a1, int a2, T step) {
+        int dim1=DIM(res,0), dim2=DIM(res,1), wrap_n1, wrap_n2;
+        IND2(mdl,a1,a2,T) -= step;
+        for (int n1=0; n1 < dim1; n1++) {
+            wrap_n1 = (n1 + a1) % dim1;
+            for (int n2=0; n2 < dim2; n2++) {
+                wrap_n2 = (n2 + a2) % dim2;
+                IND2(res,wrap_n1,wrap_n2,T) += IND2(ker,n1,n2,T) * step;
+            }
+        }
+    }
+    static void undo_1d_r(PyArrayObject *res, PyArrayObject *mdl,
+            PyArrayObject *ker, int a, T step) {
+        int dim=DIM(res,0), wrap_n;
+        IND1(mdl,a,T) -= step;
+        for (int n=0; n < dim; n++) {
+            wrap_n = (n + a) % dim;
+            IND1(res,wrap_n,T) += IND1(ker,n,T) * step;
+        }
+    }
+    static void undo_2d_c(PyArrayObject *res, PyArrayObject *mdl,
+            PyArrayObject *ker, int a1, int a2, T stepr, T stepi) {
+        int dim1=DIM(res,0), dim2=DIM(res,1), wrap_n1, wrap_n2;
+        CIND2R(mdl,a1,a2,T) -= stepr;
+        CIND2I(mdl,a1,a2,T) -= stepi;
+        for (int n1=0; n1 < dim1; n1++) {
+            wrap_n1 = (n1 + a1) % dim1;
+            for (int n2=0; n2 < dim2; n2++) {
+                wrap_n2 = (n2 + a2) % dim2;
+                CIND2R(res,wrap_n1,wrap_n2,T) += CIND2R(ker,n1,n2,T)*stepr - CIND2I(ker,n1,n2,T)*stepi;
+                CIND2I(res,wrap_n1,wrap_n2,T) += CIND2R(ker,n1,n2,T)*stepi + CIND2I(ker,n1,n2,T)*stepr;
+            }
+        }
+    }
+    static void undo_1d_c(PyArrayObject *res, PyArrayObject *mdl,
+            PyArrayObject *ker, int a, T stepr, T stepi) {
+        int dim=DIM(res,0), wrap_n;
+        CIND1R(mdl,a,T) -= stepr;
+        CIND1I(mdl,a,T) -= stepi;
+        for (int n=0; n < dim; n++) {
+            wrap_n = (n + a) % dim;
+            CIND1R(res,wrap_n,T) += CIND1R(ker,n,T) * stepr - CIND1I(ker,n,T) * stepi;
+            CIND1I(res,wrap_n,T) += CIND1R(ker,n,T) * stepi + CIND1I(ker,n,T) * stepr;
+        }
+    }
+
     //   ____ _                  ____     _
     //  / ___| | ___  __ _ _ __ |___ \ __| |_ __
     // | |   | |/ _ \/ _` | '_ \  __) / _` | '__|
@@ -54,17 +246,16 @@ template<typename T> struct Clean {
     // Does a 2d real-valued clean
     static int clean_2d_r(PyArrayObject *res, PyArrayObject *ker,
             PyArrayObject *mdl, PyArrayObject *area, double gain, int maxiter,
-            double tol, int stop_if_div, int verb, int pos_def) {
+            double tol, int stop_if_div, int verb, int pos_def,
+            CleanHistory *hist,
+            CleanComponents *comp) {
         T score=-1, nscore, best_score=-1;
         T max=0, mmax, val, mval, step, q=0, mq=0;
         T firstscore=-1;
         int argmax1=0, argmax2=0, nargmax1=0, nargmax2=0;
         int dim1=DIM(res,0), dim2=DIM(res,1), wrap_n1, wrap_n2;
-        T *best_mdl=NULL, *best_res=NULL;
-        if (!stop_if_div) {
-            best_mdl = (T *)malloc(dim1*dim2*sizeof(T));
-            best_res = (T *)malloc(dim1*dim2*sizeof(T));
-        }
+        std::vector<long> log_pos;  // Components since the best state
+        std::vector<T> log_step;
         // Compute gain/phase of kernel
         for (int n1=0; n1 < dim1; n1++) {
             for (int n2=0; n2 < dim2; n2++) {
@@ -83,6 +274,11 @@ template<typename T> struct Clean {
             mmax = -1;
             step = (T) gain * max * q;
             IND2(mdl,argmax1,argmax2,T) += step;
+            if (comp) comp->add((long) argmax1*dim2+argmax2, step, 0);
+            if (best_score > 0) {
+                log_pos.push_back((long) argmax1*dim2+argmax2);
+                log_step.push_back(step);
+            }
             // Take next step and compute score
             for (int n1=0; n1 < dim1; n1++) {
                 wrap_n1 = (n1 + argmax1) % dim1;
@@ -101,6 +297,7 @@ template<typename T> struct Clean {
             }
             nscore = sqrt(nscore / (dim1 * dim2));
             if (firstscore < 0) firstscore = nscore;
+            if (hist) hist->add(nargmax1, nargmax2, max, (T) 0, nscore, step, (T) 0);
             if (verb != 0)
                 printf("Iter %d: Max=(%d,%d,%f), Score=%f, Prev=%f, Delta=%f\n", \
                        i, nargmax1, nargmax2, (double) max, (double) (nscore/firstscore), \
@@ -109,32 +306,19 @@ template<typename T> struct Clean {
             if (score > 0 && nscore > score) {
                 if (stop_if_div) {
                     // We've diverged: undo last step and give up
-                    IND2(mdl,argmax1,argmax2,T) -= step;
-                    for (int n1=0; n1 < dim1; n1++) {
-                        wrap_n1 = (n1 + argmax1) % dim1;
-                        for (int n2=0; n2 < dim2; n2++) {
-                            wrap_n2 = (n2 + argmax2) % dim2;
-                            IND2(res,wrap_n1,wrap_n2,T) += IND2(ker,n1,n2,T) * step;
-                        }
-                    }
+                    if (comp) comp->pop(1);
+                    undo_2d_r(res, mdl, ker, argmax1, argmax2, step);
                     return -i;
                 } else if (best_score < 0 || score < best_score) {
-                    // We've diverged: buf prev score in case it's global best
-                    for (int n1=0; n1 < dim1; n1++) {
-                        wrap_n1 = (n1 + argmax1) % dim1;
-                        for (int n2=0; n2 < dim2; n2++) {
-                            wrap_n2 = (n2 + argmax2) % dim2;
-                            best_mdl[n1*dim2+n2] = IND2(mdl,n1,n2,T);
-                            best_res[wrap_n1*dim2+wrap_n2] = IND2(res,wrap_n1,wrap_n2,T) + IND2(ker,n1,n2,T) * step;
-                        }
-                    }
-                    best_mdl[argmax1*dim2+argmax2] -= step;
+                    // We've diverged: prev state may be global best, so
+                    // log components from the last one on
+                    log_pos.assign(1, (long) argmax1*dim2+argmax2);
+                    log_step.assign(1, step);
                     best_score = score;
                     i = 0;  // Reset maxiter counter
                 }
             } else if (score > 0 && std::abs(score - nscore) / firstscore < tol) {
                 // We're done
-                if (best_mdl != NULL) { free(best_mdl); free(best_res); }
                 return i;
             } else if (not stop_if_div && (best_score < 0 || nscore < best_score)) {
                 i = 0;  // Reset maxiter counter
@@ -144,14 +328,10 @@ template<typename T> struct Clean {
         }
         // If we end on maxiter, then make sure mdl/res reflect best score
         if (best_score > 0 && best_score < nscore) {
-            for (int n1=0; n1 < dim1; n1++) {
-                for (int n2=0; n2 < dim2; n2++) {
-                    IND2(mdl,n1,n2,T) = best_mdl[n1*dim2+n2];
-                    IND2(res,n1,n2,T) = best_res[n1*dim2+n2];
-                }
-            }
+            if (comp) comp->pop(log_pos.size());
+            for (long k=(long) log_pos.size()-1; k >= 0; k--)
+                undo_2d_r(res, mdl, ker, log_pos[k] / dim2, log_pos[k] % dim2, log_step[k]);
         }
-        if (best_mdl != NULL) { free(best_mdl); free(best_res); }
         return maxiter;
     }
     //   ____ _                  _     _
@@ -162,16 +342,15 @@ template<typename T> struct Clean {
     // Does a 1d real-valued clean
     static int clean_1d_r(PyArrayObject *res, PyArrayObject *ker,
             PyArrayObject *mdl, PyArrayObject *area, double gain, int maxiter, double tol,
-            int stop_if_div, int verb, int pos_def) {
+            int stop_if_div, int verb, int pos_def,
+            CleanHistory *hist,
+            CleanComponents *comp) {
         T score=-1, nscore, best_score=-1;
         T max=0, mmax, val, mval, step, q=0, mq=0;
         T firstscore=-1;
         int argmax=0, nargmax=0, dim=DIM(res,0), wrap_n;
-        T *best_mdl=NULL, *best_res=NULL;
-        if (!stop_if_div) {
-            best_mdl = (T *)malloc(dim*sizeof(T));
-            best_res = (T *)malloc(dim*sizeof(T));
-        }
+        std::vector<long> log_pos;  // Components since the best state
+        std::vector<T> log_step;
         // Compute gain/phase of kernel
         for (int n=0; n < dim; n++) {
             val = IND1(ker,n,T);
@@ -188,6 +367,11 @@ template<typename T> struct Clean {
             mmax = -1;
             step = (T) gain * max * q;
             IND1(mdl,argmax,T) += step;
+            if (comp) comp->add(argmax, step, 0);
+            if (best_score > 0) {
+                log_pos.push_back(argmax);
+                log_step.push_back(step);
+            }
             // Take next step and compute score
             for (int n=0; n < dim; n++) {
                 wrap_n = (n + argmax) % dim;
@@ -203,6 +387,7 @@ template<typename T> struct Clean {
             }
             nscore = sqrt(nscore / dim);
             if (firstscore < 0) firstscore = nscore;
+            if (hist) hist->add(0, nargmax, max, (T) 0, nscore, step, (T) 0);
             if (verb != 0)
                 printf("Iter %d: Max=(%d), Score = %f, Prev = %f\n", \
                     i, nargmax, (double) (nscore/firstscore), \
@@ -210,26 +395,19 @@ template<typename T> struct Clean {
             if (score > 0 && nscore > score) {
                 if (stop_if_div) {
                     // We've diverged: undo last step and give up
-                    IND1(mdl,argmax,T) -= step;
-                    for (int n=0; n < dim; n++) {
-                        wrap_n = (n + argmax) % dim;
-                        IND1(res,wrap_n,T) += IND1(ker,n,T) * step;
-                    }
+                    if (comp) comp->pop(1);
+                    undo_1d_r(res, mdl, ker, argmax, step);
                     return -i;
                 } else if (best_score < 0 || score < best_score) {
-                    // We've diverged: buf prev score in case it's global best
-                    for (int n=0; n < dim; n++) {
-                        wrap_n = (n + argmax) % dim;
-                        best_mdl[n] = IND1(mdl,n,T);
-                        best_res[wrap_n] = IND1(res,wrap_n,T) + IND1(ker,n,T) * step;
-                    }
-                    best_mdl[argmax] -= step;
+                    // We've diverged: prev state may be global best, so
+                    // log components from the last one on
+                    log_pos.assign(1, argmax);
+                    log_step.assign(1, step);
                     best_score = score;
                     i = 0;  // Reset maxiter counter
                 }
             } else if (score > 0 && (score - nscore) / firstscore < tol) {
                 // We're done
-                if (best_mdl != NULL) { free(best_mdl); free(best_res); }
                 return i;
             } else if (not stop_if_div && (best_score < 0 || nscore < best_score)) {
                 i = 0;  // Reset maxiter counter
@@ -239,12 +417,10 @@ template<typename T> struct Clean {
         }
         // If we end on maxiter, then make sure mdl/res reflect best score
         if (best_score > 0 && best_score < nscore) {
-            for (int n=0; n < dim; n++) {
-                IND1(mdl,n,T) = best_mdl[n];
-                IND1(res,n,T) = best_res[n];
-            }
+            if (comp) comp->pop(log_pos.size());
+            for (long k=(long) log_pos.size()-1; k >= 0; k--)
+                undo_1d_r(res, mdl, ker, log_pos[k], log_step[k]);
         }
-        if (best_mdl != NULL) { free(best_mdl); free(best_res); }
         return maxiter;
     }
     //   ____ _                  ____     _
@@ -255,18 +431,17 @@ template<typename T> struct Clean {
     // Does a 2d complex-valued clean
     static int clean_2d_c(PyArrayObject *res, PyArrayObject *ker,
             PyArrayObject *mdl, PyArrayObject *area, double gain, int maxiter, double tol,
-            int stop_if_div, int verb, int pos_def) {
+            int stop_if_div, int verb, int pos_def,
+            CleanHistory *hist,
+            CleanComponents *comp) {
         T maxr=0, maxi=0, valr, vali, stepr, stepi, qr=0, qi=0;
         T score=-1, nscore, best_score=-1;
         T mmax, mval, mq=0;
         T firstscore=-1;
         int argmax1=0, argmax2=0, nargmax1=0, nargmax2=0;
         int dim1=DIM(res,0), dim2=DIM(res,1), wrap_n1, wrap_n2;
-        T *best_mdl=NULL, *best_res=NULL;
-        if (!stop_if_div) {
-            best_mdl = (T *)malloc(2*dim1*dim2*sizeof(T));
-            best_res = (T *)malloc(2*dim1*dim2*sizeof(T));
-        }
+        std::vector<long> log_pos;  // Components since the best state
+        std::vector<T> log_step;    // (real, imag) per component
         // Compute gain/phase of kernel
         for (int n1=0; n1 < dim1; n1++) {
             for (int n2=0; n2 < dim2; n2++) {
@@ -289,6 +464,11 @@ template<typename T> struct Clean {
             stepi = (T) gain * (maxr * qi + maxi * qr);
             CIND2R(mdl,argmax1,argmax2,T) += stepr;
             CIND2I(mdl,argmax1,argmax2,T) += stepi;
+            if (comp) comp->add((long) argmax1*dim2+argmax2, stepr, stepi);
+            if (best_score > 0) {
+                log_pos.push_back((long) argmax1*dim2+argmax2);
+                log_step.push_back(stepr); log_step.push_back(stepi);
+            }
             // Take next step and compute score
             for (int n1=0; n1 < dim1; n1++) {
                 wrap_n1 = (n1 + argmax1) % dim1;
@@ -311,6 +491,7 @@ template<typename T> struct Clean {
             }
             nscore = sqrt(nscore / (dim1 * dim2));
             if (firstscore < 0) firstscore = nscore;
+            if (hist) hist->add(nargmax1, nargmax2, maxr, maxi, nscore, stepr, stepi);
             if (verb != 0)
                 printf("Iter %d: Max=(%d,%d), Score = %f, Prev = %f\n", \
                     i, nargmax1, nargmax2, (double) (nscore/firstscore), \
@@ -318,37 +499,19 @@ template<typename T> struct Clean {
             if (score > 0 && nscore > score) {
                 if (stop_if_div) {
                     // We've diverged: undo last step and give up
-                    CIND2R(mdl,argmax1,argmax2,T) -= stepr;
-                    CIND2I(mdl,argmax1,argmax2,T) -= stepi;
-                    for (int n1=0; n1 < dim1; n1++) {
-                        wrap_n1 = (n1 + argmax1) % dim1;
-                        for (int n2=0; n2 < dim2; n2++) {
-                            wrap_n2 = (n2 + argmax2) % dim2;
-                            CIND2R(res,wrap_n1,wrap_n2,T) += CIND2R(ker,n1,n2,T)*stepr - CIND2I(ker,n1,n2,T)*stepi;
-                            CIND2I(res,wrap_n1,wrap_n2,T) += CIND2R(ker,n1,n2,T)*stepi + CIND2I(ker,n1,n2,T)*stepr;
-                        }
-                    }
+                    if (comp) comp->pop(1);
+                    undo_2d_c(res, mdl, ker, argmax1, argmax2, stepr, stepi);
                     return -i;
                 } else if (best_score < 0 || score < best_score) {
-                    // We've diverged: buf prev score in case it's global best
-                    for (int n1=0; n1 < dim1; n1++) {
-                        wrap_n1 = (n1 + argmax1) % dim1;
-                        for (int n2=0; n2 < dim2; n2++) {
-                            wrap_n2 = (n2 + argmax2) % dim2;
-                            best_mdl[2*(n1*dim2+n2)+0] = CIND2R(mdl,n1,n2,T);
-                            best_mdl[2*(n1*dim2+n2)+1] = CIND2I(mdl,n1,n2,T);
-                            best_res[2*(wrap_n1*dim2+wrap_n2)+0] = CIND2R(res,wrap_n1,wrap_n2,T) + CIND2R(ker,n1,n2,T) * stepr - CIND2I(ker,n1,n2,T) * stepi;
-                            best_res[2*(wrap_n1*dim2+wrap_n2)+1] = CIND2I(res,wrap_n1,wrap_n2,T) + CIND2R(ker,n1,n2,T) * stepi + CIND2I(ker,n1,n2,T) * stepr;
-                        }
-                    }
-                    best_mdl[2*(argmax1*dim2+argmax2)+0] -= stepr;
-                    best_mdl[2*(argmax1*dim2+argmax2)+1] -= stepi;
+                    // We've diverged: prev state may be global best, so
+                    // log components from the last one on
+                    log_pos.assign(1, (long) argmax1*dim2+argmax2);
+                    log_step.clear(); log_step.push_back(stepr); log_step.push_back(stepi);
                     best_score = score;
                     i = 0;  // Reset maxiter counter
                 }
             } else if (score > 0 && (score - nscore) / firstscore < tol) {
                 // We're done
-                if (best_mdl != NULL) { free(best_mdl); free(best_res); }
                 return i;
             } else if (not stop_if_div && (best_score < 0 || nscore < best_score)) {
                 i = 0;  // Reset maxiter counter
@@ -358,16 +521,11 @@ template<typename T> struct Clean {
         }
         // If we end on maxiter, then make sure mdl/res reflect best score
         if (best_score > 0 && best_score < nscore) {
-            for (int n1=0; n1 < dim1; n1++) {
-                for (int n2=0; n2 < dim2; n2++) {
-                    CIND2R(mdl,n1,n2,T) = best_mdl[2*(n1*dim2+n2)+0];
-                    CIND2I(mdl,n1,n2,T) = best_mdl[2*(n1*dim2+n2)+1];
-                    CIND2R(res,n1,n2,T) = best_res[2*(n1*dim2+n2)+0];
-                    CIND2I(res,n1,n2,T) = best_res[2*(n1*dim2+n2)+1];
-                }
-            }
+            if (comp) comp->pop(log_pos.size());
+            for (long k=(long) log_pos.size()-1; k >= 0; k--)
+                undo_2d_c(res, mdl, ker, log_pos[k] / dim2, log_pos[k] % dim2,
+                    log_step[2*k], log_step[2*k+1]);
         }
-        if (best_mdl != NULL) { free(best_mdl); free(best_res); }
         return maxiter;
     }
     //   ____ _                  _     _
@@ -378,17 +536,16 @@ template<typename T> struct Clean {
     // Does a 1d complex-valued clean
     static int clean_1d_c(PyArrayObject *res, PyArrayObject *ker,
             PyArrayObject *mdl, PyArrayObject *area, double gain, int maxiter, double tol,
-            int stop_if_div, int verb, int pos_def) {
+            int stop_if_div, int verb, int pos_def,
+            CleanHistory *hist,
+            CleanComponents *comp) {
         T maxr=0, maxi=0, valr, vali, stepr, stepi, qr=0, qi=0;
         T score=-1, nscore, best_score=-1;
         T mmax, mval, mq=0;
         T firstscore=-1;
         int argmax=0, nargmax=0, dim=DIM(res,0), wrap_n;
-        T *best_mdl=NULL, *best_res=NULL;
-        if (!stop_if_div) {
-            best_mdl = (T *)malloc(2*dim*sizeof(T));
-            best_res = (T *)malloc(2*dim*sizeof(T));
-        }
+        std::vector<long> log_pos;  // Components since the best state
+        std::vector<T> log_step;    // (real, imag) per component
         // Compute gain/phase of kernel
         for (int n=0; n < dim; n++) {
             valr = CIND1R(ker,n,T);
@@ -410,6 +567,11 @@ template<typename T> struct Clean {
             stepi = (T) gain * (maxr * qi + maxi * qr);
             CIND1R(mdl,argmax,T) += stepr;
             CIND1I(mdl,argmax,T) += stepi;
+            if (comp) comp->add(argmax, stepr, stepi);
+            if (best_score > 0) {
+                log_pos.push_back(argmax);
+                log_step.push_back(stepr); log_step.push_back(stepi);
+            }
             // Take next step and compute score
             for (int n=0; n < dim; n++) {
                 wrap_n = (n + argmax) % dim;
@@ -430,6 +592,7 @@ template<typename T> struct Clean {
             }
             nscore = sqrt(nscore / dim);
             if (firstscore < 0) firstscore = nscore;
+            if (hist) hist->add(0, nargmax, maxr, maxi, nscore, stepr, stepi);
             if (verb != 0)
                 printf("Iter %d: Max=(%d), Score = %f, Prev = %f\n", \
                     i, nargmax, (double) (nscore/firstscore), \
@@ -437,31 +600,19 @@ template<typename T> struct Clean {
             if (score > 0 && nscore > score) {
                 if (stop_if_div) {
                     // We've diverged: undo last step and give up
-                    CIND1R(mdl,argmax,T) -= stepr;
-                    CIND1I(mdl,argmax,T) -= stepi;
-                    for (int n=0; n < dim; n++) {
-                        wrap_n = (n + argmax) % dim;
-                        CIND1R(res,wrap_n,T) += CIND1R(ker,n,T) * stepr - CIND1I(ker,n,T) * stepi;
-                        CIND1I(res,wrap_n,T) += CIND1R(ker,n,T) * stepi + CIND1I(ker,n,T) * stepr;
-                    }
+                    if (comp) comp->pop(1);
+                    undo_1d_c(res, mdl, ker, argmax, stepr, stepi);
                     return -i;
                 } else if (best_score < 0 || score < best_score) {
-                    // We've diverged: buf prev score in case it's global best
-                    for (int n=0; n < dim; n++) {
-                        wrap_n = (n + argmax) % dim;
-                        best_mdl[2*n+0] = CIND1R(mdl,n,T);
-                        best_mdl[2*n+1] = CIND1I(mdl,n,T);
-                        best_res[2*wrap_n+0] = CIND1R(res,wrap_n,T) + CIND1R(ker,n,T) * stepr - CIND1I(ker,n,T) * stepi;
-                        best_res[2*wrap_n+1] = CIND1I(res,wrap_n,T) + CIND1R(ker,n,T) * stepi + CIND1I(ker,n,T) * stepr;
-                    }
-                    best_mdl[2*argmax+0] -= stepr;
-                    best_mdl[2*argmax+1] -= stepi;
+                    // We've diverged: prev state may be global best, so
+                    // log components from the last one on
+                    log_pos.assign(1, argmax);
+                    log_step.clear(); log_step.push_back(stepr); log_step.push_back(stepi);
                     best_score = score;
                     i = 0;  // Reset maxiter counter
                 }
             } else if (score > 0 && (score - nscore) / firstscore < tol) {
                 // We're done
-                if (best_mdl != NULL) { free(best_mdl); free(best_res); }
                 return i;
             } else if (not stop_if_div && (best_score < 0 || nscore < best_score)) {
                 i = 0;  // Reset maxiter counter
@@ -471,121 +622,2321 @@ template<typename T> struct Clean {
         }
         // If we end on maxiter, then make sure mdl/res reflect best score
         if (best_score > 0 && best_score < nscore) {
-            for (int n=0; n < dim; n++) {
-                CIND1R(mdl,n,T) = best_mdl[2*n+0];
-                CIND1I(mdl,n,T) = best_mdl[2*n+1];
-                CIND1R(res,n,T) = best_res[2*n+0];
-                CIND1I(res,n,T) = best_res[2*n+1];
-            }
+            if (comp) comp->pop(log_pos.size());
+            for (long k=(long) log_pos.size()-1; k >= 0; k--)
+                undo_1d_c(res, mdl, ker, log_pos[k], log_step[2*k], log_step[2*k+1]);
         }
-        if (best_mdl != NULL) { free(best_mdl); free(best_res); }
         return maxiter;
     }
-};  // END TEMPLATE
-
-// __        __
-// \ \      / / __ __ _ _ __  _ __   ___ _ __
-//  \ \ /\ / / '__/ _` | '_ \| '_ \ / _ \ '__|
-//   \ V  V /| | | (_| | |_) | |_) |  __/ |
-//    \_/\_/ |_|  \__,_| .__/| .__/ \___|_|
-//                     |_|   |_|
+    //   ____            _   _
+    //  / ___|___  _ __ | |_(_) __ _
+    // | |   / _ \| '_ \| __| |/ _` |
+    // | |__| (_) | | | | |_| | (_| |
+    //  \____\___/|_| |_|\__|_|\__, |
+    //                         |___/
+    // Fast paths for C-contiguous arrays.  1d data is handled as a single
+    // row (dim1 = 1).  The kernel is always traversed in memory order, and
+    // each row of the residual is split at the wrap boundary so that no
+    // modulo is needed per pixel.  Results match the strided loops above
+    // exactly, since the order of operations is unchanged.
 
-// Clean wrapper that handles all different data types and dimensions
-PyObject *clean(PyObject *self, PyObject *args, PyObject *kwargs) {
-    PyArrayObject *res, *ker, *mdl, *area;
-    double gain=.1, tol=.001;
-    int maxiter=200, rank=0, dim1, dim2, rv, stop_if_div=0, verb=0, pos_def=0;
-    static char const *kwlist[] = {"res", "ker", "mdl", "area", "gain", \
-                             "maxiter", "tol", "stop_if_div", "verbose","pos_def", NULL};
-    // Parse arguments and perform sanity check
-    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O!O!O!O!|didiii", (char **) kwlist, \
-            &PyArray_Type, &res, &PyArray_Type, &ker, &PyArray_Type, &mdl, &PyArray_Type, &area,
-            &gain, &maxiter, &tol, &stop_if_div, &verb, &pos_def))
-        return NULL;
-    if (RANK(res) == 1) {
-        rank = 1;
-        CHK_ARRAY_RANK(ker, 1); CHK_ARRAY_RANK(mdl, 1); CHK_ARRAY_RANK(area, 1);
-        dim1 = DIM(res,0);
-        CHK_ARRAY_DIM(ker, 0, dim1); CHK_ARRAY_DIM(mdl, 0, dim1); CHK_ARRAY_DIM(area, 0, dim1);
-    } else if (RANK(res) == 2) {
-        rank = 2;
-        CHK_ARRAY_RANK(ker, 2); CHK_ARRAY_RANK(mdl, 2); CHK_ARRAY_RANK(area, 2);
-        dim1 = DIM(res,0); dim2 = DIM(res,1);
-        CHK_ARRAY_DIM(ker, 0, dim1); CHK_ARRAY_DIM(mdl, 0, dim1); CHK_ARRAY_DIM(area, 0, dim1);
-        CHK_ARRAY_DIM(ker, 1, dim2); CHK_ARRAY_DIM(mdl, 1, dim2); CHK_ARRAY_DIM(area, 1, dim2);
+    // res(shifted by a1,a2) += ker * step; elementwise, so order is free
+    static void shift_add_r(T *res, const T *ker, int dim1, int dim2,
+            int a1, int a2, T step) {
+        for (int n1=0; n1 < dim1; n1++) {
+            int r1 = n1 + a1; if (r1 >= dim1) r1 -= dim1;
+            T *rrow = res + (long) r1*dim2;
+            const T *krow = ker + (long) n1*dim2;
+            for (int n2=0; n2 < dim2 - a2; n2++) rrow[n2+a2] += krow[n2] * step;
+            for (int n2=dim2 - a2; n2 < dim2; n2++) rrow[n2+a2-dim2] += krow[n2] * step;
+        }
     }
-    if (TYPE(res) != TYPE(ker) || TYPE(res) != TYPE(mdl)) {
-        PyErr_Format(PyExc_ValueError, "array types must match");
-        return NULL;
+    static void shift_add_c(T *res, const T *ker, int dim1, int dim2,
+            int a1, int a2, T stepr, T stepi) {
+        for (int n1=0; n1 < dim1; n1++) {
+            int r1 = n1 + a1; if (r1 >= dim1) r1 -= dim1;
+            T *rrow = res + 2L*r1*dim2;
+            const T *krow = ker + 2L*n1*dim2;
+            for (int n2=0; n2 < dim2; n2++) {
+                T *r = rrow + 2*(n2 < dim2 - a2 ? n2 + a2 : n2 + a2 - dim2);
+                r[0] += krow[2*n2+0] * stepr - krow[2*n2+1] * stepi;
+                r[1] += krow[2*n2+0] * stepi + krow[2*n2+1] * stepr;
+            }
+        }
     }
-    if (TYPE(area) != NPY_LONG) {
-        PyErr_Format(PyExc_ValueError, "area must by of type 'int'");
-        return NULL;
+    // One clean step on a run of n pixels: res -= step*ker, accumulating the
+    // sum of squares into nscore and tracking the masked argmax.  base is the
+    // flat index of res[0].
+    static inline void sub_run_r(T *res, const T *ker, const char *mask,
+            int n, T step, int pos_def, long base, T &nscore, long &nargmax,
+            T &max, T &mmax) {
+        T val, mval;
+        for (int k=0; k < n; k++) {
+            res[k] -= ker[k] * step;
+            val = res[k];
+            mval = val * val;
+            nscore += mval;
+            if (mval > mmax && (pos_def == 0 || val > 0) && mask[k]) {
+                nargmax = base + k;
+                max = val;
+                mmax = mval;
+            }
+        }
     }
-    Py_INCREF(res); Py_INCREF(ker); Py_INCREF(mdl);
-    // Use template to implement data loops for all data types
-    if (TYPE(res) == NPY_FLOAT) {
-        if (rank == 1) {
-            rv = Clean<float>::clean_1d_r(res,ker,mdl,area,gain,maxiter,tol,stop_if_div,verb,pos_def);
-        } else {
-            rv = Clean<float>::clean_2d_r(res,ker,mdl,area,gain,maxiter,tol,stop_if_div,verb,pos_def);
+    static inline void sub_run_c(T *res, const T *ker, const char *mask,
+            int n, T stepr, T stepi, long base, T &nscore, long &nargmax,
+            T &maxr, T &maxi, T &mmax) {
+        T valr, vali, mval;
+        for (int k=0; k < n; k++) {
+            res[2*k+0] -= ker[2*k+0] * stepr - ker[2*k+1] * stepi;
+            res[2*k+1] -= ker[2*k+0] * stepi + ker[2*k+1] * stepr;
+            valr = res[2*k+0];
+            vali = res[2*k+1];
+            mval = valr * valr + vali * vali;
+            nscore += mval;
+            if (mval > mmax && mask[k]) {
+                nargmax = base + k;
+                maxr = valr; maxi = vali;
+                mmax = mval;
+            }
         }
-    } else if (TYPE(res) == NPY_DOUBLE) {
-        if (rank == 1) {
-            rv = Clean<double>::clean_1d_r(res,ker,mdl,area,gain,maxiter,tol,stop_if_div,verb,pos_def);
-        } else {
-            rv = Clean<double>::clean_2d_r(res,ker,mdl,area,gain,maxiter,tol,stop_if_div,verb,pos_def);
+    }
+    // sub_run_r/c without the peak search, for sparse masks
+    static inline void sub_only_r(T *res, const T *ker, int n, T step, T &nscore) {
+        for (int k=0; k < n; k++) {
+            res[k] -= ker[k] * step;
+            nscore += res[k] * res[k];
         }
-    } else if (TYPE(res) == NPY_LONGDOUBLE) {
-        if (rank == 1) {
-            rv = Clean<long double>::clean_1d_r(res,ker,mdl,area,gain,maxiter,tol,stop_if_div,verb,pos_def);
-        } else {
-            rv = Clean<long double>::clean_2d_r(res,ker,mdl,area,gain,maxiter,tol,stop_if_div,verb,pos_def);
+    }
+    static inline void sub_only_c(T *res, const T *ker, int n, T stepr, T stepi,
+            T &nscore) {
+        for (int k=0; k < n; k++) {
+            res[2*k+0] -= ker[2*k+0] * stepr - ker[2*k+1] * stepi;
+            res[2*k+1] -= ker[2*k+0] * stepi + ker[2*k+1] * stepr;
+            nscore += res[2*k+0] * res[2*k+0] + res[2*k+1] * res[2*k+1];
         }
-    } else if (TYPE(res) == NPY_CFLOAT) {
-        if (rank == 1) {
-            rv = Clean<float>::clean_1d_c(res,ker,mdl,area,gain,maxiter,tol,stop_if_div,verb,pos_def);
-        } else {
-            rv = Clean<float>::clean_2d_c(res,ker,mdl,area,gain,maxiter,tol,stop_if_div,verb,pos_def);
+    }
+    // Peak search over the pixels of a SparseMask, visiting them in the same
+    // order as step_r/step_c do (rows from a1, each row from column a2), so
+    // ties break the same way
+    static void sparse_max(const T *res, const SparseMask &sp, int cplx,
+            int dim1, int dim2, int a1, int a2, int pos_def, long &nargmax,
+            T &maxr, T &maxi) {
+        T mmax = -1, valr, vali = 0, mval;
+        const long *idx = sp.idx.data();
+        for (int n1=0; n1 < dim1; n1++) {
+            int r1 = n1 + a1; if (r1 >= dim1) r1 -= dim1;
+            const long *b = idx + sp.row[r1], *e = idx + sp.row[r1+1];
+            if (b == e) continue;
+            const long *m = std::lower_bound(b, e, (long) r1*dim2 + a2);
+            for (int part=0; part < 2; part++) {
+                const long *p = part ? b : m, *pe = part ? m : e;
+                for (; p < pe; p++) {
+                    if (cplx) {
+                        valr = res[2 * *p]; vali = res[2 * *p + 1];
+                        mval = valr * valr + vali * vali;
+                    } else {
+                        valr = res[*p];
+                        mval = valr * valr;
+                    }
+                    if (mval > mmax && (pos_def == 0 || valr > 0)) {
+                        nargmax = *p;
+                        maxr = valr; maxi = vali;
+                        mmax = mval;
+                    }
+                }
+            }
         }
-    } else if (TYPE(res) == NPY_CDOUBLE) {
-        if (rank == 1) {
-            rv = Clean<double>::clean_1d_c(res,ker,mdl,area,gain,maxiter,tol,stop_if_div,verb,pos_def);
-        } else {
-            rv = Clean<double>::clean_2d_c(res,ker,mdl,area,gain,maxiter,tol,stop_if_div,verb,pos_def);
+    }
+    // A full clean step over the (shifted) image.  If simd is given, it
+    // replaces sub_run_r; for complex data it needs lmask, a copy of mask
+    // with one byte per real/imaginary lane.  With a SparseMask sp, res is
+    // updated densely and the peak is searched for over sp only.
+    static T step_r(T *res, const T *ker, const char *mask, int dim1, int dim2,
+            int a1, int a2, T step, int pos_def, long &nargmax, T &max,
+            typename CleanSimd<T>::run_r_t simd, const SparseMask *sp) {
+        T nscore = 0, mmax = -1;
+        typename CleanSimd<T>::run_r_t run = simd ? simd : sub_run_r;
+        if (sp) {
+            const char *z = sp->zeros.data();
+            long na = 0; T ma = 0, mm = -1, unused = 0;
+            for (int n1=0; n1 < dim1; n1++) {
+                int r1 = n1 + a1; if (r1 >= dim1) r1 -= dim1;
+                long rbase = (long) r1*dim2;
+                const T *krow = ker + (long) n1*dim2;
+                if (simd) {
+                    simd(res+rbase+a2, krow, z, dim2-a2, step, pos_def, 0, nscore, na, ma, mm);
+                    simd(res+rbase, krow+dim2-a2, z, a2, step, pos_def, 0, nscore, na, ma, mm);
+                } else {
+                    sub_only_r(res+rbase+a2, krow, dim2-a2, step, nscore);
+                    sub_only_r(res+rbase, krow+dim2-a2, a2, step, nscore);
+                }
+            }
+            sparse_max(res, *sp, 0, dim1, dim2, a1, a2, pos_def, nargmax, max, unused);
+            return nscore;
         }
-    } else if (TYPE(res) == NPY_CLONGDOUBLE) {
-        if (rank == 1) {
-            rv = Clean<long double>::clean_1d_c(res,ker,mdl,area,gain,maxiter,tol,stop_if_div,verb,pos_def);
-        } else {
-            rv = Clean<long double>::clean_2d_c(res,ker,mdl,area,gain,maxiter,tol,stop_if_div,verb,pos_def);
+        for (int n1=0; n1 < dim1; n1++) {
+            int r1 = n1 + a1; if (r1 >= dim1) r1 -= dim1;
+            long rbase = (long) r1*dim2;
+            const T *krow = ker + (long) n1*dim2;
+            run(res+rbase+a2, krow, mask+rbase+a2, dim2-a2, step,
+                pos_def, rbase+a2, nscore, nargmax, max, mmax);
+            run(res+rbase, krow+dim2-a2, mask+rbase, a2, step,
+                pos_def, rbase, nscore, nargmax, max, mmax);
         }
-    } else {
-        PyErr_Format(PyExc_ValueError, "Unsupported data type.");
-        return NULL;
+        return nscore;
     }
-    Py_DECREF(res); Py_DECREF(ker); Py_DECREF(mdl);
-    return Py_BuildValue("i", rv);
-}
-
-// Wrap function into module
-static PyMethodDef DeconvMethods[] = {
-    {"clean", (PyCFunction)clean, METH_VARARGS|METH_KEYWORDS,
-        "clean(res,ker,mdl,gain=.1,maxiter=200,tol=.001,stop_if_div=0,verbose=0,pos_def=0)\nPerform a 1 or 2 dimensional deconvolution using the CLEAN algorithm.."},
-    {NULL, NULL}
-};
-
-MOD_INIT(_deconv) {
-    PyObject* m;
-
-    Py_Initialize();
+    static T step_c(T *res, const T *ker, const char *mask, const char *lmask,
+            int dim1, int dim2, int a1, int a2, T stepr, T stepi,
+            long &nargmax, T &maxr, T &maxi, typename CleanSimd<T>::run_c_t simd,
+            const SparseMask *sp) {
+        T nscore = 0, mmax = -1;
+        typename CleanSimd<T>::run_c_t run = simd;
+        if (!simd || !lmask) { run = sub_run_c; lmask = NULL; }
+        if (sp) {
+            const char *z = sp->zeros.data();
+            long na = 0; T mr = 0, mi = 0, mm = -1;
+            for (int n1=0; n1 < dim1; n1++) {
+                int r1 = n1 + a1; if (r1 >= dim1) r1 -= dim1;
+                long rbase = (long) r1*dim2;
+                const T *krow = ker + 2L*n1*dim2;
+                if (lmask) {
+                    run(res+2*(rbase+a2), krow, z, dim2-a2, stepr, stepi, 0, nscore, na, mr, mi, mm);
+                    run(res+2*rbase, krow+2*(dim2-a2), z, a2, stepr, stepi, 0, nscore, na, mr, mi, mm);
+                } else {
+                    sub_only_c(res+2*(rbase+a2), krow, dim2-a2, stepr, stepi, nscore);
+                    sub_only_c(res+2*rbase, krow+2*(dim2-a2), a2, stepr, stepi, nscore);
+                }
+            }
+            sparse_max(res, *sp, 1, dim1, dim2, a1, a2, 0, nargmax, maxr, maxi);
+            return nscore;
+        }
+        for (int n1=0; n1 < dim1; n1++) {
+            int r1 = n1 + a1; if (r1 >= dim1) r1 -= dim1;
+            long rbase = (long) r1*dim2;
+            const T *krow = ker + 2L*n1*dim2;
+            run(res+2*(rbase+a2), krow,
+                lmask ? lmask+2*(rbase+a2) : mask+rbase+a2, dim2-a2, stepr,
+                stepi, rbase+a2, nscore, nargmax, maxr, maxi, mmax);
+            run(res+2*rbase, krow+2*(dim2-a2),
+                lmask ? lmask+2*rbase : mask+rbase, a2, stepr,
+                stepi, rbase, nscore, nargmax, maxr, maxi, mmax);
+        }
+        return nscore;
+    }
+    // Does a contiguous 1d or 2d real-valued clean
+    static int clean_r_contig(T *res, const T *ker, T *mdl, const char *mask,
+            int dim1, int dim2, int rank, double gain, int maxiter, double tol,
+            int stop_if_div, int verb, int pos_def,
+            CleanHistory *hist,
+            CleanComponents *comp) {
+        T score=-1, nscore, best_score=-1;
+        T max=0, val, mval, step, q=0, mq=0;
+        T firstscore=-1;
+        long argmax=0, nargmax=0, npix=(long) dim1*dim2;
+        std::vector<long> log_pos;  // Components since the best state
+        std::vector<T> log_step;
+        typename CleanSimd<T>::run_r_t simd = CleanSimd<T>::run_r;
+        SparseMask sp;
+        const SparseMask *sparse = sp.init(mask, dim1, dim2, 0) ? &sp : NULL;
+        // Compute gain/phase of kernel
+        for (long n=0; n < npix; n++) {
+            val = ker[n];
+            mval = val * val;
+            if (mval > mq && mask[n]) {
+                mq = mval;
+                q = val;
+            }
+        }
+        q = 1/q;
+        // The clean loop
+        for (int i=0; i < maxiter; i++) {
+            step = (T) gain * max * q;
+            mdl[argmax] += step;
+            if (comp) comp->add(argmax, step, 0);
+            if (best_score > 0) {
+                log_pos.push_back(argmax);
+                log_step.push_back(step);
+            }
+            // Take next step and compute score
+            nscore = step_r(res, ker, mask, dim1, dim2, argmax / dim2,
+                argmax % dim2, step, pos_def, nargmax, max, simd, sparse);
+            nscore = sqrt(nscore / npix);
+            if (firstscore < 0) firstscore = nscore;
+            if (hist) hist->add(nargmax / dim2, nargmax % dim2, max, (T) 0, nscore, step, (T) 0);
+            if (verb != 0 && rank == 2)
+                printf("Iter %d: Max=(%ld,%ld,%f), Score=%f, Prev=%f, Delta=%f\n", \
+                       i, nargmax / dim2, nargmax % dim2, (double) max, (double) (nscore/firstscore), \
+                    (double) (score/firstscore),
+                       (double) (std::abs(score - nscore) / firstscore));
+            else if (verb != 0)
+                printf("Iter %d: Max=(%ld), Score = %f, Prev = %f\n", \
+                    i, nargmax, (double) (nscore/firstscore), \
+                    (double) (score/firstscore));
+            if (score > 0 && nscore > score) {
+                if (stop_if_div) {
+                    // We've diverged: undo last step and give up
+                    if (comp) comp->pop(1);
+                    mdl[argmax] -= step;
+                    shift_add_r(res, ker, dim1, dim2, argmax / dim2, argmax % dim2, step);
+                    return -i;
+                } else if (best_score < 0 || score < best_score) {
+                    // We've diverged: prev state may be global best, so
+                    // log components from the last one on
+                    log_pos.assign(1, argmax);
+                    log_step.assign(1, step);
+                    best_score = score;
+                    i = 0;  // Reset maxiter counter
+                }
+            } else if (score > 0 && std::abs(score - nscore) / firstscore < tol) {
+                // We're done
+                return i;
+            } else if (not stop_if_div && (best_score < 0 || nscore < best_score)) {
+                i = 0;  // Reset maxiter counter
+            }
+            score = nscore;
+            argmax = nargmax;
+        }
+        // If we end on maxiter, then make sure mdl/res reflect best score
+        if (best_score > 0 && best_score < nscore) {
+            if (comp) comp->pop(log_pos.size());
+            for (long k=(long) log_pos.size()-1; k >= 0; k--) {
+                mdl[log_pos[k]] -= log_step[k];
+                shift_add_r(res, ker, dim1, dim2, log_pos[k] / dim2, log_pos[k] % dim2, log_step[k]);
+            }
+        }
+        return maxiter;
+    }
+    // Does a contiguous 1d or 2d complex-valued clean
+    static int clean_c_contig(T *res, const T *ker, T *mdl, const char *mask,
+            int dim1, int dim2, int rank, double gain, int maxiter, double tol,
+            int stop_if_div, int verb, int pos_def,
+            CleanHistory *hist,
+            CleanComponents *comp) {
+        T maxr=0, maxi=0, valr, vali, stepr, stepi, qr=0, qi=0;
+        T score=-1, nscore, best_score=-1;
+        T mval, mq=0;
+        T firstscore=-1;
+        long argmax=0, nargmax=0, npix=(long) dim1*dim2;
+        std::vector<long> log_pos;  // Components since the best state
+        std::vector<T> log_step;    // (real, imag) per component
+        char *lmask=NULL;
+        typename CleanSimd<T>::run_c_t simd = CleanSimd<T>::run_c;
+        SparseMask sp;
+        const SparseMask *sparse = sp.init(mask, dim1, dim2, 1) ? &sp : NULL;
+        if (simd && dim1 > 0 && dim2 > 0 &&
+                (lmask = (char *)malloc((size_t) 2 * (size_t) npix)) != NULL) {
+            for (long n=0; n < npix; n++) lmask[2*n] = lmask[2*n+1] = mask[n];
+        }
+        // Compute gain/phase of kernel
+        for (long n=0; n < npix; n++) {
+            valr = ker[2*n+0];
+            vali = ker[2*n+1];
+            mval = valr * valr + vali * vali;
+            if (mval > mq && mask[n]) {
+                mq = mval;
+                qr = valr; qi = vali;
+            }
+        }
+        qr /= mq;
+        qi = -qi / mq;
+        // The clean loop
+        for (int i=0; i < maxiter; i++) {
+            stepr = (T) gain * (maxr * qr - maxi * qi);
+            stepi = (T) gain * (maxr * qi + maxi * qr);
+            mdl[2*argmax+0] += stepr;
+            mdl[2*argmax+1] += stepi;
+            if (comp) comp->add(argmax, stepr, stepi);
+            if (best_score > 0) {
+                log_pos.push_back(argmax);
+                log_step.push_back(stepr); log_step.push_back(stepi);
+            }
+            // Take next step and compute score
+            nscore = step_c(res, ker, mask, lmask, dim1, dim2, argmax / dim2,
+                argmax % dim2, stepr, stepi, nargmax, maxr, maxi, simd, sparse);
+            nscore = sqrt(nscore / npix);
+            if (firstscore < 0) firstscore = nscore;
+            if (hist) hist->add(nargmax / dim2, nargmax % dim2, maxr, maxi, nscore, stepr, stepi);
+            if (verb != 0 && rank == 2)
+                printf("Iter %d: Max=(%ld,%ld), Score = %f, Prev = %f\n", \
+                    i, nargmax / dim2, nargmax % dim2, (double) (nscore/firstscore), \
+                    (double) (score/firstscore));
+            else if (verb != 0)
+                printf("Iter %d: Max=(%ld), Score = %f, Prev = %f\n", \
+                    i, nargmax, (double) (nscore/firstscore), \
+                    (double) (score/firstscore));
+            if (score > 0 && nscore > score) {
+                if (stop_if_div) {
+                    // We've diverged: undo last step and give up
+                    if (comp) comp->pop(1);
+                    mdl[2*argmax+0] -= stepr;
+                    mdl[2*argmax+1] -= stepi;
+                    shift_add_c(res, ker, dim1, dim2, argmax / dim2, argmax % dim2, stepr, stepi);
+                    free(lmask);
+                    return -i;
+                } else if (best_score < 0 || score < best_score) {
+                    // We've diverged: prev state may be global best, so
+                    // log components from the last one on
+                    log_pos.assign(1, argmax);
+                    log_step.clear(); log_step.push_back(stepr); log_step.push_back(stepi);
+                    best_score = score;
+                    i = 0;  // Reset maxiter counter
+                }
+            } else if (score > 0 && (score - nscore) / firstscore < tol) {
+                // We're done
+                free(lmask);
+                return i;
+            } else if (not stop_if_div && (best_score < 0 || nscore < best_score)) {
+                i = 0;  // Reset maxiter counter
+            }
+            score = nscore;
+            argmax = nargmax;
+        }
+        // If we end on maxiter, then make sure mdl/res reflect best score
+        if (best_score > 0 && best_score < nscore) {
+            if (comp) comp->pop(log_pos.size());
+            for (long k=(long) log_pos.size()-1; k >= 0; k--) {
+                mdl[2*log_pos[k]+0] -= log_step[2*k];
+                mdl[2*log_pos[k]+1] -= log_step[2*k+1];
+                shift_add_c(res, ker, dim1, dim2, log_pos[k] / dim2, log_pos[k] % dim2,
+                    log_step[2*k], log_step[2*k+1]);
+            }
+        }
+        free(lmask);
+        return maxiter;
+    }
+    //  ____       _       _     ____     _
+    // |  _ \ __ _| |_ ___| |__ |___ \ __| |
+    // | |_) / _` | __/ __| '_ \  __) / _` |
+    // |  __/ (_| | || (__| | | |/ __/ (_| |
+    // |_|   \__,_|\__\___|_| |_|_____\__,_|
+    // Beam-patch cleans for C-contiguous arrays.  Each step subtracts only the
+    // (2*p1+1) x (2*p2+1) box of ker around its origin, and the peak and score
+    // are kept incrementally in per-segment and per-row (max, argmax, sum of
+    // squares) tables: only segments the patch touched are rescanned, then
+    // only their rows are re-reduced, then the rows are reduced to a peak.
+    // These loops also stop once the peak falls below thresh (if > 0), as a
+    // Clark minor cycle does.
 
-    // Module definitions and functions
-    MOD_DEF(m, "_deconv", DeconvMethods, "Deconvolution module");
-    if (m == NULL)
-        return MOD_ERROR_VAL;
+    struct PatchState {
+        int dim1, dim2, nseg, p1, p2;
+        std::vector<T> segmax, segsum, rowmax, rowsum;
+        std::vector<long> segarg, rowarg;
+        std::vector<char> dirty;
+    };
+    enum { PATCH_SEG = 64 };
 
-    import_array();
+    // Half-widths of the patch: beam_patch >= 1 is a radius in pixels;
+    // otherwise it is a threshold relative to the kernel peak and the patch
+    // is the smallest box holding every pixel with |ker| >= beam_patch*peak.
+    // A half-width covering the whole axis is clipped to avoid overlap.
+    static void patch_radius(const T *ker, int dim1, int dim2, int cplx,
+            double beam_patch, int &p1, int &p2) {
+        long npix = (long) dim1*dim2;
+        if (beam_patch >= 1) {
+            p1 = p2 = (int) beam_patch;
+        } else {
+            T peak = 0, thr, m;
+            for (long n=0; n < npix; n++) {
+                m = cplx ? ker[2*n]*ker[2*n] + ker[2*n+1]*ker[2*n+1] : ker[n]*ker[n];
+                if (m > peak) peak = m;
+            }
+            thr = (T) (beam_patch * beam_patch) * peak;
+            p1 = p2 = 0;
+            for (int n1=0; n1 < dim1; n1++) {
+                for (int n2=0; n2 < dim2; n2++) {
+                    long n = (long) n1*dim2 + n2;
+                    m = cplx ? ker[2*n]*ker[2*n] + ker[2*n+1]*ker[2*n+1] : ker[n]*ker[n];
+                    if (m < thr) continue;
+                    p1 = std::max(p1, std::min(n1, dim1 - n1));
+                    p2 = std::max(p2, std::min(n2, dim2 - n2));
+                }
+            }
+        }
+        if (2*p1+1 >= dim1) p1 = -1;  // -1 flags "whole axis"
+        if (2*p2+1 >= dim2) p2 = -1;
+    }
+    // Range of kernel offsets along an axis of length dim with half-width p
+    static inline void patch_range(int p, int dim, int &lo, int &hi) {
+        if (p < 0) { lo = 0; hi = dim - 1; } else { lo = -p; hi = p; }
+    }
+    static inline int wrap(int n, int dim) {
+        return n < 0 ? n + dim : (n >= dim ? n - dim : n);
+    }
+    // res(shifted by a1,a2) += ker * step over the patch; marks touched segments
+    static void patch_add(PatchState &ps, T *res, const T *ker, int cplx,
+            int a1, int a2, T stepr, T stepi) {
+        int lo1, hi1, lo2, hi2, dim1=ps.dim1, dim2=ps.dim2;
+        patch_range(ps.p1, dim1, lo1, hi1);
+        patch_range(ps.p2, dim2, lo2, hi2);
+        for (int o1=lo1; o1 <= hi1; o1++) {
+            int r1 = wrap(a1 + o1, dim1), k1 = wrap(o1, dim1);
+            for (int o2=lo2; o2 <= hi2; o2++) {
+                int r2 = wrap(a2 + o2, dim2), k2 = wrap(o2, dim2);
+                long r = (long) r1*dim2 + r2, k = (long) k1*dim2 + k2;
+                if (cplx) {
+                    res[2*r+0] += ker[2*k+0] * stepr - ker[2*k+1] * stepi;
+                    res[2*r+1] += ker[2*k+0] * stepi + ker[2*k+1] * stepr;
+                } else {
+                    res[r] += ker[k] * stepr;
+                }
+                if (!ps.dirty.empty()) ps.dirty[(long) r1*ps.nseg + r2/PATCH_SEG] = 1;
+            }
+        }
+    }
+    // Rescan one segment of one row
+    static void patch_scan_seg(PatchState &ps, const T *res, const char *mask,
+            int cplx, int pos_def, int r1, int s) {
+        long base = (long) r1*ps.dim2, k = (long) r1*ps.nseg + s;
+        int end = std::min(ps.dim2, (s+1)*(int) PATCH_SEG);
+        T sum = 0, mmax = -1, mval;
+        long arg = -1;
+        for (int n2=s*PATCH_SEG; n2 < end; n2++) {
+            long n = base + n2;
+            if (cplx) mval = res[2*n]*res[2*n] + res[2*n+1]*res[2*n+1];
+            else mval = res[n]*res[n];
+            sum += mval;
+            if (mval > mmax && (cplx || pos_def == 0 || res[n] > 0) && mask[n]) {
+                mmax = mval;
+                arg = n;
+            }
+        }
+        ps.segmax[k] = mmax; ps.segarg[k] = arg; ps.segsum[k] = sum;
+    }
+    // Re-reduce the segments of row r1 (rescanning the dirty ones)
+    static void patch_scan_row(PatchState &ps, const T *res, const char *mask,
+            int cplx, int pos_def, int r1) {
+        T sum = 0, mmax = -1;
+        long arg = -1;
+        for (int s=0; s < ps.nseg; s++) {
+            long k = (long) r1*ps.nseg + s;
+            if (ps.dirty[k]) {
+                patch_scan_seg(ps, res, mask, cplx, pos_def, r1, s);
+                ps.dirty[k] = 0;
+            }
+            sum += ps.segsum[k];
+            if (ps.segmax[k] > mmax) { mmax = ps.segmax[k]; arg = ps.segarg[k]; }
+        }
+        ps.rowmax[r1] = mmax; ps.rowarg[r1] = arg; ps.rowsum[r1] = sum;
+    }
+    static void patch_init(PatchState &ps, const T *ker, int dim1, int dim2,
+            int cplx, double beam_patch) {
+        ps.dim1 = dim1; ps.dim2 = dim2;
+        ps.nseg = (dim2 + PATCH_SEG - 1) / PATCH_SEG;
+        patch_radius(ker, dim1, dim2, cplx, beam_patch, ps.p1, ps.p2);
+        long n = (long) dim1*ps.nseg;
+        ps.segmax.assign(n, -1); ps.segsum.assign(n, 0); ps.segarg.assign(n, -1);
+        ps.dirty.assign(n, 1);
+        ps.rowmax.assign(dim1, -1); ps.rowsum.assign(dim1, 0); ps.rowarg.assign(dim1, -1);
+    }
+    // Subtract the patch, refresh the touched rows and return the sum of
+    // squares of the residual; nargmax is left alone if nothing is unmasked.
+    static T patch_step(PatchState &ps, T *res, const T *ker, const char *mask,
+            int cplx, int pos_def, int a1, int a2, T stepr, T stepi,
+            long &nargmax) {
+        int lo1, hi1;
+        T nscore = 0, mmax = -1;
+        patch_add(ps, res, ker, cplx, a1, a2, -stepr, -stepi);
+        patch_range(ps.p1, ps.dim1, lo1, hi1);
+        for (int o1=lo1; o1 <= hi1; o1++)
+            patch_scan_row(ps, res, mask, cplx, pos_def, wrap(a1 + o1, ps.dim1));
+        for (int r1=0; r1 < ps.dim1; r1++) {
+            nscore += ps.rowsum[r1];
+            if (ps.rowmax[r1] > mmax) { mmax = ps.rowmax[r1]; nargmax = ps.rowarg[r1]; }
+        }
+        return nscore;
+    }
+    // Does a contiguous 1d or 2d real-valued clean with a beam patch
+    static int clean_r_patch(T *res, const T *ker, T *mdl, const char *mask,
+            int dim1, int dim2, int rank, double beam_patch, double gain,
+            int maxiter, double tol, double thresh, int stop_if_div, int verb,
+            int pos_def, CleanHistory *hist,
+            CleanComponents *comp) {
+        T score=-1, nscore, best_score=-1;
+        T max=0, val, mval, step, q=0, mq=0;
+        T firstscore=-1;
+        long argmax=0, nargmax=0, npix=(long) dim1*dim2;
+        std::vector<long> log_pos;  // Components since the best state
+        std::vector<T> log_step;
+        T thr2 = (T) (thresh * thresh);
+        PatchState ps, undo;
+        patch_init(ps, ker, dim1, dim2, 0, beam_patch);
+        undo.dim1 = dim1; undo.dim2 = dim2; undo.p1 = ps.p1; undo.p2 = ps.p2;
+        for (int r1=0; r1 < dim1; r1++) patch_scan_row(ps, res, mask, 0, pos_def, r1);
+        // Compute gain/phase of kernel, from its peak wherever the mask is
+        for (long n=0; n < npix; n++) {
+            val = ker[n];
+            mval = val * val;
+            if (mval > mq) {
+                mq = mval;
+                q = val;
+            }
+        }
+        q = 1/q;
+        // The clean loop
+        for (int i=0; i < maxiter; i++) {
+            step = (T) gain * max * q;
+            mdl[argmax] += step;
+            if (comp) comp->add(argmax, step, 0);
+            if (best_score > 0) {
+                log_pos.push_back(argmax);
+                log_step.push_back(step);
+            }
+            // Take next step and compute score
+            nscore = patch_step(ps, res, ker, mask, 0, pos_def, argmax / dim2,
+                argmax % dim2, step, 0, nargmax);
+            max = res[nargmax];
+            nscore = sqrt(nscore / npix);
+            if (firstscore < 0) firstscore = nscore;
+            if (hist) hist->add(nargmax / dim2, nargmax % dim2, max, (T) 0, nscore, step, (T) 0);
+            if (verb != 0 && rank == 2)
+                printf("Iter %d: Max=(%ld,%ld,%f), Score=%f, Prev=%f, Delta=%f\n", \
+                       i, nargmax / dim2, nargmax % dim2, (double) max, (double) (nscore/firstscore), \
+                    (double) (score/firstscore),
+                       (double) (std::abs(score - nscore) / firstscore));
+            else if (verb != 0)
+                printf("Iter %d: Max=(%ld), Score = %f, Prev = %f\n", \
+                    i, nargmax, (double) (nscore/firstscore), \
+                    (double) (score/firstscore));
+            if (score > 0 && nscore > score) {
+                if (stop_if_div) {
+                    // We've diverged: undo last step and give up
+                    if (comp) comp->pop(1);
+                    mdl[argmax] -= step;
+                    patch_add(undo, res, ker, 0, argmax / dim2, argmax % dim2, step, 0);
+                    return -i;
+                } else if (best_score < 0 || score < best_score) {
+                    // We've diverged: prev state may be global best, so
+                    // log components from the last one on
+                    log_pos.assign(1, argmax);
+                    log_step.assign(1, step);
+                    best_score = score;
+                    i = 0;  // Reset maxiter counter
+                }
+            } else if (score > 0 && (std::abs(score - nscore) / firstscore < tol
+                    || max * max < thr2)) {
+                // We're done
+                return i;
+            } else if (not stop_if_div && (best_score < 0 || nscore < best_score)) {
+                i = 0;  // Reset maxiter counter
+            }
+            score = nscore;
+            argmax = nargmax;
+        }
+        // If we end on maxiter, then make sure mdl/res reflect best score
+        if (best_score > 0 && best_score < nscore) {
+            if (comp) comp->pop(log_pos.size());
+            for (long k=(long) log_pos.size()-1; k >= 0; k--) {
+                mdl[log_pos[k]] -= log_step[k];
+                patch_add(undo, res, ker, 0, log_pos[k] / dim2, log_pos[k] % dim2, log_step[k], 0);
+            }
+        }
+        return maxiter;
+    }
+    // Does a contiguous 1d or 2d complex-valued clean with a beam patch
+    static int clean_c_patch(T *res, const T *ker, T *mdl, const char *mask,
+            int dim1, int dim2, int rank, double beam_patch, double gain,
+            int maxiter, double tol, double thresh, int stop_if_div, int verb,
+            int pos_def, CleanHistory *hist,
+            CleanComponents *comp) {
+        T maxr=0, maxi=0, valr, vali, stepr, stepi, qr=0, qi=0;
+        T score=-1, nscore, best_score=-1;
+        T mval, mq=0;
+        T firstscore=-1;
+        long argmax=0, nargmax=0, npix=(long) dim1*dim2;
+        std::vector<long> log_pos;  // Components since the best state
+        std::vector<T> log_step;    // (real, imag) per component
+        T thr2 = (T) (thresh * thresh);
+        PatchState ps, undo;
+        patch_init(ps, ker, dim1, dim2, 1, beam_patch);
+        undo.dim1 = dim1; undo.dim2 = dim2; undo.p1 = ps.p1; undo.p2 = ps.p2;
+        for (int r1=0; r1 < dim1; r1++) patch_scan_row(ps, res, mask, 1, pos_def, r1);
+        // Compute gain/phase of kernel, from its peak wherever the mask is
+        for (long n=0; n < npix; n++) {
+            valr = ker[2*n+0];
+            vali = ker[2*n+1];
+            mval = valr * valr + vali * vali;
+            if (mval > mq) {
+                mq = mval;
+                qr = valr; qi = vali;
+            }
+        }
+        qr /= mq;
+        qi = -qi / mq;
+        // The clean loop
+        for (int i=0; i < maxiter; i++) {
+            stepr = (T) gain * (maxr * qr - maxi * qi);
+            stepi = (T) gain * (maxr * qi + maxi * qr);
+            mdl[2*argmax+0] += stepr;
+            mdl[2*argmax+1] += stepi;
+            if (comp) comp->add(argmax, stepr, stepi);
+            if (best_score > 0) {
+                log_pos.push_back(argmax);
+                log_step.push_back(stepr); log_step.push_back(stepi);
+            }
+            // Take next step and compute score
+            nscore = patch_step(ps, res, ker, mask, 1, pos_def, argmax / dim2,
+                argmax % dim2, stepr, stepi, nargmax);
+            maxr = res[2*nargmax+0]; maxi = res[2*nargmax+1];
+            nscore = sqrt(nscore / npix);
+            if (firstscore < 0) firstscore = nscore;
+            if (hist) hist->add(nargmax / dim2, nargmax % dim2, maxr, maxi, nscore, stepr, stepi);
+            if (verb != 0 && rank == 2)
+                printf("Iter %d: Max=(%ld,%ld), Score = %f, Prev = %f\n", \
+                    i, nargmax / dim2, nargmax % dim2, (double) (nscore/firstscore), \
+                    (double) (score/firstscore));
+            else if (verb != 0)
+                printf("Iter %d: Max=(%ld), Score = %f, Prev = %f\n", \
+                    i, nargmax, (double) (nscore/firstscore), \
+                    (double) (score/firstscore));
+            if (score > 0 && nscore > score) {
+                if (stop_if_div) {
+                    // We've diverged: undo last step and give up
+                    if (comp) comp->pop(1);
+                    mdl[2*argmax+0] -= stepr;
+                    mdl[2*argmax+1] -= stepi;
+                    patch_add(undo, res, ker, 1, argmax / dim2, argmax % dim2, stepr, stepi);
+                    return -i;
+                } else if (best_score < 0 || score < best_score) {
+                    // We've diverged: prev state may be global best, so
+                    // log components from the last one on
+                    log_pos.assign(1, argmax);
+                    log_step.clear(); log_step.push_back(stepr); log_step.push_back(stepi);
+                    best_score = score;
+                    i = 0;  // Reset maxiter counter
+                }
+            } else if (score > 0 && ((score - nscore) / firstscore < tol
+                    || maxr * maxr + maxi * maxi < thr2)) {
+                // We're done
+                return i;
+            } else if (not stop_if_div && (best_score < 0 || nscore < best_score)) {
+                i = 0;  // Reset maxiter counter
+            }
+            score = nscore;
+            argmax = nargmax;
+        }
+        // If we end on maxiter, then make sure mdl/res reflect best score
+        if (best_score > 0 && best_score < nscore) {
+            if (comp) comp->pop(log_pos.size());
+            for (long k=(long) log_pos.size()-1; k >= 0; k--) {
+                mdl[2*log_pos[k]+0] -= log_step[2*k];
+                mdl[2*log_pos[k]+1] -= log_step[2*k+1];
+                patch_add(undo, res, ker, 1, log_pos[k] / dim2, log_pos[k] % dim2,
+                    log_step[2*k], log_step[2*k+1]);
+            }
+        }
+        return maxiter;
+    }
+    //  __  __       _ _   _               _      ____     _
+    // |  \/  |_   _| | |_(_)___  ___ __ _| | ___|___ \ __| |
+    // | |\/| | | | | | __| / __|/ __/ _` | |/ _ \ __) / _` |
+    // | |  | | |_| | | |_| \__ \ (_| (_| | |  __// __/ (_| |
+    // |_|  |_|\__,_|_|\__|_|___/\___\__,_|_|\___|_____\__,_|
+    // Multi-scale clean of real-valued, C-contiguous data.  res holds one
+    // residual per scale (the residual convolved with that scale), ker the
+    // nscales x nscales cross-scale beams (ker convolved with both scales)
+    // and mdl one component image per scale.  Each iteration picks the scale
+    // with the largest (bias-weighted, normalised) peak, then updates every scale residual
+    // in place with step_r, which also yields its next peak.  The score is
+    // that of scale 0 (normally the point scale, i.e. the true residual).
+    static int clean_ms_r(T *res, const T *ker, T *mdl, const char *mask,
+            int nscales, const double *bias, int dim1, int dim2, int rank,
+            double gain, int maxiter, double tol, int verb, int pos_def) {
+        T score=-1, nscore, firstscore=-1, step, best;
+        long npix=(long) dim1*dim2, argmax;
+        int s=0;
+        std::vector<T> max(nscales, 0), nsc(nscales, 0);
+        std::vector<long> arg(nscales, -1);
+        typename CleanSimd<T>::run_r_t simd = CleanSimd<T>::run_r;
+        SparseMask sp;
+        const SparseMask *sparse = sp.init(mask, dim1, dim2, 0) ? &sp : NULL;
+        std::vector<T> norm(nscales, 1);
+        // Find the initial peak of each scale (a zero step changes nothing)
+        for (int t=0; t < nscales; t++) {
+            step_r(res+t*npix, ker+t*npix, mask, dim1, dim2, 0, 0, 0, pos_def,
+                arg[t], max[t], simd, sparse);
+            norm[t] = sqrt(std::abs(ker[((long) t*nscales+t)*npix]));
+            if (norm[t] == 0) norm[t] = 1;
+        }
+        // The clean loop
+        for (int i=0; i < maxiter; i++) {
+            // Pick the scale with the largest weighted peak.  Peaks are
+            // normalised by sqrt(B_tt(0)), so that without bias the step that
+            // removes the most residual power wins, whatever the scale
+            // functions' normalisation.
+            best = -1;
+            for (int t=0; t < nscales; t++) {
+                if (arg[t] < 0) continue;
+                T w = (T) bias[t] * std::abs(max[t]) / norm[t];
+                if (w > best) { best = w; s = t; }
+            }
+            if (best < 0) return i;  // Nothing left inside area
+            argmax = arg[s];
+            const T *kss = ker + ((long) s*nscales+s)*npix;
+            step = (T) gain * max[s] / kss[0];
+            mdl[s*npix+argmax] += step;
+            // Take next step in every scale and compute score
+            for (int t=0; t < nscales; t++) {
+                nsc[t] = step_r(res+t*npix, ker+((long) s*nscales+t)*npix,
+                    mask, dim1, dim2, argmax / dim2, argmax % dim2, step,
+                    pos_def, arg[t], max[t], simd, sparse);
+            }
+            nscore = sqrt(nsc[0] / npix);
+            if (firstscore < 0) firstscore = nscore;
+            if (verb != 0 && rank == 2)
+                printf("Iter %d: Scale=%d, Max=(%ld,%ld,%f), Score=%f, Prev=%f\n", \
+                    i, s, argmax / dim2, argmax % dim2, (double) step, \
+                    (double) (nscore/firstscore), (double) (score/firstscore));
+            else if (verb != 0)
+                printf("Iter %d: Scale=%d, Max=(%ld), Score = %f, Prev = %f\n", \
+                    i, s, argmax, (double) (nscore/firstscore), \
+                    (double) (score/firstscore));
+            if (score > 0 && nscore > score) {
+                // We've diverged: undo last step and give up
+                mdl[s*npix+argmax] -= step;
+                for (int t=0; t < nscales; t++)
+                    shift_add_r(res+t*npix, ker+((long) s*nscales+t)*npix,
+                        dim1, dim2, argmax / dim2, argmax % dim2, step);
+                return -i;
+            } else if (score > 0 && std::abs(score - nscore) / firstscore < tol) {
+                // We're done
+                return i;
+            }
+            score = nscore;
+        }
+        return maxiter;
+    }
+    //      _       _       _
+    //     | | ___ (_)_ __ | |_
+    //  _  | |/ _ \| | '_ \| __|
+    // | |_| | (_) | | | | | |_
+    //  \___/ \___/|_|_| |_|\__|
+
+    // One joint clean step on a stack of nplanes contiguous images: every
+    // plane t subtracts its own ker_t*step_t at (a1,a2), and the peak is
+    // searched for in the power summed over planes, row by row so that each
+    // row of every plane is touched once.  C is 1 (real) or 2 (complex);
+    // pw is a dim2 scratch row.  Visits pixels in the order step_r does.
+    template<int C> static T joint_step(T *res, const T *ker, const char *mask,
+            int nplanes, int dim1, int dim2, int a1, int a2, const T *step,
+            int pos_def, T *pw, long &nargmax) {
+        long npix = (long) dim1*dim2;
+        T nscore = 0, mmax = -1;
+        for (int n1=0; n1 < dim1; n1++) {
+            int r1 = n1 + a1; if (r1 >= dim1) r1 -= dim1;
+            long rbase = (long) r1*dim2;
+            for (int n2=0; n2 < dim2; n2++) pw[n2] = 0;
+            for (int t=0; t < nplanes; t++) {
+                T *rrow = res + C*(t*npix + rbase);
+                const T *krow = ker + C*(t*npix + (long) n1*dim2);
+                T sr = step[C*t], si = C == 2 ? step[C*t+1] : 0;
+                for (int n2=0; n2 < dim2; n2++) {
+                    int k = n2 >= a2 ? n2 - a2 : n2 - a2 + dim2;
+                    if (C == 1) {
+                        rrow[n2] -= krow[k] * sr;
+                        pw[n2] += rrow[n2] * rrow[n2];
+                    } else {
+                        rrow[2*n2+0] -= krow[2*k+0] * sr - krow[2*k+1] * si;
+                        rrow[2*n2+1] -= krow[2*k+0] * si + krow[2*k+1] * sr;
+                        pw[n2] += rrow[2*n2+0] * rrow[2*n2+0] + rrow[2*n2+1] * rrow[2*n2+1];
+                    }
+                }
+            }
+            for (int m=0; m < dim2; m++) {
+                int n2 = m + a2; if (n2 >= dim2) n2 -= dim2;
+                nscore += pw[n2];
+                if (pw[n2] > mmax && mask[rbase+n2]
+                        && (pos_def == 0 || res[C*(rbase+n2)] > 0)) {
+                    nargmax = rbase + n2;
+                    mmax = pw[n2];
+                }
+            }
+        }
+        return nscore;
+    }
+    // Undo one joint component: mdl_t -= step_t and res_t += ker_t*step_t
+    template<int C> static void joint_undo(T *res, const T *ker, T *mdl,
+            int nplanes, int dim1, int dim2, long pos, const T *step) {
+        long npix = (long) dim1*dim2;
+        for (int t=0; t < nplanes; t++) {
+            mdl[C*(t*npix+pos)] -= step[C*t];
+            if (C == 1) {
+                shift_add_r(res+t*npix, ker+t*npix, dim1, dim2, pos / dim2,
+                    pos % dim2, step[t]);
+            } else {
+                mdl[C*(t*npix+pos)+1] -= step[C*t+1];
+                shift_add_c(res+2*t*npix, ker+2*t*npix, dim1, dim2, pos / dim2,
+                    pos % dim2, step[C*t], step[C*t+1]);
+            }
+        }
+    }
+    // Joint clean of a stack of nplanes contiguous 1d or 2d images (e.g.
+    // polarisations or MFS terms) sharing component positions.  Each
+    // iteration puts a component at the peak of the summed power, with
+    // step_t = gain*res_t/ker_t in every plane (pos_def tests plane 0), and
+    // the score is the RMS over all planes.  Otherwise behaves as
+    // clean_r_contig/clean_c_contig, which it matches for one plane.
+    template<int C> static int clean_joint(T *res, const T *ker, T *mdl,
+            const char *mask, int nplanes, int dim1, int dim2, int rank,
+            double gain, int maxiter, double tol, int stop_if_div, int verb,
+            int pos_def) {
+        T score=-1, nscore, best_score=-1, firstscore=-1, valr, vali, mval;
+        long argmax=0, nargmax=0, npix=(long) dim1*dim2;
+        std::vector<T> step(C*nplanes, 0), peak(C*nplanes, 0), q(C*nplanes, 0);
+        std::vector<T> pw(dim2);
+        std::vector<long> log_pos;  // Components since the best state
+        std::vector<T> log_step;    // C*nplanes values per component
+        // Compute gain/phase of each kernel
+        for (int t=0; t < nplanes; t++) {
+            T mq = 0;
+            const T *k = ker + C*t*npix;
+            for (long n=0; n < npix; n++) {
+                valr = k[C*n]; vali = C == 2 ? k[C*n+1] : 0;
+                mval = valr * valr + vali * vali;
+                if (mval > mq && mask[n]) {
+                    mq = mval;
+                    q[C*t] = valr;
+                    if (C == 2) q[C*t+1] = vali;
+                }
+            }
+            if (C == 1) q[t] = 1 / q[t];
+            else { q[C*t] /= mq; q[C*t+1] = -q[C*t+1] / mq; }
+        }
+        // The clean loop
+        for (int i=0; i < maxiter; i++) {
+            for (int t=0; t < nplanes; t++) {
+                if (C == 1) {
+                    step[t] = (T) gain * peak[t] * q[t];
+                } else {
+                    step[C*t] = (T) gain * (peak[C*t] * q[C*t] - peak[C*t+1] * q[C*t+1]);
+                    step[C*t+1] = (T) gain * (peak[C*t] * q[C*t+1] + peak[C*t+1] * q[C*t]);
+                }
+                mdl[C*(t*npix+argmax)] += step[C*t];
+                if (C == 2) mdl[C*(t*npix+argmax)+1] += step[C*t+1];
+            }
+            if (best_score > 0) {
+                log_pos.push_back(argmax);
+                log_step.insert(log_step.end(), step.begin(), step.end());
+            }
+            // Take next step and compute score
+            nscore = joint_step<C>(res, ker, mask, nplanes, dim1, dim2,
+                argmax / dim2, argmax % dim2, step.data(), pos_def, pw.data(), nargmax);
+            for (int t=0; t < nplanes; t++)
+                for (int c=0; c < C; c++) peak[C*t+c] = res[C*(t*npix+nargmax)+c];
+            nscore = sqrt(nscore / (npix * nplanes));
+            if (firstscore < 0) firstscore = nscore;
+            if (verb != 0 && rank == 2)
+                printf("Iter %d: Max=(%ld,%ld), Score = %f, Prev = %f\n", \
+                    i, nargmax / dim2, nargmax % dim2, (double) (nscore/firstscore), \
+                    (double) (score/firstscore));
+            else if (verb != 0)
+                printf("Iter %d: Max=(%ld), Score = %f, Prev = %f\n", \
+                    i, nargmax, (double) (nscore/firstscore), \
+                    (double) (score/firstscore));
+            if (score > 0 && nscore > score) {
+                if (stop_if_div) {
+                    // We've diverged: undo last step and give up
+                    joint_undo<C>(res, ker, mdl, nplanes, dim1, dim2, argmax, step.data());
+                    return -i;
+                } else if (best_score < 0 || score < best_score) {
+                    // We've diverged: prev state may be global best, so
+                    // log components from the last one on
+                    log_pos.assign(1, argmax);
+                    log_step.assign(step.begin(), step.end());
+                    best_score = score;
+                    i = 0;  // Reset maxiter counter
+                }
+            } else if (score > 0 && std::abs(score - nscore) / firstscore < tol) {
+                // We're done
+                return i;
+            } else if (not stop_if_div && (best_score < 0 || nscore < best_score)) {
+                i = 0;  // Reset maxiter counter
+            }
+            score = nscore;
+            argmax = nargmax;
+        }
+        // If we end on maxiter, then make sure mdl/res reflect best score
+        if (best_score > 0 && best_score < nscore) {
+            for (long k=(long) log_pos.size()-1; k >= 0; k--)
+                joint_undo<C>(res, ker, mdl, nplanes, dim1, dim2, log_pos[k],
+                    log_step.data() + k*C*nplanes);
+        }
+        return maxiter;
+    }
+};  // END TEMPLATE
+
+//  ____  _               _
+// / ___|(_)_ __ ___   __| |
+// \___ \| | '_ ` _ \ / _` |
+//  ___) | | | | | | | (_| |
+// |____/|_|_| |_| |_|\__,_|
+// Vectorised fused clean step (res -= step*ker, sum of squares, masked
+// argmax), written once with GCC/Clang vector extensions and instantiated
+// for each instruction set.  Each lane keeps its own running maximum and the
+// first index at which it occurred; lanes are reduced at the end of a run,
+// preferring the earliest index on ties, which matches the scalar loops.
+// The sum of squares is accumulated per lane, so scores can differ from the
+// scalar loops in the last bits.
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__aarch64__))
+#define CLEAN_SIMD
+#endif
+
+#ifdef CLEAN_SIMD
+#include <stdint.h>
+// Vector arguments of the inlined helpers never cross a real call boundary
+#pragma GCC diagnostic ignored "-Wpsabi"
+
+#define SIMD_INLINE inline __attribute__((always_inline))
+#if defined(__clang__)
+#define SIMD_SHUFFLE(iv,x,...) __builtin_shufflevector(x, x, __VA_ARGS__)
+#else
+#define SIMD_SHUFFLE(iv,x,...) __builtin_shuffle(x, (iv){__VA_ARGS__})
+#endif
+
+template<typename T> struct SimdInt { typedef int32_t type; };
+template<> struct SimdInt<double> { typedef int64_t type; };
+
+// Swap the real and imaginary lanes of interleaved complex data
+template<int L> struct SimdSwap;
+template<> struct SimdSwap<2> { template<typename IV, typename V>
+    static SIMD_INLINE V run(V x) { return SIMD_SHUFFLE(IV, x, 1,0); } };
+template<> struct SimdSwap<4> { template<typename IV, typename V>
+    static SIMD_INLINE V run(V x) { return SIMD_SHUFFLE(IV, x, 1,0,3,2); } };
+template<> struct SimdSwap<8> { template<typename IV, typename V>
+    static SIMD_INLINE V run(V x) { return SIMD_SHUFFLE(IV, x, 1,0,3,2,5,4,7,6); } };
+template<> struct SimdSwap<16> { template<typename IV, typename V>
+    static SIMD_INLINE V run(V x) {
+        return SIMD_SHUFFLE(IV, x, 1,0,3,2,5,4,7,6,9,8,11,10,13,12,15,14); } };
+
+template<typename T, int W> struct SimdRun {
+    typedef T vec __attribute__((vector_size(W)));
+    typedef typename SimdInt<T>::type I;
+    typedef I ivec __attribute__((vector_size(W)));
+    enum { L = W / sizeof(T) };
+    typedef int8_t cvec __attribute__((vector_size(L)));
+
+    static SIMD_INLINE vec load(const T *p) { vec v; memcpy(&v, p, W); return v; }
+    static SIMD_INLINE void store(T *p, vec v) { memcpy(p, &v, W); }
+    static SIMD_INLINE ivec load_mask(const char *p) {
+        cvec c; memcpy(&c, p, L);
+        return __builtin_convertvector(c, ivec) != 0;
+    }
+    static SIMD_INLINE vec splat(T x) { return (vec){} + x; }
+
+    // Reduce per-lane (best, idx) pairs over the lanes selected by 'stride'.
+    static SIMD_INLINE int best_lane(vec vbest, ivec vidx, int stride) {
+        int bj = -1;
+        for (int j=0; j < L; j += stride) {
+            if (vidx[j] < 0) continue;
+            if (bj < 0 || vbest[j] > vbest[bj] ||
+                    (vbest[j] == vbest[bj] && vidx[j] < vidx[bj])) bj = j;
+        }
+        return bj;
+    }
+
+    static SIMD_INLINE void run_r(T *res, const T *ker, const char *mask,
+            int n, T step, int pos_def, long base, T &nscore, long &nargmax,
+            T &max, T &mmax) {
+        vec vstep = splat(step), vsum = splat(0), vbest = splat(mmax);
+        vec vval = splat(0), zero = splat(0);
+        ivec vidx = (ivec){} - 1, lane;
+        for (int j=0; j < L; j++) lane[j] = j;
+        int k = 0;
+        for (; k + L <= n; k += L) {
+            vec r = load(res+k) - load(ker+k) * vstep;
+            store(res+k, r);
+            vec m2 = r * r;
+            vsum += m2;
+            ivec ok = (m2 > vbest) & load_mask(mask+k);
+            if (pos_def) ok &= (r > zero);
+            vbest = ok ? m2 : vbest;
+            vval = ok ? r : vval;
+            vidx = ok ? lane + (I) k : vidx;
+        }
+        for (int j=0; j < L; j++) nscore += vsum[j];
+        int bj = best_lane(vbest, vidx, 1);
+        if (bj >= 0) {
+            nargmax = base + vidx[bj];
+            max = vval[bj];
+            mmax = vbest[bj];
+        }
+        Clean<T>::sub_run_r(res+k, ker+k, mask+k, n-k, step, pos_def, base+k,
+            nscore, nargmax, max, mmax);
+    }
+
+    // lmask has one byte per lane (see Clean<T>::step_c)
+    static SIMD_INLINE void run_c(T *res, const T *ker, const char *lmask,
+            int n, T stepr, T stepi, long base, T &nscore, long &nargmax,
+            T &maxr, T &maxi, T &mmax) {
+        vec vsr = splat(stepr), vsi, vsum = splat(0), vbest = splat(mmax);
+        vec vval = splat(0);
+        ivec vidx = (ivec){} - 1, lane;
+        for (int j=0; j < L; j++) {
+            vsi[j] = (j & 1) ? stepi : -stepi;
+            lane[j] = j / 2;
+        }
+        int k = 0;
+        for (; 2*k + L <= 2*n; k += L/2) {
+            vec kk = load(ker+2*k);
+            vec r = load(res+2*k) - (kk * vsr + SimdSwap<L>::template run<ivec>(kk) * vsi);
+            store(res+2*k, r);
+            vec m2 = r * r;
+            vsum += m2;
+            m2 += SimdSwap<L>::template run<ivec>(m2);
+            ivec ok = (m2 > vbest) & load_mask(lmask+2*k);
+            vbest = ok ? m2 : vbest;
+            vval = ok ? r : vval;
+            vidx = ok ? lane + (I) k : vidx;
+        }
+        for (int j=0; j < L; j++) nscore += vsum[j];
+        int bj = best_lane(vbest, vidx, 2);
+        if (bj >= 0) {
+            nargmax = base + vidx[bj];
+            maxr = vval[bj]; maxi = vval[bj+1];
+            mmax = vbest[bj];
+        }
+        // The scalar tail takes a per-pixel mask: every other lane byte
+        for (; k < n; k++) {
+            Clean<T>::sub_run_c(res+2*k, ker+2*k, lmask+2*k, 1, stepr, stepi,
+                base+k, nscore, nargmax, maxr, maxi, mmax);
+        }
+    }
+};
+
+#define CLEAN_SIMD_ISA(attr,isa,W,T) \
+    attr static void clean_run_r_##isa##_##T(T *res, const T *ker, \
+            const char *mask, int n, T step, int pos_def, long base, \
+            T &nscore, long &nargmax, T &max, T &mmax) { \
+        SimdRun<T,W>::run_r(res, ker, mask, n, step, pos_def, base, nscore, \
+            nargmax, max, mmax); } \
+    attr static void clean_run_c_##isa##_##T(T *res, const T *ker, \
+            const char *lmask, int n, T stepr, T stepi, long base, \
+            T &nscore, long &nargmax, T &maxr, T &maxi, T &mmax) { \
+        SimdRun<T,W>::run_c(res, ker, lmask, n, stepr, stepi, base, nscore, \
+            nargmax, maxr, maxi, mmax); }
+
+#if defined(__x86_64__)
+CLEAN_SIMD_ISA(__attribute__((target("avx512f"))),avx512,64,float)
+CLEAN_SIMD_ISA(__attribute__((target("avx512f"))),avx512,64,double)
+CLEAN_SIMD_ISA(__attribute__((target("avx2,fma"))),avx2,32,float)
+CLEAN_SIMD_ISA(__attribute__((target("avx2,fma"))),avx2,32,double)
+#else
+CLEAN_SIMD_ISA(,neon,16,float)
+CLEAN_SIMD_ISA(,neon,16,double)
+#endif
+#endif // CLEAN_SIMD
+
+#define SET_SIMD(isa) \
+    CleanSimd<float>::run_r = clean_run_r_##isa##_float; \
+    CleanSimd<float>::run_c = clean_run_c_##isa##_float; \
+    CleanSimd<double>::run_r = clean_run_r_##isa##_double; \
+    CleanSimd<double>::run_c = clean_run_c_##isa##_double; \
+    return #isa;
+
+// Install the best SIMD kernels this CPU supports (or none, if enable is 0).
+// Returns the name of the instruction set in use.
+static const char *clean_simd_init(int enable) {
+    CleanSimd<float>::run_r = NULL; CleanSimd<float>::run_c = NULL;
+    CleanSimd<double>::run_r = NULL; CleanSimd<double>::run_c = NULL;
+    if (!enable) return "none";
+#if defined(CLEAN_SIMD) && defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) { SET_SIMD(avx512); }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) { SET_SIMD(avx2); }
+#elif defined(CLEAN_SIMD)
+    SET_SIMD(neon);
+#endif
+    return "none";
+}
+static const char *clean_simd_isa = "none";
+
+//  __  __                      _
+// |  \/  | __ ___  _____ _ __ | |_
+// | |\/| |/ _` \ \/ / _ \ '_ \| __|
+// | |  | | (_| |>  <  __/ | | | |_
+// |_|  |_|\__,_/_/\_\___|_| |_|\__|
+
+// State of a maximum entropy deconvolution (see aipy.deconv.maxent): the
+// FFT plans, the transformed kernel and the work buffers, all allocated
+// once per call.
+struct Maxent {
+    long dim1, dim2, npix;
+    Fft2d fft;
+    std::vector<cplx_t> fker, buf;
+    std::vector<double> diff;
+
+    Maxent(const double *ker, long d1, long d2) : dim1(d1), dim2(d2),
+            npix(d1*d2), fft(d1, d2), fker(npix), buf(npix), diff(npix) {
+        for (long n=0; n < npix; n++) fker[n] = ker[n];
+        fft.exec(&fker[0], 0);
+        for (long n=0; n < npix; n++) fker[n] /= (double) npix;
+    }
+    // res = im - b (*) ker, with circular convolution
+    void residual(const double *im, const double *b, double *res) {
+        for (long n=0; n < npix; n++) buf[n] = b[n];
+        fft.exec(&buf[0], 0);
+        for (long n=0; n < npix; n++) buf[n] *= fker[n];
+        fft.exec(&buf[0], 1);
+        for (long n=0; n < npix; n++) res[n] = im[n] - buf[n].real();
+    }
+    // Runs the MEM Newton iteration on b, starting from b with prior m.
+    // Returns the number of iterations; term is 0 (maxiter), 1 (tol) or
+    // 2 (divergence).  res receives the residual of the final b.
+    int run(const double *im, const double *m, double *b, double *res,
+            double q, double var0, double gain, double tol, int maxiter,
+            double lower, double upper, int verb, int &term, double &score,
+            double &alpha) {
+        double nvar0 = npix * var0, gc = -2*q, ggc = 2*q*q;
+        int i;
+        term = 0; score = 0; alpha = 0;
+        for (i=0; i < maxiter; i++) {
+            if (verb) printf("Step %d:\n", i);
+            residual(im, b, &diff[0]);
+            // Pass 1: chi^2 and the metric-weighted dot products
+            double fit=0, sw=0, sgg=0, sgc=0, scc=0;
+            for (long n=0; n < npix; n++) {
+                double d = diff[n], g_chi2 = gc * d;
+                double g_J = -log(b[n] / m[n]) - 1 - alpha * g_chi2;
+                double w = 1 / (1 / b[n] + alpha * ggc);  // 1 / -gg_J
+                fit += d * d;
+                sw += w; sgg += g_J * g_J * w;
+                sgc += g_chi2 * g_J * w; scc += g_chi2 * g_chi2 * w;
+            }
+            double chi2 = fit - nvar0;
+            double d_alpha = (chi2 + sgc) / scc;
+            score = sgg / sw;
+            if (verb) {
+                printf("    score %g fit %g\n", score, fit);
+                printf("    alpha %g d_alpha %g\n", alpha, d_alpha);
+            }
+            if (score < tol && score > 0) { term = 1; break; }
+            else if (score > 1e10 || std::isnan(score) || score <= 0) { term = 2; break; }
+            // Pass 2: Newton step on b, clipped to [lower, upper]
+            for (long n=0; n < npix; n++) {
+                double g_chi2 = gc * diff[n];
+                double g_J = -log(b[n] / m[n]) - 1 - alpha * g_chi2;
+                double gg_J = -1 / b[n] - alpha * ggc, d_b = 0;
+                if (gg_J != 0) d_b = -1 / gg_J * (g_J - d_alpha * g_chi2);
+                b[n] = std::min(std::max(b[n] + gain * d_b, lower), upper);
+            }
+            alpha += gain * d_alpha;
+        }
+        residual(im, b, res);
+        return i < maxiter ? i + 1 : maxiter;
+    }
+};
+
+//  _
+// | |    ___  __ _
+// | |   / __|/ _` |
+// | |___\__ \ (_| |
+// |_____|___/\__, |
+//               |_|
+
+// State of a least-squares deconvolution (see aipy.deconv.lsq): the FFT
+// plans and the work buffer of one plane size, kept for all the planes a
+// thread deconvolves, and the transformed kernel of its last plane.
+struct Lsq {
+    long dim1, dim2, npix;
+    Fft2d fft;
+    std::vector<cplx_t> fker, buf;
+
+    Lsq(long d1, long d2) : dim1(d1), dim2(d2), npix(d1*d2), fft(d1, d2),
+            buf(npix) {}
+    // fk = the transform of ker, scaled for the unnormalised inverse
+    void kernel(const double *ker, std::vector<cplx_t> &fk) {
+        fk.resize(npix);
+        for (long n=0; n < npix; n++) fk[n] = ker[n];
+        fft.exec(&fk[0], 0);
+        for (long n=0; n < npix; n++) fk[n] /= (double) npix;
+    }
+    // buf = buf (*) ker, with circular convolution
+    void convolve(const cplx_t *fk) {
+        fft.exec(&buf[0], 0);
+        for (long n=0; n < npix; n++) buf[n] *= fk[n];
+        fft.exec(&buf[0], 1);
+    }
+    // Runs the lsq iteration on x for the kernel transform fk.  Returns the
+    // number of iterations; term is 0 (maxiter) or 1 (tol).  res receives
+    // the residual of the final x.
+    int run(const cplx_t *fk, const double *im, const double *area, double *x,
+            double *res, double q, double gain, double tol, int maxiter,
+            double lower, double upper, int verb, int &term, double &score) {
+        double gc = -2*q;
+        int i;
+        term = 0; score = 0;
+        for (long n=0; n < npix; n++) buf[n] = x[n];
+        for (i=0; i < maxiter; i++) {
+            convolve(fk);
+            // Pass 1: the area-masked difference, left in buf, and chi^2
+            double fit = 0;
+            for (long n=0; n < npix; n++) {
+                double d = (im[n] - buf[n].real()) * area[n];
+                buf[n] = d;
+                fit += d * d;
+            }
+            double n_score = fit / npix, t = fabs(1 - score / n_score);
+            if (verb) printf("Step %d: score %g slope %g term %g\n", i, score,
+                fabs(gc) * sqrt(n_score), t);
+            if (t < tol) { term = 1; break; }
+            score = n_score;
+            // Pass 2: step x along the gradient, clipped to [lower, upper],
+            // and load it for the next convolution
+            for (long n=0; n < npix; n++) {
+                double d = buf[n].real(), g_chi2 = gc * d, d_x = 0;
+                if (g_chi2 != 0) d_x = -(1 / g_chi2) * (d * d);
+                x[n] = std::min(std::max(x[n] + gain * d_x, lower), upper);
+                buf[n] = x[n];
+            }
+        }
+        if (term == 1) for (long n=0; n < npix; n++) buf[n] = x[n];
+        convolve(fk);
+        for (long n=0; n < npix; n++) res[n] = im[n] - buf[n].real();
+        return i < maxiter ? i + 1 : maxiter;
+    }
+};
+
+//     _                            _
+//    / \   _ __  _ __   ___  __ _| |
+//   / _ \ | '_ \| '_ \ / _ \/ _` | |
+//  / ___ \| | | | | | |  __/ (_| | |
+// /_/   \_\_| |_|_| |_|\___|\__,_|_|
+
+// xorshift64* generator; each annealing chain keeps its own state
+struct AnnealRng {
+    npy_uint64 s;
+    double spare;
+    int has_spare;
+    AnnealRng(npy_uint64 seed) : s(seed ? seed : 0x9e3779b97f4a7c15ULL), spare(0), has_spare(0) {}
+    npy_uint64 next() {
+        s ^= s >> 12; s ^= s << 25; s ^= s >> 27;
+        return s * 2685821657736338717ULL;
+    }
+    // Uniform in [0, 1)
+    double uniform() { return (next() >> 11) * (1. / 9007199254740992.); }
+    // Uniform in [0, n)
+    long index(long n) { return (long) (((next() >> 32) * (npy_uint64) n) >> 32); }
+    // Standard normal (Marsaglia polar method)
+    double normal() {
+        if (has_spare) { has_spare = 0; return spare; }
+        double u, v, r;
+        do {
+            u = 2 * uniform() - 1; v = 2 * uniform() - 1;
+            r = u * u + v * v;
+        } while (r >= 1 || r == 0);
+        r = sqrt(-2 * log(r) / r);
+        spare = v * r; has_spare = 1;
+        return u * r;
+    }
+};
+
+// The kernel entries an annealing move updates: offsets and values of
+// every |ker| > footprint * max|ker| (every nonzero entry for footprint 0)
+struct AnnealKernel {
+    std::vector<long> o1, o2;
+    std::vector<double> k;
+    double q2;       // sum of k^2 over the footprint
+    AnnealKernel(const double *ker, long dim1, long dim2, double footprint) : q2(0) {
+        double kmax = 0;
+        for (long n=0; n < dim1*dim2; n++) kmax = std::max(kmax, std::abs(ker[n]));
+        for (long n1=0; n1 < dim1; n1++) {
+            for (long n2=0; n2 < dim2; n2++) {
+                double v = ker[n1*dim2+n2];
+                if (v == 0 || std::abs(v) <= footprint * kmax) continue;
+                o1.push_back(n1); o2.push_back(n2); k.push_back(v);
+                q2 += v * v;
+            }
+        }
+    }
+};
+
+// One annealing sweep of a chain: nmoves single-pixel perturbations of
+// mdl, each drawn from N(0, sigma[p]) at a random pixel p, clipped to
+// [lower, upper] and kept only if it lowers |res|^2.  res is updated
+// through the kernel footprint only.  Returns the number of moves kept.
+static long anneal_sweep(const AnnealKernel &ak, double *mdl, double *res,
+        const double *sigma, long dim1, long dim2, long nmoves, double lower,
+        double upper, AnnealRng &rng) {
+    long nk = (long) ak.k.size(), npix = dim1*dim2, kept = 0;
+    const long *o1 = ak.o1.data(), *o2 = ak.o2.data();
+    const double *k = ak.k.data();
+    for (long mv=0; mv < nmoves; mv++) {
+        long p = rng.index(npix), p1 = p / dim2, p2 = p % dim2, x1, x2;
+        double delta = sigma[p] * rng.normal(), corr = 0;
+        delta = std::min(std::max(mdl[p] + delta, lower), upper) - mdl[p];
+        if (delta == 0) continue;
+        // d|res|^2 = delta * (delta * q2 - 2 * sum(res * ker))
+        for (long j=0; j < nk; j++) {
+            x1 = p1 + o1[j]; if (x1 >= dim1) x1 -= dim1;
+            x2 = p2 + o2[j]; if (x2 >= dim2) x2 -= dim2;
+            corr += res[x1*dim2+x2] * k[j];
+        }
+        if (delta * (delta * ak.q2 - 2 * corr) >= 0) continue;
+        mdl[p] += delta;
+        for (long j=0; j < nk; j++) {
+            x1 = p1 + o1[j]; if (x1 >= dim1) x1 -= dim1;
+            x2 = p2 + o2[j]; if (x2 >= dim2) x2 -= dim2;
+            res[x1*dim2+x2] -= delta * k[j];
+        }
+        kept++;
+    }
+    return kept;
+}
+
+// __        __
+// \ \      / / __ __ _ _ __  _ __   ___ _ __
+//  \ \ /\ / / '__/ _` | '_ \| '_ \ / _ \ '__|
+//   \ V  V /| | | (_| | |_) | |_) |  __/ |
+//    \_/\_/ |_|  \__,_| .__/| .__/ \___|_|
+//                     |_|   |_|
+
+// Convert area to a C-contiguous byte mask for the Contig fast paths.
+static char *area_mask(PyArrayObject *area) {
+    int rank = RANK(area);
+    int dim1 = rank == 2 ? DIM(area,0) : 1, dim2 = DIM(area,rank-1);
+    char *mask = (char *)malloc((long) dim1*dim2);
+    if (mask == NULL) return NULL;
+    for (int n1=0; n1 < dim1; n1++) {
+        for (int n2=0; n2 < dim2; n2++) {
+            if (rank == 2) mask[(long) n1*dim2+n2] = IND2(area,n1,n2,long) != 0;
+            else mask[n2] = IND1(area,n2,long) != 0;
+        }
+    }
+    return mask;
+}
+
+#define CLEAN_CONTIG(T,fn) Clean<T>::fn((T *)PyArray_DATA(res), \
+    (T *)PyArray_DATA(ker), (T *)PyArray_DATA(mdl), mask, dim1, dim2, rank, \
+    gain, maxiter, tol, stop_if_div, verb, pos_def, hist, comp)
+#define CLEAN_JOINT(T,C) Clean<T>::clean_joint<C>((T *)PyArray_DATA(res), \
+    (T *)PyArray_DATA(ker), (T *)PyArray_DATA(mdl), mask, nplanes, dim1, dim2, \
+    rank, gain, maxiter, tol, stop_if_div, verb, pos_def)
+#define CLEAN_PATCH(T,fn) Clean<T>::fn((T *)rbuf, (T *)kbuf, (T *)mbuf, \
+    mask, dim1, dim2, rank, beam_patch, gain, maxiter, tol, thresh, \
+    stop_if_div, verb, pos_def, hist, comp)
+
+// Copy a 1d or 2d array to/from a C-contiguous buffer, element by element
+static void copy_plane(PyArrayObject *a, char *buf, int to_buf) {
+    int rank = RANK(a), sz = PyArray_ITEMSIZE(a);
+    npy_intp dim1 = rank == 2 ? DIM(a,0) : 1, dim2 = DIM(a,rank-1);
+    npy_intp s1 = rank == 2 ? PyArray_STRIDES(a)[0] : 0, s2 = PyArray_STRIDES(a)[rank-1];
+    char *d = (char *)PyArray_DATA(a);
+    for (npy_intp n1=0; n1 < dim1; n1++) {
+        for (npy_intp n2=0; n2 < dim2; n2++, buf += sz) {
+            if (to_buf) memcpy(buf, d + n1*s1 + n2*s2, sz);
+            else memcpy(d + n1*s1 + n2*s2, buf, sz);
+        }
+    }
+}
+
+// Beam-patch clean; non-contiguous arrays are cleaned in contiguous copies.
+// Returns 0 with ok = 0 if buffers could not be allocated.
+static int clean_patch(PyArrayObject *res, PyArrayObject *ker,
+        PyArrayObject *mdl, const char *mask, double beam_patch, double gain,
+        int maxiter, double tol, double thresh, int stop_if_div, int verb,
+        int pos_def, CleanHistory *hist, CleanComponents *comp, int &ok) {
+    int rank = RANK(res), rv = 0;
+    int dim1 = rank == 2 ? DIM(res,0) : 1, dim2 = DIM(res,rank-1);
+    long nbytes = (long) dim1*dim2*PyArray_ITEMSIZE(res);
+    int rc = PyArray_ISCARRAY(res), kc = PyArray_ISCARRAY_RO(ker), mc = PyArray_ISCARRAY(mdl);
+    char *rbuf = rc ? (char *)PyArray_DATA(res) : (char *)malloc(nbytes);
+    char *kbuf = kc ? (char *)PyArray_DATA(ker) : (char *)malloc(nbytes);
+    char *mbuf = mc ? (char *)PyArray_DATA(mdl) : (char *)malloc(nbytes);
+    ok = rbuf != NULL && kbuf != NULL && mbuf != NULL;
+    if (!ok) goto fail;
+    if (!rc) copy_plane(res, rbuf, 1);
+    if (!kc) copy_plane(ker, kbuf, 1);
+    if (!mc) copy_plane(mdl, mbuf, 1);
+    switch (TYPE(res)) {
+        case NPY_FLOAT: rv = CLEAN_PATCH(float,clean_r_patch); break;
+        case NPY_DOUBLE: rv = CLEAN_PATCH(double,clean_r_patch); break;
+        case NPY_LONGDOUBLE: rv = CLEAN_PATCH(long double,clean_r_patch); break;
+        case NPY_CFLOAT: rv = CLEAN_PATCH(float,clean_c_patch); break;
+        case NPY_CDOUBLE: rv = CLEAN_PATCH(double,clean_c_patch); break;
+        default: rv = CLEAN_PATCH(long double,clean_c_patch); break;
+    }
+    if (!rc) copy_plane(res, rbuf, 0);
+    if (!mc) copy_plane(mdl, mbuf, 0);
+  fail:
+    if (!rc && rbuf != NULL) free(rbuf);
+    if (!kc && kbuf != NULL) free(kbuf);
+    if (!mc && mbuf != NULL) free(mbuf);
+    return ok ? rv : 0;
+}
+
+// Dispatch to the Clean<T> loop matching the type and rank of res.  Arrays
+// must already have been validated; safe to call without holding the GIL.
+// beam_patch > 0 selects the beam-patch loops (see Clean<T>::patch_radius),
+// which also implement thresh > 0 (using a patch as large as ker if needed).
+// hist and comp, if not NULL, collect a record per iteration (see
+// CleanHistory) and the components added (see CleanComponents).
+static int clean_dispatch(PyArrayObject *res, PyArrayObject *ker,
+        PyArrayObject *mdl, PyArrayObject *area, double beam_patch,
+        double thresh, double gain, int maxiter, double tol, int stop_if_div,
+        int verb, int pos_def, CleanHistory *hist, CleanComponents *comp) {
+    int rank = RANK(res), rv, ok;
+    int dim1 = rank == 2 ? DIM(res,0) : 1, dim2 = DIM(res,rank-1);
+    char *mask;
+    if (thresh > 0 && beam_patch <= 0) beam_patch = std::max(dim1, dim2);
+    if (beam_patch > 0 && (mask = area_mask(area)) != NULL) {
+        rv = clean_patch(res, ker, mdl, mask, beam_patch, gain, maxiter, tol,
+            thresh, stop_if_div, verb, pos_def, hist, comp, ok);
+        free(mask);
+        if (ok) return rv;
+    }
+    // C-contiguous data takes the raw-pointer fast path
+    if (PyArray_ISCARRAY(res) && PyArray_ISCARRAY(mdl) && PyArray_ISCARRAY_RO(ker)
+            && (mask = area_mask(area)) != NULL) {
+        switch (TYPE(res)) {
+            case NPY_FLOAT: rv = CLEAN_CONTIG(float,clean_r_contig); break;
+            case NPY_DOUBLE: rv = CLEAN_CONTIG(double,clean_r_contig); break;
+            case NPY_LONGDOUBLE: rv = CLEAN_CONTIG(long double,clean_r_contig); break;
+            case NPY_CFLOAT: rv = CLEAN_CONTIG(float,clean_c_contig); break;
+            case NPY_CDOUBLE: rv = CLEAN_CONTIG(double,clean_c_contig); break;
+            default: rv = CLEAN_CONTIG(long double,clean_c_contig); break;
+        }
+        free(mask);
+        return rv;
+    }
+    switch (TYPE(res)) {
+        case NPY_FLOAT:
+            if (rank == 1) return Clean<float>::clean_1d_r(res,ker,mdl,area,gain,maxiter,tol,stop_if_div,verb,pos_def,hist,comp);
+            return Clean<float>::clean_2d_r(res,ker,mdl,area,gain,maxiter,tol,stop_if_div,verb,pos_def,hist,comp);
+        case NPY_DOUBLE:
+            if (rank == 1) return Clean<double>::clean_1d_r(res,ker,mdl,area,gain,maxiter,tol,stop_if_div,verb,pos_def,hist,comp);
+            return Clean<double>::clean_2d_r(res,ker,mdl,area,gain,maxiter,tol,stop_if_div,verb,pos_def,hist,comp);
+        case NPY_LONGDOUBLE:
+            if (rank == 1) return Clean<long double>::clean_1d_r(res,ker,mdl,area,gain,maxiter,tol,stop_if_div,verb,pos_def,hist,comp);
+            return Clean<long double>::clean_2d_r(res,ker,mdl,area,gain,maxiter,tol,stop_if_div,verb,pos_def,hist,comp);
+        case NPY_CFLOAT:
+            if (rank == 1) return Clean<float>::clean_1d_c(res,ker,mdl,area,gain,maxiter,tol,stop_if_div,verb,pos_def,hist,comp);
+            return Clean<float>::clean_2d_c(res,ker,mdl,area,gain,maxiter,tol,stop_if_div,verb,pos_def,hist,comp);
+        case NPY_CDOUBLE:
+            if (rank == 1) return Clean<double>::clean_1d_c(res,ker,mdl,area,gain,maxiter,tol,stop_if_div,verb,pos_def,hist,comp);
+            return Clean<double>::clean_2d_c(res,ker,mdl,area,gain,maxiter,tol,stop_if_div,verb,pos_def,hist,comp);
+        default:
+            if (rank == 1) return Clean<long double>::clean_1d_c(res,ker,mdl,area,gain,maxiter,tol,stop_if_div,verb,pos_def,hist,comp);
+            return Clean<long double>::clean_2d_c(res,ker,mdl,area,gain,maxiter,tol,stop_if_div,verb,pos_def,hist,comp);
+    }
+}
+
+// numpy dtype of a CleanRecord, exported as _deconv.history_dtype
+static PyArray_Descr *history_descr = NULL;
+
+static int init_history_descr() {
+    PyObject *spec = Py_BuildValue("[(ss)(ss(i))(ss)(ss)(ss)]", "iter", "<i8",
+        "pos", "<i8", 2, "peak", "<c16", "score", "<f8", "step", "<c16");
+    if (spec == NULL) return 0;
+    int ok = PyArray_DescrConverter(spec, &history_descr);
+    Py_DECREF(spec);
+    return ok;
+}
+
+// The counters of stats(): calls, planes (or rows, or spectra) cleaned,
+// iterations and time of the clean functions
+enum { ST_CALLS, ST_PLANES, ST_ITER, ST_NS, ST_N };
+static aipy_stats clean_stats = {0, ST_N, {"clean_calls", "clean_planes",
+    "clean_iter", "clean_ns"}};
+
+// Counts a call from t0 that cleaned the planes with iteration counts rv
+// (an int array, or the single count n of one plane if rv is NULL)
+static void count_clean(long long t0, PyArrayObject *rv, int n) {
+    if (!clean_stats.on) return;
+    long long iter = 0, nplanes = rv ? DIM(rv,0) : 1;
+    if (rv) for (npy_intp k=0; k < DIM(rv,0); k++) iter += std::abs(IND1(rv,k,int));
+    else iter = std::abs(n);
+    AIPY_STATS_ADD(clean_stats, ST_CALLS, 1);
+    AIPY_STATS_ADD(clean_stats, ST_PLANES, nplanes);
+    AIPY_STATS_ADD(clean_stats, ST_ITER, iter);
+    AIPY_STATS_TIME(clean_stats, ST_NS, t0);
+}
+
+#define CHK_CLEAN_TYPES(res,ker,mdl,area) \
+    if (TYPE(res) != TYPE(ker) || TYPE(res) != TYPE(mdl)) { \
+        PyErr_Format(PyExc_ValueError, "array types must match"); \
+        return NULL; } \
+    if (TYPE(area) != NPY_LONG) { \
+        PyErr_Format(PyExc_ValueError, "area must by of type 'int'"); \
+        return NULL; } \
+    switch (TYPE(res)) { \
+        case NPY_FLOAT: case NPY_DOUBLE: case NPY_LONGDOUBLE: \
+        case NPY_CFLOAT: case NPY_CDOUBLE: case NPY_CLONGDOUBLE: \
+            break; \
+        default: \
+            PyErr_Format(PyExc_ValueError, "Unsupported data type."); \
+            return NULL; }
+
+// Clean wrapper that handles all different data types and dimensions
+PyObject *clean(PyObject *self, PyObject *args, PyObject *kwargs) {
+    PyArrayObject *res, *ker, *mdl, *area, *history=NULL;
+    PyObject *hobj=Py_None;
+    double gain=.1, tol=.001, beam_patch=0, thresh=0;
+    int maxiter=200, dim1, dim2, rv, stop_if_div=0, verb=0, pos_def=0, every=1;
+    int components=0, merge=0;
+    CleanHistory hist = {NULL, 0, 0, 1, 0};
+    CleanComponents comp;
+    static char const *kwlist[] = {"res", "ker", "mdl", "area", "gain", \
+                             "maxiter", "tol", "stop_if_div", "verbose","pos_def",
+                             "beam_patch", "thresh", "history", "history_every",
+                             "components", "merge_components", NULL};
+    // Parse arguments and perform sanity check
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O!O!O!O!|didiiiddOiii", (char **) kwlist, \
+            &PyArray_Type, &res, &PyArray_Type, &ker, &PyArray_Type, &mdl, &PyArray_Type, &area,
+            &gain, &maxiter, &tol, &stop_if_div, &verb, &pos_def, &beam_patch, &thresh,
+            &hobj, &every, &components, &merge))
+        return NULL;
+    if (hobj != Py_None) {
+        if (!PyArray_Check(hobj)) {
+            PyErr_Format(PyExc_ValueError, "history must be an array");
+            return NULL;
+        }
+        history = (PyArrayObject *) hobj;
+        CHK_ARRAY_RANK(history, 1);
+        if (!PyArray_EquivTypes(PyArray_DESCR(history), history_descr)
+                || !PyArray_ISCARRAY(history)) {
+            PyErr_Format(PyExc_ValueError, "history must be a C-contiguous array of _deconv.history_dtype");
+            return NULL;
+        }
+        if (!PyArray_ISWRITEABLE(history)) {
+            PyErr_Format(PyExc_ValueError, "history must be writeable");
+            return NULL;
+        }
+        if (every < 1) {
+            PyErr_Format(PyExc_ValueError, "history_every must be >= 1");
+            return NULL;
+        }
+        hist.rec = (CleanRecord *)PyArray_DATA(history);
+        hist.size = DIM(history,0);
+        hist.every = every;
+    }
+    if (RANK(res) == 1) {
+        CHK_ARRAY_RANK(ker, 1); CHK_ARRAY_RANK(mdl, 1); CHK_ARRAY_RANK(area, 1);
+        dim1 = DIM(res,0);
+        CHK_ARRAY_DIM(ker, 0, dim1); CHK_ARRAY_DIM(mdl, 0, dim1); CHK_ARRAY_DIM(area, 0, dim1);
+    } else if (RANK(res) == 2) {
+        CHK_ARRAY_RANK(ker, 2); CHK_ARRAY_RANK(mdl, 2); CHK_ARRAY_RANK(area, 2);
+        dim1 = DIM(res,0); dim2 = DIM(res,1);
+        CHK_ARRAY_DIM(ker, 0, dim1); CHK_ARRAY_DIM(mdl, 0, dim1); CHK_ARRAY_DIM(area, 0, dim1);
+        CHK_ARRAY_DIM(ker, 1, dim2); CHK_ARRAY_DIM(mdl, 1, dim2); CHK_ARRAY_DIM(area, 1, dim2);
+    } else {
+        PyErr_Format(PyExc_ValueError, "rank(res) must be 1 or 2");
+        return NULL;
+    }
+    CHK_CLEAN_TYPES(res, ker, mdl, area);
+    Py_INCREF(res); Py_INCREF(ker); Py_INCREF(mdl); Py_INCREF(area);
+    Py_XINCREF(history);
+    // The clean loops only touch array memory, so let other threads run
+    long long t0 = aipy_stats_clock(&clean_stats);
+    Py_BEGIN_ALLOW_THREADS
+    rv = clean_dispatch(res,ker,mdl,area,beam_patch,thresh,gain,maxiter,tol,stop_if_div,verb,pos_def,
+        history ? &hist : NULL, components ? &comp : NULL);
+    // Mark the records that were not written
+    for (long n=hist.count; n < hist.size; n++) hist.rec[n].iter = -1;
+    if (components) comp.compact(merge);
+    Py_END_ALLOW_THREADS
+    count_clean(t0, NULL, rv);
+    Py_DECREF(res); Py_DECREF(ker); Py_DECREF(mdl); Py_DECREF(area);
+    Py_XDECREF(history);
+    if (!components) return Py_BuildValue("i", rv);
+    return comp.build(rv, RANK(res), RANK(res) == 1 ? 1 : DIM(res,1),
+        PyArray_ISCOMPLEX(res));
+}
+
+// Joint clean wrapper (see Clean<T>::clean_joint)
+PyObject *clean_joint(PyObject *self, PyObject *args, PyObject *kwargs) {
+    PyArrayObject *res, *ker, *mdl, *area;
+    double gain=.1, tol=.001;
+    int maxiter=200, rv=0, stop_if_div=0, verb=0, pos_def=0, nplanes, rank, dim1, dim2;
+    char *mask;
+    static char const *kwlist[] = {"res", "ker", "mdl", "area", "gain", \
+                             "maxiter", "tol", "stop_if_div", "verbose","pos_def", NULL};
+    // Parse arguments and perform sanity check
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O!O!O!O!|didiii", (char **) kwlist, \
+            &PyArray_Type, &res, &PyArray_Type, &ker, &PyArray_Type, &mdl, &PyArray_Type, &area,
+            &gain, &maxiter, &tol, &stop_if_div, &verb, &pos_def))
+        return NULL;
+    if (RANK(res) != 2 && RANK(res) != 3) {
+        PyErr_Format(PyExc_ValueError, "rank(res) must be 2 or 3");
+        return NULL;
+    }
+    rank = RANK(res) - 1;
+    nplanes = DIM(res,0);
+    CHK_ARRAY_RANK(ker, RANK(res)); CHK_ARRAY_RANK(mdl, RANK(res));
+    CHK_ARRAY_RANK(area, rank);
+    for (int d=0; d < RANK(res); d++) {
+        CHK_ARRAY_DIM(ker, d, DIM(res,d)); CHK_ARRAY_DIM(mdl, d, DIM(res,d));
+        if (d > 0) { CHK_ARRAY_DIM(area, d-1, DIM(res,d)); }
+    }
+    CHK_CLEAN_TYPES(res, ker, mdl, area);
+    if (!PyArray_ISCARRAY(res) || !PyArray_ISCARRAY_RO(ker) || !PyArray_ISCARRAY(mdl)) {
+        PyErr_Format(PyExc_ValueError, "res, ker and mdl must be C-contiguous");
+        return NULL;
+    }
+    dim1 = rank == 2 ? DIM(res,1) : 1; dim2 = DIM(res,rank);
+    if ((mask = area_mask(area)) == NULL) return PyErr_NoMemory();
+    Py_INCREF(res); Py_INCREF(ker); Py_INCREF(mdl);
+    long long t0 = aipy_stats_clock(&clean_stats);
+    Py_BEGIN_ALLOW_THREADS
+    switch (TYPE(res)) {
+        case NPY_FLOAT: rv = CLEAN_JOINT(float,1); break;
+        case NPY_DOUBLE: rv = CLEAN_JOINT(double,1); break;
+        case NPY_LONGDOUBLE: rv = CLEAN_JOINT(long double,1); break;
+        case NPY_CFLOAT: rv = CLEAN_JOINT(float,2); break;
+        case NPY_CDOUBLE: rv = CLEAN_JOINT(double,2); break;
+        default: rv = CLEAN_JOINT(long double,2); break;
+    }
+    Py_END_ALLOW_THREADS
+    count_clean(t0, NULL, rv);
+    Py_DECREF(res); Py_DECREF(ker); Py_DECREF(mdl);
+    free(mask);
+    return Py_BuildValue("i", rv);
+}
+
+// Multi-scale clean wrapper (see Clean<T>::clean_ms_r)
+PyObject *clean_ms(PyObject *self, PyObject *args, PyObject *kwargs) {
+    PyArrayObject *res, *ker, *mdl, *area, *bias;
+    double gain=.1, tol=.001;
+    int maxiter=200, rv=0, verb=0, pos_def=0, nscales, rank, dim1, dim2;
+    char *mask;
+    static char const *kwlist[] = {"res", "ker", "mdl", "area", "bias", "gain", \
+                             "maxiter", "tol", "verbose","pos_def", NULL};
+    // Parse arguments and perform sanity check
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O!O!O!O!O!|didii", (char **) kwlist, \
+            &PyArray_Type, &res, &PyArray_Type, &ker, &PyArray_Type, &mdl, &PyArray_Type, &area,
+            &PyArray_Type, &bias, &gain, &maxiter, &tol, &verb, &pos_def))
+        return NULL;
+    if (RANK(res) != 2 && RANK(res) != 3) {
+        PyErr_Format(PyExc_ValueError, "rank(res) must be 2 or 3");
+        return NULL;
+    }
+    rank = RANK(res) - 1;
+    nscales = DIM(res,0);
+    CHK_ARRAY_RANK(mdl, RANK(res)); CHK_ARRAY_RANK(ker, RANK(res)+1);
+    CHK_ARRAY_RANK(area, rank); CHK_ARRAY_RANK(bias, 1);
+    CHK_ARRAY_DIM(ker, 0, nscales); CHK_ARRAY_DIM(ker, 1, nscales);
+    CHK_ARRAY_DIM(mdl, 0, nscales); CHK_ARRAY_DIM(bias, 0, nscales);
+    for (int d=0; d < rank; d++) {
+        CHK_ARRAY_DIM(mdl, d+1, DIM(res,d+1)); CHK_ARRAY_DIM(ker, d+2, DIM(res,d+1));
+        CHK_ARRAY_DIM(area, d, DIM(res,d+1));
+    }
+    CHK_ARRAY_TYPE(bias, NPY_DOUBLE);
+    CHK_CLEAN_TYPES(res, ker, mdl, area);
+    if (TYPE(res) != NPY_FLOAT && TYPE(res) != NPY_DOUBLE && TYPE(res) != NPY_LONGDOUBLE) {
+        PyErr_Format(PyExc_ValueError, "multi-scale clean requires real-valued data");
+        return NULL;
+    }
+    if (!PyArray_ISCARRAY(res) || !PyArray_ISCARRAY_RO(ker) || !PyArray_ISCARRAY(mdl)
+            || !PyArray_ISCARRAY_RO(bias)) {
+        PyErr_Format(PyExc_ValueError, "res, ker, mdl and bias must be C-contiguous");
+        return NULL;
+    }
+    dim1 = rank == 2 ? DIM(res,1) : 1; dim2 = DIM(res,rank);
+    mask = area_mask(area);
+    if (mask == NULL) return PyErr_NoMemory();
+    Py_INCREF(res); Py_INCREF(ker); Py_INCREF(mdl); Py_INCREF(bias);
+    long long t0 = aipy_stats_clock(&clean_stats);
+    Py_BEGIN_ALLOW_THREADS
+    switch (TYPE(res)) {
+        case NPY_FLOAT: rv = Clean<float>::clean_ms_r((float *)PyArray_DATA(res),
+            (float *)PyArray_DATA(ker), (float *)PyArray_DATA(mdl), mask, nscales,
+            (double *)PyArray_DATA(bias), dim1, dim2, rank, gain, maxiter, tol, verb, pos_def); break;
+        case NPY_DOUBLE: rv = Clean<double>::clean_ms_r((double *)PyArray_DATA(res),
+            (double *)PyArray_DATA(ker), (double *)PyArray_DATA(mdl), mask, nscales,
+            (double *)PyArray_DATA(bias), dim1, dim2, rank, gain, maxiter, tol, verb, pos_def); break;
+        default: rv = Clean<long double>::clean_ms_r((long double *)PyArray_DATA(res),
+            (long double *)PyArray_DATA(ker), (long double *)PyArray_DATA(mdl), mask, nscales,
+            (double *)PyArray_DATA(bias), dim1, dim2, rank, gain, maxiter, tol, verb, pos_def); break;
+    }
+    Py_END_ALLOW_THREADS
+    count_clean(t0, NULL, rv);
+    free(mask);
+    Py_DECREF(res); Py_DECREF(ker); Py_DECREF(mdl); Py_DECREF(bias);
+    return Py_BuildValue("i", rv);
+}
+
+// Return a new view of plane n of the leading axis of a (a itself if it
+// has no leading plane axis, i.e. is shared between all planes).  The view
+// is writeable only if a is.
+static PyArrayObject *plane_view(PyArrayObject *a, int plane_rank, npy_intp n) {
+    PyArrayObject *v;
+    if (RANK(a) == plane_rank) {
+        Py_INCREF(a);
+        return a;
+    }
+    Py_INCREF(PyArray_DESCR(a));
+    v = (PyArrayObject *) PyArray_NewFromDescr(&PyArray_Type, PyArray_DESCR(a),
+        plane_rank, PyArray_DIMS(a)+1, PyArray_STRIDES(a)+1,
+        PyArray_DATA(a) + n*PyArray_STRIDES(a)[0],
+        PyArray_FLAGS(a) & NPY_ARRAY_WRITEABLE, NULL);
+    if (v == NULL) return NULL;
+    Py_INCREF(a);
+    if (PyArray_SetBaseObject(v, (PyObject *) a) < 0) {
+        Py_DECREF(v);
+        return NULL;
+    }
+    return v;
+}
+
+// Validate that a is either a stack of nplanes planes matching res, or a
+// single plane shared by all of them.
+static int chk_plane_stack(PyArrayObject *a, PyArrayObject *res, const char *name) {
+    int plane_rank = RANK(res) - 1, off = RANK(a) - plane_rank;
+    if (off != 0 && off != 1) {
+        PyErr_Format(PyExc_ValueError, "rank(%s) must be %d or %d", name,
+            plane_rank, plane_rank + 1);
+        return -1;
+    }
+    if (off == 1 && DIM(a,0) != DIM(res,0)) {
+        PyErr_Format(PyExc_ValueError, "dim(%s) != dim(res) along plane axis", name);
+        return -1;
+    }
+    for (int d=0; d < plane_rank; d++) {
+        if (DIM(a,d+off) != DIM(res,d+1)) {
+            PyErr_Format(PyExc_ValueError, "plane shape of %s != plane shape of res", name);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Clean each plane of a stack of 1 or 2 dimensional arrays on a pool of
+// native threads.  Planes are independent, so threads simply pull the next
+// unclaimed plane until none remain.
+PyObject *clean_batch(PyObject *self, PyObject *args, PyObject *kwargs) {
+    PyArrayObject *res, *ker, *mdl, *area, *rv;
+    double gain=.1, tol=.001, beam_patch=0;
+    int maxiter=200, stop_if_div=0, verb=0, pos_def=0, nthreads=0, plane_rank;
+    npy_intp nplanes;
+    static char const *kwlist[] = {"res", "ker", "mdl", "area", "gain", \
+                             "maxiter", "tol", "stop_if_div", "verbose","pos_def",
+                             "nthreads", "beam_patch", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O!O!O!O!|didiiiid", (char **) kwlist, \
+            &PyArray_Type, &res, &PyArray_Type, &ker, &PyArray_Type, &mdl, &PyArray_Type, &area,
+            &gain, &maxiter, &tol, &stop_if_div, &verb, &pos_def, &nthreads, &beam_patch))
+        return NULL;
+    if (RANK(res) != 2 && RANK(res) != 3) {
+        PyErr_Format(PyExc_ValueError, "rank(res) must be 2 or 3");
+        return NULL;
+    }
+    CHK_ARRAY_RANK(mdl, RANK(res));
+    for (int d=0; d < RANK(res); d++) {
+        CHK_ARRAY_DIM(mdl, d, DIM(res,d));
+    }
+    if (chk_plane_stack(ker, res, "ker") < 0) return NULL;
+    if (chk_plane_stack(area, res, "area") < 0) return NULL;
+    CHK_CLEAN_TYPES(res, ker, mdl, area);
+    if (!PyArray_ISWRITEABLE(res) || !PyArray_ISWRITEABLE(mdl)) {
+        PyErr_Format(PyExc_ValueError, "res and mdl must be writeable");
+        return NULL;
+    }
+    plane_rank = RANK(res) - 1;
+    nplanes = DIM(res,0);
+    rv = (PyArrayObject *) PyArray_SimpleNew(1, &nplanes, NPY_INT);
+    if (rv == NULL) return NULL;
+    // Build per-plane views while we still hold the GIL
+    std::vector<PyArrayObject *> views(4*nplanes, NULL);
+    for (npy_intp n=0; n < nplanes; n++) {
+        views[4*n+0] = plane_view(res, plane_rank, n);
+        views[4*n+1] = plane_view(ker, plane_rank, n);
+        views[4*n+2] = plane_view(mdl, plane_rank, n);
+        views[4*n+3] = plane_view(area, plane_rank, n);
+        if (!views[4*n+0] || !views[4*n+1] || !views[4*n+2] || !views[4*n+3]) {
+            for (size_t k=0; k < views.size(); k++) Py_XDECREF(views[k]);
+            Py_DECREF(rv);
+            return NULL;
+        }
+    }
+    long long t0 = aipy_stats_clock(&clean_stats);
+    Py_BEGIN_ALLOW_THREADS
+    aipy_parallel(nplanes, nthreads, [&](long n, int) {
+        IND1(rv,n,int) = clean_dispatch(views[4*n+0], views[4*n+1],
+            views[4*n+2], views[4*n+3], beam_patch, 0, gain, maxiter, tol, stop_if_div,
+            verb, pos_def, NULL, NULL);
+    });
+    Py_END_ALLOW_THREADS
+    count_clean(t0, rv, 0);
+    for (size_t k=0; k < views.size(); k++) Py_DECREF(views[k]);
+    return PyArray_Return(rv);
+}
+
+#define CLEAN_ROW(T,fn) Clean<T>::fn((T *)res, (T *)ker, (T *)mdl, mask, 1, n, 1, \
+    gain, maxiter, tol, stop_if_div, verb, pos_def, NULL, NULL)
+
+// Clean one C-contiguous 1d row of the given type in place
+static int clean_row(int type, char *res, const char *ker, char *mdl,
+        const char *mask, int n, double gain, int maxiter, double tol,
+        int stop_if_div, int verb, int pos_def) {
+    switch (type) {
+        case NPY_FLOAT: return CLEAN_ROW(float,clean_r_contig);
+        case NPY_DOUBLE: return CLEAN_ROW(double,clean_r_contig);
+        case NPY_LONGDOUBLE: return CLEAN_ROW(long double,clean_r_contig);
+        case NPY_CFLOAT: return CLEAN_ROW(float,clean_c_contig);
+        case NPY_CDOUBLE: return CLEAN_ROW(double,clean_c_contig);
+        default: return CLEAN_ROW(long double,clean_c_contig);
+    }
+}
+
+// Clean each row of res[nrows,n] as clean_batch does, but straight from the
+// array buffers: no per-row array objects, and the mask of a shared area is
+// built once.  Non-contiguous input is handed to clean_batch.
+PyObject *clean_1d_batch(PyObject *self, PyObject *args, PyObject *kwargs) {
+    PyArrayObject *res, *ker, *mdl, *area, *rv;
+    double gain=.1, tol=.001;
+    int maxiter=200, stop_if_div=0, verb=0, pos_def=0, nthreads=0;
+    npy_intp nrows;
+    static char const *kwlist[] = {"res", "ker", "mdl", "area", "gain", \
+                             "maxiter", "tol", "stop_if_div", "verbose","pos_def",
+                             "nthreads", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O!O!O!O!|didiiii", (char **) kwlist, \
+            &PyArray_Type, &res, &PyArray_Type, &ker, &PyArray_Type, &mdl, &PyArray_Type, &area,
+            &gain, &maxiter, &tol, &stop_if_div, &verb, &pos_def, &nthreads))
+        return NULL;
+    CHK_ARRAY_RANK(res, 2);
+    CHK_ARRAY_RANK(mdl, 2);
+    CHK_ARRAY_DIM(mdl, 0, DIM(res,0)); CHK_ARRAY_DIM(mdl, 1, DIM(res,1));
+    if (chk_plane_stack(ker, res, "ker") < 0) return NULL;
+    if (chk_plane_stack(area, res, "area") < 0) return NULL;
+    CHK_CLEAN_TYPES(res, ker, mdl, area);
+    if (!PyArray_ISCARRAY(res) || !PyArray_ISCARRAY(mdl) || !PyArray_ISCARRAY_RO(ker)
+            || !PyArray_ISCARRAY_RO(area))
+        return clean_batch(self, args, kwargs);
+    nrows = DIM(res,0);
+    int n = DIM(res,1), type = TYPE(res);
+    long rstride = (long) n * PyArray_ITEMSIZE(res);
+    long kstride = RANK(ker) == 2 ? rstride : 0;
+    int row_area = RANK(area) == 2;
+    char *rd = (char *)PyArray_DATA(res), *md = (char *)PyArray_DATA(mdl);
+    const char *kd = (char *)PyArray_DATA(ker);
+    const long *ad = (long *)PyArray_DATA(area);
+    char *shared = NULL;
+    if (!row_area && (shared = area_mask(area)) == NULL) return PyErr_NoMemory();
+    rv = (PyArrayObject *) PyArray_SimpleNew(1, &nrows, NPY_INT);
+    if (rv == NULL) {
+        free(shared);
+        return NULL;
+    }
+    Py_INCREF(res); Py_INCREF(ker); Py_INCREF(mdl); Py_INCREF(area);
+    long long t0 = aipy_stats_clock(&clean_stats);
+    Py_BEGIN_ALLOW_THREADS
+    int nt = aipy_pool_nthreads(nrows, nthreads);
+    std::vector<std::vector<char> > rmasks(nt);
+    aipy_parallel(nrows, nt, [&](long r, int tid) {
+        const char *mask = shared;
+        if (row_area) {
+            std::vector<char> &rmask = rmasks[tid];
+            rmask.resize(n);
+            for (int k=0; k < n; k++) rmask[k] = ad[r*n+k] != 0;
+            mask = rmask.data();
+        }
+        IND1(rv,r,int) = clean_row(type, rd + r*rstride, kd + r*kstride,
+            md + r*rstride, mask, n, gain, maxiter, tol, stop_if_div, verb,
+            pos_def);
+    });
+    Py_END_ALLOW_THREADS
+    count_clean(t0, rv, 0);
+    Py_DECREF(res); Py_DECREF(ker); Py_DECREF(mdl); Py_DECREF(area);
+    free(shared);
+    return PyArray_Return(rv);
+}
+
+static std::mutex delay_plan_lock;
+static std::map<long, FftPlan> delay_plans;
+
+// A private copy (FftPlan::exec uses scratch space) of the plan for n
+static FftPlan delay_plan(long n) {
+    std::lock_guard<std::mutex> lock(delay_plan_lock);
+    std::map<long, FftPlan>::iterator it = delay_plans.find(n);
+    if (it == delay_plans.end()) it = delay_plans.insert(std::make_pair(n, FftPlan(n))).first;
+    return it->second;
+}
+
+// w * window transformed to delay (as numpy.fft.ifft) into ker; false if
+// it is all zero
+static bool delay_kernel(FftPlan &p, cplx_t *ker, const double *w, const double *win, long n) {
+    bool any = false;
+    for (long k=0; k < n; k++) {
+        ker[k] = w[k] * win[k];
+        any = any || ker[k] != 0.;
+    }
+    p.exec(ker, 1);
+    for (long k=0; k < n; k++) ker[k] /= (double) n;
+    return any;
+}
+
+// Delay filtering of each spectrum of data[nspec,nchan]: the weighted,
+// windowed spectrum is transformed to delay, cleaned (as clean_1d_batch)
+// by the transform of its weights within area, and the model transformed
+// back, all in one pass per spectrum on a pool of native threads.
+PyObject *delay_filter(PyObject *self, PyObject *args, PyObject *kwargs) {
+    PyArrayObject *data, *wgts, *window, *area, *mdl, *res, *rv;
+    double gain=.1, tol=1e-9;
+    int maxiter=100, stop_if_div=0, nthreads=0;
+    npy_intp nspec;
+    static char const *kwlist[] = {"data", "wgts", "window", "area", "mdl", "res",
+                             "gain", "maxiter", "tol", "stop_if_div", "nthreads", NULL};
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O!O!O!O!O!O!|didii", (char **) kwlist, \
+            &PyArray_Type, &data, &PyArray_Type, &wgts, &PyArray_Type, &window,
+            &PyArray_Type, &area, &PyArray_Type, &mdl, &PyArray_Type, &res,
+            &gain, &maxiter, &tol, &stop_if_div, &nthreads))
+        return NULL;
+    CHK_ARRAY_RANK(data, 2);
+    CHK_ARRAY_TYPE(data, NPY_CDOUBLE);
+    CHK_ARRAY_RANK(mdl, 2);
+    CHK_ARRAY_TYPE(mdl, NPY_CDOUBLE);
+    CHK_ARRAY_RANK(res, 2);
+    CHK_ARRAY_TYPE(res, NPY_CDOUBLE);
+    CHK_ARRAY_TYPE(wgts, NPY_DOUBLE);
+    CHK_ARRAY_RANK(window, 1);
+    CHK_ARRAY_TYPE(window, NPY_DOUBLE);
+    CHK_ARRAY_RANK(area, 1);
+    if (TYPE(area) != NPY_LONG) {
+        PyErr_Format(PyExc_ValueError, "area must be of type 'int'");
+        return NULL;
+    }
+    nspec = DIM(data,0);
+    long n = DIM(data,1);
+    CHK_ARRAY_DIM(mdl, 0, nspec); CHK_ARRAY_DIM(mdl, 1, n);
+    CHK_ARRAY_DIM(res, 0, nspec); CHK_ARRAY_DIM(res, 1, n);
+    CHK_ARRAY_DIM(window, 0, n);
+    CHK_ARRAY_DIM(area, 0, n);
+    if (chk_plane_stack(wgts, data, "wgts") < 0) return NULL;
+    if (!PyArray_ISCARRAY_RO(data) || !PyArray_ISCARRAY(mdl) || !PyArray_ISCARRAY(res)
+            || !PyArray_ISCARRAY_RO(wgts) || !PyArray_ISCARRAY_RO(window)) {
+        PyErr_Format(PyExc_ValueError, "data, wgts, window, mdl and res must be C-contiguous");
+        return NULL;
+    }
+    int row_wgts = RANK(wgts) == 2;
+    const cplx_t *dd = (const cplx_t *)PyArray_DATA(data);
+    const double *wd = (const double *)PyArray_DATA(wgts), *win = (const double *)PyArray_DATA(window);
+    cplx_t *md = (cplx_t *)PyArray_DATA(mdl), *rd = (cplx_t *)PyArray_DATA(res);
+    char *mask = area_mask(area);
+    if (mask == NULL) return PyErr_NoMemory();
+    rv = (PyArrayObject *) PyArray_SimpleNew(1, &nspec, NPY_INT);
+    if (rv == NULL) {
+        free(mask);
+        return NULL;
+    }
+    Py_INCREF(data); Py_INCREF(wgts); Py_INCREF(window); Py_INCREF(mdl); Py_INCREF(res);
+    long long t0 = aipy_stats_clock(&clean_stats);
+    Py_BEGIN_ALLOW_THREADS
+    // A kernel shared by all spectra is transformed once
+    std::vector<cplx_t> shared(row_wgts ? 0 : n);
+    bool shared_ok = false;
+    if (!row_wgts && n > 0) {
+        FftPlan p = delay_plan(n);
+        shared_ok = delay_kernel(p, &shared[0], wd, win, n);
+    }
+    // Each thread's plan and buffers, made when it takes its first spectrum
+    struct Scratch {
+        FftPlan p;
+        std::vector<cplx_t> dly, ker, cmp;
+        Scratch(long n, bool row_wgts) : p(delay_plan(n > 0 ? n : 1)), dly(n), ker(row_wgts ? n : 0), cmp(n) {}
+    };
+    int nt = aipy_pool_nthreads(nspec, nthreads);
+    std::vector<std::unique_ptr<Scratch> > scratch(nt);
+    aipy_parallel(nspec, nt, [&](long r, int tid) {
+        if (!scratch[tid]) scratch[tid].reset(new Scratch(n, row_wgts));
+        FftPlan &p = scratch[tid]->p;
+        std::vector<cplx_t> &dly = scratch[tid]->dly, &ker = scratch[tid]->ker, &cmp = scratch[tid]->cmp;
+        const cplx_t *d = dd + r*n;
+        const double *w = wd + (row_wgts ? r*n : 0);
+        cplx_t *m = md + r*n, *o = rd + r*n;
+        const cplx_t *k = &shared[0];
+        bool ok = shared_ok;
+        if (row_wgts) {
+            ok = delay_kernel(p, &ker[0], w, win, n);
+            k = &ker[0];
+        }
+        if (!ok) {
+            // Nothing unflagged: no model, and nothing left over
+            std::fill(m, m + n, cplx_t(0.));
+            std::fill(o, o + n, cplx_t(0.));
+            IND1(rv,r,int) = 0;
+            return;
+        }
+        for (long c=0; c < n; c++) dly[c] = d[c] * (w[c] * win[c]);
+        p.exec(&dly[0], 1);
+        for (long c=0; c < n; c++) dly[c] /= (double) n;
+        std::fill(cmp.begin(), cmp.end(), cplx_t(0.));
+        IND1(rv,r,int) = Clean<double>::clean_c_contig((double *) &dly[0],
+            (const double *) k, (double *) &cmp[0], mask, 1, (int) n, 1, gain,
+            maxiter, tol, stop_if_div, 0, 0, NULL, NULL);
+        p.exec(&cmp[0], 0);
+        for (long c=0; c < n; c++) {
+            m[c] = cmp[c];
+            o[c] = (d[c] - cmp[c]) * w[c];
+        }
+    });
+    Py_END_ALLOW_THREADS
+    count_clean(t0, rv, 0);
+    Py_DECREF(data); Py_DECREF(wgts); Py_DECREF(window); Py_DECREF(mdl); Py_DECREF(res);
+    free(mask);
+    return PyArray_Return(rv);
+}
+
+// Maximum entropy wrapper (see Maxent)
+PyObject *maxent(PyObject *self, PyObject *args, PyObject *kwargs) {
+    PyArrayObject *im, *ker, *mdl, *b, *res;
+    double var0, gain=.1, tol=.001, lower=DBL_MIN, upper=HUGE_VAL, score=0, alpha=0, q=0;
+    int maxiter=200, verb=0, rv=0, term=0, ok=1, dim1, dim2;
+    static char const *kwlist[] = {"im", "ker", "mdl", "b", "res", "var0", \
+                             "gain", "tol", "maxiter", "lower", "upper", "verbose", NULL};
+    // Parse arguments and perform sanity check
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O!O!O!O!O!d|ddiddi", (char **) kwlist, \
+            &PyArray_Type, &im, &PyArray_Type, &ker, &PyArray_Type, &mdl, &PyArray_Type, &b,
+            &PyArray_Type, &res, &var0, &gain, &tol, &maxiter, &lower, &upper, &verb))
+        return NULL;
+    if (RANK(im) != 1 && RANK(im) != 2) {
+        PyErr_Format(PyExc_ValueError, "rank(im) must be 1 or 2");
+        return NULL;
+    }
+    PyArrayObject *arrs[] = {im, ker, mdl, b, res};
+    for (int k=0; k < 5; k++) {
+        CHK_ARRAY_RANK(arrs[k], RANK(im));
+        CHK_ARRAY_TYPE(arrs[k], NPY_DOUBLE);
+        for (int d=0; d < RANK(im); d++) { CHK_ARRAY_DIM(arrs[k], d, DIM(im,d)); }
+        if (!PyArray_ISCARRAY(arrs[k])) {
+            PyErr_Format(PyExc_ValueError, "arrays must be C-contiguous and writeable");
+            return NULL;
+        }
+    }
+    dim1 = RANK(im) == 2 ? DIM(im,0) : 1; dim2 = DIM(im,RANK(im)-1);
+    const double *kd = (double *)PyArray_DATA(ker);
+    for (long n=0; n < (long) dim1*dim2; n++) q += kd[n] * kd[n];
+    q = sqrt(q);
+    Py_INCREF(im); Py_INCREF(ker); Py_INCREF(mdl); Py_INCREF(b); Py_INCREF(res);
+    Py_BEGIN_ALLOW_THREADS
+    try {
+        Maxent mem(kd, dim1, dim2);
+        rv = mem.run((double *)PyArray_DATA(im), (double *)PyArray_DATA(mdl),
+            (double *)PyArray_DATA(b), (double *)PyArray_DATA(res), q, var0,
+            gain, tol, maxiter, lower, upper, verb, term, score, alpha);
+    } catch (std::bad_alloc &) {
+        ok = 0;
+    }
+    Py_END_ALLOW_THREADS
+    Py_DECREF(im); Py_DECREF(ker); Py_DECREF(mdl); Py_DECREF(b); Py_DECREF(res);
+    if (!ok) return PyErr_NoMemory();
+    return Py_BuildValue("iidd", rv, term, score, alpha);
+}
+
+// Least-squares wrapper (see Lsq): the planes of a stack are shared among
+// native threads, each keeping an Lsq for all the planes it takes on, and
+// a kernel shared by all planes is transformed once.
+PyObject *lsq(PyObject *self, PyObject *args, PyObject *kwargs) {
+    PyArrayObject *im, *ker, *x, *area, *res, *iters, *terms, *scores;
+    double gain=.1, tol=.001, lower=DBL_MIN, upper=HUGE_VAL;
+    int maxiter=200, verb=0, nthreads=0, ok=1;
+    static char const *kwlist[] = {"im", "ker", "x", "area", "res", "gain", \
+                             "tol", "maxiter", "lower", "upper", "verbose", "nthreads", NULL};
+    // Parse arguments and perform sanity check
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O!O!O!O!O!|ddiddii", (char **) kwlist, \
+            &PyArray_Type, &im, &PyArray_Type, &ker, &PyArray_Type, &x, &PyArray_Type, &area,
+            &PyArray_Type, &res, &gain, &tol, &maxiter, &lower, &upper, &verb, &nthreads))
+        return NULL;
+    if (RANK(im) != 2 && RANK(im) != 3) {
+        PyErr_Format(PyExc_ValueError, "rank(im) must be 2 or 3");
+        return NULL;
+    }
+    if (chk_plane_stack(ker, im, "ker") < 0) return NULL;
+    if (chk_plane_stack(area, im, "area") < 0) return NULL;
+    PyArrayObject *arrs[] = {im, ker, x, area, res};
+    for (int k=0; k < 5; k++) {
+        if (k == 2 || k == 4) {
+            CHK_ARRAY_RANK(arrs[k], RANK(im));
+            for (int d=0; d < RANK(im); d++) { CHK_ARRAY_DIM(arrs[k], d, DIM(im,d)); }
+        }
+        CHK_ARRAY_TYPE(arrs[k], NPY_DOUBLE);
+        if (!PyArray_ISCARRAY(arrs[k])) {
+            PyErr_Format(PyExc_ValueError, "arrays must be C-contiguous and writeable");
+            return NULL;
+        }
+    }
+    npy_intp nplanes = DIM(im,0);
+    long dim1 = RANK(im) == 3 ? DIM(im,1) : 1, dim2 = DIM(im,RANK(im)-1), npix = dim1*dim2;
+    int kstack = RANK(ker) == RANK(im), astack = RANK(area) == RANK(im);
+    iters = (PyArrayObject *) PyArray_SimpleNew(1, &nplanes, NPY_INT);
+    terms = (PyArrayObject *) PyArray_SimpleNew(1, &nplanes, NPY_INT);
+    scores = (PyArrayObject *) PyArray_SimpleNew(1, &nplanes, NPY_DOUBLE);
+    if (iters == NULL || terms == NULL || scores == NULL) {
+        Py_XDECREF(iters); Py_XDECREF(terms); Py_XDECREF(scores);
+        return NULL;
+    }
+    const double *imd = (double *)PyArray_DATA(im), *kd = (double *)PyArray_DATA(ker);
+    const double *ad = (double *)PyArray_DATA(area);
+    double *xd = (double *)PyArray_DATA(x), *rd = (double *)PyArray_DATA(res);
+    Py_INCREF(im); Py_INCREF(ker); Py_INCREF(x); Py_INCREF(area); Py_INCREF(res);
+    Py_BEGIN_ALLOW_THREADS
+    try {
+        int nt = aipy_pool_nthreads(nplanes, nthreads);
+        std::vector<std::unique_ptr<Lsq> > scratch(nt);
+        std::vector<cplx_t> fshared;
+        if (!kstack && nplanes > 0) {
+            scratch[0].reset(new Lsq(dim1, dim2));
+            scratch[0]->kernel(kd, fshared);
+        }
+        aipy_parallel(nplanes, nt, [&](long n, int tid) {
+            if (!scratch[tid]) scratch[tid].reset(new Lsq(dim1, dim2));
+            Lsq &ls = *scratch[tid];
+            const double *k = kd + (kstack ? n*npix : 0);
+            double q = 0, score = 0;
+            int term = 0;
+            for (long p=0; p < npix; p++) q += k[p] * k[p];
+            if (kstack) ls.kernel(k, ls.fker);
+            IND1(iters,n,int) = ls.run(kstack ? &ls.fker[0] : &fshared[0],
+                imd + n*npix, ad + (astack ? n*npix : 0), xd + n*npix, rd + n*npix,
+                sqrt(q), gain, tol, maxiter, lower, upper, verb, term, score);
+            IND1(terms,n,int) = term;
+            IND1(scores,n,double) = score;
+        });
+    } catch (std::bad_alloc &) {
+        ok = 0;
+    }
+    Py_END_ALLOW_THREADS
+    Py_DECREF(im); Py_DECREF(ker); Py_DECREF(x); Py_DECREF(area); Py_DECREF(res);
+    if (!ok) {
+        Py_DECREF(iters); Py_DECREF(terms); Py_DECREF(scores);
+        return PyErr_NoMemory();
+    }
+    return Py_BuildValue("NNN", PyArray_Return(iters), PyArray_Return(terms),
+        PyArray_Return(scores));
+}
+
+// Simulated annealing wrapper: one anneal_sweep per chain, with chains
+// spread over native threads
+PyObject *anneal(PyObject *self, PyObject *args, PyObject *kwargs) {
+    PyArrayObject *ker, *mdl, *res, *sigma, *state, *rv;
+    double lower=-HUGE_VAL, upper=HUGE_VAL, footprint=0;
+    long nmoves=0;
+    int nthreads=0;
+    static char const *kwlist[] = {"ker", "mdl", "res", "sigma", "state", \
+                             "nmoves", "lower", "upper", "footprint", "nthreads", NULL};
+    // Parse arguments and perform sanity check
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O!O!O!O!O!|ldddi", (char **) kwlist, \
+            &PyArray_Type, &ker, &PyArray_Type, &mdl, &PyArray_Type, &res, &PyArray_Type, &sigma,
+            &PyArray_Type, &state, &nmoves, &lower, &upper, &footprint, &nthreads))
+        return NULL;
+    int krank = RANK(ker), stacked = RANK(mdl) == krank + 1;
+    if (krank != 1 && krank != 2) {
+        PyErr_Format(PyExc_ValueError, "rank(ker) must be 1 or 2");
+        return NULL;
+    }
+    if (RANK(mdl) != krank && !stacked) {
+        PyErr_Format(PyExc_ValueError, "mdl must be a plane or a stack of planes like ker");
+        return NULL;
+    }
+    npy_intp nchains = stacked ? DIM(mdl,0) : 1;
+    PyArrayObject *arrs[] = {ker, mdl, res, sigma};
+    for (int a=0; a < 4; a++) {
+        if (a > 0) { CHK_ARRAY_RANK(arrs[a], RANK(mdl)); }
+        if (a > 0 && stacked) { CHK_ARRAY_DIM(arrs[a], 0, nchains); }
+        for (int d=0; d < krank; d++) { CHK_ARRAY_DIM(arrs[a], d+(a > 0 && stacked), DIM(ker,d)); }
+        CHK_ARRAY_TYPE(arrs[a], NPY_DOUBLE);
+        if (!PyArray_ISCARRAY(arrs[a])) {
+            PyErr_Format(PyExc_ValueError, "arrays must be C-contiguous and writeable");
+            return NULL;
+        }
+    }
+    CHK_ARRAY_RANK(state, 1); CHK_ARRAY_DIM(state, 0, nchains);
+    CHK_ARRAY_TYPE(state, NPY_UINT64);
+    if (!PyArray_ISCARRAY(state)) {
+        PyErr_Format(PyExc_ValueError, "state must be C-contiguous and writeable");
+        return NULL;
+    }
+    long dim1 = krank == 2 ? DIM(ker,0) : 1, dim2 = DIM(ker,krank-1), npix = dim1*dim2;
+    if (nmoves <= 0) nmoves = npix;
+    rv = (PyArrayObject *) PyArray_SimpleNew(1, &nchains, NPY_LONG);
+    if (rv == NULL) return NULL;
+    AnnealKernel *ak = NULL;
+    try {
+        ak = new AnnealKernel((double *)PyArray_DATA(ker), dim1, dim2, footprint);
+    } catch (std::bad_alloc &) {
+        Py_DECREF(rv);
+        return PyErr_NoMemory();
+    }
+    double *md = (double *)PyArray_DATA(mdl), *rd = (double *)PyArray_DATA(res);
+    double *sd = (double *)PyArray_DATA(sigma);
+    npy_uint64 *st = (npy_uint64 *)PyArray_DATA(state);
+    Py_INCREF(ker); Py_INCREF(mdl); Py_INCREF(res); Py_INCREF(sigma); Py_INCREF(state);
+    Py_BEGIN_ALLOW_THREADS
+    aipy_parallel(nchains, nthreads, [&](long c, int) {
+        AnnealRng rng(st[c]);
+        IND1(rv,c,long) = anneal_sweep(*ak, md + c*npix, rd + c*npix,
+            sd + c*npix, dim1, dim2, nmoves, lower, upper, rng);
+        st[c] = rng.s;
+    });
+    Py_END_ALLOW_THREADS
+    Py_DECREF(ker); Py_DECREF(mdl); Py_DECREF(res); Py_DECREF(sigma); Py_DECREF(state);
+    delete ak;
+    return PyArray_Return(rv);
+}
+
+// Turn the SIMD clean kernels on or off (they are on by default)
+PyObject *set_simd(PyObject *self, PyObject *args) {
+    int enable;
+    if (!PyArg_ParseTuple(args, "i", &enable)) return NULL;
+    clean_simd_isa = clean_simd_init(enable);
+    return PyString_FromString(clean_simd_isa);
+}
+
+PyObject *get_simd(PyObject *self) {
+    return PyString_FromString(clean_simd_isa);
+}
+
+PyObject *stats(PyObject *self, PyObject *args, PyObject *kwargs) {
+    return aipy_stats_call(&clean_stats, args, kwargs);
+}
+
+// Wrap function into module
+static PyMethodDef DeconvMethods[] = {
+    {"clean", (PyCFunction)clean, METH_VARARGS|METH_KEYWORDS,
+        "clean(res,ker,mdl,gain=.1,maxiter=200,tol=.001,stop_if_div=0,verbose=0,pos_def=0,beam_patch=0,thresh=0,history=None,history_every=1,components=0,merge_components=0)\nPerform a 1 or 2 dimensional deconvolution using the CLEAN algorithm.  The GIL is released while cleaning, so independent arrays may be cleaned from concurrent threads.  If beam_patch > 0, each iteration subtracts only a box of ker around its origin: beam_patch >= 1 is the box half-width in pixels, otherwise it is a threshold relative to the kernel peak and the box encloses all pixels above it.  The peak is then tracked incrementally, so an iteration costs roughly the patch size rather than the image size.  If thresh > 0, cleaning also stops once the peak residual in area falls below thresh.  If history is a 1 dimensional array of history_dtype, every history_every'th iteration writes a record (iter, pos of the next peak, its residual value 'peak', RMS residual 'score', and the component 'step' just added) into it; records beyond the last one written get iter = -1.  If components is true, returns (iters, pos, flux) instead of iters: pos is an (n, rank) int array of the pixels where components were added and flux their steps (complex for complex res), in the order added and without zero or undone steps; with merge_components, repeated pixels are summed into one component and the list is sorted by pixel."},
+    {"clean_batch", (PyCFunction)clean_batch, METH_VARARGS|METH_KEYWORDS,
+        "clean_batch(res,ker,mdl,area,gain=.1,maxiter=200,tol=.001,stop_if_div=0,verbose=0,pos_def=0,nthreads=0,beam_patch=0)\nClean each plane along the first axis of a stack of 1 or 2 dimensional arrays.  'ker' and 'area' may be stacks matching 'res' or single planes shared by all.  Planes are cleaned in parallel on 'nthreads' native threads (0 = aipy.get_num_threads()).  Returns an int array of per-plane iteration counts with the same meaning as clean()'s return value."},
+    {"clean_1d_batch", (PyCFunction)clean_1d_batch, METH_VARARGS|METH_KEYWORDS,
+        "clean_1d_batch(res,ker,mdl,area,gain=.1,maxiter=200,tol=.001,stop_if_div=0,verbose=0,pos_def=0,nthreads=0)\nClean each row of a 2 dimensional res[nrows,n] (e.g. one delay spectrum per baseline) as a 1 dimensional array.  'ker' and 'area' may be per-row or a single row shared by all.  Equivalent to clean_batch on 1 dimensional planes, but C-contiguous rows are cleaned straight from the array buffers, so per-row overhead is negligible.  Returns an int array of per-row iteration counts."},
+    {"delay_filter", (PyCFunction)delay_filter, METH_VARARGS|METH_KEYWORDS,
+        "delay_filter(data,wgts,window,area,mdl,res,gain=.1,maxiter=100,tol=1e-9,stop_if_div=0,nthreads=0)\nDelay-filter each row of the complex128 data[nspec,nchan]: the spectrum times its float64 weights 'wgts' (per-row, or one row shared by all) and 'window' is inverse transformed to delay (as numpy.fft.ifft), cleaned as clean_1d_batch does by the transform of wgts*window within the int 'area' (nchan,) of delays, and the clean model transformed back (as numpy.fft.fft).  Writes that model spectrum to 'mdl' and (data - mdl)*wgts to 'res', both complex128 (nspec,nchan).  Rows are shared among 'nthreads' native threads (0 = aipy.get_num_threads()), each with its own FFT plan, cached by length between calls, and buffers; the GIL is released.  Returns an int array of per-row iteration counts, 0 for rows with no weight."},
+    {"clean_joint", (PyCFunction)clean_joint, METH_VARARGS|METH_KEYWORDS,
+        "clean_joint(res,ker,mdl,area,gain=.1,maxiter=200,tol=.001,stop_if_div=0,verbose=0,pos_def=0)\nJointly clean a stack of 1 or 2 dimensional planes (e.g. polarisations or MFS terms) whose components share positions.  'res', 'ker' and 'mdl' are C-contiguous stacks of per-plane residuals, kernels and models; 'area' is a single plane.  Each iteration finds the peak of the residual power summed over planes and subtracts every plane's kernel there with that plane's own step, in one pass over memory.  pos_def requires plane 0 to be positive at the peak.  Returns the iteration count as clean() does."},
+    {"clean_ms", (PyCFunction)clean_ms, METH_VARARGS|METH_KEYWORDS,
+        "clean_ms(res,ker,mdl,area,bias,gain=.1,maxiter=200,tol=.001,verbose=0,pos_def=0)\nPerform a 1 or 2 dimensional multi-scale CLEAN of real-valued data.  'res' and 'mdl' are stacks of one residual (convolved with that scale) and one component image per scale, 'ker' is the nscales x nscales stack of cross-scale beams, and 'bias' weights the peak of each scale.  Every iteration cleans the scale with the largest weighted peak and updates all scale residuals in place.  Stops on divergence; returns the iteration count as clean() does."},
+    {"maxent", (PyCFunction)maxent, METH_VARARGS|METH_KEYWORDS,
+        "maxent(im,ker,mdl,b,res,var0,gain=.1,tol=.001,maxiter=200,lower=tiny,upper=inf,verbose=0)\nRun the maximum entropy deconvolution of aipy.deconv.maxent on 1 or 2 dimensional float64 arrays.  'mdl' is the prior model and 'b' the starting model, which is updated in place; 'res' receives the final residual.  Convolutions are circular, by FFT.  'lower' defaults to the smallest positive float64, as the entropy needs b > 0.  Returns (iter, term, score, alpha), where term is 0 for maxiter, 1 for tol and 2 for divergence."},
+    {"lsq", (PyCFunction)lsq, METH_VARARGS|METH_KEYWORDS,
+        "lsq(im,ker,x,area,res,gain=.1,tol=.001,maxiter=200,lower=tiny,upper=inf,verbose=0,nthreads=0)\nRun the least-squares deconvolution of aipy.deconv.lsq on each plane of a stack (first axis) of 1 or 2 dimensional float64 planes 'im'.  'x' holds the starting models and is updated in place; 'res' receives the final residuals.  'ker' and 'area' (float64, multiplying the difference) may be stacks matching 'im' or single planes shared by all.  Convolutions are circular, by FFT, with a kernel's transform computed once; an iteration costs two FFTs and two sweeps of the plane.  Planes are shared among 'nthreads' native threads (0 = aipy.get_num_threads()), with the GIL released.  Returns (iters, terms, scores), per-plane arrays of the iterations, the terminations (0 for maxiter, 1 for tol) and the final scores."},
+    {"anneal", (PyCFunction)anneal, METH_VARARGS|METH_KEYWORDS,
+        "anneal(ker,mdl,res,sigma,state,nmoves=0,lower=-inf,upper=inf,footprint=0,nthreads=0)\nRun one simulated-annealing sweep on real-valued float64 data: 'nmoves' (0 = one per pixel) single-pixel perturbations of 'mdl', drawn from N(0,sigma) at random pixels, clipped to [lower,upper] and kept if they lower the power in the residual 'res' = im - mdl (*) ker (circular).  'res' is updated in place through the kernel entries above footprint*max|ker| only.  'mdl', 'res' and 'sigma' may be stacks of independent chains, run in parallel on 'nthreads' native threads (0 = aipy.get_num_threads()); 'state' holds one nonzero uint64 RNG state per chain and is advanced in place.  Returns an int array of the moves kept per chain."},
+    {"set_simd", (PyCFunction)set_simd, METH_VARARGS,
+        "set_simd(enable)\nEnable or disable the vectorised (AVX-512/AVX2/NEON) kernels used for contiguous float32/float64 data.  Returns the name of the instruction set now in use ('none' for the scalar loops)."},
+    {"get_simd", (PyCFunction)get_simd, METH_NOARGS,
+        "get_simd()\nReturn the name of the instruction set used by the vectorised clean kernels ('none' for the scalar loops)."},
+    {"stats", (PyCFunction)stats, METH_VARARGS|METH_KEYWORDS,
+        "stats(enable=None,reset=False)\nReturn a dict of the counters of cleaning work: calls of clean, clean_joint, clean_ms, clean_batch, clean_1d_batch and delay_filter, the planes (rows, spectra) they cleaned, the iterations taken and nanoseconds spent.  Counting is off until switched on by enable=True (and off again by enable=False).  reset zeroes the counters after returning them."},
+    {NULL, NULL}
+};
+
+MOD_INIT(_deconv) {
+    PyObject* m;
+
+    Py_Initialize();
+
+    // Module definitions and functions
+    MOD_DEF(m, "_deconv", DeconvMethods, "Deconvolution module");
+    if (m == NULL)
+        return MOD_ERROR_VAL;
+
+    import_array();
+    if (aipy_pool_import() < 0)
+        return MOD_ERROR_VAL;
+
+    clean_simd_isa = clean_simd_init(1);
+
+    if (!init_history_descr() || PyModule_AddObject(m, "history_dtype",
+            (PyObject *) history_descr) < 0)
+        return MOD_ERROR_VAL;
+    Py_INCREF(history_descr);
 
     return MOD_SUCCESS_VAL(m);
 };
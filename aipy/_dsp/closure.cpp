@@ -0,0 +1,83 @@
+// Closure quantities for dsp.closure_phases and dsp.closure_amps, from
+// complex64 (ntime, nbl, ninner) cubes (ninner being the polarizations
+// and channels of a uv.to_cube cube) with bool flags (nonzero = flagged)
+// of the same shape, into float32 (ntime, nclose, ninner) outputs and
+// their flags.  Each closure quantity takes its baselines from a row of
+// a table; the rows are shared among threads, each working through the
+// channels of one integration at a time.  Flagged outputs are 0.
+
+#include "closure.h"
+#include "aipy_pool.h"
+#include <cmath>
+
+// Checks that the k columns of the ntab rows of tab index baselines < nbl
+static int chk_table(const long *tab, long ntab, int k, long nbl) {
+    for (long r=0; r < ntab * k; r++)
+        if (tab[r] < 0 || tab[r] >= nbl) return -1;
+    return 0;
+}
+
+// Closure phases arg(V[a] V[b] conj(V[c])) of the rows (a, b, c) of tri
+extern "C"
+int closure_phs(float *out, unsigned char *oflag, const float *vis,
+        const unsigned char *flag, long ntime, long nbl, long ninner,
+        const long *tri, long ntri, int nthreads) {
+    if (chk_table(tri, ntri, 3, nbl) != 0) return -1;
+    aipy_parallel(ntri, nthreads, [&](long r, int) {
+        const long *row = tri + 3*r;
+        for (long t=0; t < ntime; t++) {
+            const float *va = vis + 2*(t*nbl + row[0])*ninner;
+            const float *vb = vis + 2*(t*nbl + row[1])*ninner;
+            const float *vc = vis + 2*(t*nbl + row[2])*ninner;
+            const unsigned char *fa = flag + (t*nbl + row[0])*ninner;
+            const unsigned char *fb = flag + (t*nbl + row[1])*ninner;
+            const unsigned char *fc = flag + (t*nbl + row[2])*ninner;
+            float *o = out + (t*ntri + r)*ninner;
+            unsigned char *of = oflag + (t*ntri + r)*ninner;
+            for (long c=0; c < ninner; c++) {
+                float abr = va[2*c]*vb[2*c] - va[2*c+1]*vb[2*c+1];
+                float abi = va[2*c]*vb[2*c+1] + va[2*c+1]*vb[2*c];
+                float re = abr*vc[2*c] + abi*vc[2*c+1];
+                float im = abi*vc[2*c] - abr*vc[2*c+1];
+                unsigned char f = fa[c] | fb[c] | fc[c];
+                of[c] = f != 0;
+                o[c] = f ? 0.f : std::atan2(im, re);
+            }
+        }
+    });
+    return 0;
+}
+
+// Closure amplitudes |V[a]| |V[b]| / (|V[c]| |V[d]|) of the rows (a, b, c,
+// d) of quad, also flagged where the denominator is 0
+extern "C"
+int closure_amp(float *out, unsigned char *oflag, const float *vis,
+        const unsigned char *flag, long ntime, long nbl, long ninner,
+        const long *quad, long nquad, int nthreads) {
+    if (chk_table(quad, nquad, 4, nbl) != 0) return -1;
+    aipy_parallel(nquad, nthreads, [&](long r, int) {
+        const long *row = quad + 4*r;
+        for (long t=0; t < ntime; t++) {
+            const float *v[4];
+            const unsigned char *fl[4];
+            for (int k=0; k < 4; k++) {
+                v[k] = vis + 2*(t*nbl + row[k])*ninner;
+                fl[k] = flag + (t*nbl + row[k])*ninner;
+            }
+            float *o = out + (t*nquad + r)*ninner;
+            unsigned char *of = oflag + (t*nquad + r)*ninner;
+            for (long c=0; c < ninner; c++) {
+                // Squared amplitudes, in double so that the products of
+                // four neither overflow nor underflow
+                double p[4];
+                for (int k=0; k < 4; k++)
+                    p[k] = (double) v[k][2*c]*v[k][2*c] + (double) v[k][2*c+1]*v[k][2*c+1];
+                double den = p[2] * p[3];
+                unsigned char f = fl[0][c] | fl[1][c] | fl[2][c] | fl[3][c] | (den == 0);
+                of[c] = f != 0;
+                o[c] = f ? 0.f : (float) std::sqrt(p[0] * p[1] / den);
+            }
+        }
+    });
+    return 0;
+}
@@ -0,0 +1,17 @@
+#ifndef _CLOSURE_H_
+#define _CLOSURE_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int closure_phs(float *, unsigned char *, const float *, const unsigned char *,
+        long, long, long, const long *, long, int);
+int closure_amp(float *, unsigned char *, const float *, const unsigned char *,
+        long, long, long, const long *, long, int);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
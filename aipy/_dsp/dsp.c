@@ -1,21 +1,86 @@
 #include "dsp.h"
 #include "aipy_compat.h"
+#include "aipy_stats.h"
+#define AIPY_POOL_MAIN
+#include "aipy_pool.h"
+
+// The counters of stats(): calls, visibilities and time of gridding and
+// degridding
+enum { ST_GRID, ST_GRID_VIS, ST_GRID_NS, ST_DEGRID, ST_DEGRID_VIS, ST_DEGRID_NS, ST_N };
+static aipy_stats dsp_stats = {0, ST_N, {"grid_calls", "grid_vis", "grid_ns",
+    "degrid_calls", "degrid_vis", "degrid_ns"}};
+
+// Counts a call of kind k (ST_GRID or ST_DEGRID) on n visibilities from t0
+#define COUNT_CALL(k,n,t0) do { AIPY_STATS_ADD(dsp_stats, k, 1); \
+    AIPY_STATS_ADD(dsp_stats, (k)+1, n); AIPY_STATS_TIME(dsp_stats, (k)+2, t0); } while (0)
+
+// Sets *v to a strided view of the 1D array a, which must hold float32 or
+// float64 (cplx = 0) or complex64 or complex128 (cplx = 1) values
+static int sview_array(PyArrayObject *a, int cplx, sview *v, const char *name) {
+    int t = PyArray_TYPE(a);
+    if (RANK(a) != 1 || (t != (cplx ? NPY_CFLOAT : NPY_FLOAT)
+            && t != (cplx ? NPY_CDOUBLE : NPY_DOUBLE)) || !PyArray_ISALIGNED(a)) {
+        PyErr_Format(PyExc_ValueError, "%s must be a 1D, aligned %s array", name,
+            cplx ? "complex64 or complex128" : "float32 or float64");
+        return -1;
+    }
+    v->p = (char *) PyArray_DATA(a);
+    v->stride = (long) PyArray_STRIDE(a,0);
+    v->dbl = (t == NPY_DOUBLE || t == NPY_CDOUBLE);
+    return 0;
+}
+#define CHK_SVIEW(a,cplx,v) \
+    if (sview_array(a, cplx, &v, QUOTE(a)) != 0) return NULL;
+
+// Optional per-sample arrays of n entries (None gives p = NULL): real
+// weights as sview_array, and flags of bool or int type
+static int opt_sview(PyObject *o, long n, sview *v, const char *name) {
+    *v = sv_none();
+    if (o == Py_None) return 0;
+    if (!PyArray_Check(o) || sview_array((PyArrayObject *) o, 0, v, name) != 0)
+        return -1;
+    if (PyArray_DIM((PyArrayObject *) o, 0) != n) {
+        PyErr_Format(PyExc_ValueError, "%s must have one entry per sample", name);
+        return -1;
+    }
+    return 0;
+}
+
+static int opt_fview(PyObject *o, long n, fview *f) {
+    PyArrayObject *a = (PyArrayObject *) o;
+    int size;
+    *f = fv_none();
+    if (o == Py_None) return 0;
+    if (!PyArray_Check(o) || RANK(a) != 1 || !PyArray_ISALIGNED(a)
+            || !(PyArray_ISBOOL(a) || PyArray_ISINTEGER(a))
+            || ((size = (int) PyArray_ITEMSIZE(a)) != 1 && size != 4 && size != 8)) {
+        PyErr_Format(PyExc_ValueError, "flags must be a 1D, aligned bool or int array");
+        return -1;
+    }
+    if (PyArray_DIM(a,0) != n) {
+        PyErr_Format(PyExc_ValueError, "flags must have one entry per sample");
+        return -1;
+    }
+    f->p = (char *) PyArray_DATA(a);
+    f->stride = (long) PyArray_STRIDE(a,0);
+    f->size = size;
+    return 0;
+}
 
 // Adds data to a at indicies specified in ind.  Checks safety of arrays input.
 PyObject *wrap_grid1D_c(PyObject *self, PyObject *args) {
     PyArrayObject *buf, *ind, *dat;
+    sview vind, vdat;
     int rv;
     long footprint=6;
     // Parse arguments and perform sanity check
-    if (!PyArg_ParseTuple(args, "O!O!O!|i", &PyArray_Type, &buf,
+    if (!PyArg_ParseTuple(args, "O!O!O!|l", &PyArray_Type, &buf,
             &PyArray_Type, &ind, &PyArray_Type, &dat, &footprint))
         return NULL;
     CHK_ARRAY_RANK(buf, 1);
-    CHK_ARRAY_RANK(ind, 1);
-    CHK_ARRAY_RANK(dat, 1);
     CHK_ARRAY_TYPE(buf, NPY_CFLOAT);
-    CHK_ARRAY_TYPE(ind, NPY_FLOAT);
-    CHK_ARRAY_TYPE(dat, NPY_CFLOAT);
+    CHK_SVIEW(ind, 0, vind);
+    CHK_SVIEW(dat, 1, vdat);
     if (PyArray_DIM(ind,0) != PyArray_DIM(dat,0)) {
         PyErr_Format(PyExc_ValueError, "Dimensions of ind and dat do not match");
         return NULL;
@@ -24,9 +89,12 @@ PyObject *wrap_grid1D_c(PyObject *self, PyObject *args) {
     Py_INCREF(buf);
     Py_INCREF(ind);
     Py_INCREF(dat);
-    rv = grid1D_c((float *) PyArray_DATA(buf), (long) PyArray_DIM(buf,0),
-                  (float *) PyArray_DATA(ind),
-                  (float *) PyArray_DATA(dat), (long) PyArray_DIM(dat,0), footprint);
+    long long t0 = aipy_stats_clock(&dsp_stats);
+    Py_BEGIN_ALLOW_THREADS
+    rv = grid1D_c_sv((float *) PyArray_DATA(buf), (long) PyArray_DIM(buf,0),
+                  vind, vdat, (long) PyArray_DIM(dat,0), footprint);
+    Py_END_ALLOW_THREADS
+    COUNT_CALL(ST_GRID, (long) PyArray_DIM(dat,0), t0);
     Py_DECREF(buf);
     Py_DECREF(ind);
     Py_DECREF(dat);
@@ -41,11 +109,62 @@ PyObject *wrap_grid1D_c(PyObject *self, PyObject *args) {
 
 PyObject *wrap_grid2D_c(PyObject *self, PyObject *args) {
     PyArrayObject *buf, *ind1, *ind2, *dat;
+    PyObject *fobj=Py_None, *wobj=Py_None;
+    sview vind1, vind2, vdat, vwgt;
+    fview vflags;
     int rv;
     long footprint=6;
     // Parse arguments and perform sanity check
-    if (!PyArg_ParseTuple(args, "O!O!O!O!|i", &PyArray_Type, &buf,
-            &PyArray_Type, &ind1, &PyArray_Type, &ind2, &PyArray_Type, &dat, &footprint))
+    if (!PyArg_ParseTuple(args, "O!O!O!O!|lOO", &PyArray_Type, &buf,
+            &PyArray_Type, &ind1, &PyArray_Type, &ind2, &PyArray_Type, &dat,
+            &footprint, &fobj, &wobj))
+        return NULL;
+    CHK_ARRAY_RANK(buf, 2);
+    CHK_ARRAY_TYPE(buf, NPY_CFLOAT);
+    CHK_SVIEW(ind1, 0, vind1);
+    CHK_SVIEW(ind2, 0, vind2);
+    CHK_SVIEW(dat, 1, vdat);
+    if (PyArray_DIM(ind1,0) != PyArray_DIM(dat,0) || PyArray_DIM(ind2,0) != PyArray_DIM(dat,0)) {
+        PyErr_Format(PyExc_ValueError, "Dimensions of ind and dat do not match");
+        return NULL;
+    }
+    if (opt_fview(fobj, (long) PyArray_DIM(dat,0), &vflags) != 0
+            || opt_sview(wobj, (long) PyArray_DIM(dat,0), &vwgt, "wgt") != 0)
+        return NULL;
+
+    Py_INCREF(buf);
+    Py_INCREF(ind1);
+    Py_INCREF(ind2);
+    Py_INCREF(dat);
+    long long t0 = aipy_stats_clock(&dsp_stats);
+    Py_BEGIN_ALLOW_THREADS
+    rv = grid2D_c_sv((float *) PyArray_DATA(buf), (long) PyArray_DIM(buf,0), (long) PyArray_DIM(buf,1),
+                  vind1, vind2, vdat, (long) PyArray_DIM(dat,0), footprint,
+                  vflags, vwgt);
+    Py_END_ALLOW_THREADS
+    COUNT_CALL(ST_GRID, (long) PyArray_DIM(dat,0), t0);
+    Py_DECREF(buf);
+    Py_DECREF(ind1);
+    Py_DECREF(ind2);
+    Py_DECREF(dat);
+    if (rv == 0) {
+        Py_INCREF(Py_None);
+        return Py_None;
+    } else {
+        PyErr_Format(PyExc_ValueError, "Invalid indices found.");
+        return NULL;
+    }
+}
+
+// Multithreaded grid2D_c; releases the GIL while gridding
+PyObject *wrap_grid2D_c_mt(PyObject *self, PyObject *args) {
+    PyArrayObject *buf, *ind1, *ind2, *dat;
+    int rv, nthreads=0;
+    long footprint=6;
+    // Parse arguments and perform sanity check
+    if (!PyArg_ParseTuple(args, "O!O!O!O!|li", &PyArray_Type, &buf,
+            &PyArray_Type, &ind1, &PyArray_Type, &ind2, &PyArray_Type, &dat,
+            &footprint, &nthreads))
         return NULL;
     CHK_ARRAY_RANK(buf, 2);
     CHK_ARRAY_RANK(ind1, 1);
@@ -64,9 +183,261 @@ PyObject *wrap_grid2D_c(PyObject *self, PyObject *args) {
     Py_INCREF(ind1);
     Py_INCREF(ind2);
     Py_INCREF(dat);
-    rv = grid2D_c((float *) PyArray_DATA(buf), (long) PyArray_DIM(buf,0), (long) PyArray_DIM(buf,1),
+    long long t0 = aipy_stats_clock(&dsp_stats);
+    Py_BEGIN_ALLOW_THREADS
+    rv = grid2D_c_mt((float *) PyArray_DATA(buf), (long) PyArray_DIM(buf,0), (long) PyArray_DIM(buf,1),
                   (float *) PyArray_DATA(ind1), (float *) PyArray_DATA(ind2),
-                  (float *) PyArray_DATA(dat), (long) PyArray_DIM(dat,0), footprint);
+                  (float *) PyArray_DATA(dat), (long) PyArray_DIM(dat,0), footprint, nthreads);
+    Py_END_ALLOW_THREADS
+    COUNT_CALL(ST_GRID, (long) PyArray_DIM(dat,0), t0);
+    Py_DECREF(buf);
+    Py_DECREF(ind1);
+    Py_DECREF(ind2);
+    Py_DECREF(dat);
+    if (rv == 0) {
+        Py_INCREF(Py_None);
+        return Py_None;
+    } else {
+        PyErr_Format(PyExc_ValueError, "Invalid indices found.");
+        return NULL;
+    }
+}
+
+// Tile-by-tile sample order for cache-friendly gridding
+PyObject *wrap_tile_order(PyObject *self, PyObject *args) {
+    PyArrayObject *ind1, *ind2, *order;
+    long dim1, dim2, footprint=6;
+    npy_intp n;
+    // Parse arguments and perform sanity check
+    if (!PyArg_ParseTuple(args, "O!O!ll|l", &PyArray_Type, &ind1,
+            &PyArray_Type, &ind2, &dim1, &dim2, &footprint))
+        return NULL;
+    CHK_ARRAY_RANK(ind1, 1);
+    CHK_ARRAY_RANK(ind2, 1);
+    CHK_ARRAY_TYPE(ind1, NPY_FLOAT);
+    CHK_ARRAY_TYPE(ind2, NPY_FLOAT);
+    if (PyArray_DIM(ind1,0) != PyArray_DIM(ind2,0)) {
+        PyErr_Format(PyExc_ValueError, "Dimensions of ind1 and ind2 do not match");
+        return NULL;
+    }
+    if (dim1 < 1 || dim2 < 1) {
+        PyErr_Format(PyExc_ValueError, "dim1 and dim2 must be >= 1");
+        return NULL;
+    }
+    n = PyArray_DIM(ind1,0);
+    order = (PyArrayObject *) PyArray_SimpleNew(1, &n, NPY_LONG);
+    if (order == NULL) return NULL;
+    grid_tile_order((long *) PyArray_DATA(order), dim1, dim2,
+                    (float *) PyArray_DATA(ind1), (float *) PyArray_DATA(ind2),
+                    (long) n, footprint);
+    return PyArray_Return(order);
+}
+
+// Checks that order only indexes samples 0..n-1
+static int chk_order(long *o, long n) {
+    long i;
+    for (i = 0; i < n; i++) {
+        if (o[i] < 0 || o[i] >= n) {
+            PyErr_Format(PyExc_ValueError, "order has entries outside [0, len(dat))");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// grid2D_c, visiting samples in a given order
+PyObject *wrap_grid2D_c_order(PyObject *self, PyObject *args) {
+    PyArrayObject *buf, *ind1, *ind2, *dat, *order;
+    int rv;
+    long footprint=6, n, *o;
+    // Parse arguments and perform sanity check
+    if (!PyArg_ParseTuple(args, "O!O!O!O!O!|l", &PyArray_Type, &buf,
+            &PyArray_Type, &ind1, &PyArray_Type, &ind2, &PyArray_Type, &dat,
+            &PyArray_Type, &order, &footprint))
+        return NULL;
+    CHK_ARRAY_RANK(buf, 2);
+    CHK_ARRAY_RANK(ind1, 1);
+    CHK_ARRAY_RANK(ind2, 1);
+    CHK_ARRAY_RANK(dat, 1);
+    CHK_ARRAY_RANK(order, 1);
+    CHK_ARRAY_TYPE(buf, NPY_CFLOAT);
+    CHK_ARRAY_TYPE(ind1, NPY_FLOAT);
+    CHK_ARRAY_TYPE(ind2, NPY_FLOAT);
+    CHK_ARRAY_TYPE(dat, NPY_CFLOAT);
+    CHK_ARRAY_TYPE(order, NPY_LONG);
+    if (PyArray_DIM(ind1,0) != PyArray_DIM(dat,0) || PyArray_DIM(ind2,0) != PyArray_DIM(dat,0)
+            || PyArray_DIM(order,0) != PyArray_DIM(dat,0)) {
+        PyErr_Format(PyExc_ValueError, "Dimensions of ind, dat and order do not match");
+        return NULL;
+    }
+    n = (long) PyArray_DIM(dat,0);
+    o = (long *) PyArray_DATA(order);
+    if (chk_order(o, n) != 0) return NULL;
+
+    Py_INCREF(buf);
+    Py_INCREF(ind1);
+    Py_INCREF(ind2);
+    Py_INCREF(dat);
+    Py_INCREF(order);
+    rv = grid2D_c_order((float *) PyArray_DATA(buf), (long) PyArray_DIM(buf,0), (long) PyArray_DIM(buf,1),
+                  (float *) PyArray_DATA(ind1), (float *) PyArray_DATA(ind2),
+                  (float *) PyArray_DATA(dat), n, footprint, o);
+    Py_DECREF(buf);
+    Py_DECREF(ind1);
+    Py_DECREF(ind2);
+    Py_DECREF(dat);
+    Py_DECREF(order);
+    if (rv == 0) {
+        Py_INCREF(Py_None);
+        return Py_None;
+    } else {
+        PyErr_Format(PyExc_ValueError, "Invalid indices found.");
+        return NULL;
+    }
+}
+
+// Grids several planes' values at the same uv points in one pass, onto
+// full grids or (herm != 0) Hermitian half-plane grids
+static PyObject *grid_multi(PyObject *args, int herm) {
+    PyObject *bufs, *dats, *oobj=Py_None, *fobj=Py_None, *wobj=Py_None;
+    PyObject *bseq=NULL, *dseq=NULL, *rv_obj=NULL;
+    PyArrayObject *ind1, *ind2, *b0, *a;
+    sview vind1, vind2, vwgt, *dp=NULL;
+    fview vflags;
+    int rv, k, nplanes;
+    long footprint=6, n, dim1, dim2=0, width, *o=NULL;
+    float **bp=NULL;
+    long long t0;
+    // Parse arguments and perform sanity check
+    if (herm) {
+        if (!PyArg_ParseTuple(args, "OO!O!Ol|lOOO", &bufs, &PyArray_Type, &ind1,
+                &PyArray_Type, &ind2, &dats, &dim2, &footprint, &oobj, &fobj, &wobj))
+            return NULL;
+    } else if (!PyArg_ParseTuple(args, "OO!O!O|lOOO", &bufs, &PyArray_Type, &ind1,
+            &PyArray_Type, &ind2, &dats, &footprint, &oobj, &fobj, &wobj))
+        return NULL;
+    CHK_SVIEW(ind1, 0, vind1);
+    CHK_SVIEW(ind2, 0, vind2);
+    CHK_ARRAY_DIM(ind2, 0, PyArray_DIM(ind1,0));
+    n = (long) PyArray_DIM(ind1,0);
+    if (opt_fview(fobj, n, &vflags) != 0 || opt_sview(wobj, n, &vwgt, "wgt") != 0)
+        return NULL;
+    bseq = PySequence_Tuple(bufs);
+    dseq = PySequence_Tuple(dats);
+    if (bseq == NULL || dseq == NULL) goto done;
+    nplanes = (int) PyTuple_GET_SIZE(bseq);
+    if (nplanes < 1 || PyTuple_GET_SIZE(dseq) != nplanes) {
+        PyErr_Format(PyExc_ValueError, "need one dat array per buf");
+        goto done;
+    }
+    b0 = (PyArrayObject *) PyTuple_GET_ITEM(bseq, 0);
+    if (!PyArray_Check((PyObject *) b0) || RANK(b0) != 2) {
+        PyErr_Format(PyExc_ValueError, "bufs must be 2D arrays");
+        goto done;
+    }
+    dim1 = (long) PyArray_DIM(b0,0);
+    width = (long) PyArray_DIM(b0,1);
+    if (!herm) dim2 = width;
+    else if (dim2 < 1 || width != dim2 / 2 + 1) {
+        PyErr_Format(PyExc_ValueError, "half-plane bufs must be dim2//2+1 wide");
+        goto done;
+    }
+    bp = (float **) malloc(nplanes * sizeof(float *));
+    dp = (sview *) malloc(nplanes * sizeof(sview));
+    if (bp == NULL || dp == NULL) { PyErr_NoMemory(); goto done; }
+    for (k = 0; k < nplanes; k++) {
+        a = (PyArrayObject *) PyTuple_GET_ITEM(bseq, k);
+        if (!PyArray_Check((PyObject *) a) || PyArray_TYPE(a) != NPY_CFLOAT || RANK(a) != 2
+                || PyArray_DIM(a,0) != dim1 || PyArray_DIM(a,1) != width
+                || !PyArray_ISCARRAY(a)) {
+            PyErr_Format(PyExc_ValueError, "bufs must be C-contiguous complex64 arrays of the same shape");
+            goto done;
+        }
+        bp[k] = (float *) PyArray_DATA(a);
+        a = (PyArrayObject *) PyTuple_GET_ITEM(dseq, k);
+        if (!PyArray_Check((PyObject *) a) || sview_array(a, 1, &dp[k], "dats") != 0)
+            goto done;
+        if (PyArray_DIM(a,0) != n) {
+            PyErr_Format(PyExc_ValueError, "dats must be as long as ind1");
+            goto done;
+        }
+    }
+    if (oobj != Py_None) {
+        a = (PyArrayObject *) oobj;
+        if (!PyArray_Check(oobj) || PyArray_TYPE(a) != NPY_LONG || RANK(a) != 1
+                || PyArray_DIM(a,0) != n || !PyArray_ISCARRAY(a)) {
+            PyErr_Format(PyExc_ValueError, "order must be a contiguous int array as long as ind1");
+            goto done;
+        }
+        o = (long *) PyArray_DATA(a);
+        if (chk_order(o, n) != 0) goto done;
+    }
+
+    t0 = aipy_stats_clock(&dsp_stats);
+    Py_BEGIN_ALLOW_THREADS
+    if (herm) rv = grid2D_herm_c(bp, nplanes, dim1, dim2, vind1, vind2, dp, n,
+                        footprint, o, vflags, vwgt);
+    else rv = grid2D_multi_c(bp, nplanes, dim1, dim2, vind1, vind2, dp, n,
+                        footprint, o, vflags, vwgt);
+    Py_END_ALLOW_THREADS
+    COUNT_CALL(ST_GRID, n, t0);
+    if (rv == 0) {
+        Py_INCREF(Py_None);
+        rv_obj = Py_None;
+    } else {
+        PyErr_Format(PyExc_ValueError, "Invalid indices found.");
+    }
+done:
+    Py_XDECREF(bseq);
+    Py_XDECREF(dseq);
+    free(bp);
+    free(dp);
+    return rv_obj;
+}
+
+PyObject *wrap_grid2D_multi_c(PyObject *self, PyObject *args) {
+    return grid_multi(args, 0);
+}
+
+PyObject *wrap_grid2D_herm_c(PyObject *self, PyObject *args) {
+    return grid_multi(args, 1);
+}
+
+// degrid2D_c from a Hermitian half-plane grid
+PyObject *wrap_degrid2D_herm_c(PyObject *self, PyObject *args) {
+    PyArrayObject *buf, *ind1, *ind2, *dat;
+    sview vind1, vind2, vdat;
+    int rv;
+    long footprint=6, dim2;
+    // Parse arguments and perform sanity check
+    if (!PyArg_ParseTuple(args, "O!O!O!O!l|l", &PyArray_Type, &buf,
+            &PyArray_Type, &ind1, &PyArray_Type, &ind2, &PyArray_Type, &dat,
+            &dim2, &footprint))
+        return NULL;
+    CHK_ARRAY_RANK(buf, 2);
+    CHK_ARRAY_TYPE(buf, NPY_CFLOAT);
+    if (dim2 < 1 || PyArray_DIM(buf,1) != dim2 / 2 + 1 || !PyArray_ISCARRAY(buf)) {
+        PyErr_Format(PyExc_ValueError, "buf must be a C-contiguous half-plane grid dim2//2+1 wide");
+        return NULL;
+    }
+    CHK_SVIEW(ind1, 0, vind1);
+    CHK_SVIEW(ind2, 0, vind2);
+    CHK_SVIEW(dat, 1, vdat);
+    if (PyArray_DIM(ind1,0) != PyArray_DIM(dat,0) || PyArray_DIM(ind2,0) != PyArray_DIM(dat,0)) {
+        PyErr_Format(PyExc_ValueError, "Dimensions of ind and dat do not match");
+        return NULL;
+    }
+
+    Py_INCREF(buf);
+    Py_INCREF(ind1);
+    Py_INCREF(ind2);
+    Py_INCREF(dat);
+    long long t0 = aipy_stats_clock(&dsp_stats);
+    Py_BEGIN_ALLOW_THREADS
+    rv = degrid2D_herm_c((float *) PyArray_DATA(buf), (long) PyArray_DIM(buf,0), dim2,
+                  vind1, vind2, vdat, (long) PyArray_DIM(dat,0), footprint);
+    Py_END_ALLOW_THREADS
+    COUNT_CALL(ST_DEGRID, (long) PyArray_DIM(dat,0), t0);
     Py_DECREF(buf);
     Py_DECREF(ind1);
     Py_DECREF(ind2);
@@ -82,13 +453,167 @@ PyObject *wrap_grid2D_c(PyObject *self, PyObject *args) {
 
 PyObject *wrap_degrid2D_c(PyObject *self, PyObject *args) {
     PyArrayObject *buf, *ind1, *ind2, *dat;
+    sview vind1, vind2, vdat;
     int rv;
     long footprint=6;
     // Parse arguments and perform sanity check
-    if (!PyArg_ParseTuple(args, "O!O!O!O!|i", &PyArray_Type, &buf,
+    if (!PyArg_ParseTuple(args, "O!O!O!O!|l", &PyArray_Type, &buf,
             &PyArray_Type, &ind1, &PyArray_Type, &ind2, &PyArray_Type, &dat, &footprint))
         return NULL;
     CHK_ARRAY_RANK(buf, 2);
+    CHK_ARRAY_TYPE(buf, NPY_CFLOAT);
+    CHK_SVIEW(ind1, 0, vind1);
+    CHK_SVIEW(ind2, 0, vind2);
+    CHK_SVIEW(dat, 1, vdat);
+    if (PyArray_DIM(ind1,0) != PyArray_DIM(dat,0) || PyArray_DIM(ind2,0) != PyArray_DIM(dat,0)) {
+        PyErr_Format(PyExc_ValueError, "Dimensions of ind and dat do not match");
+        return NULL;
+    }
+
+    Py_INCREF(buf);
+    Py_INCREF(ind1);
+    Py_INCREF(ind2);
+    Py_INCREF(dat);
+    // Being lazy.  should allocate data rather than take it as an argument
+    long long t0 = aipy_stats_clock(&dsp_stats);
+    Py_BEGIN_ALLOW_THREADS
+    rv = degrid2D_c_sv((float *) PyArray_DATA(buf), (long) PyArray_DIM(buf,0), (long) PyArray_DIM(buf,1),
+                  vind1, vind2, vdat, (long) PyArray_DIM(dat,0), footprint);
+    Py_END_ALLOW_THREADS
+    COUNT_CALL(ST_DEGRID, (long) PyArray_DIM(dat,0), t0);
+    Py_DECREF(buf);
+    Py_DECREF(ind1);
+    Py_DECREF(ind2);
+    Py_DECREF(dat);
+    if (rv == 0) {
+        Py_INCREF(Py_None);
+        return Py_None;
+    } else {
+        PyErr_Format(PyExc_ValueError, "Invalid indices found.");
+        return NULL;
+    }
+}
+
+// degrid2D_c spread over native threads
+PyObject *wrap_degrid2D_c_mt(PyObject *self, PyObject *args) {
+    PyArrayObject *buf, *ind1, *ind2, *dat;
+    sview vind1, vind2, vdat;
+    int rv, nthreads=0;
+    long footprint=6;
+    // Parse arguments and perform sanity check
+    if (!PyArg_ParseTuple(args, "O!O!O!O!|li", &PyArray_Type, &buf,
+            &PyArray_Type, &ind1, &PyArray_Type, &ind2, &PyArray_Type, &dat,
+            &footprint, &nthreads))
+        return NULL;
+    CHK_ARRAY_RANK(buf, 2);
+    CHK_ARRAY_TYPE(buf, NPY_CFLOAT);
+    CHK_SVIEW(ind1, 0, vind1);
+    CHK_SVIEW(ind2, 0, vind2);
+    CHK_SVIEW(dat, 1, vdat);
+    if (PyArray_DIM(ind1,0) != PyArray_DIM(dat,0) || PyArray_DIM(ind2,0) != PyArray_DIM(dat,0)) {
+        PyErr_Format(PyExc_ValueError, "Dimensions of ind and dat do not match");
+        return NULL;
+    }
+
+    Py_INCREF(buf);
+    Py_INCREF(ind1);
+    Py_INCREF(ind2);
+    Py_INCREF(dat);
+    long long t0 = aipy_stats_clock(&dsp_stats);
+    Py_BEGIN_ALLOW_THREADS
+    rv = degrid2D_c_mt((float *) PyArray_DATA(buf), (long) PyArray_DIM(buf,0), (long) PyArray_DIM(buf,1),
+                  vind1, vind2, vdat, (long) PyArray_DIM(dat,0), footprint, nthreads);
+    Py_END_ALLOW_THREADS
+    COUNT_CALL(ST_DEGRID, (long) PyArray_DIM(dat,0), t0);
+    Py_DECREF(buf);
+    Py_DECREF(ind1);
+    Py_DECREF(ind2);
+    Py_DECREF(dat);
+    if (rv == 0) {
+        Py_INCREF(Py_None);
+        return Py_None;
+    } else {
+        PyErr_Format(PyExc_ValueError, "Invalid indices found.");
+        return NULL;
+    }
+}
+
+// Major cycle: residual visibilities and their grid from a model uv plane
+PyObject *wrap_degrid_grid2D_c(PyObject *self, PyObject *args) {
+    PyArrayObject *mdl, *res, *ind1, *ind2, *dat, *rdat;
+    int rv;
+    long footprint=6;
+    // Parse arguments and perform sanity check
+    if (!PyArg_ParseTuple(args, "O!O!O!O!O!O!|i", &PyArray_Type, &mdl,
+            &PyArray_Type, &res, &PyArray_Type, &ind1, &PyArray_Type, &ind2,
+            &PyArray_Type, &dat, &PyArray_Type, &rdat, &footprint))
+        return NULL;
+    CHK_ARRAY_RANK(mdl, 2);
+    CHK_ARRAY_RANK(res, 2);
+    CHK_ARRAY_RANK(ind1, 1);
+    CHK_ARRAY_RANK(ind2, 1);
+    CHK_ARRAY_RANK(dat, 1);
+    CHK_ARRAY_RANK(rdat, 1);
+    CHK_ARRAY_TYPE(mdl, NPY_CFLOAT);
+    CHK_ARRAY_TYPE(res, NPY_CFLOAT);
+    CHK_ARRAY_TYPE(ind1, NPY_FLOAT);
+    CHK_ARRAY_TYPE(ind2, NPY_FLOAT);
+    CHK_ARRAY_TYPE(dat, NPY_CFLOAT);
+    CHK_ARRAY_TYPE(rdat, NPY_CFLOAT);
+    CHK_ARRAY_DIM(res, 0, PyArray_DIM(mdl,0));
+    CHK_ARRAY_DIM(res, 1, PyArray_DIM(mdl,1));
+    if (PyArray_DIM(ind1,0) != PyArray_DIM(dat,0) || PyArray_DIM(ind2,0) != PyArray_DIM(dat,0)
+            || PyArray_DIM(rdat,0) != PyArray_DIM(dat,0)) {
+        PyErr_Format(PyExc_ValueError, "Dimensions of ind and dat do not match");
+        return NULL;
+    }
+
+    Py_INCREF(mdl);
+    Py_INCREF(res);
+    Py_INCREF(ind1);
+    Py_INCREF(ind2);
+    Py_INCREF(dat);
+    Py_INCREF(rdat);
+    rv = degrid_grid2D_c((float *) PyArray_DATA(mdl), (float *) PyArray_DATA(res),
+                  (long) PyArray_DIM(mdl,0), (long) PyArray_DIM(mdl,1),
+                  (float *) PyArray_DATA(ind1), (float *) PyArray_DATA(ind2),
+                  (float *) PyArray_DATA(dat), (float *) PyArray_DATA(rdat),
+                  (long) PyArray_DIM(dat,0), footprint);
+    Py_DECREF(mdl);
+    Py_DECREF(res);
+    Py_DECREF(ind1);
+    Py_DECREF(ind2);
+    Py_DECREF(dat);
+    Py_DECREF(rdat);
+    if (rv == 0) {
+        Py_INCREF(Py_None);
+        return Py_None;
+    } else {
+        PyErr_Format(PyExc_ValueError, "Invalid indices found.");
+        return NULL;
+    }
+}
+
+// Checks a kernel table and its sampling (see grid2D_tab_c)
+#define CHK_KERNEL_TAB(tab, support, oversample) \
+    CHK_ARRAY_RANK(tab, 1); \
+    CHK_ARRAY_TYPE(tab, NPY_FLOAT); \
+    if (support < 1 || oversample < 1 || PyArray_DIM(tab,0) < 1) { \
+        PyErr_Format(PyExc_ValueError, "support and oversample must be >= 1 and tab non-empty"); \
+        return NULL; }
+
+// Shared by grid2D_tab_c and degrid2D_tab_c, which take the same arguments
+static PyObject *wrap_tab2D_c(PyObject *args, int (*func)(float *, long, long,
+        float *, float *, float *, long, float *, long, long, long)) {
+    PyArrayObject *buf, *ind1, *ind2, *dat, *tab;
+    int rv;
+    long support, oversample;
+    // Parse arguments and perform sanity check
+    if (!PyArg_ParseTuple(args, "O!O!O!O!O!ll", &PyArray_Type, &buf,
+            &PyArray_Type, &ind1, &PyArray_Type, &ind2, &PyArray_Type, &dat,
+            &PyArray_Type, &tab, &support, &oversample))
+        return NULL;
+    CHK_ARRAY_RANK(buf, 2);
     CHK_ARRAY_RANK(ind1, 1);
     CHK_ARRAY_RANK(ind2, 1);
     CHK_ARRAY_RANK(dat, 1);
@@ -96,6 +621,7 @@ PyObject *wrap_degrid2D_c(PyObject *self, PyObject *args) {
     CHK_ARRAY_TYPE(ind1, NPY_FLOAT);
     CHK_ARRAY_TYPE(ind2, NPY_FLOAT);
     CHK_ARRAY_TYPE(dat, NPY_CFLOAT);
+    CHK_KERNEL_TAB(tab, support, oversample);
     if (PyArray_DIM(ind1,0) != PyArray_DIM(dat,0) || PyArray_DIM(ind2,0) != PyArray_DIM(dat,0)) {
         PyErr_Format(PyExc_ValueError, "Dimensions of ind and dat do not match");
         return NULL;
@@ -105,14 +631,18 @@ PyObject *wrap_degrid2D_c(PyObject *self, PyObject *args) {
     Py_INCREF(ind1);
     Py_INCREF(ind2);
     Py_INCREF(dat);
-    // Being lazy.  should allocate data rather than take it as an argument
-    rv = degrid2D_c((float *) PyArray_DATA(buf), (long) PyArray_DIM(buf,0), (long) PyArray_DIM(buf,1),
+    Py_INCREF(tab);
+    long long t0 = aipy_stats_clock(&dsp_stats);
+    rv = func((float *) PyArray_DATA(buf), (long) PyArray_DIM(buf,0), (long) PyArray_DIM(buf,1),
                   (float *) PyArray_DATA(ind1), (float *) PyArray_DATA(ind2),
-                  (float *) PyArray_DATA(dat), (long) PyArray_DIM(dat,0), footprint);
+                  (float *) PyArray_DATA(dat), (long) PyArray_DIM(dat,0),
+                  (float *) PyArray_DATA(tab), (long) PyArray_DIM(tab,0), support, oversample);
+    COUNT_CALL(func == grid2D_tab_c ? ST_GRID : ST_DEGRID, (long) PyArray_DIM(dat,0), t0);
     Py_DECREF(buf);
     Py_DECREF(ind1);
     Py_DECREF(ind2);
     Py_DECREF(dat);
+    Py_DECREF(tab);
     if (rv == 0) {
         Py_INCREF(Py_None);
         return Py_None;
@@ -122,14 +652,918 @@ PyObject *wrap_degrid2D_c(PyObject *self, PyObject *args) {
     }
 }
 
+PyObject *wrap_grid2D_tab_c(PyObject *self, PyObject *args) {
+    return wrap_tab2D_c(args, grid2D_tab_c);
+}
+
+PyObject *wrap_degrid2D_tab_c(PyObject *self, PyObject *args) {
+    return wrap_tab2D_c(args, degrid2D_tab_c);
+}
+
+PyObject *wrap_grid_correct(PyObject *self, PyObject *args) {
+    PyArrayObject *corr, *tab;
+    long support, oversample;
+    // Parse arguments and perform sanity check
+    if (!PyArg_ParseTuple(args, "O!O!ll", &PyArray_Type, &corr,
+            &PyArray_Type, &tab, &support, &oversample))
+        return NULL;
+    CHK_ARRAY_RANK(corr, 1);
+    CHK_ARRAY_TYPE(corr, NPY_FLOAT);
+    CHK_KERNEL_TAB(tab, support, oversample);
+
+    grid_correct((float *) PyArray_DATA(corr), (long) PyArray_DIM(corr,0),
+                 (float *) PyArray_DATA(tab), (long) PyArray_DIM(tab,0), support, oversample);
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+// Checks that a is a C-contiguous dim x dim complex64 plane
+static int chk_wplane(PyObject *a, long dim) {
+    PyArrayObject *p = (PyArrayObject *) a;
+    if (!PyArray_Check(a) || PyArray_TYPE(p) != NPY_CFLOAT || RANK(p) != 2
+            || PyArray_DIM(p,0) != dim || PyArray_DIM(p,1) != dim
+            || !PyArray_ISCARRAY(p)) {
+        PyErr_Format(PyExc_ValueError, "planes must be C-contiguous, complex64 and all of the same square shape");
+        return -1;
+    }
+    return 0;
+}
+
+// Checks the sample arrays shared by wstack_put and wstack_get
+#define CHK_WSAMPLES(ind1, ind2, w) \
+    CHK_ARRAY_RANK(ind1, 1); \
+    CHK_ARRAY_RANK(ind2, 1); \
+    CHK_ARRAY_RANK(w, 1); \
+    CHK_ARRAY_TYPE(ind1, NPY_FLOAT); \
+    CHK_ARRAY_TYPE(ind2, NPY_FLOAT); \
+    CHK_ARRAY_TYPE(w, NPY_DOUBLE); \
+    if (PyArray_DIM(ind2,0) != PyArray_DIM(ind1,0) || PyArray_DIM(w,0) != PyArray_DIM(ind1,0)) { \
+        PyErr_Format(PyExc_ValueError, "Dimensions of ind1, ind2 and w do not match"); \
+        return NULL; }
+
+// W-stacked gridding of several planes (see ImgW.put)
+PyObject *wrap_wstack_put(PyObject *self, PyObject *args) {
+    PyObject *planes, *values, *kobj=Py_None, *pseq=NULL, *vseq=NULL, *rv_obj=NULL;
+    PyArrayObject *ind1, *ind2, *w, *invker2=NULL;
+    double wres, res;
+    int nlayers=1, rv = 0;
+    long footprint=6, dim, n, k, nplanes;
+    float **pp = NULL, **vp = NULL;
+    // Parse arguments and perform sanity check
+    if (!PyArg_ParseTuple(args, "OOO!O!O!dd|Oil", &planes, &values,
+            &PyArray_Type, &ind1, &PyArray_Type, &ind2, &PyArray_Type, &w,
+            &wres, &res, &kobj, &nlayers, &footprint))
+        return NULL;
+    CHK_WSAMPLES(ind1, ind2, w);
+    n = (long) PyArray_DIM(ind1,0);
+    pseq = PySequence_Tuple(planes);
+    vseq = PySequence_Tuple(values);
+    if (pseq == NULL || vseq == NULL) goto done;
+    nplanes = (long) PyTuple_GET_SIZE(pseq);
+    if (nplanes < 1 || PyTuple_GET_SIZE(vseq) != nplanes) {
+        PyErr_Format(PyExc_ValueError, "need one value array per plane");
+        goto done;
+    }
+    if (!PyArray_Check(PyTuple_GET_ITEM(pseq, 0))) {
+        PyErr_Format(PyExc_ValueError, "planes must be arrays");
+        goto done;
+    }
+    dim = (long) PyArray_DIM((PyArrayObject *) PyTuple_GET_ITEM(pseq, 0), 0);
+    pp = (float **) malloc(nplanes * sizeof(float *));
+    vp = (float **) malloc(nplanes * sizeof(float *));
+    if (pp == NULL || vp == NULL) { PyErr_NoMemory(); goto done; }
+    for (k = 0; k < nplanes; k++) {
+        PyObject *p = PyTuple_GET_ITEM(pseq, k), *v = PyTuple_GET_ITEM(vseq, k);
+        if (chk_wplane(p, dim) != 0) goto done;
+        if (!PyArray_Check(v) || PyArray_TYPE((PyArrayObject *) v) != NPY_CFLOAT
+                || RANK((PyArrayObject *) v) != 1 || PyArray_DIM((PyArrayObject *) v, 0) != n
+                || !PyArray_ISCARRAY((PyArrayObject *) v)) {
+            PyErr_Format(PyExc_ValueError, "values must be contiguous complex64 arrays as long as ind1");
+            goto done;
+        }
+        pp[k] = (float *) PyArray_DATA((PyArrayObject *) p);
+        vp[k] = (float *) PyArray_DATA((PyArrayObject *) v);
+    }
+    if (kobj != Py_None) {
+        invker2 = (PyArrayObject *) kobj;
+        if (!PyArray_Check(kobj) || PyArray_TYPE(invker2) != NPY_CDOUBLE || RANK(invker2) != 2
+                || PyArray_DIM(invker2,0) != dim || PyArray_DIM(invker2,1) != dim
+                || !PyArray_ISCARRAY(invker2)) {
+            PyErr_Format(PyExc_ValueError, "invker2 must be a C-contiguous complex128 array of the planes' shape");
+            goto done;
+        }
+    }
+
+    Py_BEGIN_ALLOW_THREADS
+    rv = wstack_put(pp, vp, (int) nplanes, dim, (float *) PyArray_DATA(ind1),
+                    (float *) PyArray_DATA(ind2), (double *) PyArray_DATA(w), n,
+                    wres, res, invker2 ? (double *) PyArray_DATA(invker2) : NULL,
+                    nlayers, footprint);
+    Py_END_ALLOW_THREADS
+    if (rv == 0) {
+        Py_INCREF(Py_None);
+        rv_obj = Py_None;
+    } else {
+        PyErr_Format(PyExc_MemoryError, "Could not allocate gridding buffers.");
+    }
+done:
+    Py_XDECREF(pseq);
+    Py_XDECREF(vseq);
+    free(pp);
+    free(vp);
+    return rv_obj;
+}
+
+// W-stacked degridding (see ImgW.get)
+PyObject *wrap_wstack_get(PyObject *self, PyObject *args) {
+    PyArrayObject *uv, *bm, *ind1, *ind2, *w, *dat;
+    double wres, res;
+    int nlayers=1, rv;
+    long footprint=6, dim;
+    // Parse arguments and perform sanity check
+    if (!PyArg_ParseTuple(args, "O!O!O!O!O!O!dd|il", &PyArray_Type, &uv,
+            &PyArray_Type, &bm, &PyArray_Type, &ind1, &PyArray_Type, &ind2,
+            &PyArray_Type, &w, &PyArray_Type, &dat, &wres, &res, &nlayers, &footprint))
+        return NULL;
+    CHK_WSAMPLES(ind1, ind2, w);
+    CHK_ARRAY_RANK(dat, 1);
+    CHK_ARRAY_TYPE(dat, NPY_CFLOAT);
+    CHK_ARRAY_DIM(dat, 0, PyArray_DIM(ind1,0));
+    dim = (long) PyArray_DIM(uv,0);
+    if (chk_wplane((PyObject *) uv, dim) != 0 || chk_wplane((PyObject *) bm, dim) != 0)
+        return NULL;
+
+    Py_INCREF(uv);
+    Py_INCREF(bm);
+    Py_INCREF(ind1);
+    Py_INCREF(ind2);
+    Py_INCREF(w);
+    Py_INCREF(dat);
+    Py_BEGIN_ALLOW_THREADS
+    rv = wstack_get((float *) PyArray_DATA(uv), (float *) PyArray_DATA(bm), dim,
+                    (float *) PyArray_DATA(ind1), (float *) PyArray_DATA(ind2),
+                    (double *) PyArray_DATA(w), (float *) PyArray_DATA(dat),
+                    (long) PyArray_DIM(dat,0), wres, res, nlayers, footprint);
+    Py_END_ALLOW_THREADS
+    Py_DECREF(uv);
+    Py_DECREF(bm);
+    Py_DECREF(ind1);
+    Py_DECREF(ind2);
+    Py_DECREF(w);
+    Py_DECREF(dat);
+    if (rv == 0) {
+        Py_INCREF(Py_None);
+        return Py_None;
+    } else {
+        PyErr_Format(PyExc_MemoryError, "Could not allocate gridding buffers.");
+        return NULL;
+    }
+}
+
+// Checks a (off, wgt) tap table from grid_plan against a dim1 x dim2 grid
+// and returns its number of samples, or -1
+static long chk_plan(PyArrayObject *off, PyArrayObject *wgt, long dim1,
+        long dim2, long *ntap) {
+    long i, n, *o;
+    if (PyArray_TYPE(off) != NPY_LONG || RANK(off) != 2 || PyArray_DIM(off,1) != 4
+            || !PyArray_ISCARRAY(off) || PyArray_TYPE(wgt) != NPY_FLOAT || RANK(wgt) != 2
+            || PyArray_DIM(wgt,0) != PyArray_DIM(off,0) || PyArray_DIM(wgt,1) % 2
+            || !PyArray_ISCARRAY(wgt)) {
+        PyErr_Format(PyExc_ValueError, "off and wgt must be a tap table from grid_plan");
+        return -1;
+    }
+    n = (long) PyArray_DIM(off,0);
+    *ntap = (long) PyArray_DIM(wgt,1) / 2;
+    o = (long *) PyArray_DATA(off);
+    for (i = 0; i < n; i++, o += 4) {
+        if (o[0] < 0 || o[0] >= dim1 || o[1] < 0 || o[1] >= dim2
+                || o[2] < 0 || o[2] > *ntap || o[3] < 0 || o[3] > *ntap) {
+            PyErr_Format(PyExc_ValueError, "tap table does not fit this grid");
+            return -1;
+        }
+    }
+    return n;
+}
+
+// Tabulates the kernel taps of samples for reuse across slices
+PyObject *wrap_grid_plan(PyObject *self, PyObject *args) {
+    PyArrayObject *ind1, *ind2, *off, *wgt;
+    sview vind1, vind2;
+    long dim1, dim2, footprint=6;
+    npy_intp dims[2];
+    if (!PyArg_ParseTuple(args, "O!O!ll|l", &PyArray_Type, &ind1,
+            &PyArray_Type, &ind2, &dim1, &dim2, &footprint))
+        return NULL;
+    CHK_SVIEW(ind1, 0, vind1);
+    CHK_SVIEW(ind2, 0, vind2);
+    CHK_ARRAY_DIM(ind2, 0, PyArray_DIM(ind1,0));
+    if (dim1 < 1 || dim2 < 1) {
+        PyErr_Format(PyExc_ValueError, "dim1 and dim2 must be positive");
+        return NULL;
+    }
+    dims[0] = PyArray_DIM(ind1,0);
+    dims[1] = 4;
+    off = (PyArrayObject *) PyArray_SimpleNew(2, dims, NPY_LONG);
+    dims[1] = 2 * grid_plan_ntap(footprint);
+    wgt = (PyArrayObject *) PyArray_ZEROS(2, dims, NPY_FLOAT, 0);
+    if (off == NULL || wgt == NULL) {
+        Py_XDECREF(off);
+        Py_XDECREF(wgt);
+        return NULL;
+    }
+    Py_BEGIN_ALLOW_THREADS
+    grid_plan((long *) PyArray_DATA(off), (float *) PyArray_DATA(wgt), dim1, dim2,
+              vind1, vind2, (long) dims[0], footprint);
+    Py_END_ALLOW_THREADS
+    return Py_BuildValue("(NN)", off, wgt);
+}
+
+// Grids one set of samples with a tap table
+PyObject *wrap_grid_plan_c(PyObject *self, PyObject *args) {
+    PyArrayObject *buf, *off, *wgt, *dat;
+    sview vdat;
+    long n, ntap;
+    float scale = 1;
+    if (!PyArg_ParseTuple(args, "O!O!O!O!|f", &PyArray_Type, &buf,
+            &PyArray_Type, &off, &PyArray_Type, &wgt, &PyArray_Type, &dat, &scale))
+        return NULL;
+    CHK_ARRAY_RANK(buf, 2);
+    if (PyArray_TYPE(buf) != NPY_CDOUBLE) CHK_ARRAY_TYPE(buf, NPY_CFLOAT);
+    if (scale != 1 && PyArray_TYPE(buf) != NPY_CDOUBLE) {
+        PyErr_Format(PyExc_ValueError, "scale needs a complex128 buf");
+        return NULL;
+    }
+    if (!PyArray_ISCARRAY(buf)) {
+        PyErr_Format(PyExc_ValueError, "buf must be C-contiguous");
+        return NULL;
+    }
+    CHK_SVIEW(dat, 1, vdat);
+    n = chk_plan(off, wgt, (long) PyArray_DIM(buf,0), (long) PyArray_DIM(buf,1), &ntap);
+    if (n < 0) return NULL;
+    CHK_ARRAY_DIM(dat, 0, n);
+
+    Py_INCREF(buf);
+    Py_INCREF(off);
+    Py_INCREF(wgt);
+    Py_INCREF(dat);
+    Py_BEGIN_ALLOW_THREADS
+    if (PyArray_TYPE(buf) == NPY_CDOUBLE)
+        grid_plan_c_dbl((double *) PyArray_DATA(buf), (long) PyArray_DIM(buf,0),
+                        (long) PyArray_DIM(buf,1), (long *) PyArray_DATA(off),
+                        (float *) PyArray_DATA(wgt), ntap, vdat, n, scale);
+    else
+        grid_plan_c((float *) PyArray_DATA(buf), (long) PyArray_DIM(buf,0), (long) PyArray_DIM(buf,1),
+                    (long *) PyArray_DATA(off), (float *) PyArray_DATA(wgt), ntap, vdat, n);
+    Py_END_ALLOW_THREADS
+    Py_DECREF(buf);
+    Py_DECREF(off);
+    Py_DECREF(wgt);
+    Py_DECREF(dat);
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+// Dirty images of many slices of data sharing a tap table
+PyObject *wrap_snap_images(PyObject *self, PyObject *args) {
+    PyArrayObject *out, *off, *wgt, *dats;
+    sview vdat;
+    long n, ntap, c1=0, c2=0, dim1, dim2;
+    int nthreads=0, t;
+    if (!PyArg_ParseTuple(args, "O!O!O!O!|lli", &PyArray_Type, &out,
+            &PyArray_Type, &off, &PyArray_Type, &wgt, &PyArray_Type, &dats,
+            &c1, &c2, &nthreads))
+        return NULL;
+    CHK_ARRAY_RANK(out, 3);
+    CHK_ARRAY_TYPE(out, NPY_FLOAT);
+    CHK_ARRAY_RANK(dats, 2);
+    if (!PyArray_ISCARRAY(out)) {
+        PyErr_Format(PyExc_ValueError, "out must be C-contiguous");
+        return NULL;
+    }
+    t = PyArray_TYPE(dats);
+    if ((t != NPY_CFLOAT && t != NPY_CDOUBLE) || !PyArray_ISALIGNED(dats)) {
+        PyErr_Format(PyExc_ValueError, "dats must be an aligned complex64 or complex128 array");
+        return NULL;
+    }
+    CHK_ARRAY_DIM(dats, 0, PyArray_DIM(out,0));
+    dim1 = (long) PyArray_DIM(out,1);
+    dim2 = (long) PyArray_DIM(out,2);
+    n = chk_plan(off, wgt, dim1, dim2, &ntap);
+    if (n < 0) return NULL;
+    CHK_ARRAY_DIM(dats, 1, n);
+    vdat.p = (char *) PyArray_DATA(dats);
+    vdat.stride = (long) PyArray_STRIDE(dats,1);
+    vdat.dbl = (t == NPY_CDOUBLE);
+    c1 %= dim1; if (c1 < 0) c1 += dim1;
+    c2 %= dim2; if (c2 < 0) c2 += dim2;
+
+    Py_INCREF(out);
+    Py_INCREF(off);
+    Py_INCREF(wgt);
+    Py_INCREF(dats);
+    Py_BEGIN_ALLOW_THREADS
+    snap_images((float *) PyArray_DATA(out), (long) PyArray_DIM(out,0), dim1, dim2,
+                (long *) PyArray_DATA(off), (float *) PyArray_DATA(wgt), ntap, vdat,
+                (long) PyArray_STRIDE(dats,0), n, c1, c2, nthreads);
+    Py_END_ALLOW_THREADS
+    Py_DECREF(out);
+    Py_DECREF(off);
+    Py_DECREF(wgt);
+    Py_DECREF(dats);
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+// Dirty image of a (full or half) uv plane
+PyObject *wrap_uv_image(PyObject *self, PyObject *args) {
+    PyArrayObject *out, *uv;
+    long c1=0, c2=0, dim1, dim2, width;
+    int nthreads=0, t;
+    if (!PyArg_ParseTuple(args, "O!O!|lli", &PyArray_Type, &out,
+            &PyArray_Type, &uv, &c1, &c2, &nthreads))
+        return NULL;
+    CHK_ARRAY_RANK(out, 2);
+    CHK_ARRAY_TYPE(out, NPY_FLOAT);
+    CHK_ARRAY_RANK(uv, 2);
+    if (!PyArray_ISCARRAY(out)) {
+        PyErr_Format(PyExc_ValueError, "out must be C-contiguous");
+        return NULL;
+    }
+    t = PyArray_TYPE(uv);
+    if ((t != NPY_CFLOAT && t != NPY_CDOUBLE) || !PyArray_ISCARRAY_RO(uv)) {
+        PyErr_Format(PyExc_ValueError, "uv must be a C-contiguous complex64 or complex128 array");
+        return NULL;
+    }
+    dim1 = (long) PyArray_DIM(out,0);
+    dim2 = (long) PyArray_DIM(out,1);
+    width = (long) PyArray_DIM(uv,1);
+    CHK_ARRAY_DIM(uv, 0, dim1);
+    if (width != dim2 && width != dim2/2 + 1) {
+        PyErr_Format(PyExc_ValueError, "uv must have %ld (full) or %ld (half-plane) columns",
+                     dim2, dim2/2 + 1);
+        return NULL;
+    }
+    if (dim1 == 0 || dim2 == 0) {
+        Py_INCREF(Py_None);
+        return Py_None;
+    }
+    c1 %= dim1; if (c1 < 0) c1 += dim1;
+    c2 %= dim2; if (c2 < 0) c2 += dim2;
+
+    Py_INCREF(out);
+    Py_INCREF(uv);
+    Py_BEGIN_ALLOW_THREADS
+    uv_image((float *) PyArray_DATA(out), dim1, dim2, (char *) PyArray_DATA(uv),
+             t == NPY_CDOUBLE, width, c1, c2, nthreads);
+    Py_END_ALLOW_THREADS
+    Py_DECREF(out);
+    Py_DECREF(uv);
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+// An optional C-contiguous float64 (n, 3) array, NULL for None
+static int opt_rows3(PyObject *o, long n, const double **p, const char *name) {
+    PyArrayObject *a = (PyArrayObject *) o;
+    *p = NULL;
+    if (o == Py_None) return 0;
+    if (!PyArray_Check(o) || PyArray_TYPE(a) != NPY_DOUBLE || RANK(a) != 2
+            || PyArray_DIM(a,0) != n || PyArray_DIM(a,1) != 3 || !PyArray_ISCARRAY_RO(a)) {
+        PyErr_Format(PyExc_ValueError, "%s must be a C-contiguous float64 (nsrc,3) array", name);
+        return -1;
+    }
+    *p = (const double *) PyArray_DATA(a);
+    return 0;
+}
+
+// Phasors of many baselines towards many sources
+PyObject *wrap_gen_phs(PyObject *self, PyObject *args) {
+    PyArrayObject *out, *uvw, *freqs, *off;
+    PyObject *ion=Py_None, *shape=Py_None;
+    const double *pion, *pshape;
+    long nbl, nsrc, nchan;
+    if (!PyArg_ParseTuple(args, "O!O!O!O!|OO", &PyArray_Type, &out,
+            &PyArray_Type, &uvw, &PyArray_Type, &freqs, &PyArray_Type, &off,
+            &ion, &shape))
+        return NULL;
+    CHK_ARRAY_RANK(out, 3);
+    CHK_ARRAY_TYPE(out, NPY_CDOUBLE);
+    CHK_ARRAY_RANK(uvw, 3);
+    CHK_ARRAY_TYPE(uvw, NPY_DOUBLE);
+    CHK_ARRAY_RANK(freqs, 1);
+    CHK_ARRAY_TYPE(freqs, NPY_DOUBLE);
+    CHK_ARRAY_RANK(off, 2);
+    CHK_ARRAY_TYPE(off, NPY_DOUBLE);
+    nbl = (long) PyArray_DIM(out,0);
+    nsrc = (long) PyArray_DIM(out,1);
+    nchan = (long) PyArray_DIM(out,2);
+    CHK_ARRAY_DIM(uvw, 0, nbl);
+    CHK_ARRAY_DIM(uvw, 1, nsrc);
+    CHK_ARRAY_DIM(uvw, 2, 3);
+    CHK_ARRAY_DIM(freqs, 0, nchan);
+    CHK_ARRAY_DIM(off, 0, nbl);
+    CHK_ARRAY_DIM(off, 1, nchan);
+    if (!PyArray_ISCARRAY(out) || !PyArray_ISCARRAY_RO(uvw) || !PyArray_ISCARRAY_RO(freqs)
+            || !PyArray_ISCARRAY_RO(off)) {
+        PyErr_Format(PyExc_ValueError, "out, uvw, freqs and off must be C-contiguous");
+        return NULL;
+    }
+    if (opt_rows3(ion, nsrc, &pion, "ion") != 0) return NULL;
+    if (opt_rows3(shape, nsrc, &pshape, "shape") != 0) return NULL;
+
+    Py_INCREF(out);
+    Py_INCREF(uvw);
+    Py_INCREF(freqs);
+    Py_INCREF(off);
+    Py_XINCREF(ion);
+    Py_XINCREF(shape);
+    Py_BEGIN_ALLOW_THREADS
+    gen_phs((double *) PyArray_DATA(out), nbl, nsrc, nchan, (double *) PyArray_DATA(uvw),
+            (double *) PyArray_DATA(freqs), (double *) PyArray_DATA(off), pion, pshape);
+    Py_END_ALLOW_THREADS
+    Py_DECREF(out);
+    Py_DECREF(uvw);
+    Py_DECREF(freqs);
+    Py_DECREF(off);
+    Py_XDECREF(ion);
+    Py_XDECREF(shape);
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+// Apparent places of fixed sources at many times
+PyObject *wrap_src_crds(PyObject *self, PyObject *args) {
+    PyArrayObject *eq, *s, *m, *v, *e2t, *top=NULL;
+    PyObject *top_obj=Py_None;
+    long ntime, nsrc;
+    int nthreads=0;
+    if (!PyArg_ParseTuple(args, "O!OO!O!O!O!|i", &PyArray_Type, &eq, &top_obj,
+            &PyArray_Type, &s, &PyArray_Type, &m, &PyArray_Type, &v,
+            &PyArray_Type, &e2t, &nthreads))
+        return NULL;
+    CHK_ARRAY_RANK(eq, 3);
+    CHK_ARRAY_TYPE(eq, NPY_DOUBLE);
+    ntime = (long) PyArray_DIM(eq,0);
+    nsrc = (long) PyArray_DIM(eq,2);
+    CHK_ARRAY_DIM(eq, 1, 3);
+    CHK_ARRAY_RANK(s, 2);
+    CHK_ARRAY_TYPE(s, NPY_DOUBLE);
+    CHK_ARRAY_DIM(s, 0, 3);
+    CHK_ARRAY_DIM(s, 1, nsrc);
+    CHK_ARRAY_RANK(m, 3);
+    CHK_ARRAY_TYPE(m, NPY_DOUBLE);
+    CHK_ARRAY_DIM(m, 0, ntime);
+    CHK_ARRAY_DIM(m, 1, 3);
+    CHK_ARRAY_DIM(m, 2, 3);
+    CHK_ARRAY_RANK(v, 2);
+    CHK_ARRAY_TYPE(v, NPY_DOUBLE);
+    CHK_ARRAY_DIM(v, 0, ntime);
+    CHK_ARRAY_DIM(v, 1, 3);
+    CHK_ARRAY_RANK(e2t, 3);
+    CHK_ARRAY_TYPE(e2t, NPY_DOUBLE);
+    CHK_ARRAY_DIM(e2t, 0, ntime);
+    CHK_ARRAY_DIM(e2t, 1, 3);
+    CHK_ARRAY_DIM(e2t, 2, 3);
+    if (!PyArray_ISCARRAY(eq) || !PyArray_ISCARRAY_RO(s) || !PyArray_ISCARRAY_RO(m)
+            || !PyArray_ISCARRAY_RO(v) || !PyArray_ISCARRAY_RO(e2t)) {
+        PyErr_Format(PyExc_ValueError, "eq, s, m, v and e2t must be C-contiguous");
+        return NULL;
+    }
+    if (top_obj != Py_None) {
+        top = (PyArrayObject *) top_obj;
+        if (!PyArray_Check(top_obj) || PyArray_TYPE(top) != NPY_DOUBLE
+                || !PyArray_SAMESHAPE(top, eq) || !PyArray_ISCARRAY(top)) {
+            PyErr_Format(PyExc_ValueError, "top must be None or a C-contiguous float64 array shaped as eq");
+            return NULL;
+        }
+    }
+
+    Py_INCREF(eq);
+    Py_XINCREF(top);
+    Py_INCREF(s);
+    Py_INCREF(m);
+    Py_INCREF(v);
+    Py_INCREF(e2t);
+    Py_BEGIN_ALLOW_THREADS
+    src_crds((double *) PyArray_DATA(eq), top == NULL ? NULL : (double *) PyArray_DATA(top),
+             ntime, nsrc, (double *) PyArray_DATA(s), (double *) PyArray_DATA(m),
+             (double *) PyArray_DATA(v), (double *) PyArray_DATA(e2t), nthreads);
+    Py_END_ALLOW_THREADS
+    Py_DECREF(eq);
+    Py_XDECREF(top);
+    Py_DECREF(s);
+    Py_DECREF(m);
+    Py_DECREF(v);
+    Py_DECREF(e2t);
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+// Model visibilities of many baselines, summed over sources
+PyObject *wrap_sim_vis(PyObject *self, PyObject *args) {
+    PyArrayObject *out, *uvw, *freqs, *off, *bm, *bidx, *jys, *gain=NULL;
+    PyObject *ion=Py_None, *shape=Py_None, *gobj=Py_None;
+    const double *pion, *pshape;
+    long nbl, nsrc, nchan, rv;
+    int nthreads=0;
+    if (!PyArg_ParseTuple(args, "O!O!O!O!OOO!O!O!|Oi", &PyArray_Type, &out,
+            &PyArray_Type, &uvw, &PyArray_Type, &freqs, &PyArray_Type, &off,
+            &ion, &shape, &PyArray_Type, &bm, &PyArray_Type, &bidx,
+            &PyArray_Type, &jys, &gobj, &nthreads))
+        return NULL;
+    CHK_ARRAY_RANK(out, 2);
+    CHK_ARRAY_TYPE(out, NPY_CDOUBLE);
+    CHK_ARRAY_RANK(uvw, 3);
+    CHK_ARRAY_TYPE(uvw, NPY_DOUBLE);
+    CHK_ARRAY_RANK(freqs, 1);
+    CHK_ARRAY_TYPE(freqs, NPY_DOUBLE);
+    CHK_ARRAY_RANK(off, 2);
+    CHK_ARRAY_TYPE(off, NPY_DOUBLE);
+    CHK_ARRAY_RANK(bm, 3);
+    CHK_ARRAY_TYPE(bm, NPY_CDOUBLE);
+    CHK_ARRAY_RANK(bidx, 2);
+    CHK_ARRAY_TYPE(bidx, NPY_INT);
+    CHK_ARRAY_RANK(jys, 2);
+    CHK_ARRAY_TYPE(jys, NPY_DOUBLE);
+    nbl = (long) PyArray_DIM(out,0);
+    nchan = (long) PyArray_DIM(out,1);
+    nsrc = (long) PyArray_DIM(uvw,1);
+    CHK_ARRAY_DIM(uvw, 0, nbl);
+    CHK_ARRAY_DIM(uvw, 2, 3);
+    CHK_ARRAY_DIM(freqs, 0, nchan);
+    CHK_ARRAY_DIM(off, 0, nbl);
+    CHK_ARRAY_DIM(off, 1, nchan);
+    CHK_ARRAY_DIM(bm, 1, nsrc);
+    CHK_ARRAY_DIM(bm, 2, nchan);
+    CHK_ARRAY_DIM(bidx, 0, nbl);
+    CHK_ARRAY_DIM(bidx, 1, 2);
+    CHK_ARRAY_DIM(jys, 0, nsrc);
+    CHK_ARRAY_DIM(jys, 1, nchan);
+    if (gobj != Py_None) {
+        gain = (PyArrayObject *) gobj;
+        if (!PyArray_Check(gobj) || PyArray_TYPE(gain) != NPY_CDOUBLE || RANK(gain) != 2
+                || PyArray_DIM(gain,0) != nbl || PyArray_DIM(gain,1) != nchan
+                || !PyArray_ISCARRAY_RO(gain)) {
+            PyErr_Format(PyExc_ValueError, "gain must be None or a C-contiguous complex128 (nbl,nchan) array");
+            return NULL;
+        }
+    }
+    if (!PyArray_ISCARRAY(out) || !PyArray_ISCARRAY_RO(uvw) || !PyArray_ISCARRAY_RO(freqs)
+            || !PyArray_ISCARRAY_RO(off) || !PyArray_ISCARRAY_RO(bm)
+            || !PyArray_ISCARRAY_RO(bidx) || !PyArray_ISCARRAY_RO(jys)) {
+        PyErr_Format(PyExc_ValueError, "out, uvw, freqs, off, bm, bidx and jys must be C-contiguous");
+        return NULL;
+    }
+    if (opt_rows3(ion, nsrc, &pion, "ion") != 0) return NULL;
+    if (opt_rows3(shape, nsrc, &pshape, "shape") != 0) return NULL;
+
+    Py_INCREF(out);
+    Py_INCREF(uvw);
+    Py_INCREF(freqs);
+    Py_INCREF(off);
+    Py_XINCREF(ion);
+    Py_XINCREF(shape);
+    Py_INCREF(bm);
+    Py_INCREF(bidx);
+    Py_INCREF(jys);
+    Py_XINCREF(gain);
+    Py_BEGIN_ALLOW_THREADS
+    rv = sim_vis((double *) PyArray_DATA(out), nbl, nsrc, nchan, (double *) PyArray_DATA(uvw),
+            (double *) PyArray_DATA(freqs), (double *) PyArray_DATA(off), pion, pshape,
+            (double *) PyArray_DATA(bm), (long) PyArray_DIM(bm,0), (int *) PyArray_DATA(bidx),
+            (double *) PyArray_DATA(jys), gain == NULL ? NULL : (double *) PyArray_DATA(gain),
+            nthreads);
+    Py_END_ALLOW_THREADS
+    Py_DECREF(out);
+    Py_DECREF(uvw);
+    Py_DECREF(freqs);
+    Py_DECREF(off);
+    Py_XDECREF(ion);
+    Py_XDECREF(shape);
+    Py_DECREF(bm);
+    Py_DECREF(bidx);
+    Py_DECREF(jys);
+    Py_XDECREF(gain);
+    if (rv != 0) {
+        PyErr_Format(PyExc_ValueError, "baseline %ld has a beam index outside bm", rv - 1);
+        return NULL;
+    }
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+// A C-contiguous float32 (nbl,ntime,nchan) plane 'dat' and, if mask is
+// not NULL, a C-contiguous bool mask of the same shape
+static int chk_rfi_plane(PyArrayObject *dat, PyArrayObject *mask, long *nbl, long *ntime, long *nchan) {
+    if (PyArray_TYPE(dat) != NPY_FLOAT || RANK(dat) != 3 || !PyArray_ISCARRAY_RO(dat)) {
+        PyErr_Format(PyExc_ValueError, "dat must be a C-contiguous float32 (nbl,ntime,nchan) array");
+        return -1;
+    }
+    *nbl = (long) PyArray_DIM(dat,0);
+    *ntime = (long) PyArray_DIM(dat,1);
+    *nchan = (long) PyArray_DIM(dat,2);
+    if (mask != NULL && (PyArray_TYPE(mask) != NPY_BOOL || RANK(mask) != 3
+            || PyArray_DIM(mask,0) != *nbl || PyArray_DIM(mask,1) != *ntime
+            || PyArray_DIM(mask,2) != *nchan || !PyArray_ISCARRAY(mask))) {
+        PyErr_Format(PyExc_ValueError, "mask must be a C-contiguous bool array shaped as dat");
+        return -1;
+    }
+    return 0;
+}
+
+// Robust residual of a rolling median
+PyObject *wrap_rfi_medfilt(PyObject *self, PyObject *args) {
+    PyArrayObject *out, *dat, *mask;
+    long nbl, ntime, nchan, wt=2, wf=8;
+    int nthreads=0;
+    if (!PyArg_ParseTuple(args, "O!O!O!|lli", &PyArray_Type, &out,
+            &PyArray_Type, &dat, &PyArray_Type, &mask, &wt, &wf, &nthreads))
+        return NULL;
+    if (chk_rfi_plane(dat, mask, &nbl, &ntime, &nchan) != 0) return NULL;
+    if (PyArray_TYPE(out) != NPY_FLOAT || RANK(out) != 3 || !PyArray_ISCARRAY(out)
+            || PyArray_DIM(out,0) != nbl || PyArray_DIM(out,1) != ntime
+            || PyArray_DIM(out,2) != nchan) {
+        PyErr_Format(PyExc_ValueError, "out must be a writeable float32 array shaped as dat");
+        return NULL;
+    }
+    if (wt < 0 || wf < 0) {
+        PyErr_Format(PyExc_ValueError, "wt and wf must not be negative");
+        return NULL;
+    }
+
+    Py_INCREF(out);
+    Py_INCREF(dat);
+    Py_INCREF(mask);
+    Py_BEGIN_ALLOW_THREADS
+    rfi_medfilt((float *) PyArray_DATA(out), (float *) PyArray_DATA(dat),
+                (unsigned char *) PyArray_DATA(mask), nbl, ntime, nchan, wt, wf, nthreads);
+    Py_END_ALLOW_THREADS
+    Py_DECREF(out);
+    Py_DECREF(dat);
+    Py_DECREF(mask);
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+// Iterative sigma clipping
+PyObject *wrap_rfi_sigclip(PyObject *self, PyObject *args) {
+    PyArrayObject *mask, *dat;
+    long nbl, ntime, nchan;
+    double nsig=4;
+    int axis=0, niter=5, nthreads=0;
+    if (!PyArg_ParseTuple(args, "O!O!|idii", &PyArray_Type, &mask,
+            &PyArray_Type, &dat, &axis, &nsig, &niter, &nthreads))
+        return NULL;
+    if (chk_rfi_plane(dat, mask, &nbl, &ntime, &nchan) != 0) return NULL;
+    if (axis != 0 && axis != 1) {
+        PyErr_Format(PyExc_ValueError, "axis must be 0 (time) or 1 (frequency)");
+        return NULL;
+    }
+
+    Py_INCREF(mask);
+    Py_INCREF(dat);
+    Py_BEGIN_ALLOW_THREADS
+    rfi_sigclip((unsigned char *) PyArray_DATA(mask), (float *) PyArray_DATA(dat),
+                nbl, ntime, nchan, axis, nsig, niter, nthreads);
+    Py_END_ALLOW_THREADS
+    Py_DECREF(mask);
+    Py_DECREF(dat);
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+// SumThreshold flagging
+PyObject *wrap_rfi_sumthreshold(PyObject *self, PyObject *args) {
+    PyArrayObject *mask, *dat;
+    long nbl, ntime, nchan, mmax=32;
+    double chi1=6, rho=1.5;
+    int nthreads=0;
+    if (!PyArg_ParseTuple(args, "O!O!|dldi", &PyArray_Type, &mask,
+            &PyArray_Type, &dat, &chi1, &mmax, &rho, &nthreads))
+        return NULL;
+    if (chk_rfi_plane(dat, mask, &nbl, &ntime, &nchan) != 0) return NULL;
+    if (mmax < 1 || rho <= 0) {
+        PyErr_Format(PyExc_ValueError, "mmax must be positive and rho above 0");
+        return NULL;
+    }
+
+    Py_INCREF(mask);
+    Py_INCREF(dat);
+    Py_BEGIN_ALLOW_THREADS
+    rfi_sumthreshold((unsigned char *) PyArray_DATA(mask), (float *) PyArray_DATA(dat),
+                     nbl, ntime, nchan, chi1, mmax, rho, nthreads);
+    Py_END_ALLOW_THREADS
+    Py_DECREF(mask);
+    Py_DECREF(dat);
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+// A C-contiguous complex64 (ntime,nbl,...) cube 'data' with C-contiguous
+// bool flags of its shape, a C-contiguous long (nclose,k) table 'tab' and
+// C-contiguous float32 'out' and bool 'oflags' shaped (ntime,nclose,...)
+static int chk_closure(PyArrayObject *out, PyArrayObject *oflags, PyArrayObject *data,
+        PyArrayObject *flags, PyArrayObject *tab, int k, long *ntime, long *nbl,
+        long *ninner, long *nclose) {
+    int d;
+    if (PyArray_TYPE(data) != NPY_CFLOAT || RANK(data) < 2 || !PyArray_ISCARRAY_RO(data)) {
+        PyErr_Format(PyExc_ValueError, "data must be a C-contiguous complex64 (ntime,nbl,...) array");
+        return -1;
+    }
+    if (PyArray_TYPE(flags) != NPY_BOOL || !PyArray_ISCARRAY_RO(flags)
+            || !PyArray_SAMESHAPE(flags, data)) {
+        PyErr_Format(PyExc_ValueError, "flags must be a C-contiguous bool array shaped as data");
+        return -1;
+    }
+    if (PyArray_TYPE(tab) != NPY_LONG || RANK(tab) != 2 || PyArray_DIM(tab,1) != k
+            || !PyArray_ISCARRAY_RO(tab)) {
+        PyErr_Format(PyExc_ValueError, "the table must be a C-contiguous int (n,%d) array", k);
+        return -1;
+    }
+    *ntime = (long) PyArray_DIM(data,0);
+    *nbl = (long) PyArray_DIM(data,1);
+    *ninner = (long) (PyArray_SIZE(data) / (*ntime * *nbl > 0 ? *ntime * *nbl : 1));
+    *nclose = (long) PyArray_DIM(tab,0);
+    for (d=0; d < 2; d++) {
+        PyArrayObject *a = d ? oflags : out;
+        int ok = PyArray_TYPE(a) == (d ? NPY_BOOL : NPY_FLOAT) && PyArray_ISCARRAY(a)
+            && RANK(a) == RANK(data) && PyArray_DIM(a,0) == *ntime
+            && PyArray_DIM(a,1) == *nclose;
+        int i;
+        for (i=2; ok && i < RANK(data); i++) ok = PyArray_DIM(a,i) == PyArray_DIM(data,i);
+        if (!ok) {
+            PyErr_Format(PyExc_ValueError, "%s must be a C-contiguous %s (ntime,n,...) array, as data with n rows of the table for its baselines",
+                d ? "oflags" : "out", d ? "bool" : "float32");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Closure phases and amplitudes from a cube
+static PyObject *closure_call(PyObject *args, int k, int (*func)(float *,
+        unsigned char *, const float *, const unsigned char *, long, long, long,
+        const long *, long, int)) {
+    PyArrayObject *out, *oflags, *data, *flags, *tab;
+    long ntime, nbl, ninner, nclose;
+    int nthreads=0, rv;
+    if (!PyArg_ParseTuple(args, "O!O!O!O!O!|i", &PyArray_Type, &out,
+            &PyArray_Type, &oflags, &PyArray_Type, &data, &PyArray_Type, &flags,
+            &PyArray_Type, &tab, &nthreads))
+        return NULL;
+    if (chk_closure(out, oflags, data, flags, tab, k, &ntime, &nbl, &ninner, &nclose) != 0)
+        return NULL;
+
+    Py_INCREF(out);
+    Py_INCREF(oflags);
+    Py_INCREF(data);
+    Py_INCREF(flags);
+    Py_INCREF(tab);
+    Py_BEGIN_ALLOW_THREADS
+    rv = func((float *) PyArray_DATA(out), (unsigned char *) PyArray_DATA(oflags),
+              (float *) PyArray_DATA(data), (unsigned char *) PyArray_DATA(flags),
+              ntime, nbl, ninner, (long *) PyArray_DATA(tab), nclose, nthreads);
+    Py_END_ALLOW_THREADS
+    Py_DECREF(out);
+    Py_DECREF(oflags);
+    Py_DECREF(data);
+    Py_DECREF(flags);
+    Py_DECREF(tab);
+    if (rv != 0) {
+        PyErr_Format(PyExc_ValueError, "the table holds baselines outside data");
+        return NULL;
+    }
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+PyObject *wrap_closure_phs(PyObject *self, PyObject *args) {
+    return closure_call(args, 3, closure_phs);
+}
+
+PyObject *wrap_closure_amp(PyObject *self, PyObject *args) {
+    return closure_call(args, 4, closure_amp);
+}
+
+// Polyphase FIR interpolation of many rows
+PyObject *wrap_interp_fir(PyObject *self, PyObject *args) {
+    PyArrayObject *out, *ys, *fir;
+    long factor, order, nrow, n, ntap, nout, rv;
+    int degree=2, nthreads=0, t;
+    if (!PyArg_ParseTuple(args, "O!O!O!ll|ii", &PyArray_Type, &out,
+            &PyArray_Type, &ys, &PyArray_Type, &fir, &factor, &order,
+            &degree, &nthreads))
+        return NULL;
+    t = PyArray_TYPE(ys);
+    if ((t != NPY_DOUBLE && t != NPY_CDOUBLE) || RANK(ys) != 2 || !PyArray_ISCARRAY_RO(ys)) {
+        PyErr_Format(PyExc_ValueError, "ys must be a C-contiguous float64 or complex128 (nrow,n) array");
+        return NULL;
+    }
+    CHK_ARRAY_RANK(fir, 1);
+    CHK_ARRAY_TYPE(fir, NPY_DOUBLE);
+    if (!PyArray_ISCARRAY_RO(fir)) {
+        PyErr_Format(PyExc_ValueError, "fir must be C-contiguous");
+        return NULL;
+    }
+    nrow = (long) PyArray_DIM(ys,0);
+    n = (long) PyArray_DIM(ys,1);
+    ntap = (long) PyArray_DIM(fir,0);
+    if (factor < 1 || degree < 0 || order <= degree || n < order || ntap < 1
+            || (nout = (n + 2*order) * factor - ntap + 1) < 1) {
+        PyErr_Format(PyExc_ValueError, "need factor >= 1, degree < order <= n and a filter no longer than the upsampled, extended rows");
+        return NULL;
+    }
+    if (PyArray_TYPE(out) != t || RANK(out) != 2 || !PyArray_ISCARRAY(out)
+            || PyArray_DIM(out,0) != nrow || PyArray_DIM(out,1) != nout) {
+        PyErr_Format(PyExc_ValueError, "out must be a C-contiguous array of the type of ys, shaped (nrow,%ld)", nout);
+        return NULL;
+    }
+
+    Py_INCREF(out);
+    Py_INCREF(ys);
+    Py_INCREF(fir);
+    Py_BEGIN_ALLOW_THREADS
+    rv = interp_fir((double *) PyArray_DATA(out), (double *) PyArray_DATA(ys), nrow, n,
+                    t == NPY_CDOUBLE ? 2 : 1, (double *) PyArray_DATA(fir), ntap,
+                    factor, order, degree, nthreads);
+    Py_END_ALLOW_THREADS
+    Py_DECREF(out);
+    Py_DECREF(ys);
+    Py_DECREF(fir);
+    if (rv < 0) {
+        PyErr_Format(PyExc_ValueError, "the polynomial fit to the ends is singular");
+        return NULL;
+    }
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+PyObject *wrap_stats(PyObject *self, PyObject *args, PyObject *kwargs) {
+    return aipy_stats_call(&dsp_stats, args, kwargs);
+}
+
 // Wrap function into module
 static PyMethodDef _dsp_methods[] = {
     {"grid1D_c", (PyCFunction)wrap_grid1D_c, METH_VARARGS,
-        "grid1D_c(buf,ind,dat,footprint=6)\nTBD."},
+        "grid1D_c(buf,ind,dat,footprint=6)\nAdd the samples 'dat' at fractional pixel indices 'ind' to the complex64 'buf' with a Gaussian kernel (sigma = 0.5 pixels).  'ind' may be float32 or float64 and 'dat' complex64 or complex128, either of them strided (e.g. a column of a larger array); they are read in place.  Releases the GIL."},
     {"grid2D_c", (PyCFunction)wrap_grid2D_c, METH_VARARGS,
-        "grid2D_c(buf,ind1,ind2,dat,footprint=6)\nTBD."},
+        "grid2D_c(buf,ind1,ind2,dat,footprint=6,flags=None,wgt=None)\nAs grid1D_c, onto the 2D complex64 'buf' at indices (ind1,ind2): the kernel is a separable 2D Gaussian reaching footprint/2 pixels either side of each sample.  Inputs may be float64/complex128 and strided, as for grid1D_c.  Samples whose 'flags' (bool or int) are nonzero, as UV.read(raw=True) returns them, are skipped, and the rest are scaled by the real 'wgt', inside the gridding loop."},
+    {"grid2D_c_mt", (PyCFunction)wrap_grid2D_c_mt, METH_VARARGS,
+        "grid2D_c_mt(buf,ind1,ind2,dat,footprint=6,nthreads=0)\nAs grid2D_c, spread over 'nthreads' native threads (0 = aipy.get_num_threads()) with the GIL released.  Samples are binned into uv tiles that each thread grids into a private tile-plus-halo buffer before adding it to 'buf'; tiles whose halos overlap are never gridded at the same time.  The result agrees with grid2D_c to rounding and is the same for any thread count."},
+    {"tile_order", (PyCFunction)wrap_tile_order, METH_VARARGS,
+        "tile_order(ind1,ind2,dim1,dim2,footprint=6)\nReturn the permutation (an int array) that sorts samples at (ind1,ind2) on a dim1 x dim2 grid by coarse uv tile, as the binning of grid2D_c_mt does (a counting sort; samples keep their order within a tile).  Pass it to grid2D_c_order.  It depends only on the sample positions, so for a fixed array it can be cached and reused across integrations and channels."},
+    {"grid2D_c_order", (PyCFunction)wrap_grid2D_c_order, METH_VARARGS,
+        "grid2D_c_order(buf,ind1,ind2,dat,order,footprint=6)\nAs grid2D_c, visiting the samples in the given 'order' (a permutation of range(len(dat)), e.g. from tile_order) so that consecutive writes stay within a few uv tiles.  The permutation only affects speed: any order grids the same data to rounding, so a cached one that no longer sorts exactly is still correct."},
+    {"grid2D_multi_c", (PyCFunction)wrap_grid2D_multi_c, METH_VARARGS,
+        "grid2D_multi_c(bufs,ind1,ind2,dats,footprint=6,order=None,flags=None,wgt=None)\nAs grid2D_c(bufs[k],ind1,ind2,dats[k],footprint,flags,wgt) for every k, in one pass: each sample's kernel taps are computed once and scattered into all of the planes 'bufs' (complex64, of one shape) with their values 'dats'.  Img.put grids its uv plane and beam terms this way.  With 'order' (from tile_order), visits the samples as grid2D_c_order does."},
+    {"grid2D_herm_c", (PyCFunction)wrap_grid2D_herm_c, METH_VARARGS,
+        "grid2D_herm_c(bufs,ind1,ind2,dats,dim2,footprint=6,order=None,flags=None,wgt=None)\nAs grid2D_multi_c for the samples together with their conjugates at (-ind1,-ind2) (as Img.append_hermitian adds them), onto Hermitian half-plane grids: each of 'bufs' holds columns 0..dim2//2 of a grid dim2 wide, as numpy.fft.rfft2 lays it out, and numpy.fft.irfft2(buf, s=(len(buf),dim2)) is its image.  Each sample is gridded once, so this takes about half the time and memory of gridding the doubled samples onto full grids."},
+    {"degrid2D_herm_c", (PyCFunction)wrap_degrid2D_herm_c, METH_VARARGS,
+        "degrid2D_herm_c(buf,ind1,ind2,dat,dim2,footprint=6)\nAs degrid2D_c, from a half-plane grid made by grid2D_herm_c."},
     {"degrid2D_c", (PyCFunction)wrap_degrid2D_c, METH_VARARGS,
-        "degrid2D_c(buf,ind1,ind2,dat,footprint=6)\nTBD."},
+        "degrid2D_c(buf,ind1,ind2,dat,footprint=6)\nThe inverse of grid2D_c: add to each 'dat' the kernel-weighted average of the complex64 'buf' around (ind1,ind2).  'dat' (complex64 or complex128) and the indices may be strided views, as for grid1D_c.  Releases the GIL."},
+    {"degrid2D_c_mt", (PyCFunction)wrap_degrid2D_c_mt, METH_VARARGS,
+        "degrid2D_c_mt(buf,ind1,ind2,dat,footprint=6,nthreads=0)\nAs degrid2D_c, spread over 'nthreads' native threads (0 = aipy.get_num_threads()) that take the samples a few thousand at a time.  Samples are independent, so the result is exactly that of degrid2D_c for any thread count."},
+    {"degrid_grid2D_c", (PyCFunction)wrap_degrid_grid2D_c, METH_VARARGS,
+        "degrid_grid2D_c(mdl,res,ind1,ind2,dat,rdat,footprint=6)\nOne Cotton-Schwab major cycle: degrid the model uv plane 'mdl' at (ind1,ind2) as degrid2D_c does, write dat minus the model to 'rdat', and grid those residuals onto 'res' (zeroed first) as grid2D_c does."},
+    {"grid2D_tab_c", (PyCFunction)wrap_grid2D_tab_c, METH_VARARGS,
+        "grid2D_tab_c(buf,ind1,ind2,dat,tab,support,oversample)\nAs grid2D_c, but with a separable kernel looked up in 'tab' (float32) instead of a Gaussian: tab[k] is the 1D kernel at an offset of k/oversample pixels, and each sample is spread over the pixels within support/2 of it on each axis.  See dsp.kaiser_bessel for a table, and grid_correct for the matching image-plane correction."},
+    {"degrid2D_tab_c", (PyCFunction)wrap_degrid2D_tab_c, METH_VARARGS,
+        "degrid2D_tab_c(buf,ind1,ind2,dat,tab,support,oversample)\nAs degrid2D_c, with the tabulated kernel of grid2D_tab_c."},
+    {"grid_correct", (PyCFunction)wrap_grid_correct, METH_VARARGS,
+        "grid_correct(corr,tab,support,oversample)\nFill the float32 array 'corr' with the grid correction for grid2D_tab_c along an axis of len(corr) pixels: the Fourier transform of the kernel, in FFT order.  Dividing an image made by inverse FFT of the grid by the outer product of the two axes' corrections removes the taper of the kernel."},
+    {"grid_plan", (PyCFunction)wrap_grid_plan, METH_VARARGS,
+        "grid_plan(ind1,ind2,dim1,dim2,footprint=6)\nTabulate the kernel taps that grid2D_c uses for samples at (ind1,ind2) on a dim1 x dim2 grid, and return them as (off, wgt): off[i] (int, 4 per sample) holds the first (wrapped) row and column of sample i's taps and their counts, and wgt[i] (float32) their weights along each axis.  For data taken at fixed (or slowly changing) uv points, the table can be kept and used by grid_plan_c and snap_images, which then skip all exp() calls."},
+    {"grid_plan_c", (PyCFunction)wrap_grid_plan_c, METH_VARARGS,
+        "grid_plan_c(buf,off,wgt,dat,scale=1)\nAs grid2D_c, with the taps tabulated by grid_plan for the same grid shape.  'dat' may be complex64 or complex128 and strided.  'buf' may also be complex128 (C-contiguous), and then 'scale' times 'dat' is added: the terms are formed as for scale=1, so scale=-1 takes gridded samples back out to the rounding of 'buf' (see img.ImgWindow)."},
+    {"snap_images", (PyCFunction)wrap_snap_images, METH_VARARGS,
+        "snap_images(out,off,wgt,dats,c1=0,c2=0,nthreads=0)\nFor each slice dats[k] (a row of a complex64 or complex128 array of shape (nslices, nsamples), any strides) grid it with the taps of grid_plan, inverse FFT it (normalised as numpy.fft.ifft2) and write the real part, recentred on (c1,c2) as img.recenter does, to the float32 image out[k].  Slices are shared among 'nthreads' native threads (0 = aipy.get_num_threads()), each with its own grid and FFT buffers, with the GIL released."},
+    {"uv_image", (PyCFunction)wrap_uv_image, METH_VARARGS,
+        "uv_image(out,uv,c1=0,c2=0,nthreads=0)\nWrite the real part of the inverse FFT (normalised as numpy.fft.ifft2) of the C-contiguous complex64 or complex128 uv plane 'uv', recentred on (c1,c2) as img.recenter does, to the float32 image 'out'.  'uv' may also be the half-plane of a Hermitian plane (out.shape[1]//2+1 columns, as numpy.fft.irfft2 takes it).  The transform runs on 'nthreads' native threads (0 = aipy.get_num_threads()) in double precision, with the GIL released; FFT plans are cached by length between calls."},
+    {"wstack_put", (PyCFunction)wrap_wstack_put, METH_VARARGS,
+        "wstack_put(planes,values,ind1,ind2,w,wres,res,invker2=None,nlayers=1,footprint=6)\nW-stacked gridding, as ImgW.put: the samples at pixel indices (ind1,ind2) (float32, from Img.get_indices) and w (float64, wavelengths) are sorted by w and cut into chunks whose signed sqrt(|w|) span less than 'wres'.  Each chunk's values[k] (complex64) are gridded as grid2D_c does, transformed to the image plane and multiplied by ImgW.conv_invker at the chunk's mean w (and by 'invker2', complex128, if given).  The image-plane layers are summed and added to planes[k] (square, complex64, of a uv matrix with resolution 'res') with one inverse FFT per plane.  'nlayers' chunks (0 = aipy.get_num_threads()) are gridded at once on native threads, each holding a few image-sized buffers."},
+    {"wstack_get", (PyCFunction)wrap_wstack_get, METH_VARARGS,
+        "wstack_get(uv,bm,ind1,ind2,w,dat,wres,res,nlayers=1,footprint=6)\nW-stacked degridding, as ImgW.get: for each chunk of samples (see wstack_put), degrid 'uv' and 'bm' (complex64) projected to the chunk's mean w, and write their ratio into 'dat'.  uv and bm are transformed to the image plane once per call."},
+    {"gen_phs", (PyCFunction)wrap_gen_phs, METH_VARARGS,
+        "gen_phs(out,uvw,freqs,off,ion=None,shape=None)\nWrite exp(-2j*pi*(w+o)) to the complex128 out[b,s,f] for baselines b projected towards sources s, uvw (nbl,nsrc,3) (float64, ns), at freqs (GHz) with phase offsets off (nbl,nchan) (turns), as AntennaArray.gen_phs computes it.  With ion (nsrc,3: dra,ddec,mfreq), w gets the refraction term of AntennaArray.refract; with shape (nsrc,3: a1,a2,th), the phasors get the uniform-disk amplitude of AntennaArray.resolve_src.  Sines and cosines are of the phase reduced exactly to a quarter turn, in vectorisable loops, with the GIL released."},
+    {"src_crds", (PyCFunction)wrap_src_crds, METH_VARARGS,
+        "src_crds(eq,top,s,m,v,e2t,nthreads=0)\nWrite to the float64 eq[t] (ntime,3,nsrc) the apparent equatorial unit vectors m[t]*(s + v[t] - (s.v[t])*s), normalised, of the J2000 unit vectors s (3,nsrc) of fixed sources, for the precession-nutation matrices m (ntime,3,3) and aberrating velocities v (ntime,3) (units of c, in J2000 axes) of phs.apparent_frame, and to top[t] (None, or shaped as eq) their topocentric vectors e2t[t]*eq[t] for the matrices e2t (ntime,3,3).  Times and blocks of sources are shared among 'nthreads' native threads (0 = aipy.get_num_threads()), with the GIL released."},
+    {"sim_vis", (PyCFunction)wrap_sim_vis, METH_VARARGS,
+        "sim_vis(out,uvw,freqs,off,ion,shape,bm,bidx,jys,gain=None,nthreads=0)\nWrite the model visibilities of AntennaArray.sim to the complex128 out[b,f] for baselines b: gain[b,f] (complex128 (nbl,nchan), or 1 for None) times the sum over sources s of bm[bidx[b,1],s,f]*conj(bm[bidx[b,0],s,f])*jys[s,f]*conj(phs[b,s,f]), with bm (nbeam,nsrc,nchan) complex128 beam responses, bidx (nbl,2) int32 choosing those of antennas i and j, jys (nsrc,nchan) float64 fluxes, and phs the phasors gen_phs() computes from uvw, freqs, off, ion and shape (each None or (nsrc,3)), never built.  Baselines are shared among 'nthreads' native threads (0 = aipy.get_num_threads()), with the GIL released."},
+    {"rfi_medfilt", (PyCFunction)wrap_rfi_medfilt, METH_VARARGS,
+        "rfi_medfilt(out,dat,mask,wt=2,wf=8,nthreads=0)\nWrite to the float32 out the residual of each sample of the float32 (nbl,ntime,nchan) plane 'dat' from the median of the unflagged samples within wt integrations and wf channels of it, in units of 1.4826 times the baseline's median absolute residual (its noise, for Gaussian noise).  Samples flagged in the bool 'mask' (True = flagged) get 0.  Baselines are shared among 'nthreads' native threads (0 = aipy.get_num_threads()), with the GIL released."},
+    {"rfi_sigclip", (PyCFunction)wrap_rfi_sigclip, METH_VARARGS,
+        "rfi_sigclip(mask,dat,axis=0,nsig=4,niter=5,nthreads=0)\nIteratively flag in the bool 'mask' the samples of the float32 (nbl,ntime,nchan) plane 'dat' more than nsig standard deviations from the mean of the unflagged samples along time (axis 0, for each channel) or frequency (axis 1, for each integration), for up to niter rounds.  Threads as rfi_medfilt."},
+    {"rfi_sumthreshold", (PyCFunction)wrap_rfi_sumthreshold, METH_VARARGS,
+        "rfi_sumthreshold(mask,dat,chi1=6,mmax=32,rho=1.5,nthreads=0)\nSumThreshold flagging (Offringa et al. 2010) in the bool 'mask' of the float32 (nbl,ntime,nchan) plane 'dat', a residual in units of its noise as rfi_medfilt writes: windows of w = 1, 2, 4, ... mmax samples along time or frequency whose sum (flagged samples counting as the threshold) is above, or below minus, w*chi1/rho**log2(w) are flagged.  Threads as rfi_medfilt."},
+    {"closure_phs", (PyCFunction)wrap_closure_phs, METH_VARARGS,
+        "closure_phs(out,oflags,data,flags,tri,nthreads=0)\nWrite to the float32 out[t,r] the closure phases arg(V[a]*V[b]*conj(V[c])) (radians) of the rows (a,b,c) of the int (ntri,3) baseline table 'tri', V[b] = data[t,b] for the complex64 (ntime,nbl,...) cube 'data' (as uv.to_cube gives it, the trailing axes taken element by element).  oflags (bool) is True, and out 0, where any of the three is flagged in the bool 'flags' (True = flagged).  Rows of the table are shared among 'nthreads' native threads (0 = aipy.get_num_threads()), with the GIL released."},
+    {"closure_amp", (PyCFunction)wrap_closure_amp, METH_VARARGS,
+        "closure_amp(out,oflags,data,flags,quad,nthreads=0)\nAs closure_phs, for the closure amplitudes |V[a]|*|V[b]|/(|V[c]|*|V[d]|) of the rows (a,b,c,d) of the int (nquad,4) table 'quad', also flagged where the denominator is 0."},
+    {"interp_fir", (PyCFunction)wrap_interp_fir, METH_VARARGS,
+        "interp_fir(out,ys,fir,factor,order,degree=2,nthreads=0)\nWrite to 'out' (nrow,(n+2*order)*factor-len(fir)+1) the rows of the C-contiguous float64 or complex128 (nrow,n) 'ys' interpolated as interp.interpolate does: each row extended by 'order' samples either side with the least squares polynomial of the given degree through its 'order' end samples, upsampled by 'factor' with zeros, convolved ('valid') with the float64 'fir' and divided by the same convolution of the sample weights.  Only the taps that meet samples are computed.  Blocks of outputs are shared among 'nthreads' native threads (0 = aipy.get_num_threads()), with the GIL released."},
+    {"stats", (PyCFunction)wrap_stats, METH_VARARGS|METH_KEYWORDS,
+        "stats(enable=None,reset=False)\nReturn a dict of the counters of gridding and degridding work: calls, visibilities and nanoseconds of the grid* and degrid* functions.  Counting is off until switched on by enable=True (and off again by enable=False), and costs a clock read per call while on.  reset zeroes the counters after returning them."},
     {NULL, NULL}
 };
 
@@ -142,6 +1576,8 @@ MOD_INIT(_dsp) {
         return MOD_ERROR_VAL;
 
     import_array();
+    if (aipy_pool_import() < 0)
+        return MOD_ERROR_VAL;
 
     return MOD_SUCCESS_VAL(m);
 };
@@ -3,6 +3,10 @@
 
 #include <Python.h>
 #include "grid.h"
+#include "phs.h"
+#include "rfi.h"
+#include "closure.h"
+#include "interp.h"
 #include "numpy/arrayobject.h"
 
 #define QUOTE(s) # s
@@ -0,0 +1,87 @@
+// Dirty images of uv planes for Img.image and Img.bm_image.  The inverse
+// FFT runs on the columns (in blocks, so each pass over the plane reads
+// whole cache lines) and then on the rows, both shared among threads; the
+// last pass writes the recentred real part straight to the output.  Plans
+// are cached by length, so imaging the same grid again costs no set-up.
+
+#include "grid.h"
+#include "aipy_fft.h"
+#include "aipy_pool.h"
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+
+// Columns transformed together in the column pass
+#define IMAGE_COL_BLOCK 16
+
+static std::mutex plan_lock;
+static std::map<long, FftPlan> plan_cache;
+
+// A private copy (FftPlan::exec uses scratch space) of the plan for n
+static FftPlan cached_plan(long n) {
+    std::lock_guard<std::mutex> lock(plan_lock);
+    std::map<long, FftPlan>::iterator it = plan_cache.find(n);
+    if (it == plan_cache.end()) it = plan_cache.insert(std::make_pair(n, FftPlan(n))).first;
+    return it->second;
+}
+
+struct ImageScratch {
+    FftPlan plan;
+    std::vector<cplx_t> buf;
+    ImageScratch(long n) : plan(cached_plan(n)) {}
+};
+
+// Runs fn(k, plan, scratch) for k < nwork on nthreads threads (0 =
+// aipy.get_num_threads()), each with its own plan for length n and scratch
+// buffer, made when it takes its first k
+template <class F>
+static void image_parallel(long nwork, int nthreads, long n, F fn) {
+    int nt = aipy_pool_nthreads(nwork, nthreads);
+    std::vector<std::unique_ptr<ImageScratch> > scratch(nt);
+    aipy_parallel(nwork, nt, [&](long k, int tid) {
+        if (!scratch[tid]) scratch[tid].reset(new ImageScratch(n));
+        fn(k, scratch[tid]->plan, scratch[tid]->buf);
+    });
+}
+
+// Writes the real part of the inverse FFT (normalised as numpy.fft.ifft2)
+// of the C-contiguous dim1 x width complex plane uv (complex128 if dbl,
+// else complex64) to the dim1 x dim2 image out, rolled to put pixel
+// (c1, c2) at (0, 0) as img.recenter does.  width is dim2 for a full plane
+// or dim2/2+1 for the half-plane of a Hermitian one (as numpy.fft.irfft2).
+// The result does not depend on nthreads.
+extern "C"
+int uv_image(float *out, long dim1, long dim2, const char *uv, int dbl,
+        long width, long c1, long c2, int nthreads) {
+    if (width != dim2 && width != dim2/2 + 1) return -1;
+    long npix = dim1 * dim2;
+    std::vector<cplx_t> work(dim1 * width);
+    // Columns, from uv into work
+    long nblock = (width + IMAGE_COL_BLOCK - 1) / IMAGE_COL_BLOCK;
+    image_parallel(nblock, nthreads, dim1, [&](long b, FftPlan &p, std::vector<cplx_t> &col) {
+        long j0 = b * IMAGE_COL_BLOCK, nj = std::min((long) IMAGE_COL_BLOCK, width - j0);
+        col.resize(nj * dim1);
+        for (long r=0; r < dim1; r++) {
+            long q = r * width + j0;
+            for (long j=0; j < nj; j++, q++) {
+                if (dbl) col[j*dim1+r] = ((const cplx_t *) uv)[q];
+                else col[j*dim1+r] = cplx_t(((const float *) uv)[2*q], ((const float *) uv)[2*q+1]);
+            }
+        }
+        for (long j=0; j < nj; j++) p.exec(&col[j*dim1], 1);
+        for (long r=0; r < dim1; r++)
+            for (long j=0; j < nj; j++) work[r*width+j0+j] = col[j*dim1+r];
+    });
+    // Rows, into out; a half-plane row is filled out by conjugate symmetry
+    image_parallel(dim1, nthreads, dim2, [&](long r, FftPlan &p, std::vector<cplx_t> &row) {
+        const cplx_t *src = &work[((r + c1) % dim1) * width];
+        row.resize(dim2);
+        for (long k=0; k < width; k++) row[k] = src[k];
+        for (long k=width; k < dim2; k++) row[k] = std::conj(src[dim2-k]);
+        p.exec(&row[0], 1);
+        float *o = out + r*dim2;
+        for (long c=0; c < dim2; c++) o[c] = row[(c + c2) % dim2].real() / npix;
+    });
+    return 0;
+}
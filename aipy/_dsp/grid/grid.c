@@ -18,14 +18,15 @@ int grid1D_r(float *buf, long buflen,
     return 0;
 }
 
-int grid1D_c(float *buf, long buflen, 
-        float *inds, float *data, long datalen, long footprint) {
+// As grid1D_c, reading samples through strided views (see grid.h)
+int grid1D_c_sv(float *buf, long buflen,
+        sview inds, sview data, long datalen, long footprint) {
     long i, j, jmod;
     float find, fdatr, fdati, fwgt;
     for (i = 0; i < datalen; i++) {
-        find = inds[i];
-        fdatr = data[2*i];
-        fdati = data[2*i+1];
+        find = sv_get(inds, i, 0);
+        fdatr = sv_get(data, i, 0);
+        fdati = sv_get(data, i, 1);
         for (j = floorf(find-footprint/2); j <= ceilf(find+footprint/2); j++) {
             fwgt = find - j;
             jmod = j % buflen;
@@ -38,61 +39,416 @@ int grid1D_c(float *buf, long buflen,
     return 0;
 }
 
+int grid1D_c(float *buf, long buflen, 
+        float *inds, float *data, long datalen, long footprint) {
+    return grid1D_c_sv(buf, buflen, sv_float(inds, 1), sv_float(data, 2),
+        datalen, footprint);
+}
+
+// Per-axis 1D weights exp(-2*d^2) of the 2D Gaussian kernel (sigx,y=0.5)
+// for a sample at find, for the pixels j0, j0+1, ... within footprint/2 of
+// it.  The 2D weight is the outer product of two axes' weights, so a
+// sample costs 2*ntaps rather than ntaps^2 calls to exp().  Returns the
+// number of taps (at most footprint+2).
+long gauss_wgts(float find, long footprint, float *wgt, long *j0) {
+    long j, n = 0;
+    float d;
+    *j0 = floorf(find-footprint/2);
+    for (j = *j0; j <= ceilf(find+footprint/2); j++) {
+        d = find - j;
+        wgt[n++] = exp(-2*d*d);
+    }
+    return n;
+}
+
+// As gauss_wgts, also giving the taps' buffer indices jmod, wrapped
+static long gauss_taps(float find, long footprint, long buflen,
+        float *wgt, long *jmod) {
+    long j, j0, n = gauss_wgts(find, footprint, wgt, &j0);
+    for (j = 0; j < n; j++) {
+        jmod[j] = (j0 + j) % buflen;
+        jmod[j] = jmod[j] < 0 ? jmod[j] + buflen : jmod[j];
+    }
+    return n;
+}
+
+// Scratch space for the taps of both axes
+#define ALLOC_TAPS(footprint, w1, w2, m1, m2) \
+    long ntap = (footprint > 0 ? footprint : 0) + 3; \
+    float *w1 = (float *) malloc(2*ntap*sizeof(float)), *w2 = w1 + ntap; \
+    long *m1 = (long *) malloc(2*ntap*sizeof(long)), *m2 = m1 + ntap; \
+    if (w1 == NULL || m1 == NULL) { free(w1); free(m1); return -1; }
+
+// As grid2D_c (or grid2D_c_order, if order is not NULL) for each of the
+// nplanes planes buf[p] with values data[p], at the same (ind1, ind2).
+// The kernel taps of a sample are computed once and scattered into every
+// plane in the same pass.  Samples with nonzero flags are skipped, and the
+// values of the rest are scaled by wgt (either may be absent, p = NULL).
+int grid2D_multi_c(float **buf, int nplanes, long buflen1,
+        long buflen2, sview ind1, sview ind2, sview *data, long datalen,
+        long footprint, long *order, fview flags, sview wgt) {
+    long i, s, j1, j2, n1, n2, k;
+    int p;
+    float fdatr, fdati, fwgt, swgt, *b;
+    ALLOC_TAPS(footprint, w1, w2, m1, m2);
+    for (s = 0; s < datalen; s++) {
+        i = order ? order[s] : s;
+        if (flags.p != NULL && fv_get(flags, i)) continue;
+        swgt = wgt.p != NULL ? sv_get(wgt, i, 0) : 1;
+        n1 = gauss_taps(sv_get(ind1, i, 0), footprint, buflen1, w1, m1);
+        n2 = gauss_taps(sv_get(ind2, i, 0), footprint, buflen2, w2, m2);
+        for (j1 = 0; j1 < n1; j1++) {
+          // XXX should really make sure wgts sum to 1
+          fwgt = 0.63661977236758149 * w1[j1]; // 2D Gaussian, sigx,y=0.5
+          for (p = 0; p < nplanes; p++) {
+            fdatr = fwgt * (swgt * sv_get(data[p], i, 0));
+            fdati = fwgt * (swgt * sv_get(data[p], i, 1));
+            b = buf[p] + 2*m1[j1]*buflen2;
+            for (j2 = 0; j2 < n2; j2++) {
+              k = 2*m2[j2];
+              b[k]   += w2[j2] * fdatr;
+              b[k+1] += w2[j2] * fdati;
+            }
+          }
+        }
+    }
+    free(w1);
+    free(m1);
+    return 0;
+}
+
+// Grids the samples order[0..datalen-1] (0..datalen-1 if order is NULL)
+static int grid2D_c_in(float *buf, long buflen1, long buflen2,
+        sview ind1, sview ind2, sview data, long datalen, long footprint,
+        long *order, fview flags, sview wgt) {
+    return grid2D_multi_c(&buf, 1, buflen1, buflen2, ind1, ind2, &data,
+        datalen, footprint, order, flags, wgt);
+}
+
 int grid2D_c(float *buf, long buflen1, long buflen2,
         float *ind1, float *ind2, float *data, long datalen, long footprint) {
-    long i, j1, j2, j1mod, j2mod;
-    float find1, find2, fdatr, fdati, fwgt1, fwgt2;
+    return grid2D_c_in(buf, buflen1, buflen2, sv_float(ind1, 1),
+        sv_float(ind2, 1), sv_float(data, 2), datalen, footprint, NULL,
+        fv_none(), sv_none());
+}
+
+// As grid2D_c, reading samples through strided views (see grid.h), less
+// flagged samples and scaled by wgt (see grid2D_multi_c)
+int grid2D_c_sv(float *buf, long buflen1, long buflen2,
+        sview ind1, sview ind2, sview data, long datalen, long footprint,
+        fview flags, sview wgt) {
+    return grid2D_c_in(buf, buflen1, buflen2, ind1, ind2, data, datalen,
+        footprint, NULL, flags, wgt);
+}
+
+// As grid2D_c, visiting the samples in the given order (a permutation of
+// 0..datalen-1, e.g. from grid_tile_order) so that consecutive writes stay
+// within a few uv tiles.  Any order gives the same grid up to rounding.
+int grid2D_c_order(float *buf, long buflen1, long buflen2,
+        float *ind1, float *ind2, float *data, long datalen, long footprint,
+        long *order) {
+    return grid2D_c_in(buf, buflen1, buflen2, sv_float(ind1, 1),
+        sv_float(ind2, 1), sv_float(data, 2), datalen, footprint, order,
+        fv_none(), sv_none());
+}
+
+// As grid2D_multi_c, for the Hermitian-symmetric grid of the samples and
+// their conjugates at (-ind1, -ind2), as Img.append_hermitian makes them,
+// stored as its half-plane: buf[p] holds columns 0..buflen2/2 of the
+// buflen1 x buflen2 grid, laid out as numpy.fft.rfft2 gives it.  Each tap
+// lands on the half-plane either itself or as its mirror image (both, on
+// the self-conjugate columns 0 and buflen2/2), so this is about half the
+// work of gridding the doubled samples.
+int grid2D_herm_c(float **buf, int nplanes, long buflen1, long buflen2,
+        sview ind1, sview ind2, sview *data, long datalen, long footprint,
+        long *order, fview flags, sview wgt) {
+    long i, s, j1, j2, n1, n2, k, c, r, h = buflen2 / 2, hw = h + 1;
+    int p;
+    float fdatr, fdati, fwgt, swgt, *b, *bb;
+    ALLOC_TAPS(footprint, w1, w2, m1, m2);
+    for (s = 0; s < datalen; s++) {
+        i = order ? order[s] : s;
+        if (flags.p != NULL && fv_get(flags, i)) continue;
+        swgt = wgt.p != NULL ? sv_get(wgt, i, 0) : 1;
+        n1 = gauss_taps(sv_get(ind1, i, 0), footprint, buflen1, w1, m1);
+        n2 = gauss_taps(sv_get(ind2, i, 0), footprint, buflen2, w2, m2);
+        for (j1 = 0; j1 < n1; j1++) {
+          fwgt = 0.63661977236758149 * w1[j1]; // 2D Gaussian, sigx,y=0.5
+          r = m1[j1] ? buflen1 - m1[j1] : 0;    // the mirrored row
+          for (p = 0; p < nplanes; p++) {
+            fdatr = fwgt * (swgt * sv_get(data[p], i, 0));
+            fdati = fwgt * (swgt * sv_get(data[p], i, 1));
+            b = buf[p] + 2*m1[j1]*hw;
+            bb = buf[p] + 2*r*hw;
+            for (j2 = 0; j2 < n2; j2++) {
+              c = m2[j2];
+              if (c <= h) {
+                k = 2*c;
+                b[k]   += w2[j2] * fdatr;
+                b[k+1] += w2[j2] * fdati;
+              }
+              c = c ? buflen2 - c : 0;
+              if (c <= h) {
+                k = 2*c;
+                bb[k]   += w2[j2] * fdatr;
+                bb[k+1] -= w2[j2] * fdati;
+              }
+            }
+          }
+        }
+    }
+    free(w1);
+    free(m1);
+    return 0;
+}
+
+// As degrid2D_c, from the half-plane grid that grid2D_herm_c makes: a
+// pixel (r, c) of the right half is the conjugate of (-r, -c)
+int degrid2D_herm_c(float *buf, long buflen1, long buflen2,
+        sview ind1, sview ind2, sview data, long datalen, long footprint) {
+    long i, j1, j2, n1, n2, k, c, h = buflen2 / 2, hw = h + 1;
+    float fwgt, tot_wgt, sumr, sumi, rowr, rowi, roww, *row, *rrow;
+    ALLOC_TAPS(footprint, w1, w2, m1, m2);
     for (i = 0; i < datalen; i++) {
-        find1 = ind1[i];
-        find2 = ind2[i];
-        fdatr = data[2*i];
-        fdati = data[2*i+1];
-        for (j1 = floorf(find1-footprint/2); j1 <= ceilf(find1+footprint/2); j1++) {
-          j1mod = j1 % buflen1;
-          j1mod = j1mod < 0 ? j1mod + buflen1 : j1mod;
-          fwgt1 = find1 - j1;
-          fwgt1 *= fwgt1;
-          for (j2 = floorf(find2-footprint/2); j2 <= ceilf(find2+footprint/2); j2++) {
-            j2mod = j2 % buflen2;
-            j2mod = j2mod < 0 ? j2mod + buflen2 : j2mod;
-            fwgt2 = find2 - j2;
-            fwgt2 *= fwgt2;
-            fwgt2 = 0.63661977236758149 * exp(-2*(fwgt1+fwgt2)); // 2D Gaussian, sigx,y=0.5
-            // XXX should really make sure wgts sum to 1
-            buf[2*(j1mod*buflen1+j2mod)]   += fwgt2 * fdatr;
-            buf[2*(j1mod*buflen1+j2mod)+1] += fwgt2 * fdati;
+        n1 = gauss_taps(sv_get(ind1, i, 0), footprint, buflen1, w1, m1);
+        n2 = gauss_taps(sv_get(ind2, i, 0), footprint, buflen2, w2, m2);
+        tot_wgt = sumr = sumi = roww = 0;
+        for (j2 = 0; j2 < n2; j2++) roww += w2[j2];
+        for (j1 = 0; j1 < n1; j1++) {
+          row = buf + 2*m1[j1]*hw;
+          rrow = buf + 2*(m1[j1] ? buflen1 - m1[j1] : 0)*hw;
+          rowr = rowi = 0;
+          for (j2 = 0; j2 < n2; j2++) {
+            c = m2[j2];
+            if (c <= h) {
+              k = 2*c;
+              rowr += w2[j2] * row[k];
+              rowi += w2[j2] * row[k+1];
+            } else {
+              k = 2*(buflen2 - c);
+              rowr += w2[j2] * rrow[k];
+              rowi -= w2[j2] * rrow[k+1];
+            }
           }
+          fwgt = 0.63661977236758149 * w1[j1]; // 2D Gaussian, sigx,y=0.5
+          tot_wgt += fwgt * roww;
+          sumr += fwgt * rowr;
+          sumi += fwgt * rowi;
         }
+        sv_add(data, i, 0, sumr / tot_wgt);
+        sv_add(data, i, 1, sumi / tot_wgt);
     }
+    free(w1);
+    free(m1);
+    return 0;
+}
+
+// Degrids the samples order[0..datalen-1] (0..datalen-1 if order is NULL)
+static int degrid2D_c_in(float *buf, long buflen1, long buflen2,
+        sview ind1, sview ind2, sview data, long datalen, long footprint,
+        long *order) {
+    long i, s, j1, j2, n1, n2, k;
+    int contig;
+    float fwgt, tot_wgt, sumr, sumi, rowr, rowi, roww, *row;
+    ALLOC_TAPS(footprint, w1, w2, m1, m2);
+    for (s = 0; s < datalen; s++) {
+        i = order ? order[s] : s;
+        n1 = gauss_taps(sv_get(ind1, i, 0), footprint, buflen1, w1, m1);
+        n2 = gauss_taps(sv_get(ind2, i, 0), footprint, buflen2, w2, m2);
+        tot_wgt = sumr = sumi = roww = 0;
+        // Every row has the same weights along axis 2
+        for (j2 = 0; j2 < n2; j2++) roww += w2[j2];
+        // Unless the taps wrap, a row is a contiguous run of pixels
+        contig = m2[n2-1] - m2[0] == n2 - 1;
+        for (j1 = 0; j1 < n1; j1++) {
+          row = buf + 2*m1[j1]*buflen2;
+          rowr = rowi = 0;
+          if (contig) {
+            row += 2*m2[0];
+            for (j2 = 0; j2 < n2; j2++) {
+              rowr += w2[j2] * row[2*j2];
+              rowi += w2[j2] * row[2*j2+1];
+            }
+          } else {
+            for (j2 = 0; j2 < n2; j2++) {
+              k = 2*m2[j2];
+              rowr += w2[j2] * row[k];
+              rowi += w2[j2] * row[k+1];
+            }
+          }
+          fwgt = 0.63661977236758149 * w1[j1]; // 2D Gaussian, sigx,y=0.5
+          tot_wgt += fwgt * roww;
+          sumr += fwgt * rowr;
+          sumi += fwgt * rowi;
+        }
+        sv_add(data, i, 0, sumr / tot_wgt);
+        sv_add(data, i, 1, sumi / tot_wgt);
+    }
+    free(w1);
+    free(m1);
     return 0;
 }
 
 int degrid2D_c(float *buf, long buflen1, long buflen2,
         float *ind1, float *ind2, float *data, long datalen, long footprint) {
-    long i, j1, j2, j1mod, j2mod;
-    float find1, find2, fwgt1, fwgt2, tot_wgt;
+    return degrid2D_c_in(buf, buflen1, buflen2, sv_float(ind1, 1),
+        sv_float(ind2, 1), sv_float(data, 2), datalen, footprint, NULL);
+}
+
+// As degrid2D_c, through strided views (see grid.h)
+int degrid2D_c_sv(float *buf, long buflen1, long buflen2,
+        sview ind1, sview ind2, sview data, long datalen, long footprint) {
+    return degrid2D_c_in(buf, buflen1, buflen2, ind1, ind2, data, datalen,
+        footprint, NULL);
+}
+
+// As degrid2D_c for the samples in order (see grid2D_c_order)
+int degrid2D_c_order(float *buf, long buflen1, long buflen2,
+        float *ind1, float *ind2, float *data, long datalen, long footprint,
+        long *order) {
+    return degrid2D_c_in(buf, buflen1, buflen2, sv_float(ind1, 1),
+        sv_float(ind2, 1), sv_float(data, 2), datalen, footprint, order);
+}
+
+// Cotton-Schwab major cycle: for each sample, degrid the model uv plane mdl
+// (as degrid2D_c does), store data - model in rdata, and grid that residual
+// onto res (as grid2D_c does).  res is zeroed first; no other buffers are
+// used.  The taps of a sample are shared by both passes.
+int degrid_grid2D_c(float *mdl, float *res, long buflen1, long buflen2,
+        float *ind1, float *ind2, float *data, float *rdata, long datalen,
+        long footprint) {
+    long i, j1, j2, n1, n2, k;
+    float fwgt, tot_wgt, mdlr, mdli, rowr, rowi, roww, fdatr, fdati;
+    ALLOC_TAPS(footprint, w1, w2, m1, m2);
+    memset(res, 0, 2*buflen1*buflen2*sizeof(float));
+    for (i = 0; i < datalen; i++) {
+        n1 = gauss_taps(ind1[i], footprint, buflen1, w1, m1);
+        n2 = gauss_taps(ind2[i], footprint, buflen2, w2, m2);
+        tot_wgt = mdlr = mdli = 0;
+        for (j1 = 0; j1 < n1; j1++) {
+          rowr = rowi = roww = 0;
+          for (j2 = 0; j2 < n2; j2++) {
+            k = 2*(m1[j1]*buflen2+m2[j2]);
+            roww += w2[j2];
+            rowr += w2[j2] * mdl[k];
+            rowi += w2[j2] * mdl[k+1];
+          }
+          fwgt = 0.63661977236758149 * w1[j1]; // 2D Gaussian, sigx,y=0.5
+          tot_wgt += fwgt * roww;
+          mdlr += fwgt * rowr;
+          mdli += fwgt * rowi;
+        }
+        rdata[2*i] = data[2*i] - mdlr / tot_wgt;
+        rdata[2*i+1] = data[2*i+1] - mdli / tot_wgt;
+        for (j1 = 0; j1 < n1; j1++) {
+          fwgt = 0.63661977236758149 * w1[j1];
+          fdatr = fwgt * rdata[2*i];
+          fdati = fwgt * rdata[2*i+1];
+          for (j2 = 0; j2 < n2; j2++) {
+            k = 2*(m1[j1]*buflen2+m2[j2]);
+            res[k]   += w2[j2] * fdatr;
+            res[k+1] += w2[j2] * fdati;
+          }
+        }
+    }
+    free(w1);
+    free(m1);
+    return 0;
+}
+
+// Per-axis taps of a tabulated kernel: tab[k] is the kernel at offset
+// k/oversample (k < ntab, symmetric), looked up at the nearest entry for
+// the pixels within support/2 of find.  Returns the number of taps (at
+// most support+1).
+static long tab_taps(float find, long support, long oversample,
+        float *tab, long ntab, long buflen, float *wgt, long *jmod) {
+    long j, k, n = 0;
+    float h = 0.5 * support;
+    for (j = ceilf(find-h); j <= floorf(find+h); j++) {
+        k = (long) (fabsf(find - j) * oversample + 0.5);
+        wgt[n] = k < ntab ? tab[k] : 0;
+        jmod[n] = j % buflen;
+        jmod[n] = jmod[n] < 0 ? jmod[n] + buflen : jmod[n];
+        n++;
+    }
+    return n;
+}
+
+// As grid2D_c, with the kernel tab(ulated) as for tab_taps instead of a
+// Gaussian
+int grid2D_tab_c(float *buf, long buflen1, long buflen2,
+        float *ind1, float *ind2, float *data, long datalen,
+        float *tab, long ntab, long support, long oversample) {
+    long i, j1, j2, n1, n2, k;
+    float fdatr, fdati;
+    ALLOC_TAPS(support, w1, w2, m1, m2);
     for (i = 0; i < datalen; i++) {
-        find1 = ind1[i];
-        find2 = ind2[i];
-        tot_wgt = 0;
-        for (j1 = floorf(find1-footprint/2); j1 <= ceilf(find1+footprint/2); j1++) {
-          j1mod = j1 % buflen1;
-          j1mod = j1mod < 0 ? j1mod + buflen1 : j1mod;
-          fwgt1 = find1 - j1;
-          fwgt1 *= fwgt1;
-          for (j2 = floorf(find2-footprint/2); j2 <= ceilf(find2+footprint/2); j2++) {
-            j2mod = j2 % buflen2;
-            j2mod = j2mod < 0 ? j2mod + buflen2 : j2mod;
-            fwgt2 = find2 - j2;
-            fwgt2 *= fwgt2;
-            fwgt2 = 0.63661977236758149 * exp(-2*(fwgt1+fwgt2)); // 2D Gaussian, sigx,y=0.5
-            tot_wgt += fwgt2;
-            data[2*i] += fwgt2 * buf[2*(j1mod*buflen1+j2mod)];
-            data[2*i+1] += fwgt2 * buf[2*(j1mod*buflen1+j2mod)+1];
+        n1 = tab_taps(ind1[i], support, oversample, tab, ntab, buflen1, w1, m1);
+        n2 = tab_taps(ind2[i], support, oversample, tab, ntab, buflen2, w2, m2);
+        for (j1 = 0; j1 < n1; j1++) {
+          fdatr = w1[j1] * data[2*i];
+          fdati = w1[j1] * data[2*i+1];
+          for (j2 = 0; j2 < n2; j2++) {
+            k = 2*(m1[j1]*buflen2+m2[j2]);
+            buf[k]   += w2[j2] * fdatr;
+            buf[k+1] += w2[j2] * fdati;
           }
         }
-        data[2*i] /= tot_wgt;
-        data[2*i+1] /= tot_wgt;
+    }
+    free(w1);
+    free(m1);
+    return 0;
+}
+
+// As degrid2D_c, with a tabulated kernel (see grid2D_tab_c)
+int degrid2D_tab_c(float *buf, long buflen1, long buflen2,
+        float *ind1, float *ind2, float *data, long datalen,
+        float *tab, long ntab, long support, long oversample) {
+    long i, j1, j2, n1, n2, k;
+    float tot_wgt, sumr, sumi, rowr, rowi, roww;
+    ALLOC_TAPS(support, w1, w2, m1, m2);
+    for (i = 0; i < datalen; i++) {
+        n1 = tab_taps(ind1[i], support, oversample, tab, ntab, buflen1, w1, m1);
+        n2 = tab_taps(ind2[i], support, oversample, tab, ntab, buflen2, w2, m2);
+        tot_wgt = sumr = sumi = 0;
+        for (j1 = 0; j1 < n1; j1++) {
+          rowr = rowi = roww = 0;
+          for (j2 = 0; j2 < n2; j2++) {
+            k = 2*(m1[j1]*buflen2+m2[j2]);
+            roww += w2[j2];
+            rowr += w2[j2] * buf[k];
+            rowi += w2[j2] * buf[k+1];
+          }
+          tot_wgt += w1[j1] * roww;
+          sumr += w1[j1] * rowr;
+          sumi += w1[j1] * rowi;
+        }
+        if (tot_wgt == 0) continue;
+        data[2*i] += sumr / tot_wgt;
+        data[2*i+1] += sumi / tot_wgt;
+    }
+    free(w1);
+    free(m1);
+    return 0;
+}
+
+// Grid correction for grid2D_tab_c along an axis of n pixels: corr[x] is
+// the Fourier transform of the (nearest-entry, piecewise constant) kernel
+// at x cycles per n pixels, in FFT order, so that dividing an image made
+// by an n-point inverse FFT by corr removes the kernel's taper.
+int grid_correct(float *corr, long n, float *tab, long ntab, long support,
+        long oversample) {
+    long x, k, kmax = (long) (0.5 * support * oversample + 0.5);
+    double f, sum, sinc;
+    if (kmax > ntab - 1) kmax = ntab - 1;
+    for (x = 0; x < n; x++) {
+        f = (double) (2*x < n ? x : x - n) / n;
+        sum = tab[0];
+        for (k = 1; k <= kmax; k++)
+            sum += 2 * tab[k] * cos(2 * M_PI * f * k / oversample);
+        // Each entry covers 1/oversample of a pixel
+        sinc = f == 0 ? 1 : sin(M_PI * f / oversample) / (M_PI * f / oversample);
+        corr[x] = sum * sinc / oversample;
     }
     return 0;
 }
@@ -3,10 +3,114 @@
 
 #include <stdlib.h>
 #include <math.h>
+#include <string.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// A strided view of a 1D array of float32 or float64 samples (pairs of
+// them for complex64/complex128), as numpy describes a slice: element i
+// starts i*stride bytes after p.  Lets the kernels read slices of larger
+// arrays, in either precision, without copying them.
+typedef struct {
+    char *p;
+    long stride;
+    int dbl;        // 1 for float64/complex128
+} sview;
+
+// Component c (0, or 1 for the imaginary part) of element i of v
+static inline float sv_get(sview v, long i, int c) {
+    char *q = v.p + i*v.stride;
+    return v.dbl ? (float) ((double *) q)[c] : ((float *) q)[c];
+}
+
+static inline void sv_add(sview v, long i, int c, float x) {
+    char *q = v.p + i*v.stride;
+    if (v.dbl) ((double *) q)[c] += x;
+    else ((float *) q)[c] += x;
+}
+
+// A view of a contiguous float32 array of ncomp-component elements
+static inline sview sv_float(float *p, int ncomp) {
+    sview v;
+    v.p = (char *) p;
+    v.stride = ncomp * sizeof(float);
+    v.dbl = 0;
+    return v;
+}
+
+// No array (for optional arguments)
+static inline sview sv_none(void) {
+    sview v;
+    v.p = NULL;
+    v.stride = 0;
+    v.dbl = 0;
+    return v;
+}
+
+// A strided view of per-sample flags (bool or integers of 1, 4 or 8
+// bytes; nonzero marks a sample to skip), p = NULL for none
+typedef struct {
+    char *p;
+    long stride;
+    int size;
+} fview;
+
+static inline int fv_get(fview f, long i) {
+    char *q = f.p + i*f.stride;
+    switch (f.size) {
+        case 4: return *(int *) q != 0;
+        case 8: return *(long long *) q != 0;
+        default: return *q != 0;
+    }
+}
+
+static inline fview fv_none(void) {
+    fview f;
+    f.p = NULL;
+    f.stride = 0;
+    f.size = 1;
+    return f;
+}
+
+long gauss_wgts(float, long, float *, long *);
 int grid1D_r(float *, long, float *, float *, long, long);
 int grid1D_c(float *, long, float *, float *, long, long);
+int grid1D_c_sv(float *, long, sview, sview, long, long);
 int grid2D_c(float *, long, long, float *, float *, float *, long, long);
+int grid2D_c_sv(float *, long, long, sview, sview, sview, long, long, fview, sview);
 int degrid2D_c(float *, long, long, float *, float *, float *, long, long);
+int degrid2D_c_sv(float *, long, long, sview, sview, sview, long, long);
+int degrid2D_c_order(float *, long, long, float *, float *, float *, long, long, long *);
+int degrid_grid2D_c(float *, float *, long, long, float *, float *, float *, float *, long, long);
+int grid2D_tab_c(float *, long, long, float *, float *, float *, long, float *, long, long, long);
+int degrid2D_tab_c(float *, long, long, float *, float *, float *, long, float *, long, long, long);
+int grid_correct(float *, long, float *, long, long, long);
+int grid2D_c_order(float *, long, long, float *, float *, float *, long, long, long *);
+int grid2D_multi_c(float **, int, long, long, sview, sview, sview *, long, long, long *,
+        fview, sview);
+int grid2D_c_mt(float *, long, long, float *, float *, float *, long, long, int);
+int grid_tile_order(long *, long, long, float *, float *, long, long);
+int degrid2D_c_mt(float *, long, long, sview, sview, sview, long, long, int);
+int grid2D_herm_c(float **, int, long, long, sview, sview, sview *, long, long, long *,
+        fview, sview);
+int degrid2D_herm_c(float *, long, long, sview, sview, sview, long, long);
+long grid_plan_ntap(long);
+int grid_plan(long *, float *, long, long, sview, sview, long, long);
+int grid_plan_c(float *, long, long, const long *, const float *, long, sview, long);
+int grid_plan_c_dbl(double *, long, long, const long *, const float *, long, sview, long,
+        float);
+int snap_images(float *, long, long, long, const long *, const float *, long, sview,
+        long, long, long, long, int);
+int uv_image(float *, long, long, const char *, int, long, long, long, int);
+int wstack_put(float **, float **, int, long, float *, float *, double *, long,
+        double, double, double *, int, long);
+int wstack_get(float *, float *, long, float *, float *, double *, float *, long,
+        double, double, int, long);
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif
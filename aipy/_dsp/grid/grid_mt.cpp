@@ -0,0 +1,181 @@
+// Multithreaded gridding.  The uv plane is cut into tiles at least twice
+// the kernel halo wide; samples are binned by the tile holding their
+// nearest pixel, and each tile is gridded by one thread into a private
+// buffer (tile plus halo) that is then added into the grid.  Tiles are
+// processed in colour passes chosen so that no two tiles of a pass have
+// overlapping halos, so neither the inner loop nor the reduction needs
+// atomics, and the result does not depend on the number of threads.
+// Degridding only reads the grid, so it simply splits the samples.
+
+#include "grid.h"
+#include "aipy_pool.h"
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <algorithm>
+
+// Nominal tile width (pixels) along an axis
+#define GRID_TILE 64
+
+// The tiling of one axis of buflen pixels: ntile tiles with edges
+// edge[t] = t*buflen/ntile, each at least 2*halo wide (but for ntile = 1)
+struct TileAxis {
+    long buflen, ntile, halo, width;   // width: widest tile plus 2*halo
+    std::vector<long> edge;
+    TileAxis(long len, long hlo) : buflen(len), halo(hlo) {
+        ntile = len / std::max((long) GRID_TILE, 2*halo);
+        if (ntile < 1) ntile = 1;
+        edge.resize(ntile+1);
+        for (long t=0; t <= ntile; t++) edge[t] = t * buflen / ntile;
+        width = 0;
+        for (long t=0; t < ntile; t++) width = std::max(width, edge[t+1] - edge[t]);
+        width += 2*halo;
+    }
+    // Tile holding (wrapped) pixel j
+    long tile(long j) const {
+        long t = j * ntile / buflen;
+        while (t+1 < ntile && edge[t+1] <= j) t++;
+        while (t > 0 && edge[t] > j) t--;
+        return t;
+    }
+    // Alternate tiles share a colour; with an odd count the last tile
+    // (which borders tile 0 across the wrap) gets one of its own
+    long colour(long t) const {
+        return (ntile % 2 && ntile > 1 && t == ntile-1) ? 2 : t % 2;
+    }
+    long ncolour() const { return ntile == 1 ? 1 : (ntile % 2 ? 3 : 2); }
+};
+
+static long wrap(long j, long n) {
+    j %= n;
+    return j < 0 ? j + n : j;
+}
+
+// Taps reach footprint/2+1 pixels either side of the nearest pixel
+static long tile_halo(long footprint) {
+    return (footprint > 0 ? footprint : 0) / 2 + 1;
+}
+
+// Bins samples by the tile of their nearest pixel with a (stable) counting
+// sort: the samples of tile t are order[start[t]..start[t+1]-1]
+static void bin_tiles(const TileAxis &ax1, const TileAxis &ax2,
+        const float *ind1, const float *ind2, long datalen,
+        std::vector<long> &start, long *order) {
+    long ntile = ax1.ntile * ax2.ntile;
+    std::vector<long> tile(datalen);
+    start.assign(ntile+1, 0);
+    for (long i=0; i < datalen; i++) {
+        long t1 = ax1.tile(wrap((long) floorf(ind1[i]), ax1.buflen));
+        long t2 = ax2.tile(wrap((long) floorf(ind2[i]), ax2.buflen));
+        tile[i] = t1 * ax2.ntile + t2;
+        start[tile[i]+1]++;
+    }
+    for (long t=0; t < ntile; t++) start[t+1] += start[t];
+    std::vector<long> pos(start.begin(), start.end()-1);
+    for (long i=0; i < datalen; i++) order[pos[tile[i]]++] = i;
+}
+
+// The order in which grid2D_c_mt visits samples (tile by tile), for
+// gridding with grid2D_c_order
+extern "C"
+int grid_tile_order(long *order, long buflen1, long buflen2,
+        float *ind1, float *ind2, long datalen, long footprint) {
+    long halo = tile_halo(footprint);
+    TileAxis ax1(buflen1, halo), ax2(buflen2, halo);
+    std::vector<long> start;
+    bin_tiles(ax1, ax2, ind1, ind2, datalen, start, order);
+    return 0;
+}
+
+extern "C"
+int grid2D_c_mt(float *buf, long buflen1, long buflen2,
+        float *ind1, float *ind2, float *data, long datalen, long footprint,
+        int nthreads) {
+    long halo = tile_halo(footprint);
+    TileAxis ax1(buflen1, halo), ax2(buflen2, halo);
+    std::vector<long> start, order(datalen);
+    bin_tiles(ax1, ax2, ind1, ind2, datalen, start, order.data());
+    // Each thread's tile buffer and taps, made when it takes its first tile
+    // and kept for the passes that follow
+    struct Scratch {
+        std::vector<float> priv, wt1, wt2;
+        Scratch(long n, long ntap) : priv(n), wt1(ntap), wt2(ntap) {}
+    };
+    int nt = aipy_pool_nthreads(ax1.ntile * ax2.ntile, nthreads);
+    std::vector<std::unique_ptr<Scratch> > scratch(nt);
+    for (long c1=0; c1 < ax1.ncolour(); c1++) {
+        for (long c2=0; c2 < ax2.ncolour(); c2++) {
+            // The occupied tiles of this pass
+            std::vector<long> todo;
+            for (long t1=0; t1 < ax1.ntile; t1++) {
+                if (ax1.colour(t1) != c1) continue;
+                for (long t2=0; t2 < ax2.ntile; t2++) {
+                    long t = t1 * ax2.ntile + t2;
+                    if (ax2.colour(t2) == c2 && start[t+1] > start[t]) todo.push_back(t);
+                }
+            }
+            aipy_parallel((long) todo.size(), nt, [&](long k, int tid) {
+                long ntap = 2*halo + 1, w1 = ax1.width, w2 = ax2.width;
+                if (!scratch[tid]) scratch[tid].reset(new Scratch(2*w1*w2, ntap));
+                std::vector<float> &priv = scratch[tid]->priv;
+                std::vector<float> &wt1 = scratch[tid]->wt1, &wt2 = scratch[tid]->wt2;
+                long t = todo[k], t1 = t / ax2.ntile, t2 = t % ax2.ntile;
+                long o1 = ax1.edge[t1] - halo, o2 = ax2.edge[t2] - halo;
+                std::fill(priv.begin(), priv.end(), 0.f);
+                for (long s=start[t]; s < start[t+1]; s++) {
+                    long i = order[s], j01, j02, n1, n2;
+                    n1 = gauss_wgts(ind1[i], footprint, &wt1[0], &j01);
+                    n2 = gauss_wgts(ind2[i], footprint, &wt2[0], &j02);
+                    // Shift the taps into tile coordinates
+                    long f1 = (long) floorf(ind1[i]), f2 = (long) floorf(ind2[i]);
+                    j01 += wrap(f1, buflen1) - f1 - o1;
+                    j02 += wrap(f2, buflen2) - f2 - o2;
+                    for (long j1=0; j1 < n1; j1++) {
+                        // XXX should really make sure wgts sum to 1
+                        float fwgt = 0.63661977236758149 * wt1[j1]; // 2D Gaussian, sigx,y=0.5
+                        float fdatr = fwgt * data[2*i], fdati = fwgt * data[2*i+1];
+                        float *row = &priv[2*((j01+j1)*w2 + j02)];
+                        for (long j2=0; j2 < n2; j2++) {
+                            row[2*j2]   += wt2[j2] * fdatr;
+                            row[2*j2+1] += wt2[j2] * fdati;
+                        }
+                    }
+                }
+                // Reduce: no other tile of this pass touches these pixels
+                long e1 = ax1.edge[t1+1] - o1 + halo, e2 = ax2.edge[t2+1] - o2 + halo;
+                for (long p1=0; p1 < e1; p1++) {
+                    long g1 = wrap(o1 + p1, buflen1);
+                    for (long p2=0; p2 < e2; p2++) {
+                        long g = 2*(g1*buflen2 + wrap(o2 + p2, buflen2));
+                        buf[g]   += priv[2*(p1*w2+p2)];
+                        buf[g+1] += priv[2*(p1*w2+p2)+1];
+                    }
+                }
+            });
+        }
+    }
+    return 0;
+}
+
+// Samples per unit of work in degrid2D_c_mt
+#define DEGRID_CHUNK 4096
+
+// As degrid2D_c_sv on nthreads threads (0 = aipy.get_num_threads()).
+// Samples are independent, so threads take chunks of them in turn and the
+// result is exactly that of degrid2D_c_sv.
+extern "C"
+int degrid2D_c_mt(float *buf, long buflen1, long buflen2,
+        sview ind1, sview ind2, sview data, long datalen, long footprint,
+        int nthreads) {
+    long nchunk = (datalen + DEGRID_CHUNK - 1) / DEGRID_CHUNK;
+    std::atomic<int> rv(0);
+    aipy_parallel(nchunk, nthreads, [&](long c, int) {
+        long i0 = c * DEGRID_CHUNK, n = std::min((long) DEGRID_CHUNK, datalen - i0);
+        sview v1 = ind1, v2 = ind2, vd = data;
+        v1.p += i0 * v1.stride;
+        v2.p += i0 * v2.stride;
+        vd.p += i0 * vd.stride;
+        if (degrid2D_c_sv(buf, buflen1, buflen2, v1, v2, vd, n, footprint) != 0) rv = -1;
+    });
+    return rv;
+}
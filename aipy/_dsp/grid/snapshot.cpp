@@ -0,0 +1,122 @@
+// Snapshot imaging for img.ImgSnap: many slices (times, channels) of data
+// at the same uv points.  grid_plan tabulates each sample's kernel taps
+// once; every slice is then gridded from the table (no exp() calls, no
+// index arithmetic beyond a wrap) and transformed to the image plane by
+// one thread on that thread's own grid and FFT buffers.
+
+#include "grid.h"
+#include "aipy_fft.h"
+#include "aipy_pool.h"
+#include <vector>
+#include <memory>
+#include <algorithm>
+
+// Taps of a sample, per axis: at most footprint+2 (see gauss_wgts)
+extern "C"
+long grid_plan_ntap(long footprint) {
+    return (footprint > 0 ? footprint : 0) + 3;
+}
+
+// Tabulates the taps of grid2D_c for samples at (ind1, ind2) on a
+// dim1 x dim2 grid.  Sample i's taps cover rows off[4i] + 0..off[4i+2]-1
+// and columns off[4i+1] + 0..off[4i+3]-1 (wrapped), with weights
+// wgt[2i*ntap + j1] (the 2D normalisation folded in) and
+// wgt[(2i+1)*ntap + j2].
+extern "C"
+int grid_plan(long *off, float *wgt, long dim1, long dim2, sview ind1,
+        sview ind2, long datalen, long footprint) {
+    long ntap = grid_plan_ntap(footprint);
+    for (long i=0; i < datalen; i++) {
+        long j01, j02, *o = off + 4*i;
+        float *w1 = wgt + 2*i*ntap, *w2 = w1 + ntap;
+        o[2] = gauss_wgts(sv_get(ind1, i, 0), footprint, w1, &j01);
+        o[3] = gauss_wgts(sv_get(ind2, i, 0), footprint, w2, &j02);
+        // XXX should really make sure wgts sum to 1
+        for (long j=0; j < o[2]; j++) w1[j] *= 0.63661977236758149; // 2D Gaussian, sigx,y=0.5
+        o[0] = j01 % dim1; if (o[0] < 0) o[0] += dim1;
+        o[1] = j02 % dim2; if (o[1] < 0) o[1] += dim2;
+    }
+    return 0;
+}
+
+// Adds scale times the samples data to buf (float or double re, im pairs)
+// with the taps of grid_plan.  The terms are formed in float either way,
+// and a scale of -1 negates them exactly, so gridding samples with -1
+// takes back what gridding them with 1 added, to the rounding of buf.
+template <class B>
+static void plan_add(B *buf, long dim1, long dim2, const long *off,
+        const float *wgt, long ntap, sview data, long datalen, float scale) {
+    for (long i=0; i < datalen; i++) {
+        const long *o = off + 4*i;
+        const float *w1 = wgt + 2*i*ntap, *w2 = w1 + ntap;
+        float dr = scale * sv_get(data, i, 0), di = scale * sv_get(data, i, 1);
+        long r = o[0];
+        for (long j1=0; j1 < o[2]; j1++, r++) {
+            if (r == dim1) r = 0;
+            float fr = w1[j1] * dr, fi = w1[j1] * di;
+            B *row = buf + 2*r*dim2;
+            long c = o[1];
+            for (long j2=0; j2 < o[3]; j2++, c++) {
+                if (c == dim2) c = 0;
+                row[2*c]   += w2[j2] * fr;
+                row[2*c+1] += w2[j2] * fi;
+            }
+        }
+    }
+}
+
+// Adds the samples data to buf with the taps of grid_plan
+extern "C"
+int grid_plan_c(float *buf, long dim1, long dim2, const long *off,
+        const float *wgt, long ntap, sview data, long datalen) {
+    plan_add(buf, dim1, dim2, off, wgt, ntap, data, datalen, 1.f);
+    return 0;
+}
+
+// As grid_plan_c, adding scale times the samples to a complex128 buf
+extern "C"
+int grid_plan_c_dbl(double *buf, long dim1, long dim2, const long *off,
+        const float *wgt, long ntap, sview data, long datalen, float scale) {
+    plan_add(buf, dim1, dim2, off, wgt, ntap, data, datalen, scale);
+    return 0;
+}
+
+// For each of nslice slices of data (slice s starts s*slice_stride bytes
+// after data.p), grids it with the taps of grid_plan and writes the real
+// part of its inverse FFT (normalised as numpy.fft.ifft2), rolled to put
+// pixel (c1, c2) at (0, 0) as img.recenter does, to the dim1 x dim2 image
+// out + s*dim1*dim2.  Slices are shared among nthreads threads (0 =
+// aipy.get_num_threads()); the result does not depend on the thread count.
+extern "C"
+int snap_images(float *out, long nslice, long dim1, long dim2,
+        const long *off, const float *wgt, long ntap, sview data,
+        long slice_stride, long datalen, long c1, long c2, int nthreads) {
+    long npix = dim1 * dim2;
+    // Each thread's FFT and buffers, made when it takes its first slice
+    struct Scratch {
+        Fft2d fft;
+        std::vector<float> grid;
+        std::vector<cplx_t> img;
+        Scratch(long dim1, long dim2) : fft(dim1, dim2), grid(2*dim1*dim2), img(dim1*dim2) {}
+    };
+    int nt = aipy_pool_nthreads(nslice, nthreads);
+    std::vector<std::unique_ptr<Scratch> > scratch(nt);
+    aipy_parallel(nslice, nt, [&](long s, int tid) {
+        if (!scratch[tid]) scratch[tid].reset(new Scratch(dim1, dim2));
+        std::vector<float> &grid = scratch[tid]->grid;
+        std::vector<cplx_t> &img = scratch[tid]->img;
+        sview d = data;
+        d.p += s * slice_stride;
+        std::fill(grid.begin(), grid.end(), 0.f);
+        grid_plan_c(&grid[0], dim1, dim2, off, wgt, ntap, d, datalen);
+        for (long q=0; q < npix; q++) img[q] = cplx_t(grid[2*q], grid[2*q+1]);
+        scratch[tid]->fft.exec(&img[0], 1);
+        float *o = out + s*npix;
+        for (long r=0; r < dim1; r++) {
+            const cplx_t *src = &img[((r + c1) % dim1) * dim2];
+            for (long c=0; c < dim2; c++)
+                o[r*dim2+c] = src[(c + c2) % dim2].real() / npix;
+        }
+    });
+    return 0;
+}
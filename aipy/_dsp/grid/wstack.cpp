@@ -0,0 +1,184 @@
+// W-stacking for img.ImgW.  Samples are sorted by w and cut into the
+// chunks ImgW.put always used; each chunk is gridded with grid2D_c_order
+// onto a w-layer, transformed to the image plane and multiplied by the
+// w-screen of ImgW.conv_invker there.  Layers are summed in the image
+// plane, so the whole stack needs one inverse FFT per plane rather than
+// one per layer.  nlayers chunks are in flight at a time, one per thread;
+// each costs a few image-sized buffers.
+
+#include "grid.h"
+#include "aipy_fft.h"
+#include "aipy_pool.h"
+#include <vector>
+#include <atomic>
+#include <algorithm>
+
+// The chunks of ImgW: chunk k is the samples order[start[k]..start[k+1]-1],
+// whose signed sqrt(|w|) are within wres of the first one's
+struct WChunks {
+    std::vector<long> order, start;
+    std::vector<double> avg_w;          // mean w of each chunk
+    WChunks(const double *w, long n, double wres) : order(n) {
+        for (long i=0; i < n; i++) order[i] = i;
+        std::stable_sort(order.begin(), order.end(),
+            [w](long a, long b) { return w[a] < w[b]; });
+        std::vector<double> sw(n);
+        for (long k=0; k < n; k++) {
+            double x = w[order[k]];
+            sw[k] = sqrt(fabs(x)) * (x > 0 ? 1 : (x < 0 ? -1 : 0));
+        }
+        for (long i=0, j; i < n; i = j) {
+            j = std::lower_bound(sw.begin() + i, sw.end(), sw[i] + wres) - sw.begin();
+            if (j <= i) j = i + 1;
+            double sum = 0;
+            for (long k=i; k < j; k++) sum += w[order[k]];
+            start.push_back(i);
+            avg_w.push_back(sum / (j - i));
+        }
+        start.push_back(n);
+    }
+    long size() const { return (long) avg_w.size(); }
+};
+
+// n - 1 = sqrt(1 - l^2 - m^2) - 1 at each pixel of a dim x dim image, laid
+// out as ImgW.conv_invker leaves it (both axes flipped), and whether the
+// pixel is on the sky
+struct WScreen {
+    long dim;
+    std::vector<double> nm1;
+    std::vector<char> sky;
+    WScreen(long d, double res) : dim(d), nm1(d*d), sky(d*d) {
+        for (long r=0; r < d; r++) {
+            for (long c=0; c < d; c++) {
+                long r0 = (d - r) % d, c0 = (d - c) % d;
+                double l = (c0 > d/2 ? d - c0 : -c0) / (double) d / res;
+                double m = (r0 > d/2 ? r0 - d : r0) / (double) d / res;
+                double q = l*l + m*m;
+                sky[r*d+c] = q < 1;
+                nm1[r*d+c] = q < 1 ? sqrt(1 - q) - 1 : 0;
+            }
+        }
+    }
+    // g = conv_invker(w) (times extra, if given)
+    void eval(double w, cplx_t *g, const double *extra) const {
+        double norm = 1. / (dim * dim);
+        for (long p=0; p < dim*dim; p++) {
+            g[p] = sky[p] ? std::polar(norm, -2 * M_PI * w * nm1[p]) : cplx_t(0.);
+            if (extra) g[p] *= cplx_t(extra[2*p], extra[2*p+1]);
+        }
+    }
+};
+
+// The layers in flight: the result depends on this, but not on how many of
+// them run at once (all of them, unless nested in another parallel loop)
+static int wstack_nthreads(int nlayers, long nchunk) {
+    if (nlayers <= 0) nlayers = aipy_pool_nthreads(nchunk, 0);
+    if (nlayers > nchunk) nlayers = (int) nchunk;
+    return nlayers < 1 ? 1 : nlayers;
+}
+
+// Adds the w-projected grids of values[p] at (ind1, ind2, w) to the
+// dim x dim planes[p], as ImgW.put: planes[p] += ifft2(sum over chunks of
+// fft2(layer) * conv_invker(avg_w) * invker2).  invker2 (complex, may be
+// NULL) is an extra image-plane factor.
+extern "C"
+int wstack_put(float **planes, float **values, int nplanes, long dim,
+        float *ind1, float *ind2, double *w, long datalen, double wres,
+        double res, double *invker2, int nlayers, long footprint) {
+    WChunks ch(w, datalen, wres);
+    WScreen scr(dim, res);
+    long npix = dim * dim, nchunk = ch.size();
+    int nt = wstack_nthreads(nlayers, nchunk);
+    std::atomic<int> rv(0);
+    // Image-plane sums of each thread's layers, per plane
+    std::vector<std::vector<cplx_t> > acc(nt);
+    auto worker = [&](long t, int) {
+        Fft2d fft(dim, dim);
+        std::vector<float> layer(2*npix);
+        std::vector<cplx_t> buf(npix), g(npix);
+        acc[t].assign(nplanes * npix, 0.);
+        for (long k=t; k < nchunk; k += nt) {
+            long s0 = ch.start[k], n = ch.start[k+1] - s0;
+            scr.eval(ch.avg_w[k], &g[0], invker2);
+            for (int p=0; p < nplanes; p++) {
+                std::fill(layer.begin(), layer.end(), 0.f);
+                if (grid2D_c_order(&layer[0], dim, dim, ind1, ind2, values[p], n,
+                        footprint, &ch.order[s0]) != 0) { rv = -1; return; }
+                for (long q=0; q < npix; q++) buf[q] = cplx_t(layer[2*q], layer[2*q+1]);
+                fft.exec(&buf[0], 0);
+                cplx_t *a = &acc[t][p*npix];
+                for (long q=0; q < npix; q++) a[q] += buf[q] * g[q];
+            }
+        }
+    };
+    aipy_parallel(nt, nt, worker);
+    if (rv != 0) return rv;
+    // Reduce in thread order, then back to the uv plane
+    Fft2d fft(dim, dim);
+    for (int p=0; p < nplanes; p++) {
+        cplx_t *a = &acc[0][p*npix];
+        for (int t=1; t < nt; t++)
+            for (long q=0; q < npix; q++) a[q] += acc[t][p*npix+q];
+        fft.exec(a, 1);
+        for (long q=0; q < npix; q++) {
+            planes[p][2*q]   += a[q].real() / npix;
+            planes[p][2*q+1] += a[q].imag() / npix;
+        }
+    }
+    return 0;
+}
+
+// Predicts the samples at (ind1, ind2, w) from the dim x dim uv and bm
+// planes, as ImgW.get: each chunk degrids uv and bm projected to its w
+// (ifft2(fft2(plane) * conv_invker(-avg_w))) and out = uv / bm.  uv and bm
+// are transformed to the image plane once.
+extern "C"
+int wstack_get(float *uv, float *bm, long dim, float *ind1, float *ind2,
+        double *w, float *out, long datalen, double wres, double res,
+        int nlayers, long footprint) {
+    WChunks ch(w, datalen, wres);
+    WScreen scr(dim, res);
+    long npix = dim * dim, nchunk = ch.size();
+    int nt = wstack_nthreads(nlayers, nchunk);
+    std::atomic<int> rv(0);
+    std::vector<cplx_t> img[2] = {std::vector<cplx_t>(npix), std::vector<cplx_t>(npix)};
+    float *src[2] = {uv, bm};
+    std::vector<float> dat[2] = {std::vector<float>(2*datalen, 0.f),
+                                 std::vector<float>(2*datalen, 0.f)};
+    {
+        Fft2d fft(dim, dim);
+        for (int p=0; p < 2; p++) {
+            for (long q=0; q < npix; q++) img[p][q] = cplx_t(src[p][2*q], src[p][2*q+1]);
+            fft.exec(&img[p][0], 0);
+        }
+    }
+    // Each sample is in one chunk, so threads write disjoint entries of dat
+    auto worker = [&](long t, int) {
+        Fft2d fft(dim, dim);
+        std::vector<float> layer(2*npix);
+        std::vector<cplx_t> buf(npix), g(npix);
+        for (long k=t; k < nchunk; k += nt) {
+            long s0 = ch.start[k], n = ch.start[k+1] - s0;
+            scr.eval(-ch.avg_w[k], &g[0], NULL);
+            for (int p=0; p < 2; p++) {
+                for (long q=0; q < npix; q++) buf[q] = img[p][q] * g[q];
+                fft.exec(&buf[0], 1);
+                for (long q=0; q < npix; q++) {
+                    layer[2*q]   = buf[q].real() / npix;
+                    layer[2*q+1] = buf[q].imag() / npix;
+                }
+                if (degrid2D_c_order(&layer[0], dim, dim, ind1, ind2, &dat[p][0], n,
+                        footprint, &ch.order[s0]) != 0) { rv = -1; return; }
+            }
+        }
+    };
+    aipy_parallel(nt, nt, worker);
+    if (rv != 0) return rv;
+    for (long i=0; i < datalen; i++) {
+        std::complex<float> d = std::complex<float>(dat[0][2*i], dat[0][2*i+1])
+            / std::complex<float>(dat[1][2*i], dat[1][2*i+1]);
+        out[2*i] = d.real();
+        out[2*i+1] = d.imag();
+    }
+    return 0;
+}
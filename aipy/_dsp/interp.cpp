@@ -0,0 +1,136 @@
+// Polyphase FIR interpolation for interp.interpolate: the convolution of
+// the zero-stuffed, polynomially extended rows with the filter, and of
+// its weights, without the zeros.  Output p = q*factor + r only meets the
+// taps of phase r, which multiply consecutive samples, so each output
+// costs ntap/factor multiplies and the weight of each phase is summed
+// once.  The polynomial extension of each end is a fixed linear map of
+// the end samples, set up once for all rows.  Rows are split into blocks
+// of outputs shared among threads, so the result does not depend on the
+// thread count.
+
+#include "interp.h"
+#include "aipy_pool.h"
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+// Outputs per item of the interp_fir loop
+#define INTERP_BLOCK 4096
+
+// Sets e (nx rows of len) to the map from the samples y(x[i]) to the
+// values at xe of the least squares polynomial of the given degree
+// through them; 0, or -1 if the fit is singular
+static int polyext_map(std::vector<double> &e, const std::vector<double> &x,
+        const std::vector<double> &xe, int degree) {
+    int d = degree + 1;
+    long len = (long) x.size(), nx = (long) xe.size();
+    // The normal equations [V^T V | V^T] (d rows), solved for the
+    // coefficients of each sample
+    std::vector<double> a(d * (d + len));
+    for (int j=0; j < d; j++) {
+        for (int k=0; k < d; k++) {
+            double s = 0;
+            for (long i=0; i < len; i++) s += std::pow(x[i], j + k);
+            a[j*(d+len) + k] = s;
+        }
+        for (long i=0; i < len; i++) a[j*(d+len) + d + i] = std::pow(x[i], j);
+    }
+    for (int c=0; c < d; c++) {
+        int piv = c;
+        for (int j=c+1; j < d; j++)
+            if (std::fabs(a[j*(d+len)+c]) > std::fabs(a[piv*(d+len)+c])) piv = j;
+        if (a[piv*(d+len)+c] == 0) return -1;
+        if (piv != c)
+            std::swap_ranges(a.begin() + c*(d+len), a.begin() + (c+1)*(d+len),
+                             a.begin() + piv*(d+len));
+        for (int j=0; j < d; j++) {
+            if (j == c) continue;
+            double f = a[j*(d+len)+c] / a[c*(d+len)+c];
+            for (long k=c; k < d + len; k++) a[j*(d+len)+k] -= f * a[c*(d+len)+k];
+        }
+    }
+    e.assign(nx * len, 0);
+    for (long k=0; k < nx; k++)
+        for (int j=0; j < d; j++) {
+            double w = std::pow(xe[k], j) / a[j*(d+len)+j];
+            for (long i=0; i < len; i++) e[k*len + i] += w * a[j*(d+len) + d + i];
+        }
+    return 0;
+}
+
+// Interpolates the nrow rows of n samples (ncomp interleaved doubles each:
+// 1 for real, 2 for complex data) in ys by factor with the ntap filter fir:
+// as interp.interpolate, each row extended by order samples either side
+// with a polynomial of the given degree fitted to its order end samples,
+// then convolved ('valid') after upsampling and divided by the convolved
+// weights.  Returns the number of outputs per row written to out, or -1
+// for a bad size.
+extern "C"
+long interp_fir(double *out, const double *ys, long nrow, long n, int ncomp,
+        const double *fir, long ntap, long factor, long order, int degree,
+        int nthreads) {
+    if (factor < 1 || degree < 0 || order <= degree || n < order || ntap < 1) return -1;
+    long next = n + 2*order, nout = next*factor - ntap + 1;
+    if (nout < 1) return -1;
+    // The end maps, on x in units of order to keep the fit well conditioned
+    std::vector<double> x0(order), x1(order), xe0(order), xe1(order), e0, e1;
+    for (long i=0; i < order; i++) {
+        x0[i] = (double) i / order;
+        xe0[i] = (double) (i - order) / order;
+        x1[i] = (double) (i - order + 1) / order;
+        xe1[i] = (double) (i + 1) / order;
+    }
+    if (polyext_map(e0, x0, xe0, degree) != 0 || polyext_map(e1, x1, xe1, degree) != 0)
+        return -1;
+    // Phase r reads samples c[r] + a of the extended row from output q,
+    // with taps h[r][a] summing to wsum[r]
+    std::vector<std::vector<double> > h(factor);
+    std::vector<long> c(factor);
+    std::vector<double> wsum(factor, 0.);
+    long span = 0;
+    for (long r=0; r < factor; r++) {
+        long m0 = (factor - r) % factor;
+        c[r] = r > 0 ? 1 : 0;
+        for (long m=m0; m < ntap; m+=factor) h[r].push_back(fir[ntap-1-m]);
+        for (size_t a=0; a < h[r].size(); a++) wsum[r] += h[r][a];
+        span = std::max(span, c[r] + (long) h[r].size());
+    }
+    long nblk = (nout + INTERP_BLOCK - 1) / INTERP_BLOCK;
+    int nt = aipy_pool_nthreads(nrow * nblk, nthreads);
+    std::vector<std::vector<double> > scratch(nt);
+    aipy_parallel(nrow * nblk, nt, [&](long k, int tid) {
+        long row = k / nblk, p0 = (k % nblk) * INTERP_BLOCK;
+        long p1 = std::min(nout, p0 + INTERP_BLOCK);
+        const double *y = ys + row * n * ncomp;
+        double *o = out + (row * nout + p0) * ncomp;
+        // The samples j0 <= j < j1 of the extended row this block reads
+        long j0 = p0 / factor, j1 = std::min(next, (p1 - 1) / factor + span);
+        std::vector<double> &ye = scratch[tid];
+        ye.assign((j1 - j0) * ncomp, 0.);
+        for (long j=j0; j < j1; j++) {
+            double *v = &ye[(j - j0) * ncomp];
+            if (j >= order && j < order + n) {
+                for (int q=0; q < ncomp; q++) v[q] = y[(j - order) * ncomp + q];
+            } else if (j < order) {
+                for (long i=0; i < order; i++)
+                    for (int q=0; q < ncomp; q++) v[q] += e0[j*order + i] * y[i*ncomp + q];
+            } else {
+                const double *yt = y + (n - order) * ncomp;
+                for (long i=0; i < order; i++)
+                    for (int q=0; q < ncomp; q++)
+                        v[q] += e1[(j - order - n)*order + i] * yt[i*ncomp + q];
+            }
+        }
+        for (long p=p0; p < p1; p++, o+=ncomp) {
+            long r = p % factor;
+            const double *hr = h[r].data(), *v = &ye[(p / factor + c[r] - j0) * ncomp];
+            long na = (long) h[r].size();
+            for (int q=0; q < ncomp; q++) {
+                double s = 0;
+                for (long a=0; a < na; a++) s += hr[a] * v[a*ncomp + q];
+                o[q] = s / wsum[r];
+            }
+        }
+    });
+    return nout;
+}
@@ -0,0 +1,15 @@
+#ifndef _INTERP_H_
+#define _INTERP_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+long interp_fir(double *, const double *, long, long, int, const double *, long,
+        long, long, int, int);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,191 @@
+// Phasing for phs.AntennaArray.gen_phs: exp(-2 pi i (w + o)) for every
+// baseline, source and channel, written straight into the output with
+// none of numpy's (nsrc, nchan) temporaries.  The phase is reduced to a
+// quarter turn exactly (w is in turns) before a polynomial sin/cos, so the
+// loops vectorise and large w lose no accuracy to argument reduction.
+// sim_vis fuses the same phasors with the beam, flux and passband terms
+// of amp.AntennaArray.sim, summing over sources, for every baseline.
+// src_crds gives SrcCatalog.compute_crds the apparent positions of fixed
+// sources at many times.
+
+#include "phs.h"
+#include "aipy_pool.h"
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+// Sources per item of the src_crds loop
+#define SRC_BLOCK 4096
+
+// cos and sin of 2 pi x, for any x below 2^50 in magnitude
+static inline void cis2pi(double x, double &c, double &s) {
+    const double round = 6755399441055744.0;    // 1.5 * 2^52
+    double q = (4*x + round) - round;           // nearest quarter turn
+    double r = 6.283185307179586476925 * (x - 0.25*q), r2 = r*r;
+    // Taylor series on |r| <= pi/4, good to rounding
+    double sr = r * (1 + r2*(-1./6 + r2*(1./120 + r2*(-1./5040 + r2*(1./362880
+        + r2*(-1./39916800 + r2*(1./6227020800 + r2*(-1./1307674368000))))))));
+    double cr = 1 + r2*(-1./2 + r2*(1./24 + r2*(-1./720 + r2*(1./40320
+        + r2*(-1./3628800 + r2*(1./479001600 + r2*(-1./87178291200
+        + r2*(1./20922789888000))))))));
+    long k = (long) q & 3;
+    c = k == 0 ? cr : (k == 1 ? -sr : (k == 2 ? -cr : sr));
+    s = k == 0 ? sr : (k == 1 ? cr : (k == 2 ? -sr : -cr));
+}
+
+// The phases x (turns) over nchan channels of baseline p (u, v, w) towards
+// source s with offsets o, with the refraction term when ion is given
+static inline void phs_turns(double *x, const double *p, long s, long nchan,
+        const double *freqs, const double *o, const double *ion) {
+    double u = p[0], v = p[1], w = p[2];
+    if (ion != NULL) {
+        const double *ir = ion + 3*s;
+        double m2 = ir[2]*ir[2];
+        for (long f=0; f < nchan; f++) {
+            double fr = freqs[f];
+            x[f] = (w*fr + (ir[0]*(u*fr) + ir[1]*(v*fr)) * m2 / (fr*fr)) + o[f];
+        }
+    } else {
+        for (long f=0; f < nchan; f++) x[f] = w*freqs[f] + o[f];
+    }
+}
+
+// The uniform-disk amplitude of source s (shape: a1, a2, th) on baseline
+// p (u, v) at channel frequency fr
+static inline double disk_amp(const double *p, const double *sh, double ct,
+        double st, double fr) {
+    double uf = p[0]*fr, vf = p[1]*fr;
+    double ru = sh[0] * (uf*ct - vf*st), rv = sh[1] * (uf*st + vf*ct);
+    double a = 2 * M_PI * sqrt(ru*ru + rv*rv);
+    return a == 0 ? 1 : 2 * j1(a) / a;
+}
+
+// Writes the complex128 phasors out (nbl, nsrc, nchan) of baselines
+// projected towards each source, uvw (nbl, nsrc, 3) (ns), at freqs (GHz)
+// with offsets off (nbl, nchan) (turns), as AntennaArray.gen_phs does:
+// w gets the refraction term of AntennaArray.refract when ion (nsrc, 3:
+// dra, ddec, mfreq) is given, and the phasors the uniform-disk amplitude
+// of AntennaArray.resolve_src when shape (nsrc, 3: a1, a2, th) is.
+extern "C"
+int gen_phs(double *out, long nbl, long nsrc, long nchan, const double *uvw,
+        const double *freqs, const double *off, const double *ion,
+        const double *shape) {
+    std::vector<double> x(nchan);
+    for (long b=0; b < nbl; b++) {
+        const double *o = off + b*nchan;
+        for (long s=0; s < nsrc; s++) {
+            const double *p = uvw + 3*(b*nsrc + s);
+            double *row = out + 2*(b*nsrc + s)*nchan;
+            phs_turns(&x[0], p, s, nchan, freqs, o, ion);
+            for (long f=0; f < nchan; f++) {
+                double c, sn;
+                cis2pi(x[f], c, sn);
+                row[2*f] = c;
+                row[2*f+1] = -sn;
+            }
+            if (shape == NULL) continue;
+            const double *sh = shape + 3*s;
+            double ct = cos(sh[2]), st = sin(sh[2]);
+            for (long f=0; f < nchan; f++) {
+                double a = disk_amp(p, sh, ct, st, freqs[f]);
+                row[2*f] *= a;
+                row[2*f+1] *= a;
+            }
+        }
+    }
+    return 0;
+}
+
+// Writes the complex128 model visibilities out (nbl, nchan) of
+// amp.AntennaArray.sim: for each baseline b, gain[b] (complex128, nchan,
+// or 1 if gain is NULL) times the sum over sources s of
+// bm[bidx[b,1],s] conj(bm[bidx[b,0],s]) jys[s] conj(phs[b,s]), with the
+// beams bm (nbeam, nsrc, nchan: complex128) of the feeds of antennas i
+// and j chosen by bidx (nbl, 2), the fluxes jys (nsrc, nchan) and the
+// phasors phs of gen_phs (uvw, freqs, off, ion and shape as there).
+// Baselines are shared among nthreads threads (0 = aipy.get_num_threads()).
+// Returns 0, or 1 + the first baseline with a beam index outside bm, in
+// which case nothing is written.
+extern "C"
+long sim_vis(double *out, long nbl, long nsrc, long nchan, const double *uvw,
+        const double *freqs, const double *off, const double *ion,
+        const double *shape, const double *bm, long nbeam, const int *bidx,
+        const double *jys, const double *gain, int nthreads) {
+    for (long b=0; b < nbl; b++) {
+        if (bidx[2*b] < 0 || bidx[2*b] >= nbeam || bidx[2*b+1] < 0 || bidx[2*b+1] >= nbeam)
+            return b + 1;
+    }
+    aipy_parallel(nbl, nthreads, [&](long b, int) {
+        static thread_local std::vector<double> buf;
+        buf.resize(3*nchan);
+        double *x = &buf[0], *ar = x + nchan, *ai = ar + nchan;
+        const double *o = off + b*nchan;
+        for (long f=0; f < nchan; f++) ar[f] = ai[f] = 0;
+        for (long s=0; s < nsrc; s++) {
+            const double *p = uvw + 3*(b*nsrc + s);
+            const double *bi = bm + 2*(bidx[2*b]*nsrc + s)*nchan;
+            const double *bj = bm + 2*(bidx[2*b+1]*nsrc + s)*nchan;
+            const double *jy = jys + s*nchan;
+            const double *sh = shape == NULL ? NULL : shape + 3*s;
+            double ct = sh == NULL ? 1 : cos(sh[2]), st = sh == NULL ? 0 : sin(sh[2]);
+            phs_turns(x, p, s, nchan, freqs, o, ion);
+            for (long f=0; f < nchan; f++) {
+                double c, sn;
+                cis2pi(x[f], c, sn);
+                // bm_j conj(bm_i) jys, times the conjugate phasor c + i sn
+                double a = jy[f] * (sh == NULL ? 1 : disk_amp(p, sh, ct, st, freqs[f]));
+                double br = (bj[2*f]*bi[2*f] + bj[2*f+1]*bi[2*f+1]) * a;
+                double bim = (bj[2*f+1]*bi[2*f] - bj[2*f]*bi[2*f+1]) * a;
+                ar[f] += br*c - bim*sn;
+                ai[f] += br*sn + bim*c;
+            }
+        }
+        double *row = out + 2*b*nchan;
+        for (long f=0; f < nchan; f++) {
+            double gr = gain == NULL ? 1 : gain[2*(b*nchan + f)];
+            double gi = gain == NULL ? 0 : gain[2*(b*nchan + f) + 1];
+            row[2*f] = gr*ar[f] - gi*ai[f];
+            row[2*f+1] = gr*ai[f] + gi*ar[f];
+        }
+    });
+    return 0;
+}
+
+// Apparent places of nsrc fixed sources at ntime times: for the (3, nsrc)
+// J2000 unit vectors s, writes eq[t] = m[t] (s + v[t] - (s.v[t]) s), made
+// unit, and, if top is not NULL, top[t] = e2t[t] eq[t], both (3, nsrc)
+// per time.  m (3x3 per time) rotates J2000 to the equator and equinox of
+// date, v (3 per time) is the aberrating velocity (units of c) in J2000
+// and e2t (3x3 per time) converts to topocentric.  Blocks of sources at a
+// time are shared among threads; the loops over sources vectorise.
+extern "C"
+int src_crds(double *eq, double *top, long ntime, long nsrc, const double *s,
+        const double *m, const double *v, const double *e2t, int nthreads) {
+    long nblk = (nsrc + SRC_BLOCK - 1) / SRC_BLOCK;
+    aipy_parallel(ntime * nblk, nthreads, [&](long k, int) {
+        long t = k / nblk, s0 = (k % nblk) * SRC_BLOCK;
+        long s1 = std::min(nsrc, s0 + SRC_BLOCK);
+        const double *mt = m + 9*t, *vt = v + 3*t, *et = e2t + 9*t;
+        const double *sx = s, *sy = s + nsrc, *sz = s + 2*nsrc;
+        double *ex = eq + 3*t*nsrc, *ey = ex + nsrc, *ez = ey + nsrc;
+        for (long i=s0; i < s1; i++) {
+            double d = sx[i]*vt[0] + sy[i]*vt[1] + sz[i]*vt[2];
+            double wx = sx[i] + vt[0] - d*sx[i];
+            double wy = sy[i] + vt[1] - d*sy[i];
+            double wz = sz[i] + vt[2] - d*sz[i];
+            double r = 1 / sqrt(wx*wx + wy*wy + wz*wz);
+            wx *= r; wy *= r; wz *= r;
+            ex[i] = mt[0]*wx + mt[1]*wy + mt[2]*wz;
+            ey[i] = mt[3]*wx + mt[4]*wy + mt[5]*wz;
+            ez[i] = mt[6]*wx + mt[7]*wy + mt[8]*wz;
+        }
+        if (top == NULL) return;
+        double *tx = top + 3*t*nsrc, *ty = tx + nsrc, *tz = ty + nsrc;
+        for (long i=s0; i < s1; i++) {
+            tx[i] = et[0]*ex[i] + et[1]*ey[i] + et[2]*ez[i];
+            ty[i] = et[3]*ex[i] + et[4]*ey[i] + et[5]*ez[i];
+            tz[i] = et[6]*ex[i] + et[7]*ey[i] + et[8]*ez[i];
+        }
+    });
+    return 0;
+}
@@ -0,0 +1,20 @@
+#ifndef _PHS_H_
+#define _PHS_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int gen_phs(double *, long, long, long, const double *, const double *,
+        const double *, const double *, const double *);
+long sim_vis(double *, long, long, long, const double *, const double *,
+        const double *, const double *, const double *, const double *, long,
+        const int *, const double *, const double *, int);
+int src_crds(double *, double *, long, long, const double *, const double *,
+        const double *, const double *, int);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,155 @@
+// RFI flagging for rfi.py: the robust residual of a rolling median, sigma
+// clipping and SumThreshold (Offringa et al. 2010), on float32 (nbl, ntime,
+// nchan) planes with byte masks (nonzero = flagged) that new flags are
+// or'ed into in place.  Baselines are independent and shared among
+// threads, so the result does not depend on the thread count.
+
+#include "rfi.h"
+#include "aipy_pool.h"
+#include <cmath>
+#include <cfloat>
+#include <vector>
+#include <algorithm>
+
+// Median of v (reordered), which must not be empty
+static double median(std::vector<float> &v) {
+    size_t h = v.size() / 2;
+    std::nth_element(v.begin(), v.begin() + h, v.end());
+    double m = v[h];
+    if (v.size() % 2 == 0) m = 0.5 * (m + *std::max_element(v.begin(), v.begin() + h));
+    return m;
+}
+
+// Writes to out the residual of dat from the median of the unflagged
+// samples within wt integrations and wf channels of each, in units of
+// 1.4826 times the median absolute residual of the baseline (the standard
+// deviation, for Gaussian noise).  Flagged samples, and those with no
+// unflagged neighbours, get 0.
+extern "C"
+int rfi_medfilt(float *out, const float *dat, const unsigned char *mask,
+        long nbl, long ntime, long nchan, long wt, long wf, int nthreads) {
+    if (wt < 0 || wf < 0) return -1;
+    long n = ntime * nchan;
+    aipy_parallel(nbl, nthreads, [&](long b, int) {
+        const float *d = dat + b*n;
+        const unsigned char *m = mask + b*n;
+        float *o = out + b*n;
+        std::vector<float> win, res;
+        win.reserve((2*wt+1) * (2*wf+1));
+        res.reserve(n);
+        for (long t=0; t < ntime; t++) {
+            long t0 = std::max(0L, t-wt), t1 = std::min(ntime, t+wt+1);
+            for (long f=0; f < nchan; f++) {
+                long k = t*nchan + f;
+                o[k] = 0;
+                if (m[k]) continue;
+                long f0 = std::max(0L, f-wf), f1 = std::min(nchan, f+wf+1);
+                win.clear();
+                for (long tt=t0; tt < t1; tt++)
+                    for (long q=tt*nchan+f0; q < tt*nchan+f1; q++)
+                        if (!m[q]) win.push_back(d[q]);
+                // The sample itself is always in its window
+                o[k] = (float) (d[k] - median(win));
+                res.push_back(std::fabs(o[k]));
+            }
+        }
+        if (res.empty()) return;
+        double sig = std::max(1.4826 * median(res), (double) FLT_MIN);
+        for (long k=0; k < n; k++) {
+            double z = o[k] / sig;
+            o[k] = (float) std::max(-(double) FLT_MAX, std::min((double) FLT_MAX, z));
+        }
+    });
+    return 0;
+}
+
+// Iterative sigma clipping of dat: along time for each channel (axis 0)
+// or along frequency for each integration (axis 1), flags the samples
+// more than nsig standard deviations from the mean of those unflagged,
+// for up to niter rounds or until a round flags nothing.
+extern "C"
+int rfi_sigclip(unsigned char *mask, const float *dat, long nbl, long ntime,
+        long nchan, int axis, double nsig, int niter, int nthreads) {
+    if (axis != 0 && axis != 1) return -1;
+    long n = ntime * nchan;
+    long nline = axis == 0 ? nchan : ntime, len = axis == 0 ? ntime : nchan;
+    long step = axis == 0 ? nchan : 1, lstep = axis == 0 ? 1 : nchan;
+    aipy_parallel(nbl, nthreads, [&](long b, int) {
+        const float *d = dat + b*n;
+        unsigned char *m = mask + b*n;
+        for (long l=0; l < nline; l++) {
+            long k0 = l*lstep;
+            for (int it=0; it < niter; it++) {
+                double s = 0, s2 = 0;
+                long cnt = 0;
+                for (long i=0, k=k0; i < len; i++, k+=step) {
+                    if (m[k]) continue;
+                    s += d[k];
+                    cnt++;
+                }
+                if (cnt < 2) break;
+                double mean = s / cnt;
+                for (long i=0, k=k0; i < len; i++, k+=step)
+                    if (!m[k]) s2 += (d[k] - mean) * (d[k] - mean);
+                double lim = nsig * std::sqrt(s2 / cnt);
+                long nnew = 0;
+                for (long i=0, k=k0; i < len; i++, k+=step) {
+                    if (m[k] || std::fabs(d[k] - mean) <= lim) continue;
+                    m[k] = 1;
+                    nnew++;
+                }
+                if (nnew == 0) break;
+            }
+        }
+    });
+    return 0;
+}
+
+// One SumThreshold pass over a line of len samples step apart: flags every
+// window of w samples whose sum of sgn*dat (flagged samples counting as
+// chi) exceeds w chi, in the pass's own mask nw
+static void sum_line(unsigned char *nw, const float *d, const unsigned char *m,
+        long len, long step, long w, double chi, double sgn) {
+    if (w > len) return;
+    double s = 0;
+    long last = -1;     // last window end flagged out to, in samples
+    for (long i=0; i < len; i++) {
+        long k = i*step;
+        s += m[k] ? chi : sgn*d[k];
+        if (i >= w) {
+            long q = (i-w)*step;
+            s -= m[q] ? chi : sgn*d[q];
+        }
+        if (i < w-1 || s <= w*chi) continue;
+        for (long j=std::max(i-w+1, last+1); j <= i; j++) nw[j*step] = 1;
+        last = i;
+    }
+}
+
+// SumThreshold of dat, for excesses and deficits alike, along time and
+// along frequency, for windows of 1, 2, 4, ... up to mmax samples with
+// thresholds chi1 / rho**log2(w): the flags of each window size count (as
+// the threshold) in the next.  dat should be a residual in units of its
+// noise, as rfi_medfilt writes.
+extern "C"
+int rfi_sumthreshold(unsigned char *mask, const float *dat, long nbl, long ntime,
+        long nchan, double chi1, long mmax, double rho, int nthreads) {
+    if (mmax < 1 || rho <= 0) return -1;
+    long n = ntime * nchan;
+    aipy_parallel(nbl, nthreads, [&](long b, int) {
+        const float *d = dat + b*n;
+        unsigned char *m = mask + b*n;
+        std::vector<unsigned char> nw(m, m + n);
+        for (long w=1; w <= mmax; w*=2) {
+            double chi = chi1 / std::pow(rho, std::log2((double) w));
+            for (int sgn=-1; sgn <= 1; sgn+=2) {
+                for (long t=0; t < ntime; t++)
+                    sum_line(&nw[t*nchan], d + t*nchan, m + t*nchan, nchan, 1, w, chi, sgn);
+                for (long f=0; f < nchan; f++)
+                    sum_line(&nw[f], d + f, m + f, ntime, nchan, w, chi, sgn);
+            }
+            for (long k=0; k < n; k++) m[k] |= nw[k];
+        }
+    });
+    return 0;
+}
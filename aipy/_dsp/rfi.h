@@ -0,0 +1,19 @@
+#ifndef _RFI_H_
+#define _RFI_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int rfi_medfilt(float *, const float *, const unsigned char *, long, long, long,
+        long, long, int);
+int rfi_sigclip(unsigned char *, const float *, long, long, long, int, double,
+        int, int);
+int rfi_sumthreshold(unsigned char *, const float *, long, long, long, double,
+        long, double, int);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
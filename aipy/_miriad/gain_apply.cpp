@@ -0,0 +1,87 @@
+// Application of per-antenna complex gains to blocks of visibilities, for
+// apply_gains and the cal option of raw_pipe in miriad_wrap.cpp: each
+// record of baseline (i, j) is multiplied (or divided) by g_i conj(g_j),
+// the gains interpolated linearly in time from a table.  The per-channel
+// loops work on separate real and imaginary rows so that they vectorise;
+// records are independent and shared among threads.
+
+#include "gain_apply.h"
+#include "aipy_pool.h"
+#include <vector>
+#include <algorithm>
+
+// Interpolates the gains (re, im pairs) g0 and g1 of nchan channels with
+// weight w on g1, into the rows re and im
+static inline void gain_interp(float *re, float *im, const float *g0,
+        const float *g1, float w, long nchan) {
+    float w0 = 1 - w;
+    for (long c=0; c < nchan; c++) {
+        re[c] = w0 * g0[2*c] + w * g1[2*c];
+        im[c] = w0 * g0[2*c+1] + w * g1[2*c+1];
+    }
+}
+
+// Applies the gains (ntime, nant, npol, nchan: complex64 as re, im pairs)
+// sampled at the ascending gtimes to the n records of data (n, nchan:
+// complex64) at times t, of antennas ij (n, 2) and feeds pidx (n, 2)
+// (indices on the npol axis for antennas i and j, so that g_x conj(g_y)
+// calibrates an xy record; records with a negative one are left alone): data *= g_i conj(g_j), or with divide, data /= g_i
+// conj(g_j), which flags (if flags, (n, nchan) bool, invalid where true)
+// and zeroes channels of zero gain.  Gains are linear in time between
+// samples and held beyond them.  Returns 0, or 1 + the first record of an
+// antenna or polarization outside the table, in which case nothing is
+// changed.
+extern "C"
+long gain_apply(float *data, unsigned char *flags, long n, long nchan,
+        const int *ij, const int *pidx, const double *t, const float *gains,
+        const double *gtimes, long ntime, long nant, long npol, int divide,
+        int nthreads) {
+    for (long r=0; r < n; r++) {
+        if (pidx[2*r] < 0 || pidx[2*r+1] < 0) continue;
+        if (pidx[2*r] >= npol || pidx[2*r+1] >= npol || ij[2*r] < 0 || ij[2*r] >= nant
+                || ij[2*r+1] < 0 || ij[2*r+1] >= nant)
+            return r + 1;
+    }
+    if (ntime <= 0) return n > 0 ? 1 : 0;
+    aipy_parallel(n, nthreads, [&](long r, int) {
+        if (pidx[2*r] < 0 || pidx[2*r+1] < 0) return;
+        static thread_local std::vector<float> buf;
+        buf.resize(4*nchan);
+        float *ar = &buf[0], *ai = ar + nchan, *br = ai + nchan, *bi = br + nchan;
+        // The samples either side of t[r], and the weight on the later one
+        long k1 = std::upper_bound(gtimes, gtimes + ntime, t[r]) - gtimes, k0 = k1 - 1;
+        float w = 0;
+        if (k1 == 0) k0 = 0;
+        else if (k1 == ntime) k1 = k0;
+        else w = (float) ((t[r] - gtimes[k0]) / (gtimes[k1] - gtimes[k0]));
+        const float *g0 = gains + 2*nchan*((k0*nant + ij[2*r])*npol + pidx[2*r]);
+        const float *g1 = gains + 2*nchan*((k1*nant + ij[2*r])*npol + pidx[2*r]);
+        gain_interp(ar, ai, g0, g1, w, nchan);
+        g0 = gains + 2*nchan*((k0*nant + ij[2*r+1])*npol + pidx[2*r+1]);
+        g1 = gains + 2*nchan*((k1*nant + ij[2*r+1])*npol + pidx[2*r+1]);
+        gain_interp(br, bi, g0, g1, w, nchan);
+        // g_i conj(g_j) into (ar, ai), inverted for divide
+        for (long c=0; c < nchan; c++) {
+            float pr = ar[c]*br[c] + ai[c]*bi[c], pi = ai[c]*br[c] - ar[c]*bi[c];
+            if (divide) {
+                float m = pr*pr + pi*pi;
+                float s = m > 0 ? 1 / m : 0;
+                pr *= s;
+                pi *= -s;
+            }
+            ar[c] = pr;
+            ai[c] = pi;
+        }
+        float *d = data + 2*r*nchan;
+        for (long c=0; c < nchan; c++) {
+            float dr = d[2*c], di = d[2*c+1];
+            d[2*c] = dr*ar[c] - di*ai[c];
+            d[2*c+1] = dr*ai[c] + di*ar[c];
+        }
+        if (divide && flags != NULL) {
+            unsigned char *f = flags + r*nchan;
+            for (long c=0; c < nchan; c++) f[c] |= ar[c] == 0 && ai[c] == 0;
+        }
+    });
+    return 0;
+}
@@ -0,0 +1,15 @@
+#ifndef _GAIN_APPLY_H_
+#define _GAIN_APPLY_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+long gain_apply(float *, unsigned char *, long, long, const int *, const int *,
+        const double *, const float *, const double *, long, long, long, int, int);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,89 @@
+// Parsing of JPL line catalog entries (c<tag>.cat) for jpl_index in
+// miriad.py, which sorts them by frequency into a memory-mapped index.
+// Entries are the fixed-width lines that getcat in jplread.c reads:
+// FREQ F13.4, ERR F8.4, LGINT F8.4, DR I2, ELO F10.4, GUP I3, TAG I7,
+// QNFMT I4, then 12 quantum numbers of 2 characters each (6 upper, 6
+// lower), encoded as readqn decodes them.
+
+#include "jplcat.h"
+#include <cstdlib>
+#include <cstring>
+
+// The fields before the quantum numbers: width, whether an integer, and
+// column of dval or ival
+static const struct { int w, isint, col; } fields[8] = {
+    {13, 0, 0}, {8, 0, 1}, {8, 0, 2}, {2, 1, 0},
+    {10, 0, 3}, {3, 1, 1}, {7, 1, 2}, {4, 1, 3},
+};
+
+// The field of width w at line[*col] (of n characters) into buf, with
+// *col moved past it: 0 if it is blank
+static int field(const char *line, long n, long *col, int w, char *buf) {
+    int k = 0;
+    for (int i=0; i < w && *col + i < n; i++) buf[k++] = line[*col + i];
+    buf[k] = 0;
+    *col += w;
+    for (int i=0; i < k; i++) if (buf[i] != ' ') return 1;
+    return 0;
+}
+
+// Decodes the quantum number of 2 characters ich ic into *q, as readqn:
+// returns -1 if they are not one
+static int qnum(char ich, char ic, short *q) {
+    if (ic == ' ') { *q = 0; return 0; }
+    int v = ic - '0';
+    if (v < 0 || v > 9) return -1;
+    if (ich == '-') v = -v;
+    else if (ich >= '0' && ich <= '9') v += (ich - '0') * 10;
+    else if (ich >= 'a' && ich <= 'z') v = -v - 10 * (ich - ('a' - 1));
+    else if (ich >= 'A' && ich <= 'Z') v += 10 * (ich - ('A' - 10));
+    else if (ich != ' ') return -1;
+    *q = (short) v;
+    return 0;
+}
+
+// Parses the catalog entries of buf (nbuf characters, lines ended by
+// '\n' and maybe '\r'; blank lines are skipped) into the rows of dval
+// (freq, err, lgint, elo), ival (dr, gup, tag, qnfmt) and qn (JPL_NQN
+// each), at most maxline of them.  Returns the entries parsed, or -1 -
+// the line number (from 0) of the first that is malformed or beyond
+// maxline.
+extern "C"
+long jpl_parse(const char *buf, long nbuf, long maxline, double *dval, int *ival, short *qn) {
+    char f[16], *end;
+    long n = 0, lineno = 0;
+    for (long p=0; p < nbuf; lineno++) {
+        const char *line = buf + p;
+        const char *nl = (const char *) memchr(line, '\n', nbuf - p);
+        long len = nl ? nl - line : nbuf - p;
+        p += len + 1;
+        if (len > 0 && line[len-1] == '\r') len--;
+        int blank = 1;
+        for (long i=0; i < len && blank; i++) blank = line[i] == ' ';
+        if (blank) continue;
+        if (n >= maxline) return -1 - lineno;
+        long col = 0;
+        double *d = dval + 4*n;
+        int *iv = ival + 4*n;
+        short *q = qn + JPL_NQN*n;
+        for (int k=0; k < 8; k++) {
+            double v = 0;
+            if (field(line, len, &col, fields[k].w, f)) {
+                v = fields[k].isint ? (double) strtol(f, &end, 10) : strtod(f, &end);
+                while (*end == ' ') end++;
+                if (*end != 0) return -1 - lineno;
+            } else if (k == 0) {
+                return -1 - lineno;
+            }
+            if (fields[k].isint) iv[fields[k].col] = (int) v;
+            else d[fields[k].col] = v;
+        }
+        for (int k=0; k < JPL_NQN; k++, col+=2) {
+            q[k] = 0;
+            if (col + 1 >= len) continue;
+            if (qnum(line[col], line[col+1], &q[k]) != 0) return -1 - lineno;
+        }
+        n++;
+    }
+    return n;
+}
@@ -0,0 +1,16 @@
+#ifndef _JPLCAT_H_
+#define _JPLCAT_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define JPL_NQN 12
+
+long jpl_parse(const char *, long, long, double *, int *, short *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -114,7 +114,9 @@ void bug_c(char s,Const char *m)
   fprintf(stderr,"### %s:  %s\n",p,m);
   if(doabort){
     reentrant = !reentrant;
-    if(reentrant)habort_c();
+    /* A client that recovers keeps its other data-sets, which may be in
+       use on other threads */
+    if(reentrant && !bug_cleanup)habort_c();
 #ifdef vms
 # include ssdef
     lib$stop(SS$_ABORT);
@@ -168,7 +170,9 @@ void bugv_c(char s,Const char *m, ...)
 
   if(doabort){
     reentrant = !reentrant;
-    if(reentrant)habort_c();
+    /* A client that recovers keeps its other data-sets, which may be in
+       use on other threads */
+    if(reentrant && !bug_cleanup)habort_c();
     if (bug_cleanup) {
         (*bug_cleanup)();       /* call it */
         fprintf(stderr,"### bug_cleanup: code should not come here, goodbye\n");
@@ -46,6 +46,7 @@
 #define direct dirent
 #include <stdio.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "miriad.h"
 
@@ -64,6 +65,39 @@ struct dent {
   char path[MAXPATH];
   DIR *dir;
 };
+
+/* Asynchronous i/o. dread_c and dwrite_c start a transfer, which runs on
+   one of DIO_THREADS background threads, and dwait_c waits for it: hio
+   has at most one transfer in flight per file, and uses the time to
+   unpack (or fill) its other buffer. dreadf_c also has the thread call a
+   function once the read is done, so that hio can decode a compressed
+   chunk ahead of its use. The threads are started on first use
+   (and again in a forked child); if they cannot be, transfers are done
+   synchronously. */
+
+#define DIO_THREADS 2
+
+#define DREQ_IDLE   0
+#define DREQ_QUEUED 1
+#define DREQ_DONE   2
+
+typedef struct dreq {
+  int fd,dowrite,state,iostat;
+  char *buffer;
+  off64_t offset;
+  size_t length;
+  int (*post)(void *);		/* Called after a good read, if not NULL. */
+  void *arg;
+  struct dreq *next;
+} DREQ;
+
+static pthread_mutex_t dio_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t dio_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t dio_done = PTHREAD_COND_INITIALIZER;
+static DREQ **dio_slot = NULL;		/* The request of each fd */
+static int dio_nslot = 0;
+static DREQ *dio_head = NULL,*dio_tail = NULL;
+static int dio_nthreads = 0,dio_atfork = 0;
 /************************************************************************/
 void ddelete_c(char *path,int *iostat)
 /*
@@ -73,6 +107,14 @@ void ddelete_c(char *path,int *iostat)
   *iostat = ( unlink(path) ? errno : 0 );
 }
 /************************************************************************/
+void drename_c(char *from,char *to,int *iostat)
+/*
+  This renames a file, replacing any called "to".
+------------------------------------------------------------------------*/
+{
+  *iostat = ( rename(from,to) < 0 ? errno : 0 );
+}
+/************************************************************************/
 void dtrans_c(char *inpath,char *outpath,int *iostat)
 /*
   Translate a directory spec into the local format. On a UNIX machine,
@@ -179,6 +221,14 @@ void dopen_c(int *fd,char *name,char *status,off64_t *size,int *iostat)
   if((*fd = open(s,flags,0644)) < 0){*iostat = errno; return;}
   *size = Lseek(*fd,0,SEEK_END);
 
+/* Files opened for reading are mostly read from start to end: let the
+   kernel read ahead further. */
+
+#ifdef POSIX_FADV_SEQUENTIAL
+  if(!strcmp(status,"read"))
+    (void)posix_fadvise(*fd,0,0,POSIX_FADV_SEQUENTIAL);
+#endif
+
 /* If its a scratch file, unlink it now, so that the file will disappear
    when it is closed (or this program crashes). */
 
@@ -187,50 +237,190 @@ void dopen_c(int *fd,char *name,char *status,off64_t *size,int *iostat)
 /************************************************************************/
 void dclose_c(int fd,int *iostat)
 /*
-  This subroutine does unbelievably complex stuff.
+  This subroutine does unbelievably complex stuff. It waits for any
+  transfer on fd, and returns its status if nobody did (so that the slot
+  is idle when the fd is reused).
 ------------------------------------------------------------------------*/
 {
-  *iostat = ( close(fd) < 0 ? errno : 0 );
+  DREQ *r;
+  int stat;
+
+  stat = 0;
+  pthread_mutex_lock(&dio_lock);
+  r = (fd < dio_nslot ? dio_slot[fd] : NULL);
+  if(r != NULL){
+    while(r->state == DREQ_QUEUED) pthread_cond_wait(&dio_done,&dio_lock);
+    if(r->state == DREQ_DONE) stat = r->iostat;
+    r->state = DREQ_IDLE;
+  }
+  pthread_mutex_unlock(&dio_lock);
+  *iostat = ( close(fd) < 0 ? errno : stat );
 }
 /************************************************************************/
-void dread_c(int fd, char *buffer,off64_t offset,size_t length,int *iostat)
+static int dxfer(DREQ *r)
 /*
-  Read from a file.
+  Do a transfer, and then its post function, returning the i/o status.
 ------------------------------------------------------------------------*/
 {
-  ssize_t nread;
+  ssize_t n;
 #ifdef debug
-  if (length >= SSIZE_MAX) bugv_c('f',"dread_c: possible incomplete read");
+  if (r->length >= SSIZE_MAX) bugv_c('f',"dxfer: possible incomplete transfer");
 #endif
-  if(Lseek(fd,offset,SEEK_SET) < 0) { *iostat = errno; return; }
-  nread = read(fd,buffer,length);
-  if(nread < 0) *iostat = errno; 
-  else if(nread != (ssize_t) length) *iostat = EIO;
+  if(r->dowrite) n = pwrite64(r->fd,r->buffer,r->length,r->offset);
+  else		 n = pread64(r->fd,r->buffer,r->length,r->offset);
+  if(n < 0) return errno;
+  if(n != (ssize_t) r->length) return EIO;
+  return (r->post != NULL ? (*r->post)(r->arg) : 0);
+}
+/************************************************************************/
+static void *dio_thread(void *arg)
+/*
+  A background i/o thread: do queued transfers in turn.
+------------------------------------------------------------------------*/
+{
+  DREQ *r;
+  int iostat;
+
+  pthread_mutex_lock(&dio_lock);
+  while(1){
+    while(dio_head == NULL) pthread_cond_wait(&dio_work,&dio_lock);
+    r = dio_head;
+    dio_head = r->next;
+    if(dio_head == NULL) dio_tail = NULL;
+    pthread_mutex_unlock(&dio_lock);
+    iostat = dxfer(r);
+    pthread_mutex_lock(&dio_lock);
+    r->iostat = iostat;
+    r->state = DREQ_DONE;
+    pthread_cond_broadcast(&dio_done);
+  }
+  return NULL;
+}
+/************************************************************************/
+static void dio_child(void)
+/*
+  After a fork, the child has none of the threads: forget them and any
+  transfers they had, and start afresh.
+------------------------------------------------------------------------*/
+{
+  int i;
+  pthread_mutex_init(&dio_lock,NULL);
+  pthread_cond_init(&dio_work,NULL);
+  pthread_cond_init(&dio_done,NULL);
+  dio_head = dio_tail = NULL;
+  dio_nthreads = 0;
+  for(i=0; i < dio_nslot; i++) if(dio_slot[i] != NULL) dio_slot[i]->state = DREQ_IDLE;
+}
+/************************************************************************/
+static void dstart_c(int fd,int dowrite,char *buffer,off64_t offset,
+		     size_t length,int (*post)(void *),void *arg,int *iostat)
+/*
+  Start a transfer to or from fd, once any it already has is done. If
+  that one failed and has not been waited for, its status is returned
+  instead, and the new transfer is not started.
+------------------------------------------------------------------------*/
+{
+  pthread_t thread;
+  DREQ *r;
+  int n;
+
+  *iostat = 0;
+  pthread_mutex_lock(&dio_lock);
+  if(!dio_atfork){
+    pthread_atfork(NULL,NULL,dio_child);
+    dio_atfork = 1;
+  }
+  while(dio_nthreads < DIO_THREADS &&
+	pthread_create(&thread,NULL,dio_thread,NULL) == 0){
+    pthread_detach(thread);
+    dio_nthreads++;
+  }
+  if(fd >= dio_nslot){
+    n = (fd+1 > 2*dio_nslot ? fd+1 : 2*dio_nslot);
+    dio_slot = (DREQ **)realloc(dio_slot,n*sizeof(DREQ *));
+    memset(dio_slot+dio_nslot,0,(n-dio_nslot)*sizeof(DREQ *));
+    dio_nslot = n;
+  }
+  if(dio_slot[fd] == NULL) dio_slot[fd] = (DREQ *)calloc(1,sizeof(DREQ));
+  r = dio_slot[fd];
+  while(r->state == DREQ_QUEUED) pthread_cond_wait(&dio_done,&dio_lock);
+  if(r->state == DREQ_DONE && r->iostat){
+    *iostat = r->iostat;
+    r->state = DREQ_IDLE;
+    pthread_mutex_unlock(&dio_lock);
+    return;
+  }
+  r->fd = fd;
+  r->dowrite = dowrite;
+  r->buffer = buffer;
+  r->offset = offset;
+  r->length = length;
+  r->post = post;
+  r->arg = arg;
+  r->next = NULL;
+  if(dio_nthreads == 0){
+    r->iostat = dxfer(r);
+    r->state = DREQ_DONE;
+  } else {
+    r->state = DREQ_QUEUED;
+    if(dio_tail != NULL) dio_tail->next = r;
+    else		 dio_head = r;
+    dio_tail = r;
+    pthread_cond_signal(&dio_work);
+  }
+  pthread_mutex_unlock(&dio_lock);
+}
+/************************************************************************/
+void dread_c(int fd, char *buffer,off64_t offset,size_t length,int *iostat)
+/*
+  Start a read from a file. The buffer must be left alone until dwait_c.
+------------------------------------------------------------------------*/
+{
+  HCOUNT(HC_DREAD,1);
+  HCOUNT(HC_DREAD_BYTES,length);
+  dstart_c(fd,0,buffer,offset,length,NULL,NULL,iostat);
+}
+/************************************************************************/
+void dreadf_c(int fd,char *buffer,off64_t offset,size_t length,
+	      int (*post)(void *),void *arg,int *iostat)
+/*
+  Start a read from a file, after which the i/o thread calls post(arg),
+  whose return (0 or an errno) becomes the i/o status. The buffer, and
+  whatever post uses, must be left alone until dwait_c.
+------------------------------------------------------------------------*/
+{
+  HCOUNT(HC_DREAD,1);
+  HCOUNT(HC_DREAD_BYTES,length);
+  dstart_c(fd,0,buffer,offset,length,post,arg,iostat);
 }
 /************************************************************************/
 void dwrite_c(int fd, char *buffer,off64_t offset,size_t length,int *iostat)
 /*
-  Write to a file.
+  Start a write to a file. The buffer must be left alone until dwait_c.
 ------------------------------------------------------------------------*/
 {
-  ssize_t nwrite;
-#ifdef debug
-  if (length >= SSIZE_MAX) bugv_c('f',"dwrite_c: possible incomplete write");
-#endif
-  if(Lseek(fd,offset,SEEK_SET) < 0) { *iostat = errno; return; }
-  nwrite = write(fd,buffer,length);
-  if(nwrite < 0) *iostat = errno; 
-  else if(nwrite != (ssize_t) length) *iostat = EIO;
+  HCOUNT(HC_DWRITE,1);
+  HCOUNT(HC_DWRITE_BYTES,length);
+  dstart_c(fd,1,buffer,offset,length,NULL,NULL,iostat);
 }
 /************************************************************************/
-/*ARGSUSED*/
 void dwait_c(int fd,int *iostat)
 /*
-  This nominally waits for i/o to a file to finish. Things work synchronously
-  in UNIX.
+  Wait for the transfer started on a file to finish, and return its i/o
+  status.
 ------------------------------------------------------------------------*/
 {
+  DREQ *r;
+
   *iostat = 0;
+  pthread_mutex_lock(&dio_lock);
+  r = (fd < dio_nslot ? dio_slot[fd] : NULL);
+  if(r != NULL){
+    while(r->state == DREQ_QUEUED) pthread_cond_wait(&dio_done,&dio_lock);
+    if(r->state == DREQ_DONE) *iostat = r->iostat;
+    r->state = DREQ_IDLE;
+  }
+  pthread_mutex_unlock(&dio_lock);
 }
 /************************************************************************/
 int dexpand_c(char *templat,char *output,int length)
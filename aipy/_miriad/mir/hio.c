@@ -39,12 +39,17 @@
        05-nov-04  jwr	changed file sizes from size_t to off_t
        01-jan-05  pjt   a few bug_c() -> bugv_c()
        03-jan-05  pjt/rjs   hreada/hwritea off_t -> size_t for length 
+       14-oct-26  Compressed visdata and flags (hcompress).
 */
 
 #include <Python.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <time.h>
 
 #include "hio.h"
 #include "miriad.h"
@@ -68,9 +73,44 @@
 #define ACCESS_MODE (ITEM_READ|ITEM_WRITE|ITEM_SCRATCH|ITEM_APPEND)
 #define ITEM_CACHE    0x10
 #define ITEM_NOCACHE  0x20
+#define ITEM_MAPPED   0x40
+#define ITEM_STREAM   0x80
+#define ITEM_ZIP      0x100
+
+/* Items opened "write" in a new data set (visdata, flags and the like, as
+   a data set is first written) only ever grow: they get buffers of at
+   least STREAM_BUFSIZE, so they go to disk in few large transfers, and
+   hio_c packs writes to their end straight into the current buffer while
+   it has room, without the general buffer juggling. */
+#define STREAM_BUFSIZE (1<<20)
+
+/* Items opened "read" that are at least MAP_MIN bytes (visdata, flags and
+   the like) are memory mapped, and io[0] is made to cover the whole file:
+   reads unpack straight from the mapped pages, and processes reading the
+   same data share the page cache. The data set must not be truncated
+   while it is mapped. Define HIO_NOMMAP to always use i/o buffers. */
+#define MAP_MIN       BUFSIZE
+
+/* Compressed items. While hcompress_c (or the HIO_COMPRESS environment
+   variable) has it on, visdata, flags and wflags written into a new data
+   set are stored as chunks of the size of their i/o buffer, each coded by
+   hzencode_c. The file holds a ZIP_HDR byte header (ZIP_MAGIC and the
+   chunk size), the coded chunks, a table of the offsets of the chunks and
+   of their end, and a ZIP_TAIL byte trailer (the offset of the table, the
+   size of the item and ZIP_MAGIC), all int8s big-endian. Reading is
+   transparent: while a buffer fill hands over the chunk it needs, the
+   next one is read and decoded on the dio thread, so reading in order
+   only waits on the decoder when it outruns it. An item is compressed as it is written,
+   so writes must go forward (rewriting what is still in the buffer is
+   fine); a compressed item opened "append" is first inflated in place. */
+#define ZIP_MAGIC     "MIRZIP01"
+#define ZIP_HDR       16
+#define ZIP_TAIL      24
+#define ZIP_WIDTH     8			/* The shuffle width: a complex value. */
 
 #define TREE_CACHEMOD 0x1
 #define TREE_NEW      0x2
+#define TREE_ZIP      0x4
 
 #define RDWR_UNKNOWN 0
 #define RDWR_RDONLY  1
@@ -83,14 +123,28 @@ typedef struct {          /* buffer for I/O operations */
   char   *buf;
 } IOB;
 
+typedef struct {	  /* The chunks of a compressed item. */
+  size_t chunk;
+  int nchunk,ntab,ahead,pending;
+  size_t tail;		  /* The size of the last chunk written. */
+  off64_t *tab;		  /* File offsets of the chunks and of their end. */
+  off64_t end;		  /* The end of what has been written. */
+  off64_t size;		  /* The size of the item being read. */
+  size_t nnext,lnext;	  /* The coded and decoded sizes of chunk ahead. */
+  char *buf,*next,*work;
+  char *dec,*awork;	  /* Chunk ahead decoded, and its scratch. */
+} ZIP;
+
 typedef struct item {	
   char *name;
   int handle,flags,fd,last;
   off64_t size;
   size_t bsize;       /* bsize can technicall be an int, since it's an internal buffer size */
   off64_t offset;
+  int count;          /* index of the item's byte counters, or -1 */
   struct tree *tree;
   IOB io[2];
+  ZIP *zip;
   struct item *fwd;
 } ITEM;
 
@@ -110,8 +164,43 @@ private ITEM *item_addr[MAXITEM];
 #define hget_tree(tno) (tree_addr[tno])
 #define hget_item(tno) (item_addr[tno])
 
-private int header_ok,expansion[MAXTYPES],align_size[MAXTYPES];
-private char align_buf[BUFSIZE];
+/* Distinct data-sets may be used from different threads at once: the
+   address tables (and the item list of tree 0) only change under
+   table_lock, and header_ok and align_buf belong to the calling thread. */
+
+private pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER;
+private pthread_once_t init_once = PTHREAD_ONCE_INIT;
+#define HINIT pthread_once(&init_once,hinit_c)
+
+/* The size of the i/o buffers of items opened from now on: BUFSIZE, or
+   the HIO_BUFSIZE environment variable, or as set by hbufsize_c. Large
+   buffers suit parallel file systems. */
+
+private size_t bufsize = BUFSIZE;
+
+/* Whether data sets opened "new" compress their items: see hcompress_c. */
+
+private int zip_on = FALSE;
+
+/* The counters of hcount_c: hcount holds those of miriad.h, and hcount_item
+   the bytes read and written of each item name seen while counting (names
+   are only added, under table_lock). */
+
+#define HC_MAXITEMS 32
+#define HC_NAMELEN 16
+int hcount_on = FALSE;
+long long hcount[HC_NCOUNT];
+private int hcount_nitem;
+private char hcount_name[HC_MAXITEMS][HC_NAMELEN];
+private long long hcount_item[HC_MAXITEMS][2];
+private Const char *hcount_label[HC_NCOUNT] = {
+  "dread_calls","dread_bytes","dwrite_calls","dwrite_bytes","uvread_calls",
+  "uvread_ns","records_read","records_skipped","unpack_ns","flags_ns",
+  "records_written"};
+
+private int expansion[MAXTYPES],align_size[MAXTYPES];
+private __thread int header_ok;
+private __thread char align_buf[BUFSIZE];
 private int first=TRUE;
 
 /* Macro to wait for I/O to complete. If its a synchronous i/o system,
@@ -137,10 +226,21 @@ static void hinit_c(void);
 static int hfind_nl(char *buf, int len);
 static void hcheckbuf_c(ITEM *item, off64_t next, int *iostat);
 static void hwrite_fill_c(ITEM *item, IOB *iob, int next, int *iostat);
+static void hpack_c(int type, char *in, char *out, size_t len);
 static void hcache_create_c(TREE *t, int *iostat);
 static void hcache_read_c(TREE *t, int *iostat);
 static int hname_check(char *name);
 static void hdir_c(ITEM *item);
+static int hmap_c(ITEM *item);
+static int hzname(Const char *name);
+static ZIP *hzalloc_c(size_t chunk,int ntab);
+static ZIP *hzopen_c(int fd,off64_t *size,int *iostat);
+static void hzfree_c(ZIP *z);
+static void hzget_c(int fd,ZIP *z,int k,char *out,size_t length,int *iostat);
+static void hzfill_c(ITEM *item,IOB *iob,off64_t offset,int dowrite,int *iostat);
+static void hzwrite_c(ITEM *item,IOB *iob,int *iostat);
+static void hzclose_c(ITEM *item,int *iostat);
+static void hzinflate_c(char *path,int *iostat);
 static void hrelease_item_c(ITEM *item);
 static ITEM *hcreate_item_c(TREE *tree, char *name);
 static TREE *hcreate_tree_c(char *name);
@@ -180,7 +280,7 @@ void hopen_c(int *tno,Const char *name,Const char *status,int *iostat)
 
 /* Initialise if its the first time through. */
 
-  if(first)hinit_c();
+  HINIT;
 
 /* Find a spare slot, and set the name etc. */
 
@@ -197,6 +297,9 @@ void hopen_c(int *tno,Const char *name,Const char *status,int *iostat)
     dmkdir_c(path,iostat);
     if(!*iostat)hcache_create_c(t,iostat);
     t->flags |= TREE_NEW;
+    pthread_mutex_lock(&table_lock);
+    if(zip_on) t->flags |= TREE_ZIP;
+    pthread_mutex_unlock(&table_lock);
     t->rdwr = RDWR_RDWR;
   } else *iostat = -1;
 
@@ -214,6 +317,8 @@ private void hinit_c()
 ------------------------------------------------------------------------*/
 {
   int i;
+  long n;
+  char *s;
 
   nitem = 0;
   ntree = 1;
@@ -241,8 +346,164 @@ private void hinit_c()
   align_size[H_DBLE] = H_DBLE_SIZE;
   align_size[H_CMPLX] =H_REAL_SIZE;
   align_size[H_TXT]  = 1;
+
+  if((s = getenv("HIO_BUFSIZE")) != NULL && (n = atol(s)) > 0)
+    bufsize = mroundup(max((size_t)n,BUFSIZE),BUFALIGN);
+  if((s = getenv("HIO_COMPRESS")) != NULL && atol(s) > 0) zip_on = TRUE;
   first = FALSE;
-  header_ok = FALSE;
+}
+/************************************************************************/
+size_t hbufsize_c(size_t size)
+/**hbufsize -- Set the size of item i/o buffers.			*/
+/*:low-level-i/o							*/
+/*+									*/
+/*
+  This sets the size (in bytes) of the i/o buffers given to items opened
+  from now on; items already open keep theirs. Sizes below the default
+  (BUFSIZE) are raised to it.
+
+  Input:
+    size	The new buffer size, or 0 to leave it unchanged.
+  Output:
+    hbufsize	The previous buffer size.				*/
+/*--									*/
+/*----------------------------------------------------------------------*/
+{
+  size_t old;
+
+  HINIT;
+  pthread_mutex_lock(&table_lock);
+  old = bufsize;
+  if(size > 0) bufsize = mroundup(max(size,BUFSIZE),BUFALIGN);
+  pthread_mutex_unlock(&table_lock);
+  return(old);
+}
+/************************************************************************/
+int hcompress_c(int enable)
+/**hcompress -- Switch compression of new items on or off.		*/
+/*:low-level-i/o							*/
+/*+									*/
+/*
+  While switched on, the visdata, flags and wflags items written into
+  data sets opened "new" from now on are compressed (losslessly, in
+  chunks that can be read independently). Reading compressed items needs
+  nothing: they are recognised whatever the switch.
+
+  Input:
+    enable	1 to compress, 0 not to, or -1 to leave it unchanged.
+  Output:
+    hcompress	The previous setting.					*/
+/*--									*/
+/*----------------------------------------------------------------------*/
+{
+  int old;
+
+  HINIT;
+  pthread_mutex_lock(&table_lock);
+  old = zip_on;
+  if(enable >= 0) zip_on = (enable ? TRUE : FALSE);
+  pthread_mutex_unlock(&table_lock);
+  return(old);
+}
+/************************************************************************/
+void hcount_c(int enable)
+/**hcount -- Switch the i/o and decoding counters on or off.		*/
+/*:low-level-i/o							*/
+/*+									*/
+/*
+  While switched on, the routines of hio, dio and uvio count their calls,
+  bytes moved and time taken (see hcount_get_c); while off, counting costs
+  a test of a flag. Bytes are counted per item for the items opened while
+  counting is on.
+
+  Input:
+    enable	Nonzero to count, zero to stop.				*/
+/*--									*/
+/*----------------------------------------------------------------------*/
+{
+  __atomic_store_n(&hcount_on,enable ? TRUE : FALSE,__ATOMIC_RELAXED);
+}
+/************************************************************************/
+void hcount_reset_c(void)
+/**hcount_reset -- Zero the i/o and decoding counters.			*/
+/*:low-level-i/o							*/
+/*+									*/
+/*
+  This zeroes all counters, keeping the item names seen so far.		*/
+/*--									*/
+/*----------------------------------------------------------------------*/
+{
+  int i;
+
+  for(i=0; i < HC_NCOUNT; i++)
+    __atomic_store_n(&hcount[i],0,__ATOMIC_RELAXED);
+  for(i=0; i < HC_MAXITEMS; i++){
+    __atomic_store_n(&hcount_item[i][0],0,__ATOMIC_RELAXED);
+    __atomic_store_n(&hcount_item[i][1],0,__ATOMIC_RELAXED);
+  }
+}
+/************************************************************************/
+int hcount_get_c(int i,char *name,size_t length,long long *value)
+/**hcount_get -- Return a counter by index.				*/
+/*:low-level-i/o							*/
+/*+									*/
+/*
+  Counters are numbered from 0: first those of all data sets (calls, bytes,
+  records and nanoseconds of dread, dwrite and uvread), then the bytes read
+  and written of each item, named "item.<name>.read_bytes" and
+  "item.<name>.write_bytes".
+
+  Input:
+    i		The index of the counter.
+    length	The size of name.
+  Output:
+    name	The name of the counter.
+    value	Its value.
+    hcount_get	1 for a counter, 0 past the last of them.		*/
+/*--									*/
+/*----------------------------------------------------------------------*/
+{
+  int k;
+
+  if(i < 0) return(0);
+  if(i < HC_NCOUNT){
+    snprintf(name,length,"%s",hcount_label[i]);
+    *value = __atomic_load_n(&hcount[i],__ATOMIC_RELAXED);
+    return(1);
+  }
+  k = (i - HC_NCOUNT) / 2;
+  if(k >= __atomic_load_n(&hcount_nitem,__ATOMIC_ACQUIRE)) return(0);
+  snprintf(name,length,"item.%s.%s_bytes",hcount_name[k],
+    (i - HC_NCOUNT) % 2 ? "write" : "read");
+  *value = __atomic_load_n(&hcount_item[k][(i - HC_NCOUNT) % 2],__ATOMIC_RELAXED);
+  return(1);
+}
+/************************************************************************/
+long long hcount_clock(void)
+/*
+  A monotonic clock in nanoseconds for the timing counters, or 0 when
+  counting is off.
+------------------------------------------------------------------------*/
+{
+  struct timespec ts;
+
+  if(!hcount_on) return(0);
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return((long long)ts.tv_sec * 1000000000LL + ts.tv_nsec);
+}
+/************************************************************************/
+private size_t hbufsize(ITEM *item)
+/*
+  The buffer size for a newly opened item.
+------------------------------------------------------------------------*/
+{
+  size_t n;
+
+  pthread_mutex_lock(&table_lock);
+  n = bufsize;
+  pthread_mutex_unlock(&table_lock);
+  if(item->flags & ITEM_STREAM) n = max(n,STREAM_BUFSIZE);
+  return(n);
 }
 /************************************************************************/
 void hflush_c(int tno,int *iostat)
@@ -280,7 +541,8 @@ void hflush_c(int tno,int *iostat)
 	if(item->io[i].state == IO_MODIFIED){
 	  WAIT(item,iostat);
 	  if(*iostat)return;
-	  dwrite_c( item->fd, item->io[i].buf, item->io[i].offset,
+	  if(item->zip != NULL) hzwrite_c(item,&(item->io[i]),iostat);
+	  else dwrite_c( item->fd, item->io[i].buf, item->io[i].offset,
 				     item->io[i].length, iostat);
 	  if(*iostat)return;
 	  item->io[i].state = IO_ACTIVE;
@@ -471,10 +733,12 @@ void hclose_c(int tno)
     hrelease_item_c(it1);
     it1 = it2;
   }
+  pthread_mutex_lock(&table_lock);
   tree_addr[tno] = NULL;
+  ntree--;
+  pthread_mutex_unlock(&table_lock);
   free(t->name);
   free((char *)t);
-  ntree--;
 }
 /************************************************************************/
 void hdelete_c(int tno,Const char *keyword,int *iostat)
@@ -505,7 +769,7 @@ void hdelete_c(int tno,Const char *keyword,int *iostat)
   TREE *t;
   int ent_del;
 
-  if(first)hinit_c();
+  HINIT;
 
   if(tno != 0) if( (*iostat = hname_check((char *)keyword)) ) return;
 
@@ -573,7 +837,7 @@ void haccess_c(int tno,int *ihandle,Const char *keyword,Const char *status,int *
   int mode=0;
   char string[3];
 
-  if(first)hinit_c();
+  HINIT;
 
   if(!strcmp("read",status))	    mode = ITEM_READ;
   else if(!strcmp("write",status))  mode = ITEM_WRITE;
@@ -618,6 +882,10 @@ void haccess_c(int tno,int *ihandle,Const char *keyword,Const char *status,int *
   if(item->flags & ACCESS_MODE) 
     bugv_c('f',"haccess_c: Multiple access to item %s",keyword);  
   item->flags |= mode;
+  if(mode == ITEM_WRITE && (t->flags & TREE_NEW)){
+    item->flags |= ITEM_STREAM;
+    if((t->flags & TREE_ZIP) && hzname(keyword)) item->flags |= ITEM_ZIP;
+  }
 
 /* Open the file if necessary. */
 
@@ -629,11 +897,20 @@ void haccess_c(int tno,int *ihandle,Const char *keyword,Const char *status,int *
     			    && !(item->flags & ITEM_CACHE)){
     Strcpy(path,t->name);
     Strcat(path,keyword);
-    dopen_c(&(item->fd),path,(char *)status,&(item->size),iostat);
-
-    item->bsize = BUFSIZE;
-    item->io[0].buf = Malloc(BUFSIZE);
-    if(BUFDBUFF)item->io[1].buf = Malloc(BUFSIZE);
+    if((mode & ITEM_APPEND) && hzname(keyword)) hzinflate_c(path,iostat);
+    if(!*iostat) dopen_c(&(item->fd),path,(char *)status,&(item->size),iostat);
+    if(!*iostat && mode == ITEM_READ && hzname(keyword))
+      item->zip = hzopen_c(item->fd,&(item->size),iostat);
+
+    if(item->zip != NULL){
+      item->bsize = item->zip->chunk;
+      item->io[0].buf = Malloc(item->bsize);
+      if(BUFDBUFF)item->io[1].buf = Malloc(item->bsize);
+    } else if(*iostat || mode != ITEM_READ || !hmap_c(item)){
+      item->bsize = hbufsize(item);
+      item->io[0].buf = Malloc(item->bsize);
+      if(BUFDBUFF)item->io[1].buf = Malloc(item->bsize);
+    }
     if(mode & ITEM_APPEND) item->offset = item->size;
 
 /* If we have opened a file in write mode, remember that this dataset is
@@ -649,6 +926,362 @@ void haccess_c(int tno,int *ihandle,Const char *keyword,Const char *status,int *
   if(*iostat)hrelease_item_c(item);
 }
 /************************************************************************/
+private int hmap_c(ITEM *item)
+/*
+  Map a large item opened for reading, making its first i/o buffer the
+  whole file. Returns FALSE (and leaves the item alone) if it is small or
+  cannot be mapped.
+------------------------------------------------------------------------*/
+{
+#ifdef HIO_NOMMAP
+  return FALSE;
+#else
+  void *p;
+
+  if(item->size < MAP_MIN || (off64_t)(size_t)item->size != item->size)
+    return FALSE;
+  p = mmap(NULL,(size_t)item->size,PROT_READ,MAP_SHARED,item->fd,0);
+  if(p == MAP_FAILED) return FALSE;
+#ifdef MADV_SEQUENTIAL
+  madvise(p,(size_t)item->size,MADV_SEQUENTIAL);
+#endif
+  item->flags |= ITEM_MAPPED;
+  item->bsize = (size_t)item->size;
+  item->io[0].buf = (char *)p;
+  item->io[0].offset = 0;
+  item->io[0].length = (size_t)item->size;
+  item->io[0].state = IO_VALID;
+  return TRUE;
+#endif
+}
+/************************************************************************/
+private int hzname(Const char *name)
+/*
+  Whether an item of this name may be compressed.
+------------------------------------------------------------------------*/
+{
+  return(!strcmp(name,"visdata") || !strcmp(name,"flags") ||
+	 !strcmp(name,"wflags"));
+}
+/************************************************************************/
+private ZIP *hzalloc_c(size_t chunk,int ntab)
+/*
+  Allocate the chunk descriptor of a compressed item, with room in its
+  table for ntab offsets.
+------------------------------------------------------------------------*/
+{
+  ZIP *z;
+
+  z = (ZIP *)Malloc(sizeof(ZIP));
+  z->chunk = chunk;
+  z->nchunk = 0;
+  z->ntab = ntab;
+  z->ahead = -1;
+  z->pending = FALSE;
+  z->tail = 0;
+  z->tab = (off64_t *)Malloc(ntab*sizeof(off64_t));
+  z->tab[0] = ZIP_HDR;
+  z->end = ZIP_HDR;
+  z->size = 0;
+  z->nnext = z->lnext = 0;
+  z->buf = Malloc(HZ_BOUND(chunk));
+  z->next = Malloc(HZ_BOUND(chunk));
+  z->work = Malloc(chunk);
+  z->dec = NULL;
+  z->awork = NULL;
+  return(z);
+}
+/************************************************************************/
+private void hzfree_c(ZIP *z)
+/*
+  Release the chunk descriptor of a compressed item.
+------------------------------------------------------------------------*/
+{
+  free(z->tab);
+  free(z->buf);
+  free(z->next);
+  free(z->work);
+  if(z->dec != NULL) free(z->dec);
+  if(z->awork != NULL) free(z->awork);
+  free((char *)z);
+}
+/************************************************************************/
+private ZIP *hzopen_c(int fd,off64_t *size,int *iostat)
+/*
+  Check whether a file just opened for reading holds a compressed item. If
+  so, read its table, and return its descriptor and the size of the item
+  (in place of that of the file). Otherwise return NULL.
+------------------------------------------------------------------------*/
+{
+  char hdr[ZIP_HDR],tail[ZIP_TAIL],*s;
+  int8 v[2];
+  off64_t taboff;
+  int i,n;
+  ZIP *z;
+
+  *iostat = 0;
+  if(*size < ZIP_HDR + ZIP_TAIL) return(NULL);
+  dread_c(fd,hdr,0,ZIP_HDR,iostat);
+  if(!*iostat) dwait_c(fd,iostat);
+  if(*iostat || memcmp(hdr,ZIP_MAGIC,8)) return(NULL);
+  dread_c(fd,tail,*size-ZIP_TAIL,ZIP_TAIL,iostat);
+  if(!*iostat) dwait_c(fd,iostat);
+  if(*iostat) return(NULL);
+
+/* Check the trailer and the table. */
+
+  *iostat = EIO;
+  if(memcmp(tail+16,ZIP_MAGIC,8)) return(NULL);
+  unpack64_c(hdr+8,v,1);
+  if(v[0] <= 0 || v[0] > (1 << 30)) return(NULL);
+  z = hzalloc_c((size_t)v[0],1);
+  unpack64_c(tail,v,2);
+  taboff = v[0];
+  n = (v[1] + z->chunk - 1) / z->chunk;
+  if(v[1] < 0 || taboff < ZIP_HDR ||
+     taboff + 8*(off64_t)(n+1) > *size - ZIP_TAIL){
+    hzfree_c(z);
+    return(NULL);
+  }
+  *size = z->size = v[1];
+  z->dec = Malloc(z->chunk);
+  z->awork = Malloc(z->chunk);
+  s = Malloc(8*(n+1));
+  free(z->tab);
+  z->tab = (off64_t *)Malloc((n+1)*sizeof(off64_t));
+  z->nchunk = z->ntab = n;
+  dread_c(fd,s,taboff,8*(n+1),iostat);
+  if(!*iostat) dwait_c(fd,iostat);
+  for(i=0; i <= n && !*iostat; i++){
+    unpack64_c(s+8*i,v,1);
+    z->tab[i] = v[0];
+    if(i == 0 ? v[0] != ZIP_HDR : v[0] < z->tab[i-1] || v[0] > taboff ||
+		v[0] - z->tab[i-1] > HZ_BOUND(z->chunk)) *iostat = EIO;
+  }
+  free(s);
+  if(*iostat){
+    hzfree_c(z);
+    return(NULL);
+  }
+  return(z);
+}
+/************************************************************************/
+private int hzahead_c(void *arg)
+/*
+  Decode the chunk read ahead. This runs on the dio thread, once the read
+  is done.
+------------------------------------------------------------------------*/
+{
+  ZIP *z;
+
+  z = (ZIP *)arg;
+  return(hzdecode_c(z->next,z->nnext,z->dec,z->lnext,z->awork) ? EIO : 0);
+}
+/************************************************************************/
+private void hzget_c(int fd,ZIP *z,int k,char *out,size_t length,int *iostat)
+/*
+  Read and decode chunk k of a compressed item, of length bytes, starting
+  the read and decoding of the next one in the background. If chunk k was
+  decoded ahead, it is just copied out.
+------------------------------------------------------------------------*/
+{
+  char *s;
+  size_t n;
+  int stat,decoded;
+
+  n = z->tab[k+1] - z->tab[k];
+  decoded = FALSE;
+  if(z->ahead == k){
+    dwait_c(fd,iostat);
+    if(!*iostat && length == z->lnext){
+      memcpy(out,z->dec,length);
+      decoded = TRUE;
+    } else {
+      s = z->buf;
+      z->buf = z->next;
+      z->next = s;
+    }
+  } else {
+    if(z->ahead >= 0) dwait_c(fd,&stat);
+    dread_c(fd,z->buf,z->tab[k],n,iostat);
+    if(!*iostat) dwait_c(fd,iostat);
+  }
+  z->ahead = -1;
+  if(*iostat) return;
+  if(k+1 < z->nchunk){
+    z->nnext = z->tab[k+2] - z->tab[k+1];
+    z->lnext = min(z->chunk,z->size - (off64_t)(k+1) * z->chunk);
+    dreadf_c(fd,z->next,z->tab[k+1],z->nnext,hzahead_c,(void *)z,&stat);
+    if(!stat) z->ahead = k+1;
+  }
+  if(!decoded && hzdecode_c(z->buf,n,out,length,z->work)) *iostat = EIO;
+}
+/************************************************************************/
+private void hzfill_c(ITEM *item,IOB *iob,off64_t offset,int dowrite,int *iostat)
+/*
+  Make the i/o buffer of a compressed item hold the chunk that includes
+  offset: decode it if the item is being read, or start it afresh if
+  the item is being written and this is the next one.
+------------------------------------------------------------------------*/
+{
+  ZIP *z;
+  int k;
+
+  z = item->zip;
+  k = offset / z->chunk;
+  *iostat = 0;
+
+/* A writer can only move on to the next chunk, padding the last one
+   out if a write skipped over its end. */
+
+  if(!(item->flags & ITEM_READ)){
+    if(!dowrite || k != z->nchunk){
+      *iostat = ESPIPE;
+      return;
+    }
+    if(k > 0 && z->tail < z->chunk){
+      if(iob->offset != (off64_t)(k-1) * z->chunk){
+	*iostat = ESPIPE;
+	return;
+      }
+      memset(iob->buf+iob->length,0,z->chunk-iob->length);
+      iob->length = z->chunk;
+      hzwrite_c(item,iob,iostat);			if(*iostat) return;
+    }
+    iob->offset = (off64_t)k * z->chunk;
+    iob->length = 0;
+    iob->state = IO_VALID;
+    return;
+  }
+
+  iob->offset = (off64_t)k * z->chunk;
+  iob->length = min(z->chunk,item->size - iob->offset);
+  iob->state = IO_VALID;
+  hzget_c(item->fd,z,k,iob->buf,iob->length,iostat);
+  if(*iostat) iob->length = 0;
+}
+/************************************************************************/
+private void hzwrite_c(ITEM *item,IOB *iob,int *iostat)
+/*
+  Code and write the i/o buffer of a compressed item, as the chunk that
+  it holds. Only the last chunk written may be written again.
+------------------------------------------------------------------------*/
+{
+  ZIP *z;
+  size_t n;
+  int k;
+
+  z = item->zip;
+  k = iob->offset / z->chunk;
+  if(iob->offset % z->chunk || k < z->nchunk - 1 || k > z->nchunk){
+    *iostat = ESPIPE;
+    return;
+  }
+  if(k + 2 > z->ntab){
+    z->ntab = max(2*z->ntab,k+2);
+    z->tab = (off64_t *)Realloc(z->tab,z->ntab*sizeof(off64_t));
+  }
+
+/* The last chunk written has long since gone, but collect its status
+   before reusing its buffer. */
+
+  if(z->pending){
+    z->pending = FALSE;
+    dwait_c(item->fd,iostat);				if(*iostat) return;
+  }
+  n = hzencode_c(iob->buf,iob->length,ZIP_WIDTH,z->buf,z->work);
+  z->nchunk = k + 1;
+  z->tail = iob->length;
+  z->tab[k+1] = z->tab[k] + n;
+  z->end = max(z->end,z->tab[k+1]);
+  dwrite_c(item->fd,z->buf,z->tab[k],n,iostat);
+  z->pending = (*iostat == 0);
+}
+/************************************************************************/
+private void hzclose_c(ITEM *item,int *iostat)
+/*
+  Finish with a compressed item, whose buffers have been flushed. Once it
+  has been written, add its header, table and trailer (the trailer going
+  at the very end, past anything left from a longer last chunk).
+------------------------------------------------------------------------*/
+{
+  ZIP *z;
+  char *s;
+  int8 v[2];
+  off64_t t;
+  int i,n,stat;
+
+  z = item->zip;
+  *iostat = 0;
+  if(z->pending) dwait_c(item->fd,iostat);
+  else if(z->ahead >= 0) dwait_c(item->fd,&stat);
+  z->pending = FALSE;
+  z->ahead = -1;
+  if((item->flags & ITEM_READ) || *iostat) return;
+
+  n = z->nchunk + 1;
+  s = Malloc(8*n+ZIP_TAIL);
+  t = max(z->tab[z->nchunk] + 8*n,z->end - ZIP_TAIL);
+  for(i=0; i < n; i++){
+    v[0] = z->tab[i];
+    pack64_c(v,s+8*i,1);
+  }
+  dwrite_c(item->fd,s,z->tab[z->nchunk],8*n,iostat);
+  if(!*iostat) dwait_c(item->fd,iostat);
+  v[0] = z->tab[z->nchunk];
+  v[1] = item->size;
+  pack64_c(v,s,2);
+  Memcpy(s+16,ZIP_MAGIC,8);
+  if(!*iostat) dwrite_c(item->fd,s,t,ZIP_TAIL,iostat);
+  if(!*iostat) dwait_c(item->fd,iostat);
+  Memcpy(s,ZIP_MAGIC,8);
+  v[0] = z->chunk;
+  pack64_c(v,s+8,1);
+  if(!*iostat) dwrite_c(item->fd,s,0,ZIP_HDR,iostat);
+  if(!*iostat) dwait_c(item->fd,iostat);
+  free(s);
+}
+/************************************************************************/
+private void hzinflate_c(char *path,int *iostat)
+/*
+  If the file of an item is compressed, replace it with the item as is.
+------------------------------------------------------------------------*/
+{
+  char tpath[MAXPATH],*s;
+  off64_t size,tsize;
+  size_t len;
+  int fd,out,k,stat;
+  ZIP *z;
+
+  *iostat = 0;
+  dopen_c(&fd,path,"read",&size,&stat);
+  if(stat) return;
+  z = hzopen_c(fd,&size,iostat);
+  if(z != NULL && strlen(path) + 2 > MAXPATH) *iostat = ENAMETOOLONG;
+  if(z != NULL && !*iostat){
+    Strcpy(tpath,path);
+    Strcat(tpath,"~");
+    dopen_c(&out,tpath,"write",&tsize,iostat);
+    if(!*iostat){
+      s = Malloc(z->chunk);
+      for(k=0; k < z->nchunk && !*iostat; k++){
+	len = min(z->chunk,size - (off64_t)k * z->chunk);
+	hzget_c(fd,z,k,s,len,iostat);
+	if(!*iostat) dwrite_c(out,s,(off64_t)k * z->chunk,len,iostat);
+	if(!*iostat) dwait_c(out,iostat);
+      }
+      free(s);
+      if(z->ahead >= 0) dwait_c(fd,&stat);
+      dclose_c(out,&stat);
+      if(!*iostat) *iostat = stat;
+      if(!*iostat) drename_c(tpath,path,iostat);
+      else ddelete_c(tpath,&stat);
+    }
+  }
+  if(z != NULL) hzfree_c(z);
+  dclose_c(fd,&stat);
+}
+/************************************************************************/
 void hmode_c(int tno,char *mode)
 /*									*/
 /**hmode -- Return access modes of a dataset.				*/
@@ -793,7 +1426,8 @@ void hdaccess_c(int ihandle,int *iostat)
     for(i=0; i<2 && !stat; i++){
       if(item->io[i].state == IO_MODIFIED && !(item->flags & ITEM_SCRATCH)){
 	WAIT(item,&stat);
-	if(!stat)dwrite_c( item->fd, item->io[i].buf, item->io[i].offset,
+	if(!stat && item->zip != NULL) hzwrite_c(item,&(item->io[i]),&stat);
+	else if(!stat)dwrite_c( item->fd, item->io[i].buf, item->io[i].offset,
 				     item->io[i].length, &stat);
 	item->io[i].state = IO_ACTIVE;
       }
@@ -801,6 +1435,10 @@ void hdaccess_c(int ihandle,int *iostat)
     *iostat = stat;
     WAIT(item,&stat);
     if(stat) *iostat = stat;
+    if(item->zip != NULL){
+      hzclose_c(item,&stat);
+      if(stat && !*iostat) *iostat = stat;
+    }
     dclose_c(item->fd,&stat);
     if(stat) *iostat = stat;
     hrelease_item_c(item);
@@ -812,7 +1450,7 @@ void hdaccess_c(int ihandle,int *iostat)
    as it will need to be written to the cache later on. */
 
   } else{
-    item->flags &= ~ACCESS_MODE;
+    item->flags &= ~(ACCESS_MODE|ITEM_STREAM|ITEM_ZIP);
     if(item->io[0].state == IO_MODIFIED)item->tree->flags |= TREE_CACHEMOD;
     item->io[0].state = IO_VALID;
   }
@@ -934,8 +1572,34 @@ void hio_c(int ihandle,int dowrite,int type,char *buf,
   ITEM *item;
 
   item = hget_item(ihandle);
+  if(hcount_on && item->count >= 0)
+    __atomic_fetch_add(&hcount_item[item->count][dowrite ? 1 : 0],
+                       (long long)length,__ATOMIC_RELAXED);
   size = align_size[type];
 
+/* Mapped items, and compressed ones opened for reading, are read-only. */
+
+  if(dowrite && ((item->flags & ITEM_MAPPED) ||
+		 (item->zip != NULL && (item->flags & ITEM_READ)))){
+    *iostat = EBADF;
+    return;
+  }
+
+/* Appends to a streamed item that fit in the buffer being filled. */
+
+  iob1 = &(item->io[item->last]);
+  if(dowrite && (item->flags & ITEM_STREAM) && type != H_TXT &&
+     offset == item->size && iob1->state == IO_MODIFIED &&
+     offset == iob1->offset + (off64_t) iob1->length &&
+     iob1->length + length <= item->bsize && iob1->length % size == 0){
+    hpack_c(type,buf,iob1->buf + iob1->length,length);
+    iob1->length += length;
+    item->size += length;
+    item->offset = item->size;
+    *iostat = 0;
+    return;
+  }
+
 /* Check various end-of-file conditions and for adequate buffers. */
 
   next = offset + (off64_t) (!dowrite && type == H_TXT ? 1 : length );
@@ -943,7 +1607,7 @@ void hio_c(int ihandle,int dowrite,int type,char *buf,
   *iostat = -1;
   if(!dowrite && next > item->size)return;
   *iostat = 0;
-  if(item->bsize < BUFSIZE && item->bsize < next)hcheckbuf_c(item,next,iostat);
+  if(item->bsize <= CACHESIZE && item->bsize < next)hcheckbuf_c(item,next,iostat);
   if(*iostat)return;
 
 /*----------------------------------------------------------------------*/
@@ -976,21 +1640,26 @@ void hio_c(int ihandle,int dowrite,int type,char *buf,
     if(!WITHIN_BUF(b)){
       if(iob1->state == IO_MODIFIED){
 	next = iob1->offset + iob1->length;
-        if(iob1->length%BUFALIGN && next < item->size)
+        if(iob1->length%BUFALIGN && next < item->size && item->zip == NULL)
 	  {hwrite_fill_c(item,iob1,next,iostat);	if(*iostat) return;}
         WAIT(item,iostat);				if(*iostat) return;
-        dwrite_c(item->fd,iob1->buf,iob1->offset,iob1->length,iostat);
+        if(item->zip != NULL) hzwrite_c(item,iob1,iostat);
+        else dwrite_c(item->fd,iob1->buf,iob1->offset,iob1->length,iostat);
         iob1->state = IO_ACTIVE;			if(*iostat) return;
       }
-      iob1->offset = (offset/BUFALIGN) * BUFALIGN;
-      iob1->length = 0;
-      if(!dowrite){
-        WAIT(item,iostat);				if(*iostat) return;
-        iob1->length = min(item->bsize,item->size-iob1->offset);
-	if(iob2->buf != NULL && iob1->offset < iob2->offset)
-	  iob1->length = min(iob1->length, iob2->offset - iob1->offset);
-	dread_c(item->fd,iob1->buf,iob1->offset,iob1->length,iostat);
-	iob1->state = IO_ACTIVE;			if(*iostat) return;
+      if(item->zip != NULL){
+        hzfill_c(item,iob1,offset,dowrite,iostat);	if(*iostat) return;
+      } else {
+	iob1->offset = (offset/BUFALIGN) * BUFALIGN;
+	iob1->length = 0;
+	if(!dowrite){
+	  WAIT(item,iostat);				if(*iostat) return;
+	  iob1->length = min(item->bsize,item->size-iob1->offset);
+	  if(iob2->buf != NULL && iob1->offset < iob2->offset)
+	    iob1->length = min(iob1->length, iob2->offset - iob1->offset);
+	  dread_c(item->fd,iob1->buf,iob1->offset,iob1->length,iostat);
+	  iob1->state = IO_ACTIVE;			if(*iostat) return;
+	}
       }
     }
 
@@ -1008,7 +1677,7 @@ void hio_c(int ihandle,int dowrite,int type,char *buf,
     if(iob1->state == IO_ACTIVE)
       {WAIT(item,iostat);				if(*iostat)return;}
 
-    if(iob2->buf != NULL && iob2->state != IO_ACTIVE){
+    if(iob2->buf != NULL && iob2->state != IO_ACTIVE && item->zip == NULL){
       next = iob1->offset + iob1->length;
 
 /* Write behind. */
@@ -1020,7 +1689,7 @@ void hio_c(int ihandle,int dowrite,int type,char *buf,
 /* Read ahead. */
       } else if(!dowrite && next < item->size && next != iob2->offset){
         iob2->offset = next;
-        iob2->length = min( BUFSIZE, item->size - iob2->offset );
+        iob2->length = min( item->bsize, item->size - iob2->offset );
         dread_c (item->fd,iob2->buf,iob2->offset,iob2->length,iostat);
         iob2->state = IO_ACTIVE;
       }
@@ -1036,8 +1705,10 @@ void hio_c(int ihandle,int dowrite,int type,char *buf,
 
     if(dowrite){
       if(iob1->offset + iob1->length < offset &&
-         iob1->offset + iob1->length < item->size)
-	  {hwrite_fill_c(item,iob1,offset,iostat);	if(*iostat) return;}
+         iob1->offset + iob1->length < item->size){
+	if(item->zip != NULL){ *iostat = ESPIPE; return; }
+	hwrite_fill_c(item,iob1,offset,iostat);		if(*iostat) return;
+      }
       iob1->state = IO_MODIFIED;
       iob1->length = max(iob1->length,
 			 min(length + offset - iob1->offset, item->bsize));
@@ -1052,28 +1723,13 @@ void hio_c(int ihandle,int dowrite,int type,char *buf,
 
     off  = offset - iob1->offset;
     len = min(length, iob1->length - off);
+    if(off % size) len = min(len, BUFSIZE);	/* A mapped buffer can be bigger */
     s = ( ( off % size ) ? align_buf : iob1->buf + off );
     if(dowrite){
-      switch(type){
-        case H_BYTE: 	Memcpy(s,buf,len);
-			break;
-        case H_INT:  	pack32_c((int *)buf, s,len/H_INT_SIZE);
-			break;
-        case H_INT2:	pack16_c((int2 *)buf,s,len/H_INT2_SIZE);
-			break;
-        case H_INT8:	pack64_c((int8 *)buf,s,len/H_INT8_SIZE);
-			break;
-        case H_REAL:	packr_c((float *)buf,s,len/H_REAL_SIZE);
-			break;
-        case H_DBLE:	packd_c((double *)buf,s,len/H_DBLE_SIZE);
-			break;
-        case H_CMPLX:	packr_c((float *)buf,s,(2*len)/H_CMPLX_SIZE);
-			break;
-        case H_TXT:	Memcpy(s,buf,len);
-			if(*(buf+len-1) == 0)*(iob1->buf+off+len-1) = '\n';
-			break;
-        default:	bugv_c('f',"hio_c: Unrecognised write type %d",type);
-      }
+      if(type == H_TXT){
+	Memcpy(s,buf,len);
+	if(*(buf+len-1) == 0)*(iob1->buf+off+len-1) = '\n';
+      } else hpack_c(type,buf,s,len);
       if(off % size) Memcpy(iob1->buf+off,align_buf,len);
     } else {
 
@@ -1116,6 +1772,31 @@ void hio_c(int ihandle,int dowrite,int type,char *buf,
   }
 }
 /************************************************************************/
+private void hpack_c(int type,char *in,char *out,size_t len)
+/*
+  Convert len bytes' worth of elements of the given type to their external
+  form, for any type but H_TXT.
+------------------------------------------------------------------------*/
+{
+  switch(type){
+    case H_BYTE: 	Memcpy(out,in,len);
+			break;
+    case H_INT:  	pack32_c((int *)in,out,len/H_INT_SIZE);
+			break;
+    case H_INT2:	pack16_c((int2 *)in,out,len/H_INT2_SIZE);
+			break;
+    case H_INT8:	pack64_c((int8 *)in,out,len/H_INT8_SIZE);
+			break;
+    case H_REAL:	packr_c((float *)in,out,len/H_REAL_SIZE);
+			break;
+    case H_DBLE:	packd_c((double *)in,out,len/H_DBLE_SIZE);
+			break;
+    case H_CMPLX:	packr_c((float *)in,out,(2*len)/H_CMPLX_SIZE);
+			break;
+    default:		bugv_c('f',"hio_c: Unrecognised write type %d",type);
+  }
+}
+/************************************************************************/
 private int hfind_nl(char *buf,int len)
 /*
   Return the character number of the first new-line character.
@@ -1148,12 +1829,13 @@ private void hcheckbuf_c(ITEM *item,off64_t next,int *iostat)
 /* Allocate full sized buffers if needed. */
 
   } else if(item->bsize <= CACHESIZE && next > CACHESIZE){
-    s = Malloc(BUFSIZE);
-    item->bsize = BUFSIZE;
+    item->bsize = hbufsize(item);
+    s = Malloc(item->bsize);
     if(item->io[0].length > 0)Memcpy(s,item->io[0].buf,item->io[0].length);
     if(item->io[0].buf != NULL) free(item->io[0].buf);
     item->io[0].buf = s;
-    if(BUFDBUFF)item->io[1].buf = Malloc(BUFSIZE);
+    if(item->flags & ITEM_ZIP) item->zip = hzalloc_c(item->bsize,64);
+    else if(BUFDBUFF)item->io[1].buf = Malloc(item->bsize);
   }
 
 /* Open a file if needed. */
@@ -1186,20 +1868,25 @@ private void hwrite_fill_c(ITEM *item,IOB *iob,int next,int *iostat)
     iostat	I/O status.
 ------------------------------------------------------------------------*/
 {
-  char buffer[BUFSIZE];
-  int offset,length;
+  char *buffer;
+  off64_t offset;
+  size_t length;
 
   offset = BUFALIGN * ((iob->offset + iob->length) / BUFALIGN);
   length = BUFALIGN * ((next-1)/BUFALIGN + 1) - offset;
-  length = min(length, item->size - offset);
+  length = (size_t)min((off64_t)length, item->size - offset);
 
   WAIT(item,iostat);					if(*iostat)return;
-  dread_c(item->fd,buffer,offset,length,iostat);	if(*iostat)return;
-  dwait_c(item->fd,iostat);				if(*iostat)return;
-  offset = iob->offset + iob->length - offset;
-  length -= offset;
-  Memcpy(iob->buf+iob->length,buffer+offset,length);
-  iob->length += length;
+  buffer = Malloc(length);
+  dread_c(item->fd,buffer,offset,length,iostat);
+  if(!*iostat) dwait_c(item->fd,iostat);
+  if(!*iostat){
+    offset = iob->offset + iob->length - offset;
+    length -= offset;
+    Memcpy(iob->buf+iob->length,buffer+offset,length);
+    iob->length += length;
+  }
+  free(buffer);
 }
 /************************************************************************/
 void hseek_c(int ihandle,off64_t offset)
@@ -1411,6 +2098,8 @@ private void hrelease_item_c(ITEM *item)
   ITEM *it1,*it2;
   TREE *t;
 
+  pthread_mutex_lock(&table_lock);
+
 /* Find the item. Less than attractive code. */
 
   t = item->tree;
@@ -1426,13 +2115,16 @@ private void hrelease_item_c(ITEM *item)
 
 /* Release any memory associated with the item. */
 
-  if(item->io[0].buf != NULL) free(item->io[0].buf);
+  if(item->flags & ITEM_MAPPED) munmap(item->io[0].buf,item->bsize);
+  else if(item->io[0].buf != NULL) free(item->io[0].buf);
   if(item->io[1].buf != NULL) free(item->io[1].buf);
+  if(item->zip != NULL) hzfree_c(item->zip);
 
   item_addr[item->handle] = NULL;
+  nitem--;
+  pthread_mutex_unlock(&table_lock);
   free(item->name);
   free((char *)item);
-  nitem--;
 }
 /************************************************************************/
 private ITEM *hcreate_item_c(TREE *tree,char *name)
@@ -1447,9 +2139,13 @@ private ITEM *hcreate_item_c(TREE *tree,char *name)
 /* Hash the name. */
 
   s = name;
+  pthread_mutex_lock(&table_lock);
   hash = nitem++;
-  if(nitem > MAXITEM)
-    bugv_c('f',"Item address table overflow, in hio; nitem=%d MAXITEM=%d",nitem,MAXITEM);
+  if(nitem > MAXITEM){
+    nitem--;
+    pthread_mutex_unlock(&table_lock);
+    bugv_c('f',"Item address table overflow, in hio; nitem=%d MAXITEM=%d",nitem+1,MAXITEM);
+  }
   while(*s) hash += *s++;
   hash %= MAXITEM;
 
@@ -1471,6 +2167,16 @@ private ITEM *hcreate_item_c(TREE *tree,char *name)
   item->offset = 0;
   item->bsize = 0;
   item->tree = tree;
+  item->count = -1;
+  item->zip = NULL;
+  if(hcount_on){
+    for(i=0; i < hcount_nitem && strncmp(hcount_name[i],name,HC_NAMELEN-1); i++);
+    if(i == hcount_nitem && i < HC_MAXITEMS){
+      strncpy(hcount_name[i],name,HC_NAMELEN-1);
+      __atomic_store_n(&hcount_nitem,i+1,__ATOMIC_RELEASE);
+    }
+    if(i < hcount_nitem) item->count = i;
+  }
   for(i=0; i<2; i++){
     item->io[i].offset = 0;
     item->io[i].length = 0;
@@ -1479,6 +2185,7 @@ private ITEM *hcreate_item_c(TREE *tree,char *name)
    }
   item->fwd = tree->itemlist;
   tree->itemlist = item;
+  pthread_mutex_unlock(&table_lock);
   return(item);
 }
 /************************************************************************/
@@ -1494,9 +2201,13 @@ private TREE *hcreate_tree_c(char *name)
 /* Hash the name. */
 
   s = name;
+  pthread_mutex_lock(&table_lock);
   hash = ntree++;
-  if(ntree > MAXOPEN)
-    bugv_c('f',"Tree address table overflow, in hio, ntree=%d MAXOPEN=%d",ntree,MAXOPEN);
+  if(ntree > MAXOPEN){
+    ntree--;
+    pthread_mutex_unlock(&table_lock);
+    bugv_c('f',"Tree address table overflow, in hio, ntree=%d MAXOPEN=%d",ntree+1,MAXOPEN);
+  }
   while(*s) hash += *s++;
   hash %= MAXOPEN;
 
@@ -1513,5 +2224,6 @@ private TREE *hcreate_tree_c(char *name)
   t->handle = hash;
   t->flags = 0;
   t->itemlist = NULL;
+  pthread_mutex_unlock(&table_lock);
   return t;
 }
@@ -0,0 +1,293 @@
+/************************************************************************/
+/*									*/
+/*  hzip -- Lossless compression of the chunks of compressed items.	*/
+/*									*/
+/*  A chunk is byte-shuffled (the first bytes of all its elements,	*/
+/*  then the second bytes, ...), which brings together the slowly	*/
+/*  varying high bytes of the big-endian integers and reals of		*/
+/*  visdata and flags, and then coded with a byte-oriented LZ77 coder	*/
+/*  in the style of LZ4: runs of literals and back references of at	*/
+/*  least HZ_MINMATCH bytes within the last 64 KB, with a single hash	*/
+/*  probe per position. That decodes at memory speed and packs fast	*/
+/*  enough to keep up with writing a data set.				*/
+/*									*/
+/*  A coded chunk starts with two bytes: the method (HZ_STORED or	*/
+/*  HZ_SHUFLZ) and the shuffle width, followed by the data as is or	*/
+/*  by the sequences of the coder. Each sequence is a token (the	*/
+/*  number of literals in its high nibble, the match length less	*/
+/*  HZ_MINMATCH in its low one, 15 meaning "add the bytes that		*/
+/*  follow, up to one that is not 255"), the literals, and a 2-byte	*/
+/*  little-endian match offset; the last sequence has no match.	*/
+/*									*/
+/*  History:								*/
+/*    14oct26  Original version.					*/
+/************************************************************************/
+
+#include <Python.h>
+#include <string.h>
+#include "sysdep.h"
+#include "miriad.h"
+
+#define private static
+
+#define HZ_STORED   0
+#define HZ_SHUFLZ   1
+#define HZ_MINMATCH 4
+#define HZ_LAST     12		/* No match starts this near the end. */
+#define HZ_HBITS    14
+#define HZ_WINDOW   65535
+
+typedef unsigned char uchar;
+
+private size_t hzlz_c(const uchar *in,size_t n,uchar *out);
+private int hzunlz_c(const uchar *in,size_t n,uchar *out,size_t nout);
+private uchar *hzlen_c(uchar *op,size_t len);
+
+/************************************************************************/
+private unsigned int hzread32(const uchar *p)
+{
+  unsigned int v;
+  memcpy(&v,p,4);
+  return(v);
+}
+/************************************************************************/
+private unsigned int hzhash(const uchar *p)
+{
+  return((hzread32(p) * 2654435761U) >> (32 - HZ_HBITS));
+}
+/************************************************************************/
+size_t hzencode_c(const char *in,size_t n,int width,char *out,char *work)
+/*
+  Code a chunk of n bytes of elements width bytes wide.
+
+  Input:
+    in		The chunk.
+    n		Its size in bytes.
+    width	The element size for the shuffle (1 for none).
+  Scratch:
+    work	At least n bytes.
+  Output:
+    out		The coded chunk, of at most HZ_BOUND(n) bytes.
+    hzencode	Its size.
+------------------------------------------------------------------------*/
+{
+  size_t i,j,m,len;
+  uchar *s;
+
+  width = (width < 1 || width > 16 ? 1 : width);
+  m = n / width;
+  s = (uchar *)work;
+  if(width == 1 || m == 0) s = (uchar *)in;
+  else {
+    for(j=0; j < (size_t)width; j++){
+      for(i=0; i < m; i++) s[j*m+i] = (uchar)in[i*width+j];
+    }
+    memcpy(s+m*width,in+m*width,n-m*width);
+  }
+
+  out[1] = (char)width;
+  len = hzlz_c(s,n,(uchar *)out+2);
+  if(len < n){
+    out[0] = HZ_SHUFLZ;
+    return(len+2);
+  }
+  out[0] = HZ_STORED;
+  memcpy(out+2,in,n);
+  return(n+2);
+}
+/************************************************************************/
+int hzdecode_c(const char *in,size_t n,char *out,size_t nout,char *work)
+/*
+  Decode a chunk coded by hzencode_c.
+
+  Input:
+    in		The coded chunk.
+    n		Its size.
+    nout	The size of the chunk.
+  Scratch:
+    work	At least nout bytes.
+  Output:
+    out		The chunk.
+    hzdecode	0 on success, -1 if the chunk is corrupt.
+------------------------------------------------------------------------*/
+{
+  size_t i,j,m;
+  int width;
+  uchar *s;
+
+  if(n < 2) return(-1);
+  width = (uchar)in[1];
+  if(in[0] == HZ_STORED){
+    if(n - 2 != nout) return(-1);
+    memcpy(out,in+2,nout);
+    return(0);
+  }
+  if(in[0] != HZ_SHUFLZ || width < 1 || width > 16) return(-1);
+  m = nout / width;
+  s = (uchar *)(width == 1 || m == 0 ? out : work);
+  if(hzunlz_c((const uchar *)in+2,n-2,s,nout)) return(-1);
+  if(s != (uchar *)out){
+    for(j=0; j < (size_t)width; j++){
+      for(i=0; i < m; i++) out[i*width+j] = (char)s[j*m+i];
+    }
+    memcpy(out+m*width,s+m*width,nout-m*width);
+  }
+  return(0);
+}
+/************************************************************************/
+private uchar *hzlen_c(uchar *op,size_t len)
+/*
+  Write the extra bytes of a length of 15 or more.
+------------------------------------------------------------------------*/
+{
+  for(len -= 15; len >= 255; len -= 255) *op++ = 255;
+  *op++ = (uchar)len;
+  return(op);
+}
+/************************************************************************/
+private size_t hzlz_c(const uchar *in,size_t n,uchar *out)
+/*
+  LZ code n bytes. Returns the coded size, or n if coding would not save
+  anything (in which case out holds rubbish). out must have room for
+  n + n/255 + 16 bytes.
+------------------------------------------------------------------------*/
+{
+  unsigned int htab[1 << HZ_HBITS];
+  const uchar *ip,*anchor,*ref,*mlimit,*iend;
+  uchar *op,*oend,*token;
+  size_t lit,len;
+  unsigned int h,step;
+
+  op = out;
+  oend = out + n;
+  ip = anchor = in;
+  iend = in + n;
+
+  if(n > HZ_LAST){
+    memset(htab,0,sizeof(htab));
+    mlimit = iend - HZ_LAST;
+    step = 1 << 6;
+    ip++;
+    while(ip < mlimit){
+
+/* Look for a match, skipping faster over data that do not compress. */
+
+      h = hzhash(ip);
+      ref = in + htab[h];
+      htab[h] = (unsigned int)(ip - in);
+      if(ref >= ip || ip - ref > HZ_WINDOW || hzread32(ref) != hzread32(ip)){
+	ip += step++ >> 6;
+	continue;
+      }
+      step = 1 << 6;
+
+/* Extend it backwards over the literals, and forwards. */
+
+      while(ip > anchor && ref > in && ip[-1] == ref[-1]){ ip--; ref--; }
+      len = HZ_MINMATCH;
+      while(ip + len < iend - 5 && ip[len] == ref[len]) len++;
+
+/* Emit the sequence. */
+
+      lit = ip - anchor;
+      if(op + 1 + lit + lit/255 + 3 + len/255 + 1 >= oend) return(n);
+      token = op++;
+      *token = (uchar)((lit >= 15 ? 15 : lit) << 4);
+      if(lit >= 15) op = hzlen_c(op,lit);
+      memcpy(op,anchor,lit);
+      op += lit;
+      *op++ = (uchar)((ip - ref) & 0xff);
+      *op++ = (uchar)((ip - ref) >> 8);
+      *token |= (uchar)(len - HZ_MINMATCH >= 15 ? 15 : len - HZ_MINMATCH);
+      if(len - HZ_MINMATCH >= 15) op = hzlen_c(op,len - HZ_MINMATCH);
+      ip += len;
+      anchor = ip;
+      if(ip < mlimit) htab[hzhash(ip-2)] = (unsigned int)(ip - 2 - in);
+    }
+  }
+
+/* The last literals. */
+
+  lit = iend - anchor;
+  if(op + 1 + lit + lit/255 + 1 >= oend) return(n);
+  token = op++;
+  *token = (uchar)((lit >= 15 ? 15 : lit) << 4);
+  if(lit >= 15) op = hzlen_c(op,lit);
+  memcpy(op,anchor,lit);
+  op += lit;
+  return(op - out);
+}
+/************************************************************************/
+private int hzunlz_c(const uchar *in,size_t n,uchar *out,size_t nout)
+/*
+  Decode n bytes coded by hzlz_c, which must give nout bytes. Returns 0,
+  or -1 if they are corrupt.
+------------------------------------------------------------------------*/
+{
+  const uchar *ip,*iend,*ref;
+  uchar *op,*oend,*mend;
+  size_t lit,len,off,i;
+  unsigned int t;
+
+  ip = in;
+  iend = in + n;
+  op = out;
+  oend = out + nout;
+  while(ip < iend){
+    t = *ip++;
+
+/* Literals. */
+
+    lit = t >> 4;
+    if(lit == 15){
+      do{
+	if(ip >= iend) return(-1);
+	lit += *ip;
+      }while(*ip++ == 255);
+    }
+    if((size_t)(iend - ip) < lit || (size_t)(oend - op) < lit) return(-1);
+    memcpy(op,ip,lit);
+    op += lit;
+    ip += lit;
+    if(ip == iend) break;
+
+/* A match. */
+
+    if(iend - ip < 2) return(-1);
+    off = ip[0] | (ip[1] << 8);
+    ip += 2;
+    len = (t & 15);
+    if(len == 15){
+      do{
+	if(ip >= iend) return(-1);
+	len += *ip;
+      }while(*ip++ == 255);
+    }
+    len += HZ_MINMATCH;
+    if(off == 0 || (size_t)(op - out) < off || (size_t)(oend - op) < len)
+      return(-1);
+    ref = op - off;
+    if((size_t)(oend - op) < len + 8){
+      while(len--) *op++ = *ref++;
+      continue;
+    }
+
+/* Copy 8 bytes at a time (maybe past the end of the match), from a
+   multiple of off back if it is short. */
+
+    mend = op + len;
+    if(off < 8){
+      for(i=0; i < 8; i++) op[i] = ref[i];
+      op += 8;
+      off *= (8 + off - 1) / off;
+      ref = op - off;
+    }
+    while(op < mend){
+      memcpy(op,ref,8);
+      op += 8;
+      ref += 8;
+    }
+    op = mend;
+  }
+  return(op == oend ? 0 : -1);
+}
@@ -30,7 +30,7 @@
 #include "miriad.h"
 
 
-static char message[128];
+static __thread char message[128];
 
 #define BITS_PER_INT 31
 
@@ -123,8 +123,25 @@ off64_t hsize_c(int ihandle);
 void hio_c(int ihandle, int dowrite, int type, char *buf, off64_t offset, size_t length, int *iostat);
 void hseek_c(int ihandle, off64_t offset);
 off64_t htell_c(int ihandle);
+size_t hbufsize_c(size_t size);
+int  hcompress_c(int enable);
 void hreada_c(int ihandle, char *line, size_t length, int *iostat);
 void hwritea_c(int ihandle, Const char *line, size_t length, int *iostat);
+void hcount_c(int enable);
+void hcount_reset_c(void);
+int  hcount_get_c(int i, char *name, size_t length, long long *value);
+long long hcount_clock(void);
+
+/* Counters of i/o and decoding work (see hcount_c), which HCOUNT leaves
+   alone unless they are switched on. */
+
+enum { HC_DREAD, HC_DREAD_BYTES, HC_DWRITE, HC_DWRITE_BYTES, HC_UVREAD,
+       HC_UVREAD_NS, HC_RECORDS, HC_SKIPPED, HC_UNPACK_NS, HC_FLAGS_NS,
+       HC_UVWRITE, HC_NCOUNT };
+extern int hcount_on;
+extern long long hcount[HC_NCOUNT];
+#define HCOUNT(c,v) do{ if(hcount_on) \
+        __atomic_fetch_add(&hcount[c],(long long)(v),__ATOMIC_RELAXED); }while(0)
 
 /* Macros defined in hio.c */
 
@@ -186,12 +203,15 @@ void hdprobe_c (int tno, Const char *keyword, char *descr, size_t length, char *
 /* dio.c */
 
 void ddelete_c   (char *path, int *iostat);
+void drename_c   (char *from, char *to, int *iostat);
 void dtrans_c    (char *inpath, char *outpath, int *iostat);
 void dmkdir_c    (char *path, int *iostat);
 void drmdir_c    (char *path, int *iostat);
 void dopen_c     (int *fd, char *name, char *status, off64_t *size, int *iostat);
 void dclose_c    (int fd, int *iostat);
 void dread_c     (int fd, char *buffer, off64_t offset, size_t length, int *iostat);
+void dreadf_c    (int fd, char *buffer, off64_t offset, size_t length,
+		  int (*post)(void *), void *arg, int *iostat);
 void dwrite_c    (int fd, char *buffer, off64_t offset, size_t length, int *iostat);
 void dwait_c     (int fd, int *iostat);
 int dexpand_c    (char *tmplte, char *output, int length);
@@ -199,6 +219,12 @@ void dopendir_c  (char **contxt, char *path);
 void dclosedir_c (char *contxt);
 void dreaddir_c  (char *contxt, char *path, int length);
 
+/* hzip.c */
+
+#define HZ_BOUND(n) ((n) + 16)	/* The largest coded size of n bytes. */
+size_t hzencode_c(Const char *in, size_t n, int width, char *out, char *work);
+int  hzdecode_c(Const char *in, size_t n, char *out, size_t nout, char *work);
+
 /* uvio.c */
 
 void uvopen_c   (int *tno, Const char *name, Const char *status);
@@ -206,7 +232,13 @@ void uvclose_c  (int tno);
 void uvflush_c  (int tno);
 void uvnext_c   (int tno);
 void uvrewind_c (int tno);
+void uvseek_c   (int tno, double time, int forward);
+int  uvindex_c  (int tno);
+void uvdecimate_c(int tno, int n, int phase);
+void uvproject_c(int tno, Const char *names);
 void uvcopyvr_c (int tin, int tout);
+int  uvcopysave_c (int tin, char *buf, int size);
+void uvcopyput_c (int tin, int tout, Const char *buf, int len);
 int  uvupdate_c (int tno);
 void uvvarini_c (int tno, int *vhan);
 void uvvarset_c (int vhan, Const char *var);
@@ -215,6 +247,7 @@ int  uvvarupd_c (int vhan);
 void uvrdvr_c   (int tno, int type, Const char *var, char *data, char *def, int n);
 void uvgetvr_c  (int tno, int type, Const char *var, char *data, int n);
 void uvprobvr_c (int tno, Const char *var, char *type, int *length, int *updated);
+int  uvvarinfo_c(int tno, int i, char *var, char *type);
 void uvputvr_c  (int tno, int type, Const char *var, Const char *data, int n);
 void uvtrack_c  (int tno, Const char *name, Const char *switches);
 int  uvscan_c   (int tno, Const char *var);
@@ -224,6 +257,7 @@ void uvsela_c   (int tno, Const char *object, Const char *string, int datasel);
 void uvselect_c (int tno, Const char *object, double p1, double p2, int datasel);
 void uvset_c    (int tno, Const char *object, Const char *type, int n, double p1, double p2, double p3);
 void uvread_c   (int tno, double *preamble, float *data, int *flags, int n, int *nread);
+void uvreadmeta_c (int tno, double *preamble, int *nread);
 void uvwread_c  (int tno, float *data, int *flags, int n, int *nread);
 void uvflgwr_c  (int tno, Const int *flags);
 void uvwflgwr_c (int tno, Const int *flags);
@@ -320,6 +354,7 @@ void scropen_c  (int *handle);
 void scrclose_c (int handle);
 void scrread_c  (int handle, float *buffer, int offset, int length);
 void scrwrite_c (int handle, Const float *buffer, int offset, int length);
+void scrmode_c  (Const char *mode, double maxmb);
 
 /* key.c */
 
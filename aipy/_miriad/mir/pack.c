@@ -91,6 +91,191 @@ void	unpack64_c(char *from,register int *to,int n)
 /*  History:								*/
 /*    rjs  21nov94 Original version.					*/
 /************************************************************************/
+/*									*/
+/*  Vector kernels for the byte reversals below, written with GCC/Clang	*/
+/*  vector extensions: constant byte shuffles, which become pshufb on	*/
+/*  x86 and rev/tbl on ARM. One is chosen for this CPU when the library	*/
+/*  is loaded; each handles whole vectors and returns how many elements	*/
+/*  it did, leaving the rest to the scalar loops.			*/
+/*									*/
+/************************************************************************/
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__aarch64__))
+#define PACK_SIMD
+#endif
+
+#ifdef PACK_SIMD
+#include <string.h>
+
+#if defined(__clang__)
+#define PACK_SHUFFLE(vt,a,b,...) __builtin_shufflevector(a, b, __VA_ARGS__)
+#else
+#define PACK_SHUFFLE(vt,a,b,...) __builtin_shuffle(a, b, (vt){__VA_ARGS__})
+#endif
+
+/* Byte indices for vectors of 16 and 32 bytes: reversing 4 and 8 byte
+   groups; big-endian shorts to the top of ints (U16, shuffled against a
+   zero vector whose bytes are numbered from W); and the low two bytes of
+   ints, big-endian, from a pair of vectors (P16). */
+
+#define REV4(b) b+3,b+2,b+1,b
+#define REV8(b) b+7,b+6,b+5,b+4,b+3,b+2,b+1,b
+#define U16(b,z) z,z,b+1,b
+#define P16(b) b+1,b
+#define REV4_16 REV4(0),REV4(4),REV4(8),REV4(12)
+#define REV4_32 REV4_16,REV4(16),REV4(20),REV4(24),REV4(28)
+#define REV8_16 REV8(0),REV8(8)
+#define REV8_32 REV8_16,REV8(16),REV8(24)
+#define U16LO_16 U16(0,16),U16(2,16),U16(4,16),U16(6,16)
+#define U16HI_16 U16(8,16),U16(10,16),U16(12,16),U16(14,16)
+#define U16LO_32 U16(0,32),U16(2,32),U16(4,32),U16(6,32), \
+		 U16(8,32),U16(10,32),U16(12,32),U16(14,32)
+#define U16HI_32 U16(16,32),U16(18,32),U16(20,32),U16(22,32), \
+		 U16(24,32),U16(26,32),U16(28,32),U16(30,32)
+#define P16_16 P16(0),P16(4),P16(8),P16(12),P16(16),P16(20),P16(24),P16(28)
+#define P16_32 P16_16,P16(32),P16(36),P16(40),P16(44),P16(48),P16(52), \
+		 P16(56),P16(60)
+
+typedef struct {
+  int (*rev4)(char *in,char *out,int n);
+  int (*rev8)(char *in,char *out,int n);
+  int (*unpack16)(char *in,int *out,int n);
+  int (*pack16)(int *in,char *out,int n);
+  int (*unpack16s)(char *in,float *out,float scale,int n);
+  int (*pack16s)(float *in,char *out,float scale,int n);
+} PACK_KERNELS;
+
+#define PACK_SIMD_ISA(attr,isa,W) \
+typedef unsigned char bvec_##isa __attribute__((vector_size(W))); \
+typedef int ivec_##isa __attribute__((vector_size(W))); \
+typedef float fvec_##isa __attribute__((vector_size(W))); \
+attr static int rev4_##isa(char *in,char *out,int n) \
+{ \
+  int i; \
+  bvec_##isa v; \
+  for(i=0; i + W/4 <= n; i += W/4, in += W, out += W){ \
+    memcpy(&v,in,W); \
+    v = PACK_SHUFFLE(bvec_##isa,v,v,REV4_##W); \
+    memcpy(out,&v,W); \
+  } \
+  return i; \
+} \
+attr static int rev8_##isa(char *in,char *out,int n) \
+{ \
+  int i; \
+  bvec_##isa v; \
+  for(i=0; i + W/8 <= n; i += W/8, in += W, out += W){ \
+    memcpy(&v,in,W); \
+    v = PACK_SHUFFLE(bvec_##isa,v,v,REV8_##W); \
+    memcpy(out,&v,W); \
+  } \
+  return i; \
+} \
+attr static int unpack16_##isa(char *in,int *out,int n) \
+{ \
+  int i; \
+  bvec_##isa v,z = {0}; \
+  ivec_##isa lo,hi; \
+  for(i=0; i + W/2 <= n; i += W/2, in += W, out += W/2){ \
+    memcpy(&v,in,W); \
+    lo = (ivec_##isa)PACK_SHUFFLE(bvec_##isa,v,z,U16LO_##W) >> 16; \
+    hi = (ivec_##isa)PACK_SHUFFLE(bvec_##isa,v,z,U16HI_##W) >> 16; \
+    memcpy(out,&lo,W); \
+    memcpy(out+W/4,&hi,W); \
+  } \
+  return i; \
+} \
+attr static int pack16_##isa(int *in,char *out,int n) \
+{ \
+  int i; \
+  bvec_##isa a,b; \
+  for(i=0; i + W/2 <= n; i += W/2, in += W/2, out += W){ \
+    memcpy(&a,in,W); \
+    memcpy(&b,in+W/4,W); \
+    a = PACK_SHUFFLE(bvec_##isa,a,b,P16_##W); \
+    memcpy(out,&a,W); \
+  } \
+  return i; \
+} \
+attr static int unpack16s_##isa(char *in,float *out,float scale,int n) \
+{ \
+  int i; \
+  bvec_##isa v,z = {0}; \
+  fvec_##isa lo,hi; \
+  for(i=0; i + W/2 <= n; i += W/2, in += W, out += W/2){ \
+    memcpy(&v,in,W); \
+    lo = __builtin_convertvector((ivec_##isa)PACK_SHUFFLE(bvec_##isa,v,z,U16LO_##W) >> 16,fvec_##isa) * scale; \
+    hi = __builtin_convertvector((ivec_##isa)PACK_SHUFFLE(bvec_##isa,v,z,U16HI_##W) >> 16,fvec_##isa) * scale; \
+    memcpy(out,&lo,W); \
+    memcpy(out+W/4,&hi,W); \
+  } \
+  return i; \
+} \
+attr static int pack16s_##isa(float *in,char *out,float scale,int n) \
+{ \
+  int i; \
+  fvec_##isa fa,fb; \
+  ivec_##isa ia,ib; \
+  bvec_##isa a; \
+  for(i=0; i + W/2 <= n; i += W/2, in += W/2, out += W){ \
+    memcpy(&fa,in,W); \
+    memcpy(&fb,in+W/4,W); \
+    ia = __builtin_convertvector(fa * scale,ivec_##isa); \
+    ib = __builtin_convertvector(fb * scale,ivec_##isa); \
+    a = PACK_SHUFFLE(bvec_##isa,(bvec_##isa)ia,(bvec_##isa)ib,P16_##W); \
+    memcpy(out,&a,W); \
+  } \
+  return i; \
+} \
+static PACK_KERNELS kernels_##isa = \
+  { rev4_##isa, rev8_##isa, unpack16_##isa, pack16_##isa, \
+    unpack16s_##isa, pack16s_##isa };
+
+#if defined(__x86_64__)
+PACK_SIMD_ISA(__attribute__((target("avx2"))),avx2,32)
+PACK_SIMD_ISA(__attribute__((target("ssse3"))),ssse3,16)
+#else
+PACK_SIMD_ISA(,neon,16)
+#endif
+
+static PACK_KERNELS *kernels = NULL;
+
+__attribute__((constructor)) static void pack_init(void)
+/*
+  Choose the kernels for this CPU.
+------------------------------------------------------------------------*/
+{
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx2"))	   kernels = &kernels_avx2;
+  else if(__builtin_cpu_supports("ssse3")) kernels = &kernels_ssse3;
+#else
+  kernels = &kernels_neon;
+#endif
+}
+
+/* Do the first elements with kernel k, then carry on with the scalar
+   loop. */
+#define PACK_KERNEL(k,in,out,n,isize,osize) \
+  if(kernels != NULL){ \
+    i = kernels->k((void *)(in),(void *)(out),n); \
+    in = (void *)((char *)in + i*(isize)); \
+    out = (void *)((char *)out + i*(osize)); \
+    n -= i; \
+  }
+/* As PACK_KERNEL for the kernels that scale, with isize and osize in
+   elements of in and out. */
+#define PACK_KERNEL_SCALED(k,in,out,scale,n,isize,osize) \
+  if(kernels != NULL){ \
+    i = kernels->k(in,out,scale,n); \
+    in += i*(isize); \
+    out += i*(osize); \
+    n -= i; \
+  }
+#else
+#define PACK_KERNEL(k,in,out,n,isize,osize)
+#define PACK_KERNEL_SCALED(k,in,out,scale,n,isize,osize)
+#endif
+/************************************************************************/
 void pack16_c(int *in,char *out,int n)
 /*
   Pack an integer array into 16 bit integers.
@@ -99,6 +284,7 @@ void pack16_c(int *in,char *out,int n)
   int i;
   char *s;
 
+  PACK_KERNEL(pack16,in,out,n,sizeof(int),2);
   s = (char *)in;
   for(i=0; i < n; i++){
     *out++ = *(s+1);
@@ -115,6 +301,7 @@ void unpack16_c(char *in,int *out,int n)
   int i;
   char *s;
 
+  PACK_KERNEL(unpack16,in,out,n,2,sizeof(int));
   s = (char *)out;
   for(i=0; i < n; i++){
     *s++ = *(in+1);
@@ -138,6 +325,7 @@ void pack32_c(int *in,char *out,int n)
   int i;
   char *s;
 
+  PACK_KERNEL(rev4,in,out,n,4,4);
   s = (char *)in;
   for(i = 0; i < n; i++){
     *out++ = *(s+3);
@@ -156,6 +344,7 @@ void unpack32_c(char *in,int *out,int n)
   int i;
   char *s;
 
+  PACK_KERNEL(rev4,in,out,n,4,4);
   s = (char *)out;
   for(i = 0; i < n; i++){
     *s++ = *(in+3);
@@ -174,6 +363,7 @@ void pack64_c(int8 *in,char *out,int n)
   int i;
   char *s;
 
+  PACK_KERNEL(rev8,in,out,n,8,8);
   s = (char *)in;
   for(i=0; i < n; i++){
     *out++ = *(s+7);
@@ -196,6 +386,7 @@ void unpack64_c(char *in,int8 *out,int n)
   int i;
   char *s;
 
+  PACK_KERNEL(rev8,in,out,n,8,8);
   s = (char *)out;
   for(i=0; i < n; i++){
     *s++ = *(in+7);
@@ -218,6 +409,7 @@ void packr_c(float *in,char *out,int n)
   int i;
   char *s;
 
+  PACK_KERNEL(rev4,in,out,n,4,4);
   s = (char *)in;
   for(i = 0; i < n; i++){
     *out++ = *(s+3);
@@ -236,6 +428,7 @@ void unpackr_c(char *in,float *out,int n)
   int i;
   char *s;
 
+  PACK_KERNEL(rev4,in,out,n,4,4);
   s = (char *)out;
   for(i = 0; i < n; i++){
     *s++ = *(in+3);
@@ -255,6 +448,7 @@ void packd_c(double *in,char *out,int n)
   int i;
   char *s;
 
+  PACK_KERNEL(rev8,in,out,n,8,8);
   s = (char *)in;
   for(i = 0; i < n; i++){
     *out++ = *(s+7);
@@ -278,6 +472,7 @@ void unpackd_c(char *in,double *out,int n)
   int i;
   char *s;
 
+  PACK_KERNEL(rev8,in,out,n,8,8);
   s = (char *)out;
   for(i = 0; i < n; i++){
     *s++ = *(in+7);
@@ -638,3 +833,39 @@ void unpackd_c(char *in,double *out,int n)
 }
 
 #endif
+
+
+#ifndef PACK_KERNEL_SCALED
+#define PACK_KERNEL_SCALED(k,in,out,scale,n,isize,osize)
+#endif
+/************************************************************************/
+void pack16s_c(float *in,char *out,float scale,int n)
+/*
+  Pack an array of reals, multiplied by scale and truncated, into 16 bit
+  integers. This is pack16_c of the integer parts, in one pass.
+------------------------------------------------------------------------*/
+{
+  int i,t;
+
+  PACK_KERNEL_SCALED(pack16s,in,out,scale,n,1,2);
+  for(i=0; i < n; i++){
+    t = scale * *in++;
+    *out++ = t >> 8;
+    *out++ = t;
+  }
+}
+/************************************************************************/
+void unpack16s_c(char *in,float *out,float scale,int n)
+/*
+  Unpack an array of 16 bit integers into reals, multiplying by scale.
+  This is unpack16_c followed by the scaling, in one pass.
+------------------------------------------------------------------------*/
+{
+  int i;
+
+  PACK_KERNEL_SCALED(unpack16s,in,out,scale,n,2,1);
+  for(i=0; i < n; i++){
+    *out++ = scale * ((signed char)*in * 256 + (unsigned char)*(in+1));
+    in += 2;
+  }
+}
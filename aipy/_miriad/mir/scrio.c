@@ -10,12 +10,104 @@
 /*   jwr  05nov04  Change file offsets to type off_t			*/
 /************************************************************************/
 
+#include <Python.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include "io.h"
 #include "miriad.h"
 
+#define Realloc(a,b) ((a)==NULL?malloc((size_t)(b)):realloc((a),(size_t)(b)))
+#define MEMBASE	0x40000000	/* Handles of in-memory scratch files.	*/
+#define MAXMEM	256		/* In-memory scratch files open at once. */
+#define MINALLOC 65536
 
+/* An in-memory scratch file, or (once spilt) the disk one holding it. */
+
+typedef struct {
+  char *buf;
+  size_t size,alloc;
+  int open,disk;
+} SCRMEM;
+
+static SCRMEM scrmem[MAXMEM];
 static int number=0;
+static int inmem = -1;		/* Not yet set from MIRSCRATCH.		*/
+static size_t limit = 0,used = 0;
+
+static int scr_disk(void);
+static void scr_spill(SCRMEM *s);
+static SCRMEM *scr_mem(int handle);
+/************************************************************************/
+void scrmode_c(Const char *mode,double maxmb)
+/**scrmode -- Choose where new scratch files are kept.			*/
+/*:scratch-i/o								*/
+/*+
+  This chooses whether scratch files opened from now on live on disk
+  (the default) or in memory. In-memory scratch files together may use
+  up to maxmb megabytes; one that would take them past this is moved to
+  disk, and carries on there. Without a call to scrmode, the mode is
+  taken from the environment variable MIRSCRATCH ("disk" or "memory",
+  optionally followed by ":" and the limit in megabytes).
+  Input:
+    mode	Either "disk" or "memory".
+    maxmb	The limit in megabytes, or 0 for none.			*/
+/*--									*/
+/*----------------------------------------------------------------------*/
+{
+  if(!strcmp(mode,"memory"))   inmem = 1;
+  else if(!strcmp(mode,"disk"))inmem = 0;
+  else bugv_c('f',"scrmode_c: unrecognised mode %s",mode);
+  limit = maxmb > 0 ? (size_t)(maxmb*1048576.0) : 0;
+}
+/************************************************************************/
+static int scr_disk(void)
+/*
+  Open a scratch file on disk, returning its item handle.
+------------------------------------------------------------------------*/
+{
+  int iostat,handle;
+  char name[32];
+
+  (void)sprintf(name,"scratch%d",number++);
+  haccess_c(0,&handle,name,"scratch",&iostat);
+  if(iostat){
+    bug_c(  'w',"Error opening scratch file");
+    bugno_c('f',iostat);
+  }
+  return handle;
+}
+/************************************************************************/
+static SCRMEM *scr_mem(int handle)
+/*
+  The in-memory scratch file of a handle from MEMBASE on.
+------------------------------------------------------------------------*/
+{
+  if(handle - MEMBASE >= MAXMEM || !scrmem[handle-MEMBASE].open)
+    bugv_c('f',"Invalid scratch file handle %d",handle);
+  return &scrmem[handle-MEMBASE];
+}
+/************************************************************************/
+static void scr_spill(SCRMEM *s)
+/*
+  Move an in-memory scratch file to disk.
+------------------------------------------------------------------------*/
+{
+  int iostat;
+
+  s->disk = scr_disk();
+  if(s->size > 0){
+    hwriteb_c(s->disk,s->buf,0,s->size,&iostat);
+    if(iostat){
+      bug_c(  'w',"Error writing to scratch file");
+      bugno_c('f',iostat);
+    }
+  }
+  free(s->buf);
+  used -= s->alloc;
+  s->buf = NULL;
+  s->alloc = 0;
+}
 /************************************************************************/
 void scropen_c(int *handle)
 /**scropen -- Open a scratch file.					*/
@@ -25,21 +117,38 @@ void scropen_c(int *handle)
 	subroutine scropen(tno)
 	integer tno
 
-  This opens a scratch file, and readies it for use.
+  This opens a scratch file, and readies it for use. It is kept in
+  memory or on disk as scrmode chose.
   Output:
     tno		The handle of the scratch file.				*/
 /*--									*/
 /*----------------------------------------------------------------------*/
 {
-  int iostat;
-  char name[32];
+  char *env,*colon;
+  int i;
 
-  (void)sprintf(name,"scratch%d",number++);
-  haccess_c(0,handle,name,"scratch",&iostat);
-  if(iostat){
-    bug_c(  'w',"Error opening scratch file");
-    bugno_c('f',iostat);
+  if(inmem < 0){
+    env = getenv("MIRSCRATCH");
+    inmem = env != NULL && !strncmp(env,"memory",6);
+    colon = env != NULL ? strchr(env,':') : NULL;
+    if(colon != NULL) limit = (size_t)(atof(colon+1)*1048576.0);
+  }
+
+/* Find a free in-memory slot, or fall back to disk if there is none. */
+
+  if(inmem){
+    for(i=0; i < MAXMEM; i++){
+      if(!scrmem[i].open){
+        scrmem[i].open = TRUE;
+        scrmem[i].buf = NULL;
+        scrmem[i].size = scrmem[i].alloc = 0;
+        scrmem[i].disk = -1;
+        *handle = MEMBASE + i;
+        return;
+      }
+    }
   }
+  *handle = scr_disk();
 }
 /************************************************************************/
 void scrclose_c(int handle)
@@ -58,7 +167,19 @@ void scrclose_c(int handle)
 /*----------------------------------------------------------------------*/
 {
   int iostat;
+  SCRMEM *s;
 
+  if(handle >= MEMBASE){
+    s = scr_mem(handle);
+    s->open = FALSE;
+    if(s->disk < 0){
+      free(s->buf);
+      used -= s->alloc;
+      s->buf = NULL;
+      return;
+    }
+    handle = s->disk;
+  }
   hdaccess_c(handle,&iostat);
   if(iostat){
     bug_c(  'w',"Error closing scratch file");
@@ -87,7 +208,23 @@ void scrread_c(int handle,float *buffer,int offset,int length)
 /*----------------------------------------------------------------------*/
 {
   int iostat;
+  size_t off,len;
+  SCRMEM *s;
 
+  if(handle >= MEMBASE){
+    s = scr_mem(handle);
+    if(s->disk < 0){
+      off = sizeof(float)*(size_t)offset;
+      len = sizeof(float)*(size_t)length;
+      if(offset < 0 || off + len > s->size){
+	bug_c(  'w',"Error reading from scratch file");
+	bugno_c('f',-1);
+      }
+      memcpy(buffer,s->buf+off,len);
+      return;
+    }
+    handle = s->disk;
+  }
   hreadb_c(handle,(char *)buffer,
     (off64_t)sizeof(float)*offset,sizeof(float)*length,&iostat);
   if(iostat){
@@ -116,7 +253,39 @@ void scrwrite_c(int handle,Const float *buffer,int offset,int length)
 /*----------------------------------------------------------------------*/
 {
   int iostat;
+  size_t off,len,need,alloc;
+  SCRMEM *s;
 
+/* Writes past the end of an in-memory file grow it (zero filling any
+   gap), unless that would pass the limit, when it moves to disk. */
+
+  if(handle >= MEMBASE){
+    s = scr_mem(handle);
+    off = sizeof(float)*(size_t)offset;
+    len = sizeof(float)*(size_t)length;
+    if(s->disk < 0 && off + len > s->alloc){
+      need = off + len;
+      alloc = 2*s->alloc > need ? 2*s->alloc : need;
+      if(alloc < MINALLOC) alloc = MINALLOC;
+      if(limit > 0 && used - s->alloc + alloc > limit){
+	if(used - s->alloc + need <= limit) alloc = need;
+	else scr_spill(s);
+      }
+      if(s->disk < 0){
+	s->buf = Realloc(s->buf,alloc);
+	if(s->buf == NULL) bug_c('f',"Out of memory for a scratch file");
+	used += alloc - s->alloc;
+	s->alloc = alloc;
+      }
+    }
+    if(s->disk < 0){
+      if(off > s->size) memset(s->buf+s->size,0,off-s->size);
+      memcpy(s->buf+off,buffer,len);
+      if(off + len > s->size) s->size = off + len;
+      return;
+    }
+    handle = s->disk;
+  }
   hwriteb_c(handle,(char *)buffer,
     (off64_t)sizeof(float)*offset,sizeof(float)*length,&iostat);
   if(iostat){
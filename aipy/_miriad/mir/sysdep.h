@@ -111,7 +111,9 @@ typedef long long int int8;
 #define FORT_FALSE 0
 #define FORT_LOGICAL(a) ((a) != FORT_FALSE)
 
-#define BUFDBUFF 0
+/* dio.c does transfers in the background, so hio reads ahead and
+   writes behind. */
+#define BUFDBUFF 1
 #define BUFALIGN 2
 #define BUFSIZE 16384
 
@@ -172,4 +174,9 @@ void unpackd_c(char *in, double *out, int n);
 #endif
 #endif
 
+/* 16 bit integers to and from scaled reals, for any byte order. */
+
+void pack16s_c(float *in, char *out, float scale, int n);
+void unpack16s_c(char *in, float *out, float scale, int n);
+
 #endif /* MIR_SYSDEP_H */
@@ -266,6 +266,7 @@
 #include <string.h>
 #include <math.h>
 #include <ctype.h>
+#include <pthread.h>
 #include "io.h"
 #include "miriad.h"
 
@@ -290,11 +291,15 @@
 #define UVF_UPDATED_UVW 0x4000	/* Set if things needed for uvw have changed. */
 #define UVF_REDO_UVW	0x8000	/* Set if u-v-w are to be recomputed. */
 #define UVF_DOW		0x10000	/* Set if the caller wants w returned. */
+#define UVF_LAZY	0x20000	/* Set if this variable is only read when
+				   its value is asked for (see uvproject). */
 
 #define UV_ALIGN	8
 #define UV_HDR_SIZE	4
 
 #define CHECK_THRESH	6
+
+#define UVFETCH(uv,v) if((v)->pending >= 0) uv_fetch(uv,v)
 #define HASHSIZE      123
 #define MAXVAR	      256
 #define MAXNAM		8
@@ -359,19 +364,22 @@
 /*									*/
 /*----------------------------------------------------------------------*/
 
-static char message[MAXLINE];
+static __thread char message[MAXLINE];
 static int internal_size[10];
 static int external_size[10];
 static char type_flag[10];
 
-static char var_data_hdr[UV_HDR_SIZE]={0,0,VAR_DATA,0};
-static char var_size_hdr[UV_HDR_SIZE]={0,0,VAR_SIZE,0};
+/* The variable headers get the variable's number written into them, so
+   each thread writing a data set needs its own. */
+static __thread char var_data_hdr[UV_HDR_SIZE]={0,0,VAR_DATA,0};
+static __thread char var_size_hdr[UV_HDR_SIZE]={0,0,VAR_SIZE,0};
 static char var_eor_hdr[UV_HDR_SIZE]={0,0,VAR_EOR,0};
 
 
 typedef struct variable{
 	char *buf,name[MAXNAM+1];
 	int length,flength,flags,type,index,callno;
+	off64_t pending;	/* Offset of a value not yet read, or -1. */
 	struct variable *fwd;
 } VARIABLE;
 
@@ -446,6 +454,20 @@ typedef struct select {
 		struct select *fwd;
 } SELECT;
 
+/* A selection made of nothing but antennae and polarisation clauses
+   depends only on the baseline and polarisation of a record, so on first
+   use uvread_select evaluates the whole chain once for each baseline of
+   antennae 1..nants and each polarisation it mentions (plus one entry for
+   any other polarisation), into one bit per baseline.  Records are then
+   judged with a single probe.  "compiled" is -1 when the chain changed
+   since the last build, 0 when it cannot be compiled, 1 otherwise.	*/
+#define MAXSELPOL 8
+
+typedef struct {
+	int compiled,maxant,nants,nbl,npol,pols[MAXSELPOL];
+	unsigned char *bits;
+} SELTAB;
+
 typedef struct {
 	int nants;
 	double uu[MAXANT],vv[MAXANT],ww[MAXANT];
@@ -463,6 +485,20 @@ typedef struct {
         off64_t offset;
 } FLAGS;
 
+/* The record index of a data set opened "old" (see uvseek_c): the time
+   runs (blocks of records of constant time) in file order, the visdata,
+   flags and wflags offsets each run starts at, and every UVIDX_STRIDE
+   runs a checkpoint of the offset and length of each variable's value at
+   that point.  It is kept in the "visindex" item.			*/
+typedef struct {
+	int8 vislen,nvar,nrun,ncheck;
+	double *time;
+	int8 *start,*check,*size;
+} UVINDEX;
+
+#define UVIDX_VERSION	1
+#define UVIDX_STRIDE	16
+
 typedef struct {
 	int item;
 	int nvar,saved_nvar,tno,flags,callno,maxvis,mark;
@@ -486,11 +522,17 @@ typedef struct {
         int skyfreq_start;
 	VARHAND *vhans;
 	SELECT *select;
+	SELTAB seltab;
 	int apply_amp,apply_win;
 	AMP *amp;
 	SIGMA2 sigma2;
 	UVW *uvw;
 	WINDOW *win;
+	UVINDEX *index;
+	int decimate,decphase,intcnt;
+	double dectime;
+	char *packed;		/* Scratch for int2 corr in disk format. */
+	int npacked;
 } UV;
 
 #define MAXVHANDS 128
@@ -501,6 +543,11 @@ static WINDOW truewin;
 static AMP noamp;
 static int first=TRUE;
 
+/* uvs[tno] belongs to whoever opened tree tno (hio hands out the tree
+   handles), so only the shared variable handle table needs locking. */
+static pthread_mutex_t varhands_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t init_once = PTHREAD_ONCE_INIT;
+
 /* void uvputvr_c(); */
 private void uvinfo_chan(UV *uv,double *data,int mode);
 private void uvinfo_variance(UV *uv,double *data);
@@ -510,6 +557,7 @@ private void uv_freeuv(UV *uv);
 private void uv_free_select(SELECT *sel);
 private void uvread_defline(int tno);
 private void uvread_init(int tno);
+private void uvread_rec(int tno,double *preamble,float *data,int *flags,int n,int *nread);
 private void uvread_velocity(UV *uv,LINE_INFO *line,float *data, int *flags,int nsize,LINE_INFO *actual);
 private void uvread_flags(UV *uv,VARIABLE *v,FLAGS *flag_info,int nchan);
 private void uvread_defvelline(UV* uv,LINE_INFO *line,WINDOW *win);
@@ -533,10 +581,18 @@ private VARIABLE *uv_checkvar(int tno,char *varname,int type);
 private int uv_scan(UV *uv, VARIABLE *vt);
 private int uvread_line(UV *uv,LINE_INFO *line,float *data, int nsize,int *flags,LINE_INFO *actual);
 private int uvread_select(UV *uv);
+private void uvread_selcompile(UV *uv);
+private int uvread_decimate(UV *uv);
+private void uv_fetch(UV *uv,VARIABLE *v);
+private void uv_fetch_scaled(UV *uv,VARIABLE *v,float *data,float scale,int start,int n);
+private void uv_put_scaled(UV *uv,VARIABLE *v,Const float *data,float scale,int n);
+private char *uv_packed(UV *uv,int n);
 private int uvread_maxvis(SELECT *sel);
 private int uvread_shadowed(UV *uv,double diameter);
 private int uvread_match(char *s1,char *s2, int length);
 private double uv_getskyfreq(UV *uv,WINDOW *win);
+private UVINDEX *uvidx_get(UV *uv);
+private void uvidx_free(UVINDEX *idx);
 
 /************************************************************************/
 #ifdef TESTBED
@@ -729,7 +785,7 @@ void uvopen_c(int *tno,Const char *name,Const char *status)
   int iostat;
   char line[MAXLINE];
 
-  if(first)uv_init();
+  pthread_once(&init_once,uv_init);
 
 /*----------------------------------------------------------------------*/
 /*									*/
@@ -986,7 +1042,9 @@ private void uv_freeuv(UV *uv)
   vh = uv->vhans;
   while(vh != NULL){
     vp = vh->varhd;
+    pthread_mutex_lock(&varhands_lock);
     varhands[vh->index] = NULL;
+    pthread_mutex_unlock(&varhands_lock);
     while(vp != NULL){
       vpt = vp;
       vp = vp->fwd;
@@ -1008,7 +1066,10 @@ private void uv_freeuv(UV *uv)
   if(uv->wcorr_flags.flags != NULL ) free((char *)uv->wcorr_flags.flags);
   if(uv->sigma2.table != NULL)free((char *)uv->sigma2.table);
   uv_free_select(uv->select);
+  if(uv->seltab.bits != NULL) free((char *)uv->seltab.bits);
   if(uv->uvw != NULL) free((char *)(uv->uvw));
+  uvidx_free(uv->index);
+  if(uv->packed != NULL) free(uv->packed);
   free((char *)uv);
 }
 /************************************************************************/
@@ -1043,6 +1104,13 @@ private UV *uv_getuv(int tno)
   VARIABLE *v;
 
   uv = (UV *)Malloc(sizeof(UV));
+  uv->index	= NULL;
+  uv->decimate	= 1;
+  uv->decphase	= 0;
+  uv->intcnt	= -1;
+  uv->dectime	= -1;
+  uv->packed	= NULL;
+  uv->npacked	= 0;
   uv->item	= 0;
   uv->tno	= tno;
   uv->vhans	= NULL;
@@ -1057,6 +1125,9 @@ private UV *uv_getuv(int tno)
   uv->maxvis	= 0;
   uv->mark	= 0;
   uv->select    = NULL;
+  uv->seltab.compiled = -1;
+  uv->seltab.maxant = 0;
+  uv->seltab.bits = NULL;
   uv->need_skyfreq = uv->need_point = uv->need_planet = FALSE;
   uv->need_pol	   = uv->need_on    = uv->need_uvw    = FALSE;
   uv->need_src	   = uv->need_win   = uv->need_bin    = FALSE;
@@ -1101,6 +1172,7 @@ private UV *uv_getuv(int tno)
   for(i=0, v = uv->variable; i < MAXVAR; i++, v++){
     v->length = v->flength = 0;
     v->buf = NULL;
+    v->pending = -1;
     v->flags = 0;
     v->type = 0;
     v->fwd = NULL;
@@ -1335,6 +1407,8 @@ void uvrewind_c(int tno)
   uv->offset = 0;
   uv->corr_flags.offset = 0;
   uv->wcorr_flags.offset = 0;
+  uv->intcnt = -1;
+  uv->dectime = -1;
 }
 /************************************************************************/
 void uvcopyvr_c(int tin,int tout)
@@ -1362,8 +1436,78 @@ void uvcopyvr_c(int tin,int tout)
 
   uv = uvs[tin];
   if(uv->flags & UVF_COPY) for(i=0, v=uv->variable; i < uv->nvar; i++,v++){
-    if(v->callno >= uv->mark && (v->flags & UVF_COPY))
+    if(v->callno >= uv->mark && (v->flags & UVF_COPY)){
+      UVFETCH(uv,v);
       uvputvr_c(tout,v->type,v->name,v->buf,VARLEN(v));
+    }
+  }
+}
+/************************************************************************/
+int uvcopysave_c(int tin,char *buf,int size)
+/**uvcopysave -- Save the variables that uvcopyvr would copy now.	*/
+/*:uv-i/o								*/
+/*+
+  This saves the values of the variables that uvcopyvr would copy after
+  the last read, so that uvcopyput can write them to an output data set
+  later, once more records have been read. Values are only saved if they
+  all fit; call again with a bigger buffer otherwise.
+
+  Inputs:
+    tin		File handle of the input uv data set.
+    size	Size of buf, in bytes.
+  Output:
+    buf		The saved values, if they fit.
+    uvcopysave	The number of bytes the saved values take.		*/
+/*--									*/
+/*----------------------------------------------------------------------*/
+{
+  UV *uv;
+  VARIABLE *v;
+  int i,n,len,need;
+
+  uv = uvs[tin];
+  len = 0;
+  if(uv->flags & UVF_COPY) for(i=0, v=uv->variable; i < uv->nvar; i++,v++){
+    if(v->callno >= uv->mark && (v->flags & UVF_COPY)){
+      UVFETCH(uv,v);
+      n = VARLEN(v) * internal_size[v->type];
+      need = 2*sizeof(int) + mroundup(n,sizeof(double));
+      if(len + need <= size){
+	((int *)(buf+len))[0] = i;
+	((int *)(buf+len))[1] = VARLEN(v);
+	memcpy(buf+len+2*sizeof(int),v->buf,n);
+      }
+      len += need;
+    }
+  }
+  return len;
+}
+/************************************************************************/
+void uvcopyput_c(int tin,int tout,Const char *buf,int len)
+/**uvcopyput -- Write variables saved by uvcopysave.			*/
+/*:uv-i/o								*/
+/*+
+  This writes the variable values that uvcopysave saved from the input
+  data set to the output, as uvcopyvr would have when they were saved.
+  The input may be read meanwhile.
+
+  Inputs:
+    tin		File handle of the input uv data set.
+    tout	File handle of the output uv data set.
+    buf		The values saved by uvcopysave.
+    len		The number of bytes returned by uvcopysave.		*/
+/*--									*/
+/*----------------------------------------------------------------------*/
+{
+  VARIABLE *v;
+  Const int *hdr;
+  int off;
+
+  for(off=0; off < len;){
+    hdr = (Const int *)(buf+off);
+    v = uvs[tin]->variable + hdr[0];
+    uvputvr_c(tout,v->type,v->name,buf+off+2*sizeof(int),hdr[1]);
+    off += 2*sizeof(int) + mroundup(hdr[1]*internal_size[v->type],sizeof(double));
   }
 }
 /************************************************************************/
@@ -1415,9 +1559,14 @@ void uvvarini_c(int tno,int *vhan)
 
 /* Locate a space handle slot. */
 
+  pthread_mutex_lock(&varhands_lock);
   for(i=0; i < MAXVHANDS; i++)if(varhands[i] == NULL)break;
-  if(i == MAXVHANDS)BUG('f',"Ran out of variable handle slots, in UVVARINI");
+  if(i == MAXVHANDS){
+    pthread_mutex_unlock(&varhands_lock);
+    BUG('f',"Ran out of variable handle slots, in UVVARINI");
+  }
   varhands[i] = vh = (VARHAND *)Malloc(sizeof(VARHAND));
+  pthread_mutex_unlock(&varhands_lock);
   
   vh->index = i;
   vh->callno = 0;
@@ -1457,8 +1606,10 @@ void uvvarcpy_c(int vhan,int tout)
 
   for(vp = vh->varhd; vp != NULL; vp = vp->fwd){
     v = vp->v;
-    if(v->callno > callno)
+    if(v->callno > callno){
+      UVFETCH(uvs[vh->tno],v);
       uvputvr_c(tout,v->type,v->name,v->buf,VARLEN(v));
+    }
   }
 }
 /************************************************************************/
@@ -1515,6 +1666,7 @@ void uvrdvr_c(int tno,int type,Const char *var,char *data,char *def,int n)
   int deflt,oktype;
 
   v = uv_locvar(tno,(char *)var);
+  if(v != NULL) UVFETCH(uvs[tno],v);
   oktype = TRUE;
   deflt = (v == NULL);
   if(!deflt) deflt = (v->buf == NULL) || (v->length == 0);
@@ -1613,6 +1765,7 @@ void uvgetvr_c(int tno,int type,Const char *var,char *data,int n)
   v = uv_locvar(tno,(char *)var);
   if(v == NULL)
     ERROR('f',(message,"Variable %s not found, in UVGETVR",var));
+  UVFETCH(uvs[tno],v);
   size = external_size[type];
   if( type != v->type )
     ERROR('f',(message,"Variable %s has wrong type, in UVGETVR",var));
@@ -1676,6 +1829,35 @@ void uvprobvr_c(int tno,Const char *var,char *type,int *length,int *updated)
   }
 }
 /************************************************************************/
+int uvvarinfo_c(int tno,int i,char *var,char *type)
+/**uvvarinfo -- Return the name and type of a variable by number.	*/
+/*:uv-i/o								*/
+/*+
+  This returns the name and type of the i'th variable known to the
+  uv data set (those of its vartable, then any made since), so that
+  callers can list the variables without reading the vartable again.
+
+  Input:
+    tno		The handle of the uv data file.
+    i		The variable number, counting from 0.
+  Output:
+    var		The name of the variable (9 bytes will hold any).
+    type	Its type: one of 'a', 'j', 'i', 'r', 'd' or 'c'.
+    uvvarinfo_c	FALSE once i is past the last variable.			*/
+/*--									*/
+/*----------------------------------------------------------------------*/
+{
+  UV *uv;
+  VARIABLE *v;
+
+  uv = uvs[tno];
+  if(i < 0 || i >= uv->nvar) return(FALSE);
+  v = &uv->variable[i];
+  Strcpy(var,v->name);
+  *type = VARTYPE(v);
+  return(TRUE);
+}
+/************************************************************************/
 void uvputvr_c(int tno,int type,Const char *var,Const char *data,int n)
 /**uvputvr -- Write the value of a uv variable.				*/
 /*&rjs                                                                  */
@@ -1819,6 +2001,51 @@ void uvtrack_c(int tno,Const char *name,Const char *switches)
   }
 }
 /************************************************************************/
+void uvproject_c(int tno,Const char *names)
+/**uvproject -- Read only the named variables eagerly.			*/
+/*:uv-i/o								*/
+/*+									*/
+/*
+  After this, uvread leaves the values of variables other than those named
+  (and those uvread itself needs) in the file, and reads them only when
+  asked for by uvgetvr, uvrdvr, uvcopyvr or uvvarcpy. Whether and when they
+  were updated is still tracked. Each call replaces the last; an empty list
+  makes every variable eager again.
+
+  Input:
+    tno		The uv data file handle.
+    names	Names of variables, separated by commas or blanks.	*/
+/*--									*/
+/*----------------------------------------------------------------------*/
+{
+  UV *uv;
+  VARIABLE *v;
+  char name[MAXNAM+1];
+  int i,n,all;
+
+  uv = uvs[tno];
+  all = TRUE;
+  for(i=0, v = uv->variable; i < uv->nvar; i++, v++) v->flags &= ~UVF_LAZY;
+  while(*names){
+    while(*names == ',' || *names == ' ') names++;
+    for(n=0; *names && *names != ',' && *names != ' '; names++)
+      if(n < MAXNAM) name[n++] = *names;
+    name[n] = 0;
+    if(n == 0) continue;
+    if(all) for(i=0, v = uv->variable; i < uv->nvar; i++, v++)
+      if(!(v->flags & UVF_OVERRIDE)) v->flags |= UVF_LAZY;
+    all = FALSE;
+    if((v = uv_locvar(tno,name)) != NULL) v->flags &= ~UVF_LAZY;
+  }
+
+/* uvread needs the variables it has already located, whatever the
+   caller wants; corr and wcorr are always read on demand anyway. */
+
+  for(i=0; i < uv->presize; i++)
+    if(uv->prevar[i] != NULL) uv->prevar[i]->flags &= ~UVF_LAZY;
+  uv->flags &= ~UVF_INIT;
+}
+/************************************************************************/
 int uvscan_c(int tno,Const char *var)
 /**uvscan -- Scan a uv file until a variable changes.			*/
 /*&rjs                                                                  */
@@ -1904,6 +2131,7 @@ private int uv_scan(UV *uv, VARIABLE *vt)
         ERROR('f',(message,
 	  "Non-integral no. elements in variable %s, when scanning",v->name));
       if(!(v->flags & UVF_OVERRIDE) || v->type != H_BYTE){
+        UVFETCH(uv,v);
         v->length = v->flength;
         v->buf = Realloc( v->buf, (v->flength * intsize)/extsize );
         if(v->flags & UVF_OVERRIDE && v->flength > extsize)
@@ -1915,10 +2143,16 @@ private int uv_scan(UV *uv, VARIABLE *vt)
       break;
 
 /* Process the data of a variable. If we want to keep track of the value
-   of this variable, read it. */
+   of this variable, read it. Correlation data is only read (by UVFETCH)
+   when something wants it, so that records which are not selected cost
+   no more than their headers. */
      case VAR_DATA:
       offset += mroundup(UV_HDR_SIZE,extsize);
-      if(!(v->flags & UVF_OVERRIDE)){
+      if(v->flags & UVF_OVERRIDE){
+      } else if(v == uv->corr || v == uv->wcorr || (v->flags & UVF_LAZY)){
+	v->pending = offset;
+	changed = TRUE;
+      } else {
 	hread_c(uv->item,v->type,v->buf,offset,v->flength,&iostat);
 	CHECK(iostat,(message,"Error reading a variable value for %s, while UV scanning",v->name));
 	changed = TRUE;
@@ -1949,6 +2183,435 @@ private int uv_scan(UV *uv, VARIABLE *vt)
   return 0;
 }
 /************************************************************************/
+private void uv_fetch(UV *uv,VARIABLE *v)
+/*
+  Read the value of a variable that uv_scan has passed over.
+------------------------------------------------------------------------*/
+{
+  int iostat;
+
+  hread_c(uv->item,v->type,v->buf,v->pending,v->flength,&iostat);
+  CHECK(iostat,(message,"Error reading a variable value for %s",v->name));
+  v->pending = -1;
+}
+/************************************************************************/
+private char *uv_packed(UV *uv,int n)
+/*
+  Scratch space for n int2 values in disk format.
+------------------------------------------------------------------------*/
+{
+  if(uv->npacked < n){
+    uv->npacked = n;
+    uv->packed = Realloc(uv->packed,n*H_INT2_SIZE);
+  }
+  return uv->packed;
+}
+/************************************************************************/
+private void uv_fetch_scaled(UV *uv,VARIABLE *v,float *data,float scale,
+			     int start,int n)
+/*
+  Read values start to start+n-1 of the pending value of the int2
+  variable v straight into data, multiplied by scale. The value stays
+  pending, so nothing else is read or converted unless it is asked for.
+------------------------------------------------------------------------*/
+{
+  int iostat;
+  char *s;
+
+  s = uv_packed(uv,n);
+  hreadb_c(uv->item,s,v->pending+start*H_INT2_SIZE,n*H_INT2_SIZE,&iostat);
+  CHECK(iostat,(message,"Error reading a variable value for %s",v->name));
+  unpack16s_c(s,data,scale,n);
+}
+/************************************************************************/
+private void uv_put_scaled(UV *uv,VARIABLE *v,Const float *data,float scale,
+			   int n)
+/*
+  Write n reals, multiplied by scale, as the value of the int2 variable v.
+  This is uvputvrj_c of the truncated products for a variable with
+  UVF_NOCHECK set, packing in one pass without an integer copy.
+------------------------------------------------------------------------*/
+{
+  int iostat;
+  char *s;
+
+  if(v->length != H_INT2_SIZE*n){
+    v->length = H_INT2_SIZE * n;
+    var_size_hdr[0] = v->index;
+    hwriteb_c(uv->item,var_size_hdr,uv->offset,UV_HDR_SIZE,&iostat);
+    CHECK(iostat,(message,"Error writing variable-length header for %s, in UVWRITE",v->name));
+    hwritei_c(uv->item,&v->length,uv->offset+UV_HDR_SIZE,H_INT_SIZE,&iostat);
+    CHECK(iostat,(message,"Error writing variable-length for %s, in UVWRITE",v->name));
+    uv->offset += UV_ALIGN;
+  }
+  s = uv_packed(uv,n);
+  pack16s_c((float *)data,s,scale,n);
+  var_data_hdr[0] = v->index;
+  hwriteb_c(uv->item,var_data_hdr,uv->offset,UV_HDR_SIZE,&iostat);
+  CHECK(iostat,(message,"Error writing variable-value header for %s, in UVWRITE",v->name));
+  uv->offset += mroundup(UV_HDR_SIZE,H_INT2_SIZE);
+  hwriteb_c(uv->item,s,uv->offset,v->length,&iostat);
+  CHECK(iostat,(message,"Error writing variable-value for %s, in UVWRITE",v->name));
+  uv->offset = mroundup(uv->offset+v->length,UV_ALIGN);
+}
+/************************************************************************/
+private int uvidx_nchan(VARIABLE *v,int8 length)
+/*
+  The number of channels in a value of length bytes of the corr or wcorr
+  variable v (as NUMCHAN).
+------------------------------------------------------------------------*/
+{
+  if(v->type == H_INT2 || v->type == H_REAL)
+    return length / (2*external_size[v->type]);
+  return length / external_size[v->type];
+}
+/************************************************************************/
+private void uvidx_walk(UV *uv,off64_t from,off64_t to,int8 *chk,int8 *size,
+			int8 *fl,UVINDEX *idx)
+/*
+  Walk the record headers of the visdata stream from offset "from" (the
+  start of a record) up to offset "to", reading no variable values but
+  time. On return chk[i] and size[i] give the offset and length of the
+  latest value of variable i as of the last record boundary passed (-1 and
+  0 if there is none), and fl[0], fl[1] the corr and wcorr flag offsets
+  there. If idx is not NULL, the time runs met are appended to it.
+  Inputs:
+    uv		The uv data set.
+    from,to	Offsets in visdata to walk between.
+  Input/Output:
+    chk,size	Value offsets and lengths (uv->nvar of them).
+    fl		Flag offsets.
+    idx		Index to extend, or NULL.
+------------------------------------------------------------------------*/
+{
+  int8 poff[MAXVAR],psize[MAXVAR],flength[MAXVAR];
+  int touched[MAXVAR],ntouched,iostat,i,k,n,extsize,ncorr,nwcorr;
+  off64_t offset,rec_start;
+  double t,lastt=0;
+  char s[UV_HDR_SIZE];
+  VARIABLE *v;
+
+  ncorr  = (uv->corr  == NULL ? -1 : uv->corr  - uv->variable);
+  nwcorr = (uv->wcorr == NULL ? -1 : uv->wcorr - uv->variable);
+  for(i=0; i < uv->nvar; i++){
+    flength[i] = size[i];
+    poff[i] = -1;
+  }
+  if(idx != NULL && idx->nrun > 0) lastt = idx->time[idx->nrun-1];
+  ntouched = 0;
+  offset = rec_start = from;
+  while(offset < to){
+    hreadb_c(uv->item,s,offset,UV_HDR_SIZE,&iostat);
+    if(iostat == -1) break;
+    CHECK(iostat,(message,"Error reading a record header, while indexing"));
+    i = (unsigned char) *s;
+    if(*(s+2) != VAR_EOR){
+      if(i >= uv->nvar)
+	ERROR('f',(message,"Unknown variable %d, while indexing",i));
+      v = &uv->variable[i];
+      extsize = external_size[v->type];
+    }
+    switch(*(s+2)){
+     case VAR_SIZE:
+      hreadi_c(uv->item,&n,offset+UV_HDR_SIZE,H_INT_SIZE,&iostat);
+      CHECK(iostat,(message,"Error reading a variable-length for %s, while indexing",v->name));
+      flength[i] = n;
+      offset += UV_ALIGN;
+      break;
+     case VAR_DATA:
+      offset += mroundup(UV_HDR_SIZE,extsize);
+      if(poff[i] < 0) touched[ntouched++] = i;
+      poff[i] = offset;
+      psize[i] = flength[i];
+      if(idx != NULL && v == uv->time){
+	hreadd_c(uv->item,&t,offset,H_DBLE_SIZE,&iostat);
+	CHECK(iostat,(message,"Error reading the time, while indexing"));
+	if(idx->nrun == 0 || t != lastt){
+	  if(idx->nrun % UVIDX_STRIDE == 0){
+	    idx->ncheck++;
+	    idx->check = (int8 *)Realloc(idx->check,idx->ncheck*uv->nvar*sizeof(int8));
+	    idx->size  = (int8 *)Realloc(idx->size, idx->ncheck*uv->nvar*sizeof(int8));
+	    memcpy(idx->check+(idx->ncheck-1)*uv->nvar,chk,uv->nvar*sizeof(int8));
+	    memcpy(idx->size +(idx->ncheck-1)*uv->nvar,size,uv->nvar*sizeof(int8));
+	  }
+	  if(idx->nrun % 1024 == 0){
+	    idx->time  = (double *)Realloc(idx->time,(idx->nrun+1024)*sizeof(double));
+	    idx->start = (int8 *)Realloc(idx->start,3*(idx->nrun+1024)*sizeof(int8));
+	  }
+	  idx->time[idx->nrun] = lastt = t;
+	  idx->start[3*idx->nrun]   = rec_start;
+	  idx->start[3*idx->nrun+1] = fl[0];
+	  idx->start[3*idx->nrun+2] = fl[1];
+	  idx->nrun++;
+	}
+      }
+      offset = mroundup(offset+flength[i],UV_ALIGN);
+      break;
+     case VAR_EOR:
+      for(k=0; k < ntouched; k++){
+	i = touched[k];
+	chk[i] = poff[i];
+	size[i] = psize[i];
+	poff[i] = -1;
+	if(i == ncorr)  fl[0] += uvidx_nchan(uv->corr,size[i]);
+	if(i == nwcorr) fl[1] += uvidx_nchan(uv->wcorr,size[i]);
+      }
+      ntouched = 0;
+      offset += UV_ALIGN;
+      rec_start = offset;
+      break;
+     default:
+      ERROR('f',(message,"Unrecognised record code %d, when indexing",*(s+2)));
+    }
+  }
+}
+/************************************************************************/
+private void uvidx_free(UVINDEX *idx)
+{
+  if(idx == NULL) return;
+  if(idx->time  != NULL) free((char *)idx->time);
+  if(idx->start != NULL) free((char *)idx->start);
+  if(idx->check != NULL) free((char *)idx->check);
+  if(idx->size  != NULL) free((char *)idx->size);
+  free((char *)idx);
+}
+/************************************************************************/
+private UVINDEX *uvidx_new(void)
+{
+  UVINDEX *idx;
+  idx = (UVINDEX *)Malloc(sizeof(UVINDEX));
+  idx->vislen = idx->nvar = idx->nrun = idx->ncheck = 0;
+  idx->time = NULL;
+  idx->start = idx->check = idx->size = NULL;
+  return idx;
+}
+/************************************************************************/
+private UVINDEX *uvidx_load(UV *uv)
+/*
+  Read the "visindex" item, if there is one and it describes visdata as
+  it is now.
+------------------------------------------------------------------------*/
+{
+  int item,iostat;
+  int8 hdr[5],nc;
+  off64_t offset;
+  UVINDEX *idx;
+
+  haccess_c(uv->tno,&item,"visindex","read",&iostat);
+  if(iostat) return NULL;
+  hreadl_c(item,hdr,8,5*H_INT8_SIZE,&iostat);
+  if(iostat || hdr[0] != UVIDX_VERSION || hdr[1] != (int8)uv->max_offset ||
+     hdr[2] != uv->nvar || hdr[4] != UVIDX_STRIDE || hdr[3] < 0 ||
+     hsize_c(item) != 8 + 5*H_INT8_SIZE + hdr[3]*(H_DBLE_SIZE+3*H_INT8_SIZE) +
+	((hdr[3]+UVIDX_STRIDE-1)/UVIDX_STRIDE)*hdr[2]*2*H_INT8_SIZE){
+    hdaccess_c(item,&iostat);
+    return NULL;
+  }
+  idx = uvidx_new();
+  idx->vislen = hdr[1];
+  idx->nvar = hdr[2];
+  idx->nrun = hdr[3];
+  idx->ncheck = nc = (idx->nrun+UVIDX_STRIDE-1)/UVIDX_STRIDE;
+  idx->time  = (double *)Malloc(max(idx->nrun,1)*sizeof(double));
+  idx->start = (int8 *)Malloc(max(3*idx->nrun,1)*sizeof(int8));
+  idx->check = (int8 *)Malloc(max(nc*idx->nvar,1)*sizeof(int8));
+  idx->size  = (int8 *)Malloc(max(nc*idx->nvar,1)*sizeof(int8));
+  offset = 8 + 5*H_INT8_SIZE;
+  hreadd_c(item,idx->time,offset,idx->nrun*H_DBLE_SIZE,&iostat);
+  offset += idx->nrun*H_DBLE_SIZE;
+  if(!iostat) hreadl_c(item,idx->start,offset,3*idx->nrun*H_INT8_SIZE,&iostat);
+  offset += 3*idx->nrun*H_INT8_SIZE;
+  if(!iostat) hreadl_c(item,idx->check,offset,nc*idx->nvar*H_INT8_SIZE,&iostat);
+  offset += nc*idx->nvar*H_INT8_SIZE;
+  if(!iostat) hreadl_c(item,idx->size,offset,nc*idx->nvar*H_INT8_SIZE,&iostat);
+  if(iostat){
+    uvidx_free(idx);
+    idx = NULL;
+  }
+  hdaccess_c(item,&iostat);
+  return idx;
+}
+/************************************************************************/
+private int uvidx_save(UV *uv,UVINDEX *idx)
+/*
+  Write the index to the "visindex" item. Returns 0, or the error of
+  the write (-1 if the data set is not writable).
+------------------------------------------------------------------------*/
+{
+  int item,iostat,iostat2;
+  int8 hdr[5],nc;
+  off64_t offset;
+  char mode[3];
+
+  hmode_c(uv->tno,mode);
+  if(strcmp(mode,"rw")) return(-1);
+  haccess_c(uv->tno,&item,"visindex","write",&iostat);
+  if(iostat) return(iostat);
+  nc = idx->ncheck;
+  hdr[0] = UVIDX_VERSION;
+  hdr[1] = idx->vislen;
+  hdr[2] = idx->nvar;
+  hdr[3] = idx->nrun;
+  hdr[4] = UVIDX_STRIDE;
+  hwriteb_c(item,int8_item,0,ITEM_HDR_SIZE,&iostat);
+  if(!iostat) hwritel_c(item,hdr,8,5*H_INT8_SIZE,&iostat);
+  offset = 8 + 5*H_INT8_SIZE;
+  if(!iostat) hwrited_c(item,idx->time,offset,idx->nrun*H_DBLE_SIZE,&iostat);
+  offset += idx->nrun*H_DBLE_SIZE;
+  if(!iostat) hwritel_c(item,idx->start,offset,3*idx->nrun*H_INT8_SIZE,&iostat);
+  offset += 3*idx->nrun*H_INT8_SIZE;
+  if(!iostat) hwritel_c(item,idx->check,offset,nc*idx->nvar*H_INT8_SIZE,&iostat);
+  offset += nc*idx->nvar*H_INT8_SIZE;
+  if(!iostat) hwritel_c(item,idx->size,offset,nc*idx->nvar*H_INT8_SIZE,&iostat);
+  hdaccess_c(item,&iostat2);
+  return(iostat ? iostat : iostat2);
+}
+/************************************************************************/
+private UVINDEX *uvidx_get(UV *uv)
+/*
+  The index of a data set opened "old": loaded from "visindex" or, failing
+  that, built by walking the record headers. It is only kept in memory:
+  reading a data set never writes to it (see uvindex_c).
+------------------------------------------------------------------------*/
+{
+  UVINDEX *idx;
+  int8 *chk,*size,fl[2];
+  int i;
+
+  if(uv->index != NULL) return uv->index;
+  if(uv->flags & (UVF_NEW|UVF_APPEND))
+    BUG('f',"Cannot seek in a uv data set being written, in UVSEEK");
+  idx = uvidx_load(uv);
+  if(idx == NULL){
+    idx = uvidx_new();
+    idx->vislen = uv->max_offset;
+    idx->nvar = uv->nvar;
+    chk  = (int8 *)Malloc(max(uv->nvar,1)*sizeof(int8));
+    size = (int8 *)Malloc(max(uv->nvar,1)*sizeof(int8));
+    for(i=0; i < uv->nvar; i++){
+      chk[i] = -1;
+      size[i] = 0;
+    }
+    fl[0] = fl[1] = 0;
+    uvidx_walk(uv,0,uv->max_offset,chk,size,fl,idx);
+    free((char *)chk);
+    free((char *)size);
+  }
+  uv->index = idx;
+  return idx;
+}
+/************************************************************************/
+int uvindex_c(int tno)
+/**uvindex -- Save the record index of a uv data set with it.		*/
+/*:uv-i/o								*/
+/*+
+  Build the record index uvseek uses (if it is not already there) and save
+  it as the "visindex" item of an "old" uv data set, so that later opens
+  seek without a pass over the record headers.  The index is reused while
+  visdata keeps its length.
+
+  Input:
+    tno		The uv data set handle.
+  Output:
+    uvindex	0, or the error of the write (-1 if the data set is not
+		writable).						*/
+/*--									*/
+/*----------------------------------------------------------------------*/
+{
+  UV *uv;
+
+  uv = uvs[tno];
+  return(uvidx_save(uv,uvidx_get(uv)));
+}
+/************************************************************************/
+void uvseek_c(int tno,double time,int forward)
+/**uvseek -- Position a uv data set at a time, using its record index.	*/
+/*:uv-i/o								*/
+/*+
+  Position an "old" uv data set at the start of the first run of records
+  (in file order) with time >= the given time, so that the next uvread
+  returns its first record; or at the end of the file, if there is none.
+  Variables take the values they have there.  The index is read from
+  the "visindex" item (see uvindex) or, failing that, built by a quick
+  pass over the record headers the first time it is needed, and kept
+  until the data set is closed.
+
+  Input:
+    tno		The uv data set handle.
+    time	The time (Julian date) to seek to.
+    forward	If true, only runs from the current position on are
+		considered, and the data set never moves backwards: the
+		records skipped are those a time selection of "time"
+		onwards would discard.					*/
+/*--									*/
+/*----------------------------------------------------------------------*/
+{
+  UV *uv;
+  UVINDEX *idx;
+  VARIABLE *v;
+  int8 *chk,*size,fl[2];
+  int r,r0,c,i,iostat,intsize,extsize;
+  off64_t target;
+
+  uv = uvs[tno];
+  idx = uvidx_get(uv);
+
+/* Find the run to go to: runs start at increasing offsets. */
+
+  r0 = 0;
+  if(forward){
+    int lo = 0, hi = idx->nrun;
+    while(lo < hi){
+      int mid = (lo + hi) / 2;
+      if(idx->start[3*mid] <= uv->offset) lo = mid + 1;
+      else hi = mid;
+    }
+    r0 = (lo > 0 ? lo - 1 : 0);
+  }
+  for(r=r0; r < idx->nrun && idx->time[r] < time; r++);
+  if(r == idx->nrun){
+    uv->offset = uv->max_offset;
+    return;
+  }
+  target = idx->start[3*r];
+  if(forward && target <= uv->offset) return;
+
+/* Restore the variables from the checkpoint before the run, walking the
+   headers up to its start. */
+
+  c = r / UVIDX_STRIDE;
+  chk  = (int8 *)Malloc(max(uv->nvar,1)*sizeof(int8));
+  size = (int8 *)Malloc(max(uv->nvar,1)*sizeof(int8));
+  memcpy(chk, idx->check+c*uv->nvar,uv->nvar*sizeof(int8));
+  memcpy(size,idx->size +c*uv->nvar,uv->nvar*sizeof(int8));
+  fl[0] = idx->start[3*c*UVIDX_STRIDE+1];
+  fl[1] = idx->start[3*c*UVIDX_STRIDE+2];
+  uvidx_walk(uv,idx->start[3*c*UVIDX_STRIDE],target,chk,size,fl,NULL);
+
+/* The restored values count as updated by the next uvread, but for corr
+   and wcorr, which the run's first record sets. */
+
+  for(i=0, v = uv->variable; i < uv->nvar; i++, v++){
+    if(chk[i] < 0 || (v->flags & UVF_OVERRIDE) || v == uv->corr || v == uv->wcorr)
+      continue;
+    intsize = internal_size[v->type];
+    extsize = external_size[v->type];
+    v->length = v->flength = size[i];
+    v->buf = Realloc(v->buf,(v->flength*intsize)/extsize);
+    hread_c(uv->item,v->type,v->buf,chk[i],v->flength,&iostat);
+    CHECK(iostat,(message,"Error reading a variable value for %s, in UVSEEK",v->name));
+    v->pending = -1;
+    v->callno = uv->callno + 1;
+    uv->flags |= v->flags & (UVF_UPDATED | UVF_UPDATED_PLANET |
+			     UVF_UPDATED_SKYFREQ | UVF_UPDATED_UVW | UVF_COPY);
+  }
+  free((char *)chk);
+  free((char *)size);
+  uv->offset = target;
+  uv->corr_flags.offset = fl[0];
+  uv->wcorr_flags.offset = fl[1];
+}
+/************************************************************************/
 void uvwrite_c(int tno,Const double *preamble,Const float *data,
 	       Const int *flags,int n)
 /**uvwrite -- Write correlation data to a uv file.			*/
@@ -1981,12 +2644,12 @@ void uvwrite_c(int tno,Const double *preamble,Const float *data,
   int i,nchan,i1,i2,nuvw,itemp;
   float maxval,scale,*p,temp;
   double *d,dtemp;
-  int *q;
   char *counter,*status;
   FLAGS *flags_info;
   VARIABLE *v;
 
   uv = uvs[tno];
+  HCOUNT(HC_UVWRITE,1);
 
 /* Initialise things if this is the first call to uvwrite. */
 
@@ -2080,8 +2743,6 @@ void uvwrite_c(int tno,Const double *preamble,Const float *data,
   } else if(v->type == H_CMPLX) {
     uvputvrc_c(tno,v->name,data,n);
   } else {
-    if(v->length != 2*n*H_INT2_SIZE)
-      v->buf = Realloc(v->buf,2*n*sizeof(int));
     maxval = 0;
     p = (float *)data;
     for(i=0; i < 2*n; i++){
@@ -2092,12 +2753,7 @@ void uvwrite_c(int tno,Const double *preamble,Const float *data,
     if(maxval == 0) maxval = 1;
     scale = maxval / 32767;
     uvputvrr_c(tno,"tscale",&scale,1);
-    scale = 32767 / maxval;
-    p = (float *)data;
-    q = (int *)v->buf;
-    for(i=0; i < 2*n; i++) *q++ = scale * *p++;
-    q = (int *)v->buf;
-    uvputvrj_c(tno,v->name,(int *)v->buf,2*n);
+    uv_put_scaled(uv,v,data,32767 / maxval,2*n);
   }
 
 /* Write out the preamble. */
@@ -2256,6 +2912,32 @@ void uvsela_c(int tno,Const char *object,Const char *string,int datasel)
   }
 }
 /************************************************************************/
+void uvdecimate_c(int tno,int n,int phase)
+/**uvdecimate -- Read only every n'th integration.			*/
+/*:uv-i/o								*/
+/*+									*/
+/*
+  After this, uvread only returns the records of every n'th integration
+  (run of records with the same time) of those that pass uvselect,
+  starting with integration number phase (counting from 0 since the file
+  was opened or rewound). The records in between are skipped without
+  reading their correlation data or flags.
+
+  Input:
+    tno		The uv data file handle.
+    n		Keep one integration in n (1 keeps them all).
+    phase	The first integration kept.				*/
+/*--									*/
+/*----------------------------------------------------------------------*/
+{
+  UV *uv;
+
+  if(n < 1) ERROR('f',(message,"Bad decimation %d, in UVDECIMATE",n));
+  uv = uvs[tno];
+  uv->decimate = n;
+  uv->decphase = phase;
+}
+/************************************************************************/
 void uvselect_c(int tno,Const char *object,double p1,double p2,int datasel)
 /**uvselect -- Select or reject uv data.				*/
 /*&rjs                                                                  */
@@ -2299,10 +2981,12 @@ void uvselect_c(int tno,Const char *object,double p1,double p2,int datasel)
 
   discard = !datasel;
   uv->flags &= ~UVF_INIT;
+  uv->seltab.compiled = -1;
 
   if(!strcmp(object,"clear")){
     uv_free_select(uv->select);
     uv->select = NULL;
+    uv->seltab.maxant = 0;
     return;
   }
 
@@ -2508,6 +3192,7 @@ void uvselect_c(int tno,Const char *object,double p1,double p2,int datasel)
     i2 = min(p1, p2) + 0.5;
     if(i1 < 0 || i1 > MAXANT) ERROR('f',(message,"bad antennae %d",i1));
     if(i2 < 0 || i2 > MAXANT) ERROR('f',(message,"bad antennae %d",i2));
+    uv->seltab.maxant = max(uv->seltab.maxant,i1);
     if(i1 == 0){
       for(i=0; i < MAXANT*(MAXANT+1)/2; i++)sel->ants[i] = discard;
     } else if(i2 == 0){
@@ -2825,9 +3510,44 @@ void uvread_c(int tno,double *preamble,float *data,int *flags,int n,int *nread)
 		is returned.						*/
 /*--									*/
 /*----------------------------------------------------------------------*/
+{
+  long long t0 = hcount_clock();
+
+  uvread_rec(tno,preamble,data,flags,n,nread);
+  HCOUNT(HC_UVREAD,1);
+  if(*nread > 0) HCOUNT(HC_RECORDS,1);
+  if(t0) HCOUNT(HC_UVREAD_NS,hcount_clock() - t0);
+}
+/************************************************************************/
+void uvreadmeta_c(int tno,double *preamble,int *nread)
+/**uvreadmeta -- Skip to the next selected record, returning its preamble.*/
+/*:uv-i/o								*/
+/*+
+  This scans and selects records exactly as uvread does, but leaves the
+  correlation data of the record it stops at undecoded. Variables (and
+  uvrdvr) reflect that record, as after uvread.
+
+  Input:
+    tno		Handle of the uv data set.
+  Output:
+    preamble	The preamble of the record, as uvread returns it.
+    nread	Number of correlations of the record (its channel count
+		for the data linetype). On end-of-file, zero is returned. */
+/*--									*/
+/*----------------------------------------------------------------------*/
+{
+  uvread_rec(tno,preamble,NULL,NULL,0,nread);
+}
+/************************************************************************/
+private void uvread_rec(int tno,double *preamble,float *data,int *flags,int n,int *nread)
+/*
+  The work of uvread_c, which counts its calls and time (see hcount_c),
+  and of uvreadmeta_c (for data NULL).
+------------------------------------------------------------------------*/
 {
   UV *uv;
   int more,nchan;
+  long long t0;
   VARIABLE *v;
   uv = uvs[tno];
 
@@ -2868,6 +3588,8 @@ void uvread_c(int tno,double *preamble,float *data,int *flags,int n,int *nread)
     uv->win = &truewin;
     if(uv->select != NULL) more = uvread_select(uv);
     else		   more = FALSE;
+    if(!more && uv->time != NULL) more = uvread_decimate(uv);
+    if(more) HCOUNT(HC_SKIPPED,1);
   }
 
 /* Update the planet parameters, if needed. */
@@ -2877,7 +3599,14 @@ void uvread_c(int tno,double *preamble,float *data,int *flags,int n,int *nread)
 
 /* Apply linetype processing and planet scaling. */
 
+  if(data == NULL){
+    *nread = NUMCHAN(v);
+    if(*nread > 0) uvread_preamble(uv,preamble);
+    return;
+  }
+  t0 = hcount_clock();
   *nread = uvread_line(uv,&(uv->data_line),data,n,flags,&(uv->actual_line));
+  if(t0) HCOUNT(HC_UNPACK_NS,hcount_clock() - t0);
   if(*nread == 0)return;
 
 /* Get preamble variables. */
@@ -2901,6 +3630,7 @@ private void uvread_preamble(UV *uv, double *preamble)
 
   for(i=0; i < uv->presize; i++){
     v = uv->prevar[i];
+    if(v != NULL) UVFETCH(uv,v);
     if(v == NULL){
       *preamble++ = 0;
     } else if(v == uv->coord){
@@ -3143,7 +3873,106 @@ private void uvread_updated_planet(UV *uv)
   uv->flags &= ~UVF_UPDATED_PLANET;
 }
 /************************************************************************/
+private int uvread_decimate(UV *uv)
+/*
+  Apply decimation to a selected record: integrations (runs of records
+  with the same time) are counted, and only every uv->decimate'th is
+  kept. Returns TRUE if the record is to be discarded.
+------------------------------------------------------------------------*/
+{
+  double time;
+
+  time = *(double *)uv->time->buf;
+  if(time != uv->dectime){
+    uv->intcnt++;
+    uv->dectime = time;
+  }
+  return ((uv->intcnt - uv->decphase) % uv->decimate != 0);
+}
+/************************************************************************/
 /* return 1 if record not selected, 0 if selected for output            */
+private void uvread_selcompile(UV *uv)
+/*
+  Build the baseline/polarisation lookup table of the selection chain
+  (see SELTAB), if every clause of it is an antennae and polarisation
+  selection. The table covers the baselines of antennae up to the larger
+  of "nants" and the highest antenna named; others are left to
+  uvread_select to walk the chain for.
+------------------------------------------------------------------------*/
+{
+  SELTAB *tab;
+  SELECT *sel;
+  OPERS *op;
+  VARIABLE *v;
+  unsigned char *state;
+  int i,k,b,n,discard,nsel,*poldis;
+
+  tab = &(uv->seltab);
+  tab->compiled = 0;
+  if(tab->bits != NULL) free((char *)tab->bits);
+  tab->bits = NULL;
+
+/* Check that the chain is simple enough, and gather its polarisations. */
+
+  tab->npol = 0;
+  for(nsel = 0, sel = uv->select; sel != NULL; sel = sel->fwd, nsel++){
+    if(sel->amp.select || sel->win.select) return;
+    for(n=0, op = sel->opers; n < sel->noper; n++, op++){
+      if(op->type != SEL_POL) return;
+      for(k=0; k < tab->npol && tab->pols[k] != (int)op->loval; k++);
+      if(k == tab->npol){
+	if(tab->npol == MAXSELPOL) return;
+	tab->pols[tab->npol++] = op->loval;
+      }
+    }
+  }
+
+  tab->nants = tab->maxant;
+  v = uv_locvar(uv->tno,"nants");
+  if(v != NULL && v->buf != NULL && v->type == H_INT)
+    tab->nants = max(tab->nants,*(int *)(v->buf));
+  tab->nants = min(tab->nants,MAXANT);
+  tab->nbl = (tab->nants*(tab->nants+1))/2;
+
+/* The outcome of the polarisation clauses of each SELECT, for each
+   polarisation of the table (the last being "any other"). */
+
+  poldis = (int *)Malloc(sizeof(int)*nsel*(tab->npol+1));
+  for(i=0, sel = uv->select; sel != NULL; sel = sel->fwd, i++){
+    for(k=0; k <= tab->npol; k++){
+      discard = FALSE;
+      if(sel->noper > 0){
+	discard = !sel->opers->discard;
+	for(n=0, op = sel->opers; n < sel->noper; n++, op++)
+	  if(k < tab->npol && op->loval == tab->pols[k]) discard = op->discard;
+      }
+      poldis[i*(tab->npol+1)+k] = discard;
+    }
+  }
+
+/* Run the chain over all baselines at once, one polarisation at a time. */
+
+  tab->bits = (unsigned char *)Malloc((tab->npol+1)*((tab->nbl+7)/8)+1);
+  memset(tab->bits,0,(tab->npol+1)*((tab->nbl+7)/8)+1);
+  state = (unsigned char *)Malloc(tab->nbl+1);
+  for(k=0; k <= tab->npol; k++){
+    memset(state,TRUE,tab->nbl);
+    for(i=0, sel = uv->select; sel != NULL; sel = sel->fwd, i++){
+      for(b=0; b < tab->nbl; b++){
+	if(state[b] != (sel->and != 0)) continue;
+	discard = sel->selants ? sel->ants[b] : FALSE;
+	if(!discard) discard = poldis[i*(tab->npol+1)+k];
+	state[b] = !discard;
+      }
+    }
+    for(b=0; b < tab->nbl; b++)
+      if(state[b]) tab->bits[k*((tab->nbl+7)/8) + b/8] |= 1 << (b%8);
+  }
+  free((char *)state);
+  free((char *)poldis);
+  tab->compiled = 1;
+}
+/************************************************************************/
 private int uvread_select(UV *uv)
 {
   int i,i1,i2,bl,pol,n,nants,inc,selectit,selprev,discard,binlo,binhi,on;
@@ -3155,6 +3984,23 @@ private int uvread_select(UV *uv)
   SELECT *sel;
   OPERS *op;
   WINDOW *win;
+  SELTAB *tab;
+
+/* Antennae and polarisation only selections are a probe of the table. */
+
+  tab = &(uv->seltab);
+  if(tab->compiled < 0) uvread_selcompile(uv);
+  if(tab->compiled){
+    bl = *((float *)(uv->bl->buf)) + 0.5;
+    uvbasant_c(bl,&i1,&i2);
+    if(i1 >= 1 && i1 <= i2 && i2 <= tab->nants){
+      if(uv->need_pol) pol = *(int *)(uv->pol->buf);
+      else	       pol = 1;
+      for(i=0; i < tab->npol && tab->pols[i] != pol; i++);
+      n = (i2*(i2-1))/2+i1-1;
+      return !(tab->bits[i*((tab->nbl+7)/8) + n/8] & (1 << (n%8)));
+    }
+  }
 
   selprev = TRUE;
 
@@ -3986,6 +4832,11 @@ private VARIABLE *uv_checkvar(int tno,char *varname,int type)
 	"Variable %s has the wrong data type, in UVREAD",varname));
   else if(v->buf == NULL || v->length <= 0)ERROR('f',(message,
 	"Variable %s was not initialised before it was required, in UVREAD",varname));
+
+/* uvread itself uses this variable, so always read it. */
+
+  v->flags &= ~UVF_LAZY;
+  UVFETCH(uvs[tno],v);
   return(v);
 }
 /************************************************************************/
@@ -4026,11 +4877,17 @@ private int uvread_line(UV *uv,LINE_INFO *line,float *data,
     flag_info = &(uv->corr_flags);
   }
   nchan = NUMCHAN(v);
-  if(! flag_info->init ) uvread_flags(uv,v,flag_info,nchan);
+  if(! flag_info->init ){
+    long long t0 = hcount_clock();
+    if(uv->amp->select && uv->apply_amp) UVFETCH(uv,v);
+    uvread_flags(uv,v,flag_info,nchan);
+    if(t0) HCOUNT(HC_FLAGS_NS,hcount_clock() - t0);
+  }
 
 /* Handle velocity linetype. */
 
   if(line->linetype == LINE_VELOCITY || line->linetype == LINE_FELOCITY){
+    UVFETCH(uv,v);
     uvread_velocity(uv,line,data,flags,nsize,actual);
     return(line->n);
   }
@@ -4075,14 +4932,20 @@ private int uvread_line(UV *uv,LINE_INFO *line,float *data,
   flagin = flag_info->flags + start;
   d = data;
 
-/* Handle the common case of just a straight copy of the correlation data. */
+/* Handle the common case of just a straight copy of the correlation data.
+   Scaled integers not yet read are decoded straight from the file. */
 
   if(width == 1 && ( step == 0 || n == 1)){
     if(v->type == H_INT2){
       scale *= *(float *)uv->tscale->buf;
-      di   = (int *)v->buf + 2*start;
-      for(i=0; i < 2*n; i++) *d++ = scale * *di++;
+      if(v->pending >= 0){
+	uv_fetch_scaled(uv,v,d,scale,2*start,2*n);
+      } else {
+        di   = (int *)v->buf + 2*start;
+        for(i=0; i < 2*n; i++) *d++ = scale * *di++;
+      }
     } else {
+      UVFETCH(uv,v);
       df   = (float *)v->buf + 2*start;
       if(scale != 1)for(i=0; i < 2*n; i++) *d++ = scale * *df++;
       else	    memcpy((char *)d,(char *)df,2*sizeof(float)*n);
@@ -4092,6 +4955,7 @@ private int uvread_line(UV *uv,LINE_INFO *line,float *data,
 /* Handle the case of averaged, scaled integers. */
 
   } else if(v->type == H_INT2){
+    UVFETCH(uv,v);
     di = (int *)(v->buf) + 2*start;
     scale *= *(float *)uv->tscale->buf;
     for(i=0; i<n; i++){
@@ -4111,6 +4975,7 @@ private int uvread_line(UV *uv,LINE_INFO *line,float *data,
 /* Handle the case of averaged, reals. */
 
   } else {
+    UVFETCH(uv,v);
     df = (float *)(v->buf) + 2*start;
     for(i=0; i<n; i++){
       ref = 0; imf = 0; nc  = 0;
@@ -54,6 +54,7 @@
 /*                                                                            */
 /******************************************************************************/
 
+#include <Python.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
@@ -148,8 +149,10 @@ static char   *words[4] = { "get", "put", "filled", "emptied" };
 static int     nio=0;
 
 /* static functions */
+#ifdef XYZ_DEBUG
 static void get_test(int interactive);
 static int putnio(int x);
+#endif
 static void ferr(char *string, int arg);
 static void get_put_data(int tno, int virpix_off, float *data, int *mask, int *ndata, int dim_sub);
 static void do_copy(float *bufptr, float *bufend, int DIR, float *data, int *mask);
@@ -169,22 +172,28 @@ static void fill_buffer(int tno, int start, int last);
 static void empty_buffer(int tno, int start, int last);
 static void loop_buffer(int tno, int start, int last, int *newstart);
 static void zero(int bl_tr, int tno);
-static void testprint(int tno, int virpix_off, int virpix_lst);
 static void limprint(char *string, int lower[], int upper[]);
+#ifdef XYZ_DEBUG
+static void testprint(int tno, int virpix_off, int virpix_lst);
 static void testsearch(int callnr, int coords[], int filoff, int viroff);
 
- static void get_test(int interactive)
+static void get_test(int interactive)
 {
-    if(interactive)printf("iTest >"); scanf("%d",&itest);
-    if(interactive)printf("rTest >"); scanf("%d",&rtest);
-    if(interactive)printf("oTest >"); scanf("%d",&otest);
-    if(interactive)printf("vTest >"); scanf("%d",&vtest);
+    if(interactive)printf("iTest >");
+    if(scanf("%d",&itest) != 1) itest = 0;
+    if(interactive)printf("rTest >");
+    if(scanf("%d",&rtest) != 1) rtest = 0;
+    if(interactive)printf("oTest >");
+    if(scanf("%d",&otest) != 1) otest = 0;
+    if(interactive)printf("vTest >");
+    if(scanf("%d",&vtest) != 1) vtest = 0;
 }
 
 static int putnio(int x) 
 {
   return nio;
 }
+#endif
 
 
 /******************************************************************************/
@@ -242,7 +251,7 @@ void xyzopen_c( int *handle, Const char *name, Const char *status,
     n_axis = *naxis;
     if(      !strcmp( "old",     status ) ) { access = OLD; mode = "read";  }
     else if( !strcmp( "new",     status ) ) { access = NEW; mode = "write"; }
-    else { bug_c( 'f', "xyzopen: Unrecognised status" ); printf("bug\n"); }
+    else { bug_c( 'f', "xyzopen: Unrecognised status" ); return; }
 
     hopen_c(  &tno, name, status, &iostat );                   check(iostat);
     haccess_c( tno, &imgs[tno].itno, "image", mode, &iostat ); check(iostat);
@@ -554,8 +563,7 @@ sure it is never deallocated.                                                 */
 
 void xyzmkbuf_c()
 {
-   int i;
-   i = bufferallocation( MAXBUF );
+   (void)bufferallocation( MAXBUF );
    neverfree = TRUE;
 }
 
@@ -963,6 +971,7 @@ void xyzwrite_c(int tno, Const int *coords, Const float *data,
 	 dim++; }
     MODE=PUT; 
     get_put_data( tno, virpix_off, (float *)data, (int *)mask, (int *)ndata, dim_sub );
+    written[tno] = TRUE;
 }
 
 
@@ -1342,10 +1351,10 @@ static void get_buflen(void)
     int  tno;
     int  try, maxsize, size;
     int *mbufpt, cnt;
-    if(itest)printf("# bytes per real %d\n",sizeof(float));
+    if(itest)printf("# bytes per real %d\n",(int)sizeof(float));
 
     maxsize = 0;
-    for( tno=1; tno<=MAXOPEN; tno++ ) {
+    for( tno=0; tno<MAXOPEN; tno++ ) {
       if( imgs[tno].itno != 0 ) {
 	 size    = bufs[tno].cubesize[bufs[tno].naxis];
 	 maxsize = ( (maxsize<size) ? size : maxsize );
@@ -1408,7 +1417,10 @@ static void copy_to_one_d( int tno )
     imgscubesize[d]=imgs[tno].cubesize[d];bufscubesize[d]=bufs[tno].cubesize[d];
     imgsblc[d]     =imgs[tno].blc[d];     bufsblc[d]     =0;
     imgstrc[d]     =imgs[tno].trc[d];     bufstrc[d]     =bufs[tno].axlen[d]-1;
+    imgscsz[d]     =0;                    bufscsz[d]     =0;
+    if( d > 0 ) {
     imgscsz[d]     =imgscubesize[d-1];    bufscsz[d]     =bufscubesize[d-1];
+    }
     imgslower[d]   =imgs[tno].lower[d];
     imgsupper[d]   =imgs[tno].upper[d];
     axnumr[d]      =axnum[tno][d];
@@ -1782,6 +1794,7 @@ static void zero( int bl_tr, int tno )
 /******************************************************************************/
 /******************************************************************************/
 
+#ifdef XYZ_DEBUG
 static void testprint( int tno, int virpix_off, int virpix_lst )
 {   
     int vircoo[ARRSIZ];
@@ -1807,6 +1820,8 @@ static void testprint( int tno, int virpix_off, int virpix_lst )
     }
 }
 
+#endif
+
 static void limprint( char *string, int *lower, int *upper )
 {
     printf( "%s:", string );
@@ -1815,6 +1830,7 @@ static void limprint( char *string, int *lower, int *upper )
     printf( "\n");
 }
 
+#ifdef XYZ_DEBUG
 static void testsearch( int callnr, int *coords, int filoff, int viroff )
 {
     if( callnr == 2 ) printf( " -> " );
@@ -1822,6 +1838,7 @@ static void testsearch( int callnr, int *coords, int filoff, int viroff )
     if( callnr == 1 ) printf( "  filoff %d viroff %d", filoff, viroff );
     if( callnr == 2 ) printf( "\n" );
 }
+#endif
 
 
 
@@ -1,8 +1,23 @@
 #include <Python.h>
 #include "numpy/arrayobject.h"
 #include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstring>
+#include <algorithm>
 #include "aipy_compat.h"
+#include "aipy_stats.h"
+#define AIPY_POOL_MAIN
+#include "aipy_pool.h"
 #include "miriad_wrap.h"
+#include "sma_read.h"
+#include "jplcat.h"
+#include "uv_average.h"
+#include "gain_apply.h"
 
 #define MAXVAR 100000
 
@@ -17,15 +32,19 @@
 typedef struct {
     PyObject_HEAD
     int tno;
-    long decimate;
-    long decphase;
-    long intcnt;
-    double curtime;
+    PyThread_type_lock lock;    // held while MIRIAD works on tno
+    PyArrayObject *snap;        // values of the tracked variables, or NULL
+    std::vector<std::string> *snap_names;
+    UVAverage *avg;             // for raw_read_average, or NULL
 } UVObject;
 
 // Deallocate memory when Python object is deleted
 static void UVObject_dealloc(UVObject *self) {
     if (self->tno != -1) uvclose_c(self->tno);
+    if (self->lock != NULL) PyThread_free_lock(self->lock);
+    Py_XDECREF(self->snap);
+    delete self->snap_names;
+    delete self->avg;
     Py_TYPE(self)->tp_free((PyObject*)self);
 }
 
@@ -34,9 +53,80 @@ static PyObject *UVObject_new(PyTypeObject *type,
         PyObject *args, PyObject *kwds) {
     UVObject *self;
     self = (UVObject *) type->tp_alloc(type, 0);
+    if (self == NULL) return NULL;
+    self->tno = -1;
+    self->snap = NULL;
+    self->snap_names = NULL;
+    self->avg = NULL;
+    self->lock = PyThread_allocate_lock();
+    if (self->lock == NULL) {
+        Py_DECREF(self);
+        return PyErr_NoMemory();
+    }
     return (PyObject *) self;
 }
 
+/* Holds uv's lock for the life of the object (a no-op for NULL), waiting
+ * with the GIL released if another thread is reading or writing uv.
+ */
+struct UVLock {
+    PyThread_type_lock lock;
+    UVLock(UVObject *uv) : lock(uv == NULL ? NULL : uv->lock) {
+        if (lock == NULL || PyThread_acquire_lock(lock, NOWAIT_LOCK)) return;
+        Py_BEGIN_ALLOW_THREADS
+        PyThread_acquire_lock(lock, WAIT_LOCK);
+        Py_END_ALLOW_THREADS
+    }
+    ~UVLock() { if (lock != NULL) PyThread_release_lock(lock); }
+};
+
+/* Runs f() (MIRIAD calls on self->tno only, no Python API) with self's
+ * lock held, from any thread.  Returns false with MIRIAD's message in err
+ * if it failed.
+ */
+template <class F>
+static bool uv_run(UVObject *self, F f, std::string &err) {
+    bool ok = true;
+    PyThread_acquire_lock(self->lock, WAIT_LOCK);
+    try {
+        f();
+    } catch (MiriadError &e) {
+        ok = false;
+        err = e.get_message();
+    }
+    PyThread_release_lock(self->lock);
+    return ok;
+}
+
+/* Runs f() (as for uv_run) with the GIL released, so other threads run
+ * meanwhile and calls on one data set take turns.  Returns -1 with a
+ * RuntimeError set if MIRIAD failed, else 0.
+ */
+template <class F>
+static int uv_call(UVObject *self, F f) {
+    std::string err;
+    bool failed;
+    Py_BEGIN_ALLOW_THREADS
+    failed = !uv_run(self, f, err);
+    Py_END_ALLOW_THREADS
+    if (failed) {
+        PyErr_Format(PyExc_RuntimeError, "%s", err.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+/* Refreshes self's snapshot of the tracked variables (NaN for one with no
+ * value) after a read.  MIRIAD calls only, so it may run in uv_call.
+ */
+static void uv_snapshot(UVObject *self) {
+    if (self->snap == NULL) return;
+    double nan = Py_NAN, *s = (double *) PyArray_DATA(self->snap);
+    for (size_t k=0; k < self->snap_names->size(); k++)
+        uvrdvr_c(self->tno, H_DBLE, (*self->snap_names)[k].c_str(),
+            (char *) (s + k), (char *) &nan, 1);
+}
+
 // A simple error handler that we can use in bug.c
 void error_handler(void) {
     throw MiriadError("Runtime error in MIRIAD");
@@ -46,10 +136,6 @@ void error_handler(void) {
 static int UVObject_init(UVObject *self, PyObject *args, PyObject *kwds) {
     char *name=NULL, *status=NULL, *corrmode=NULL;
     self->tno = -1;
-    self->decimate = 1;
-    self->decphase = 0;
-    self->intcnt = -1;
-    self->curtime = -1;
     // Parse arguments and typecheck
     if (!PyArg_ParseTuple(args, "sss", &name, &status, &corrmode)) return -1;
     switch (corrmode[0]) {
@@ -60,14 +146,13 @@ static int UVObject_init(UVObject *self, PyObject *args, PyObject *kwds) {
     }
     // Setup an error handler so MIRIAD doesn't just exit
     bugrecover_c(error_handler);
-    try {
+    if (uv_call(self, [&]() {
         uvopen_c(&self->tno, name, status);
         // Statically set the preamble format
         uvset_c(self->tno,"preamble","uvw/time/baseline",0,0.,0.,0.);
         uvset_c(self->tno,"corr",corrmode,0,0.,0.,0.);
-    } catch (MiriadError &e) {
+    }) != 0) {
         self->tno = -1;
-        PyErr_Format(PyExc_RuntimeError, "%s", e.get_message());
         return -1;
     }
     return 0;
@@ -81,11 +166,66 @@ static int UVObject_init(UVObject *self, PyObject *args, PyObject *kwds) {
            |__/
 */
 
-// Thin wrapper over uvrewind_c
+// Thin wrapper over uvrewind_c, which also clears the averager
 PyObject * UVObject_rewind(UVObject *self) {
+    UVLock lock(self);
     uvrewind_c(self->tno);
-    self->intcnt = -1;
-    self->curtime = -1;
+    if (self->avg != NULL) self->avg->clear();
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+/* Reads the variables of the first record (without decoding its data or
+ * flags) and rewinds, so that they have values before the first read */
+PyObject * UVObject_peek(UVObject *self) {
+    if (uv_call(self, [&]() {
+        uvnext_c(self->tno);
+        uvrewind_c(self->tno);
+    }) != 0) return NULL;
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+// The names and types of the variables, as parsed from vartable on open
+PyObject * UVObject_vartable(UVObject *self) {
+    char name[64], type;
+    PyObject *rv = PyDict_New();
+    if (rv == NULL) return NULL;
+    UVLock lock(self);
+    for (int i=0; uvvarinfo_c(self->tno, i, name, &type); i++) {
+        PyObject *t = PyString_FromStringAndSize(&type, 1);
+        if (t == NULL || PyDict_SetItemString(rv, name, t) < 0) {
+            Py_XDECREF(t);
+            Py_DECREF(rv);
+            return NULL;
+        }
+        Py_DECREF(t);
+    }
+    return rv;
+}
+
+// A thin wrapper over uvseek_c, which also clears the averager
+PyObject * UVObject_seek_time(UVObject *self, PyObject *args) {
+    double t;
+    int forward=0;
+    if (!PyArg_ParseTuple(args, "d|i", &t, &forward)) return NULL;
+    if (uv_call(self, [&]() {
+        uvseek_c(self->tno, t, forward);
+        if (self->avg != NULL) self->avg->clear();
+    }) != 0) return NULL;
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+// A thin wrapper over uvindex_c
+PyObject * UVObject_write_index(UVObject *self) {
+    int rv=0;
+    if (uv_call(self, [&]() { rv = uvindex_c(self->tno); }) != 0) return NULL;
+    if (rv != 0) {
+        PyErr_Format(PyExc_RuntimeError, rv < 0 ? "the data set is not writable"
+                     : "error %d writing the record index", rv);
+        return NULL;
+    }
     Py_INCREF(Py_None);
     return Py_None;
 }
@@ -105,22 +245,13 @@ PyObject * UVObject_read(UVObject *self, PyObject *args) {
     CHK_NULL(data);
     flags = (PyArrayObject *) PyArray_SimpleNew(1, data_dims, NPY_INT);
     CHK_NULL(flags);
-    while (1) {
-        // Here is the MIRIAD call
-        try {
-            uvread_c(self->tno, preamble,
-                     (float *)PyArray_DATA(data), (int *)PyArray_DATA(flags), n2read, &nread);
-        } catch (MiriadError &e) {
-            PyErr_Format(PyExc_RuntimeError, "%s", e.get_message());
-            return NULL;
-        }
-        if (preamble[3] != self->curtime) {
-            self->intcnt += 1;
-            self->curtime = preamble[3];
-        }
-        if ((self->intcnt-self->decphase) % self->decimate == 0 || nread==0) {
-            break;
-        }
+    if (uv_call(self, [&]() {
+        uvread_c(self->tno, preamble,
+            (float *)PyArray_DATA(data), (int *)PyArray_DATA(flags), n2read, &nread);
+        if (nread > 0) uv_snapshot(self);
+    }) != 0) {
+        Py_DECREF(data); Py_DECREF(flags);
+        return NULL;
     }
     // Now we build a return value of ((uvw,t,(i,j)), data, flags, nread)
     npy_intp uvw_dims[1] = {3};
@@ -139,6 +270,484 @@ PyObject * UVObject_read(UVObject *self, PyObject *args) {
     return rv;
 }
 
+// Whether a is a C-contiguous array of the given type and shape (n,) or
+// (n,m)
+static bool chk_block(PyArrayObject *a, int type, npy_intp n, npy_intp m) {
+    if (TYPE(a) != type || !PyArray_ISCARRAY_RO(a) || DIM(a,0) != n) return false;
+    return m < 0 ? RANK(a) == 1 : (RANK(a) == 2 && DIM(a,1) == m);
+}
+
+/* Parses vars, a sequence of (name, array) pairs with each array a
+ * C-contiguous (n,) int16, int32, float32 or float64 array (for Miriad
+ * types j, i, r and d), into names, vals and htypes.  Returns vars as a
+ * new reference to a fast sequence, which keeps the names alive, or NULL
+ * with an exception set.
+ */
+static PyObject *block_vars(PyObject *vars, npy_intp n,
+        std::vector<std::string> &names, std::vector<PyArrayObject *> &vals,
+        std::vector<int> &htypes) {
+    PyObject *seq = PySequence_Fast(vars, "vars must be a sequence of (name, array) pairs");
+    if (seq == NULL) return NULL;
+    for (npy_intp k=0; k < PySequence_Fast_GET_SIZE(seq); k++) {
+        char *name;
+        PyArrayObject *a;
+        int htype;
+        if (!PyArg_ParseTuple(PySequence_Fast_GET_ITEM(seq, k), "sO!", &name,
+                &PyArray_Type, &a)) {
+            Py_DECREF(seq);
+            return NULL;
+        }
+        switch (RANK(a) == 1 && DIM(a,0) == n && PyArray_ISCARRAY_RO(a) ? TYPE(a) : -1) {
+            case NPY_SHORT: htype = H_INT2; break;
+            case NPY_INT: htype = H_INT; break;
+            case NPY_FLOAT: htype = H_REAL; break;
+            case NPY_DOUBLE: htype = H_DBLE; break;
+            default:
+                PyErr_Format(PyExc_ValueError, "array for variable \"%s\" must be a "
+                    "C-contiguous (n,) int16, int32, float32 or float64 array", name);
+                Py_DECREF(seq);
+                return NULL;
+        }
+        names.push_back(name);
+        vals.push_back(a);
+        htypes.push_back(htype);
+    }
+    return seq;
+}
+
+// Scratch flags for raw_read_block, raw_read_into and raw_write_from
+static thread_local std::vector<int> flag_buf;
+
+/* Reads up to n records (the length of uvw) straight into preallocated,
+ * C-contiguous arrays: uvw (n,3) and t (n,) float64, ij (n,2) int32, and
+ * data (n,nchan) complex64 and flags (n,nchan) int32 or bool (valid where
+ * true, or invalid if masked; bool flags are narrowed a record at a time,
+ * so no int32 block is ever built).  vars, if given,
+ * pairs variable names with (n,) arrays (int16, int32, float32 or float64,
+ * for Miriad types j, i, r and d) that receive the first value of the
+ * variable after each record.  Channels past the end of a short record are
+ * zeroed and flagged.  Returns the number of records read.
+ */
+PyObject * UVObject_read_block(UVObject *self, PyObject *args) {
+    PyArrayObject *uvw, *t, *ij, *data, *flags;
+    PyObject *vars=NULL, *seq=NULL;
+    std::vector<std::string> names;
+    std::vector<PyArrayObject *> vals;
+    std::vector<int> htypes;
+    double preamble[PREAMBLE_SIZE];
+    npy_intp n, nchan, k, nvar=0;
+    int masked=0;
+    if (!PyArg_ParseTuple(args, "O!O!O!O!O!|Oi", &PyArray_Type, &uvw,
+            &PyArray_Type, &t, &PyArray_Type, &ij, &PyArray_Type, &data,
+            &PyArray_Type, &flags, &vars, &masked)) return NULL;
+    n = DIM(uvw,0);
+    nchan = RANK(data) == 2 ? DIM(data,1) : 0;
+    bool bflags = chk_block(flags, NPY_BOOL, n, nchan);
+    if (!chk_block(uvw, NPY_DOUBLE, n, 3) || !chk_block(t, NPY_DOUBLE, n, -1)
+            || !chk_block(ij, NPY_INT, n, 2) || !chk_block(data, NPY_CFLOAT, n, nchan)
+            || !(bflags || chk_block(flags, NPY_INT, n, nchan))) {
+        PyErr_Format(PyExc_ValueError, "uvw (n,3), t (n,), ij (n,2), data (n,nchan) "
+            "and flags (n,nchan) must be C-contiguous float64, float64, int32, "
+            "complex64 and int32 (or bool) arrays");
+        return NULL;
+    }
+    if (!PyArray_ISWRITEABLE(uvw) || !PyArray_ISWRITEABLE(t) || !PyArray_ISWRITEABLE(ij)
+            || !PyArray_ISWRITEABLE(data) || !PyArray_ISWRITEABLE(flags)) {
+        PyErr_Format(PyExc_ValueError, "uvw, t, ij, data and flags must be writeable");
+        return NULL;
+    }
+    if (vars != NULL && vars != Py_None) {
+        seq = block_vars(vars, n, names, vals, htypes);
+        if (seq == NULL) return NULL;
+        nvar = (npy_intp) names.size();
+        for (k=0; k < nvar; k++) {
+            if (!PyArray_ISWRITEABLE(vals[k])) {
+                PyErr_Format(PyExc_ValueError, "array for variable \"%s\" must be "
+                    "writeable", names[k].c_str());
+                Py_DECREF(seq);
+                return NULL;
+            }
+        }
+    }
+    npy_intp nrec = 0;
+    bool invert = !bflags && masked;
+    if (bflags || invert) flag_buf.resize(nchan);
+    int rv = uv_call(self, [&]() {
+        for (; nrec < n; nrec++) {
+            float *d = (float *) PyArray_DATA(data) + 2*nrec*nchan;
+            int *f = (bflags || invert) ? &flag_buf[0] : (int *) PyArray_DATA(flags) + nrec*nchan;
+            int nread;
+            uvread_c(self->tno, preamble, d, f, (int) nchan, &nread);
+            if (nread == 0) break;
+            for (k=nread; k < nchan; k++) { d[2*k] = d[2*k+1] = 0; f[k] = 0; }
+            if (bflags) {
+                npy_bool *b = (npy_bool *) PyArray_DATA(flags) + nrec*nchan;
+                for (k=0; k < nchan; k++) b[k] = (f[k] != 0) != (masked != 0);
+            } else if (invert) {
+                int *o = (int *) PyArray_DATA(flags) + nrec*nchan;
+                for (k=0; k < nchan; k++) o[k] = f[k] == 0;
+            }
+            double *u = (double *) PyArray_DATA(uvw) + 3*nrec;
+            u[0] = preamble[0]; u[1] = preamble[1]; u[2] = preamble[2];
+            ((double *) PyArray_DATA(t))[nrec] = preamble[3];
+            ((int *) PyArray_DATA(ij))[2*nrec] = GETI(preamble[4]);
+            ((int *) PyArray_DATA(ij))[2*nrec+1] = GETJ(preamble[4]);
+            for (k=0; k < nvar; k++) {
+                int size = PyArray_ITEMSIZE(vals[k]);
+                uvgetvr_c(self->tno, htypes[k], names[k].c_str(),
+                    (char *) PyArray_DATA(vals[k]) + size*nrec, 1);
+            }
+        }
+    });
+    Py_XDECREF(seq);
+    if (rv != 0) return NULL;
+    return PyInt_FromLong((long) nrec);
+}
+
+/* Starts averaging nt integrations and nchan channels for
+ * raw_read_average, discarding any averages still open or waiting.
+ */
+PyObject * UVObject_set_average(UVObject *self, PyObject *args) {
+    int nt, nchan;
+    if (!PyArg_ParseTuple(args, "ii", &nt, &nchan)) return NULL;
+    if (nt < 1 || nchan < 1) {
+        PyErr_Format(PyExc_ValueError, "nt and nchan must be positive");
+        return NULL;
+    }
+    UVLock lock(self);
+    delete self->avg;
+    self->avg = new UVAverage(nt, nchan);
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+/* Reads records through the averager (see raw_set_average) until n
+ * averages (the length of uvw) are complete or the file ends, and copies
+ * them into preallocated, C-contiguous arrays: uvw (n,3) and t (n,)
+ * float64, ij (n,2) and pol (n,) int32, and data (n,nout) complex64,
+ * flags (n,nout) bool (invalid where true) and wgt (n,nout) float32.
+ * Averages left over stay with the averager for the next call.  Returns
+ * the number of averages copied.
+ */
+PyObject * UVObject_read_average(UVObject *self, PyObject *args) {
+    PyArrayObject *uvw, *t, *ij, *pol, *data, *flags, *wgt;
+    if (!PyArg_ParseTuple(args, "O!O!O!O!O!O!O!", &PyArray_Type, &uvw,
+            &PyArray_Type, &t, &PyArray_Type, &ij, &PyArray_Type, &pol,
+            &PyArray_Type, &data, &PyArray_Type, &flags, &PyArray_Type, &wgt))
+        return NULL;
+    npy_intp n = DIM(uvw,0);
+    npy_intp nout = RANK(data) == 2 ? DIM(data,1) : 0;
+    if (!chk_block(uvw, NPY_DOUBLE, n, 3) || !chk_block(t, NPY_DOUBLE, n, -1)
+            || !chk_block(ij, NPY_INT, n, 2) || !chk_block(pol, NPY_INT, n, -1)
+            || !chk_block(data, NPY_CFLOAT, n, nout) || !chk_block(flags, NPY_BOOL, n, nout)
+            || !chk_block(wgt, NPY_FLOAT, n, nout)) {
+        PyErr_Format(PyExc_ValueError, "uvw (n,3), t (n,), ij (n,2), pol (n,), data "
+            "(n,nout), flags (n,nout) and wgt (n,nout) must be C-contiguous float64, "
+            "float64, int32, int32, complex64, bool and float32 arrays");
+        return NULL;
+    }
+    if (!PyArray_ISWRITEABLE(uvw) || !PyArray_ISWRITEABLE(t) || !PyArray_ISWRITEABLE(ij)
+            || !PyArray_ISWRITEABLE(pol) || !PyArray_ISWRITEABLE(data)
+            || !PyArray_ISWRITEABLE(flags) || !PyArray_ISWRITEABLE(wgt)) {
+        PyErr_Format(PyExc_ValueError, "uvw, t, ij, pol, data, flags and wgt must be writeable");
+        return NULL;
+    }
+    if (self->avg == NULL) {
+        PyErr_Format(PyExc_RuntimeError, "raw_set_average must come first");
+        return NULL;
+    }
+    static thread_local std::vector<float> buf;
+    buf.resize(2*MAXCHAN);
+    flag_buf.resize(MAXCHAN);
+    npy_intp nrec = 0;
+    int rv = uv_call(self, [&]() {
+        UVAverage &avg = *self->avg;
+        double preamble[PREAMBLE_SIZE];
+        int defpol = 1;
+        while (avg.ready() < (size_t) n) {
+            int nread, p;
+            uvread_c(self->tno, preamble, &buf[0], &flag_buf[0], MAXCHAN, &nread);
+            if (nread == 0) { avg.flush(); break; }
+            uvrdvr_c(self->tno, H_INT, "pol", (char *) &p, (char *) &defpol, 1);
+            avg.add(preamble, p, &buf[0], &flag_buf[0], nread);
+        }
+        for (; nrec < n && avg.ready() > 0; nrec++) {
+            double bl;
+            avg.pop((double *) PyArray_DATA(uvw) + 3*nrec, (double *) PyArray_DATA(t) + nrec,
+                &bl, (int *) PyArray_DATA(pol) + nrec,
+                (float *) PyArray_DATA(data) + 2*nrec*nout,
+                (unsigned char *) PyArray_DATA(flags) + nrec*nout,
+                (float *) PyArray_DATA(wgt) + nrec*nout, (int) nout);
+            ((int *) PyArray_DATA(ij))[2*nrec] = GETI(bl);
+            ((int *) PyArray_DATA(ij))[2*nrec+1] = GETJ(bl);
+        }
+    });
+    if (rv != 0) return NULL;
+    return PyInt_FromLong((long) nrec);
+}
+
+/* Reads every (selected) record from the start into a dense cube in two
+ * passes: the first skips from record to record without decoding data
+ * (uvreadmeta_c), gathering the times, baselines and polarizations; the
+ * second reads each record's data straight into its row of the complex64
+ * (ntime, nbl, npol, nchan) cube, and its flags into the bool flag cube,
+ * which starts all True (invalid) so that missing records stay flagged.
+ * Times and baselines are sorted, polarizations in order of appearance.
+ * Returns (data, flags, times, ij, pols) and leaves the file rewound.
+ */
+PyObject * UVObject_to_cube(UVObject *self) {
+    std::vector<double> times;
+    std::vector<long> bls;
+    std::vector<int> pols, tind, bind, pind;
+    double preamble[PREAMBLE_SIZE];
+    int nchan = 0, defpol = 1;
+    if (uv_call(self, [&]() {
+        uvrewind_c(self->tno);
+        for (;;) {
+            int nread, p;
+            uvreadmeta_c(self->tno, preamble, &nread);
+            if (nread == 0) break;
+            uvrdvr_c(self->tno, H_INT, "pol", (char *) &p, (char *) &defpol, 1);
+            times.push_back(preamble[3]);
+            bls.push_back(65536L * GETI(preamble[4]) + GETJ(preamble[4]));
+            pind.push_back(p);
+            if (nread > nchan) nchan = nread;
+        }
+        uvrewind_c(self->tno);
+    }) != 0) return NULL;
+    // Axes of the cube, and each record's place on them
+    size_t nrec = times.size();
+    std::vector<double> ut(times);
+    std::sort(ut.begin(), ut.end());
+    ut.erase(std::unique(ut.begin(), ut.end()), ut.end());
+    std::vector<long> ub(bls);
+    std::sort(ub.begin(), ub.end());
+    ub.erase(std::unique(ub.begin(), ub.end()), ub.end());
+    tind.resize(nrec);
+    bind.resize(nrec);
+    for (size_t r=0; r < nrec; r++) {
+        tind[r] = (int) (std::lower_bound(ut.begin(), ut.end(), times[r]) - ut.begin());
+        bind[r] = (int) (std::lower_bound(ub.begin(), ub.end(), bls[r]) - ub.begin());
+        size_t k = std::find(pols.begin(), pols.end(), pind[r]) - pols.begin();
+        if (k == pols.size()) pols.push_back(pind[r]);
+        pind[r] = (int) k;
+    }
+    std::vector<double>().swap(times);
+    std::vector<long>().swap(bls);
+
+    npy_intp dims[4] = {(npy_intp) ut.size(), (npy_intp) ub.size(), (npy_intp) pols.size(), nchan};
+    PyArrayObject *data = (PyArrayObject *) PyArray_ZEROS(4, dims, NPY_CFLOAT, 0);
+    PyArrayObject *flags = (PyArrayObject *) PyArray_EMPTY(4, dims, NPY_BOOL, 0);
+    PyArrayObject *t = (PyArrayObject *) PyArray_SimpleNew(1, dims, NPY_DOUBLE);
+    npy_intp ijdims[2] = {dims[1], 2};
+    PyArrayObject *ij = (PyArrayObject *) PyArray_SimpleNew(2, ijdims, NPY_INT);
+    PyArrayObject *p = (PyArrayObject *) PyArray_SimpleNew(1, dims+2, NPY_INT);
+    if (data == NULL || flags == NULL || t == NULL || ij == NULL || p == NULL) {
+        Py_XDECREF(data); Py_XDECREF(flags); Py_XDECREF(t); Py_XDECREF(ij); Py_XDECREF(p);
+        return NULL;
+    }
+    memset(PyArray_DATA(flags), 1, PyArray_NBYTES(flags));
+    for (npy_intp k=0; k < dims[0]; k++) ((double *) PyArray_DATA(t))[k] = ut[k];
+    for (npy_intp k=0; k < dims[1]; k++) {
+        ((int *) PyArray_DATA(ij))[2*k] = (int) (ub[k] / 65536);
+        ((int *) PyArray_DATA(ij))[2*k+1] = (int) (ub[k] % 65536);
+    }
+    for (npy_intp k=0; k < dims[2]; k++) ((int *) PyArray_DATA(p))[k] = pols[k];
+
+    size_t nread_recs = 0;
+    flag_buf.resize(nchan > 0 ? nchan : 1);
+    int rv = uv_call(self, [&]() {
+        for (; nread_recs < nrec; nread_recs++) {
+            size_t r = nread_recs;
+            npy_intp row = ((npy_intp) tind[r] * dims[1] + bind[r]) * dims[2] + pind[r];
+            float *d = (float *) PyArray_DATA(data) + 2*row*nchan;
+            npy_bool *b = (npy_bool *) PyArray_DATA(flags) + row*nchan;
+            int nread;
+            uvread_c(self->tno, preamble, d, &flag_buf[0], nchan, &nread);
+            if (nread == 0) break;
+            for (int k=0; k < nread; k++) b[k] = flag_buf[k] == 0;
+        }
+        uvrewind_c(self->tno);
+    });
+    if (rv == 0 && nread_recs != nrec) {
+        PyErr_Format(PyExc_RuntimeError, "read %ld of the %ld records indexed",
+            (long) nread_recs, (long) nrec);
+        rv = -1;
+    }
+    if (rv != 0) {
+        Py_DECREF(data); Py_DECREF(flags); Py_DECREF(t); Py_DECREF(ij); Py_DECREF(p);
+        return NULL;
+    }
+    return Py_BuildValue("(NNNNN)", data, flags, t, ij, p);
+}
+
+/* The complement of raw_read_block: writes the n records (the length of
+ * uvw) held in C-contiguous arrays uvw (n,3) and t (n,) float64, ij (n,2)
+ * int32, and data (n,nchan) complex64 and flags (n,nchan) int32.  vars, if
+ * given, pairs variable names with (n,) arrays (as for raw_read_block)
+ * whose kth values are put before record k; MIRIAD only writes a variable
+ * out when its value changes.
+ */
+PyObject * UVObject_write_block(UVObject *self, PyObject *args) {
+    PyArrayObject *uvw, *t, *ij, *data, *flags;
+    PyObject *vars=NULL, *seq=NULL;
+    std::vector<std::string> names;
+    std::vector<PyArrayObject *> vals;
+    std::vector<int> htypes;
+    npy_intp n, nchan, nvar=0;
+    if (!PyArg_ParseTuple(args, "O!O!O!O!O!|O", &PyArray_Type, &uvw,
+            &PyArray_Type, &t, &PyArray_Type, &ij, &PyArray_Type, &data,
+            &PyArray_Type, &flags, &vars)) return NULL;
+    n = DIM(uvw,0);
+    nchan = RANK(data) == 2 ? DIM(data,1) : 0;
+    if (!chk_block(uvw, NPY_DOUBLE, n, 3) || !chk_block(t, NPY_DOUBLE, n, -1)
+            || !chk_block(ij, NPY_INT, n, 2) || !chk_block(data, NPY_CFLOAT, n, nchan)
+            || !chk_block(flags, NPY_INT, n, nchan)) {
+        PyErr_Format(PyExc_ValueError, "uvw (n,3), t (n,), ij (n,2), data (n,nchan) "
+            "and flags (n,nchan) must be C-contiguous float64, float64, int32, "
+            "complex64 and int32 arrays");
+        return NULL;
+    }
+    if (vars != NULL && vars != Py_None) {
+        seq = block_vars(vars, n, names, vals, htypes);
+        if (seq == NULL) return NULL;
+        nvar = (npy_intp) names.size();
+    }
+    int rv = uv_call(self, [&]() {
+        double preamble[PREAMBLE_SIZE];
+        for (npy_intp rec=0; rec < n; rec++) {
+            for (npy_intp k=0; k < nvar; k++) {
+                int size = PyArray_ITEMSIZE(vals[k]);
+                uvputvr_c(self->tno, htypes[k], names[k].c_str(),
+                    (char *) PyArray_DATA(vals[k]) + size*rec, 1);
+            }
+            const double *u = (const double *) PyArray_DATA(uvw) + 3*rec;
+            const int *b = (const int *) PyArray_DATA(ij) + 2*rec;
+            preamble[0] = u[0]; preamble[1] = u[1]; preamble[2] = u[2];
+            preamble[3] = ((const double *) PyArray_DATA(t))[rec];
+            preamble[4] = MKBL(b[0], b[1]);
+            uvwrite_c(self->tno, preamble, (float *) PyArray_DATA(data) + 2*rec*nchan,
+                (int *) PyArray_DATA(flags) + rec*nchan, (int) nchan);
+        }
+    });
+    Py_XDECREF(seq);
+    if (rv != 0) return NULL;
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+/* Checks that data (complex64) and flags (int32 or bool, valid where true,
+ * or invalid if masked) are C-contiguous 1d arrays of the same length, and
+ * returns whether flags can be handed to MIRIAD as they are.  Sets a
+ * ValueError and returns -1 otherwise.
+ */
+static int chk_rec(PyArrayObject *data, PyArrayObject *flags, int masked) {
+    if (RANK(data) != 1 || TYPE(data) != NPY_CFLOAT || !PyArray_ISCARRAY_RO(data)
+            || RANK(flags) != 1 || (TYPE(flags) != NPY_INT && TYPE(flags) != NPY_BOOL)
+            || !PyArray_ISCARRAY_RO(flags) || DIM(flags,0) != DIM(data,0)) {
+        PyErr_Format(PyExc_ValueError, "data and flags must be C-contiguous 1d "
+            "complex64 and int32 (or bool) arrays of the same length");
+        return -1;
+    }
+    return TYPE(flags) == NPY_INT && !masked;
+}
+
+/* As raw_read, into the caller's data and flags (see chk_rec), and uvw if
+ * given, so nothing is allocated but the returned preamble tuple.  Both
+ * may be rows of larger arrays.
+ */
+PyObject * UVObject_read_into(UVObject *self, PyObject *args) {
+    PyArrayObject *data, *flags;
+    PyObject *uvwobj=NULL, *rv;
+    int masked=0, direct, nread, n;
+    double preamble[PREAMBLE_SIZE];
+    if (!PyArg_ParseTuple(args, "O!O!|Oi", &PyArray_Type, &data,
+            &PyArray_Type, &flags, &uvwobj, &masked)) return NULL;
+    if ((direct = chk_rec(data, flags, masked)) < 0) return NULL;
+    if (!PyArray_ISWRITEABLE(data) || !PyArray_ISWRITEABLE(flags)) {
+        PyErr_Format(PyExc_ValueError, "data and flags must be writeable");
+        return NULL;
+    }
+    if (uvwobj == Py_None) uvwobj = NULL;
+    if (uvwobj != NULL && (!PyArray_Check(uvwobj)
+            || RANK((PyArrayObject *) uvwobj) != 1 || DIM((PyArrayObject *) uvwobj,0) != 3
+            || TYPE((PyArrayObject *) uvwobj) != NPY_DOUBLE
+            || !PyArray_ISWRITEABLE((PyArrayObject *) uvwobj))) {
+        PyErr_Format(PyExc_ValueError, "uvw must be a writeable float64 array of shape (3,)");
+        return NULL;
+    }
+    n = (int) DIM(data,0);
+    if (!direct) flag_buf.resize(n);
+    int *f = direct ? (int *) PyArray_DATA(flags) : &flag_buf[0];
+    if (uv_call(self, [&]() {
+        uvread_c(self->tno, preamble, (float *) PyArray_DATA(data), f, n, &nread);
+        if (nread > 0) uv_snapshot(self);
+    }) != 0) return NULL;
+    if (!direct) {
+        if (TYPE(flags) == NPY_BOOL) {
+            npy_bool *b = (npy_bool *) PyArray_DATA(flags);
+            for (int k=0; k < n; k++) b[k] = (f[k] != 0) != (masked != 0);
+        } else {
+            int *o = (int *) PyArray_DATA(flags);
+            for (int k=0; k < n; k++) o[k] = f[k] == 0;
+        }
+    }
+    if (uvwobj == NULL) {
+        npy_intp uvw_dims[1] = {3};
+        uvwobj = PyArray_SimpleNew(1, uvw_dims, NPY_DOUBLE);
+        CHK_NULL(uvwobj);
+    } else Py_INCREF(uvwobj);
+    PyArrayObject *uvw = (PyArrayObject *) uvwobj;
+    IND1(uvw,0,double) = preamble[0];
+    IND1(uvw,1,double) = preamble[1];
+    IND1(uvw,2,double) = preamble[2];
+    rv = Py_BuildValue("((Od(ii))i)", uvwobj, preamble[3],
+        GETI(preamble[4]), GETJ(preamble[4]), nread);
+    Py_DECREF(uvwobj);
+    return rv;
+}
+
+/* As raw_write, straight from the caller's data and flags (see chk_rec),
+ * which may be rows of larger arrays: nothing is copied unless the flags
+ * need converting.
+ */
+PyObject * UVObject_write_from(UVObject *self, PyObject *args) {
+    PyArrayObject *data, *flags, *uvw;
+    int i, j, masked=0, direct, n;
+    double preamble[PREAMBLE_SIZE], t;
+    if (!PyArg_ParseTuple(args, "(O!d(ii))O!O!|i",
+        &PyArray_Type, &uvw, &t, &i, &j,
+        &PyArray_Type, &data, &PyArray_Type, &flags, &masked)) return NULL;
+    if (RANK(uvw) != 1 || DIM(uvw,0) != 3) {
+        PyErr_Format(PyExc_ValueError, "uvw must have shape (3,) %d", RANK(uvw));
+        return NULL;
+    }
+    CHK_ARRAY_TYPE(uvw, NPY_DOUBLE);
+    if ((direct = chk_rec(data, flags, masked)) < 0) return NULL;
+    n = (int) DIM(data,0);
+    if (!direct) {
+        flag_buf.resize(n);
+        if (TYPE(flags) == NPY_BOOL) {
+            npy_bool *b = (npy_bool *) PyArray_DATA(flags);
+            for (int k=0; k < n; k++) flag_buf[k] = (b[k] != 0) != (masked != 0);
+        } else {
+            int *o = (int *) PyArray_DATA(flags);
+            for (int k=0; k < n; k++) flag_buf[k] = o[k] == 0;
+        }
+    }
+    preamble[0] = IND1(uvw,0,double);
+    preamble[1] = IND1(uvw,1,double);
+    preamble[2] = IND1(uvw,2,double);
+    preamble[3] = t;
+    preamble[4] = MKBL(i,j);
+    if (uv_call(self, [&]() {
+        uvwrite_c(self->tno, preamble, (float *) PyArray_DATA(data),
+            direct ? (int *) PyArray_DATA(flags) : &flag_buf[0], n);
+    }) != 0) return NULL;
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
 /* Wrapper over uvwrite_c to deal with numpy arrays, conversion of baseline
  * codes, and accepts preamble as a tuple.
  */
@@ -173,9 +782,1357 @@ PyObject * UVObject_write(UVObject *self, PyObject *args) {
     preamble[3] = t;
     preamble[4] = MKBL(i,j);
     // Here is the MIRIAD call
-    try {
+    if (uv_call(self, [&]() {
         uvwrite_c(self->tno, preamble,
             (float *)PyArray_DATA(data), (int *)PyArray_DATA(flags), DIM(data,0));
+    }) != 0) return NULL;
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+// A thin wrapper over uvcopyvr_c
+PyObject * UVObject_copyvr(UVObject *self, PyObject *args) {
+    UVObject *uv;
+    if (!PyArg_ParseTuple(args, "O!", &UVType, &uv)) return NULL;
+    // Both locks, in a fixed order so two copies the other way can't deadlock
+    UVLock lock1(self < uv ? self : uv);
+    UVLock lock2(self == uv ? NULL : (self < uv ? uv : self));
+    try {
+        uvcopyvr_c(uv->tno, self->tno);
+    } catch (MiriadError &e) {
+        PyErr_Format(PyExc_RuntimeError, "%s", e.get_message());
+        return NULL;
+    }
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+/* A block of records read by raw_pipe: arrays uvw (n,3), t (n,), ij (n,2),
+ * data (n,nchan), flags (n,nchan) (bool, invalid where true) and vars
+ * (n,nvar) (float64 values of the tracked variables), of which nrec
+ * records are filled, and what uvcopysave_c saved after each: record k's
+ * in saved[soff[k]..soff[k+1]).  With gains to apply, pidx holds the
+ * feed indices of each record's antennas on their polarization axis (-1
+ * for none).  Read for raw_fan_out, pol holds each record's polarization
+ * code, and wrec the records with which the spectral windows changed,
+ * each change's nspect, then nschan, ischan, sfreq and sdf (nspect values
+ * each) following in turn in wins.
+ */
+struct PipeBlock {
+    PyObject *arr[6];
+    npy_intp nrec;
+    std::vector<char> saved;
+    std::vector<size_t> soff;
+    std::vector<int> pidx;
+    std::vector<int> pol;
+    std::vector<npy_intp> wrec;
+    std::vector<double> wins;
+    std::string err;            // MIRIAD's message if reading failed
+};
+
+/* What raw_pipe writes for a block: the arrays mfunc returned (uvw, t, ij,
+ * data, flags and keep, which may be NULL) for its nrec records (0 if
+ * there are none), and the block read, for its saved variables.
+ */
+struct PipeJob {
+    PipeBlock *in;
+    PyObject *arr[6];
+    npy_intp nrec;
+    std::string err;            // MIRIAD's message if writing failed
+};
+
+// A queue between raw_pipe's threads; pop() waits for an entry
+template <class T>
+struct PipeQueue {
+    std::mutex m;
+    std::condition_variable cv;
+    std::deque<T *> q;
+    void push(T *x) {
+        { std::lock_guard<std::mutex> l(m); q.push_back(x); }
+        cv.notify_one();
+    }
+    T *pop() {
+        std::unique_lock<std::mutex> l(m);
+        cv.wait(l, [this]() { return !q.empty(); });
+        T *x = q.front();
+        q.pop_front();
+        return x;
+    }
+};
+
+// Frees a block (with the GIL held)
+static void pipe_free(PipeBlock *b) {
+    if (b == NULL) return;
+    for (int k=0; k < 6; k++) Py_XDECREF(b->arr[k]);
+    delete b;
+}
+
+// Frees a job and its block (with the GIL held)
+static void pipe_release(PipeJob *j) {
+    if (j == NULL) return;
+    for (int k=0; k < 6; k++) Py_XDECREF(j->arr[k]);
+    pipe_free(j->in);
+    delete j;
+}
+
+// A new block for n records of nchan channels and nvar tracked variables
+static PipeBlock *pipe_alloc(npy_intp n, npy_intp nchan, npy_intp nvar) {
+    PipeBlock *b = new PipeBlock;
+    npy_intp d_uvw[2] = {n, 3}, d_t[1] = {n}, d_ij[2] = {n, 2};
+    npy_intp d_data[2] = {n, nchan}, d_vars[2] = {n, nvar};
+    b->arr[0] = PyArray_SimpleNew(2, d_uvw, NPY_DOUBLE);
+    b->arr[1] = PyArray_SimpleNew(1, d_t, NPY_DOUBLE);
+    b->arr[2] = PyArray_SimpleNew(2, d_ij, NPY_INT);
+    b->arr[3] = PyArray_SimpleNew(2, d_data, NPY_CFLOAT);
+    b->arr[4] = PyArray_SimpleNew(2, d_data, NPY_BOOL);
+    b->arr[5] = PyArray_SimpleNew(2, d_vars, NPY_DOUBLE);
+    b->nrec = 0;
+    for (int k=0; k < 6; k++) {
+        if (b->arr[k] == NULL) {
+            pipe_free(b);
+            return NULL;
+        }
+    }
+    return b;
+}
+
+/* The gains raw_pipe applies to each block it reads (see gain_apply.cpp):
+ * gains (ntime, nant, npol, nchan) complex64 sampled at gtimes, the
+ * polarization codes calibrated with the indices on the npol axis of the
+ * feeds of their two antennas (feeds[2*k], feeds[2*k+1] for pols[k]),
+ * whether to divide, and threads.
+ */
+struct PipeCal {
+    PyArrayObject *gains, *gtimes;
+    std::vector<int> pols, feeds;
+    int divide, nthreads;
+};
+
+// Applies cal to a block read (no Python API); false if it did not fit
+static bool pipe_calibrate(const PipeCal *cal, PipeBlock *b) {
+    if (cal == NULL || b->nrec == 0) return true;
+    PyArrayObject *data = (PyArrayObject *) b->arr[3];
+    return gain_apply((float *) PyArray_DATA(data),
+        (unsigned char *) PyArray_DATA((PyArrayObject *) b->arr[4]), (long) b->nrec,
+        (long) DIM(data,1), (int *) PyArray_DATA((PyArrayObject *) b->arr[2]),
+        &b->pidx[0], (double *) PyArray_DATA((PyArrayObject *) b->arr[1]),
+        (float *) PyArray_DATA(cal->gains), (double *) PyArray_DATA(cal->gtimes),
+        (long) DIM(cal->gains,0), (long) DIM(cal->gains,1), (long) DIM(cal->gains,2),
+        cal->divide, cal->nthreads) == 0;
+}
+
+// Notes in b the spectral windows of record r just read from in, if they
+// changed with it
+static void pipe_spect(UVObject *in, PipeBlock *b, npy_intp r) {
+    static const char *names[5] = {"nspect", "nschan", "ischan", "sfreq", "sdf"};
+    char type;
+    int len[5], updated, changed = 0, nspect, k, m;
+    for (k=0; k < 5; k++) {
+        uvprobvr_c(in->tno, names[k], &type, &len[k], &updated);
+        if (type == ' ' || len[k] < 1) return;
+        changed |= updated;
+    }
+    if (!changed) return;
+    uvgetvr_c(in->tno, H_INT, "nspect", (char *) &nspect, 1);
+    for (k=1; k < 5; k++) if (len[k] < nspect) return;
+    std::vector<int> iv(max(len[1], len[2]));
+    std::vector<double> dv(max(len[3], len[4]));
+    b->wrec.push_back(r);
+    b->wins.push_back(nspect);
+    for (k=1; k < 5; k++) {
+        if (k < 3) uvgetvr_c(in->tno, H_INT, names[k], (char *) &iv[0], len[k]);
+        else uvgetvr_c(in->tno, H_DBLE, names[k], (char *) &dv[0], len[k]);
+        for (m=0; m < nspect; m++) b->wins.push_back(k < 3 ? iv[m] : dv[m]);
+    }
+}
+
+// Reads a block from in (MIRIAD calls only, with in's lock held), with
+// the polarization index of each record if there is cal, or what
+// raw_fan_out routes by with fan
+static void pipe_read(UVObject *in, PipeBlock *b, const std::vector<std::string> &names,
+        const PipeCal *cal, bool fan=false) {
+    PyArrayObject *data = (PyArrayObject *) b->arr[3];
+    npy_intp n = DIM(data,0), nchan = DIM(data,1), nvar = (npy_intp) names.size(), k;
+    std::vector<int> f(nchan + 1);
+    double preamble[PREAMBLE_SIZE], nan = Py_NAN;
+    b->soff.assign(1, 0);
+    b->pidx.clear();
+    b->pol.clear();
+    b->wrec.clear();
+    b->wins.clear();
+    for (b->nrec=0; b->nrec < n; b->nrec++) {
+        npy_intp r = b->nrec;
+        float *d = (float *) PyArray_DATA(data) + 2*r*nchan;
+        int nread;
+        uvread_c(in->tno, preamble, d, &f[0], (int) nchan, &nread);
+        if (nread == 0) break;
+        npy_bool *fl = (npy_bool *) PyArray_DATA((PyArrayObject *) b->arr[4]) + r*nchan;
+        for (k=0; k < nread; k++) fl[k] = f[k] == 0;
+        for (; k < nchan; k++) { d[2*k] = d[2*k+1] = 0; fl[k] = 1; }
+        double *u = (double *) PyArray_DATA((PyArrayObject *) b->arr[0]) + 3*r;
+        u[0] = preamble[0]; u[1] = preamble[1]; u[2] = preamble[2];
+        ((double *) PyArray_DATA((PyArrayObject *) b->arr[1]))[r] = preamble[3];
+        int *ij = (int *) PyArray_DATA((PyArrayObject *) b->arr[2]) + 2*r;
+        ij[0] = GETI(preamble[4]);
+        ij[1] = GETJ(preamble[4]);
+        double *v = (double *) PyArray_DATA((PyArrayObject *) b->arr[5]) + r*nvar;
+        for (k=0; k < nvar; k++)
+            uvrdvr_c(in->tno, H_DBLE, names[k].c_str(), (char *) (v + k), (char *) &nan, 1);
+        if (cal != NULL) {
+            int p, defpol = 1;
+            uvrdvr_c(in->tno, H_INT, "pol", (char *) &p, (char *) &defpol, 1);
+            size_t q = std::find(cal->pols.begin(), cal->pols.end(), p) - cal->pols.begin();
+            b->pidx.push_back(q < cal->pols.size() ? cal->feeds[2*q] : -1);
+            b->pidx.push_back(q < cal->pols.size() ? cal->feeds[2*q+1] : -1);
+        }
+        if (fan) {
+            int p, defpol = 1;
+            uvrdvr_c(in->tno, H_INT, "pol", (char *) &p, (char *) &defpol, 1);
+            b->pol.push_back(p);
+            pipe_spect(in, b, r);
+        }
+        // The variables copyvr would copy now, for when the record is written
+        size_t off = b->soff.back();
+        if (b->saved.size() < off + 4096) b->saved.resize(2*b->saved.size() + 4096);
+        int len = uvcopysave_c(in->tno, &b->saved[off], (int) (b->saved.size() - off));
+        if ((size_t) len > b->saved.size() - off) {
+            b->saved.resize(off + len);
+            uvcopysave_c(in->tno, &b->saved[off], len);
+        }
+        b->soff.push_back(off + len);
+    }
+}
+
+// Writes a job to out (MIRIAD calls only, with out's lock held)
+static void pipe_write(UVObject *in, UVObject *out, PipeJob *j) {
+    PipeBlock *b = j->in;
+    npy_intp nchan = j->nrec > 0 ? DIM((PyArrayObject *) j->arr[3],1) : 0;
+    std::vector<int> f(nchan + 1);
+    double preamble[PREAMBLE_SIZE];
+    for (npy_intp r=0; r < b->nrec; r++) {
+        uvcopyput_c(in->tno, out->tno, b->saved.data() + b->soff[r],
+            (int) (b->soff[r+1] - b->soff[r]));
+        if (r >= j->nrec || (j->arr[5] != NULL
+                && !((npy_bool *) PyArray_DATA((PyArrayObject *) j->arr[5]))[r])) continue;
+        const double *u = (const double *) PyArray_DATA((PyArrayObject *) j->arr[0]) + 3*r;
+        const int *ij = (const int *) PyArray_DATA((PyArrayObject *) j->arr[2]) + 2*r;
+        const npy_bool *fl = (const npy_bool *) PyArray_DATA((PyArrayObject *) j->arr[4]) + r*nchan;
+        preamble[0] = u[0]; preamble[1] = u[1]; preamble[2] = u[2];
+        preamble[3] = ((const double *) PyArray_DATA((PyArrayObject *) j->arr[1]))[r];
+        preamble[4] = MKBL(ij[0], ij[1]);
+        for (npy_intp k=0; k < nchan; k++) f[k] = !fl[k];
+        uvwrite_c(out->tno, preamble, (float *) PyArray_DATA((PyArrayObject *) j->arr[3]) + 2*r*nchan,
+            &f[0], (int) nchan);
+    }
+}
+
+/* Runs mfunc (or None, to copy) on a block read (with the GIL held),
+ * returning the job to write it, or NULL with an exception set.
+ */
+static PipeJob *pipe_process(PyObject *mfunc, PipeBlock *b) {
+    static const int types[6] = {NPY_DOUBLE, NPY_DOUBLE, NPY_INT, NPY_CFLOAT, NPY_BOOL, NPY_BOOL};
+    static const int ranks[6] = {2, 1, 2, 2, 2, 1};
+    PyObject *args[6], *res;
+    int k, nres;
+    for (k=0; k < 6; k++) {
+        args[k] = PySequence_GetSlice(b->arr[k], 0, b->nrec);
+        if (args[k] == NULL) {
+            while (k-- > 0) Py_DECREF(args[k]);
+            return NULL;
+        }
+    }
+    if (mfunc == Py_None) {
+        res = PyTuple_Pack(5, args[0], args[1], args[2], args[3], args[4]);
+    } else {
+        res = PyObject_CallFunctionObjArgs(mfunc, args[0], args[1], args[2],
+            args[3], args[4], args[5], NULL);
+    }
+    for (k=0; k < 6; k++) Py_DECREF(args[k]);
+    if (res == NULL) return NULL;
+    PipeJob *j = new PipeJob;
+    j->in = b;
+    j->nrec = 0;
+    for (k=0; k < 6; k++) j->arr[k] = NULL;
+    if (res == Py_None) {
+        Py_DECREF(res);
+        return j;
+    }
+    nres = PyTuple_Check(res) ? (int) PyTuple_GET_SIZE(res) : -1;
+    if (nres != 5 && nres != 6) {
+        PyErr_Format(PyExc_ValueError, "mfunc must return None or "
+            "(uvw, t, ij, data, flags[, keep])");
+        goto fail;
+    }
+    for (k=0; k < nres; k++) {
+        j->arr[k] = PyArray_FROMANY(PyTuple_GET_ITEM(res, k), types[k], ranks[k],
+            ranks[k], NPY_ARRAY_IN_ARRAY | NPY_ARRAY_FORCECAST);
+        if (j->arr[k] == NULL) goto fail;
+    }
+    {
+        PyArrayObject **a = (PyArrayObject **) j->arr;
+        npy_intp n = b->nrec;
+        if (DIM(a[0],0) != n || DIM(a[0],1) != 3 || DIM(a[1],0) != n || DIM(a[2],0) != n
+                || DIM(a[2],1) != 2 || DIM(a[3],0) != n || DIM(a[4],0) != n
+                || DIM(a[4],1) != DIM(a[3],1) || (a[5] != NULL && DIM(a[5],0) != n)) {
+            PyErr_Format(PyExc_ValueError, "mfunc must return uvw (n,3), t (n,), "
+                "ij (n,2), data and flags (n,nchan) and keep (n,) for the n "
+                "records it was given");
+            goto fail;
+        }
+    }
+    Py_DECREF(res);
+    j->nrec = b->nrec;
+    return j;
+fail:
+    Py_DECREF(res);
+    j->in = NULL;
+    pipe_release(j);
+    return NULL;
+}
+
+/* Parses raw_pipe's cal, (gains, gtimes, pols, divide, nthreads) with
+ * pols a sequence of (code, feed_i, feed_j) triples, for
+ * blocks of nchan channels into c (whose arrays then need freeing).
+ * Returns false with an exception set if it is malformed.
+ */
+static bool pipe_cal_parse(PyObject *obj, PipeCal &c, npy_intp nchan) {
+    PyObject *g, *gt, *pols, *seq;
+    c.gains = c.gtimes = NULL;
+    if (!PyArg_ParseTuple(obj, "OOOii", &g, &gt, &pols, &c.divide, &c.nthreads)) return false;
+    c.gains = (PyArrayObject *) PyArray_FROMANY(g, NPY_CFLOAT, 4, 4, NPY_ARRAY_IN_ARRAY | NPY_ARRAY_FORCECAST);
+    c.gtimes = (PyArrayObject *) PyArray_FROMANY(gt, NPY_DOUBLE, 1, 1, NPY_ARRAY_IN_ARRAY);
+    if (c.gains == NULL || c.gtimes == NULL) return false;
+    if (DIM(c.gains,0) < 1 || DIM(c.gtimes,0) != DIM(c.gains,0) || DIM(c.gains,3) != nchan) {
+        PyErr_Format(PyExc_ValueError, "cal needs gains (ntime,nant,npol,nchan) for "
+            "ntime > 0 ascending gtimes and the nchan channels piped");
+        return false;
+    }
+    if ((seq = PySequence_Fast(pols, "cal pols must be a sequence")) == NULL) return false;
+    for (Py_ssize_t k=0; k < PySequence_Fast_GET_SIZE(seq); k++) {
+        int code, fi, fj;
+        if (!PyArg_ParseTuple(PySequence_Fast_GET_ITEM(seq, k), "iii", &code, &fi, &fj)) break;
+        if (fi < 0 || fi >= DIM(c.gains,2) || fj < 0 || fj >= DIM(c.gains,2)) {
+            PyErr_Format(PyExc_ValueError, "cal feeds of polarization %d lie outside the "
+                "npol gains", code);
+            break;
+        }
+        c.pols.push_back(code);
+        c.feeds.push_back(fi);
+        c.feeds.push_back(fj);
+    }
+    Py_DECREF(seq);
+    return !PyErr_Occurred();
+}
+
+// Frees the arrays of a cal on the way out of raw_pipe (with the GIL held)
+struct PipeCalRef {
+    PipeCal &c;
+    ~PipeCalRef() { Py_XDECREF(c.gains); Py_XDECREF(c.gtimes); }
+};
+
+/* Pipes the records of uv (read nblock at a time, with nchan channels)
+ * through mfunc(uvw, t, ij, data, flags, vars) into self, copying the
+ * variables uvcopyvr_c would, record by record, in C.  vars holds the
+ * values of uv's tracked variables.  mfunc returns None (to drop the
+ * block) or (uvw, t, ij, data, flags[, keep]); None for mfunc copies.
+ * With cal, each block gets gains applied (gain_apply) natively as it is
+ * read, before mfunc.  With threaded, a reader thread keeps a block ahead
+ * and a writer thread writes behind, while mfunc runs in this one.
+ * Returns the number of records read.
+ */
+PyObject * UVObject_pipe(UVObject *self, PyObject *args) {
+    UVObject *in;
+    PyObject *mfunc, *calobj=Py_None;
+    int nblock, nchan, threaded=0;
+    std::vector<std::string> names;
+    PipeCal calbuf;
+    calbuf.gains = calbuf.gtimes = NULL;
+    PipeCalRef calref = {calbuf};
+    if (!PyArg_ParseTuple(args, "O!Oii|iO", &UVType, &in, &mfunc, &nblock,
+            &nchan, &threaded, &calobj)) return NULL;
+    if (in == self) {
+        PyErr_Format(PyExc_ValueError, "cannot pipe a data set into itself");
+        return NULL;
+    }
+    if (mfunc != Py_None && !PyCallable_Check(mfunc)) {
+        PyErr_Format(PyExc_TypeError, "mfunc must be callable or None");
+        return NULL;
+    }
+    if (nblock <= 0 || nchan < 0) {
+        PyErr_Format(PyExc_ValueError, "nblock must be positive and nchan not negative");
+        return NULL;
+    }
+    {
+        UVLock lock(in);
+        if (in->snap_names != NULL) names = *in->snap_names;
+    }
+    const PipeCal *cal = NULL;
+    if (calobj != Py_None) {
+        if (!pipe_cal_parse(calobj, calbuf, nchan)) return NULL;
+        cal = &calbuf;
+    }
+    const char *calerr = "a record's antenna lies outside the gain table";
+    npy_intp nvar = (npy_intp) names.size(), total = 0;
+    std::string err;
+    bool failed = false;
+    if (!threaded) {
+        while (true) {
+            PipeBlock *b = pipe_alloc(nblock, nchan, nvar);
+            if (b == NULL) return NULL;
+            Py_BEGIN_ALLOW_THREADS
+            failed = !uv_run(in, [&]() { pipe_read(in, b, names, cal); }, err);
+            if (!failed && !pipe_calibrate(cal, b)) { err = calerr; failed = true; }
+            Py_END_ALLOW_THREADS
+            if (failed || b->nrec == 0) {
+                pipe_free(b);
+                break;
+            }
+            total += b->nrec;
+            PipeJob *j = pipe_process(mfunc, b);
+            if (j == NULL) {
+                pipe_free(b);
+                return NULL;
+            }
+            Py_BEGIN_ALLOW_THREADS
+            failed = !uv_run(self, [&]() { pipe_write(in, self, j); }, err);
+            Py_END_ALLOW_THREADS
+            pipe_release(j);
+            if (failed) break;
+        }
+    } else {
+        PipeQueue<PipeBlock> empty, full;
+        PipeQueue<PipeJob> todo, done;
+        std::thread reader([&]() {
+            for (PipeBlock *b=empty.pop(); b != NULL; b=empty.pop()) {
+                // b is the main thread's once pushed
+                bool more = uv_run(in, [&]() { pipe_read(in, b, names, cal); }, b->err)
+                    && b->nrec > 0;
+                if (more && !pipe_calibrate(cal, b)) { b->err = calerr; more = false; }
+                full.push(b);
+                if (!more) break;
+            }
+        });
+        std::thread writer([&]() {
+            bool ok = true;
+            for (PipeJob *j=todo.pop(); j != NULL; j=todo.pop()) {
+                if (ok) ok = uv_run(self, [&]() { pipe_write(in, self, j); }, j->err);
+                else j->err = "not written";
+                done.push(j);
+            }
+        });
+        // Keep one block queued for the reader and at most two behind
+        int queued = 0, pending = 0;
+        bool pyerr = false;
+        for (; queued < 2; queued++) {
+            PipeBlock *b = pipe_alloc(nblock, nchan, nvar);
+            if (b == NULL) { pyerr = true; break; }
+            empty.push(b);
+        }
+        while (!pyerr && !failed && queued > 0) {
+            PipeBlock *b;
+            Py_BEGIN_ALLOW_THREADS
+            b = full.pop();
+            Py_END_ALLOW_THREADS
+            queued--;
+            if (!b->err.empty()) {
+                err = b->err;
+                failed = true;
+            }
+            if (failed || b->nrec == 0) {
+                pipe_free(b);
+                break;
+            }
+            total += b->nrec;
+            PipeBlock *nb = pipe_alloc(nblock, nchan, nvar);
+            if (nb == NULL) {
+                pipe_free(b);
+                pyerr = true;
+                break;
+            }
+            empty.push(nb);
+            queued++;
+            PipeJob *j = pipe_process(mfunc, b);
+            if (j == NULL) {
+                pipe_free(b);
+                pyerr = true;
+                break;
+            }
+            todo.push(j);
+            pending++;
+            // Collect what has been written, waiting while two are behind
+            while (pending > 0) {
+                PipeJob *d = NULL;
+                if (pending > 2) {
+                    Py_BEGIN_ALLOW_THREADS
+                    d = done.pop();
+                    Py_END_ALLOW_THREADS
+                } else {
+                    std::lock_guard<std::mutex> l(done.m);
+                    if (!done.q.empty()) { d = done.q.front(); done.q.pop_front(); }
+                }
+                if (d == NULL) break;
+                pending--;
+                if (!failed && !d->err.empty()) { err = d->err; failed = true; }
+                pipe_release(d);
+            }
+        }
+        // Stop the reader (which may be on a block) and the writer (once
+        // done), and free whatever is left
+        empty.push(NULL);
+        todo.push(NULL);
+        Py_BEGIN_ALLOW_THREADS
+        reader.join();
+        writer.join();
+        Py_END_ALLOW_THREADS
+        for (; !empty.q.empty(); empty.q.pop_front()) pipe_free(empty.q.front());
+        for (; !full.q.empty(); full.q.pop_front()) pipe_free(full.q.front());
+        for (; !done.q.empty(); done.q.pop_front()) {
+            PipeJob *d = done.q.front();
+            if (!failed && !d->err.empty()) { err = d->err; failed = true; }
+            pipe_release(d);
+        }
+        if (pyerr) return NULL;
+    }
+    if (failed) {
+        PyErr_Format(PyExc_RuntimeError, "%s", err.c_str());
+        return NULL;
+    }
+    return PyInt_FromLong((long) total);
+}
+
+/* Where raw_fan_out sends records: out gets channels lo..hi-1 of those of
+ * the polarizations pols and antenna pairs bls (i*65536+j, i <= j; both
+ * sorted, and empty for all), written by a thread of its own from the
+ * blocks queued for it.
+ */
+struct FanSlot {
+    PipeBlock *b;
+    std::atomic<int> refs;      // routes yet to write b
+};
+
+struct FanRoute {
+    UVObject *out;
+    int lo, hi;
+    std::vector<int> pols;
+    std::vector<long> bls;
+    PipeQueue<FanSlot> q;
+    bool failed;
+    std::string err;
+};
+
+// Puts the spectral windows w (as pipe_spect noted them) cut down to
+// channels lo..hi-1 to tno, unless none of them overlaps those
+static void fan_spect(int tno, const double *w, int lo, int hi) {
+    int n = (int) w[0];
+    std::vector<int> nschan, ischan;
+    std::vector<double> sfreq, sdf;
+    for (int k=0; k < n; k++) {
+        int s = (int) w[1+n+k] - 1, a = max(s, lo);
+        int z = min(s + (int) w[1+k], hi);
+        if (a >= z) continue;
+        nschan.push_back(z - a);
+        ischan.push_back(a - lo + 1);
+        sfreq.push_back(w[1+2*n+k] + (a - s) * w[1+3*n+k]);
+        sdf.push_back(w[1+3*n+k]);
+    }
+    int m = (int) nschan.size();
+    if (m == 0) return;
+    uvputvri_c(tno, "nspect", &m, 1);
+    uvputvri_c(tno, "nschan", &nschan[0], m);
+    uvputvri_c(tno, "ischan", &ischan[0], m);
+    uvputvrd_c(tno, "sfreq", &sfreq[0], m);
+    uvputvrd_c(tno, "sdf", &sdf[0], m);
+}
+
+// Writes the records of a block read from in that rt takes to rt.out
+// (MIRIAD calls only, with rt.out's lock held)
+static void fan_write(UVObject *in, FanRoute &rt, const PipeBlock *b) {
+    PyArrayObject *data = (PyArrayObject *) b->arr[3];
+    int nchan = (int) DIM(data,1), n = rt.hi - rt.lo;
+    bool cut = rt.lo > 0 || rt.hi < nchan;
+    std::vector<int> f(n + 1);
+    double preamble[PREAMBLE_SIZE];
+    size_t w = 0, woff = 0;
+    for (npy_intp r=0; r < b->nrec; r++) {
+        uvcopyput_c(in->tno, rt.out->tno, b->saved.data() + b->soff[r],
+            (int) (b->soff[r+1] - b->soff[r]));
+        for (; w < b->wrec.size() && b->wrec[w] == r; w++) {
+            if (cut) fan_spect(rt.out->tno, &b->wins[woff], rt.lo, rt.hi);
+            woff += 1 + 4 * (size_t) b->wins[woff];
+        }
+        if (cut) uvputvri_c(rt.out->tno, "nchan", &n, 1);
+        const int *ij = (const int *) PyArray_DATA((PyArrayObject *) b->arr[2]) + 2*r;
+        long bl = min(ij[0], ij[1]) * 65536L + max(ij[0], ij[1]);
+        if (!rt.pols.empty() && !std::binary_search(rt.pols.begin(), rt.pols.end(), b->pol[r]))
+            continue;
+        if (!rt.bls.empty() && !std::binary_search(rt.bls.begin(), rt.bls.end(), bl))
+            continue;
+        const double *u = (const double *) PyArray_DATA((PyArrayObject *) b->arr[0]) + 3*r;
+        const npy_bool *fl = (const npy_bool *) PyArray_DATA((PyArrayObject *) b->arr[4])
+            + r*nchan + rt.lo;
+        preamble[0] = u[0]; preamble[1] = u[1]; preamble[2] = u[2];
+        preamble[3] = ((const double *) PyArray_DATA((PyArrayObject *) b->arr[1]))[r];
+        preamble[4] = MKBL(ij[0], ij[1]);
+        for (int k=0; k < n; k++) f[k] = !fl[k];
+        uvwrite_c(rt.out->tno, preamble,
+            (const float *) PyArray_DATA(data) + 2*(r*nchan + rt.lo), &f[0], n);
+    }
+}
+
+// Parses the (uv, lo, hi, pols, bls) routes of raw_fan_out into routes
+static bool fan_parse(UVObject *in, PyObject *outs, int nchan, std::deque<FanRoute> &routes) {
+    PyObject *seq = PySequence_Fast(outs, "outs must be a sequence");
+    if (seq == NULL) return false;
+    for (Py_ssize_t k=0; k < PySequence_Fast_GET_SIZE(seq); k++) {
+        PyObject *pols, *bls, *s;
+        routes.emplace_back();
+        FanRoute &rt = routes.back();
+        rt.out = NULL;
+        rt.failed = false;
+        if (!PyArg_ParseTuple(PySequence_Fast_GET_ITEM(seq, k), "O!iiOO", &UVType,
+                &rt.out, &rt.lo, &rt.hi, &pols, &bls)) break;
+        Py_INCREF(rt.out);
+        bool dup = rt.out == in;
+        for (size_t m=0; m + 1 < routes.size(); m++) dup |= routes[m].out == rt.out;
+        if (dup) {
+            PyErr_Format(PyExc_ValueError, "each output must be a distinct data set other "
+                "than the input");
+            break;
+        }
+        if (rt.lo < 0 || rt.hi <= rt.lo || rt.hi > nchan) {
+            PyErr_Format(PyExc_ValueError, "channels %d..%d lie outside the %d read",
+                rt.lo, rt.hi - 1, nchan);
+            break;
+        }
+        if (pols != Py_None) {
+            if ((s = PySequence_Fast(pols, "pols must be a sequence or None")) == NULL) break;
+            for (Py_ssize_t m=0; m < PySequence_Fast_GET_SIZE(s); m++)
+                rt.pols.push_back((int) PyInt_AsLong(PySequence_Fast_GET_ITEM(s, m)));
+            Py_DECREF(s);
+            if (PyErr_Occurred()) break;
+            std::sort(rt.pols.begin(), rt.pols.end());
+        }
+        if (bls != Py_None) {
+            if ((s = PySequence_Fast(bls, "bls must be a sequence or None")) == NULL) break;
+            for (Py_ssize_t m=0; m < PySequence_Fast_GET_SIZE(s); m++) {
+                int i, j;
+                if (!PyArg_ParseTuple(PySequence_Fast_GET_ITEM(s, m), "ii", &i, &j)) break;
+                rt.bls.push_back(min(i, j) * 65536L + max(i, j));
+            }
+            Py_DECREF(s);
+            if (PyErr_Occurred()) break;
+            std::sort(rt.bls.begin(), rt.bls.end());
+        }
+    }
+    Py_DECREF(seq);
+    return !PyErr_Occurred();
+}
+
+/* Splits the records of self (read nblock at a time, with nchan channels)
+ * among the data sets of outs in one pass: each of (uv, lo, hi, pols,
+ * bls) gets channels lo..hi-1 of the records of the polarization codes
+ * pols and antenna pairs bls (None for all), with the variables
+ * uvcopyvr_c would copy and, for a channel range, its spectral windows
+ * cut down to match.  Each output is written by a thread of its own,
+ * from blocks read once by this one.  Returns the number of records read.
+ */
+PyObject * UVObject_fan_out(UVObject *self, PyObject *args) {
+    PyObject *outs;
+    int nblock, nchan;
+    std::deque<FanRoute> routes;
+    if (!PyArg_ParseTuple(args, "Oii", &outs, &nblock, &nchan)) return NULL;
+    if (nblock <= 0 || nchan < 0) {
+        PyErr_Format(PyExc_ValueError, "nblock must be positive and nchan not negative");
+        return NULL;
+    }
+    bool ok = fan_parse(self, outs, nchan, routes);
+    // Three blocks in flight: one being read, two being written
+    const int nslot = 3;
+    std::vector<FanSlot> slots(nslot);
+    PipeQueue<FanSlot> empty;
+    for (FanSlot &s : slots) s.b = NULL;
+    for (int k=0; ok && k < nslot; k++) {
+        slots[k].b = pipe_alloc(nblock, nchan, 0);
+        ok = slots[k].b != NULL;
+        empty.push(&slots[k]);
+    }
+    npy_intp total = 0;
+    std::string err;
+    bool failed = false;
+    if (ok) {
+        std::vector<std::string> names;
+        std::atomic<bool> wfailed(false);
+        Py_BEGIN_ALLOW_THREADS
+        std::vector<std::thread> writers;
+        for (FanRoute &route : routes) {
+            FanRoute *rt = &route;
+            writers.emplace_back([&, rt]() {
+                for (FanSlot *s=rt->q.pop(); s != NULL; s=rt->q.pop()) {
+                    if (!rt->failed && !uv_run(rt->out, [&]() { fan_write(self, *rt, s->b); }, rt->err)) {
+                        rt->failed = true;
+                        wfailed = true;
+                    }
+                    if (--s->refs == 0) empty.push(s);
+                }
+            });
+        }
+        while (!wfailed) {
+            FanSlot *s = empty.pop();
+            if (!uv_run(self, [&]() { pipe_read(self, s->b, names, NULL, true); }, err)) {
+                failed = true;
+                break;
+            }
+            if (s->b->nrec == 0) break;
+            total += s->b->nrec;
+            s->refs = (int) routes.size();
+            for (FanRoute &rt : routes) rt.q.push(s);
+            if (routes.empty()) empty.push(s);
+        }
+        for (FanRoute &rt : routes) rt.q.push(NULL);
+        for (std::thread &t : writers) t.join();
+        Py_END_ALLOW_THREADS
+        for (FanRoute &rt : routes) {
+            if (!failed && rt.failed) {
+                err = rt.err;
+                failed = true;
+            }
+        }
+    }
+    for (FanSlot &s : slots) pipe_free(s.b);
+    for (FanRoute &rt : routes) Py_XDECREF(rt.out);
+    if (!ok) return NULL;
+    if (failed) {
+        PyErr_Format(PyExc_RuntimeError, "%s", err.c_str());
+        return NULL;
+    }
+    return PyInt_FromLong((long) total);
+}
+
+// A thin wrapper over uvtrack_c
+PyObject * UVObject_trackvr(UVObject *self, PyObject *args) {
+    char *name, *sw;
+    if (!PyArg_ParseTuple(args, "ss", &name, &sw)) return NULL;
+    UVLock lock(self);
+    try {
+        uvtrack_c(self->tno, name, sw);
+    } catch (MiriadError &e) {
+        PyErr_Format(PyExc_RuntimeError, "%s", e.get_message());
+        return NULL;
+    }
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+// A thin wrapper over uvproject_c
+PyObject * UVObject_project(UVObject *self, PyObject *args) {
+    char *names;
+    if (!PyArg_ParseTuple(args, "s", &names)) return NULL;
+    UVLock lock(self);
+    try {
+        uvproject_c(self->tno, names);
+    } catch (MiriadError &e) {
+        PyErr_Format(PyExc_RuntimeError, "%s", e.get_message());
+        return NULL;
+    }
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+/* Tracks the comma-separated variables names (of type i, r or d): every
+ * raw_read and raw_read_into then refreshes, in place, the float64 array
+ * returned, so callers need no _rdvr per variable per record.  An empty
+ * string stops tracking and returns None.
+ */
+PyObject * UVObject_track(UVObject *self, PyObject *args) {
+    char *names;
+    if (!PyArg_ParseTuple(args, "s", &names)) return NULL;
+    std::vector<std::string> *v = new std::vector<std::string>;
+    for (char *p=names; *p; ) {
+        char *q = p;
+        while (*q && *q != ',') q++;
+        if (q > p) v->push_back(std::string(p, q - p));
+        p = *q ? q + 1 : q;
+    }
+    PyArrayObject *snap = NULL;
+    if (v->size() > 0) {
+        npy_intp dims[1] = {(npy_intp) v->size()};
+        snap = (PyArrayObject *) PyArray_SimpleNew(1, dims, NPY_DOUBLE);
+        if (snap == NULL) { delete v; return NULL; }
+        for (npy_intp k=0; k < dims[0]; k++) IND1(snap,k,double) = Py_NAN;
+    } else {
+        delete v;
+        v = NULL;
+    }
+    UVLock lock(self);
+    Py_XDECREF(self->snap);
+    delete self->snap_names;
+    self->snap = snap;
+    self->snap_names = v;
+    if (snap == NULL) {
+        Py_INCREF(Py_None);
+        return Py_None;
+    }
+    Py_INCREF(snap);
+    return (PyObject *) snap;
+}
+
+#define RET_IA(htype,pyconstructor,type1,type2,npy_type) \
+    if (length == 1) { \
+        uvgetvr_c(self->tno,htype,name,value,length); \
+        return pyconstructor((type1) ((type2 *)value)[0]); } \
+    rv = (PyArrayObject *) PyArray_SimpleNew(1,dims,npy_type); \
+    CHK_NULL(rv); \
+    uvgetvr_c(self->tno,htype,name,(char *)(PyArray_DATA(rv)),length);\
+    return PyArray_Return(rv);
+
+/* rdvr is responsible for reading variables of all types.  It wraps the
+ * output of uvgetvr_c into various python structures, and returns
+ * arrays as numpy arrays. */
+PyObject * UVObject_rdvr(UVObject *self, PyObject *args) {
+    char *name, *type, value[MAXVAR];
+    int length, updated;
+    npy_intp dims[1];
+    PyArrayObject *rv;
+    int elem_size;
+
+    if (!PyArg_ParseTuple(args, "ss", &name, &type))
+        return NULL;
+
+    UVLock lock(self);
+    uvprobvr_c(self->tno, name, value, &length, &updated);
+
+    switch (type[0]) {
+    case 'a':
+        elem_size = 1;
+        break;
+    case 'j':
+        elem_size = 2;
+        break;
+    case 'i':
+        elem_size = 4;
+        break;
+    case 'r':
+        elem_size = 4;
+        break;
+    case 'd':
+        elem_size = 8;
+        break;
+    case 'c':
+        elem_size = 8;
+        break;
+    default:
+        PyErr_Format(PyExc_ValueError, "unknown type of UV variable \"%s\": %c", name, type[0]);
+        return NULL;
+    }
+
+    if (length * elem_size > MAXVAR) {
+        PyErr_Format(PyExc_ValueError, "UV variable \"%s\" too big for aipy's "
+                     "internal buffers", name);
+        return NULL;
+    }
+
+    dims[0] = length;
+    try {
+        switch (type[0]) {
+            case 'a':
+                uvgetvr_c(self->tno,H_BYTE,name,value,length+1);
+                return PyString_FromStringAndSize(value, length);
+            case 'j':
+                uvgetvr_c(self->tno,H_INT2,name,value,length);
+                if (length == 1)
+                    return PyInt_FromLong((long) ((short *)value)[0]);
+                rv = (PyArrayObject *) PyArray_SimpleNew(1, dims, NPY_INT);
+                CHK_NULL(rv);
+                for (int i=0; i < length; i++)
+                    IND1(rv,i,int) = ((short *)value)[i];
+                return PyArray_Return(rv);
+            case 'i':
+                RET_IA(H_INT,PyInt_FromLong,long,int,NPY_INT);
+            case 'r':
+                RET_IA(H_REAL,PyFloat_FromDouble,double,float,NPY_FLOAT);
+            case 'd':
+                RET_IA(H_DBLE,PyFloat_FromDouble,double,double,NPY_DOUBLE);
+            case 'c':
+                if (length == 1) {
+                    uvgetvr_c(self->tno,H_CMPLX,name,value,length);
+                    return PyComplex_FromDoubles(((double *)value)[0],
+                                                 ((double *)value)[1]);
+                }
+                rv = (PyArrayObject *) PyArray_SimpleNew(1,dims,NPY_CDOUBLE);
+                CHK_NULL(rv);
+                uvgetvr_c(self->tno,H_CMPLX,name,(char *)PyArray_DATA(rv),length);
+                return PyArray_Return(rv);
+            default:
+                return NULL; /* can't happen with previous switch */
+        }
+    } catch (MiriadError &e) {
+        PyErr_Format(PyExc_RuntimeError, "%s", e.get_message());
+        return NULL;
+    }
+}
+
+#define STORE_IA(npy_type,htype,chk_type,type,pyconverter) \
+    if (PyArray_Check(wr_val)) { \
+        CHK_ARRAY_TYPE(wr_arr,npy_type); \
+        uvputvr_c(self->tno,htype,name,(char *) PyArray_DATA(wr_arr),DIM(wr_arr,0)); \
+    } else { \
+        chk_type(wr_val); \
+        ((type *)value)[0] = (type) pyconverter(wr_val); \
+        uvputvr_c(self->tno,htype,name,value,1); }
+
+/* wrvr is the complement of rdvr that uses uvputvr_c to write variables of
+ * various types.  Accepts numpy arrays for writing. */
+PyObject * UVObject_wrvr(UVObject *self, PyObject *args) {
+    char *name, *type, value[MAXVAR];
+    char *st;
+    PyObject *wr_val;
+    PyArrayObject *wr_arr=NULL;
+    if (!PyArg_ParseTuple(args, "ssO", &name, &type, &wr_val)) return NULL;
+    if (PyArray_Check(wr_val)) {
+        wr_arr = (PyArrayObject *) wr_val;
+        CHK_ARRAY_RANK(wr_arr,1);
+    }
+    UVLock lock(self);
+    try {
+        switch (type[0]) {
+            case 'a':
+                CHK_STRING(wr_val);
+                st = PyString_AsString(wr_val);
+                uvputvr_c(self->tno,H_BYTE,name, st, PyString_Size(wr_val)+1);
+                break;
+            case 'j':
+                STORE_IA(NPY_LONG,H_INT2,CHK_INT,short,PyInt_AsLong);
+                break;
+            case 'i':
+                STORE_IA(NPY_LONG,H_INT,CHK_INT,int,PyInt_AsLong);
+                break;
+            case 'r':
+                STORE_IA(NPY_FLOAT,H_REAL,CHK_FLOAT,float,PyFloat_AsDouble);
+                break;
+            case 'd':
+                STORE_IA(NPY_DOUBLE,H_DBLE,CHK_FLOAT,double,PyFloat_AsDouble);
+                break;
+            case 'c':
+                if (PyArray_Check(wr_val)) {
+                    CHK_ARRAY_TYPE(wr_arr,NPY_CDOUBLE);
+                    uvputvr_c(self->tno,H_CMPLX,name,(char *)PyArray_DATA(wr_arr),
+                        DIM(wr_arr,0));
+                } else {
+                    CHK_COMPLEX(wr_val);
+                    ((double *)value)[0] = PyComplex_RealAsDouble(wr_val);
+                    ((double *)value)[1] = PyComplex_ImagAsDouble(wr_val);
+                    uvputvr_c(self->tno,H_CMPLX,name,value,1);
+                }
+                break;
+            default:
+                PyErr_Format(PyExc_ValueError, "unknown UV variable type: %c", type[0]);
+                return NULL;
+        }
+        Py_INCREF(Py_None);
+        return Py_None;
+    } catch (MiriadError &e) {
+        PyErr_Format(PyExc_RuntimeError, "%s", e.get_message());
+        return NULL;
+    }
+}
+
+// A thin wrapper over uvselect_c
+PyObject * UVObject_select(UVObject *self, PyObject *args) {
+    char *name;
+    double n1, n2;
+    int include;
+    if (!PyArg_ParseTuple(args, "sddi", &name, &n1, &n2, &include)) return NULL;
+    UVLock lock(self);
+    try {
+        // Decimation keeps every n1'th integration, from integration n2
+        if (strncmp(name,"decimation",5) == 0) uvdecimate_c(self->tno, (int) n1, (int) n2);
+        else uvselect_c(self->tno, name, n1, n2, include);
+    } catch (MiriadError &e) {
+        PyErr_Format(PyExc_RuntimeError, "%s", e.get_message());
+        return NULL;
+    }
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+// A thin wrapper over haccess_c
+PyObject * UVObject_haccess(UVObject *self, PyObject *args) {
+    char *name, *mode;
+    int item_hdl, iostat;
+    if (!PyArg_ParseTuple(args, "ss", &name, &mode)) return NULL;
+    UVLock lock(self);
+    try {
+        haccess_c(self->tno, &item_hdl, name, mode, &iostat);
+        CHK_IO(iostat);
+        return PyInt_FromLong(item_hdl);
+    } catch (MiriadError &e) {
+        PyErr_Format(PyExc_RuntimeError, "%s", e.get_message());
+        return NULL;
+    }
+}
+
+/* Names of the data set's items, those in its header cache and its files,
+ * from one read of its directory (the "." item) */
+PyObject * UVObject_list_items(UVObject *self) {
+    int item_hdl, iostat;
+    std::vector<char> buf;
+    {
+        UVLock lock(self);
+        try {
+            haccess_c(self->tno, &item_hdl, ".", "read", &iostat);
+            CHK_IO(iostat);
+            buf.resize((size_t) hsize_c(item_hdl));
+            if (!buf.empty()) hreadb_c(item_hdl, &buf[0], 0, buf.size(), &iostat);
+            int iostat2;
+            hdaccess_c(item_hdl, &iostat2);
+            CHK_IO(iostat);
+        } catch (MiriadError &e) {
+            PyErr_Format(PyExc_RuntimeError, "%s", e.get_message());
+            return NULL;
+        }
+    }
+    PyObject *rv = PyList_New(0);
+    if (rv == NULL) return NULL;
+    for (size_t k=0, e; k < buf.size(); k=e+1) {
+        for (e=k; e < buf.size() && buf[e] != '\n'; e++) ;
+        if (e == k) continue;
+        PyObject *name = PyString_FromStringAndSize(&buf[k], e - k);
+        if (name == NULL || PyList_Append(rv, name) < 0) {
+            Py_XDECREF(name);
+            Py_DECREF(rv);
+            return NULL;
+        }
+        Py_DECREF(name);
+    }
+    return rv;
+}
+
+// A thin wrapper over hdaccess_c
+PyObject * WRAP_hdaccess(UVObject *self, PyObject *args) {
+    int item_hdl, iostat;
+    if (!PyArg_ParseTuple(args, "i", &item_hdl)) return NULL;
+    try {
+        hdaccess_c(item_hdl, &iostat);
+        Py_INCREF(Py_None);
+        return Py_None;
+    } catch (MiriadError &e) {
+        PyErr_Format(PyExc_RuntimeError, "%s", e.get_message());
+        return NULL;
+    }
+}
+
+PyObject * WRAP_set_bufsize(PyObject *self, PyObject *args) {
+    long size;
+    if (!PyArg_ParseTuple(args, "l", &size)) return NULL;
+    if (size < 0) {
+        PyErr_Format(PyExc_ValueError, "buffer size must be >= 0");
+        return NULL;
+    }
+    return PyInt_FromLong((long) hbufsize_c((size_t) size));
+}
+
+PyObject * WRAP_set_compress(PyObject *self, PyObject *args) {
+    PyObject *enable = Py_None;
+    int on = -1;
+    if (!PyArg_ParseTuple(args, "|O", &enable)) return NULL;
+    if (enable != Py_None && (on = PyObject_IsTrue(enable)) < 0) return NULL;
+    return PyBool_FromLong(hcompress_c(on));
+}
+
+PyObject * WRAP_set_scratch(PyObject *self, PyObject *args) {
+    char *mode;
+    double maxmb=0;
+    if (!PyArg_ParseTuple(args, "s|d", &mode, &maxmb)) return NULL;
+    if ((strcmp(mode, "disk") != 0 && strcmp(mode, "memory") != 0) || maxmb < 0) {
+        PyErr_Format(PyExc_ValueError, "scratch mode must be 'disk' or 'memory', with maxmb >= 0");
+        return NULL;
+    }
+    scrmode_c(mode, maxmb);
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+/* scropen, scrclose, scrread and scrwrite move float32 data through the
+ * scratch files of scrio (see set_scratch) */
+PyObject * WRAP_scropen(PyObject *self) {
+    int handle;
+    bugrecover_c(error_handler);
+    try {
+        scropen_c(&handle);
+    } catch (MiriadError &e) {
+        PyErr_Format(PyExc_RuntimeError, "%s", e.get_message());
+        return NULL;
+    }
+    return PyInt_FromLong(handle);
+}
+
+PyObject * WRAP_scrclose(PyObject *self, PyObject *args) {
+    int handle;
+    if (!PyArg_ParseTuple(args, "i", &handle)) return NULL;
+    bugrecover_c(error_handler);
+    try {
+        scrclose_c(handle);
+    } catch (MiriadError &e) {
+        PyErr_Format(PyExc_RuntimeError, "%s", e.get_message());
+        return NULL;
+    }
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+static PyObject * scr_io(PyObject *args, bool write) {
+    PyArrayObject *data;
+    int handle, offset;
+    if (!PyArg_ParseTuple(args, "iO!i", &handle, &PyArray_Type, &data, &offset)) return NULL;
+    if (PyArray_TYPE(data) != NPY_FLOAT || RANK(data) != 1
+            || !(write ? PyArray_ISCARRAY_RO(data) : PyArray_ISCARRAY(data))
+            || PyArray_DIM(data,0) > INT_MAX || offset < 0) {
+        PyErr_Format(PyExc_ValueError, "data must be a C-contiguous 1D float32 array%s, and offset >= 0",
+                     write ? "" : " (writeable)");
+        return NULL;
+    }
+    int n = (int) PyArray_DIM(data,0);
+    bugrecover_c(error_handler);
+    try {
+        if (write) scrwrite_c(handle, (float *) PyArray_DATA(data), offset, n);
+        else scrread_c(handle, (float *) PyArray_DATA(data), offset, n);
+    } catch (MiriadError &e) {
+        PyErr_Format(PyExc_RuntimeError, "%s", e.get_message());
+        return NULL;
+    }
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+PyObject * WRAP_scrread(PyObject *self, PyObject *args) {
+    return scr_io(args, false);
+}
+
+PyObject * WRAP_scrwrite(PyObject *self, PyObject *args) {
+    return scr_io(args, true);
+}
+
+/* stats reads the counters of hio, dio and uvio (see hcount_c) */
+PyObject * WRAP_stats(PyObject *self, PyObject *args, PyObject *kwargs) {
+    PyObject *d, *v;
+    int enable, reset, i;
+    char name[64];
+    long long value;
+    if (aipy_stats_args(args, kwargs, &enable, &reset) != 0) return NULL;
+    if (enable >= 0) hcount_c(enable);
+    if ((d = PyDict_New()) == NULL) return NULL;
+    for (i=0; hcount_get_c(i, name, sizeof(name), &value); i++) {
+        if ((v = PyLong_FromLongLong(value)) == NULL
+                || PyDict_SetItemString(d, name, v) != 0) {
+            Py_XDECREF(v);
+            Py_DECREF(d);
+            return NULL;
+        }
+        Py_DECREF(v);
+    }
+    if (reset) hcount_reset_c();
+    return d;
+}
+
+/* Image cubes through xyzio, which keeps its buffers and set-ups in
+ * globals: these calls hold the GIL throughout.  xyz_cubes records, per
+ * handle, the cube's axes and what its last xyzsetup implies for the
+ * coordinates and arrays of xyzread and xyzwrite (naxis 0 = not open). */
+struct XyzCube {
+    int naxis, axlen[MAXNAX];
+    int dimsub, n;      // subcube axes and pixels, dimsub < 0 before setup
+};
+static XyzCube xyz_cubes[MAXOPEN];
+
+#define CHK_XYZ(tno) \
+    if (tno < 0 || tno >= MAXOPEN || xyz_cubes[tno].naxis == 0) { \
+        PyErr_Format(PyExc_ValueError, "not an open image cube: %d", tno); \
+        return NULL; }
+
+// Reads the sequence o of up to MAXNAX ints into v: its length, or -1
+static int xyz_ints(PyObject *o, int *v, const char *name) {
+    PyObject *seq = PySequence_Fast(o, name);
+    if (seq == NULL) return -1;
+    Py_ssize_t n = PySequence_Fast_GET_SIZE(seq);
+    if (n > MAXNAX) {
+        Py_DECREF(seq);
+        PyErr_Format(PyExc_ValueError, "%s has more than %d entries", name, MAXNAX);
+        return -1;
+    }
+    for (Py_ssize_t k=0; k < n; k++) {
+        v[k] = (int) PyInt_AsLong(PySequence_Fast_GET_ITEM(seq, k));
+        if (v[k] == -1 && PyErr_Occurred()) {
+            Py_DECREF(seq);
+            return -1;
+        }
+    }
+    Py_DECREF(seq);
+    return (int) n;
+}
+
+static PyObject *xyz_tuple(const int *v, int n) {
+    PyObject *t = PyTuple_New(n);
+    if (t == NULL) return NULL;
+    for (int k=0; k < n; k++) PyTuple_SET_ITEM(t, k, PyInt_FromLong(v[k]));
+    return t;
+}
+
+// Checks the float32 data and optional int32 mask (*mask = NULL for None)
+// of an xyzread or xyzwrite, which must hold one subcube each, and the
+// coords of the axes not in the subcube
+static int xyz_args(int tno, PyObject *cobj, PyObject *dobj, PyObject *mobj,
+        int *coords, int **mask) {
+    PyArrayObject *d = (PyArrayObject *) dobj, *m = (PyArrayObject *) mobj;
+    XyzCube &c = xyz_cubes[tno];
+    if (c.dimsub < 0) {
+        PyErr_Format(PyExc_ValueError, "xyzsetup was not called for image cube %d", tno);
+        return -1;
+    }
+    if (!PyArray_Check(dobj) || TYPE(d) != NPY_FLOAT || !PyArray_ISCARRAY(d)
+            || PyArray_SIZE(d) != c.n) {
+        PyErr_Format(PyExc_ValueError, "data must be a C-contiguous float32 array of %d pixels", c.n);
+        return -1;
+    }
+    *mask = NULL;
+    if (mobj != Py_None) {
+        if (!PyArray_Check(mobj) || TYPE(m) != NPY_INT || !PyArray_ISCARRAY(m)
+                || PyArray_SIZE(m) != c.n) {
+            PyErr_Format(PyExc_ValueError, "mask must be a C-contiguous int32 array of %d pixels", c.n);
+            return -1;
+        }
+        *mask = (int *) PyArray_DATA(m);
+    }
+    if (xyz_ints(cobj, coords, "coords") != c.naxis - c.dimsub) {
+        if (!PyErr_Occurred())
+            PyErr_Format(PyExc_ValueError, "coords must have %d entries", c.naxis - c.dimsub);
+        return -1;
+    }
+    return 0;
+}
+
+PyObject * WRAP_xyzopen(PyObject *self, PyObject *args) {
+    char *name, *status;
+    PyObject *aobj=Py_None;
+    int tno, naxis=MAXNAX, axlen[MAXNAX];
+    if (!PyArg_ParseTuple(args, "ss|O", &name, &status, &aobj)) return NULL;
+    if (strcmp(status, "new") == 0) {
+        if (aobj == Py_None) {
+            PyErr_Format(PyExc_ValueError, "a new image cube needs axlen");
+            return NULL;
+        }
+        if ((naxis = xyz_ints(aobj, axlen, "axlen")) < 0) return NULL;
+        bool ok = naxis > 0;
+        for (int k=0; k < naxis; k++) ok = ok && axlen[k] > 0;
+        if (!ok) {
+            PyErr_Format(PyExc_ValueError, "axlen must be 1 to %d positive lengths", MAXNAX);
+            return NULL;
+        }
+    } else if (strcmp(status, "old") != 0) {
+        PyErr_Format(PyExc_ValueError, "image cube status must be 'old' or 'new'");
+        return NULL;
+    }
+    bugrecover_c(error_handler);
+    try {
+        xyzopen_c(&tno, name, status, &naxis, axlen);
+    } catch (MiriadError &e) {
+        PyErr_Format(PyExc_RuntimeError, "%s", e.get_message());
+        return NULL;
+    }
+    XyzCube &c = xyz_cubes[tno];
+    c.naxis = naxis;
+    for (int k=0; k < naxis; k++) c.axlen[k] = axlen[k];
+    c.dimsub = -1;
+    return Py_BuildValue("iN", tno, xyz_tuple(axlen, naxis));
+}
+
+PyObject * WRAP_xyzclose(PyObject *self, PyObject *args) {
+    int tno;
+    if (!PyArg_ParseTuple(args, "i", &tno)) return NULL;
+    CHK_XYZ(tno);
+    xyz_cubes[tno].naxis = 0;
+    try {
+        xyzclose_c(tno);
+    } catch (MiriadError &e) {
+        PyErr_Format(PyExc_RuntimeError, "%s", e.get_message());
+        return NULL;
+    }
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+PyObject * WRAP_xyzflush(PyObject *self, PyObject *args) {
+    int tno;
+    if (!PyArg_ParseTuple(args, "i", &tno)) return NULL;
+    CHK_XYZ(tno);
+    try {
+        xyzflush_c(tno);
+    } catch (MiriadError &e) {
+        PyErr_Format(PyExc_RuntimeError, "%s", e.get_message());
+        return NULL;
+    }
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
+PyObject * WRAP_xyzsetup(PyObject *self, PyObject *args) {
+    int tno, blc[MAXNAX], trc[MAXNAX], viraxlen[MAXNAX], vircubesize[MAXNAX];
+    char *subcube;
+    PyObject *bobj=Py_None, *tobj=Py_None;
+    if (!PyArg_ParseTuple(args, "is|OO", &tno, &subcube, &bobj, &tobj)) return NULL;
+    CHK_XYZ(tno);
+    XyzCube &c = xyz_cubes[tno];
+    for (int k=0; k < c.naxis; k++) {
+        blc[k] = 1;
+        trc[k] = c.axlen[k];
+    }
+    if ((bobj != Py_None && xyz_ints(bobj, blc, "blc") != c.naxis)
+            || (tobj != Py_None && xyz_ints(tobj, trc, "trc") != c.naxis)) {
+        if (!PyErr_Occurred())
+            PyErr_Format(PyExc_ValueError, "blc and trc must have %d entries", c.naxis);
+        return NULL;
+    }
+    int dimsub = 0;
+    for (char *a=subcube; *a; a++) if (*a != ' ' && *a != '-') dimsub++;
+    c.dimsub = -1;
+    try {
+        xyzsetup_c(tno, subcube, blc, trc, viraxlen, vircubesize);
+    } catch (MiriadError &e) {
+        PyErr_Format(PyExc_RuntimeError, "%s", e.get_message());
+        return NULL;
+    }
+    c.dimsub = dimsub;
+    c.n = dimsub > 0 ? vircubesize[dimsub-1] : 1;
+    return Py_BuildValue("NN", xyz_tuple(viraxlen, c.naxis), xyz_tuple(vircubesize, c.naxis));
+}
+
+PyObject * WRAP_xyzread(PyObject *self, PyObject *args) {
+    int tno, coords[MAXNAX], ndata, *mask;
+    PyObject *cobj, *dobj, *mobj=Py_None;
+    if (!PyArg_ParseTuple(args, "iOO|O", &tno, &cobj, &dobj, &mobj)) return NULL;
+    CHK_XYZ(tno);
+    if (xyz_args(tno, cobj, dobj, mobj, coords, &mask) != 0) return NULL;
+    std::vector<int> m(mask ? 0 : xyz_cubes[tno].n);
+    try {
+        xyzread_c(tno, coords, (float *) PyArray_DATA((PyArrayObject *) dobj),
+            mask ? mask : m.data(), &ndata);
+    } catch (MiriadError &e) {
+        PyErr_Format(PyExc_RuntimeError, "%s", e.get_message());
+        return NULL;
+    }
+    return PyInt_FromLong(ndata);
+}
+
+PyObject * WRAP_xyzwrite(PyObject *self, PyObject *args) {
+    int tno, coords[MAXNAX], ndata, *mask;
+    PyObject *cobj, *dobj, *mobj=Py_None;
+    if (!PyArg_ParseTuple(args, "iOO|O", &tno, &cobj, &dobj, &mobj)) return NULL;
+    CHK_XYZ(tno);
+    if (xyz_args(tno, cobj, dobj, mobj, coords, &mask) != 0) return NULL;
+    std::vector<int> m(mask ? 0 : xyz_cubes[tno].n, 1);
+    ndata = xyz_cubes[tno].n;
+    try {
+        xyzwrite_c(tno, coords, (float *) PyArray_DATA((PyArrayObject *) dobj),
+            mask ? mask : m.data(), &ndata);
     } catch (MiriadError &e) {
         PyErr_Format(PyExc_RuntimeError, "%s", e.get_message());
         return NULL;
@@ -184,26 +2141,68 @@ PyObject * UVObject_write(UVObject *self, PyObject *args) {
     return Py_None;
 }
 
-// A thin wrapper over uvcopyvr_c
-PyObject * UVObject_copyvr(UVObject *self, PyObject *args) {
-    UVObject *uv;
-    if (!PyArg_ParseTuple(args, "O!", &UVType, &uv)) return NULL;
+/* rdhd and wrhd read and write a header keyword of an open image cube
+ * through headio, by its type as stored (rdhd) or as given (wrhd) */
+PyObject * WRAP_rdhd(PyObject *self, PyObject *args) {
+    int tno, n, iv;
+    char *key, descr[80], type[16], sv[1024];
+    int8 lv;
+    double dv;
+    float cv[2], cdef[2] = {0, 0};
+    if (!PyArg_ParseTuple(args, "is", &tno, &key)) return NULL;
+    CHK_XYZ(tno);
     try {
-        uvcopyvr_c(uv->tno, self->tno);
+        hdprobe_c(tno, key, descr, sizeof(descr), type, &n);
+        if (strcmp(type, "nonexistent") == 0) {
+            PyErr_Format(PyExc_KeyError, "%s", key);
+            return NULL;
+        } else if (strcmp(type, "integer") == 0 || strcmp(type, "integer*2") == 0) {
+            rdhdi_c(tno, key, &iv, 0);
+            return PyInt_FromLong(iv);
+        } else if (strcmp(type, "integer*8") == 0) {
+            rdhdl_c(tno, key, &lv, 0);
+            return PyLong_FromLongLong(lv);
+        } else if (strcmp(type, "real") == 0 || strcmp(type, "double") == 0) {
+            rdhdd_c(tno, key, &dv, 0.);
+            return PyFloat_FromDouble(dv);
+        } else if (strcmp(type, "complex") == 0) {
+            rdhdc_c(tno, key, cv, cdef);
+            return PyComplex_FromDoubles(cv[0], cv[1]);
+        } else if (strcmp(type, "character") == 0 || strcmp(type, "text") == 0) {
+            rdhda_c(tno, key, sv, "", sizeof(sv));
+            return PyString_FromString(sv);
+        }
     } catch (MiriadError &e) {
         PyErr_Format(PyExc_RuntimeError, "%s", e.get_message());
         return NULL;
     }
-    Py_INCREF(Py_None);
-    return Py_None;
+    PyErr_Format(PyExc_ValueError, "cannot read %s header item %s", type, key);
+    return NULL;
 }
 
-// A thin wrapper over uvtrack_c
-PyObject * UVObject_trackvr(UVObject *self, PyObject *args) {
-    char *name, *sw;
-    if (!PyArg_ParseTuple(args, "ss", &name, &sw)) return NULL;
+PyObject * WRAP_wrhd(PyObject *self, PyObject *args) {
+    int tno;
+    char *key;
+    PyObject *val;
+    if (!PyArg_ParseTuple(args, "isO", &tno, &key, &val)) return NULL;
+    CHK_XYZ(tno);
     try {
-        uvtrack_c(self->tno, name, sw);
+        if (PyLong_Check(val)) {
+            long long v = PyLong_AsLongLong(val);
+            if (v == -1 && PyErr_Occurred()) return NULL;
+            if (v == (int) v) wrhdi_c(tno, key, (int) v);
+            else wrhdl_c(tno, key, (int8) v);
+        } else if (PyFloat_Check(val)) {
+            wrhdd_c(tno, key, PyFloat_AsDouble(val));
+        } else if (PyComplex_Check(val)) {
+            float cv[2] = {(float) PyComplex_RealAsDouble(val), (float) PyComplex_ImagAsDouble(val)};
+            wrhdc_c(tno, key, cv);
+        } else if (PyString_Check(val)) {
+            wrhda_c(tno, key, PyString_AsString(val));
+        } else {
+            PyErr_Format(PyExc_ValueError, "header values must be int, float, complex or str");
+            return NULL;
+        }
     } catch (MiriadError &e) {
         PyErr_Format(PyExc_RuntimeError, "%s", e.get_message());
         return NULL;
@@ -212,213 +2211,156 @@ PyObject * UVObject_trackvr(UVObject *self, PyObject *args) {
     return Py_None;
 }
 
-#define RET_IA(htype,pyconstructor,type1,type2,npy_type) \
-    if (length == 1) { \
-        uvgetvr_c(self->tno,htype,name,value,length); \
-        return pyconstructor((type1) ((type2 *)value)[0]); } \
-    rv = (PyArrayObject *) PyArray_SimpleNew(1,dims,npy_type); \
-    CHK_NULL(rv); \
-    uvgetvr_c(self->tno,htype,name,(char *)(PyArray_DATA(rv)),length);\
-    return PyArray_Return(rv);
-
-/* rdvr is responsible for reading variables of all types.  It wraps the
- * output of uvgetvr_c into various python structures, and returns
- * arrays as numpy arrays. */
-PyObject * UVObject_rdvr(UVObject *self, PyObject *args) {
-    char *name, *type, value[MAXVAR];
-    int length, updated;
-    npy_intp dims[1];
-    PyArrayObject *rv;
-    int elem_size;
-
-    if (!PyArg_ParseTuple(args, "ss", &name, &type))
+/* sma_decode turns the records of raw SMA data that sma_to_uv locates in
+ * a memory-mapped sch_read into a block of visibilities, on native threads
+ * with the GIL released */
+PyObject * WRAP_sma_decode(PyObject *self, PyObject *args) {
+    PyArrayObject *out, *buf, *pos, *nch, *dst;
+    float isign=-1;
+    int nthreads=0;
+    long rv;
+    if (!PyArg_ParseTuple(args, "O!O!O!O!O!|fi", &PyArray_Type, &out,
+            &PyArray_Type, &buf, &PyArray_Type, &pos, &PyArray_Type, &nch,
+            &PyArray_Type, &dst, &isign, &nthreads))
         return NULL;
-
-
-    uvprobvr_c(self->tno, name, value, &length, &updated);
-
-    switch (type[0]) {
-    case 'a':
-        elem_size = 1;
-        break;
-    case 'j':
-        elem_size = 2;
-        break;
-    case 'i':
-        elem_size = 4;
-        break;
-    case 'r':
-        elem_size = 4;
-        break;
-    case 'd':
-        elem_size = 8;
-        break;
-    case 'c':
-        elem_size = 8;
-        break;
-    default:
-        PyErr_Format(PyExc_ValueError, "unknown type of UV variable \"%s\": %c", name, type[0]);
+    if (TYPE(out) != NPY_CFLOAT || !PyArray_ISCARRAY(out)) {
+        PyErr_Format(PyExc_ValueError, "out must be a writeable C-contiguous complex64 array");
         return NULL;
     }
-
-    if (length * elem_size > MAXVAR) {
-        PyErr_Format(PyExc_ValueError, "UV variable \"%s\" too big for aipy's "
-                     "internal buffers", name);
+    if (TYPE(buf) != NPY_UBYTE || RANK(buf) != 1 || !PyArray_ISCONTIGUOUS(buf)) {
+        PyErr_Format(PyExc_ValueError, "buf must be a contiguous 1-D uint8 array");
+        return NULL;
+    }
+    long nspec = (long) PyArray_SIZE(nch);
+    if (!PyArray_EquivTypenums(TYPE(pos), NPY_INT64) || !PyArray_ISCARRAY_RO(pos)
+            || TYPE(nch) != NPY_INT || !PyArray_ISCARRAY_RO(nch)
+            || !PyArray_EquivTypenums(TYPE(dst), NPY_INT64) || !PyArray_ISCARRAY_RO(dst)
+            || PyArray_SIZE(pos) != nspec || PyArray_SIZE(dst) != nspec) {
+        PyErr_Format(PyExc_ValueError, "pos and dst must be int64 and nch int32 C-contiguous arrays of one length");
         return NULL;
     }
 
-    dims[0] = length;
-    try {
-        switch (type[0]) {
-            case 'a':
-                uvgetvr_c(self->tno,H_BYTE,name,value,length+1);
-                return PyString_FromStringAndSize(value, length);
-            case 'j':
-                uvgetvr_c(self->tno,H_INT2,name,value,length);
-                if (length == 1)
-                    return PyInt_FromLong((long) ((short *)value)[0]);
-                rv = (PyArrayObject *) PyArray_SimpleNew(1, dims, NPY_INT);
-                CHK_NULL(rv);
-                for (int i=0; i < length; i++)
-                    IND1(rv,i,int) = ((short *)value)[i];
-                return PyArray_Return(rv);
-            case 'i':
-                RET_IA(H_INT,PyInt_FromLong,long,int,NPY_INT);
-            case 'r':
-                RET_IA(H_REAL,PyFloat_FromDouble,double,float,NPY_FLOAT);
-            case 'd':
-                RET_IA(H_DBLE,PyFloat_FromDouble,double,double,NPY_DOUBLE);
-            case 'c':
-                if (length == 1) {
-                    uvgetvr_c(self->tno,H_CMPLX,name,value,length);
-                    return PyComplex_FromDoubles(((double *)value)[0],
-                                                 ((double *)value)[1]);
-                }
-                rv = (PyArrayObject *) PyArray_SimpleNew(1,dims,NPY_CDOUBLE);
-                CHK_NULL(rv);
-                uvgetvr_c(self->tno,H_CMPLX,name,(char *)PyArray_DATA(rv),length);
-                return PyArray_Return(rv);
-            default:
-                return NULL; /* can't happen with previous switch */
-        }
-    } catch (MiriadError &e) {
-        PyErr_Format(PyExc_RuntimeError, "%s", e.get_message());
+    Py_INCREF(out);
+    Py_INCREF(buf);
+    Py_INCREF(pos);
+    Py_INCREF(nch);
+    Py_INCREF(dst);
+    Py_BEGIN_ALLOW_THREADS
+    rv = sma_decode((float *) PyArray_DATA(out), (long long) PyArray_SIZE(out),
+                    (unsigned char *) PyArray_DATA(buf), (long long) PyArray_SIZE(buf),
+                    (long long *) PyArray_DATA(pos), (int *) PyArray_DATA(nch),
+                    (long long *) PyArray_DATA(dst), nspec, isign, nthreads);
+    Py_END_ALLOW_THREADS
+    Py_DECREF(out);
+    Py_DECREF(buf);
+    Py_DECREF(pos);
+    Py_DECREF(nch);
+    Py_DECREF(dst);
+    if (rv != 0) {
+        PyErr_Format(PyExc_ValueError, "spectrum %ld lies outside the data or out", rv - 1);
         return NULL;
     }
+    Py_INCREF(Py_None);
+    return Py_None;
 }
 
-#define STORE_IA(npy_type,htype,chk_type,type,pyconverter) \
-    if (PyArray_Check(wr_val)) { \
-        CHK_ARRAY_TYPE(wr_arr,npy_type); \
-        uvputvr_c(self->tno,htype,name,(char *) PyArray_DATA(wr_arr),DIM(wr_arr,0)); \
-    } else { \
-        chk_type(wr_val); \
-        ((type *)value)[0] = (type) pyconverter(wr_val); \
-        uvputvr_c(self->tno,htype,name,value,1); }
-
-/* wrvr is the complement of rdvr that uses uvputvr_c to write variables of
- * various types.  Accepts numpy arrays for writing. */
-PyObject * UVObject_wrvr(UVObject *self, PyObject *args) {
-    char *name, *type, value[MAXVAR];
-    char *st;
-    PyObject *wr_val;
-    PyArrayObject *wr_arr=NULL;
-    if (!PyArg_ParseTuple(args, "ssO", &name, &type, &wr_val)) return NULL;
-    if (PyArray_Check(wr_val)) {
-        wr_arr = (PyArrayObject *) wr_val;
-        CHK_ARRAY_RANK(wr_arr,1);
+/* apply_gains applies per-antenna gains, interpolated in time, to a
+ * block of records in place (see gain_apply.cpp) */
+PyObject * WRAP_apply_gains(PyObject *self, PyObject *args) {
+    PyArrayObject *data, *ij, *pidx, *t, *gains, *gtimes;
+    PyObject *fobj=Py_None;
+    int divide=0, nthreads=0;
+    long rv;
+    if (!PyArg_ParseTuple(args, "O!OO!O!O!O!O!|ii", &PyArray_Type, &data, &fobj,
+            &PyArray_Type, &ij, &PyArray_Type, &pidx, &PyArray_Type, &t,
+            &PyArray_Type, &gains, &PyArray_Type, &gtimes, &divide, &nthreads))
+        return NULL;
+    npy_intp n = RANK(data) == 2 ? DIM(data,0) : -1;
+    npy_intp nchan = RANK(data) == 2 ? DIM(data,1) : -1;
+    PyArrayObject *flags = fobj == Py_None ? NULL : (PyArrayObject *) fobj;
+    if (n < 0 || TYPE(data) != NPY_CFLOAT || !PyArray_ISCARRAY(data)
+            || (flags != NULL && (!PyArray_Check(fobj) || !chk_block(flags, NPY_BOOL, n, nchan)
+                || !PyArray_ISWRITEABLE(flags)))) {
+        PyErr_Format(PyExc_ValueError, "data (n,nchan) must be a writeable C-contiguous "
+            "complex64 array, and flags None or a writeable bool array of its shape");
+        return NULL;
     }
-    try {
-        switch (type[0]) {
-            case 'a':
-                CHK_STRING(wr_val);
-                st = PyString_AsString(wr_val);
-                uvputvr_c(self->tno,H_BYTE,name, st, PyString_Size(wr_val)+1);
-                break;
-            case 'j':
-                STORE_IA(NPY_LONG,H_INT2,CHK_INT,short,PyInt_AsLong);
-                break;
-            case 'i':
-                STORE_IA(NPY_LONG,H_INT,CHK_INT,int,PyInt_AsLong);
-                break;
-            case 'r':
-                STORE_IA(NPY_FLOAT,H_REAL,CHK_FLOAT,float,PyFloat_AsDouble);
-                break;
-            case 'd':
-                STORE_IA(NPY_DOUBLE,H_DBLE,CHK_FLOAT,double,PyFloat_AsDouble);
-                break;
-            case 'c':
-                if (PyArray_Check(wr_val)) {
-                    CHK_ARRAY_TYPE(wr_arr,NPY_CDOUBLE);
-                    uvputvr_c(self->tno,H_CMPLX,name,(char *)PyArray_DATA(wr_arr),
-                        DIM(wr_arr,0));
-                } else {
-                    CHK_COMPLEX(wr_val);
-                    ((double *)value)[0] = PyComplex_RealAsDouble(wr_val);
-                    ((double *)value)[1] = PyComplex_ImagAsDouble(wr_val);
-                    uvputvr_c(self->tno,H_CMPLX,name,value,1);
-                }
-                break;
-            default:
-                PyErr_Format(PyExc_ValueError, "unknown UV variable type: %c", type[0]);
-                return NULL;
-        }
-        Py_INCREF(Py_None);
-        return Py_None;
-    } catch (MiriadError &e) {
-        PyErr_Format(PyExc_RuntimeError, "%s", e.get_message());
+    if (!chk_block(ij, NPY_INT, n, 2) || !chk_block(pidx, NPY_INT, n, 2)
+            || !chk_block(t, NPY_DOUBLE, n, -1)) {
+        PyErr_Format(PyExc_ValueError, "ij (n,2) and pidx (n,2) must be C-contiguous "
+            "int32 arrays, and t (n,) float64");
+        return NULL;
+    }
+    if (TYPE(gains) != NPY_CFLOAT || RANK(gains) != 4 || !PyArray_ISCARRAY_RO(gains)
+            || DIM(gains,3) != nchan || DIM(gains,0) < 1 || TYPE(gtimes) != NPY_DOUBLE
+            || RANK(gtimes) != 1 || !PyArray_ISCARRAY_RO(gtimes) || DIM(gtimes,0) != DIM(gains,0)) {
+        PyErr_Format(PyExc_ValueError, "gains must be a C-contiguous complex64 "
+            "(ntime,nant,npol,nchan) array with ntime > 0, and gtimes (ntime,) float64");
         return NULL;
     }
-}
 
-// A thin wrapper over uvselect_c
-PyObject * UVObject_select(UVObject *self, PyObject *args) {
-    char *name;
-    double n1, n2;
-    int include;
-    if (!PyArg_ParseTuple(args, "sddi", &name, &n1, &n2, &include)) return NULL;
-    if (strncmp(name,"decimation",5) == 0) {
-        self->decimate = (long) n1;
-        self->decphase = (long) n2;
-    } else {
-        try {
-            uvselect_c(self->tno, name, n1, n2, include);
-        } catch (MiriadError &e) {
-            PyErr_Format(PyExc_RuntimeError, "%s", e.get_message());
-            return NULL;
-        }
+    Py_INCREF(data);
+    Py_XINCREF(flags);
+    Py_INCREF(ij);
+    Py_INCREF(pidx);
+    Py_INCREF(t);
+    Py_INCREF(gains);
+    Py_INCREF(gtimes);
+    Py_BEGIN_ALLOW_THREADS
+    rv = gain_apply((float *) PyArray_DATA(data),
+                    flags == NULL ? NULL : (unsigned char *) PyArray_DATA(flags),
+                    (long) n, (long) nchan, (int *) PyArray_DATA(ij),
+                    (int *) PyArray_DATA(pidx), (double *) PyArray_DATA(t),
+                    (float *) PyArray_DATA(gains), (double *) PyArray_DATA(gtimes),
+                    (long) DIM(gains,0), (long) DIM(gains,1), (long) DIM(gains,2),
+                    divide, nthreads);
+    Py_END_ALLOW_THREADS
+    Py_DECREF(data);
+    Py_XDECREF(flags);
+    Py_DECREF(ij);
+    Py_DECREF(pidx);
+    Py_DECREF(t);
+    Py_DECREF(gains);
+    Py_DECREF(gtimes);
+    if (rv != 0) {
+        PyErr_Format(PyExc_ValueError, "record %ld has an antenna or polarization "
+            "outside the gain table", rv - 1);
+        return NULL;
     }
     Py_INCREF(Py_None);
     return Py_None;
 }
 
-// A thin wrapper over haccess_c
-PyObject * UVObject_haccess(UVObject *self, PyObject *args) {
-    char *name, *mode;
-    int item_hdl, iostat;
-    if (!PyArg_ParseTuple(args, "ss", &name, &mode)) return NULL;
-    try {
-        haccess_c(self->tno, &item_hdl, name, mode, &iostat);
-        CHK_IO(iostat);
-        return PyInt_FromLong(item_hdl);
-    } catch (MiriadError &e) {
-        PyErr_Format(PyExc_RuntimeError, "%s", e.get_message());
+/* jpl_parse parses the entries of a JPL line catalog file for jpl_index */
+PyObject * WRAP_jpl_parse(PyObject *self, PyObject *args) {
+    PyArrayObject *buf, *dval, *ival, *qn;
+    long n;
+    if (!PyArg_ParseTuple(args, "O!O!O!O!", &PyArray_Type, &buf, &PyArray_Type, &dval,
+            &PyArray_Type, &ival, &PyArray_Type, &qn))
+        return NULL;
+    if (TYPE(buf) != NPY_UBYTE || RANK(buf) != 1 || !PyArray_ISCONTIGUOUS(buf)) {
+        PyErr_Format(PyExc_ValueError, "buf must be a contiguous 1-D uint8 array");
         return NULL;
     }
-}
-
-// A thin wrapper over hdaccess_c
-PyObject * WRAP_hdaccess(UVObject *self, PyObject *args) {
-    int item_hdl, iostat;
-    if (!PyArg_ParseTuple(args, "i", &item_hdl)) return NULL;
-    try {
-        hdaccess_c(item_hdl, &iostat);
-        Py_INCREF(Py_None);
-        return Py_None;
-    } catch (MiriadError &e) {
-        PyErr_Format(PyExc_RuntimeError, "%s", e.get_message());
+    long maxline = RANK(dval) == 2 ? (long) DIM(dval,0) : -1;
+    if (TYPE(dval) != NPY_DOUBLE || maxline < 0 || DIM(dval,1) != 4 || !PyArray_ISCARRAY(dval)
+            || TYPE(ival) != NPY_INT || RANK(ival) != 2 || DIM(ival,0) != maxline
+            || DIM(ival,1) != 4 || !PyArray_ISCARRAY(ival)
+            || TYPE(qn) != NPY_SHORT || RANK(qn) != 2 || DIM(qn,0) != maxline
+            || DIM(qn,1) != JPL_NQN || !PyArray_ISCARRAY(qn)) {
+        PyErr_Format(PyExc_ValueError, "dval (n,4) float64, ival (n,4) int32 and qn (n,%d) int16 must be writeable C-contiguous arrays", JPL_NQN);
         return NULL;
     }
+    Py_BEGIN_ALLOW_THREADS
+    n = jpl_parse((char *) PyArray_DATA(buf), (long) PyArray_SIZE(buf), maxline,
+                  (double *) PyArray_DATA(dval), (int *) PyArray_DATA(ival),
+                  (short *) PyArray_DATA(qn));
+    Py_END_ALLOW_THREADS
+    if (n < 0) {
+        PyErr_Format(PyExc_ValueError, "malformed catalog entry on line %ld", -n);
+        return NULL;
+    }
+    return PyInt_FromLong(n);
 }
 
 #define INIT(type_item,size) \
@@ -623,6 +2565,158 @@ PyObject * WRAP_hread(PyObject *self, PyObject *args) {
     }
 }
 
+/* The hio type, element size and numpy type (-1 for bytes) of an item
+ * type; 0, or -1 with a ValueError set if it is unknown.  hio holds int2
+ * values in ints, so j items are int32 arrays. */
+static int item_type(const char *type, int &htype, int &size, int &npytype) {
+    switch (type[0]) {
+        case 'a': case 'b': htype = H_BYTE; size = H_BYTE_SIZE; npytype = -1; break;
+        case 'i': htype = H_INT; size = H_INT_SIZE; npytype = NPY_INT; break;
+        case 'j': htype = H_INT2; size = H_INT2_SIZE; npytype = NPY_INT; break;
+        case 'l': htype = H_INT8; size = H_INT8_SIZE; npytype = NPY_LONG; break;
+        case 'r': htype = H_REAL; size = H_REAL_SIZE; npytype = NPY_FLOAT; break;
+        case 'd': htype = H_DBLE; size = H_DBLE_SIZE; npytype = NPY_DOUBLE; break;
+        case 'c': htype = H_CMPLX; size = H_CMPLX_SIZE; npytype = NPY_CFLOAT; break;
+        default:
+            PyErr_Format(PyExc_ValueError, "unknown item type: %c", type[0]);
+            return -1;
+    }
+    return 0;
+}
+
+/* hread_array reads n elements of a header item (all of them from offset on
+ * if n < 0) in one hread_c call: bytes for types a and b, else an array. */
+PyObject * WRAP_hread_array(PyObject *self, PyObject *args) {
+    int item_hdl, offset, iostat, htype, size, npytype;
+    long n=-1;
+    char *type;
+    PyObject *rv;
+    if (!PyArg_ParseTuple(args, "isi|l", &item_hdl, &type, &offset, &n))
+        return NULL;
+    if (item_type(type, htype, size, npytype) != 0) return NULL;
+    try {
+        if (n < 0) n = (long) ((hsize_c(item_hdl) - offset) / size);
+        if (n < 0) n = 0;
+        npy_intp dims[1] = {(npy_intp) n};
+        if (npytype < 0) rv = PyBytes_FromStringAndSize(NULL, n);
+        else rv = PyArray_SimpleNew(1, dims, npytype);
+        if (rv == NULL) return NULL;
+        if (n > 0) {
+            char *buf = npytype < 0 ? PyBytes_AS_STRING(rv) :
+                (char *) PyArray_DATA((PyArrayObject *) rv);
+            hio_c(item_hdl, FALSE, htype, buf, offset, (size_t) n * size, &iostat);
+            if (iostat != 0) {
+                Py_DECREF(rv);
+                CHK_IO(iostat);
+            }
+        }
+        return rv;
+    } catch (MiriadError &e) {
+        PyErr_Format(PyExc_RuntimeError, "%s", e.get_message());
+        return NULL;
+    }
+}
+
+/* hwrite_array writes bytes (types a and b) or the values of a 1-d array,
+ * cast to the type, to a header item from offset on in one hio_c call.
+ * Returns the number of bytes written. */
+PyObject * WRAP_hwrite_array(PyObject *self, PyObject *args) {
+    int item_hdl, offset, iostat, htype, size, npytype;
+    char *type, *buf;
+    PyObject *o;
+    PyArrayObject *a = NULL;
+    long n;
+    if (!PyArg_ParseTuple(args, "isiO", &item_hdl, &type, &offset, &o))
+        return NULL;
+    if (item_type(type, htype, size, npytype) != 0) return NULL;
+    if (npytype < 0) {
+        if (!PyBytes_Check(o)) {
+            PyErr_Format(PyExc_ValueError, "expected bytes for item type %c", type[0]);
+            return NULL;
+        }
+        buf = PyBytes_AS_STRING(o);
+        n = (long) PyBytes_GET_SIZE(o);
+    } else {
+        a = (PyArrayObject *) PyArray_FROMANY(o, npytype, 1, 1,
+            NPY_ARRAY_IN_ARRAY | NPY_ARRAY_FORCECAST);
+        if (a == NULL) return NULL;
+        buf = (char *) PyArray_DATA(a);
+        n = (long) PyArray_DIM(a, 0);
+    }
+    try {
+        iostat = 0;
+        if (n > 0) hio_c(item_hdl, TRUE, htype, buf, offset, (size_t) n * size, &iostat);
+        Py_XDECREF(a);
+        CHK_IO(iostat);
+        return PyInt_FromLong(n * size);
+    } catch (MiriadError &e) {
+        Py_XDECREF(a);
+        PyErr_Format(PyExc_RuntimeError, "%s", e.get_message());
+        return NULL;
+    }
+}
+
+/* bl2ij_array decodes an array of Miriad baseline numbers (either
+ * encoding, as GETI/GETJ) into int32 arrays of i and j of its shape. */
+PyObject * WRAP_bl2ij_array(PyObject *self, PyObject *args) {
+    PyObject *o;
+    if (!PyArg_ParseTuple(args, "O", &o)) return NULL;
+    PyArrayObject *bl = (PyArrayObject *) PyArray_FROMANY(o, NPY_DOUBLE, 0, 0,
+        NPY_ARRAY_IN_ARRAY | NPY_ARRAY_FORCECAST);
+    if (bl == NULL) return NULL;
+    PyObject *i = PyArray_SimpleNew(PyArray_NDIM(bl), PyArray_DIMS(bl), NPY_INT);
+    PyObject *j = PyArray_SimpleNew(PyArray_NDIM(bl), PyArray_DIMS(bl), NPY_INT);
+    if (i == NULL || j == NULL) {
+        Py_DECREF(bl); Py_XDECREF(i); Py_XDECREF(j);
+        return NULL;
+    }
+    const double *b = (const double *) PyArray_DATA(bl);
+    int *pi = (int *) PyArray_DATA((PyArrayObject *) i);
+    int *pj = (int *) PyArray_DATA((PyArrayObject *) j);
+    npy_intp n = PyArray_SIZE(bl);
+    for (npy_intp k=0; k < n; k++) {
+        pi[k] = GETI(b[k]);
+        pj[k] = GETJ(b[k]);
+    }
+    Py_DECREF(bl);
+    return Py_BuildValue("(NN)", i, j);
+}
+
+/* ij2bl_array encodes arrays of antenna pairs (of one shape) as Miriad
+ * baseline numbers, int64, ordering each pair as ij2bl does. */
+PyObject * WRAP_ij2bl_array(PyObject *self, PyObject *args) {
+    PyObject *oi, *oj;
+    if (!PyArg_ParseTuple(args, "OO", &oi, &oj)) return NULL;
+    PyArrayObject *ai = (PyArrayObject *) PyArray_FROMANY(oi, NPY_LONGLONG, 0, 0,
+        NPY_ARRAY_IN_ARRAY | NPY_ARRAY_FORCECAST);
+    if (ai == NULL) return NULL;
+    PyArrayObject *aj = (PyArrayObject *) PyArray_FROMANY(oj, NPY_LONGLONG, 0, 0,
+        NPY_ARRAY_IN_ARRAY | NPY_ARRAY_FORCECAST);
+    if (aj == NULL) {
+        Py_DECREF(ai);
+        return NULL;
+    }
+    if (PyArray_SIZE(ai) != PyArray_SIZE(aj)) {
+        PyErr_Format(PyExc_ValueError, "i and j must have the same shape");
+        Py_DECREF(ai); Py_DECREF(aj);
+        return NULL;
+    }
+    PyObject *bl = PyArray_SimpleNew(PyArray_NDIM(ai), PyArray_DIMS(ai), NPY_LONGLONG);
+    if (bl != NULL) {
+        const long long *pi = (const long long *) PyArray_DATA(ai);
+        const long long *pj = (const long long *) PyArray_DATA(aj);
+        long long *b = (long long *) PyArray_DATA((PyArrayObject *) bl);
+        npy_intp n = PyArray_SIZE(ai);
+        for (npy_intp k=0; k < n; k++) {
+            long long i = pi[k] < pj[k] ? pi[k] : pj[k], j = pi[k] < pj[k] ? pj[k] : pi[k];
+            b[k] = j + 1 < 256 ? 256*(i+1) + (j+1) : 2048*(i+1) + (j+1) + 65536;
+        }
+    }
+    Py_DECREF(ai);
+    Py_DECREF(aj);
+    return bl;
+}
+
 /*_        __                     _               _   _
  \ \      / / __ __ _ _ __  _ __ (_)_ __   __ _  | | | |_ __
   \ \ /\ / / '__/ _` | '_ \| '_ \| | '_ \ / _` | | | | | '_ \
@@ -634,14 +2728,44 @@ PyObject * WRAP_hread(PyObject *self, PyObject *args) {
 static PyMethodDef UVObject_methods[] = {
     {"rewind", (PyCFunction)UVObject_rewind, METH_NOARGS,
         "rewind()\nSeek to the beginning of a UV file."},
+    {"_peek", (PyCFunction)UVObject_peek, METH_NOARGS,
+        "_peek()\nRead the variables of the first record, leaving its data and flags undecoded, and rewind, so that variables have values before the first read."},
+    {"_vartable", (PyCFunction)UVObject_vartable, METH_NOARGS,
+        "_vartable()\nReturn a dict of the types (a,j,i,r,d,c) of the variables, by name, as parsed from the vartable item (and any added since)."},
+    {"seek_time", (PyCFunction)UVObject_seek_time, METH_VARARGS,
+        "seek_time(t,forward=0)\nSeek to the first run of records (in file order) with time >= t, or to the end of the file if there is none, with variables as they are there.  With 'forward', only runs from the current one on are considered and the file never moves back.  Only for files opened 'old'; uses the file's record index, read from its 'visindex' item (see write_index) or else built by a pass over the record headers on first use and kept in memory."},
+    {"write_index", (PyCFunction)UVObject_write_index, METH_NOARGS,
+        "write_index()\nSave the record index seek_time uses as the 'visindex' item of a file opened 'old', building it first if need be, so that later opens seek without a pass over the record headers.  Reading never writes the index by itself.  Raises RuntimeError if the file is not writable."},
     {"raw_read", (PyCFunction)UVObject_read, METH_VARARGS,
         "_read(num)\nRead up to the specified number of channels from a spectrum.  Returns (preamble, data, flags) where preamble = (uvw,time,(ant_i,ant_j)), data = complex64 numpy array of data, flags = integer32 array of data valid where == 1.  Note that this definition of flags is the inverse of numpy's definition."},
+    {"raw_read_block", (PyCFunction)UVObject_read_block, METH_VARARGS,
+        "raw_read_block(uvw,t,ij,data,flags,vars=None,masked=False)\nRead up to len(uvw) records into the preallocated, C-contiguous arrays uvw (n,3) and t (n,) (float64), ij (n,2) (int32 antenna pairs), data (n,nchan) (complex64) and flags (n,nchan) (int32 or bool, valid where true as for _read(), or invalid (numpy's convention) if 'masked').  'vars' may be a sequence of (name, array) pairs, each array (n,) of int16, int32, float32 or float64 (Miriad types j, i, r, d) to receive the variable's (first) value after each record.  Channels past the end of a short record are zeroed and flagged.  Returns the number of records read (less than n at the end of the file)."},
+    {"raw_set_average", (PyCFunction)UVObject_set_average, METH_VARARGS,
+        "raw_set_average(nt,nchan)\nStart averaging nt integrations and nchan channels for raw_read_average, discarding any averages still pending.  rewind and seek_time also clear the averager."},
+    {"raw_read_average", (PyCFunction)UVObject_read_average, METH_VARARGS,
+        "raw_read_average(uvw,t,ij,pol,data,flags,wgt)\nRead (time-ordered) records through the averager until len(uvw) averages are complete or the file ends, averaging each baseline and polarization natively with the GIL released, and copy them into the preallocated, C-contiguous arrays uvw (n,3) and t (n,) (float64, the means over the records averaged), ij (n,2) and pol (n,) (int32), data (n,nout) (complex64, the mean of the valid samples), flags (n,nout) (bool, True where no sample was valid) and wgt (n,nout) (float32, the number of valid samples).  Returns the number of averages copied (less than n at the end of the file)."},
+    {"raw_to_cube", (PyCFunction)UVObject_to_cube, METH_NOARGS,
+        "raw_to_cube()\nRead every selected record from the start into a dense cube, in two native passes with the GIL released: one that indexes the records without decoding their data, and one that decodes each record straight into its place.  Returns (data, flags, times, ij, pols): data (ntime,nbl,npol,nchan) complex64 and flags (same shape) bool, True where invalid or where there was no record; the sorted times and (nbl,2) int32 antenna pairs, and the polarizations in order of appearance.  The file is left rewound."},
+    {"raw_write_block", (PyCFunction)UVObject_write_block, METH_VARARGS,
+        "raw_write_block(uvw,t,ij,data,flags,vars=None)\nWrite len(uvw) records from the C-contiguous arrays uvw (n,3) and t (n,) (float64), ij (n,2) (int32 antenna pairs), data (n,nchan) (complex64) and flags (n,nchan) (int32, valid where == 1), as for raw_read_block().  'vars' may be a sequence of (name, array) pairs, each array (n,) of int16, int32, float32 or float64 (Miriad types j, i, r, d), whose kth value is written before record k (Miriad skips unchanged values)."},
     {"raw_write", (PyCFunction)UVObject_write, METH_VARARGS,
         "_write(preamble,data,flags)\nWrite the provided preamble, data, flags to file.  See _read() for definitions of preamble, data, flags."},
+    {"raw_read_into", (PyCFunction)UVObject_read_into, METH_VARARGS,
+        "raw_read_into(data,flags,uvw=None,masked=False)\nAs _read(len(data)), but into the caller's C-contiguous (rows of larger arrays will do) complex64 'data' and int32 or bool 'flags', and float64 'uvw' (3,) if given.  flags are valid where true, or invalid (numpy's convention) if 'masked'.  Returns (preamble, nread)."},
+    {"raw_write_from", (PyCFunction)UVObject_write_from, METH_VARARGS,
+        "raw_write_from(preamble,data,flags,masked=False)\nAs _write(), straight from the caller's C-contiguous complex64 'data' and int32 or bool 'flags' (valid where true, or invalid if 'masked'), without copying them."},
     {"copyvr", (PyCFunction)UVObject_copyvr, METH_VARARGS,
         "copyvr(uv)\nCopy any variables which changed during the last read into the provided uv interface."},
+    {"raw_pipe", (PyCFunction)UVObject_pipe, METH_VARARGS,
+        "raw_pipe(uv,mfunc,nblock,nchan,threaded=False,cal=None)\nWrite the records of uv, read nblock at a time with nchan channels, through mfunc(uvw,t,ij,data,flags,vars), which gets them as raw_read_block() returns them (flags bool, invalid where true) with vars (n,nvar) float64 holding uv's tracked variables (see _track()), and returns None (to drop the block) or (uvw,t,ij,data,flags[,keep]), keep (n,) bool choosing the records to write.  mfunc None copies the records.  Variables are copied (as by copyvr()) record by record.  With 'cal', (gains,gtimes,pols,divide,nthreads) as for apply_gains() with each record's polarization code looked up in pols, a sequence of (code,feed_i,feed_j) giving its pidx, the gains are applied natively to each block as it is read, before mfunc.  With 'threaded', reading and writing run on threads of their own, a block ahead and behind mfunc.  Returns the number of records read."},
+    {"raw_fan_out", (PyCFunction)UVObject_fan_out, METH_VARARGS,
+        "raw_fan_out(outs,nblock,nchan)\nSplit the records of this data set, read once, nblock at a time with nchan channels, among the data sets of outs, a sequence of (uv,lo,hi,pols,bls): each gets channels lo..hi-1 of the records whose polarization code is in pols and whose antenna pair (i,j) is in bls (None for all), with the variables copyvr() would copy and, when cut to a channel range, nspect, nschan, ischan, sfreq and sdf cut down to match.  Each output is written on a thread of its own.  Returns the number of records read."},
     {"trackvr", (PyCFunction)UVObject_trackvr, METH_VARARGS,
         "trackvr(name,code)\nIf code=='c', set variable to be copied by copyvr()."},
+    {"_project", (PyCFunction)UVObject_project, METH_VARARGS,
+        "_project(names)\nRead only the comma-separated variables names as records are read; others are read when asked for.  An empty string reads all."},
+    {"_track", (PyCFunction)UVObject_track, METH_VARARGS,
+        "_track(names)\nAfter each raw_read() or raw_read_into(), store the values of the comma-separated scalar variables names (of type i, r or d) in the float64 array returned, in place (NaN for a variable with no value).  An empty string stops tracking and returns None."},
     {"_rdvr", (PyCFunction)UVObject_rdvr, METH_VARARGS,
         "_rdvr(name,type)\nReturn the current value of a variable of the provided Miriad type (a,j,i,r,d,c).  If variable has multiple values, an array (or string if pertinent) will be returned."},
     {"_wrvr", (PyCFunction)UVObject_wrvr, METH_VARARGS,
@@ -650,6 +2774,8 @@ static PyMethodDef UVObject_methods[] = {
         "_select(name,n1,n2,include)\nSelect which data is returned by _read().  See select() for more information."},
     {"haccess", (PyCFunction)UVObject_haccess, METH_VARARGS,
         "haccess(name,mode)\nOpen a header item in the given mode ('read','write').  Returns an integer handle."},
+    {"list_items", (PyCFunction)UVObject_list_items, METH_NOARGS,
+        "list_items()\nReturn the names of the items in the data set (those in its header cache and its files), read from its directory at once."},
     {NULL}  /* Sentinel */
 };
 
@@ -707,6 +2833,52 @@ static PyMethodDef _miriad_methods[] = {
         "hwrite(handle,offset,value,type)\nWrite a value at the provided offset to an open header item of the given type."},
     {"hread", (PyCFunction)WRAP_hread, METH_VARARGS,
         "hread(handle,offset,type)\nRead a value of the given type from an open header item at the provided offset."},
+    {"bl2ij_array", (PyCFunction)WRAP_bl2ij_array, METH_VARARGS,
+        "bl2ij_array(bl)\nDecode an array of Miriad baseline numbers (int or float, either the 256 or the 2048 encoding) into int32 arrays (i, j) of its shape, 0-indexed."},
+    {"ij2bl_array", (PyCFunction)WRAP_ij2bl_array, METH_VARARGS,
+        "ij2bl_array(i,j)\nEncode arrays of 0-indexed antennas i and j (of one shape) as int64 Miriad baseline numbers, each pair ordered, as ij2bl does."},
+    {"hread_array", (PyCFunction)WRAP_hread_array, METH_VARARGS,
+        "hread_array(handle,type,offset,n=-1)\nRead n values (all from offset on if n < 0) of the given type from an open header item in one call.  Returns bytes for types a and b, else a numpy array (int32 for type j)."},
+    {"hwrite_array", (PyCFunction)WRAP_hwrite_array, METH_VARARGS,
+        "hwrite_array(handle,type,offset,data)\nWrite bytes (types a and b) or the values of a 1-d array, cast to the given type, to an open header item from offset on in one call.  Return the number of bytes written."},
+    {"set_bufsize", (PyCFunction)WRAP_set_bufsize, METH_VARARGS,
+        "set_bufsize(size)\nSet the size in bytes of the i/o buffers of items opened from now on (0 leaves it unchanged; the minimum is the compiled-in default, which the HIO_BUFSIZE environment variable overrides).  Return the previous size."},
+    {"set_compress", (PyCFunction)WRAP_set_compress, METH_VARARGS,
+        "set_compress(enable=None)\nSwitch on or off the lossless compression of the visdata, flags and wflags of data sets opened 'new' from now on (None leaves it unchanged; the HIO_COMPRESS environment variable switches it on to begin with).  Compressed data sets are read like any other, but decoding costs CPU: the chunk after the one being read is decoded on a background thread, so reading in order keeps up with plain data only when a spare core is free, and otherwise takes about 2.5x as long.  Return the previous setting."},
+    {"set_scratch", (PyCFunction)WRAP_set_scratch, METH_VARARGS,
+        "set_scratch(mode,maxmb=0)\nKeep the scratch files opened from now on on disk ('disk', the default) or in memory ('memory'), the memory ones together taking at most maxmb megabytes (0 for no limit): the one that would pass it moves to a disk scratch file and carries on there.  The MIRSCRATCH environment variable ('disk' or 'memory', optionally followed by ':maxmb') sets the mode to begin with."},
+    {"scropen", (PyCFunction)WRAP_scropen, METH_NOARGS,
+        "scropen()\nOpen a scratch file, kept as set_scratch chose.  Returns its handle."},
+    {"scrclose", (PyCFunction)WRAP_scrclose, METH_VARARGS,
+        "scrclose(handle)\nClose and delete a scratch file."},
+    {"scrread", (PyCFunction)WRAP_scrread, METH_VARARGS,
+        "scrread(handle,data,offset)\nRead len(data) reals from a scratch file, from offset (in reals) on, into the C-contiguous float32 data."},
+    {"scrwrite", (PyCFunction)WRAP_scrwrite, METH_VARARGS,
+        "scrwrite(handle,data,offset)\nWrite the C-contiguous float32 data to a scratch file from offset (in reals) on.  Writes past the end grow the file, zero filling any gap."},
+    {"xyzopen", (PyCFunction)WRAP_xyzopen, METH_VARARGS,
+        "xyzopen(name,status,axlen=None)\nOpen a MIRIAD image cube for xyzio: status 'old', or 'new' with the axis lengths axlen (x first).  Returns (handle, axlen).  xyzio keeps its buffers in globals, so cubes are for one thread at a time."},
+    {"xyzclose", (PyCFunction)WRAP_xyzclose, METH_VARARGS,
+        "xyzclose(handle)\nFlush and close an image cube."},
+    {"xyzflush", (PyCFunction)WRAP_xyzflush, METH_VARARGS,
+        "xyzflush(handle)\nWrite the buffered output of an image cube to disk, leaving it open."},
+    {"xyzsetup", (PyCFunction)WRAP_xyzsetup, METH_VARARGS,
+        "xyzsetup(handle,subcube,blc=None,trc=None)\nSet up the subcubes that xyzread and xyzwrite move, as xyzsetup_c: subcube names their axes ('xy' for planes, 'z' for profiles, '-' reverses one), within the region from blc to trc (1-based, inclusive; the whole cube by default).  Returns (viraxlen, vircubesize) of the virtual cube, whose axes are in subcube order."},
+    {"xyzread", (PyCFunction)WRAP_xyzread, METH_VARARGS,
+        "xyzread(handle,coords,data,mask=None)\nRead the subcube at the 1-based coords of the axes not in it into the C-contiguous float32 data, and its flags (nonzero = good) into the int32 mask, each of vircubesize[dimsub-1] pixels from the last xyzsetup.  Returns the pixels read."},
+    {"xyzwrite", (PyCFunction)WRAP_xyzwrite, METH_VARARGS,
+        "xyzwrite(handle,coords,data,mask=None)\nWrite the subcube at the 1-based coords of the axes not in it from data and mask (None = all good), arrays as xyzread takes.  Output is buffered (at most MAXBUF pixels are held) until it is flushed by a later subcube, xyzflush, xyzclose or xyzsetup."},
+    {"rdhd", (PyCFunction)WRAP_rdhd, METH_VARARGS,
+        "rdhd(handle,key)\nRead a header keyword of an open image cube, as int, float, complex or str by its stored type.  Raises KeyError if it is absent."},
+    {"wrhd", (PyCFunction)WRAP_wrhd, METH_VARARGS,
+        "wrhd(handle,key,value)\nWrite a header keyword of an open image cube: an int (32 or 64 bit), float (as double), complex or str."},
+    {"sma_decode", (PyCFunction)WRAP_sma_decode, METH_VARARGS,
+        "sma_decode(out,buf,pos,nch,dst,isign=-1,nthreads=0)\nDecode the spectra of raw SMA data whose records start at byte offsets pos (int64) of buf (uint8, as a memory map of sch_read), each of nch (int32) channels scaled by 2**scale, into the complex64 out from flat sample offsets dst (int64) on, with imaginary parts multiplied by isign (-1 for the MIRIAD sign convention).  Spectra are shared among 'nthreads' native threads (0 = aipy.get_num_threads()), with the GIL released.  See miriad.sma_to_uv."},
+    {"jpl_parse", (PyCFunction)WRAP_jpl_parse, METH_VARARGS,
+        "jpl_parse(buf,dval,ival,qn)\nParse the entries of a JPL line catalog file (the 80-column lines of a c<tag>.cat, as the uint8 buf) into the rows of dval (float64: freq, err, lgint, elo), ival (int32: dr, gup, tag, qnfmt) and qn (int16: 6 upper and 6 lower quantum numbers, decoded as jplread.c's readqn), skipping blank lines.  Returns the entries parsed; ValueError if one is malformed or there are more than rows.  See miriad.jpl_index."},
+    {"apply_gains", (PyCFunction)WRAP_apply_gains, METH_VARARGS,
+        "apply_gains(data,flags,ij,pidx,t,gains,gtimes,divide=False,nthreads=0)\nMultiply the records of data (n,nchan) (complex64) in place by g_i*conj(g_j) for their antennas ij (n,2) (int32), or with 'divide' divide by it, flagging channels of zero gain in flags (None or (n,nchan) bool, invalid where true).  gains (ntime,nant,npol,nchan) (complex64) are sampled at the ascending gtimes (float64) and interpolated linearly to the times t (n,) of the records, held beyond the first and last; pidx (n,2) (int32) indexes the npol axis for the feeds of antennas i and j of each record (so g_x*conj(g_y) for xy), records with a negative one being left alone.  Records are shared among 'nthreads' native threads (0 = aipy.get_num_threads()), with the GIL released, in loops that vectorise.  See miriad.apply_gains."},
+    {"stats", (PyCFunction)WRAP_stats, METH_VARARGS|METH_KEYWORDS,
+        "stats(enable=None,reset=False)\nReturn a dict of the i/o and decoding counters of all data sets: calls and bytes of the low-level reads and writes (dread, dwrite), uvread calls and nanoseconds, records read, skipped by selection and written, nanoseconds unpacking correlations and decoding flags, and the bytes read and written of each item ('item.<name>.read_bytes', 'item.<name>.write_bytes') opened while counting.  Counting is off until switched on by enable=True (and off again by enable=False); while off it costs a test of a flag.  reset zeroes the counters after returning them."},
     {NULL}  /* Sentinel */
 };
 
@@ -716,7 +2888,6 @@ MOD_INIT(_miriad) {
 
     Py_Initialize();
 
-    UVType.tp_new = PyType_GenericNew;
     if (PyType_Ready(&UVType) < 0)
         return MOD_ERROR_VAL;
 
@@ -727,6 +2898,8 @@ MOD_INIT(_miriad) {
         return MOD_ERROR_VAL;
 
     import_array();
+    if (aipy_pool_import() < 0)
+        return MOD_ERROR_VAL;
 
     Py_INCREF(&UVType);
     PyModule_AddObject(m, "UV", (PyObject *)&UVType);
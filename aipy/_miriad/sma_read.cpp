@@ -0,0 +1,45 @@
+// Decoding of the spectra of raw SMA (MIR format) data for sma_to_uv in
+// miriad.py.  The header tables (in_read, bl_read, sp_read, codes_read)
+// are read there, once; this turns the records of sch_read that they
+// point to into blocks of visibilities.  As sma_mirRead.c (the reader of
+// the MIRIAD task smalod) documents, a record is 5 big-endian shorts of
+// header (integ, toff, dnoise as two shorts, scale) followed by a pair of
+// shorts for each channel, restored_data = 2**scale * short_data.
+// Spectra are independent and shared among threads.
+
+#include "sma_read.h"
+#include "aipy_pool.h"
+#include <cmath>
+#include <vector>
+
+static inline int be_short(const unsigned char *b) {
+    return (short) ((b[0] << 8) | b[1]);
+}
+
+// Decodes the nspec spectra of nch[s] channels whose records start at
+// byte pos[s] of buf (nbuf bytes) into the complex samples (re, im pairs)
+// dst[s] on of out (nout samples), with the imaginary parts multiplied by
+// isign (-1 turns the OVRO sign convention of MIR data into MIRIAD's).
+// Returns 0, or 1 + the first spectrum that lies outside buf or out, in
+// which case nothing is written.
+extern "C"
+long sma_decode(float *out, long long nout, const unsigned char *buf, long long nbuf,
+        const long long *pos, const int *nch, const long long *dst, long nspec,
+        float isign, int nthreads) {
+    for (long s=0; s < nspec; s++) {
+        if (nch[s] < 0 || pos[s] < 0 || pos[s] + 10 + 4LL*nch[s] > nbuf
+                || dst[s] < 0 || dst[s] + nch[s] > nout)
+            return s + 1;
+    }
+    aipy_parallel(nspec, nthreads, [&](long s, int) {
+        const unsigned char *r = buf + pos[s];
+        float scale = (float) std::ldexp(1., be_short(r + 8));
+        float *o = out + 2*dst[s];
+        r += 10;
+        for (int c=0; c < nch[s]; c++, r+=4) {
+            o[2*c] = scale * be_short(r);
+            o[2*c+1] = isign * scale * be_short(r + 2);
+        }
+    });
+    return 0;
+}
@@ -0,0 +1,15 @@
+#ifndef _SMA_READ_H_
+#define _SMA_READ_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+long sma_decode(float *, long long, const unsigned char *, long long,
+        const long long *, const int *, const long long *, long, float, int);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,74 @@
+// Averaging of UV records in time and frequency for raw_read_average in
+// miriad_wrap.cpp, which reads the records and copies out the averages.
+
+#include "uv_average.h"
+#include <cmath>
+#include <utility>
+
+void UVAverage::clear() {
+    index.clear();
+    open.clear();
+    done.clear();
+    last_t = NAN;
+    ntime = 0;
+}
+
+void UVAverage::add(const double *preamble, int pol, const float *data,
+        const int *flags, int nread) {
+    // A new time that starts a new bin completes the old one
+    if (preamble[3] != last_t) {
+        if (ntime > 0 && ntime % nt == 0) flush();
+        last_t = preamble[3];
+        ntime++;
+    }
+    std::pair<double,int> key(preamble[4], pol);
+    std::map<std::pair<double,int>, size_t>::iterator it = index.find(key);
+    if (it == index.end()) {
+        it = index.insert(std::make_pair(key, open.size())).first;
+        open.push_back(Acc());
+        Acc &a = open.back();
+        a.uvw[0] = a.uvw[1] = a.uvw[2] = a.t = 0;
+        a.bl = preamble[4];
+        a.pol = pol;
+        a.nrec = 0;
+    }
+    Acc &a = open[it->second];
+    size_t nout = (nread + nchan - 1) / nchan;
+    if (a.w.size() < nout) {
+        a.re.resize(nout, 0.);
+        a.im.resize(nout, 0.);
+        a.w.resize(nout, 0.);
+    }
+    for (int k=0; k < 3; k++) a.uvw[k] += preamble[k];
+    a.t += preamble[3];
+    a.nrec++;
+    for (int c=0; c < nread; c++) {
+        if (flags[c] == 0) continue;
+        a.re[c/nchan] += data[2*c];
+        a.im[c/nchan] += data[2*c+1];
+        a.w[c/nchan] += 1;
+    }
+}
+
+void UVAverage::flush() {
+    for (size_t k=0; k < open.size(); k++) done.push_back(std::move(open[k]));
+    open.clear();
+    index.clear();
+}
+
+void UVAverage::pop(double *uvw, double *t, double *bl, int *pol, float *data,
+        unsigned char *flags, float *wgt, int nout) {
+    const Acc &a = done.front();
+    for (int k=0; k < 3; k++) uvw[k] = a.uvw[k] / a.nrec;
+    *t = a.t / a.nrec;
+    *bl = a.bl;
+    *pol = a.pol;
+    for (int c=0; c < nout; c++) {
+        double w = (size_t) c < a.w.size() ? a.w[c] : 0;
+        data[2*c] = w > 0 ? (float) (a.re[c] / w) : 0;
+        data[2*c+1] = w > 0 ? (float) (a.im[c] / w) : 0;
+        flags[c] = w == 0;
+        wgt[c] = (float) w;
+    }
+    done.pop_front();
+}
@@ -0,0 +1,51 @@
+#ifndef _UV_AVERAGE_H_
+#define _UV_AVERAGE_H_
+
+#include <cstddef>
+#include <map>
+#include <vector>
+#include <deque>
+
+/* Flag-weighted averaging of a stream of UV records over nt integrations
+ * and nchan channels, for each baseline and polarization.  Records must
+ * arrive in time order, as MIRIAD writes them; every nt distinct times
+ * make a bin, and the averages of a bin are completed when the first
+ * record of the next one arrives (or on flush), in the order in which
+ * their baselines and polarizations first appeared.  Only the open bin is
+ * held, so memory does not grow with the length of the stream.
+ */
+class UVAverage {
+  public:
+    UVAverage(int nt, int nchan) : nt(nt), nchan(nchan) { clear(); }
+    // Adds a record: preamble (u, v, w, t, baseline), its polarization,
+    // nread channels of data (re, im pairs) and flags (valid where nonzero)
+    void add(const double *preamble, int pol, const float *data,
+        const int *flags, int nread);
+    // Completes the averages of the open bin
+    void flush();
+    // Forgets everything, as for a rewind
+    void clear();
+    // The number of completed averages waiting to be popped
+    size_t ready() const { return done.size(); }
+    // Pops the oldest completed average: uvw (3), t, bl, pol, and nout
+    // channels of data (re, im pairs), flags (invalid where true) and
+    // weights (the number of valid samples averaged); channels it lacks
+    // are zeroed and flagged
+    void pop(double *uvw, double *t, double *bl, int *pol, float *data,
+        unsigned char *flags, float *wgt, int nout);
+    const int nt, nchan;
+
+  private:
+    struct Acc {
+        double uvw[3], t, bl;
+        int pol, nrec;
+        std::vector<double> re, im, w;
+    };
+    std::map<std::pair<double,int>, size_t> index;
+    std::vector<Acc> open;
+    std::deque<Acc> done;
+    double last_t;
+    long ntime;
+};
+
+#endif
@@ -0,0 +1,180 @@
+// The native thread pool behind aipy.set_num_threads, shared by the
+// extension modules through the C API of aipy_pool.h.  Workers are started
+// as loops first need them and then kept, blocked on a condition variable,
+// for the life of the process, so a parallel loop costs a wake-up rather
+// than a thread start per thread.  A loop is a job on a queue with a seat
+// for each helper it asked for; workers take seats first come, first
+// served, and all participants claim items off the job's counter, so the
+// items go to whoever is free (a worker busy with another module's loop
+// just never gets to this one, whose caller does its share).  Pool threads
+// and callers taking part in a loop run the loops they start themselves
+// serially: nesting never multiplies the threads.
+
+#include <Python.h>
+#include "aipy_compat.h"
+#include "aipy_pool.h"
+#include <cstdlib>
+#include <deque>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <system_error>
+#include <pthread.h>
+
+#define POOL_MAX_THREADS 1024
+
+struct PoolJob {
+    void (*fn)(void *, long, int);
+    void *ctx;
+    long n;
+    std::atomic<long> next;
+    int seats;      // helper seats not yet taken
+    int tid;        // the participant number of the next helper
+    int active;     // helpers taking part
+};
+
+struct Pool {
+    std::mutex mu;
+    std::condition_variable work, done;
+    std::deque<PoolJob *> queue;   // jobs with seats left
+    int nworkers;
+    Pool() : nworkers(0) {}
+};
+
+// Never freed: detached workers may still be waiting on it at exit.  A
+// forked child gets a fresh one, as the workers are not forked with it.
+static Pool *pool = new Pool();
+static std::atomic<int> pool_setting(0);   // 0 = one per core
+static thread_local int pool_inside = 0;   // on a pool thread or in a loop
+
+static int pool_default(void) {
+    int n = (int) std::thread::hardware_concurrency();
+    return n > 0 ? n : 1;
+}
+
+static int pool_get(void) {
+    int n = pool_setting.load();
+    return n > 0 ? n : pool_default();
+}
+
+static int pool_nthreads(long n, int nthreads) {
+    if (pool_inside) return 1;
+    if (nthreads <= 0) nthreads = pool_get();
+    if (nthreads > POOL_MAX_THREADS) nthreads = POOL_MAX_THREADS;
+    if (nthreads > n) nthreads = (int) n;
+    return nthreads > 0 ? nthreads : 1;
+}
+
+static void pool_loop(PoolJob *job, int tid) {
+    for (long k=job->next++; k < job->n; k=job->next++) job->fn(job->ctx, k, tid);
+}
+
+static void pool_worker(Pool *p) {
+    pool_inside = 1;
+    std::unique_lock<std::mutex> lk(p->mu);
+    for (;;) {
+        while (p->queue.empty()) p->work.wait(lk);
+        PoolJob *job = p->queue.front();
+        int tid = job->tid++;
+        job->active++;
+        if (--job->seats == 0) p->queue.pop_front();
+        lk.unlock();
+        pool_loop(job, tid);
+        lk.lock();
+        if (--job->active == 0) p->done.notify_all();
+    }
+}
+
+static void pool_run(long n, int nthreads, void (*fn)(void *, long, int), void *ctx) {
+    int nt = pool_nthreads(n, nthreads);
+    if (nt <= 1) {
+        int inside = pool_inside;
+        pool_inside = 1;
+        for (long k=0; k < n; k++) fn(ctx, k, 0);
+        pool_inside = inside;
+        return;
+    }
+    Pool *p = pool;
+    PoolJob job;
+    job.fn = fn;
+    job.ctx = ctx;
+    job.n = n;
+    job.next = 0;
+    job.seats = nt - 1;
+    job.tid = 1;
+    job.active = 0;
+    {
+        std::lock_guard<std::mutex> lk(p->mu);
+        try {
+            for (; p->nworkers < nt - 1; p->nworkers++)
+                std::thread(pool_worker, p).detach();
+        } catch (const std::system_error &) {
+            // Out of threads: make do with those there are
+        }
+        p->queue.push_back(&job);
+        if (nt - 1 >= p->nworkers) p->work.notify_all();
+        else for (int t=1; t < nt; t++) p->work.notify_one();
+    }
+    int inside = pool_inside;
+    pool_inside = 1;
+    pool_loop(&job, 0);
+    pool_inside = inside;
+    // No helper can join once the counter is spent and the job is off the
+    // queue; wait for those still finishing an item
+    std::unique_lock<std::mutex> lk(p->mu);
+    if (job.seats > 0)
+        p->queue.erase(std::find(p->queue.begin(), p->queue.end(), &job));
+    while (job.active > 0) p->done.wait(lk);
+}
+
+static void pool_atfork_child(void) {
+    pool = new Pool();
+}
+
+static aipy_pool_api pool_api = {AIPY_POOL_VERSION, pool_nthreads, pool_run};
+
+static PyObject *set_num_threads(PyObject *self, PyObject *args) {
+    int n;
+    if (!PyArg_ParseTuple(args, "i", &n)) return NULL;
+    if (n > POOL_MAX_THREADS) {
+        PyErr_Format(PyExc_ValueError, "at most %d threads", POOL_MAX_THREADS);
+        return NULL;
+    }
+    int prev = pool_get();
+    pool_setting = n > 0 ? n : 0;
+    return PyInt_FromLong(prev);
+}
+
+static PyObject *get_num_threads(PyObject *self) {
+    return PyInt_FromLong(pool_get());
+}
+
+// Wrap function into module
+static PyMethodDef PoolMethods[] = {
+    {"set_num_threads", (PyCFunction)set_num_threads, METH_VARARGS,
+        "set_num_threads(n)\nSet the number of native threads (the calling one included) the parallel loops of the extension modules run on when called with nthreads=0, to n, or to one per core for n <= 0.  Returns the number before."},
+    {"get_num_threads", (PyCFunction)get_num_threads, METH_NOARGS,
+        "get_num_threads()\nReturn the number of native threads the parallel loops of the extension modules run on when called with nthreads=0."},
+    {NULL, NULL}
+};
+
+MOD_INIT(_pool) {
+    PyObject *m, *api;
+
+    MOD_DEF(m, "_pool", PoolMethods, "Native thread pool module");
+    if (m == NULL)
+        return MOD_ERROR_VAL;
+
+    const char *env = getenv("AIPY_NUM_THREADS");
+    if (env != NULL) pool_setting = std::min(std::max(atoi(env), 0), POOL_MAX_THREADS);
+    pthread_atfork(NULL, NULL, pool_atfork_child);
+
+    api = PyCapsule_New(&pool_api, AIPY_POOL_CAPSULE, NULL);
+    if (api == NULL || PyModule_AddObject(m, "_C_API", api) < 0) {
+        Py_XDECREF(api);
+        return MOD_ERROR_VAL;
+    }
+    return MOD_SUCCESS_VAL(m);
+}
@@ -1,4 +1,19 @@
 from __future__ import print_function, division, absolute_import
 
-from . import helm, misc, culgoora, gbsix, mrt, nvss, parkes, txs, wenss
-from . import three_c, three_cr, four_c, six_c, seven_c,paper,vlss
+import importlib
+
+# Catalogs are loaded when first used (e.g. by src.get_catalog), as some
+# build thousands of sources on import.
+_catalogs = ('helm', 'misc', 'culgoora', 'gbsix', 'mrt', 'nvss', 'parkes',
+    'txs', 'wenss', 'three_c', 'three_cr', 'four_c', 'six_c', 'seven_c',
+    'paper', 'vlss')
+
+def __getattr__(name):
+    if name not in _catalogs:
+        raise AttributeError("module %r has no attribute %r" % (__name__, name))
+    mod = importlib.import_module('.' + name, __name__)
+    globals()[name] = mod
+    return mod
+
+def __dir__():
+    return sorted(set(globals()) | set(_catalogs))
@@ -8,6 +8,7 @@ from __future__ import print_function, division, absolute_import
 import numpy as np
 import ephem
 from . import phs
+from . import _dsp
 from . import coord
 from . import healpix
 
@@ -301,14 +302,15 @@ class AntennaArray(phs.AntennaArray):
         for baseline i,j with the specified polarization."""
         pol = self.get_active_pol()
         p1, p2 = pol[0], pol[-1]
-        # Check that we have cached results needed.  If not, cache them.
-        for c,p in zip([i,j], [p1,p2]):
-            if c not in self._cache: self._cache[c] = {}
-            if p not in self._cache[c]:
-                x,y,z = self._cache['s_top']
-                resp = self[c].bm_response((x,y,z), pol=p).transpose()
-                self._cache[c][p] = resp
-        return self._cache[j][p2] * np.conjugate(self._cache[i][p1])
+        return self._bm_cache(j, p2) * np.conjugate(self._bm_cache(i, p1))
+    def _bm_cache(self, c, p):
+        # The beam response of antenna c's feed p towards the cached
+        # source positions, computed once per time setting
+        if c not in self._cache: self._cache[c] = {}
+        if p not in self._cache[c]:
+            x,y,z = self._cache['s_top']
+            self._cache[c][p] = self[c].bm_response((x,y,z), pol=p).transpose()
+        return self._cache[c][p]
     def sim_cache(self, s_eqs, jys=np.array([1.]), mfreqs=0.150,
             ionrefs=(0.,0.), srcshapes=(0,0,0)):
         """Cache intermediate computations given catalog information to speed
@@ -379,3 +381,41 @@ class AntennaArray(phs.AntennaArray):
         GBIE_sf = Gij_sf * Bij_sf * I_sf * E_sf
         Vij_f = GBIE_sf.sum(axis=0)
         return Vij_f
+    def sim_bls(self, bls, nthreads=0):
+        """As sim() for each (i,j) in bls, for the active polarization, in
+        one native call: the passband, beam, flux and phase terms are fused
+        and summed over sources channel by channel, without the (nsrc,
+        nchan) arrays sim() builds for each baseline, and baselines are
+        shared among nthreads threads (0 = aipy.get_num_threads()).
+        sim_cache() must be called at each time step first.  Returns the
+        model visibilities as a (len(bls), nchan) complex128 array."""
+        if self._cache is None:
+            raise RuntimeError('sim_cache() must be called before the first sim_bls() call at each time step.')
+        bls = [(int(i), int(j)) for i,j in bls]
+        afreqs = np.array(self.get_afreqs(), dtype=np.float64).ravel()
+        nchan = afreqs.size
+        out = np.zeros((len(bls), nchan), dtype=np.complex128)
+        if self._cache == {} or len(bls) == 0: return out
+        pol = self.get_active_pol()
+        p1, p2 = pol[0], pol[-1]
+        s_eqs = self._cache['s_eqs']
+        nsrc = s_eqs.shape[1]
+        # One row of beams for each (antenna, feed) the baselines need
+        rows, beams = {}, []
+        bidx = np.empty((len(bls), 2), dtype=np.int32)
+        for k,(i,j) in enumerate(bls):
+            for n,(c,p) in enumerate(((i, p1), (j, p2))):
+                if (c,p) not in rows:
+                    rows[(c,p)] = len(beams)
+                    beams.append(np.broadcast_to(self._bm_cache(c, p), (nsrc, nchan)))
+                bidx[k,n] = rows[(c,p)]
+        bm = np.ascontiguousarray(beams, dtype=np.complex128)
+        jys = np.asarray(self._cache['jys'], dtype=np.float64)
+        if jys.ndim == 1: jys = jys.reshape((nsrc, 1))
+        jys = np.ascontiguousarray(np.broadcast_to(jys, (nsrc, nchan)))
+        gain = np.array([np.broadcast_to(self.passband(i,j), (nchan,)) for i,j in bls],
+            dtype=np.complex128)
+        uvw, afreqs, off, ion, shape = self._phs_args(s_eqs, bls,
+            self._cache['mfreq'], self._cache['i_ref'], self._cache['s_shp'], True)
+        _dsp.sim_vis(out, uvw, afreqs, off, ion, shape, bm, bidx, jys, gain, nthreads)
+        return out
@@ -21,8 +21,128 @@ from . import _deconv
 # Find smallest representable # > 0 for setting clip level
 lo_clip_lev = np.finfo(np.float64).tiny
 
+def _out_dtype(im):
+    """Return the dtype the native float64 solvers hand results back in:
+    that of im if it is floating point, else float64."""
+    dtype = np.asarray(im).dtype
+    if dtype.kind == 'f': return dtype
+    return np.dtype(np.float64)
+
+def _patch_sidelobe(ker, beam_patch):
+    """Return the largest |ker| outside the patch selected by 'beam_patch'
+    (see clean), relative to the kernel peak."""
+    if beam_patch < 1: return beam_patch
+    kabs = np.abs(ker)
+    outside = np.zeros(ker.shape, dtype=bool)
+    for ax, n in enumerate(ker.shape):
+        d = np.arange(n)
+        d = np.minimum(d, n - d)
+        outside |= (d > int(beam_patch)).reshape([-1 if i == ax else 1
+                                                 for i in range(ker.ndim)])
+    if not outside.any(): return 0.
+    return kabs[outside].max() / kabs.max()
+
+def _clean_clark(im, ker, mdl, res, area, gain, maxiter, tol, stop_if_div,
+        verbose, pos_def, beam_patch):
+    """Clark clean: minor cycles of Hoegbom clean over a beam patch, limited
+    to pixels above the sidelobe level of the current peak, alternating with
+    major cycles that recompute the residual exactly by FFT.  Returns the
+    iteration count (with the sign convention of _deconv.clean), mdl and res."""
+    if beam_patch <= 0: beam_patch = .1
+    sidelobe = _patch_sidelobe(ker, beam_patch)
+    ker_fft = np.fft.fftn(ker)
+    def residual(m):
+        r = im - np.fft.ifftn(np.fft.fftn(m) * ker_fft)
+        if not np.iscomplexobj(im): r = r.real
+        return r.astype(im.dtype)
+    def rms(r): return np.sqrt(np.average(np.abs(r)**2))
+    area = area != 0
+    mask = area.astype(np.int_)
+    score = firstscore = rms(res)
+    best = (score, mdl, res)
+    niter, cycle, diverged = 0, 0, False
+    while niter < maxiter and area.any():
+        peak = np.abs(res[area]).max()
+        if peak == 0: break
+        thresh = peak * sidelobe
+        # Minor cycle: approximate residual updates within the beam patch,
+        # down to thresh.  The mask stays the full area, which sets the
+        # loop gain from the kernel peak.
+        n_res, n_mdl = res.copy(), np.zeros_like(mdl)
+        n = _deconv.clean(n_res, ker, n_mdl, mask,
+                gain=gain, maxiter=maxiter - niter, tol=tol, stop_if_div=1,
+                pos_def=int(pos_def), beam_patch=float(beam_patch),
+                thresh=thresh)
+        niter += abs(n)
+        # Major cycle: exact residual of the accumulated model
+        n_mdl += mdl
+        n_res = residual(n_mdl)
+        n_score = rms(n_res)
+        if verbose:
+            print('Major cycle %d: Iter=%d, Score=%f, Prev=%f' % \
+                (cycle, niter, n_score / firstscore, score / firstscore))
+        cycle += 1
+        if n_score > score:
+            if stop_if_div:
+                diverged = True
+                break
+        elif firstscore == 0 or (score - n_score) / firstscore < tol:
+            mdl, res = n_mdl, n_res
+            if n_score < best[0]: best = (n_score, mdl, res)
+            break
+        mdl, res, score = n_mdl, n_res, n_score
+        if score < best[0]: best = (score, mdl, res)
+    if not stop_if_div: score, mdl, res = best
+    if diverged: return -niter, mdl, res
+    if niter >= maxiter: return maxiter, mdl, res
+    return niter, mdl, res
+
+def _scale_kernels(shape, scales):
+    """Return the FFTs of unit-sum Gaussians of width (sigma, in pixels)
+    'scales', centered on the (0,0) pixel.  Scale 0 is a delta function."""
+    fscales = []
+    for sc in scales:
+        if sc <= 0:
+            fscales.append(np.ones(shape)); continue
+        r2 = 0
+        for ax, n in enumerate(shape):
+            d = np.arange(n)
+            d = np.minimum(d, n - d).astype(np.float64)
+            r2 = r2 + (d**2).reshape([-1 if i == ax else 1
+                                      for i in range(len(shape))])
+        g = np.exp(-r2 / (2. * sc**2))
+        fscales.append(np.fft.fftn(g / g.sum()).real)
+    return fscales
+
+def _clean_multiscale(im, ker, mdl, res, area, gain, maxiter, tol, verbose,
+        pos_def, scales, scale_bias):
+    """Multi-scale clean (Cornwell 2008): return the iteration count, mdl and
+    res after cleaning res with a component per scale in 'scales'."""
+    if np.iscomplexobj(im):
+        raise ValueError('Multiscale clean requires real-valued data')
+    scales = sorted(scales)
+    fs = _scale_kernels(im.shape, scales)
+    fres, fker = np.fft.fftn(res), np.fft.fftn(ker)
+    conv = lambda f: np.fft.ifftn(f).real.astype(im.dtype)
+    ms_res = np.array([conv(fres * f) for f in fs])
+    ms_ker = np.array([[conv(fker * f * g) for g in fs] for f in fs])
+    ms_mdl = np.zeros(ms_res.shape, dtype=im.dtype)
+    smax = max(scales[-1], 1)
+    bias = np.array([1 - scale_bias * sc / smax for sc in scales],
+                    dtype=np.float64)
+    iter = _deconv.clean_ms(ms_res, ms_ker, ms_mdl, area, bias, gain=gain,
+            maxiter=maxiter, tol=tol, verbose=int(verbose),
+            pos_def=int(pos_def))
+    # Components convolved with their scale form the model
+    fmdl = sum(np.fft.fftn(m) * f for m, f in zip(ms_mdl, fs))
+    mdl = mdl + conv(fmdl)
+    res = im - conv(np.fft.fftn(mdl) * fker)
+    return iter, mdl, res
+
 def clean(im, ker, mdl=None, area=None, gain=.1, maxiter=10000, tol=1e-3,
-        stop_if_div=True, verbose=False, pos_def=False):
+        stop_if_div=True, verbose=False, pos_def=False, beam_patch=0,
+        algorithm='hogbom', scales=(0, 2, 4, 8), scale_bias=.6,
+        history=None, history_every=1, components=False):
     """This standard Hoegbom clean deconvolution algorithm operates on the
     assumption that the image is composed of point sources.  This makes it a
     poor choice for images with distributed flux.  In each iteration, a point
@@ -31,10 +151,39 @@ def clean(im, ker, mdl=None, area=None, gain=.1, maxiter=10000, tol=1e-3,
     point is removed from the residual, and the process repeats.  Termination
     happens after 'maxiter' iterations, or when the clean loops starts
     increasing the magnitude of the residual.  This implementation can handle
-    1 and 2 dimensional data that is real valued or complex.
+    1 and 2 dimensional data that is real valued or complex.  The GIL is
+    released inside the clean loop, so independent images may be cleaned in
+    parallel from a thread pool.
     gain: The fraction of a residual used in each iteration.  If this is too
         low, clean takes unnecessarily long.  If it is too high, clean does
-        a poor job of deconvolving."""
+        a poor job of deconvolving.
+    beam_patch: If > 0, subtract only the significant part of 'ker' in each
+        iteration.  Values >= 1 give the half-width (in pixels) of the box
+        around the kernel origin that is subtracted; values < 1 are a
+        threshold relative to the kernel peak, and the box encloses every
+        pixel above it.  Much faster for compact beams on large images.
+        The loop gain is then set by the kernel peak, even where 'area'
+        leaves it out.
+    algorithm: 'hogbom' (the default) or 'clark'.  Clark clean alternates
+        minor cycles, which clean only pixels brighter than the beam
+        sidelobes outside 'beam_patch' (default .1 for Clark) using the
+        patch alone, with major cycles that recompute the residual exactly
+        by FFT convolution of the model with 'ker'.  'maxiter' counts minor
+        cycle iterations, and 'tol' is checked between major cycles.
+        'multiscale' represents the model as Gaussians of the widths (sigma,
+        in pixels) in 'scales' (0 is a point), choosing the best scale and
+        position each iteration; far fewer components are needed for
+        extended emission.  Larger scales are down-weighted by up to
+        'scale_bias'.  Multiscale clean of real-valued data only, and it
+        always stops on divergence.
+    history: (Hogbom only) a preallocated 1 dimensional array of
+        _deconv.history_dtype that receives a record of the peak, RMS
+        residual and step of every 'history_every'th iteration.  Unused
+        records are left with iter = -1.
+    components: (Hogbom only) if True, info['components'] is (pos, flux),
+        the pixels (an (n, ndim) int array) and summed fluxes of the clean
+        components, sorted by pixel.  Cheaper than searching mdl for nonzero
+        pixels when the model is sparse."""
     if mdl is None:
         mdl = np.zeros(im.shape, dtype=im.dtype)
         res = im.copy()
@@ -52,22 +201,101 @@ def clean(im, ker, mdl=None, area=None, gain=.1, maxiter=10000, tol=1e-3,
     else:
         area = area.astype(np.int_)
 
-    iter = _deconv.clean(res, ker, mdl, area,
-            gain=gain, maxiter=maxiter, tol=tol,
-            stop_if_div=int(stop_if_div), verbose=int(verbose),
-            pos_def=int(pos_def))
+    if algorithm == 'clark':
+        iter, mdl, res = _clean_clark(im, ker, mdl, res, area, gain, maxiter,
+                tol, stop_if_div, verbose, pos_def, beam_patch)
+    elif algorithm == 'multiscale':
+        iter, mdl, res = _clean_multiscale(im, ker, mdl, res, area, gain,
+                maxiter, tol, verbose, pos_def, scales, scale_bias)
+    elif algorithm == 'hogbom':
+        iter = _deconv.clean(res, ker, mdl, area,
+                gain=gain, maxiter=maxiter, tol=tol,
+                stop_if_div=int(stop_if_div), verbose=int(verbose),
+                pos_def=int(pos_def), beam_patch=float(beam_patch),
+                history=history, history_every=int(history_every),
+                components=int(components), merge_components=1)
+        if components: iter, comps = iter[0], iter[1:]
+    else: raise ValueError('Unknown algorithm: %s' % algorithm)
     score = np.sqrt(np.average(np.abs(res)**2))
     info = {'success':iter > 0 and iter < maxiter, 'tol':tol}
     if iter < 0: info.update({'term':'divergence', 'iter':-iter})
     elif iter < maxiter: info.update({'term':'tol', 'iter':iter})
     else: info.update({'term':'maxiter', 'iter':iter})
     info.update({'res':res, 'score':score})
+    if components and algorithm == 'hogbom': info['components'] = comps
     if verbose:
         print('Term Condition:', info['term'])
         print('Iterations:', info['iter'])
         print('Score:', info['score'])
     return mdl, info
 
+def cotton_schwab(img, uvw, data, ncycles=5, center=(0,0), tol=1e-3,
+        verbose=False, **kwargs):
+    """Cotton-Schwab clean: minor cycles of clean (with any of its keyword
+    arguments, e.g. algorithm='clark') on the residual image of 'img' (an
+    img.Img into which (uvw, data) has been gridded), alternating with major
+    cycles that subtract the accumulated model from the visibilities
+    themselves (see Img.major_cycle).  Stops after 'ncycles' major cycles,
+    or when the residual rms improves by less than 'tol' (relative to the
+    dirty image) between cycles."""
+    ker = img.bm_image(term=0)
+    res = img.image(center)
+    mdl = np.zeros(res.shape, dtype=res.dtype)
+    score = firstscore = np.sqrt(np.average(res**2))
+    rdata = data
+    for cycle in range(ncycles):
+        cmdl, info = clean(res, ker, tol=tol, verbose=False, **kwargs)
+        n_mdl = mdl + cmdl
+        n_rdata, n_res = img.major_cycle(uvw, data, n_mdl, center=center)
+        n_score = np.sqrt(np.average(n_res**2))
+        if verbose:
+            print('Major cycle %d: Iter=%d, Score=%f, Prev=%f' % \
+                (cycle, info['iter'], n_score / firstscore, score / firstscore))
+        if n_score > score: break
+        mdl, res, rdata = n_mdl, n_res, n_rdata
+        if firstscore == 0 or (score - n_score) / firstscore < tol:
+            score = n_score
+            break
+        score = n_score
+    info = {'cycles':cycle+1, 'res':res, 'res_data':rdata, 'score':score}
+    return mdl, info
+
+def delay_filter(data, wgts, area, window='none', gain=.1, maxiter=100,
+        tol=1e-9, stop_if_div=False, nthreads=0):
+    """Delay-filter spectra natively: each spectrum in data (nchan,) or
+    (nspec,nchan), times wgts (shaped as data, or (nchan,) for all) and a
+    window (a name for dsp.gen_window, or an array), is transformed to
+    delay, cleaned by the transform of its weights, and the clean model
+    transformed back, as filter_src.py does with numpy and clean.  'area'
+    selects the delay bins (in numpy.fft order) the model may use: an
+    (nchan,) array, or an int d for the delays within d bins of 0.  Spectra
+    are shared among 'nthreads' native threads (0 =
+    aipy.get_num_threads()).  Returns (mdl, res, info): the model spectra,
+    the residual (data - mdl)*wgts, and info['iter'], the iterations of
+    each spectrum (as clean's 'iter'; negative on divergence, 0 without
+    weights)."""
+    data = np.asarray(data)
+    shape = data.shape
+    d = np.ascontiguousarray(data, dtype=np.complex128).reshape((-1, shape[-1]))
+    nchan = d.shape[1]
+    w = np.ascontiguousarray(wgts, dtype=np.float64)
+    if w.shape != (nchan,): w = np.ascontiguousarray(np.broadcast_to(w, shape)).reshape(d.shape)
+    if isinstance(window, str):
+        # dsp (and scipy.special) load only when a named window is asked for
+        from . import dsp
+        window = dsp.gen_window(nchan, window)
+    window = np.ascontiguousarray(np.broadcast_to(window, (nchan,)), dtype=np.float64)
+    if np.ndim(area) == 0:
+        a, area = np.zeros(nchan, dtype=np.int_), int(area)
+        a[:area+1] = 1
+        if area > 0: a[-area:] = 1
+        area = a
+    area = np.ascontiguousarray(area).astype(np.int_)
+    mdl, res = np.empty_like(d), np.empty_like(d)
+    iters = _deconv.delay_filter(d, w, window, area, mdl, res, gain=gain,
+        maxiter=maxiter, tol=tol, stop_if_div=int(stop_if_div), nthreads=nthreads)
+    return mdl.reshape(shape), res.reshape(shape), {'iter':np.reshape(iters, shape[:-1])}
+
 def recenter(a, c):
     """Slide the (0,0) point of matrix a to a new location tuple c."""
     s = a.shape
@@ -77,7 +305,7 @@ def recenter(a, c):
     return a2
 
 def lsq(im, ker, mdl=None, area=None, gain=.1, tol=1e-3, maxiter=200,
-        lower=lo_clip_lev, upper=np.Inf, verbose=False):
+        lower=lo_clip_lev, upper=np.Inf, verbose=False, nthreads=0):
     """This simple least-square fitting procedure for deconvolving an image
     saves computing by assuming a diagonal pixel-pixel gradient of the fit.
     In essence, this assumes that the convolution kernel is a delta-function.
@@ -90,46 +318,34 @@ def lsq(im, ker, mdl=None, area=None, gain=.1, tol=1e-3, maxiter=200,
     score change is less than 'tol' between iterations.
     gain: The fraction of the step size (calculated from the gradient) taken
         in each iteration.  If this is too low, the fit takes unnecessarily
-        long.  If it is too high, the fit process can oscillate."""
-    if mdl is None:
-        #mdl = np.zeros_like(im)
-        mdl = np.zeros(im.shape, dtype=im.dtype)
-    x = mdl.copy()
-    if area is None:
-        area = np.ones(im.shape, dtype=np.int_)
-    else:
-        area = area.astype(np.int_)
-    # Estimate gain of the kernel
-    q = np.sqrt((np.abs(ker)**2).sum())
-    ker_i = np.fft.fft2(ker)
-    info = {'success':True, 'term':'maxiter', 'tol':tol}
-    # Function to calculate chi-square and gradient
-    def f(x):
-        x_conv_ker = np.fft.ifft2(np.fft.fft2(x) * ker_i).real
-        diff = (im - x_conv_ker) * area
-        g_chi2 = -2*q*(diff)
-        chi2 = np.abs(diff)**2
-        return chi2, g_chi2
-    score = 0
-    # Start the fit loop
-    for i in range(maxiter):
-        chi2, g_chi2 = f(x)
-        n_score = np.average(chi2)
-        term = abs(1 - score/n_score)
-        if verbose:
-            slope = np.sqrt(np.average(g_chi2**2))
-            print('Step %d:' % i, 'score',  score, 'slope', slope, 'term', term)
-        if term < tol:
-            info['term'] = 'tol'
-            break
-        score = n_score
-        # For especially clean imgs, g_chi2 in some components can go to 0.
-        # This check makes lsq a little slower for most images, though...
-        d_x = np.where(abs(g_chi2) > 0, -(1/g_chi2) * chi2, 0)
-        x = np.clip(x + gain * d_x, lower, upper)
-    info.update({'res':im - np.fft.ifft2(np.fft.fft2(x) * ker_i).real,
-        'score': score, 'iter':i+1})
-    return x, info
+        long.  If it is too high, the fit process can oscillate.
+    A 3 dimensional im is a stack of images deconvolved independently, on
+    nthreads native threads (0 = aipy.get_num_threads()), with ker, mdl
+    and area stacks too or single images shared by all; info then holds
+    per-image arrays (and a list of terms).  The fit runs in float64; the
+    model and residual come back in the dtype of im if it is floating point."""
+    im = np.asarray(im)
+    dtype = _out_dtype(im)
+    stack = im.ndim == 3
+    ims = np.ascontiguousarray(im if stack else im[None], dtype=np.float64)
+    if mdl is None: mdl = np.zeros(ims.shape[1:])
+    x = np.ascontiguousarray(np.broadcast_to(mdl, ims.shape), dtype=np.float64)
+    if area is None: area = np.ones(ims.shape[1:])
+    else: area = np.asarray(area).astype(np.int_)
+    area = np.ascontiguousarray(area, dtype=np.float64)
+    ker = np.ascontiguousarray(ker, dtype=np.float64)
+    res = np.empty_like(ims)
+    # The iteration runs in _deconv, with FFT convolutions
+    iters, terms, scores = _deconv.lsq(ims, ker, x, area, res, gain=gain,
+            tol=tol, maxiter=int(maxiter), lower=lower, upper=upper,
+            verbose=int(verbose), nthreads=nthreads)
+    terms = [('maxiter', 'tol')[t] for t in terms]
+    x, res = x.astype(dtype, copy=False), res.astype(dtype, copy=False)
+    if not stack:
+        return x[0], {'success':True, 'term':terms[0], 'tol':tol,
+            'res':res[0], 'score':scores[0], 'iter':iters[0]}
+    return x, {'success':True, 'term':terms, 'tol':tol, 'res':res,
+        'score':scores, 'iter':iters}
 
 def maxent(im, ker, var0, mdl=None, gain=.1, tol=1e-3, maxiter=200,
         lower=lo_clip_lev, upper=np.Inf, verbose=False):
@@ -145,56 +361,24 @@ def maxent(im, ker, var0, mdl=None, gain=.1, tol=1e-3, maxiter=200,
         provided, a quick lsq is used to estimate the variance of the residual.
     gain: The fraction of the step size (calculated from the gradient) taken
         in each iteration.  If this is too low, the fit takes unnecessarily
-        long.  If it is too high, the fit process can oscillate."""
-    d_i = im.flatten()
-    q = np.sqrt((ker**2).sum())
-    minus_two_q = -2*q
-    two_q_sq = 2*q**2
+        long.  If it is too high, the fit process can oscillate.
+    The fit runs in float64; the model and residual come back in the dtype
+    of im if it is floating point."""
+    dtype = _out_dtype(im)
+    im = np.ascontiguousarray(im, dtype=np.float64)
+    ker = np.ascontiguousarray(ker, dtype=np.float64)
     if mdl is None:
-         #mdl = np.ones_like(im) * np.average(im) / ker.sum()
          mdl = np.ones(im.shape, dtype=im.dtype) * np.average(im) / ker.sum()
-    #if mdl is None: mdl = np.ones_like(im) * np.average(im) / q
-    Nvar0 = d_i.size * var0
-    inv_ker = np.fft.fft2(ker)
-    m_i = mdl.flatten()
-    def next_step(b_i, alpha, verbose=False):
-        b_i.shape = im.shape
-        b_i_conv_ker = np.fft.ifft2(np.fft.fft2(b_i) * inv_ker).real
-        b_i.shape = m_i.shape
-        diff = (im - b_i_conv_ker).flatten()
-        chi2 = np.dot(diff,diff) - Nvar0
-        g_chi2 = minus_two_q*(diff)
-        g_J = (-np.log(b_i/m_i) - 1) - alpha * g_chi2
-        gg_J = (-1/b_i) - alpha * two_q_sq
-        # Define dot product using the metric of -gg_J^-1
-        def dot(x, y): return (x*y/-gg_J).sum()
-        score = dot(g_J, g_J) / dot(1,1)
-        d_alpha = (chi2 + dot(g_chi2,g_J)) / dot(g_chi2,g_chi2)
-        # For especially clean images, gg_J in some components can go to 0.
-        # This check makes lsq a little slower for most images, though...
-        d_b_i = np.where(abs(gg_J) > 0, -1/gg_J * (g_J - d_alpha*g_chi2), 0)
-        if verbose:
-            print('    score', score, 'fit', np.dot(diff,diff))
-            print('    alpha', alpha, 'd_alpha', d_alpha)
-        return d_b_i, d_alpha, score
-    alpha = 0.
-    b_i = m_i.copy()
-    info = {'success':True, 'term':'maxiter', 'var0':var0, 'tol':tol}
-    for i in range(maxiter):
-        if verbose: print('Step %d:' % i)
-        d_b_i, d_alpha, score = next_step(b_i, alpha, verbose=verbose)
-        if score < tol and score > 0:
-            info['term'] = 'tol'
-            break
-        elif score > 1e10 or np.isnan(score) or score <= 0:
-            info.update({'term':'divergence', 'success':False})
-            break
-        b_i = np.clip(b_i + gain * d_b_i, lower, upper)
-        alpha += gain * d_alpha
-    b_i.shape = im.shape
-    info.update({'res':im - np.fft.ifft2(np.fft.fft2(b_i) * inv_ker).real,
-        'score': score, 'alpha': alpha, 'iter':i+1})
-    return b_i, info
+    m_i = np.ascontiguousarray(mdl, dtype=np.float64)
+    b_i, res = m_i.copy(), np.empty_like(im)
+    # The Newton iteration runs in _deconv, with FFT convolutions
+    iter, term, score, alpha = _deconv.maxent(im, ker, m_i, b_i, res, var0,
+            gain=gain, tol=tol, maxiter=int(maxiter), lower=lower,
+            upper=upper, verbose=int(verbose))
+    info = {'success':term != 2, 'term':('maxiter', 'tol', 'divergence')[term],
+        'var0':var0, 'tol':tol, 'res':res.astype(dtype, copy=False),
+        'score':score, 'alpha':alpha, 'iter':iter}
+    return b_i.astype(dtype, copy=False), info
 
 def maxent_findvar(im, ker, var=None, f_var0=.6, mdl=None, gain=.1, tol=1e-3,
         maxiter=200, lower=lo_clip_lev, upper=np.Inf, verbose=False,
@@ -238,7 +422,8 @@ def maxent_findvar(im, ker, var=None, f_var0=.6, mdl=None, gain=.1, tol=1e-3,
     return cl, info
 
 def anneal(im, ker, mdl=None, maxiter=1000, lower=lo_clip_lev, upper=np.Inf,
-        cooling=lambda i,x: 1e+1*(1-np.cos(i/50.))*(x**2), verbose=False):
+        cooling=lambda i,x: 1e+1*(1-np.cos(i/50.))*(x**2), verbose=False,
+        nchains=1, nthreads=0, footprint=1e-3, seed=None):
     """Annealing takes a non-deterministic approach to deconvolution by
     randomly perturbing the model and selecting perturbations that improve the
     residual.  By slowly reducing the temperature of the perturbations,
@@ -248,23 +433,46 @@ def anneal(im, ker, mdl=None, maxiter=1000, lower=lo_clip_lev, upper=np.Inf,
     quickly, but are less likely to find the global minimum.  This
     implementation assigns a temperature to each pixel proportional to the
     magnitude of the residual in that pixel and the global cooling speed.
+    Each iteration is a sweep (in _deconv) of one single-pixel perturbation
+    per pixel, scored and applied through the kernel only, so an iteration
+    costs about im.size times the kernel support rather than FFTs.
     cooling: A function accepting (iteration,residuals) that returns a
         vector of standard deviation for noise in the respective pixels.
         Picking the scaling of this function correctly is vital for annealing
-        to work."""
+        to work.
+    nchains: The number of independent annealing chains, run in parallel on
+        'nthreads' native threads (0 = aipy.get_num_threads()).  The chain
+        with the lowest residual is returned.
+    footprint: Kernel entries below this fraction of the kernel peak are
+        ignored when updating the residual, and the exact residual is
+        recomputed by FFT after every iteration.  0 uses every nonzero
+        entry, which is exact but slow for wide kernels.
+    seed: Seed for the random number generators of the chains.
+    The chains run in float64; the model and residual come back in the
+    dtype of im if it is floating point."""
+    dtype = _out_dtype(im)
+    im = np.ascontiguousarray(im, dtype=np.float64)
+    ker = np.ascontiguousarray(ker, dtype=np.float64)
     if mdl is None: mdl = np.zeros_like(im)
+    mdl = np.array([mdl] * nchains, dtype=np.float64)
     q = np.sqrt((ker**2).sum())
     inv_ker = np.fft.fft2(ker)
-    dif = im - np.fft.ifft2(np.fft.fft2(mdl) * inv_ker).real
-    score = np.average(dif**2)
-    #info = {'success':True, 'term':'maxiter', 'speed':speed}
+    def residual(mdl):
+        return np.ascontiguousarray(im - np.fft.ifft2(np.fft.fft2(mdl) * inv_ker).real)
+    dif = residual(mdl)
+    rng = np.random.RandomState(seed)
+    state = rng.randint(1, 2**62, size=nchains).astype(np.uint64)
+    sigma = np.empty_like(dif)
     info = {'success':True, 'term':'maxiter'}
     for i in range(maxiter):
-        delta = np.random.normal(scale=1., size=mdl.shape) * cooling(i, dif/q)
-        n_mdl = np.clip(mdl + delta, lower, upper)
-        n_dif = im - np.fft.ifft2(np.fft.fft2(n_mdl) * inv_ker).real
-        n_score = np.average(n_dif**2)
-        if verbose: print('Step %d:' % i, n_score, score)
-        if n_score < score: mdl, dif, score = n_mdl, n_dif, n_score
-    info.update({'res':dif, 'score': score, 'iter':i+1})
-    return mdl, info
+        for c in range(nchains): sigma[c] = cooling(i, dif[c]/q)
+        _deconv.anneal(ker, mdl, dif, sigma, state, lower=lower, upper=upper,
+                footprint=footprint, nthreads=nthreads)
+        if footprint > 0: dif = residual(mdl)
+        if verbose: print('Step %d:' % i, np.average(dif**2, axis=(1,2)))
+    dif = residual(mdl)
+    score = np.average(dif**2, axis=(1,2))
+    best = np.argmin(score)
+    info.update({'res':dif[best].astype(dtype, copy=False),
+        'score': score[best], 'iter':i+1})
+    return mdl[best].astype(dtype, copy=False), info
@@ -1,5 +1,6 @@
 from __future__ import print_function, division, absolute_import
 
+import itertools
 import numpy as np
 from scipy.special import i0
 from ._dsp import *
@@ -51,3 +52,83 @@ WINDOW_FUNC = {
 def gen_window(L, window='hamming', **kwargs):
     '''Return the specified window (see WINDOW_FUNC) for a length L.'''
     return np.fromfunction(lambda x: WINDOW_FUNC[window](x,L,**kwargs), (L,))
+
+def kaiser_bessel(support=6, oversample=128, beta=None):
+    '''Return a Kaiser-Bessel gridding kernel table for _dsp.grid2D_tab_c:
+    the kernel at offsets of k/oversample pixels, k = 0..support*oversample/2,
+    as float32.  beta defaults to 2.34*support, which suits a grid with the
+    usual 2x image-plane padding; the kernel is 1 at the origin.'''
+    if beta is None: beta = 2.34 * support
+    u = np.arange(support * oversample // 2 + 1) / (0.5 * support * oversample)
+    tab = i0(beta * np.sqrt(np.clip(1 - u**2, 0, 1))) / i0(beta)
+    return tab.astype(np.float32)
+
+def _bl_lookup(ij):
+    '''Return the sorted antennas of the (nbl,2) pairs ij and the matrix
+    of the index into ij of pair (i,j), i < j, of the ith and jth of
+    them (-1 where there is none).'''
+    ij = np.asarray(ij)
+    ants = np.unique(ij)
+    a = np.searchsorted(ants, ij)
+    bl = -np.ones((ants.size, ants.size), dtype=np.int_)
+    fwd = a[:,0] < a[:,1]
+    bl[a[fwd,0], a[fwd,1]] = np.arange(len(ij))[fwd]
+    return ants, bl
+
+def _combos(n, k):
+    '''Return the (ncombo,k) increasing k-tuples of range(n).'''
+    c = np.array(list(itertools.combinations(range(n), k)), dtype=np.int_)
+    return c.reshape(-1, k)
+
+def closure_triangles(ij):
+    '''Return (ants, tri) for the triangles of antennas i < j < k whose
+    baselines (i,j), (j,k) and (i,k) all appear in the (nbl,2) antenna
+    pairs ij (as uv.to_cube gives them): ants (ntri,3) holds the antennas
+    and tri (ntri,3) the indices of the baselines into ij, as
+    closure_phases takes them.'''
+    ants, bl = _bl_lookup(ij)
+    c = _combos(ants.size, 3)
+    tri = np.array([bl[c[:,0],c[:,1]], bl[c[:,1],c[:,2]], bl[c[:,0],c[:,2]]]).T
+    ok = np.all(tri >= 0, axis=1)
+    return ants[c[ok]], np.ascontiguousarray(tri[ok])
+
+def closure_quads(ij):
+    '''Return (ants, quad) for the quadrangles of antennas i < j < k < l
+    whose baselines all appear in ij (as for closure_triangles), two rows
+    each: (i,j)(k,l)/(i,k)(j,l) and (i,l)(j,k)/(i,k)(j,l).  ants (nquad,4)
+    holds the antennas of each row and quad (nquad,4) the indices of its
+    baselines into ij, numerator first, as closure_amps takes them.'''
+    ants, bl = _bl_lookup(ij)
+    c = _combos(ants.size, 4)
+    i, j, k, l = c.T
+    quad = np.array([[bl[i,j], bl[k,l], bl[i,k], bl[j,l]],
+                     [bl[i,l], bl[j,k], bl[i,k], bl[j,l]]]).transpose(2,0,1)
+    ok = np.all(quad.reshape(-1,8) >= 0, axis=1)
+    return np.repeat(ants[c[ok]], 2, axis=0), quad[ok].reshape(-1,4)
+
+def _closure(func, data, tab, flags, nthreads):
+    '''Run the closure kernel func of _dsp on the cube data for the
+    baseline table tab, returning (out, oflags).'''
+    if flags is None: flags = np.ma.getmaskarray(data)
+    d = np.ascontiguousarray(np.ma.getdata(data), dtype=np.complex64)
+    f = np.ascontiguousarray(np.broadcast_to(flags, d.shape), dtype=np.bool_)
+    tab = np.ascontiguousarray(tab, dtype=np.int_)
+    shape = (d.shape[0], tab.shape[0]) + d.shape[2:]
+    out = np.empty(shape, dtype=np.float32)
+    oflags = np.empty(shape, dtype=np.bool_)
+    func(out, oflags, d, f, tab, nthreads)
+    return out, oflags
+
+def closure_phases(data, tri, flags=None, nthreads=0):
+    '''Return the closure phases (radians) of the complex (ntime,nbl,...)
+    cube data (as uv.to_cube gives it) over the triangles tri of
+    closure_triangles, as (phs, flags): phs (ntime,ntri,...) float32, and
+    flags True (and phs 0) where any of the three baselines is flagged.
+    flags (True = flagged) defaults to the mask of data.  Triangles are
+    shared among nthreads native threads (0 = aipy.get_num_threads()).'''
+    return _closure(closure_phs, data, tri, flags, nthreads)
+
+def closure_amps(data, quad, flags=None, nthreads=0):
+    '''As closure_phases, for the closure amplitudes over the rows of
+    closure_quads, also flagged where the denominator is 0.'''
+    return _closure(closure_amp, data, quad, flags, nthreads)
@@ -80,18 +80,28 @@ def beam_gain(bm):
 class Img:
     """Class for gridding uv data, recording the synthesized beam profile,
     and performing transforms into image domain."""
-    def __init__(self, size=100, res=1, mf_order=0):
+    def __init__(self, size=100, res=1, mf_order=0, hermitian=False):
         """size = number of wavelengths which the UV matrix spans (this
         determines the image resolution).
-        res = resolution of the UV matrix (determines image field of view)."""
+        res = resolution of the UV matrix (determines image field of view).
+        hermitian = keep only the half-plane (the first shape[1]//2+1
+        columns, as numpy.fft.rfft2 lays them out) of the Hermitian uv and
+        beam matrices.  put then grids each sample together with its
+        conjugate, so append_hermitian is not needed, in about half the
+        time and memory.  See unfold for the full matrices."""
         self.res = float(res)
         self.size = float(size)
         dim = np.round(self.size / self.res)
         self.shape = (int(dim),int(dim))
-        self.uv = np.zeros(shape=self.shape, dtype=np.complex64)
+        self.hermitian = hermitian
+        if hermitian and not USEDSP:
+            raise ValueError('hermitian grids need the _dsp module')
+        if hermitian: gshape = (self.shape[0], self.shape[1]//2 + 1)
+        else: gshape = self.shape
+        self.uv = np.zeros(shape=gshape, dtype=np.complex64)
         self.bm = []
         for i in range(mf_order+1):
-            self.bm.append(np.zeros(shape=self.shape, dtype=np.complex64))
+            self.bm.append(np.zeros(shape=gshape, dtype=np.complex64))
     def get_LM(self, center=(0,0)):
         """Get the (l,m) image coordinates for an inverted UV matrix."""
         dim = self.shape[0]
@@ -115,13 +125,22 @@ class Img:
         u = np.where(u < self.shape[0]//2, u, u - self.shape[0])
         v = np.where(v < self.shape[1]//2, v, v - self.shape[1])
         return u*self.res, v*self.res
-    def put(self, uvw, data, wgts=None, apply=True):
+    def put(self, uvw, data, wgts=None, apply=True, nthreads=1, order=None,
+            flags=None, weight=None):
         """Grid uv data (w is ignored) onto a UV plane.  Data should already
         have the phase due to w removed.  Assumes the Hermitian conjugate
         data is in uvw already (i.e. the conjugate points are not placed for
         you).  If wgts are not supplied, default is 1 (normal weighting).
         If apply is false, returns uv and bm data without applying it do
-        the internally stored matrices."""
+        the internally stored matrices.  nthreads != 1 grids on that many
+        native threads (0 = aipy.get_num_threads(); see _dsp.grid2D_c_mt).
+        order (from tile_order) sets the order in which a single thread
+        visits samples.
+        Hermitian Imgs grid on one thread, whatever nthreads.
+        Samples whose flags are True (as from UV.read(raw=True)) are left out,
+        and the data and wgts of the rest are scaled by the real weight;
+        when gridding on one native thread, both happen inside the gridding
+        loop, without copies of the data."""
         u,v,w = uvw
         if wgts is None:
             wgts = []
@@ -130,6 +149,15 @@ class Img:
                 else: wgts.append(np.zeros_like(data))
         if len(self.bm) == 1 and len(wgts) != 1: wgts = [wgts]
         assert(len(wgts) == len(self.bm))
+        native = USEDSP and (nthreads == 1 or self.hermitian)
+        if not native and weight is not None:
+            data = data * weight
+            wgts = [wgt * weight for wgt in wgts]
+        if not native and flags is not None:
+            ok = np.logical_not(flags)
+            u,v = u.compress(ok), v.compress(ok)
+            data = data.compress(ok)
+            wgts = [wgt.compress(ok) for wgt in wgts]
         if apply: uv,bm = self.uv,self.bm
         else:
             uv = np.zeros_like(self.uv)
@@ -141,22 +169,49 @@ class Img:
                 np.abs(inds[:,1]) < self.shape[1])
             data = data.compress(ok)
             inds = inds.compress(ok, axis=0)
-            utils.add2array(uv, inds, data.astype(uv.dtype))
+            inds = np.ravel_multi_index((inds[:,0], inds[:,1]), self.shape,
+                mode='wrap').astype(np.int_)
+            utils.add2array_flat(uv, inds, data.astype(uv.dtype), nthreads)
+            for i,wgt in enumerate(wgts):
+                wgt = wgt.compress(ok)
+                utils.add2array_flat(bm[i], inds, wgt.astype(bm[0].dtype), nthreads)
         else:
             u,v = self.get_indices(u,v)
-            _dsp.grid2D_c(uv, u, v, data.astype(uv.dtype))
-
-        for i,wgt in enumerate(wgts):
-            if not USEDSP:
-                wgt = wgt.compress(ok)
-                utils.add2array(bm[i], inds, wgt.astype(bm[0].dtype))
+            if native:
+                # Data and all beam terms share each sample's kernel taps.
+                # Complex inputs (strided or double) are gridded in place.
+                vals = [np.asarray(d) for d in [data] + list(wgts)]
+                vals = [d if d.dtype in (np.complex64, np.complex128)
+                    else d.astype(uv.dtype) for d in vals]
+                if weight is not None:
+                    weight = np.asarray(weight)
+                    if not weight.dtype in (np.float32, np.float64):
+                        weight = weight.astype(np.float64)
+                if flags is not None: flags = np.asarray(flags)
+                if self.hermitian:
+                    _dsp.grid2D_herm_c([uv] + bm, u, v, vals, self.shape[1],
+                        6, order, flags, weight)
+                else:
+                    _dsp.grid2D_multi_c([uv] + bm, u, v, vals, 6, order,
+                        flags, weight)
             else:
-                _dsp.grid2D_c(bm[i], u, v, wgt.astype(bm[0].dtype))
+                for buf,d in zip([uv] + bm, [data] + list(wgts)):
+                    d = np.ascontiguousarray(d, dtype=uv.dtype)
+                    _dsp.grid2D_c_mt(buf, u, v, d, 6, nthreads)
         if not apply: return uv, bm
-    def get(self, uvw, uv=None, bm=None):
+    def tile_order(self, uvw):
+        """Return the permutation of the (u,v,w) samples that grids them uv
+        tile by uv tile, for put(..., order=...).  Its cost is small next
+        to gridding, and it only depends on the sample positions, so it can
+        be kept and reused for data at the same (or nearby) uvw."""
+        u,v,w = uvw
+        u,v = self.get_indices(u,v)
+        return _dsp.tile_order(u, v, self.shape[0], self.shape[1])
+    def get(self, uvw, uv=None, bm=None, nthreads=1):
         """Generate data as would be observed at the provided (u,v,w) based on
         this Img's current uv data.  Phase due to 'w' will be applied to data
-        before returning."""
+        before returning.  nthreads != 1 degrids on that many native threads
+        (0 = aipy.get_num_threads(); see _dsp.degrid2D_c_mt)."""
         u,v,w = uvw
         u,v = u.flatten(), v.flatten()
         if uv is None: uv,bm = self.uv, self.bm[0]
@@ -170,14 +225,36 @@ class Img:
             u,v = -v,u # XXX necessary, but probably because of axis ordering in FITS files...
             uvdat = np.zeros(u.shape, dtype=np.complex64)
             bmdat = np.zeros(u.shape, dtype=np.complex64)
-            _dsp.degrid2D_c(uv, u, v, uvdat)
-            _dsp.degrid2D_c(bm, u, v, bmdat)
+            if uv.shape != self.shape:
+                degrid = lambda buf, u, v, d: _dsp.degrid2D_herm_c(buf, u, v, d, self.shape[1])
+            elif nthreads == 1: degrid = _dsp.degrid2D_c
+            else: degrid = lambda buf, u, v, d: _dsp.degrid2D_c_mt(buf, u, v, d, 6, nthreads)
+            degrid(uv, u, v, uvdat)
+            degrid(bm, u, v, bmdat)
             #data = uvdat.sum() / bmdat.sum()
             data = uvdat / bmdat
         return data
+    def major_cycle(self, uvw, data, mdl, center=(0,0), footprint=6):
+        """Cotton-Schwab major cycle: subtract the visibilities of the model
+        image 'mdl' (e.g. from cleaning self.image(center)) from the
+        (u,v,w) samples 'data', and re-grid the residuals.  Degridding,
+        subtraction and gridding happen in one native pass, and the
+        residual UV matrix is kept in self.res_uv and reused between calls.
+        Returns the residual data and the residual image."""
+        u,v,w = uvw
+        u,v = self.get_indices(u.flatten(), v.flatten())
+        c = (-center[0], -center[1])
+        mdl_uv = np.fft.fft2(recenter(mdl, c)).astype(np.complex64)
+        if getattr(self, 'res_uv', None) is None or self.res_uv.shape != self.shape:
+            self.res_uv = np.empty(self.shape, dtype=np.complex64)
+        data = np.ascontiguousarray(data.flatten(), dtype=np.complex64)
+        rdata = np.empty_like(data)
+        _dsp.degrid_grid2D_c(mdl_uv, self.res_uv, u, v, data, rdata, footprint)
+        return rdata, self._gen_img(self.res_uv, center=center)
     def append_hermitian(self, uvw, data, wgts=None):
         """Append to (uvw, data, [wgts]) the points (-uvw, conj(data), [wgts]).
-        This is standard practice to get a real-valued image."""
+        This is standard practice to get a real-valued image.  Hermitian
+        Imgs do this as they grid, and must not be given the doubled data."""
         u,v,w = uvw
         u = np.concatenate([u, -u], axis=0)
         v = np.concatenate([v, -v], axis=0)
@@ -188,22 +265,50 @@ class Img:
         assert(len(wgts) == len(self.bm))
         for i,wgt in enumerate(wgts): wgts[i] = np.concatenate([wgt,wgt],axis=0)
         return (u,v,w), data, wgts
-    def _gen_img(self, data, center=(0,0)):
+    def unfold(self, data):
+        """Return the full matrix of the Hermitian half-plane 'data' (e.g.
+        self.uv of a hermitian Img); full matrices are returned as they are."""
+        if data.shape == self.shape: return data
+        n1,n2 = self.shape
+        full = np.empty(self.shape, dtype=data.dtype)
+        w = data.shape[1]
+        full[:,:w] = data
+        # (r,c) is the conjugate of (-r,-c)
+        full[:,w:] = np.conj(data[-np.arange(n1) % n1][:,n2 - np.arange(w, n2)])
+        return full
+    def _gen_img(self, data, center=(0,0), out=None, nthreads=1):
         """Return the inverse FFT of the provided data, with the 0,0 point
-        moved to 'center'.  Up=North, Right=East."""
-        return recenter(np.fft.ifft2(data).real.astype(np.float32), center)
-    def image(self, center=(0,0)):
+        moved to 'center'.  Up=North, Right=East.  With the _dsp module,
+        the transform is native, on nthreads threads (one by default; 0 =
+        aipy.get_num_threads()), and written to out (float32, of
+        self.shape) if supplied."""
+        if USEDSP and data.ndim == 2 and data.dtype in (np.complex64, np.complex128):
+            if out is None: out = np.empty(self.shape, dtype=np.float32)
+            _dsp.uv_image(out, np.ascontiguousarray(data), center[0], center[1],
+                nthreads)
+            return out
+        if data.shape != self.shape:
+            img = np.fft.irfft2(data, s=self.shape)
+        else: img = np.fft.ifft2(data).real
+        img = recenter(img.astype(np.float32), center)
+        if out is None: return img
+        out[:] = img
+        return out
+    def image(self, center=(0,0), out=None, nthreads=1):
         """Return the inverse FFT of the UV matrix, with the 0,0 point moved
-        to 'center'.  Tranposes to put up=North, right=East."""
-        return self._gen_img(self.uv, center=center)
-    def bm_image(self, center=(0,0), term=None):
+        to 'center'.  Tranposes to put up=North, right=East.  See _gen_img
+        for out and nthreads."""
+        return self._gen_img(self.uv, center=center, out=out, nthreads=nthreads)
+    def bm_image(self, center=(0,0), term=None, out=None, nthreads=1):
         """Return the inverse FFT of the sample weightings (for all mf_order
         terms, or the specified term if supplied), with the 0,0 point
-        moved to 'center'.  Tranposes to put up=North, right=East."""
+        moved to 'center'.  Tranposes to put up=North, right=East.  out
+        (for a single term) and nthreads are as for image."""
         if not term is None:
-            return self._gen_img(self.bm[term], center=center)
+            return self._gen_img(self.bm[term], center=center, out=out,
+                nthreads=nthreads)
         else:
-            return [self._gen_img(b, center=center) for b in self.bm]
+            return [self._gen_img(b, center=center, nthreads=nthreads) for b in self.bm]
     def get_top(self, center=(0,0)):
         """Return the topocentric coordinates of each pixel in the image."""
         x,y = self.get_LM(center)
@@ -224,12 +329,17 @@ class Img:
 class ImgW(Img):
     """A subclass of Img adding W projection functionality (see Cornwell
     et al. 2005 "Widefield Imaging Problems in Radio Astronomy")."""
-    def __init__(self, size=100, res=1, wres=.5, mf_order=0, verbose=True):
-        """wres: the gridding resolution of sqrt(w) when projecting to w=0."""
+    def __init__(self, size=100, res=1, wres=.5, mf_order=0, verbose=True,
+            nlayers=1):
+        """wres: the gridding resolution of sqrt(w) when projecting to w=0.
+        nlayers: how many w-layers put/get project at once, on as many
+        native threads (0 = aipy.get_num_threads()).  Each costs a few
+        uv-matrix sized buffers."""
         Img.__init__(self, size=size, res=res, mf_order=mf_order)
         self.wres = wres
         self.wcache = {}
         self.verbose = verbose
+        self.nlayers = nlayers
     def put(self, uvw, data, wgts=None, invker2=None):
         """Same as Img.put, only now the w component is projected to the w=0
         plane before applying the data to the UV matrix."""
@@ -242,6 +352,15 @@ class ImgW(Img):
                 else: wgts.append(np.zeros_like(data))
         if len(self.bm) == 1 and len(wgts) != 1: wgts = [wgts]
         assert(len(wgts) == len(self.bm))
+        if USEDSP:
+            # Sums the projected layers before a single inverse FFT
+            ind1,ind2 = self.get_indices(u,v)
+            vals = [np.ascontiguousarray(d, dtype=np.complex64) for d in [data] + list(wgts)]
+            if not invker2 is None: invker2 = np.ascontiguousarray(invker2, dtype=np.complex128)
+            _dsp.wstack_put([self.uv] + self.bm, vals, ind1, ind2,
+                np.ascontiguousarray(w, dtype=np.float64), self.wres, self.res, invker2,
+                self.nlayers)
+            return
         # Sort uvw in order of w
         order = np.argsort(w)
         u = u.take(order)
@@ -272,6 +391,15 @@ class ImgW(Img):
             i = j
     def get(self, uvw):
         u,v,w = uvw
+        if USEDSP:
+            # Projects uv and bm to each chunk's w afresh (no wcache)
+            u,v,w = u.flatten(), v.flatten(), w.flatten()
+            ind1,ind2 = self.get_indices(-u,v)
+            ind1,ind2 = -ind2,ind1
+            data = np.zeros(u.shape, dtype=np.complex64)
+            _dsp.wstack_get(self.uv, self.bm[0], ind1, ind2,
+                w.astype(np.float64), data, self.wres, self.res, self.nlayers)
+            return data
         order = np.argsort(w.flat)
         u_,v_,w_ = u.take(order).squeeze(), v.take(order).squeeze(), w.take(order).squeeze()
         sqrt_w = np.sqrt(np.abs(w_)) * np.sign(w_)
@@ -320,6 +448,115 @@ class ImgW(Img):
         G[:,1:] = np.fliplr(G[:,1:]).copy()
         return G / G.size
 
+class ImgSnap(Img):
+    """An Img for imaging many slices (snapshots of a movie, channels) of
+    data taken at the same (u,v,w), e.g. an array's baselines over a few
+    seconds.  set_uvw tabulates the kernel taps of every sample once, and
+    add and images grid each slice from that table.  images transforms
+    slices in native code on several threads, each reusing its own grid
+    and FFT buffers."""
+    def __init__(self, uvw, size=100, res=1, mf_order=0, nthreads=0):
+        """uvw: the sample coordinates (w is ignored).  nthreads: how many
+        native threads images uses (0 = aipy.get_num_threads())."""
+        Img.__init__(self, size=size, res=res, mf_order=mf_order)
+        self.nthreads = nthreads
+        self.set_uvw(uvw)
+    def set_uvw(self, uvw):
+        """Tabulate the kernel taps for samples at uvw.  uvw changes slowly,
+        so this only needs redoing once they have moved by a fair part of
+        a uv pixel (self.res)."""
+        u,v,w = uvw
+        u,v = self.get_indices(np.asarray(u).flatten(), np.asarray(v).flatten())
+        self.taps = _dsp.grid_plan(u, v, self.shape[0], self.shape[1])
+    def add(self, data, wgts=None):
+        """As Img.put(uvw, data, wgts) for the uvw of set_uvw."""
+        if wgts is None:
+            wgts = [np.ones_like(data)] + [np.zeros_like(data)] * (len(self.bm) - 1)
+        if len(self.bm) == 1 and len(wgts) != 1: wgts = [wgts]
+        assert(len(wgts) == len(self.bm))
+        for buf,d in zip([self.uv] + self.bm, [data] + list(wgts)):
+            d = np.asarray(d).flatten()
+            if not d.dtype in (np.complex64, np.complex128): d = d.astype(np.complex64)
+            _dsp.grid_plan_c(buf, self.taps[0], self.taps[1], d)
+    def images(self, data, center=(0,0)):
+        """Return the dirty image of each slice data[k] (data has shape
+        (nslices, nsamples)) as self.image(center) would be after adding
+        only that slice, as a float32 array of shape (nslices,) + shape.
+        Slices do not touch self.uv; for the beam, image the weights."""
+        data = np.asarray(data)
+        if data.ndim == 1: data = data[np.newaxis]
+        if not data.dtype in (np.complex64, np.complex128):
+            data = data.astype(np.complex64)
+        out = np.empty((len(data),) + self.shape, dtype=np.float32)
+        _dsp.snap_images(out, self.taps[0], self.taps[1], data, center[0],
+            center[1], self.nthreads)
+        return out
+
+class ImgWindow(Img):
+    """An Img holding the uv matrix and beam of a sliding window of
+    integrations, for images of the last so many seconds updated as data
+    come in.  add() grids a new integration into the matrices and takes
+    back out those that have left the window, gridding them again with
+    their tabulated kernel taps negated, so an update costs about two
+    integrations' gridding whatever the window holds, and image() and
+    bm_image() transform the matrices only when called.  The matrices are
+    complex128, so that adding and taking back leaves no drift beyond
+    double precision rounding."""
+    def __init__(self, size=100, res=1, mf_order=0, window=60.):
+        """window: the span of the times passed to add() (seconds, or
+        whatever unit they are in) that the matrices cover."""
+        Img.__init__(self, size=size, res=res, mf_order=mf_order)
+        self.window = window
+        self.uv = self.uv.astype(np.complex128)
+        self.bm = [b.astype(np.complex128) for b in self.bm]
+        self.ints = []
+    def add(self, t, uvw, data, wgts=None, flags=None, weight=None):
+        """Grid the integration at time t (ascending between calls), as
+        Img.put(uvw, data, wgts, flags=flags, weight=weight) would, and
+        take out the integrations at times t - window or before."""
+        u,v,w = uvw
+        if wgts is None:
+            wgts = [np.ones_like(data)] + [np.zeros_like(data)] * (len(self.bm) - 1)
+        if len(self.bm) == 1 and len(wgts) != 1: wgts = [wgts]
+        assert(len(wgts) == len(self.bm))
+        u,v = np.asarray(u).flatten(), np.asarray(v).flatten()
+        vals = [np.asarray(d).flatten() for d in [data] + list(wgts)]
+        if weight is not None:
+            weight = np.asarray(weight).flatten()
+            vals = [d * weight for d in vals]
+        if flags is not None:
+            ok = np.logical_not(np.asarray(flags).flatten())
+            u,v = u.compress(ok), v.compress(ok)
+            vals = [d.compress(ok) for d in vals]
+        vals = [d if d.dtype in (np.complex64, np.complex128)
+            else d.astype(np.complex64) for d in vals]
+        u,v = self.get_indices(u, v)
+        taps = _dsp.grid_plan(u, v, self.shape[0], self.shape[1])
+        for buf,d in zip([self.uv] + self.bm, vals):
+            _dsp.grid_plan_c(buf, taps[0], taps[1], d)
+        self.ints.append((t, taps, vals))
+        self.expire(t - self.window)
+    def expire(self, t):
+        """Take out the integrations at time t or before."""
+        n = 0
+        while n < len(self.ints) and self.ints[n][0] <= t: n += 1
+        if n == len(self.ints): return self.clear()
+        for t0,taps,vals in self.ints[:n]:
+            for buf,d in zip([self.uv] + self.bm, vals):
+                _dsp.grid_plan_c(buf, taps[0], taps[1], d, -1)
+        del self.ints[:n]
+    def clear(self):
+        """Take out all integrations."""
+        for buf in [self.uv] + self.bm: buf[:] = 0
+        self.ints = []
+    def times(self):
+        """Return the times of the integrations in the window."""
+        return [i[0] for i in self.ints]
+    def get(self, uvw, nthreads=1):
+        """As Img.get, from the current window."""
+        return Img.get(self, uvw, self.uv.astype(np.complex64),
+            self.bm[0].astype(np.complex64), nthreads=nthreads)
+
 default_fits_format_codes = {
     np.bool_:'L', np.uint8:'B', np.int16:'I', np.int32:'J', np.int64:'K',
     np.float32:'E', np.float64:'D', np.complex64:'C', np.complex128:'M'
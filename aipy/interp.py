@@ -1,7 +1,7 @@
 """
-A pure-python, spline-like implementation of 1D interpolation.  Uses
-an FIR filter (spline) to interpolate, and a polynomial to extrapolate
-boundaries.
+A spline-like implementation of 1D interpolation.  Uses an FIR filter
+(spline) to interpolate, and a polynomial to extrapolate boundaries, in
+a native polyphase loop (_dsp.interp_fir) over rows of samples.
 
 Author: Aaron Parsons
 Date: 12/12/07
@@ -11,6 +11,7 @@ Revisions:
 from __future__ import print_function, division, absolute_import
 
 import numpy as np
+from . import _dsp
 
 __all__ = ['interpolate', 'default_filter']
 
@@ -40,14 +41,32 @@ def default_filter(xs, freq=.25):
     i = np.arange(xs.size, dtype=np.float64) / xs.size * 2*np.pi
     return (1-np.cos(i)) * np.sinc(freq*xs)
 
-def interpolate(ys, factor, filter=default_filter, order=4):
+def interpolate(ys, factor, filter=default_filter, order=4, nthreads=0):
     """Oversample ys by the specified factor using a filter function to
     interpolated between samples.  The filter function will be used to
     construct an FIR filter for x values [-order,order] in steps of 1/order.
     Order should be even to make this an averaging filter.  Internally,
     ys is extended by 2nd degree polynomial in both directions to attempt
-    a smooth boundary transition."""
+    a smooth boundary transition.  ys may also be a stack of rows (e.g.
+    (nant,nchan)), each interpolated along the last axis.  For order > 2
+    the work is done by _dsp.interp_fir, which skips the zeros of the
+    upsampled rows, on nthreads native threads (0 =
+    aipy.get_num_threads())."""
     step = 1./factor
+    ys = np.asarray(ys)
+    if order > 2 and ys.ndim >= 1 and ys.shape[-1] >= order:
+        fir = np.ascontiguousarray(filter(np.arange(-order,order+step,step)),
+            dtype=np.float64)
+        if fir.size <= (ys.shape[-1] + 2*order) * factor:
+            dtype = np.complex128 if np.iscomplexobj(ys) else np.float64
+            rows = np.ascontiguousarray(ys.reshape(-1, ys.shape[-1]), dtype=dtype)
+            nout = (ys.shape[-1] + 2*order) * factor - fir.size + 1
+            rv = np.empty((rows.shape[0], nout), dtype=dtype)
+            _dsp.interp_fir(rv, rows, fir, factor, order, 2, nthreads)
+            return rv.reshape(ys.shape[:-1] + (nout,))
+    if ys.ndim > 1:
+        return np.array([interpolate(y, factor, filter=filter, order=order)
+            for y in ys.reshape(-1, ys.shape[-1])]).reshape(ys.shape[:-1] + (-1,))
     ys = polyextend(ys, order)
     ys_ss, wgts = subsample(ys, factor)
     fir = filter(np.arange(-order,order+step,step))
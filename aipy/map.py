@@ -4,7 +4,7 @@ Module for mapping and modeling the entire sky.
 
 from __future__ import print_function, division, absolute_import
 
-from .  import healpix, coord, img
+from .  import healpix, coord, img, utils
 import numpy as np, random
 try:
     from astropy.io import fits as pyfits
@@ -98,10 +98,28 @@ class Map(object):
         ind = [i[crds] / w for i in self.ind]
         if len(ind) == 0: return fluxes
         return (fluxes, ind)
-    def add(self, crds, wgts, fluxes, inds=[]):
-        self.wgt[crds] += wgts
-        self.map[crds] += fluxes * wgts
-        for n,i in enumerate(inds): self.ind[n][crds] += i * wgts
+    def add(self, crds, wgts, fluxes, inds=[], nthreads=0):
+        """Add wgts to the weight map, and fluxes and inds (weighted by
+        wgts) to the flux and index maps, at crds (as for
+        HealpixMap.__getitem__), repeated pixels summing.  The pixels are
+        looked up once and all the maps filled in one pass, on nthreads
+        native threads (0 = aipy.get_num_threads())."""
+        if type(crds) is tuple:
+            px = self.wgt.crd2px(*[healpix.mk_arr(c, dtype=np.double) for c in crds])
+        else: px = healpix.mk_arr(crds, dtype=np.int_)
+        px = np.asarray(px, dtype=np.int_).ravel()
+        w = np.broadcast_to(np.asarray(wgts, dtype=np.double).ravel(), px.shape)
+        vals = [np.broadcast_to(np.asarray(v, dtype=np.double).ravel(), px.shape)
+            for v in [fluxes] + list(inds)]
+        hpms = [self.wgt, self.map] + self.ind[:len(inds)]
+        dtype = hpms[0].map.dtype
+        if dtype not in (np.float32, np.float64) or \
+                any(h.map.dtype != dtype for h in hpms): dtype = np.double
+        for h in hpms:
+            if h.map.dtype != dtype or not h.map.flags.c_contiguous or \
+                    not h.map.flags.writeable:
+                h.map = np.array(h.map, dtype=dtype)
+        utils.add2maps([h.map for h in hpms], px, w, vals, nthreads)
     def put(self, crds, wgts, fluxes, inds=[]):
         self.wgt[crds] = wgts
         self.map[crds] = fluxes * wgts
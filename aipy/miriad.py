@@ -78,9 +78,10 @@ class UV(_miriad.UV):
         _miriad.UV.__init__(self, filename, status, corrmode)
         self.status = status
         self.nchan = _miriad.MAXCHAN
+        self.tracked_names, self.tracked = (), None
         if status == 'old':
-            self.vartable = self._gen_vartable()
-            self.read(); self.rewind() # Update variables for the user
+            self.vartable = self._vartable()
+            self._peek() # Update variables for the user
             try: self.nchan = self['nchan']
             except(KeyError): pass
         else: self.vartable = {'corr':corrmode}
@@ -98,33 +99,24 @@ class UV(_miriad.UV):
         return list(self.vartable.keys())
     def items(self):
         """Return a list of available header items."""
-        items = []
-        for i in itemtable:
-            try:
-                _miriad.hdaccess(self.haccess(i, 'read'))
-                items.append(i)
-            except(IOError): pass
-        return items
+        present = set(self.list_items())
+        return [i for i in itemtable if i in present]
     def _rdhd(self, name):
         """Provide read access to header items via low-level calls."""
         itype = itemtable[name]
         if itype == '?': return self._rdhd_special(name)
         h = self.haccess(name, 'read')
         rv = []
-        if len(itype) == 1:
-            if itype == 'a': offset = 0
-            else:
-                t, offset = _miriad.hread_init(h)
-                assert(itype == t)
-            while True:
-                try: c, o = _miriad.hread(h, offset, itype)
-                except(IOError): break
-                if itype == 'a':
-                    try: c = str(c[:o], 'utf-8')
-                    except(TypeError): c = c[:o]
-                rv.append(c)
-                offset += o
-            if itype == 'a': rv = ''.join(rv)
+        if itype == 'a':
+            # The whole item in one read, less its NULs
+            rv = _miriad.hread_array(h, 'a', 0).replace(b'\0', b'')
+            try: rv = str(rv, 'utf-8')
+            except(TypeError): pass
+        elif len(itype) == 1:
+            t, offset = _miriad.hread_init(h)
+            assert(itype == t)
+            rv = _miriad.hread_array(h, itype, offset)
+            if len(rv) == 1: rv = [rv[0].item()]
         else:
             t, offset = _miriad.hread_init(h); assert(t == 'b')
             for t in itype:
@@ -194,6 +186,25 @@ class UV(_miriad.UV):
             self._wrvr(name,type,val)
         except(KeyError):
             self._wrhd(name,val)
+    def project(self, names=()):
+        """Unpack only the variables named (and those read() itself needs)
+        as records are read.  Others stay in the file until asked for with
+        uv[name], so reads skip bulky variables a job never looks at.  An
+        empty list unpacks every variable again."""
+        self._project(','.join(names))
+    def track(self, names=()):
+        """Snapshot the scalar variables named (of type i, r or d, such as
+        'pol', 'lst' or 'inttime') natively as each record is read, so
+        loops need not look each one up with uv[name].  After every read(),
+        self.tracked holds their values in the order of names as a float64
+        array, updated in place (NaN for a variable with no value yet), and
+        read_block returns them by default.  An empty list stops tracking."""
+        names = tuple(names)
+        for k in names:
+            if not self.vartable.get(k) in ('i', 'r', 'd'):
+                raise ValueError('track needs an i, r or d variable: %s' % k)
+        self.tracked = self._track(','.join(names))
+        self.tracked_names = names
     def select(self, name, n1, n2, include=1):
         """Choose which data are returned by read().
             name    This can be: 'decimate','time','antennae','visibility',
@@ -210,19 +221,92 @@ class UV(_miriad.UV):
                     p1 is used.
                     For 'and','or','clear','auto' p1 and p2 are ignored.
             include If true, the data is selected. If false, the data is
-                    discarded. Ignored for 'and','or','clear'."""
+                    discarded. Ignored for 'and','or','clear'.
+        Selecting does not move the read position: a 'time' selection
+        still reads past the records before it, unless seek_time(n1, 1)
+        skips them once all selections are made."""
         if name == 'antennae':
             n1 += 1; n2 += 1
         self._select(name, float(n1), float(n2), int(include))
     def read(self, raw=False):
         """Return the next data record.  Calling this function causes
         vars to change to reflect the record which this function returns.
-        'raw' causes data and flags to be returned seperately."""
-        preamble, data, flags, nread = self.raw_read(self.nchan)
+        'raw' causes data and flags to be returned seperately.  To read
+        into existing buffers, see raw_read_into."""
+        data = np.empty(self.nchan, dtype=np.complex64)
+        flags = np.empty(self.nchan, dtype=np.bool_)
+        preamble, nread = self.raw_read_into(data, flags, None, True)
         if nread == 0: raise IOError("No data read")
-        flags = np.logical_not(flags)
         if raw: return preamble, data, flags
         return preamble, np.ma.array(data, mask=flags)
+    def read_block(self, n, vars=None):
+        """Read up to n records at once, without building per-record
+        objects.  Returns (uvw, t, ij, data, flags, v) for the nrec <= n
+        records read: uvw (nrec,3) and t (nrec,) float64, ij (nrec,2) int32
+        antenna pairs, data (nrec,nchan) complex64, flags (nrec,nchan) bool
+        (True where invalid, as for read(raw=True)), and v a dict holding,
+        for each name in vars (scalar variables of type j, i, r or d, such
+        as 'pol' or 'lst'), its value after each record.  vars defaults to
+        the variables tracked (see track).  nrec is 0 at the end of the
+        file."""
+        dtypes = {'j':np.int16, 'i':np.int32, 'r':np.float32, 'd':np.float64}
+        uvw = np.empty((n,3), dtype=np.float64)
+        t = np.empty(n, dtype=np.float64)
+        ij = np.empty((n,2), dtype=np.int32)
+        data = np.empty((n,self.nchan), dtype=np.complex64)
+        flags = np.empty((n,self.nchan), dtype=np.bool_)
+        v = {}
+        if vars is None: vars = self.tracked_names
+        for k in vars:
+            if not self.vartable.get(k) in dtypes:
+                raise ValueError('read_block needs a j, i, r or d variable: %s' % k)
+            v[k] = np.empty(n, dtype=dtypes[self.vartable[k]])
+        # The flags come back already inverted, one byte per channel
+        nrec = self.raw_read_block(uvw, t, ij, data, flags, list(v.items()), True)
+        v = dict([(k, v[k][:nrec]) for k in v])
+        return uvw[:nrec], t[:nrec], ij[:nrec], data[:nrec], flags[:nrec], v
+    def set_average(self, nt=1, nchan=1):
+        """Average nt integrations and nchan channels in read_average, for
+        each baseline and polarization.  Discards any averages pending
+        from an earlier setting; rewind and seek_time clear them, too."""
+        self.raw_set_average(nt, nchan)
+        self._avg_nchan = nchan
+    def read_average(self, n):
+        """Read up to n averages (see set_average) at once.  The records
+        are accumulated natively while streaming, so only the open
+        averages are ever held.  Every nt distinct times (records must be
+        in time order) make a bin.  Returns (uvw, t, ij, pol, data, flags,
+        wgt) as for read_block: uvw and t the means over the records
+        averaged, pol (nrec,) int32, data (nrec,nout) complex64 the mean of
+        the valid samples, flags True where there were none, and wgt
+        (nrec,nout) float32 the number of valid samples, with nout =
+        ceil(nchan / averaged channels).  nrec is 0 at the end of the
+        file."""
+        nchan = getattr(self, '_avg_nchan', None)
+        if nchan is None:
+            raise RuntimeError('set_average must come before read_average')
+        nout = (self.nchan + nchan - 1) // nchan
+        uvw = np.empty((n,3), dtype=np.float64)
+        t = np.empty(n, dtype=np.float64)
+        ij = np.empty((n,2), dtype=np.int32)
+        pol = np.empty(n, dtype=np.int32)
+        data = np.empty((n,nout), dtype=np.complex64)
+        flags = np.empty((n,nout), dtype=np.bool_)
+        wgt = np.empty((n,nout), dtype=np.float32)
+        nrec = self.raw_read_average(uvw, t, ij, pol, data, flags, wgt)
+        return (uvw[:nrec], t[:nrec], ij[:nrec], pol[:nrec], data[:nrec],
+                flags[:nrec], wgt[:nrec])
+    def to_cube(self):
+        """Read every selected record, from the start of the file, into a
+        dense cube.  Returns (data, flags, times, ij, pols): data
+        (ntime,nbl,npol,nchan) complex64 and flags (same shape) bool, True
+        where invalid or where no record was written; times the sorted
+        Julian dates, ij (nbl,2) int32 antenna pairs sorted by (i,j), and
+        pols the int32 MIRIAD polarization codes in order of appearance.
+        The records are indexed without decoding their data, then each is
+        decoded straight into its place, so nothing beyond the cube is
+        held in memory.  Leaves the file rewound."""
+        return self.raw_to_cube()
     def all(self, raw=False):
         """Provide an iterator over preamble, data.  Allows constructs like:
         for preamble, data in uv.all(): ..."""
@@ -235,15 +319,34 @@ class UV(_miriad.UV):
         array.  preamble must be (uvw, t, (i,j)), where uvw is an array of
         u,v,w, t is the Julian date, and (i,j) is an antenna pair."""
         if data is None: return
-        if not flags is None: flags = np.logical_not(flags)
-        elif len(data.mask.shape) == 0:
-            flags = np.ones(data.shape)
-            data = data.unmask()
-        else:
-            flags = np.logical_not(data.mask)
-            #data = data.filled(0)
-            data = data.data
-        self.raw_write(preamble,data.astype(np.complex64),flags.astype(np.int32))
+        if flags is None: flags = np.ma.getmaskarray(data)
+        data = np.ascontiguousarray(np.ma.getdata(data), dtype=np.complex64)
+        flags = np.asarray(flags)
+        if not flags.dtype in (np.bool_, np.int32): flags = flags.astype(np.bool_)
+        # Already complex64 data and bool masks are written without copies
+        self.raw_write_from(preamble, data, np.ascontiguousarray(flags), True)
+    def write_block(self, uvw, t, ij, data, flags=None, vars={}):
+        """Write n records at once: the complement of read_block.  uvw is
+        (n,3), t (n,), ij (n,2) antenna pairs, data (n,nchan) (complex, or
+        masked) and flags (n,nchan) (True where invalid, defaulting to the
+        mask of data).  vars maps names of scalar variables of type j, i,
+        r or d (added with add_var or already in the file) to (n,) arrays
+        of their values for each record; like other variables, they are
+        only written out when they change."""
+        dtypes = {'j':np.int16, 'i':np.int32, 'r':np.float32, 'd':np.float64}
+        if flags is None: flags = np.ma.getmaskarray(data)
+        data = np.ascontiguousarray(np.ma.getdata(data), dtype=np.complex64)
+        if data.ndim == 1: data = data.reshape((-1,1))
+        flags = np.logical_not(flags).astype(np.int32).reshape(data.shape)
+        uvw = np.ascontiguousarray(uvw, dtype=np.float64).reshape((-1,3))
+        t = np.ascontiguousarray(t, dtype=np.float64)
+        ij = np.ascontiguousarray(ij, dtype=np.int32).reshape((-1,2))
+        v = []
+        for k in vars:
+            if not self.vartable.get(k) in dtypes:
+                raise ValueError('write_block needs a j, i, r or d variable: %s' % k)
+            v.append((k, np.ascontiguousarray(vars[k], dtype=dtypes[self.vartable[k]])))
+        self.raw_write_block(uvw, t, ij, data, flags, v)
     def init_from_uv(self, uv, override={}, exclude=[]):
         """Initialize header items and variables from another UV.  Those in
         override will be overwritten by override[k], and tracking will be
@@ -284,11 +387,100 @@ class UV(_miriad.UV):
                 np, nd = mfunc(uv, p, d)
                 self.copyvr(uv)
                 self.write(np, nd)
+    def pipe_block(self, uv, mfunc=None, nblock=1024, threads=False, append2hist='',
+            cal=None, divide=False, nthreads=0):
+        """As pipe(), but natively, a block of up to nblock records at a
+        time.  mfunc(uv,uvw,t,ij,data,flags,v) gets the records as
+        read_block returns them, with v mapping each variable uv tracks
+        (see track) to its float64 values, and returns the block to write
+        as (uvw,t,ij,data,flags), optionally followed by a (n,) bool array
+        choosing the records to keep, or None to drop the block.  Without
+        mfunc the records are copied as they are.  Variables are copied
+        (as by copyvr) record by record in C.  With threads, reading and
+        writing run on threads of their own, overlapping mfunc; uv's own
+        variables then run ahead of the block mfunc has, so it should use
+        v.  cal, if given, is (gains, times, pols): gains (ntime,nant,npol,
+        nchan) applied natively to each block as it is read, before mfunc,
+        as by apply_gains, on nthreads threads.  pols is either a list of
+        the MIRIAD polarization codes of the npol axis, or a dict mapping
+        each code to the indices on it of the feeds (i, j) of its antennas,
+        such as {-7: (0, 1)} for xy with x and y gains; records of other
+        polarizations are left alone.  Returns the number of records
+        read."""
+        if cal is not None:
+            gains, times, pols = cal
+            gains = np.ascontiguousarray(gains, dtype=np.complex64)
+            if gains.ndim == 3: gains = gains[None]
+            times = np.ascontiguousarray(np.reshape(times, -1), dtype=np.float64)
+            if not isinstance(pols, dict): pols = dict([(p, (k, k)) for k,p in enumerate(pols)])
+            pols = [(int(p), int(pols[p][0]), int(pols[p][1])) for p in pols]
+            cal = (gains, times, pols, int(divide), nthreads)
+        self._wrhd('history', self['history'] + append2hist)
+        names = uv.tracked_names
+        func = None
+        if mfunc is not None:
+            def func(uvw, t, ij, data, flags, v):
+                v = dict([(k, v[:,n]) for n,k in enumerate(names)])
+                return mfunc(uv, uvw, t, ij, data, flags, v)
+        return self.raw_pipe(uv, func, nblock, uv.nchan, int(threads), cal)
+    def fan_out(self, outs, nblock=1024, init=True, append2hist=''):
+        """Split the records of this file among several new ones in a
+        single pass.  outs is a list of (uv, route): uv a UV opened 'new'
+        and route a dict of what it gets: 'chans' (lo, hi) its channels
+        lo..hi-1 (with nspect, nschan, ischan, sfreq and sdf cut down to
+        match), 'pols' the polarizations it keeps (MIRIAD codes or strings
+        such as 'xx'), 'bls' the (i,j) antenna pairs it keeps; what route
+        leaves out, uv gets all of.  Unless init is False, each uv is
+        first set up with init_from_uv(self).  Each record is read once,
+        natively, and written to every uv on a thread of its own, copying
+        variables as pipe() does.  The string 'append2hist' is appended to
+        the history of each.  Returns the number of records read."""
+        routes = []
+        for uv, route in outs:
+            if init: uv.init_from_uv(self)
+            uv._wrhd('history', uv['history'] + append2hist)
+            lo, hi = route.get('chans', (0, self.nchan))
+            pols = route.get('pols')
+            if pols is not None:
+                pols = [str2pol[p] if isinstance(p, str) else int(p) for p in pols]
+            bls = route.get('bls')
+            if bls is not None: bls = [(int(i), int(j)) for i,j in bls]
+            routes.append((uv, int(lo), int(hi), pols, bls))
+        return self.raw_fan_out(routes, nblock, self.nchan)
     def add_var(self, name, type):
         """Add a variable of the specified type to a UV file."""
         self.vartable[name] = type
 
+def apply_gains(data, ij, t, gains, times=None, pidx=None, flags=None,
+        divide=False, nthreads=0):
+    """Calibrate a block of records in place: multiply data (n,nchan)
+    complex64 by g_i * conj(g_j) for the antennas ij (n,2) of each record,
+    or with divide, divide by it (flagging channels of zero gain in flags,
+    (n,nchan) bool, if given).  gains (ntime,nant,npol,nchan), or
+    (nant,npol,nchan) for gains constant in time, are sampled at the
+    ascending times and interpolated linearly to the times t (n,) of the
+    records, held beyond the first and last samples.  pidx (n,) indexes
+    the npol axis for each record (default 0), or pidx (n,2) for the feeds
+    of antennas i and j apart (as for xy); records with a negative index
+    are left alone.  Runs natively on nthreads threads (0 =
+    aipy.get_num_threads()).  Returns data."""
+    gains = np.ascontiguousarray(gains, dtype=np.complex64)
+    if gains.ndim == 3: gains = gains[None]
+    if times is None: times = np.zeros(gains.shape[0])
+    n = data.shape[0]
+    if pidx is None: pidx = np.zeros(n, dtype=np.int32)
+    pidx = np.asarray(pidx, dtype=np.int32)
+    if pidx.ndim == 1: pidx = np.stack([pidx, pidx], axis=1)
+    _miriad.apply_gains(data, flags, np.ascontiguousarray(ij, dtype=np.int32),
+        np.ascontiguousarray(pidx, dtype=np.int32),
+        np.ascontiguousarray(np.broadcast_to(t, (n,)), dtype=np.float64), gains,
+        np.ascontiguousarray(np.reshape(times, -1), dtype=np.float64), int(divide), nthreads)
+    return data
+
 def bl2ij(bl):
+    """Decode a Miriad baseline number into 0-indexed antennas (i, j).  An
+    array of them gives arrays of i and j, decoded natively."""
+    if np.ndim(bl) > 0: return _miriad.bl2ij_array(bl)
     bl = int(bl)
     if (bl > 65536):
         bl -= 65536
@@ -299,12 +491,38 @@ def bl2ij(bl):
     return bl//mant - 1, bl%mant -1
 
 def ij2bl(i, j):
+    """Encode 0-indexed antennas i, j as a Miriad baseline number.  Arrays
+    of them (broadcast together) give an int64 array, encoded natively."""
+    if np.ndim(i) > 0 or np.ndim(j) > 0:
+        i, j = np.broadcast_arrays(i, j)
+        return _miriad.ij2bl_array(i, j)
     if i > j: i,j = j,i
     if j + 1 < 256: return 256*(i+1) + (j+1)
     else: return 2048*(i+1) + (j+1) + 65536
 
-def read_files(filenames, antstr, polstr, decimate=1, decphs=0, verbose=False, recast_as_array=True):
-    '''Read in miriad uv files.
+def _read_file(filename, antstr, polstr, decimate, decphs, nblock=4096):
+    """Read the selected records of one file with read_block, returning
+    (t, ij, pol, lst, data, flags, hdr): per-record arrays and a dict of
+    the header variables read_files reports."""
+    from . import scripting
+    uv = UV(filename)
+    scripting.uv_selector(uv, antstr, polstr)
+    if decimate > 1: uv.select('decimate', decimate, decphs)
+    blocks = []
+    while True:
+        uvw, t, ij, d, f, v = uv.read_block(nblock, vars=['pol', 'lst'])
+        if len(t) == 0: break
+        blocks.append((t, ij, v['pol'], v['lst'], d, f))
+    if len(blocks) == 0: blocks.append((t, ij, v['pol'], v['lst'], d, f))
+    rv = [np.concatenate([b[k] for b in blocks]) for k in range(6)]
+    hdr = dict([(k, uv[k]) for k in ('sdf', 'sfreq', 'nchan', 'inttime')])
+    return rv + [hdr]
+
+def read_files(filenames, antstr, polstr, decimate=1, decphs=0, verbose=False, recast_as_array=True, nthreads=None):
+    '''Read in miriad uv files.  Files are read in parallel on nthreads
+       threads (default: one per file, up to aipy.get_num_threads()), a block
+       of records at a time, and each baseline's data is gathered into one
+       array.
        Parameters
        ---------
        filenames : list of files
@@ -322,33 +540,532 @@ def read_files(filenames, antstr, polstr, decimate=1, decphs=0, verbose=False, r
        flgs      : dict
             corresponding flags to data. Same format.
     '''
-    from . import scripting, cal
-    info = {'lsts':[], 'times':[]}
+    import threading
+    from . import cal, _pool
+    if isinstance(filenames, str): filenames = [filenames]
+    if nthreads is None: nthreads = _pool.get_num_threads()
+    nthreads = max(1, min(nthreads, len(filenames)))
+    results = [None] * len(filenames)
+    todo = list(range(len(filenames)))[::-1]
+    lock = threading.Lock()
+    def worker():
+        while True:
+            with lock:
+                if not todo: return
+                k = todo.pop()
+            if verbose: print('   Reading', filenames[k])
+            try: results[k] = _read_file(filenames[k], antstr, polstr, decimate, decphs)
+            except(Exception) as e: results[k] = e
+    threads = [threading.Thread(target=worker) for n in range(nthreads - 1)]
+    for th in threads: th.start()
+    worker()
+    for th in threads: th.join()
+    for r in results:
+        if isinstance(r, Exception): raise r
+    t, ij, pol, lst, d, f = [np.concatenate([r[k] for r in results]) for k in range(6)]
+    hdr = results[-1][6]
+    # A new time starts wherever t changes from the previous record
+    new = np.ones(len(t), dtype=np.bool_)
+    new[1:] = t[1:] != t[:-1]
+    info = {'times':t[new], 'lsts':lst[new]}
+    # Gather each (i,j,pol) in record order, copying its rows just once
+    keys, inv = np.unique(np.column_stack([ij, pol]), axis=0, return_inverse=True)
+    inv = inv.ravel()
+    order = np.argsort(inv, kind='stable')
+    edges = np.concatenate([[0], np.cumsum(np.bincount(inv, minlength=len(keys)))])
     data, flgs = {}, {}
-    if type(filenames) == 'str': filenames = [filenames]
-    for filename in filenames:
-        if verbose: print('   Reading', filename)
-        uv = UV(filename)
-        scripting.uv_selector(uv, antstr, polstr)
-        if decimate > 1: uv.select('decimate', decimate, decphs)
-        for (crd,t,(i,j)),d,f in uv.all(raw=True):
-            if len(info['times']) == 0 or info['times'][-1] != t:
-                info['times'].append(t)
-                info['lsts'].append(uv['lst'])
-            pol = pol2str[uv['pol']]
-            key = (i,j,pol)
-            data[key] = data.get(key,[]) + [d]
-            flgs[key] = flgs.get(key,[]) + [f]
-    info['freqs'] = cal.get_freqs(uv['sdf'], uv['sfreq'], uv['nchan'])
-    if recast_as_array:
-        # This option helps reduce memory footprint, but it shouldn't
-        # be necessary: the replace below should free RAM as quickly
-        # as it is allocated.  Unfortunately, it doesn't seem to...
+    for n, (i, j, p) in enumerate(keys):
+        key = (int(i), int(j), pol2str[int(p)])
+        rows = order[edges[n]:edges[n+1]]
+        data[key], flgs[key] = d[rows], f[rows]
+    info['freqs'] = cal.get_freqs(hdr['sdf'], hdr['sfreq'], hdr['nchan'])
+    if not recast_as_array:
         for key in data:
-            data[key] = np.array(data[key])
-            flgs[key] = np.array(flgs[key])
-        info['lsts'] = np.array(info['lsts'])
-        info['times'] = np.array(info['times'])
-    info['inttime'] = uv['inttime']
-    info['sdf'] = uv['sdf']
+            data[key], flgs[key] = list(data[key]), list(flgs[key])
+        info['lsts'], info['times'] = list(info['lsts']), list(info['times'])
+    info['inttime'] = hdr['inttime']
+    info['sdf'] = hdr['sdf']
     return info, data, flgs
+
+#   ____      _
+#  / ___|___ | |_   _ _ __ ___  _ __   __ _ _ __
+# | |   / _ \| | | | | '_ ` _ \| '_ \ / _` | '__|
+# | |__| (_) | | |_| | | | | | | | | | (_| | |
+#  \____\___/|_|\__,_|_| |_| |_|_| |_|\__,_|_|
+
+_columnar_index = 'index.json'
+
+def to_columnar(filename, dirname, vars=('lst',), hdr=('sdf', 'sfreq', 'nchan', 'inttime'), nblock=4096):
+    """Convert the Miriad UV file filename into a columnar cache in the
+    directory dirname, for UVColumnar to map back.  Each column (t, uvw,
+    ij, pol, data, flags and one per variable in vars, which must be of
+    type j, i, r or d) is written, in record order, to a flat binary file
+    of its own, and index.json records their types and shapes along with
+    the header variables named in hdr.  The index is written last, so an
+    interrupted conversion leaves no usable cache.  Returns the
+    UVColumnar."""
+    import os, json
+    uv = UV(filename)
+    vars = [k for k in vars if k != 'pol']
+    if not os.path.isdir(dirname): os.makedirs(dirname)
+    index = os.path.join(dirname, _columnar_index)
+    if os.path.exists(index): os.remove(index)
+    names = ['t', 'uvw', 'ij', 'pol', 'data', 'flags'] + ['var_' + k for k in vars]
+    files = dict([(k, open(os.path.join(dirname, k + '.bin'), 'wb')) for k in names])
+    cols, nrec, tlast, tsorted = {}, 0, -np.inf, True
+    try:
+        while True:
+            uvw, t, ij, d, f, v = uv.read_block(nblock, vars=['pol'] + vars)
+            if len(t) == 0: break
+            block = {'t':t, 'uvw':uvw, 'ij':ij, 'pol':v['pol'], 'data':d, 'flags':f}
+            for k in vars: block['var_' + k] = v[k]
+            for k in names:
+                a = np.ascontiguousarray(block[k])
+                cols[k] = (a.dtype.str, list(a.shape[1:]))
+                a.tofile(files[k])
+            tsorted = tsorted and t[0] >= tlast and bool(np.all(np.diff(t) >= 0))
+            tlast, nrec = t[-1], nrec + len(t)
+    finally:
+        for k in files: files[k].close()
+    # Columns of an empty file still need their types
+    if nrec == 0:
+        for k, a in zip(names, [t, uvw, ij, v['pol'], d, f] + [v[k] for k in vars]):
+            cols[k] = (a.dtype.str, list(a.shape[1:]))
+    header = {}
+    for k in hdr:
+        try: val = uv[k]
+        except(KeyError): continue
+        header[k] = val if isinstance(val, str) else np.asarray(val).tolist()
+    info = {'version':1, 'source':os.path.abspath(filename), 'nrec':nrec,
+        'nchan':int(uv.nchan), 'vars':vars, 'header':header, 'sorted':tsorted,
+        'columns':dict([(k, {'dtype':cols[k][0], 'shape':[nrec] + cols[k][1]}) for k in names])}
+    with open(index + '.tmp', 'w') as fh: json.dump(info, fh, indent=1)
+    os.rename(index + '.tmp', index)
+    del uv
+    return UVColumnar(dirname)
+
+class UVColumnar(object):
+    """A columnar cache written by to_columnar, memory-mapped read-only:
+    opening one reads only its index, and each column is a numpy array
+    paged in from disk as it is used.  Columns are in record order:
+    self.t, self.uvw (nrec,3), self.ij (nrec,2), self.pol, self.data
+    (nrec,nchan) complex64 and self.flags (nrec,nchan) bool (True where
+    invalid); self.vars maps each cached variable to its (nrec,) array.
+    self.header holds the cached header variables."""
+    def __init__(self, dirname):
+        import os, json
+        self.dirname = dirname
+        with open(os.path.join(dirname, _columnar_index)) as fh: info = json.load(fh)
+        if info.get('version') != 1:
+            raise IOError('Unknown columnar cache version in %s' % dirname)
+        self.nrec, self.nchan = info['nrec'], info['nchan']
+        self.header, self.source, self.sorted = info['header'], info['source'], info['sorted']
+        cols = {}
+        for k, c in info['columns'].items():
+            shape = tuple(c['shape'])
+            if self.nrec == 0: cols[k] = np.empty(shape, dtype=c['dtype'])
+            else: cols[k] = np.memmap(os.path.join(dirname, k + '.bin'),
+                dtype=c['dtype'], mode='r', shape=shape)
+        self.t, self.uvw, self.ij = cols['t'], cols['uvw'], cols['ij']
+        self.pol, self.data, self.flags = cols['pol'], cols['data'], cols['flags']
+        self.vars = dict([(k, cols['var_' + k]) for k in info['vars']])
+        self.vars['pol'] = self.pol
+        self._bl = None
+    def _baselines(self):
+        # Records of each (i,j,pol), gathered once, in record order
+        if self._bl is None:
+            key = np.column_stack([self.ij, self.pol])
+            keys, inv = np.unique(key, axis=0, return_inverse=True)
+            inv = inv.ravel()
+            order = np.argsort(inv, kind='stable')
+            edges = np.concatenate([[0], np.cumsum(np.bincount(inv, minlength=len(keys)))])
+            self._bl = {}
+            for n, (i, j, p) in enumerate(keys):
+                self._bl[(int(i), int(j), int(p))] = order[edges[n]:edges[n+1]]
+        return self._bl
+    def keys(self):
+        """The (i, j, pol) of every baseline and polarization cached."""
+        return sorted(self._baselines().keys())
+    def rows(self, i, j, pol):
+        """The records of antennas i, j and polarization pol (a number or
+        a string such as 'xx'), for indexing columns.  When they are evenly
+        spaced (as for data with the same baselines in every integration)
+        this is a slice, so that the columns index to views of the mapped
+        files without a copy; otherwise it is an array of record numbers."""
+        if isinstance(pol, str): pol = str2pol[pol]
+        r = self._baselines().get((i, j, pol))
+        if r is None: return slice(0, 0)
+        if len(r) == 1: return slice(int(r[0]), int(r[0]) + 1)
+        step = r[1] - r[0]
+        if np.all(np.diff(r) == step): return slice(int(r[0]), int(r[-1]) + 1, int(step))
+        return r
+    def time_rows(self, t1, t2):
+        """The slice of records with t1 <= t < t2 (the records must be in
+        time order, as Miriad writes them)."""
+        if not self.sorted: raise ValueError('Records of %s are not in time order' % self.source)
+        return slice(int(np.searchsorted(self.t, t1, 'left')),
+            int(np.searchsorted(self.t, t2, 'left')))
+    def block(self, rows=slice(None)):
+        """Return (uvw, t, ij, data, flags, v), as read_block does, for the
+        records rows (from rows or time_rows, say)."""
+        v = dict([(k, self.vars[k][rows]) for k in self.vars])
+        return self.uvw[rows], self.t[rows], self.ij[rows], self.data[rows], self.flags[rows], v
+
+class ImageCube(object):
+    """A MIRIAD image cube (as written by invert or restor), read and
+    written a subcube at a time through xyzio, so that cubes larger than
+    memory stream through a bounded buffer.  Axes are in MIRIAD order, x
+    first: axlen, blc, trc and coords list x, y, z, ..., while arrays are
+    in numpy order, x last, so that a plane of an (nx, ny, nchan) cube has
+    shape (ny, nx).  Pixels are 0-based, blc inclusive and trc exclusive.
+    Subcubes are named as xyzsetup names them: 'xy' for planes, 'z' for
+    spectral profiles, 'xyz' for the whole cube.  xyzio keeps its buffers
+    in globals, so use cubes from one thread at a time.  Header keywords
+    are items: cube['bunit'] = 'JY/BEAM'."""
+    def __init__(self, filename, status='old', axlen=None):
+        self.filename = filename
+        self.tno, self.axlen = _miriad.xyzopen(filename, status, axlen)
+        self.naxis = len(self.axlen)
+        self._setup = None
+    def _use(self, subcube, blc, trc):
+        # xyzsetup for subcube over blc to trc, if not already: returns
+        # the shape of its arrays
+        blc = tuple(blc) if blc is not None else (0,) * self.naxis
+        trc = tuple(trc) if trc is not None else self.axlen
+        if self._setup is None or self._setup[0] != (subcube, blc, trc):
+            viraxlen, vircubesize = _miriad.xyzsetup(self.tno, subcube,
+                [b + 1 for b in blc], trc)
+            n = len(subcube) - subcube.count('-') - subcube.count(' ')
+            self._setup = ((subcube, blc, trc), viraxlen[:n][::-1], len(blc) - n)
+        return self._setup[1:]
+    def read(self, subcube='xy', coords=(), blc=None, trc=None):
+        """Return the subcube at coords (of the axes not in it, as for a
+        plane the channel) within blc to trc as a masked float32 array,
+        masked where flagged."""
+        shape, ncoord = self._use(subcube, blc, trc)
+        if len(coords) != ncoord: raise ValueError('Need %d coords for %s' % (ncoord, subcube))
+        data = np.empty(shape, dtype=np.float32)
+        mask = np.empty(shape, dtype=np.int32)
+        _miriad.xyzread(self.tno, [c + 1 for c in coords], data, mask)
+        return np.ma.array(data, mask=(mask == 0))
+    def write(self, subcube, coords, data, blc=None, trc=None):
+        """Write data (a masked array to flag pixels) as the subcube at
+        coords within blc to trc.  Output is buffered until a later write
+        displaces it, or flush or close."""
+        shape, ncoord = self._use(subcube, blc, trc)
+        if len(coords) != ncoord: raise ValueError('Need %d coords for %s' % (ncoord, subcube))
+        d = np.ascontiguousarray(np.ma.getdata(data), dtype=np.float32)
+        if d.shape != shape: raise ValueError('Expected data of shape %s' % (shape,))
+        m = np.ma.getmask(data)
+        if m is not np.ma.nomask:
+            m = np.ascontiguousarray(~np.broadcast_to(m, shape), dtype=np.int32)
+        else: m = None
+        _miriad.xyzwrite(self.tno, [c + 1 for c in coords], d, m)
+    def read_plane(self, *k):
+        """Return the (ny, nx) plane at index k of the axes above y."""
+        return self.read('xy', k)
+    def write_plane(self, *args):
+        """write_plane(k..., plane): write the (ny, nx) plane at index k of
+        the axes above y."""
+        self.write('xy', args[:-1], args[-1])
+    def read_profile(self, x, y, *k):
+        """Return the profile along z through pixel (x, y) (and index k of
+        any axes above z)."""
+        return self.read('z', (x, y) + k)
+    def __getitem__(self, name): return _miriad.rdhd(self.tno, name)
+    def __setitem__(self, name, val): _miriad.wrhd(self.tno, name, val)
+    def flush(self):
+        """Write buffered output to disk."""
+        _miriad.xyzflush(self.tno)
+    def close(self):
+        """Flush and close the cube."""
+        if self.tno is not None:
+            tno, self.tno = self.tno, None
+            _miriad.xyzclose(tno)
+    def __enter__(self): return self
+    def __exit__(self, *args): self.close()
+    def __del__(self):
+        try: self.close()
+        except Exception: pass
+
+# The header tables of raw SMA (MIR format) data, as packed big-endian
+# records (see sma_data.h)
+_sma_tables = {
+    'in': ('in_read', [('conid','>i4'), ('icocd','>i2'), ('traid','>i4'),
+        ('inhid','>i4'), ('ints','>i4'), ('itq','>i2'), ('az','>f4'),
+        ('el','>f4'), ('ha','>f4'), ('iut','>i2'), ('iref_time','>i2'),
+        ('dhrs','>f8'), ('vc','>f4'), ('ivctype','>i2'), ('sx','>f8'),
+        ('sy','>f8'), ('sz','>f8'), ('rinteg','>f4'), ('proid','>i4'),
+        ('souid','>i4'), ('isource','>i2'), ('ipos','>i2'), ('offx','>f4'),
+        ('offy','>f4'), ('iofftype','>i2'), ('ira','>i2'), ('idec','>i2'),
+        ('rar','>f8'), ('decr','>f8'), ('epoch','>f4'), ('sflux','>f4'),
+        ('size','>f4')]),
+    'bl': ('bl_read', [('blhid','>i4'), ('inhid','>i4'), ('isb','>i2'),
+        ('ipol','>i2'), ('pa','>f4'), ('iaq','>i2'), ('ibq','>i2'),
+        ('icq','>i2'), ('ioq','>i2'), ('irec','>i2'), ('iifc','>i2'),
+        ('u','>f4'), ('v','>f4'), ('w','>f4'), ('prbl','>f4'),
+        ('angres','>f4'), ('vis','>f4'), ('coh','>f4'), ('sigcoh','>f4'),
+        ('csnr','>f4'), ('vflux','>f4'), ('cnoise','>f4'), ('avedhrs','>f8'),
+        ('ampave','>f4'), ('phaave','>f4'), ('tpvar','>f4'), ('blsid','>i4'),
+        ('itel1','>i2'), ('itel2','>i2'), ('iblcd','>i2'), ('ble','>f4'),
+        ('bln','>f4'), ('blu','>f4'), ('soid','>i4')]),
+    'sp': ('sp_read', [('sphid','>i4'), ('blhid','>i4'), ('inhid','>i4'),
+        ('igq','>i2'), ('ipq','>i2'), ('iband','>i2'), ('ipstate','>i2'),
+        ('tau0','>f4'), ('vel','>f8'), ('vres','>f4'), ('ivtype','>i2'),
+        ('fsky','>f8'), ('fres','>f4'), ('tssb','>f4'), ('integ','>f4'),
+        ('wt','>f4'), ('itaper','>i2'), ('snoise','>f4'), ('nch','>i2'),
+        ('nrec','>i2'), ('dataoff','>i4'), ('linid','>i4'), ('itrans','>i2'),
+        ('rfreq','>f8'), ('pasid','>i2'), ('gaiidamp','>i2'),
+        ('gaiidpha','>i2'), ('flcid','>i2'), ('atmid','>i2')]),
+    'codes': ('codes_read', [('v_name','S12'), ('icode','>i2'),
+        ('code','S26'), ('ncode','>i2')]),
+}
+
+# MIRIAD polarizations of MIR ipol codes, as smalod's options=circular and
+# options=linear map them (its default, nopol, makes everything -5)
+_sma_pols = {
+    'circular': {1:-1, 2:-3, 3:-4, 4:-2},
+    'linear': {1:-6, 2:-7, 3:-8, 4:-5},
+}
+
+def read_sma_headers(dirname):
+    """Read the header tables of raw SMA data in dirname: a dict of
+    numpy record arrays 'in' (integrations), 'bl' (baselines), 'sp'
+    (spectra) and 'codes' (code strings), field names as in sma_data.h,
+    and 'sch', a dict of the byte offset in sch_read of the data of each
+    integration (by inhid)."""
+    import os, struct
+    hdr = {}
+    for k, (name, fields) in _sma_tables.items():
+        hdr[k] = np.fromfile(os.path.join(dirname, name), dtype=np.dtype(fields))
+    # sch_read holds each integration's data after a 16 byte header of
+    # (inhid, form, nbyt, nbyt_pack)
+    sch = {}
+    with open(os.path.join(dirname, 'sch_read'), 'rb') as fh:
+        pos = 0
+        while True:
+            h = fh.read(16)
+            if len(h) < 16: break
+            inhid, form, nbyt, nbyt_pack = struct.unpack('>i4sii', h)
+            sch[inhid] = pos + 16
+            pos += 16 + nbyt
+            fh.seek(pos)
+    hdr['sch'] = sch
+    return hdr
+
+def _sma_codes(codes, name):
+    # The code strings called name, by their icode
+    return dict([(int(c['icode']), c['code'][:max(c['ncode'], 0) or None].rstrip(b'\0 ').decode())
+        for c in codes if c['v_name'].rstrip(b'\0 ') == name.encode()])
+
+def sma_to_uv(dirname, filename, sb=1, rx=None, pol='nopol', nblock=4096, nthreads=0):
+    """Convert the raw SMA data in dirname to the new MIRIAD UV file
+    filename, as the MIRIAD task smalod does for one sideband sb (0 =
+    lower, 1 = upper) of one receiver rx (that of the first baseline
+    header by default).  The header tables are read once, then the
+    spectral bands (the continuum, band 0, is left out) of nblock records
+    at a time are decoded from a memory map of sch_read on nthreads
+    native threads (0 = aipy.get_num_threads()) and written with
+    write_block.  Each record holds the bands of one baseline header in
+    band order, with the frequencies of the first integration (sfreq is
+    computed from the band centres fsky) and flagged where a band's weight
+    is negative.  pol maps the MIR polarization codes as smalod's options
+    do: 'nopol' (all -5), 'circular' or 'linear'.  Returns the number of
+    records written."""
+    import os, re, datetime
+    if pol != 'nopol' and pol not in _sma_pols:
+        raise ValueError('Unknown SMA polarization mapping: %s' % pol)
+    hdr = read_sma_headers(dirname)
+    inh, blh, sph, codes, sch = hdr['in'], hdr['bl'], hdr['sp'], hdr['codes'], hdr['sch']
+    # Julian date of the ref_time code, as "Jun 10, 2005"
+    ref = list(_sma_codes(codes, 'ref_time').values())
+    m = ref and re.match(r'\s*([A-Za-z]{3})\w*\s+(\d+)\D+(\d+)', ref[0])
+    if not m: raise ValueError('No ref_time code in %s' % dirname)
+    mon = ['jan','feb','mar','apr','may','jun','jul','aug','sep','oct','nov','dec']
+    date = datetime.date(int(m.group(3)), mon.index(m.group(1).lower()) + 1, int(m.group(2)))
+    jday = date.toordinal() + 1721424.5
+    # smalod conjugates data taken before 2005-04-28
+    isign = 1. if jday < 2453488.5 else -1.
+    # The baseline headers of the records, in time order
+    if rx is None and len(blh) > 0: rx = blh['irec'][0]
+    blh = blh[(blh['isb'] == sb) & (blh['irec'] == rx)]
+    inh = inh[np.argsort(inh['inhid'], kind='stable')]
+    nint = np.searchsorted(inh['inhid'], blh['inhid'])
+    if np.any(nint >= len(inh)) or np.any(inh['inhid'][np.minimum(nint, len(inh)-1)] != blh['inhid']):
+        raise ValueError('Baseline headers of missing integrations in %s' % dirname)
+    s = np.lexsort((blh['blhid'], nint))
+    blh, inh = blh[s], inh[nint[s]]
+    nrec = len(blh)
+    blhid = blh['blhid']
+    order = np.argsort(blhid, kind='stable')
+    # The records of the spectra, and their bands
+    rec = np.searchsorted(blhid[order], sph['blhid'])
+    ok = rec < nrec
+    ok[ok] = blhid[order][rec[ok]] == sph['blhid'][ok]
+    sph, rec = sph[ok], order[rec[ok]]
+    cont = sph['iband'] == 0
+    # uvw are in klambda at the continuum's frequency
+    basefreq = np.zeros(nrec)
+    basefreq[rec[~cont]] = sph['fsky'][~cont]
+    basefreq[rec[cont]] = sph['fsky'][cont]
+    sph, rec = sph[~cont], rec[~cont]
+    bands = np.unique(sph['iband'])
+    band = np.searchsorted(bands, sph['iband'])
+    s = np.lexsort((band, rec))
+    sph, rec, band = sph[s], rec[s], band[s]
+    nband = len(bands)
+    if nrec == 0 or nband == 0:
+        raise ValueError('No spectra for sideband %d of receiver %s in %s' % (sb, rx, dirname))
+    if len(sph) != nrec * nband or np.any(band != np.tile(np.arange(nband), nrec)) \
+            or np.any(rec != np.repeat(np.arange(nrec), nband)):
+        raise ValueError('Records with different bands in %s' % dirname)
+    first = sph[:nband]
+    nch = first['nch'].astype(np.int32)
+    if np.any(sph['nch'] != np.tile(nch, nrec)):
+        raise ValueError('Bands with different channel counts in %s' % dirname)
+    choff = np.concatenate([[0], np.cumsum(nch)])
+    nchan = int(choff[-1])
+    try: pos = np.array([sch[i] for i in sph['inhid']], dtype=np.int64)
+    except(KeyError): raise ValueError('Spectra of integrations missing from sch_read in %s' % dirname)
+    pos += sph['dataoff']
+    bad = (sph['wt'] < 0).reshape((nrec, nband))
+    # Per-record variables
+    t = jday + inh['dhrs'] / 24.
+    uvw = -np.column_stack([blh['u'], blh['v'], blh['w']]) / basefreq[:,None] * 1e3
+    ij = np.column_stack([blh['itel1'], blh['itel2']]) - 1
+    if pol == 'nopol': pols = np.full(nrec, -5)
+    else: pols = np.array([_sma_pols[pol].get(p, 1) for p in blh['ipol']])
+    srcs = _sma_codes(codes, 'source')
+    # The spectral windows of the first record
+    sdf = first['fres'] * 1e-3
+    sfreq = first['fsky'] - sdf * (nch - 1) / 2.
+    uv = UV(filename, status='new')
+    uv['history'] = 'sma_to_uv: converted %s\n' % dirname
+    for k, typ in (('nchan','i'), ('pol','i'), ('nspect','i'), ('nschan','i'),
+            ('ischan','i'), ('sfreq','d'), ('sdf','d'), ('restfreq','d'),
+            ('inttime','r'), ('ra','d'), ('dec','d'), ('source','a'), ('telescop','a')):
+        uv.add_var(k, typ)
+    uv['telescop'] = 'SMA'
+    uv['nchan'] = nchan
+    uv['nspect'] = nband
+    uv['nschan'] = nch.astype(np.int_)
+    uv['ischan'] = (choff[:-1] + 1).astype(np.int_)
+    uv['sfreq'] = sfreq.astype(np.float64)
+    uv['sdf'] = sdf.astype(np.float64)
+    uv['restfreq'] = first['rfreq'].astype(np.float64)
+    buf = np.memmap(os.path.join(dirname, 'sch_read'), dtype=np.uint8, mode='r')
+    for r0 in range(0, nrec, nblock):
+        r1 = min(r0 + nblock, nrec)
+        s0, s1 = r0 * nband, r1 * nband
+        data = np.empty((r1 - r0, nchan), dtype=np.complex64)
+        dst = ((rec[s0:s1] - r0) * nchan + choff[band[s0:s1]]).astype(np.int64)
+        _miriad.sma_decode(data, buf, pos[s0:s1], nch[band[s0:s1]], dst, isign, nthreads)
+        flags = np.repeat(bad[r0:r1], nch, axis=1)
+        # Records of one source at a time, as sources are strings
+        souid = inh['souid'][r0:r1]
+        edges = np.concatenate([[0], np.nonzero(np.diff(souid))[0] + 1, [r1 - r0]])
+        for a, b in zip(edges[:-1], edges[1:]):
+            uv['source'] = srcs.get(int(souid[a]), 'unknown')
+            sl = slice(r0 + a, r0 + b)
+            uv.write_block(uvw[sl], t[sl], ij[sl], data[a:b], flags[a:b],
+                vars={'pol':pols[sl], 'inttime':inh['rinteg'][sl],
+                    'ra':inh['rar'][sl], 'dec':inh['decr'][sl]})
+    del uv
+    return nrec
+
+# Columns of a JPL line catalog index, as jpl_index writes them
+_jpl_columns = ('freq', 'err', 'lgint', 'dr', 'elo', 'gup', 'tag', 'qnfmt', 'qn')
+
+def jpl_index(catdir, dirname):
+    """Build a binary index of the JPL spectral line catalog in catdir
+    (catdir.cat and the c<tag>.cat of each species it lists, as MIRIAD's
+    jplread.c reads them) in the new directory dirname, for JPLCatalog.
+    The entries of every species are parsed once, natively, and written
+    as a .npy per column, sorted by frequency (in GHz).  Returns the
+    JPLCatalog."""
+    import os, json
+    species = {}
+    with open(os.path.join(catdir, 'catdir.cat')) as fh:
+        for line in fh:
+            # Fields as catlen reads them: I6 tag, A14 name, I6 lines,
+            # 7F7 log10 partition functions, I2 version
+            try: tag, nline = int(line[:6]), int(line[20:26])
+            except(ValueError): continue
+            if tag == 0 or nline == 0: continue
+            qln = [float(line[26+7*k:33+7*k].strip() or 0) for k in range(7)]
+            species[tag] = {'name':line[6:20].strip(), 'nline':nline,
+                'qln':qln, 'ver':int(line[75:77].strip() or 0)}
+    dval, ival, qn = [], [], []
+    for tag in sorted(species):
+        fname = os.path.join(catdir, 'c%06d.cat' % tag)
+        if not os.path.exists(fname): continue
+        buf = np.fromfile(fname, dtype=np.uint8)
+        nmax = int(np.count_nonzero(buf == ord('\n'))) + 1
+        d = np.empty((nmax, 4), dtype=np.float64)
+        i = np.empty((nmax, 4), dtype=np.int32)
+        q = np.empty((nmax, 12), dtype=np.int16)
+        try: n = _miriad.jpl_parse(buf, d, i, q)
+        except(ValueError) as e: raise ValueError('%s: %s' % (fname, e))
+        dval.append(d[:n]); ival.append(i[:n]); qn.append(q[:n])
+    dval = np.concatenate(dval) if dval else np.empty((0, 4))
+    ival = np.concatenate(ival) if ival else np.empty((0, 4), dtype=np.int32)
+    qn = np.concatenate(qn) if qn else np.empty((0, 12), dtype=np.int16)
+    order = np.argsort(dval[:,0], kind='stable')
+    dval, ival, qn = dval[order], ival[order], qn[order]
+    cols = {'freq':dval[:,0] * 1e-3, 'err':(dval[:,1] * 1e-3).astype(np.float32),
+        'lgint':dval[:,2].astype(np.float32), 'dr':ival[:,0].astype(np.int8),
+        'elo':dval[:,3], 'gup':ival[:,1].astype(np.int16), 'tag':ival[:,2],
+        'qnfmt':ival[:,3].astype(np.int16), 'qn':qn}
+    os.mkdir(dirname)
+    for k in _jpl_columns:
+        np.save(os.path.join(dirname, k + '.npy'), np.ascontiguousarray(cols[k]))
+    info = {'version':1, 'source':os.path.abspath(catdir), 'nline':len(order),
+        'species':dict([(str(t), species[t]) for t in species])}
+    with open(os.path.join(dirname, _columnar_index), 'w') as fh: json.dump(info, fh)
+    return JPLCatalog(dirname)
+
+class JPLCatalog(object):
+    """A JPL spectral line catalog index written by jpl_index, memory-mapped
+    read-only: opening one reads only its index, and a query binary-
+    searches the sorted frequencies and gathers only the entries in its
+    windows.  self.species maps each species tag to its catalog directory
+    entry: name, nline, qln (log10 partition functions at 300, 225, 150,
+    75, 37.5, 18.75 and 9.375 K) and ver."""
+    def __init__(self, dirname):
+        import os, json
+        self.dirname = dirname
+        with open(os.path.join(dirname, _columnar_index)) as fh: info = json.load(fh)
+        if info.get('version') != 1:
+            raise IOError('Unknown JPL catalog index version in %s' % dirname)
+        self.species = dict([(int(t), v) for t, v in info['species'].items()])
+        self.cols = dict([(k, np.load(os.path.join(dirname, k + '.npy'), mmap_mode='r'))
+            for k in _jpl_columns])
+        self.nline = info['nline']
+    def __len__(self): return self.nline
+    def query(self, fmin, fmax, strl=None, tags=None):
+        """Return the lines with fmin <= freq <= fmax (GHz; arrays of the
+        bounds of many windows are searched at once), of log10 intensity
+        above strl (if given) and of the species in tags (if given), as
+        jpllinerd_c selects them.  The result is a dict of arrays, one
+        entry each, in window order and by frequency within a window:
+        freq and err (GHz), lgint, dr, elo (1/cm), gup, tag (negative
+        for measured frequencies), qnfmt, qn_upper and qn_lower (n,6)
+        quantum numbers, and window, the index of the entry's window."""
+        fmin, fmax = np.broadcast_arrays(np.atleast_1d(np.asarray(fmin, dtype=np.float64)),
+            np.atleast_1d(np.asarray(fmax, dtype=np.float64)))
+        freq = self.cols['freq']
+        i0 = np.searchsorted(freq, fmin, 'left')
+        cnt = np.maximum(np.searchsorted(freq, fmax, 'right') - i0, 0)
+        window = np.repeat(np.arange(len(cnt)), cnt)
+        rows = np.arange(window.size) + np.repeat(i0 - (np.cumsum(cnt) - cnt), cnt)
+        if strl is not None:
+            ok = self.cols['lgint'][rows] > strl
+            rows, window = rows[ok], window[ok]
+        if tags is not None:
+            ok = np.isin(np.abs(self.cols['tag'][rows]), tags)
+            rows, window = rows[ok], window[ok]
+        rv = dict([(k, np.asarray(self.cols[k][rows])) for k in _jpl_columns if k != 'qn'])
+        qn = np.asarray(self.cols['qn'][rows])
+        rv['qn_upper'], rv['qn_lower'] = qn[:,:6], qn[:,6:]
+        rv['window'] = window
+        return rv
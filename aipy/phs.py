@@ -8,6 +8,7 @@ import ephem, math, numpy as np
 from . import coord
 from . import const
 from .miriad import ij2bl, bl2ij
+from . import _dsp
 from scipy.special import j1
 
 class PointingError(Exception):
@@ -30,6 +31,35 @@ def ephem2juldate(num):
     """Convert ephem date (measured from noon, Dec. 31, 1899) to Julian date."""
     return float(num + 2415020.)
 
+# (ra, dec) of the J2000 axes +x, -x, +y, -y, +z, -z
+_FRAME_PROBES = ((0., 0.), (np.pi, 0.), (np.pi/2, 0.), (3*np.pi/2, 0.),
+    (0., np.pi/2), (0., -np.pi/2))
+
+def apparent_frame(observer):
+    """Return (m, v) such that ephem puts a fixed source at the J2000 unit
+    vector s at the apparent equatorial vector m (s + v - (s.v) s), made
+    unit, for observer at its current date and epoch: m (3,3) rotates
+    J2000 to the equator and equinox of date (precession and nutation) and
+    v (3,) is the aberrating velocity, in units of c along the J2000 axes.
+    Both come from ephem's apparent places of the six J2000 axes: the
+    columns of m from the halved differences of opposite axes, v from
+    their halved sums, which is good to second order in |v| (~1e-8)."""
+    fb = ephem.FixedBody()
+    fb._epoch = ephem.J2000
+    u = []
+    for ra, dec in _FRAME_PROBES:
+        fb._ra, fb._dec = ra, dec
+        fb.compute(observer)
+        u.append(coord.radec2eq((fb.ra, fb.dec)))
+    u = np.array(u)
+    # The nearest rotation to the axes' images
+    U, _, Vt = np.linalg.svd((u[0::2] - u[1::2]).T / 2)
+    m = np.dot(U, Vt)
+    # Row k: the part of v across axis k
+    p = np.dot((u[0::2] + u[1::2]) / 2, m)
+    v = np.array([p[1,0] + p[2,0], p[0,1] + p[2,1], p[0,2] + p[1,2]]) / 2
+    return m, v
+
 #  ____           _ _       ____            _
 # |  _ \ __ _  __| (_) ___ | __ )  ___   __| |_   _
 # | |_) / _` |/ _` | |/ _ \|  _ \ / _ \ / _` | | | |
@@ -143,6 +173,51 @@ class SrcCatalog(dict):
     def compute(self, observer):
         """Call compute method of all objects in catalog."""
         for s in self: self[s].compute(observer)
+    def compute_crds(self, observer, jds, srcs=None, nthreads=0):
+        """Return (eqs, tops), the apparent equatorial and topocentric (as
+        observer.eq2top_m gives them) unit vectors, each (ntime,3,nsrc), of
+        the srcs (default all, in the order of get_crds) at the Julian dates
+        jds.  Fixed sources are not computed one by one: their J2000 places
+        go through the apparent_frame of each time in _dsp.src_crds, on
+        nthreads native threads (0 = aipy.get_num_threads()), which matches
+        compute() to a few milliarcseconds.  Moving ones (RadioSpecial) are
+        computed by ephem.  observer (an ephem.Observer, such as an
+        AntennaArray) is only read: the times are set on a copy of it."""
+        if srcs is None: srcs = list(self.keys())
+        srcs = [self[s] for s in srcs]
+        jds = np.atleast_1d(np.asarray(jds, dtype=np.float64))
+        ntime, nsrc = jds.size, len(srcs)
+        fixed = [k for k,s in enumerate(srcs) if isinstance(s, RadioFixedBody)]
+        moving = [k for k,s in enumerate(srcs) if not isinstance(s, RadioFixedBody)]
+        radec = []
+        for k in fixed:
+            s = srcs[k]
+            if float(s._epoch) != float(ephem.J2000):
+                eq = ephem.Equatorial(ephem.Equatorial(s._ra, s._dec,
+                    epoch=s._epoch), epoch=ephem.J2000)
+                radec.append((eq.ra, eq.dec))
+            else: radec.append((s._ra, s._dec))
+        s0 = coord.radec2eq(np.array(radec, dtype=np.float64).reshape(-1,2).T)
+        m = np.empty((ntime,3,3)); v = np.empty((ntime,3)); e2t = np.empty((ntime,3,3))
+        eqs = np.empty((ntime,3,nsrc)); tops = np.empty((ntime,3,nsrc))
+        obs = ephem.Observer()
+        obs.lat, obs.long, obs.elev = observer.lat, observer.long, observer.elev
+        obs.pressure, obs.temp = observer.pressure, observer.temp
+        for i,t in enumerate(jds):
+            obs.date = obs.epoch = juldate2ephem(t)
+            m[i], v[i] = apparent_frame(obs)
+            e2t[i] = coord.eq2top_m(-obs.sidereal_time(), obs.lat)
+            for k in moving:
+                b = srcs[k].Body
+                b.compute(obs)
+                eqs[i,:,k] = coord.radec2eq((b.ra, b.dec))
+        if fixed:
+            eqf = np.empty((ntime,3,len(fixed))); topf = np.empty_like(eqf)
+            _dsp.src_crds(eqf, topf, np.ascontiguousarray(s0), m, v, e2t, nthreads)
+            eqs[:,:,fixed], tops[:,:,fixed] = eqf, topf
+        if moving:
+            tops[:,:,moving] = np.matmul(e2t, eqs[:,:,moving])
+        return eqs, tops
     def get_crds(self, crdsys, ncrd=3, srcs=None):
         """Return coordinates of all objects in catalog."""
         if srcs is None: srcs = self.keys()
@@ -339,20 +414,44 @@ class AntennaArray(ArrayLocation):
     def gen_phs(self, src, i, j, mfreq=.150, ionref=None, srcshape=None,
             resolve_src=False):
         """Return phasing that is multiplied to data to point to src."""
+        return self._gen_phs(src, [(i,j)], mfreq, ionref, srcshape,
+            resolve_src)[0].squeeze()
+    def gen_phs_bls(self, src, bls, mfreq=.150, ionref=None, srcshape=None,
+            resolve_src=False):
+        """As gen_phs for each (i,j) in bls, in one native call: returns
+        an array whose first axis runs over bls and whose others are those
+        gen_phs returns."""
+        phs = self._gen_phs(src, bls, mfreq, ionref, srcshape, resolve_src)
+        return phs.reshape((len(bls),) + phs[0].squeeze().shape)
+    def _gen_phs(self, src, bls, mfreq, ionref, srcshape, resolve_src):
+        # The phasors (nbl, nsrc, nchan), from _dsp.gen_phs
+        uvw, afreqs, off, ion, shape = self._phs_args(src, bls, mfreq, ionref,
+            srcshape, resolve_src)
+        phs = np.empty((len(bls), uvw.shape[1], afreqs.size), dtype=np.complex128)
+        _dsp.gen_phs(phs, uvw, afreqs, off, ion, shape)
+        return phs
+    def _phs_args(self, src, bls, mfreq, ionref, srcshape, resolve_src):
+        # The arguments (uvw, freqs, off, ion, shape) of _dsp.gen_phs
         if ionref is None:
             try: ionref = src.ionref
             except(AttributeError): pass
-        if not ionref is None or resolve_src: u,v,w = self.gen_uvw(i,j,src=src)
-        else: w = self.gen_uvw(i,j,src=src, w_only=True)
-        if not ionref is None: w += self.refract(u, v, mfreq=mfreq, ionref=ionref)
-        o = self.get_phs_offset(i,j)
-        phs = np.exp(-1j*2*np.pi*(w + o))
-        if resolve_src:
-            if srcshape is None:
-                try: srcshape = src.srcshape
-                except(AttributeError): pass
-            if not srcshape is None: phs *= self.resolve_src(u, v, srcshape=srcshape)
-        return phs.squeeze()
+        if resolve_src and srcshape is None:
+            try: srcshape = src.srcshape
+            except(AttributeError): pass
+        if not resolve_src: srcshape = None
+        uvw = np.array([np.reshape(self.get_baseline(i,j,src=src), (3,-1)).T
+            for i,j in bls], dtype=np.float64)
+        nsrc = uvw.shape[1]
+        afreqs = np.array(self.get_afreqs(), dtype=np.float64).ravel()
+        off = np.empty((len(bls), afreqs.size), dtype=np.float64)
+        for k,(i,j) in enumerate(bls): off[k] = self.get_phs_offset(i,j)
+        def rows(*cols):
+            r = np.empty((nsrc, 3), dtype=np.float64)
+            for k,c in enumerate(cols): r[:,k] = np.ravel(c)
+            return r
+        ion = None if ionref is None else rows(ionref[0], ionref[1], mfreq)
+        shape = None if srcshape is None else rows(*srcshape)
+        return uvw, afreqs, off, ion, shape
     def resolve_src(self, u, v, srcshape=(0,0,0)):
         """Adjust amplitudes to reflect resolution effects for a uniform
         elliptical disk characterized by srcshape:
@@ -6,6 +6,7 @@ from __future__ import print_function, division, absolute_import
 
 import numpy as np
 import scipy.optimize as optimize
+from . import _dsp
 
 def gaussian(amp, sig, off, x):
     """Generate gaussian value at x given amplitude, sigma, and x offset."""
@@ -71,3 +72,82 @@ def remove_spikes(data, mask=None, order=6, iter=3, return_poly=False):
             iter=iter-1, return_poly=True)
     if return_poly: return p
     else: return np.polyval(p, xs)
+
+def _plane(data, mask, amp=True):
+    """Return |data| (or data, without amp) as a float32 (nbl,ntime,nchan)
+    plane, a bool mask of that shape viewing the returned mask, which is
+    mask itself if it is a C-contiguous bool array shaped as data, else a
+    copy of it (or of the mask of data)."""
+    shape = np.shape(data)
+    if mask is None: mask = np.ma.getmaskarray(data)
+    d = np.ma.getdata(data)
+    if amp: d = np.abs(d)
+    d = d.astype(np.float32).reshape((-1,) + shape[-2:])
+    if not (isinstance(mask, np.ndarray) and mask.dtype == np.bool_ \
+            and mask.flags.c_contiguous and mask.shape == shape):
+        mask = np.array(np.broadcast_to(mask, shape), dtype=np.bool_)
+    return np.ascontiguousarray(d), mask.reshape(d.shape), mask
+
+def medfilt_resid(data, mask=None, wt=2, wf=8, nthreads=0):
+    """Return the residual of |data| (ntime,nchan), or (nbl,ntime,nchan)
+    for several baselines, from the median of its unflagged samples
+    within wt integrations and wf channels, in units of the noise (1.4826
+    times the median absolute residual of each baseline).  Flagged
+    samples get 0.  mask (True = flagged) defaults to the mask of data."""
+    d, m, _ = _plane(data, mask)
+    z = np.empty_like(d)
+    _dsp.rfi_medfilt(z, d, m, wt, wf, nthreads)
+    return z.reshape(np.shape(data))
+
+def sigma_clip(data, mask=None, nsig=4, niter=5, axis=0, nthreads=0):
+    """Iteratively flag samples of |data| (shaped as for medfilt_resid)
+    more than nsig standard deviations from the mean of those unflagged
+    along time (axis=0, for each channel) or frequency (axis=1, for each
+    integration), for up to niter rounds.  New flags are or'ed into mask
+    in place when it is a C-contiguous bool array shaped as data; the mask
+    is returned either way."""
+    d, m, mask = _plane(data, mask)
+    _dsp.rfi_sigclip(m, d, axis, nsig, niter, nthreads)
+    return mask
+
+def sum_threshold(z, mask=None, chi1=6, mmax=32, rho=1.5, nthreads=0):
+    """SumThreshold flagging (Offringa et al. 2010) of the residual z (in
+    units of its noise, as medfilt_resid returns; shaped as for it) along
+    time and frequency: windows of w = 1, 2, 4, ... mmax samples whose sum
+    is above, or below minus, w*chi1/rho**log2(w) are flagged, with earlier
+    flags counting as the threshold.  mask as for sigma_clip."""
+    d, m, mask = _plane(z, mask, amp=False)
+    _dsp.rfi_sumthreshold(m, d, chi1, mmax, rho, nthreads)
+    return mask
+
+def xrfi(data, mask=None, wt=2, wf=8, chi1=6, mmax=32, rho=1.5, nsig=None,
+        nthreads=0):
+    """Flag RFI in data (ntime,nchan), or (nbl,ntime,nchan), natively:
+    SumThreshold (see sum_threshold) of the residual of |data| from its
+    rolling median (see medfilt_resid), followed, if nsig is given, by
+    sigma clipping of that residual along time.  mask as for sigma_clip."""
+    d, m, mask = _plane(data, mask)
+    z = np.empty_like(d)
+    _dsp.rfi_medfilt(z, d, m, wt, wf, nthreads)
+    _dsp.rfi_sumthreshold(m, z, chi1, mmax, rho, nthreads)
+    if nsig is not None: _dsp.rfi_sigclip(m, z, 0, nsig, 5, nthreads)
+    return mask
+
+def flag_block(ij, data, flags, pol=None, **kwargs):
+    """Flag RFI (see xrfi) in a block of records as UV.read_block returns
+    them, or as UV.pipe_block hands them to mfunc: records of the same
+    antenna pair ij (and pol, if given), in the order read, make up the
+    time axis of each baseline.  The bool flags (nrec,nchan) are updated
+    in place and returned.  kwargs are passed to xrfi."""
+    ij = np.asarray(ij).reshape((-1,2))
+    key = ij if pol is None else np.column_stack([ij, pol])
+    if len(key) == 0: return flags
+    _, inv = np.unique(key, axis=0, return_inverse=True)
+    inv = inv.ravel()
+    cnt = np.bincount(inv)
+    rows = np.split(np.argsort(inv, kind='stable'), np.cumsum(cnt)[:-1])
+    # Baselines with as many records are flagged together
+    for c in np.unique(cnt):
+        idx = np.array([rows[k] for k in np.nonzero(cnt == c)[0]])
+        flags[idx] = xrfi(data[idx], flags[idx], **kwargs)
+    return flags
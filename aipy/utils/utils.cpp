@@ -14,6 +14,9 @@
 #include <Python.h>
 #include "numpy/arrayobject.h"
 #include "aipy_compat.h"
+#define AIPY_POOL_MAIN
+#include "aipy_pool.h"
+#include <vector>
 
 #define QUOTE(s) # s
 
@@ -50,17 +53,25 @@
     *((type *)ptr0) += *((type *)ptr1); \
     *((type *)(ptr0 + sizeof(type))) += *((type *)(ptr1 + sizeof(type)));
 
-// A template for implementing addition loops for different data types
+// Index element I of sample i (axis j) in ind, as a long
+#define INDEX1(ind,i,I) ((long) IND1(ind,i,I))
+#define INDEX2(ind,i,j,I) ((long) IND2(ind,i,j,I))
+
+// Below this many samples per thread, add2array_flat stays on one thread
+#define ADD_MIN_PER_THREAD 65536
+
+// A template for implementing addition loops for different data types.
+// Index arrays are long or int (I).
 template<typename T> struct AddStuff {
     // Adds data to a at indices specified in ind.  Assumes arrays are safe.
-    static int addloop(PyArrayObject *a, PyArrayObject *ind,
+    template<typename I> static int addloop(PyArrayObject *a, PyArrayObject *ind,
             PyArrayObject *data) {
         char *index = NULL;
-        int v;
-        for (int i=0; i < DIM(ind,0); i++) {
+        long v;
+        for (long i=0; i < DIM(ind,0); i++) {
             index = (char *) PyArray_DATA(a);
             for (int j=0; j < RANK(a); j++) {
-                v = IND2(ind,i,j,long);
+                v = INDEX2(ind,i,j,I);
                 if (v < 0) v += DIM(a,j);
                 if (v < 0 || v >= DIM(a,j)) return -1;
                 index += v * PyArray_STRIDES(a)[j];
@@ -70,14 +81,14 @@ template<typename T> struct AddStuff {
         return 0;
     }
     // CAdds data to a at indices specified in ind.  Assumes arrays are safe.
-    static int caddloop(PyArrayObject *a, PyArrayObject *ind,
+    template<typename I> static int caddloop(PyArrayObject *a, PyArrayObject *ind,
             PyArrayObject *data) {
         char *index = NULL;
-        int v;
-        for (int i=0; i < DIM(ind,0); i++) {
+        long v;
+        for (long i=0; i < DIM(ind,0); i++) {
             index = (char *) PyArray_DATA(a);
             for (int j=0; j < RANK(a); j++) {
-                v = IND2(ind,i,j,long);
+                v = INDEX2(ind,i,j,I);
                 if (v < 0) v += DIM(a,j);
                 if (v < 0 || v >= DIM(a,j)) return -1;
                 index += v * PyArray_STRIDES(a)[j];
@@ -86,8 +97,174 @@ template<typename T> struct AddStuff {
         }
         return 0;
     }
+    // Adds samples i0..i1-1 of data (ncomp components each) to p at the
+    // flat indices ind (already checked), skipping those outside lo..hi-1
+    template<typename I> static void flatrange(T *p, long size,
+            PyArrayObject *ind, PyArrayObject *data, int ncomp,
+            long i0, long i1, long lo, long hi) {
+        for (long i=i0; i < i1; i++) {
+            long v = INDEX1(ind,i,I);
+            if (v < 0) v += size;
+            if (v < lo || v >= hi) continue;
+            const T *d = (const T *) PNT1(data,i);
+            for (int c=0; c < ncomp; c++) p[ncomp*v+c] += d[c];
+        }
+    }
+    // Adds data to the contiguous a at the flat indices ind, each checked
+    // (and wrapped, if negative) in one sweep before anything is added.
+    // Complex types add ncomp = 2 components.  On nthreads threads (0 =
+    // aipy.get_num_threads()), a target smaller than the sample count is accumulated in
+    // a private copy per thread (a share of the samples each), summed in
+    // thread order; a larger one is cut into one range of elements per
+    // thread, each of which adds the samples in its range in order, exactly
+    // as one thread would.  Either way the result does not depend on
+    // scheduling.  Assumes arrays are safe.
+    template<typename I> static int flatloop(PyArrayObject *a, PyArrayObject *ind,
+            PyArrayObject *data, int ncomp, int nthreads) {
+        long n = DIM(ind,0), size = PyArray_SIZE(a), len = ncomp * size;
+        long lo = 0, hi = -1;
+        for (long i=0; i < n; i++) {
+            long v = INDEX1(ind,i,I);
+            lo = v < lo ? v : lo;
+            hi = v > hi ? v : hi;
+        }
+        if (lo < -size || hi >= size) return -1;
+        T *p = (T *) PyArray_DATA(a);
+        if (nthreads <= 0) nthreads = aipy_pool_nthreads(n, 0);
+        if (nthreads > n / ADD_MIN_PER_THREAD) nthreads = (int) (n / ADD_MIN_PER_THREAD);
+        if (nthreads <= 1) {
+            flatrange<I>(p, size, ind, data, ncomp, 0, n, 0, size);
+            return 0;
+        }
+        // Bytes, not std::vector<T>, which is packed for bool
+        std::vector<std::vector<char> > priv(size < n ? nthreads : 0);
+        if (size < n) {
+            aipy_parallel(nthreads, nthreads, [&](long t, int) {
+                priv[t].assign(len * sizeof(T), 0);
+                flatrange<I>((T *) &priv[t][0], size, ind, data, ncomp,
+                    t * n / nthreads, (t+1) * n / nthreads, 0, size);
+            });
+            aipy_parallel(nthreads, nthreads, [&](long t, int) {
+                for (long q=t*len/nthreads; q < (t+1)*len/nthreads; q++)
+                    for (int k=0; k < nthreads; k++) p[q] += ((T *) &priv[k][0])[q];
+            });
+        } else {
+            aipy_parallel(nthreads, nthreads, [&](long t, int) {
+                flatrange<I>(p, size, ind, data, ncomp, 0, n,
+                    t * size / nthreads, (t+1) * size / nthreads);
+            });
+        }
+        return 0;
+    }
+};
+
+// Runs the AddStuff loop for the type of a and ind: addloop (caddloop for
+// complex types), or flatloop if flat.  Returns -2 for unsupported types.
+template<typename I> static int addloop_typed(PyArrayObject *a,
+        PyArrayObject *ind, PyArrayObject *data, bool flat, int nthreads) {
+#define ADDLOOP(T,c) (flat ? AddStuff<T>::template flatloop<I>(a,ind,data,c,nthreads) : \
+        (c == 1 ? AddStuff<T>::template addloop<I>(a,ind,data) : \
+        AddStuff<T>::template caddloop<I>(a,ind,data)))
+    switch (TYPE(a)) {
+        case NPY_BOOL: return ADDLOOP(bool,1);
+        case NPY_BYTE: return ADDLOOP(char,1);
+        case NPY_UBYTE: return ADDLOOP(unsigned char,1);
+        case NPY_SHORT: return ADDLOOP(short,1);
+        case NPY_USHORT: return ADDLOOP(unsigned short,1);
+        case NPY_INT: return ADDLOOP(int,1);
+        case NPY_UINT: return ADDLOOP(unsigned int,1);
+        case NPY_LONG: return ADDLOOP(long,1);
+        case NPY_ULONG: return ADDLOOP(unsigned long,1);
+        case NPY_LONGLONG: return ADDLOOP(long long,1);
+        case NPY_ULONGLONG: return ADDLOOP(unsigned long long,1);
+        case NPY_FLOAT: return ADDLOOP(float,1);
+        case NPY_DOUBLE: return ADDLOOP(double,1);
+        case NPY_LONGDOUBLE: return ADDLOOP(long double,1);
+        case NPY_CFLOAT: return ADDLOOP(float,2);
+        case NPY_CDOUBLE: return ADDLOOP(double,2);
+        case NPY_CLONGDOUBLE: return ADDLOOP(long double,2);
+        default: return -2;
+    }
+#undef ADDLOOP
+}
+
+static int addloop_typed(PyArrayObject *a, PyArrayObject *ind,
+        PyArrayObject *data, bool flat, int nthreads) {
+    if (TYPE(ind) == NPY_INT) return addloop_typed<int>(a,ind,data,flat,nthreads);
+    return addloop_typed<long>(a,ind,data,flat,nthreads);
+}
+
+// Weighted accumulation into several maps of one type T at once: w to
+// the first, and w times the value of each remaining map to it.
+template<typename T> struct MapStuff {
+    // Adds samples i0..i1-1 to the nmaps maps p of size elements at the
+    // flat indices ind (already checked), skipping those outside lo..hi-1
+    template<typename I> static void maprange(T **p, int nmaps, long size,
+            PyArrayObject *ind, PyArrayObject *wgts, PyArrayObject **vals,
+            long i0, long i1, long lo, long hi) {
+        for (long i=i0; i < i1; i++) {
+            long v = INDEX1(ind,i,I);
+            if (v < 0) v += size;
+            if (v < lo || v >= hi) continue;
+            double w = IND1(wgts,i,double);
+            p[0][v] += (T) w;
+            for (int k=1; k < nmaps; k++)
+                p[k][v] += (T) (w * IND1(vals[k-1],i,double));
+        }
+    }
+    // As flatloop, for the nmaps contiguous maps a: the indices are
+    // checked once, and the samples are shared out (or the maps cut into
+    // ranges of pixels) between the threads the same way for all the maps.
+    template<typename I> static int maploop(PyArrayObject **a, int nmaps,
+            PyArrayObject *ind, PyArrayObject *wgts, PyArrayObject **vals,
+            int nthreads) {
+        long n = DIM(ind,0), size = PyArray_SIZE(a[0]);
+        long lo = 0, hi = -1;
+        for (long i=0; i < n; i++) {
+            long v = INDEX1(ind,i,I);
+            lo = v < lo ? v : lo;
+            hi = v > hi ? v : hi;
+        }
+        if (lo < -size || hi >= size) return -1;
+        std::vector<T *> p(nmaps);
+        for (int k=0; k < nmaps; k++) p[k] = (T *) PyArray_DATA(a[k]);
+        if (nthreads <= 0) nthreads = aipy_pool_nthreads(n, 0);
+        if (nthreads > n / ADD_MIN_PER_THREAD) nthreads = (int) (n / ADD_MIN_PER_THREAD);
+        if (nthreads <= 1) {
+            maprange<I>(&p[0], nmaps, size, ind, wgts, vals, 0, n, 0, size);
+            return 0;
+        }
+        if (size < n) {
+            std::vector<std::vector<T> > priv(nthreads);
+            aipy_parallel(nthreads, nthreads, [&](long t, int) {
+                priv[t].assign(nmaps * size, 0);
+                std::vector<T *> q(nmaps);
+                for (int k=0; k < nmaps; k++) q[k] = &priv[t][k * size];
+                maprange<I>(&q[0], nmaps, size, ind, wgts, vals,
+                    t * n / nthreads, (t+1) * n / nthreads, 0, size);
+            });
+            aipy_parallel(nthreads, nthreads, [&](long t, int) {
+                for (int k=0; k < nmaps; k++)
+                    for (long q=t*size/nthreads; q < (t+1)*size/nthreads; q++)
+                        for (int m=0; m < nthreads; m++) p[k][q] += priv[m][k*size+q];
+            });
+        } else {
+            aipy_parallel(nthreads, nthreads, [&](long t, int) {
+                maprange<I>(&p[0], nmaps, size, ind, wgts, vals, 0, n,
+                    t * size / nthreads, (t+1) * size / nthreads);
+            });
+        }
+        return 0;
+    }
 };
 
+// Index arrays may be long or int
+#define CHK_INDEX_TYPE(a) \
+    if (TYPE(a) != NPY_LONG && TYPE(a) != NPY_INT) { \
+        PyErr_Format(PyExc_ValueError, "type(%s) != NPY_LONG or NPY_INT", \
+        QUOTE(a)); \
+        return NULL; }
+
 // Adds data to a at indicies specified in ind.  Checks safety of arrays input.
 PyObject *add2array(PyObject *self, PyObject *args) {
     PyArrayObject *a, *ind, *data;
@@ -98,7 +275,7 @@ PyObject *add2array(PyObject *self, PyObject *args) {
     CHK_ARRAY_RANK(data, 1);
     CHK_ARRAY_DIM(ind, 0, DIM(data,0));
     CHK_ARRAY_DIM(ind, 1, RANK(a));
-    CHK_ARRAY_TYPE(ind, NPY_LONG);
+    CHK_INDEX_TYPE(ind);
     if (TYPE(a) != TYPE(data)) {
         printf("%d %d\n", TYPE(a), TYPE(data));
         PyErr_Format(PyExc_ValueError, "type(%s) != type(%s)",
@@ -109,48 +286,55 @@ PyObject *add2array(PyObject *self, PyObject *args) {
     Py_INCREF(ind);
     Py_INCREF(data);
     // Use template to implement data loops for all data types
-    if (TYPE(a) == NPY_BOOL) {
-        rv = AddStuff<bool>::addloop(a,ind,data);
-    } else if (TYPE(a) == NPY_BYTE) {
-        rv = AddStuff<char>::addloop(a,ind,data);
-    } else if (TYPE(a) == NPY_UBYTE) {
-        rv = AddStuff<unsigned char>::addloop(a,ind,data);
-    } else if (TYPE(a) == NPY_SHORT) {
-        rv = AddStuff<short>::addloop(a,ind,data);
-    } else if (TYPE(a) == NPY_USHORT) {
-        rv = AddStuff<unsigned short>::addloop(a,ind,data);
-    } else if (TYPE(a) == NPY_INT) {
-        rv = AddStuff<int>::addloop(a,ind,data);
-    } else if (TYPE(a) == NPY_UINT) {
-        rv = AddStuff<unsigned int>::addloop(a,ind,data);
-    } else if (TYPE(a) == NPY_LONG) {
-        rv = AddStuff<long>::addloop(a,ind,data);
-    } else if (TYPE(a) == NPY_ULONG) {
-        rv = AddStuff<unsigned long>::addloop(a,ind,data);
-    } else if (TYPE(a) == NPY_LONGLONG) {
-        rv = AddStuff<long long>::addloop(a,ind,data);
-    } else if (TYPE(a) == NPY_ULONGLONG) {
-        rv = AddStuff<unsigned long long>::addloop(a,ind,data);
-    } else if (TYPE(a) == NPY_FLOAT) {
-        rv = AddStuff<float>::addloop(a,ind,data);
-    } else if (TYPE(a) == NPY_DOUBLE) {
-        rv = AddStuff<double>::addloop(a,ind,data);
-    } else if (TYPE(a) == NPY_LONGDOUBLE) {
-        rv = AddStuff<long double>::addloop(a,ind,data);
-    } else if (TYPE(a) == NPY_CFLOAT) {
-        rv = AddStuff<float>::caddloop(a,ind,data);
-    } else if (TYPE(a) == NPY_CDOUBLE) {
-        rv = AddStuff<double>::caddloop(a,ind,data);
-    } else if (TYPE(a) == NPY_CLONGDOUBLE) {
-        rv = AddStuff<long double>::caddloop(a,ind,data);
-    } else {
+    rv = addloop_typed(a,ind,data,false,1);
+    Py_DECREF(a);
+    Py_DECREF(ind);
+    Py_DECREF(data);
+    if (rv == -2) {
         PyErr_Format(PyExc_ValueError, "Unsupported data type.");
         return NULL;
+    } else if (rv == 0) {
+        Py_INCREF(Py_None);
+        return Py_None;
+    } else {
+        PyErr_Format(PyExc_ValueError, "Invalid indices found.");
+        return NULL;
+    }
+}
+
+// Adds data to a at the flat indices ind.  Checks safety of arrays input.
+PyObject *add2array_flat(PyObject *self, PyObject *args) {
+    PyArrayObject *a, *ind, *data;
+    int rv, nthreads=1;
+    // Parse arguments and perform sanity check
+    if (!PyArg_ParseTuple(args, "O!O!O!|i", &PyArray_Type, &a,
+            &PyArray_Type, &ind, &PyArray_Type, &data, &nthreads)) return NULL;
+    CHK_ARRAY_RANK(ind, 1);
+    CHK_ARRAY_RANK(data, 1);
+    CHK_ARRAY_DIM(ind, 0, DIM(data,0));
+    CHK_INDEX_TYPE(ind);
+    if (TYPE(a) != TYPE(data)) {
+        PyErr_Format(PyExc_ValueError, "type(%s) != type(%s)",
+        QUOTE(a), QUOTE(data));
+        return NULL;
+    }
+    if (!PyArray_ISCARRAY(a)) {
+        PyErr_Format(PyExc_ValueError, "a must be C-contiguous and writeable");
+        return NULL;
     }
+    Py_INCREF(a);
+    Py_INCREF(ind);
+    Py_INCREF(data);
+    Py_BEGIN_ALLOW_THREADS
+    rv = addloop_typed(a,ind,data,true,nthreads);
+    Py_END_ALLOW_THREADS
     Py_DECREF(a);
     Py_DECREF(ind);
     Py_DECREF(data);
-    if (rv == 0) {
+    if (rv == -2) {
+        PyErr_Format(PyExc_ValueError, "Unsupported data type.");
+        return NULL;
+    } else if (rv == 0) {
         Py_INCREF(Py_None);
         return Py_None;
     } else {
@@ -159,10 +343,75 @@ PyObject *add2array(PyObject *self, PyObject *args) {
     }
 }
 
+// Adds weights, and weighted values, to several maps at flat indices in
+// one pass.  Checks safety of arrays input.
+PyObject *add2maps(PyObject *self, PyObject *args) {
+    PyObject *maps_obj, *vals_obj, *maps = NULL, *vals = NULL;
+    PyArrayObject *ind, *wgts;
+    int rv = 0, nthreads=1;
+    if (!PyArg_ParseTuple(args, "OO!O!O|i", &maps_obj, &PyArray_Type, &ind,
+            &PyArray_Type, &wgts, &vals_obj, &nthreads)) return NULL;
+    CHK_ARRAY_RANK(ind, 1);
+    CHK_ARRAY_RANK(wgts, 1);
+    CHK_ARRAY_DIM(wgts, 0, DIM(ind,0));
+    CHK_ARRAY_TYPE(wgts, NPY_DOUBLE);
+    CHK_INDEX_TYPE(ind);
+    maps = PySequence_Fast(maps_obj, "maps must be a sequence of arrays");
+    if (maps == NULL) return NULL;
+    vals = PySequence_Fast(vals_obj, "vals must be a sequence of arrays");
+    if (vals == NULL) { Py_DECREF(maps); return NULL; }
+    int nmaps = (int) PySequence_Fast_GET_SIZE(maps);
+    std::vector<PyArrayObject *> a(nmaps), v(nmaps > 0 ? nmaps - 1 : 0);
+    if (nmaps < 1 || PySequence_Fast_GET_SIZE(vals) != nmaps - 1) {
+        PyErr_Format(PyExc_ValueError, "need one map more than vals");
+        rv = -3;
+    }
+    for (int k=0; rv == 0 && k < nmaps; k++) {
+        PyObject *o = PySequence_Fast_GET_ITEM(maps, k);
+        a[k] = (PyArrayObject *) o;
+        if (!PyArray_Check(o) || !PyArray_ISCARRAY(a[k]) ||
+                (TYPE(a[k]) != NPY_FLOAT && TYPE(a[k]) != NPY_DOUBLE) ||
+                TYPE(a[k]) != TYPE(a[0]) ||
+                PyArray_SIZE(a[k]) != PyArray_SIZE(a[0])) {
+            PyErr_Format(PyExc_ValueError, "maps must be C-contiguous, writeable float32 or float64 arrays of one type and size");
+            rv = -3;
+        }
+    }
+    for (int k=0; rv == 0 && k < nmaps - 1; k++) {
+        PyObject *o = PySequence_Fast_GET_ITEM(vals, k);
+        v[k] = (PyArrayObject *) o;
+        if (!PyArray_Check(o) || RANK(v[k]) != 1 || TYPE(v[k]) != NPY_DOUBLE ||
+                DIM(v[k],0) != DIM(ind,0)) {
+            PyErr_Format(PyExc_ValueError, "vals must be float64 arrays of the length of ind");
+            rv = -3;
+        }
+    }
+    if (rv == 0) {
+        PyArrayObject **pv = v.empty() ? NULL : &v[0];
+        bool dbl = TYPE(a[0]) == NPY_DOUBLE, is_int = TYPE(ind) == NPY_INT;
+        Py_BEGIN_ALLOW_THREADS
+        if (dbl && is_int) rv = MapStuff<double>::maploop<int>(&a[0], nmaps, ind, wgts, pv, nthreads);
+        else if (dbl) rv = MapStuff<double>::maploop<long>(&a[0], nmaps, ind, wgts, pv, nthreads);
+        else if (is_int) rv = MapStuff<float>::maploop<int>(&a[0], nmaps, ind, wgts, pv, nthreads);
+        else rv = MapStuff<float>::maploop<long>(&a[0], nmaps, ind, wgts, pv, nthreads);
+        Py_END_ALLOW_THREADS
+        if (rv == -1) PyErr_Format(PyExc_ValueError, "Invalid indices found.");
+    }
+    Py_DECREF(maps);
+    Py_DECREF(vals);
+    if (rv != 0) return NULL;
+    Py_INCREF(Py_None);
+    return Py_None;
+}
+
 // Wrap function into module
 static PyMethodDef UtilsMethods[] = {
     {"add2array", (PyCFunction)add2array, METH_VARARGS,
-        "add2array(a,ind,data)\nAdd 'data' to 'a' at the indices specified in 'ind'.  'data' must be 1 dimensional, 'ind' must have 1st axis same as 'data' and 2nd axis equal to number of dimensions in 'a'.  Data types of 'a' and 'data' must match."},
+        "add2array(a,ind,data)\nAdd 'data' to 'a' at the indices specified in 'ind' (int or long).  'data' must be 1 dimensional, 'ind' must have 1st axis same as 'data' and 2nd axis equal to number of dimensions in 'a'.  Data types of 'a' and 'data' must match."},
+    {"add2array_flat", (PyCFunction)add2array_flat, METH_VARARGS,
+        "add2array_flat(a,ind,data,nthreads=1)\nAs add2array, for the flat (C order, as numpy.ravel_multi_index gives) indices 'ind' (1 dimensional, int or long) into the C-contiguous 'a'.  Negative indices count back from the end of 'a'.  All indices are checked before 'a' is changed, and the per-axis address arithmetic of add2array is skipped.  With the GIL released, the adds run on 'nthreads' native threads (0 = aipy.get_num_threads()): each accumulates a share of the samples privately if 'a' has fewer elements than there are samples, and otherwise owns a range of 'a'.  Floating-point sums then depend on the thread count, but not on scheduling."},
+    {"add2maps", (PyCFunction)add2maps, METH_VARARGS,
+        "add2maps(maps,ind,wgts,vals,nthreads=1)\nAdd 'wgts' to maps[0], and 'wgts' times vals[k] to maps[k+1], at the flat indices 'ind' (1 dimensional, int or long), repeated indices summing.  'maps' are C-contiguous float32 or float64 arrays of one type and size, 'wgts' and the len(maps)-1 'vals' float64 arrays of the length of 'ind'.  The indices are checked once, before any map is changed, and all the maps are filled in the same pass, shared out among 'nthreads' native threads as by add2array_flat."},
     {NULL, NULL}
 };
 
@@ -177,6 +426,8 @@ MOD_INIT(utils) {
         return MOD_ERROR_VAL;
 
     import_array();
+    if (aipy_pool_import() < 0)
+        return MOD_ERROR_VAL;
 
     return MOD_SUCCESS_VAL(m);
 };
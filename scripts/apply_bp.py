@@ -161,11 +161,15 @@ for filename in args:
         print('No bandpass found')
         bp = np.ones((nants, nchan))
         print('.')
-    def f(uv, preamble, data, flags):
-        uvw, t, (i,j) = preamble
-        if i == j: data = np.polyval(cpoly, data)
-        data *= bp[i,:] * bp[j,:] * opts.scale
-        return preamble, data, flags
-    uvo.pipe(uvi, mfunc=f, raw=True,
+    # bp[i] * bp[j] as g_i * conj(g_j), applied natively to a block; scale
+    # goes on the data itself, since it may be negative
+    gains = bp.reshape((nants, 1, nchan))
+    def f(uv, uvw, t, ij, data, flags, v):
+        auto = ij[:,0] == ij[:,1]
+        if np.any(auto): data[auto] = np.polyval(cpoly, data[auto])
+        a.miriad.apply_gains(data, ij, t, gains)
+        data *= opts.scale
+        return uvw, t, ij, data, flags
+    uvo.pipe_block(uvi, mfunc=f,
         append2hist='APPLY_BP: ver=%s, corr type=%s, scale=%f\n' % \
             (__version__, opts.linearization, opts.scale))
@@ -6,26 +6,48 @@ Apply calibration parameters to a data set.
 
 from __future__ import print_function, division, absolute_import
 
-import aipy as a
+import aipy as a, numpy as np
 import optparse, sys, os
 
 o = optparse.OptionParser()
 a.scripting.add_standard_options(o, cal=True)
 o.add_option('--no_gain', action='store_true', help='Do not change the gain (i.e. no flux cal).')
 o.add_option('--no_phs', action='store_true', help='Do not change the phase (i.e. no phase cal).')
+o.add_option('--nblock', type='int', default=1024, help='Records to calibrate at a time.  Default 1024.')
 opts,args = o.parse_args(sys.argv[1:])
 
 uv = a.miriad.UV(args[0])
 aa = a.cal.get_aa(opts.cal, uv['sdf'], uv['sfreq'], uv['nchan'])
 del(uv)
 
-def mfunc(uv, p, d, f):
-    uvw,t,(i,j) = p
-    pol = a.miriad.pol2str[uv['pol']]
-    aa.set_active_pol(pol)
-    if not opts.no_gain: d /= aa.passband(i, j)
-    if not opts.no_phs: d = aa.phs2src(d, 'z', i, j)
-    return p, d, f
+# The passbands are divided out natively as each block is read: aa.passband(i,j)
+# is conj(g_i) * g_j for the gains g of the feeds of a polarization.  Antennas
+# without polarized gains use theirs for every polarization; polarized ones
+# only have feeds for the linear polarizations, and any other is an error.
+feeds = {'xx':(0,0), 'yy':(1,1), 'xy':(0,1), 'yx':(1,0)}
+gains, polarized = [], False
+for ant in aa:
+    try:
+        gains.append([ant.passband(conj=True, pol=p) for p in 'xy'])
+        polarized = True
+    except(TypeError): gains.append([ant.passband(conj=True)] * 2)
+gains = np.array(gains)
+if polarized: pols = dict([(a.miriad.str2pol[p], feeds[p]) for p in feeds])
+else: pols = dict([(p, (0,0)) for p in a.miriad.pol2str])
+cal = None
+if not opts.no_gain: cal = (gains, [0.], pols)
+
+def mfunc(uv, uvw, t, ij, d, f, v):
+    if cal is not None:
+        for p in np.unique(v['pol']):
+            if int(p) not in pols:
+                raise ValueError('No polarized gains for pol %s' % \
+                    a.miriad.pol2str.get(int(p), int(p)))
+    if not opts.no_phs:
+        for k, (i, j) in enumerate(ij):
+            aa.set_active_pol(a.miriad.pol2str[int(v['pol'][k])])
+            d[k] = aa.phs2src(d[k], 'z', i, j)
+    return uvw, t, ij, d, f
 
 for infile in args:
     outfile = infile+'C'
@@ -37,4 +59,7 @@ for infile in args:
     uvi = a.miriad.UV(infile)
     uvo = a.miriad.UV(outfile, status='new')
     uvo.init_from_uv(uvi)
-    uvo.pipe(uvi, mfunc, raw=True, append2hist='APPLY_CAL: ' + ' '.join(sys.argv) + '\n')
+    uvi.track(['pol'])
+    per_block = not opts.no_phs or (cal is not None and polarized)
+    uvo.pipe_block(uvi, mfunc=mfunc if per_block else None, nblock=opts.nblock,
+        cal=cal, divide=True, append2hist='APPLY_CAL: ' + ' '.join(sys.argv) + '\n')
@@ -1,7 +1,8 @@
 #!/usr/bin/env python
 
 """
-Tarball and compress (using bz2) Miriad UV files.
+Tarball and compress (using bz2) Miriad UV files, or with -m compress their
+visdata and flags in place, so they can still be read directly.
 Author: Aaron Parsons
 Date: 8/14/07
 """
@@ -17,12 +18,35 @@ p.set_description(__doc__)
 p.add_option('-d', '--delete', dest='delete', action='store_true',
     help='Delete a uv file after compressing it')
 p.add_option('-x', '--expand', dest='expand', action='store_true',
-    help='Inflate tar.bz2 files')
+    help='Inflate tar.bz2 files (or with -m, uv files ending in z)')
+p.add_option('-m', '--miriad', dest='miriad', action='store_true',
+    help='Write each uv file to one ending in z, with its visdata and flags compressed losslessly, instead of a tarball.  These are read like any other uv file, without being expanded first.')
 
 opts, args = p.parse_args(sys.argv[1:])
 
+if opts.miriad:
+    from aipy import miriad, _miriad
+
 for i in args:
     print(i)
+    if opts.miriad:
+        if opts.expand:
+            if not i.endswith('z'):
+                print(i, 'does not end in z; skipping...')
+                continue
+            out_name = i[:-1]
+        else: out_name = i + 'z'
+        if os.path.exists(out_name):
+            print(out_name, 'exists; skipping...')
+            continue
+        _miriad.set_compress(not opts.expand)
+        uvi = miriad.UV(i)
+        uvo = miriad.UV(out_name, status='new', corrmode=uvi.vartable.get('corr', 'r'))
+        uvo.init_from_uv(uvi)
+        uvo.pipe_block(uvi)
+        del uvi, uvo
+        if opts.delete: os.system('rm -rf %s' % (i))
+        continue
     if opts.expand:
         rv = os.system('tar xjf %s' % i)
         if rv != 0: break
@@ -151,12 +151,15 @@ def fit_func(prms, filelist, decimate, decphs):
         dra,ddec = cat.get('ionref')
         aa.sim_cache(eqs, flx, mfreqs=mfq,
             ionrefs=(dra,ddec), srcshapes=(a1,a2,th))
+        # Every baseline of a polarization in one native call
+        pols = {}
         for bl in dbuf[t]:
-            i,j = a.miriad.bl2ij(bl)
-            for pol in dbuf[t][bl]:
+            for pol in dbuf[t][bl]: pols.setdefault(pol, []).append(bl)
+        for pol in pols:
+            aa.set_active_pol(pol)
+            sims = aa.sim_bls([a.miriad.bl2ij(bl) for bl in pols[pol]])
+            for bl, sim_d in zip(pols[pol], sims):
                 d,f,nsamp = dbuf[t][bl][pol]
-                aa.set_active_pol(pol)
-                sim_d = aa.sim(i, j)
                 difsq = np.abs(d - sim_d)**2
                 difsq = np.where(f, 0, difsq)
                 score += difsq.sum()
@@ -26,19 +26,14 @@ for filename in args:
         print('File exists, skipping')
         continue
 
-    ants2use = opts.ants.split(',')
-
-    def mfunc(uv,p,d):
-        uvw,t,(i,j) = p
-        if i in ants2use and j in ants2use: return p,d
-        else: return None,None
+    ants2use = [int(ant) for ant in opts.ants.split(',')]
+    bls = [(i,j) for i in ants2use for j in ants2use if i <= j]
 
     uvi = a.miriad.UV(filename)
     uvo = a.miriad.UV(outfile,status='new')
-    uvo.init_from_uv(uvi)
-    histstr = 'PULL ANTS: ants='%opts.refant
+    histstr = 'PULL ANTS: ants='
     for ant in ants2use:
         histstr += str(ant)+','
         if ant == ants2use[-1]: histstr += '\n'
-    uvo.pipe(uvi,mfunc=mfunc,append2hist=histstr)
+    uvi.fan_out([(uvo, {'bls':bls})], append2hist=histstr)
     del uvo,uvi
@@ -25,17 +25,11 @@ for filename in args:
 
     pols2use = opts.pols.split(',')
 
-    def mfunc(uv,p,d):
-        pol = a.miriad.pol2str[uv['pol']]
-        if pol in pols2use: return p,d
-        else: return None,None
-
     uvi = a.miriad.UV(filename)
     uvo = a.miriad.UV(outfile,status='new')
-    uvo.init_from_uv(uvi)
     histstr = 'PULL POLS: pols='
     for pol in pols2use:
         histstr += str(pol)+','
         if pol == pols2use[-1]: histstr += '\n'
-    uvo.pipe(uvi,mfunc=mfunc,append2hist=histstr)
+    uvi.fan_out([(uvo, {'pols':pols2use})], append2hist=histstr)
     del uvo,uvi
@@ -19,7 +19,7 @@ o.add_option('-c', '--chan', dest='chan',
 o.add_option('-n', '--nsig', dest='nsig', default=2., type='float',
     help='Number of standard deviations above mean to flag.  Default 2.')
 o.add_option('-m', '--flagmode', dest='flagmode', default='both',
-    help='Can be val,int,both,none for flagging by value only, integration only, both, or only manually flagged channels.  Default both.')
+    help='Can be val,int,both,none for flagging by value only, integration only, both, or only manually flagged channels, or sum for native SumThreshold flagging of each block of --nblock records.  Default both.')
 o.add_option('-s', '--share', dest='share', action='store_true',
     help='Flag a channel, integration if any pol/baseline flags it (share flags).')
 o.add_option('--ch_thresh', dest='ch_thresh',type='float',default=.33,
@@ -28,6 +28,10 @@ o.add_option('--int_thresh', dest='int_thresh',type='float',default=.99,
     help='Fraction of the data in an integration which, if flagged, will result in the entire integration being flagged.  Default .99')
 o.add_option('--raw', dest='raw', action='store_true',
     help='Flag by integration without removing a smooth function.')
+o.add_option('--chi1', dest='chi1', default=6., type='float',
+    help='SumThreshold threshold for single samples, in standard deviations, in sum mode.  Default 6.')
+o.add_option('--nblock', dest='nblock', default=16384, type='int',
+    help='Records read at a time in sum mode.  Default 16384.')
 o.add_option('--reflag', dest='reflag', action='store_true',
     help='Ignore any previous flagging.')
 opts, args = o.parse_args(sys.argv[1:])
@@ -61,6 +65,20 @@ for uvfile in args:
         print(uvofile, 'exists, skipping.')
         continue
     uvi = a.miriad.UV(uvfile)
+    if opts.flagmode == 'sum':
+        # Flag each block natively as it is piped through
+        def sum_mfunc(uv, uvw, t, ij, d, f, v):
+            if opts.reflag: f[:] = False
+            f |= (np.abs(d) == 0)
+            f[:,chans] = True
+            a.rfi.flag_block(ij, d, f, v.get('pol'), chi1=opts.chi1)
+            return uvw, t, ij, np.where(f, 0, d), f
+        uvo = a.miriad.UV(uvofile, status='new')
+        uvo.init_from_uv(uvi)
+        if 'pol' in uvi.vartable: uvi.track(['pol'])
+        uvo.pipe_block(uvi, mfunc=sum_mfunc, nblock=opts.nblock, append2hist='XRFI: chi1=%f chans=%s mode=sum nblock=%d reflag=%s\n' % (opts.chi1, opts.chan, opts.nblock, opts.reflag))
+        del(uvo)
+        continue
     (uvw,jd,(i,j)),d,f = uvi.read(raw=True)
     uvi.rewind()
     # Gather all data and each time step
@@ -78,9 +78,14 @@ setup(
     package_dir={'aipy': 'aipy', 'aipy._src': 'aipy/_src'},
     packages=['aipy', 'aipy._src'],
     ext_modules=[
-        Extension('aipy._miriad', ['aipy/_miriad/miriad_wrap.cpp'] + \
+        Extension('aipy._pool', ['aipy/_pool/pool.cpp'],
+                  include_dirs=['aipy/_common']),
+        Extension('aipy._miriad', ['aipy/_miriad/miriad_wrap.cpp', 'aipy/_miriad/sma_read.cpp',
+                                   'aipy/_miriad/jplcat.cpp', 'aipy/_miriad/uv_average.cpp',
+                                   'aipy/_miriad/gain_apply.cpp'] + \
                   indir('aipy/_miriad/mir', ['uvio.c', 'hio.c', 'pack.c', 'bug.c',
-                                             'dio.c', 'headio.c', 'maskio.c']),
+                                             'dio.c', 'headio.c', 'maskio.c', 'xyzio.c',
+                                             'hzip.c', 'scrio.c']),
                   define_macros=global_macros,
                   include_dirs=[numpy.get_include(), 'aipy/_miriad',
                                 'aipy/_miriad/mir', 'aipy/_common']),
@@ -89,7 +94,11 @@ setup(
                   include_dirs=[numpy.get_include(), 'aipy/_common']),
         # Extension('aipy._img', ['aipy/_img/img.cpp'],
         #    include_dirs = [numpy.get_include()]),
-        Extension('aipy._dsp', ['aipy/_dsp/dsp.c', 'aipy/_dsp/grid/grid.c'],
+        Extension('aipy._dsp', ['aipy/_dsp/dsp.c', 'aipy/_dsp/grid/grid.c',
+                                'aipy/_dsp/grid/grid_mt.cpp', 'aipy/_dsp/grid/wstack.cpp',
+                                'aipy/_dsp/grid/snapshot.cpp', 'aipy/_dsp/grid/fft_image.cpp',
+                                'aipy/_dsp/phs.cpp', 'aipy/_dsp/rfi.cpp',
+                                'aipy/_dsp/closure.cpp', 'aipy/_dsp/interp.cpp'],
                   define_macros=global_macros,
                   include_dirs=[numpy.get_include(), 'aipy/_dsp', 'aipy/_dsp/grid', 'aipy/_common']),
         Extension('aipy.utils', ['aipy/utils/utils.cpp'],
@@ -95,3 +95,474 @@ def test_clean2d_stop_if_div():
     assert np.allclose(dim[0, 0], init_val, atol=1e-3)
 
     return
+
+
+def test_clean_threads():
+    from concurrent.futures import ThreadPoolExecutor
+
+    ker = np.zeros((DIM, DIM), dtype=np.float32)
+    ker[0, 0] = 1.0
+    ker[0, 1] = ker[1, 0] = 0.25
+    area = np.ones((DIM, DIM), dtype=np.int64)
+    ims = [np.random.normal(size=(DIM, DIM)).astype(np.float32) for i in range(4)]
+
+    def run(im):
+        res = im.copy()
+        mdl = np.zeros_like(im)
+        rv = aipy._deconv.clean(res, ker, mdl, area, maxiter=50, stop_if_div=1)
+        return rv, res, mdl
+
+    serial = [run(im) for im in ims]
+    with ThreadPoolExecutor(max_workers=4) as pool:
+        threaded = list(pool.map(run, ims))
+    for (rv0, res0, mdl0), (rv1, res1, mdl1) in zip(serial, threaded):
+        assert rv0 == rv1
+        assert np.all(res0 == res1)
+        assert np.all(mdl0 == mdl1)
+
+    return
+
+
+def test_clean_batch():
+    NPLANES = 5
+    ker = np.zeros((DIM, DIM), dtype=np.complex64)
+    ker[0, 0] = 1.0
+    ker[0, 1] = ker[1, 0] = 0.25
+    area = np.ones((DIM, DIM), dtype=np.int64)
+    ims = np.random.normal(size=(NPLANES, DIM, DIM)).astype(np.complex64)
+
+    res = ims.copy()
+    mdl = np.zeros_like(ims)
+    rv = aipy._deconv.clean_batch(res, ker, mdl, area, maxiter=50, stop_if_div=1, nthreads=3)
+    assert rv.shape == (NPLANES,)
+    for n in range(NPLANES):
+        res1 = ims[n].copy()
+        mdl1 = np.zeros_like(res1)
+        rv1 = aipy._deconv.clean(res1, ker, mdl1, area, maxiter=50, stop_if_div=1)
+        assert rv[n] == rv1
+        assert np.all(res[n] == res1)
+        assert np.all(mdl[n] == mdl1)
+
+    # Per-plane kernels and areas must line up with the plane axis
+    with pytest.raises(ValueError):
+        aipy._deconv.clean_batch(res, np.stack([ker] * (NPLANES + 1)), mdl, area)
+
+    # Read-only kernels are fine, but res and mdl are cleaned in place
+    ker.flags.writeable = False
+    aipy._deconv.clean_batch(ims.copy(), ker, np.zeros_like(ims), area, maxiter=5)
+    ims.flags.writeable = False
+    with pytest.raises(ValueError):
+        aipy._deconv.clean_batch(ims, ker, np.zeros_like(ims), area)
+    with pytest.raises(ValueError):
+        aipy._deconv.clean_batch(ims.copy(), ker, ims, area)
+
+    return
+
+
+@pytest.mark.parametrize("dtype", [np.float32, np.complex64, np.complex128])
+def test_clean_1d_batch(dtype):
+    NROWS, NCHAN = 40, 512
+    ker = np.zeros((NROWS, NCHAN), dtype=dtype)
+    ker[:, 0] = 1.0
+    ker[:, 1] = ker[:, -1] = np.linspace(0.1, 0.4, NROWS)
+    area = np.ones((NROWS, NCHAN), dtype=np.int64)
+    area[::3, 100:] = 0
+    ims = np.random.normal(size=(NROWS, NCHAN)).astype(dtype)
+    for k, a in ((ker, area), (ker[0], area[0])):
+        res, mdl = ims.copy(), np.zeros_like(ims)
+        rv = aipy._deconv.clean_1d_batch(res, k, mdl, a, maxiter=50, stop_if_div=1, nthreads=3)
+        assert rv.shape == (NROWS,)
+        for n in range(NROWS):
+            res1, mdl1 = ims[n].copy(), np.zeros_like(ims[n])
+            rv1 = aipy._deconv.clean(res1, k if k.ndim == 1 else k[n], mdl1,
+                                     a if a.ndim == 1 else a[n], maxiter=50, stop_if_div=1)
+            assert rv[n] == rv1
+            assert np.all(res[n] == res1)
+            assert np.all(mdl[n] == mdl1)
+
+    # Non-contiguous rows go through clean_batch
+    res, mdl = np.asfortranarray(ims), np.zeros_like(ims)
+    rv2 = aipy._deconv.clean_1d_batch(res, ker, mdl, area, maxiter=50, stop_if_div=1)
+    assert rv2.shape == (NROWS,)
+    with pytest.raises(ValueError):
+        aipy._deconv.clean_1d_batch(res[0], ker[0], mdl[0], area[0])
+
+    return
+
+
+@pytest.mark.parametrize("dtype", [np.float32, np.float64, np.complex64, np.complex128])
+def test_clean_contiguous_matches_strided(dtype):
+    ker = np.zeros((DIM, DIM // 2), dtype=dtype)
+    ker[0, 0] = 1.0
+    ker[0, 1] = ker[1, 0] = 0.25
+    ker[-1, 0] = 0.2
+    area = np.zeros((DIM, DIM // 2), dtype=np.int64)
+    area[10:60, 5:40] = 1
+    im = np.random.normal(size=ker.shape).astype(dtype)
+    # The vectorised kernels sum in a different order; compare the scalar ones
+    isa = aipy._deconv.set_simd(False)
+    try:
+        for stop_if_div in (0, 1):
+            res_c, mdl_c = im.copy(), np.zeros_like(im)
+            rv_c = aipy._deconv.clean(res_c, ker, mdl_c, area, maxiter=100, stop_if_div=stop_if_div)
+            # Fortran-ordered copies go through the strided loops
+            res_f, mdl_f = np.asfortranarray(im), np.asfortranarray(np.zeros_like(im))
+            rv_f = aipy._deconv.clean(res_f, np.asfortranarray(ker), mdl_f, area,
+                                      maxiter=100, stop_if_div=stop_if_div)
+            assert rv_c == rv_f
+            assert np.all(res_c == res_f)
+            assert np.all(mdl_c == mdl_f)
+    finally:
+        aipy._deconv.set_simd(isa != 'none')
+
+    return
+
+
+@pytest.mark.parametrize("dtype", [np.float32, np.float64, np.complex64, np.complex128])
+def test_clean_sparse_area(dtype):
+    # A box of a few percent of the field is searched as an index list
+    ker = np.zeros((DIM, DIM), dtype=dtype)
+    ker[0, 0] = 1.0
+    ker[0, 1] = ker[1, 0] = 0.25
+    im = np.random.normal(size=(DIM, DIM)).astype(dtype)
+    im[30, 40] += 10
+    im[100, 100] += 20
+    area = np.zeros((DIM, DIM), dtype=np.int64)
+    area[25:40, 35:50] = 1
+    res, mdl = im.copy(), np.zeros_like(im)
+    aipy._deconv.clean(res, ker, mdl, area, maxiter=100, stop_if_div=1)
+    res_f, mdl_f = np.asfortranarray(im), np.asfortranarray(np.zeros_like(im))
+    aipy._deconv.clean(res_f, np.asfortranarray(ker), mdl_f, area, maxiter=100,
+                       stop_if_div=1)
+    assert np.all(mdl[area == 0] == 0)
+    assert np.abs(mdl[30, 40]) > 5
+    assert np.allclose(mdl, mdl_f, atol=1e-4)
+
+    return
+
+
+@pytest.mark.parametrize("dtype", [np.float32, np.float64, np.complex64, np.complex128])
+def test_clean_simd(dtype):
+    assert aipy._deconv.get_simd() in ('none', 'avx2', 'avx512', 'neon')
+    ker = np.zeros((DIM, DIM), dtype=dtype)
+    ker[0, 0] = 1.0
+    ker[0, 1] = ker[1, 0] = ker[0, -1] = ker[-1, 0] = 0.25
+    im = np.zeros((DIM, DIM), dtype=dtype)
+    for i, j, f in ((10, 20, 3.0), (40, 7, 2.0), (55, 60, 1.5)):
+        im += f * np.roll(np.roll(ker, i, axis=0), j, axis=1)
+    area = np.ones((DIM, DIM), dtype=np.int64)
+    # Odd widths exercise the scalar tails of the vector loops
+    for shape in ((DIM, DIM), (DIM, DIM - 3)):
+        sl = tuple(slice(0, n) for n in shape)
+        results = []
+        for enable in (True, False):
+            aipy._deconv.set_simd(enable)
+            res, mdl = np.ascontiguousarray(im[sl]), np.zeros(shape, dtype=dtype)
+            rv = aipy._deconv.clean(res, np.ascontiguousarray(ker[sl]), mdl,
+                                    np.ascontiguousarray(area[sl]), tol=0, maxiter=60)
+            results.append((rv, res, mdl))
+        aipy._deconv.set_simd(True)
+        (rv1, res1, mdl1), (rv2, res2, mdl2) = results
+        assert rv1 == rv2
+        assert np.allclose(res1, res2, atol=1e-4)
+        assert np.allclose(mdl1, mdl2, atol=1e-4)
+
+    return
+
+
+@pytest.mark.parametrize("dtype", [np.float32, np.float64, np.complex64, np.complex128])
+def test_clean_beam_patch(dtype):
+    # A kernel with compact support: a patch covering it changes nothing
+    ker = np.zeros((DIM, DIM), dtype=dtype)
+    ker[0, 0] = 1.0
+    ker[0, 1] = ker[1, 0] = ker[0, -1] = ker[-1, 0] = 0.25
+    im = np.zeros((DIM, DIM), dtype=dtype)
+    for i, j, f in ((10, 20, 3.0), (40, 7, 2.0), (100, 60, 1.5)):
+        im += f * np.roll(np.roll(ker, i, axis=0), j, axis=1)
+    area = np.ones((DIM, DIM), dtype=np.int64)
+    res0, mdl0 = im.copy(), np.zeros_like(im)
+    aipy._deconv.clean(res0, ker, mdl0, area, tol=0, maxiter=100)
+    for beam_patch in (2, 0.2):
+        res1, mdl1 = im.copy(), np.zeros_like(im)
+        aipy._deconv.clean(res1, ker, mdl1, area, tol=0, maxiter=100, beam_patch=beam_patch)
+        assert np.allclose(res0, res1, atol=1e-5)
+        assert np.allclose(mdl0, mdl1, atol=1e-5)
+        # Non-contiguous arrays are cleaned in contiguous copies
+        res2, mdl2 = np.asfortranarray(im), np.asfortranarray(np.zeros_like(im))
+        aipy._deconv.clean(res2, np.asfortranarray(ker), mdl2, area, tol=0,
+                           maxiter=100, beam_patch=beam_patch)
+        assert np.all(res1 == res2)
+        assert np.all(mdl1 == mdl2)
+
+    # A patch smaller than the support leaves the kernel wings behind
+    res3, mdl3 = im.copy(), np.zeros_like(im)
+    aipy._deconv.clean(res3, ker, mdl3, area, tol=0, maxiter=100, beam_patch=0.5)
+    assert np.abs(res3[10, 21]) > np.abs(res0[10, 21])
+
+    # 1d data
+    res4, mdl4 = im[10].copy(), np.zeros_like(im[10])
+    aipy._deconv.clean(res4, ker[0], mdl4, area[0], tol=0, maxiter=50)
+    res5, mdl5 = im[10].copy(), np.zeros_like(im[10])
+    aipy._deconv.clean(res5, ker[0], mdl5, area[0], tol=0, maxiter=50, beam_patch=3)
+    assert np.allclose(res4, res5, atol=1e-5)
+
+    return
+
+
+def test_clean_thresh():
+    ker = np.zeros((DIM, DIM), dtype=np.float64)
+    ker[0, 0] = 1.0
+    res = np.zeros((DIM, DIM), dtype=np.float64)
+    res[10, 10] = 1.0
+    area = np.ones((DIM, DIM), dtype=np.int64)
+    mdl = np.zeros_like(res)
+    rv = aipy._deconv.clean(res, ker, mdl, area, tol=0, maxiter=1000, thresh=0.5)
+    # Each step removes 10% of the peak: 0.9**7 < 0.5 < 0.9**6
+    assert rv == 7
+    assert res[10, 10] < 0.5 and res[10, 10] > 0.45
+
+    return
+
+
+@pytest.mark.parametrize("beam_patch", [0, 2])
+def test_clean_history(beam_patch):
+    ker = np.zeros((DIM, DIM), dtype=np.float64)
+    ker[0, 0] = 1.0
+    res = np.zeros((DIM, DIM), dtype=np.float64)
+    res[10, 20] = 1.0
+    area = np.ones((DIM, DIM), dtype=np.int64)
+    mdl = np.zeros_like(res)
+    hist = np.zeros(20, dtype=aipy._deconv.history_dtype)
+    rv = aipy._deconv.clean(res, ker, mdl, area, tol=0, maxiter=10, stop_if_div=1,
+                            beam_patch=beam_patch, history=hist, history_every=2)
+    assert rv == 10
+    assert np.all(hist['iter'][:5] == [0, 2, 4, 6, 8])
+    assert np.all(hist['iter'][5:] == -1)
+    assert np.all(hist['pos'][:5] == [10, 20])
+    # The peak decays by (1 - gain) per step; the first step is zero
+    assert np.allclose(hist['peak'][:5].real, 0.9**np.array([0, 2, 4, 6, 8]))
+    assert np.allclose(hist['step'][1:5].real, 0.1 * 0.9**np.array([1, 3, 5, 7]))
+    assert np.allclose(hist['score'][:5], hist['peak'][:5].real / DIM)
+
+    with pytest.raises(ValueError):
+        aipy._deconv.clean(res, ker, mdl, area, history=np.zeros(20))
+    hist.flags.writeable = False
+    with pytest.raises(ValueError):
+        aipy._deconv.clean(res, ker, mdl, area, history=hist)
+
+    return
+
+
+@pytest.mark.parametrize("dtype", [np.float64, np.complex128])
+@pytest.mark.parametrize("beam_patch", [0, 2])
+def test_clean_components(dtype, beam_patch):
+    ker = np.zeros((DIM, DIM), dtype=dtype)
+    ker[0, 0] = 1.0
+    ker[0, 1] = ker[1, 0] = 0.25
+    im = np.zeros((DIM, DIM), dtype=dtype)
+    im[10, 20] = 3.0
+    im[40, 7] = 2.0
+    im = np.fft.ifft2(np.fft.fft2(im) * np.fft.fft2(ker)).astype(dtype)
+    area = np.ones((DIM, DIM), dtype=np.int64)
+    res, mdl = im.copy(), np.zeros_like(im)
+    rv, pos, flux = aipy._deconv.clean(res, ker, mdl, area, tol=0, maxiter=100,
+                                       beam_patch=beam_patch, components=1)
+    assert flux.dtype == (np.complex128 if dtype == np.complex128 else np.float64)
+    assert pos.shape == (flux.size, 2)
+    assert np.all(flux != 0)
+    # The components add up to the model
+    acc = np.zeros_like(mdl)
+    np.add.at(acc, (pos[:, 0], pos[:, 1]), flux)
+    assert np.allclose(acc, mdl)
+
+    res, mdl = im.copy(), np.zeros_like(im)
+    rv, pos, flux = aipy._deconv.clean(res, ker, mdl, area, tol=0, maxiter=100,
+                                       beam_patch=beam_patch, components=1,
+                                       merge_components=1)
+    flat = pos[:, 0] * DIM + pos[:, 1]
+    assert np.all(np.diff(flat) > 0)
+    assert np.allclose(mdl[pos[:, 0], pos[:, 1]], flux)
+    assert np.count_nonzero(mdl) == flux.size
+
+    # Steps undone on divergence are not listed
+    res = im + np.random.RandomState(0).normal(0, .1, im.shape).astype(dtype)
+    mdl = np.zeros_like(im)
+    rv, pos, flux = aipy._deconv.clean(res, ker, mdl, area, tol=0, maxiter=10000,
+                                       stop_if_div=1, beam_patch=beam_patch,
+                                       components=1, merge_components=1)
+    assert np.allclose(mdl[pos[:, 0], pos[:, 1]], flux)
+    assert np.count_nonzero(mdl) == flux.size
+
+    return
+
+
+def test_clean_ms():
+    # With a single point scale, multi-scale clean is Hogbom clean
+    ker = np.zeros((DIM, DIM), dtype=np.float64)
+    ker[0, 0] = 1.0
+    ker[0, 1] = ker[1, 0] = 0.25
+    im = np.zeros((DIM, DIM), dtype=np.float64)
+    im[10, 20] = 3.0
+    im[40, 7] = 2.0
+    im = np.fft.ifft2(np.fft.fft2(im) * np.fft.fft2(ker)).real
+    area = np.ones((DIM, DIM), dtype=np.int64)
+    res0, mdl0 = im.copy(), np.zeros_like(im)
+    rv0 = aipy._deconv.clean(res0, ker, mdl0, area, tol=0, maxiter=100, stop_if_div=1)
+    res1, mdl1 = im[None].copy(), np.zeros((1,) + im.shape)
+    assert rv0 == 100
+    # clean() spends its first iteration on a zero step
+    rv1 = aipy._deconv.clean_ms(res1, ker[None, None].copy(), mdl1, area,
+                                np.ones(1), tol=0, maxiter=99)
+    assert rv1 == 99
+    assert np.allclose(res0, res1[0], atol=1e-6)
+    assert np.allclose(mdl0, mdl1[0], atol=1e-6)
+    with pytest.raises(ValueError):
+        aipy._deconv.clean_ms(res1, ker[None].copy(), mdl1, area, np.ones(1))
+    with pytest.raises(ValueError):
+        aipy._deconv.clean_ms(res1.astype(np.complex128), ker[None, None].astype(np.complex128),
+                              mdl1.astype(np.complex128), area, np.ones(1))
+
+    return
+
+
+def test_maxent():
+    # Compare with the numpy MEM iteration; odd sizes go through Bluestein FFTs
+    shape = (24, 33)
+    ker = np.zeros(shape)
+    ker[0, 0] = 1.0
+    ker[0, 1] = ker[1, 0] = 0.3
+    im = 0.05 * np.random.normal(size=shape)
+    im[5, 7] += 2.0
+    im = np.fft.ifft2(np.fft.fft2(im) * np.fft.fft2(ker)).real
+    var0, gain, niter = 0.01, 0.1, 20
+    m = np.ones(shape) * max(np.average(im) / ker.sum(), 1e-3)
+    b, res = m.copy(), np.empty(shape)
+    rv, term, score, alpha = aipy._deconv.maxent(im, ker, m, b, res, var0,
+                                                 gain=gain, tol=0, maxiter=niter)
+    fker = np.fft.fft2(ker)
+    q = np.sqrt((ker**2).sum())
+    b0, alpha0 = m.copy(), 0.0
+    for i in range(rv):
+        diff = im - np.fft.ifft2(np.fft.fft2(b0) * fker).real
+        g_chi2 = -2 * q * diff
+        g_J = -np.log(b0 / m) - 1 - alpha0 * g_chi2
+        w = -1 / (-1 / b0 - alpha0 * 2 * q**2)
+        d_alpha = ((diff**2).sum() - diff.size * var0 + (g_chi2 * g_J * w).sum()) \
+            / (g_chi2**2 * w).sum()
+        if term != 0 and i == rv - 1:
+            break
+        b0 = np.clip(b0 + gain * w * (g_J - d_alpha * g_chi2), np.finfo(np.float64).tiny, np.inf)
+        alpha0 += gain * d_alpha
+    assert np.allclose(b, b0, rtol=1e-8, atol=1e-12)
+    assert np.allclose(alpha, alpha0, rtol=1e-8)
+    assert np.allclose(res, im - np.fft.ifft2(np.fft.fft2(b) * fker).real, atol=1e-10)
+
+    return
+
+
+def test_lsq():
+    # Compare with the numpy lsq iteration; stacks share a kernel or not
+    shape = (24, 33)
+    ker = np.zeros(shape)
+    ker[0, 0] = 1.0
+    ker[0, 1] = ker[1, 0] = 0.3
+    ims = np.random.normal(size=(3,) + shape)
+    ims[:, 5, 7] += 2.0
+    fker = np.fft.fft2(ker)
+    ims = np.fft.ifft2(np.fft.fft2(ims) * fker).real
+    area = np.ones(shape)
+    area[:, :4] = 0
+    gain, niter, q = 0.1, 15, np.sqrt((ker**2).sum())
+    x0 = np.zeros_like(ims)
+    for i in range(niter):
+        diff = (ims - np.fft.ifft2(np.fft.fft2(x0) * fker).real) * area
+        g_chi2 = -2 * q * diff
+        d_x = np.where(np.abs(g_chi2) > 0, -(1 / g_chi2) * diff**2, 0)
+        x0 = np.clip(x0 + gain * d_x, -np.inf, np.inf)
+    for kers, nthreads in ((ker, 1), (np.array([ker] * 3), 3)):
+        x, res = np.zeros_like(ims), np.empty_like(ims)
+        iters, terms, scores = aipy._deconv.lsq(ims, kers, x, area, res, gain=gain,
+                                                tol=0, maxiter=niter, lower=-np.inf,
+                                                nthreads=nthreads)
+        assert np.all(iters == niter) and np.all(terms == 0)
+        assert np.allclose(x, x0, rtol=1e-8, atol=1e-12)
+        assert np.allclose(res, ims - np.fft.ifft2(np.fft.fft2(x) * fker).real, atol=1e-10)
+    x = np.zeros_like(ims)
+    iters, terms, scores = aipy._deconv.lsq(ims, ker, x, area, res, tol=0.5)
+    assert np.all(terms == 1) and np.all(iters < 200)
+    with pytest.raises(ValueError):
+        aipy._deconv.lsq(ims, ker[:, :-1].copy(), x, area, res)
+    with pytest.raises(ValueError):
+        aipy._deconv.lsq(ims, ker, x, area.astype(np.int_), res)
+
+    return
+
+
+def test_anneal():
+    shape = (32, 24)
+    ker = np.zeros(shape)
+    ker[0, 0] = 1.0
+    ker[0, 1] = ker[1, 0] = ker[-1, 0] = 0.3
+    truth = np.zeros(shape)
+    truth[5, 7], truth[20, 3] = 2.0, 1.0
+    fker = np.fft.fft2(ker)
+    im = np.fft.ifft2(np.fft.fft2(truth) * fker).real
+    mdl = np.zeros((3,) + shape)
+    res = np.array([im] * 3)
+    state = np.arange(1, 4, dtype=np.uint64)
+    score0 = (res**2).sum()
+    for i in range(30):
+        sigma = np.ascontiguousarray(0.5 * np.abs(res))
+        kept = aipy._deconv.anneal(ker, mdl, res, sigma, state, lower=0, nthreads=2)
+        assert kept.shape == (3,)
+    # The residual is kept exact through the kernel footprint
+    for c in range(3):
+        assert np.allclose(res[c], im - np.fft.ifft2(np.fft.fft2(mdl[c]) * fker).real)
+        assert (res[c]**2).sum() < 1e-2 * score0
+    assert np.all(mdl >= 0)
+
+    # Chains are independent of the thread they run on
+    mdl1, res1, state1 = np.zeros(shape), im.copy(), np.array([2], dtype=np.uint64)
+    mdl2, res2 = np.zeros((3,) + shape), np.array([im] * 3)
+    state2 = np.array([1, 2, 3], dtype=np.uint64)
+    sigma = np.ones(shape)
+    aipy._deconv.anneal(ker, mdl1, res1, sigma, state1)
+    aipy._deconv.anneal(ker, mdl2, res2, np.array([sigma] * 3), state2, nthreads=3)
+    assert np.all(mdl1 == mdl2[1])
+    assert state1[0] == state2[1]
+
+    return
+
+
+@pytest.mark.parametrize("dtype", [np.float64, np.complex64])
+def test_clean_joint(dtype):
+    NPLANES = 3
+    ker = np.zeros((NPLANES, DIM, DIM), dtype=dtype)
+    ker[:, 0, 0] = 1.0
+    ker[:, 0, 1] = ker[:, 1, 0] = [0.2, 0.3, 0.4]
+    amps = np.array([2.0, 1.0, -0.5])
+    im = np.zeros((NPLANES, DIM, DIM), dtype=dtype)
+    for t in range(NPLANES):
+        for i, j, f in ((10, 20, 1.0), (70, 33, 0.6)):
+            im[t] += amps[t] * f * np.roll(np.roll(ker[t], i, axis=0), j, axis=1)
+    area = np.ones((DIM, DIM), dtype=np.int64)
+    res, mdl = im.copy(), np.zeros_like(im)
+    aipy._deconv.clean_joint(res, ker, mdl, area, tol=1e-9, maxiter=1000, stop_if_div=1)
+    assert np.allclose(mdl[:, 10, 20], amps, atol=1e-3)
+    assert np.allclose(mdl[:, 70, 33], 0.6 * amps, atol=1e-3)
+
+    # A single plane is an ordinary clean
+    isa = aipy._deconv.set_simd(False)
+    try:
+        im1 = np.random.normal(size=(DIM, DIM)).astype(dtype)
+        res0, mdl0 = im1.copy(), np.zeros_like(im1)
+        rv0 = aipy._deconv.clean(res0, ker[1], mdl0, area, maxiter=50, stop_if_div=1)
+        res1, mdl1 = im1[None].copy(), np.zeros((1, DIM, DIM), dtype=dtype)
+        rv1 = aipy._deconv.clean_joint(res1, ker[1:2].copy(), mdl1, area, maxiter=50, stop_if_div=1)
+        assert rv0 == rv1
+        assert np.all(res0 == res1[0])
+        assert np.all(mdl0 == mdl1[0])
+    finally:
+        aipy._deconv.set_simd(isa != 'none')
+
+    return
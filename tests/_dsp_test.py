@@ -5,6 +5,7 @@
 import numpy as np
 import pytest
 import aipy._dsp as _dsp
+import aipy.dsp as dsp
 
 
 def test_testgrid1D_c():
@@ -37,6 +38,165 @@ def test_testgrid2D_c():
     )
 
 
+def test_testgrid2D_c_nonsquare():
+    # The kernel is the outer product of two 1D Gaussians, wrapped at the edges
+    buf = np.zeros((16, 40), dtype=np.complex64)
+    ind1 = np.array([0.3, 8.0, 15.6], dtype=np.float32)
+    ind2 = np.array([20.2, 38.5, 1.0], dtype=np.float32)
+    dat = np.array([1, 2j, 3], dtype=np.complex64)
+    _dsp.grid2D_c(buf, ind1, ind2, dat)
+    ans = np.zeros(buf.shape, dtype=np.complex128)
+    for i1, i2, d in zip(ind1, ind2, dat):
+        j1 = np.arange(np.floor(i1 - 3), np.ceil(i1 + 3) + 1)
+        j2 = np.arange(np.floor(i2 - 3), np.ceil(i2 + 3) + 1)
+        w = 0.63661977236758149 * np.outer(np.exp(-2 * (i1 - j1) ** 2), np.exp(-2 * (i2 - j2) ** 2))
+        np.add.at(ans, (j1[:, None].astype(int) % 16, j2[None, :].astype(int) % 40), w * d)
+    assert np.allclose(buf, ans, atol=1e-6)
+    dat2 = np.zeros(ind1.shape, dtype=np.complex64)
+    _dsp.degrid2D_c(buf, ind1, ind2, dat2)
+    assert np.all(np.abs(dat2) > 0)
+
+
+@pytest.mark.parametrize("shape", [(256, 256), (130, 200), (10, 12)])
+def test_testgrid2D_c_mt(shape):
+    rng = np.random.RandomState(0)
+    n = 5000
+    ind1 = (rng.uniform(-0.75, 0.75, n) * shape[0]).astype(np.float32)
+    ind2 = (rng.uniform(-0.75, 0.75, n) * shape[1]).astype(np.float32)
+    dat = (rng.normal(size=n) + 1j * rng.normal(size=n)).astype(np.complex64)
+    buf = np.zeros(shape, dtype=np.complex64)
+    _dsp.grid2D_c(buf, ind1, ind2, dat)
+    buf1 = np.zeros(shape, dtype=np.complex64)
+    _dsp.grid2D_c_mt(buf1, ind1, ind2, dat, 6, 1)
+    assert np.allclose(buf1, buf, atol=1e-4)
+    # Tiles are reduced in a fixed order, whatever the thread count
+    buf4 = np.zeros(shape, dtype=np.complex64)
+    _dsp.grid2D_c_mt(buf4, ind1, ind2, dat, 6, 4)
+    assert np.all(buf4 == buf1)
+
+
+def test_testgrid2D_c_order():
+    rng = np.random.RandomState(1)
+    shape, n = (200, 130), 5000
+    ind1 = (rng.uniform(-0.5, 0.5, n) * shape[0]).astype(np.float32)
+    ind2 = (rng.uniform(-0.5, 0.5, n) * shape[1]).astype(np.float32)
+    dat = (rng.normal(size=n) + 1j * rng.normal(size=n)).astype(np.complex64)
+    order = _dsp.tile_order(ind1, ind2, shape[0], shape[1])
+    assert np.all(np.sort(order) == np.arange(n))
+    # Samples come out grouped by tile (3 x 2 tiles of about 64 pixels)
+    edges1, edges2 = np.arange(4) * shape[0] // 3, np.arange(3) * shape[1] // 2
+    t1 = np.searchsorted(edges1, np.floor(ind1[order]) % shape[0], 'right') - 1
+    t2 = np.searchsorted(edges2, np.floor(ind2[order]) % shape[1], 'right') - 1
+    assert np.all(np.diff(t1 * 2 + t2) >= 0)
+    buf, buf1 = np.zeros(shape, dtype=np.complex64), np.zeros(shape, dtype=np.complex64)
+    _dsp.grid2D_c(buf, ind1, ind2, dat)
+    _dsp.grid2D_c_order(buf1, ind1, ind2, dat, order)
+    assert np.allclose(buf, buf1, atol=1e-4)
+    with pytest.raises(ValueError):
+        _dsp.grid2D_c_order(buf1, ind1, ind2, dat, order + 1)
+
+
+def test_testgrid2D_multi_c():
+    rng = np.random.RandomState(3)
+    shape, n = (40, 24), 300
+    ind1 = (rng.uniform(-0.5, 0.5, n) * shape[0]).astype(np.float32)
+    ind2 = (rng.uniform(-0.5, 0.5, n) * shape[1]).astype(np.float32)
+    dats = [(rng.normal(size=n) + 1j * rng.normal(size=n)).astype(np.complex64)
+            for i in range(3)]
+    bufs = [np.zeros(shape, dtype=np.complex64) for i in range(3)]
+    _dsp.grid2D_multi_c(bufs, ind1, ind2, dats)
+    order = _dsp.tile_order(ind1, ind2, shape[0], shape[1])
+    bufs1 = [np.zeros(shape, dtype=np.complex64) for i in range(3)]
+    _dsp.grid2D_multi_c(bufs1, ind1, ind2, dats, 6, order)
+    for buf, buf1, dat in zip(bufs, bufs1, dats):
+        ans = np.zeros(shape, dtype=np.complex64)
+        _dsp.grid2D_c(ans, ind1, ind2, dat)
+        assert np.all(buf == ans)
+        assert np.allclose(buf1, ans, atol=1e-5)
+    with pytest.raises(ValueError):
+        _dsp.grid2D_multi_c(bufs, ind1, ind2, dats[:2])
+    with pytest.raises(ValueError):
+        _dsp.grid2D_multi_c([bufs[0], bufs[1][:10]], ind1, ind2, dats[:2])
+
+
+def test_testgrid2D_c_strided():
+    rng = np.random.RandomState(4)
+    shape, n = (32, 32), 50
+    ind = rng.uniform(-8, 8, (n, 2))  # float64 columns, strided
+    dat = rng.normal(size=(n, 3)) + 1j * rng.normal(size=(n, 3))
+    ans = np.zeros(shape, dtype=np.complex64)
+    _dsp.grid2D_c(ans, ind[:, 0].astype(np.float32), ind[:, 1].astype(np.float32),
+                  dat[:, 1].astype(np.complex64))
+    buf = np.zeros(shape, dtype=np.complex64)
+    _dsp.grid2D_c(buf, ind[:, 0], ind[:, 1], dat[:, 1])
+    assert np.allclose(buf, ans, atol=1e-6)
+    # Degridding adds into a strided complex128 view in place
+    out = np.zeros((n, 2), dtype=np.complex128)
+    ref = np.zeros(n, dtype=np.complex64)
+    _dsp.degrid2D_c(buf, ind[:, 0], ind[:, 1], out[:, 1])
+    _dsp.degrid2D_c(buf, ind[:, 0].astype(np.float32), ind[:, 1].astype(np.float32), ref)
+    assert np.all(out[:, 0] == 0)
+    assert np.allclose(out[:, 1], ref, atol=1e-6)
+    buf1 = np.zeros(32, dtype=np.complex64)
+    ans1 = np.zeros(32, dtype=np.complex64)
+    _dsp.grid1D_c(buf1, ind[::2, 0] + 16, dat[::2, 0])
+    _dsp.grid1D_c(ans1, (ind[::2, 0] + 16).astype(np.float32), dat[::2, 0].astype(np.complex64))
+    assert np.allclose(buf1, ans1, atol=1e-6)
+    with pytest.raises(ValueError):
+        _dsp.grid2D_c(buf, ind[:, 0].astype(np.int64), ind[:, 1], dat[:, 1])
+
+
+def test_testgrid2D_c_flags():
+    rng = np.random.RandomState(6)
+    shape, n = (32, 32), 100
+    ind1 = rng.uniform(-8, 8, n).astype(np.float32)
+    ind2 = rng.uniform(-8, 8, n).astype(np.float32)
+    dat = (rng.normal(size=n) + 1j * rng.normal(size=n)).astype(np.complex64)
+    flags = rng.uniform(size=n) < 0.3
+    wgt = rng.uniform(size=n)
+    ok = np.logical_not(flags)
+    ans = np.zeros(shape, dtype=np.complex64)
+    _dsp.grid2D_c(ans, ind1[ok], ind2[ok], (dat * wgt)[ok].astype(np.complex64))
+    buf = np.zeros(shape, dtype=np.complex64)
+    _dsp.grid2D_c(buf, ind1, ind2, dat, 6, flags, wgt)
+    assert np.allclose(buf, ans, atol=1e-5)
+    # Integer flags, and flags without weights, in the multi-plane gridder
+    bufs = [np.zeros(shape, dtype=np.complex64) for i in range(2)]
+    _dsp.grid2D_multi_c(bufs, ind1, ind2, [dat, dat], 6, None, flags.astype(np.int32))
+    ans[:] = 0
+    _dsp.grid2D_c(ans, ind1[ok], ind2[ok], dat[ok])
+    assert np.allclose(bufs[0], ans, atol=1e-5)
+    assert np.all(bufs[0] == bufs[1])
+    with pytest.raises(ValueError):
+        _dsp.grid2D_c(buf, ind1, ind2, dat, 6, flags[1:])
+    with pytest.raises(ValueError):
+        _dsp.grid2D_c(buf, ind1, ind2, dat, 6, flags.astype(np.float32))
+
+
+@pytest.mark.parametrize("shape", [(32, 32), (31, 27)])
+def test_testgrid2D_herm_c(shape):
+    rng = np.random.RandomState(7)
+    n = 200
+    ind1 = (rng.uniform(-0.45, 0.45, n) * shape[0]).astype(np.float32)
+    ind2 = (rng.uniform(-0.45, 0.45, n) * shape[1]).astype(np.float32)
+    dat = (rng.normal(size=n) + 1j * rng.normal(size=n)).astype(np.complex64)
+    # The full grid of the samples and their conjugates
+    full = np.zeros(shape, dtype=np.complex64)
+    _dsp.grid2D_c(full, np.concatenate([ind1, -ind1]), np.concatenate([ind2, -ind2]),
+                  np.concatenate([dat, np.conj(dat)]))
+    half = np.zeros((shape[0], shape[1] // 2 + 1), dtype=np.complex64)
+    _dsp.grid2D_herm_c([half], ind1, ind2, [dat], shape[1])
+    assert np.allclose(half, full[:, :half.shape[1]], atol=1e-5)
+    assert np.allclose(np.fft.irfft2(half, s=shape), np.fft.ifft2(full).real, atol=1e-6)
+    ans = np.zeros(n, dtype=np.complex64)
+    out = np.zeros(n, dtype=np.complex64)
+    _dsp.degrid2D_c(full, ind1, ind2, ans)
+    _dsp.degrid2D_herm_c(half, ind1, ind2, out, shape[1])
+    assert np.allclose(out, ans, atol=1e-5)
+    with pytest.raises(ValueError):
+        _dsp.grid2D_herm_c([half], ind1, ind2, [dat], shape[1] + 2)
+
+
 def test_testdegrid2D_c():
     buf = np.ones((32, 32), dtype=np.complex64)
     ind = np.array([[5, 5], [10.1, 10.1], [14.5, 15.5]], dtype=np.float32)
@@ -45,3 +205,310 @@ def test_testdegrid2D_c():
     dat = np.zeros(ind1.shape, dtype=np.complex64)
     _dsp.degrid2D_c(buf, ind1, ind2, dat)
     assert np.allclose(dat, 1.0)
+
+
+@pytest.mark.parametrize("nthreads", [1, 3, 0])
+def test_testdegrid2D_c_mt(nthreads):
+    rng = np.random.RandomState(5)
+    shape, n = (48, 40), 10000
+    buf = (rng.normal(size=shape) + 1j * rng.normal(size=shape)).astype(np.complex64)
+    ind1 = (rng.uniform(-0.5, 0.5, n) * shape[0]).astype(np.float32)
+    ind2 = (rng.uniform(-0.5, 0.5, n) * shape[1]).astype(np.float32)
+    ans = np.zeros(n, dtype=np.complex64)
+    _dsp.degrid2D_c(buf, ind1, ind2, ans)
+    dat = np.zeros(n, dtype=np.complex64)
+    _dsp.degrid2D_c_mt(buf, ind1, ind2, dat, 6, nthreads)
+    assert np.all(dat == ans)
+    with pytest.raises(ValueError):
+        _dsp.degrid2D_c_mt(buf, ind1[:10], ind2, dat)
+
+
+def test_testdegrid_grid2D_c():
+    mdl = np.ones((32, 32), dtype=np.complex64)
+    res = np.ones((32, 32), dtype=np.complex64)
+    ind = np.array([[5, 5], [10.1, 10.1], [14.5, 15.5]], dtype=np.float32)
+    ind1 = ind[:, 0].copy()  # copy necessary b/c not contigous memory otherwise
+    ind2 = ind[:, 1].copy()
+    dat = np.array([3, 3, 3], dtype=np.complex64)
+    rdat = np.zeros(ind1.shape, dtype=np.complex64)
+    _dsp.degrid_grid2D_c(mdl, res, ind1, ind2, dat, rdat)
+    assert np.allclose(rdat, 2.0)
+    # The residual grid matches gridding the residuals directly
+    buf = np.zeros((32, 32), dtype=np.complex64)
+    _dsp.grid2D_c(buf, ind1, ind2, rdat)
+    assert np.allclose(res, buf, atol=1e-6)
+    with pytest.raises(ValueError):
+        _dsp.degrid_grid2D_c(mdl, res[:16], ind1, ind2, dat, rdat)
+
+
+def test_testgrid2D_tab_c():
+    tab = dsp.kaiser_bessel(6, 128)
+    assert tab.dtype == np.float32 and tab.size == 6 * 128 // 2 + 1
+    assert tab[0] == 1
+    n = 64
+    buf = np.zeros((n, n), dtype=np.complex64)
+    ind1 = np.array([10.37], dtype=np.float32)
+    ind2 = np.array([20.0], dtype=np.float32)
+    dat = np.array([1], dtype=np.complex64)
+    _dsp.grid2D_tab_c(buf, ind1, ind2, dat, tab, 6, 128)
+    # Pixels within support/2 of the sample get the nearest table entry
+    assert buf[10, 20] == tab[47]
+    assert buf[13, 20] == tab[int(2.63 * 128 + 0.5)]
+    assert buf[14, 20] == 0 and buf[10, 24] == 0
+    # The grid correction is the kernel's transform: it flattens the image
+    # of a point well inside the aliasing-dominated edge
+    corr = np.zeros(n, dtype=np.float32)
+    _dsp.grid_correct(corr, tab, 6, 128)
+    img = np.abs(np.fft.ifft2(buf)) * n * n
+    x = np.arange(-n // 4, n // 4)
+    assert np.allclose(img[x, 0], corr[x] * corr[0], rtol=1e-3)
+    # Degridding a constant plane returns the constant
+    buf[:] = 1
+    dat[:] = 0
+    _dsp.degrid2D_tab_c(buf, ind1, ind2, dat, tab, 6, 128)
+    assert np.allclose(dat, 1.0)
+    with pytest.raises(ValueError):
+        _dsp.grid2D_tab_c(buf, ind1, ind2, dat, tab.astype(np.float64), 6, 128)
+    with pytest.raises(ValueError):
+        _dsp.grid_correct(corr, tab, 0, 128)
+
+
+def test_wstack():
+    rng = np.random.RandomState(2)
+    dim, n = 32, 200
+    ind1 = rng.uniform(-8, 8, n).astype(np.float32)
+    ind2 = rng.uniform(-8, 8, n).astype(np.float32)
+    dat = (rng.normal(size=n) + 1j * rng.normal(size=n)).astype(np.complex64)
+    wgt = np.ones(n, dtype=np.complex64)
+    # At w = 0 (and everywhere on the sky, as res = 1) the w-screen is
+    # flat, so a layer goes down as grid2D_c over the pixel count
+    ans = np.zeros((dim, dim), dtype=np.complex64)
+    _dsp.grid2D_c(ans, ind1, ind2, dat)
+    uv, bm = np.zeros_like(ans), np.zeros_like(ans)
+    _dsp.wstack_put([uv, bm], [dat, wgt], ind1, ind2, np.zeros(n), 0.5, 1.0)
+    assert np.allclose(uv, ans / dim ** 2, atol=1e-6)
+    # Projecting several layers at once changes nothing
+    w = rng.uniform(-20, 20, n)
+    uv1, bm1 = np.zeros_like(ans), np.zeros_like(ans)
+    _dsp.wstack_put([uv, bm], [dat, wgt], ind1, ind2, w, 0.5, 1.0)
+    _dsp.wstack_put([uv1, bm1], [dat, wgt], ind1, ind2, w, 0.5, 1.0, None, 3)
+    assert np.allclose(uv1 + ans / dim ** 2, uv, atol=1e-6)
+    out, out1 = np.zeros_like(dat), np.zeros_like(dat)
+    _dsp.wstack_get(uv1, bm1, ind1, ind2, w, out, 0.5, 1.0)
+    _dsp.wstack_get(uv1, bm1, ind1, ind2, w, out1, 0.5, 1.0, 3)
+    assert np.allclose(out, out1)
+    with pytest.raises(ValueError):
+        _dsp.wstack_put([uv, bm], [dat], ind1, ind2, w, 0.5, 1.0)
+    with pytest.raises(ValueError):
+        _dsp.wstack_get(uv, bm, ind1, ind2, w[:10], out, 0.5, 1.0)
+
+
+def test_snap_images():
+    rng = np.random.RandomState(5)
+    dim, n, ns = 32, 120, 5
+    ind1 = rng.uniform(-10, 10, n).astype(np.float32)
+    ind2 = rng.uniform(-10, 10, n).astype(np.float32)
+    dats = (rng.normal(size=(ns, n)) + 1j * rng.normal(size=(ns, n))).astype(np.complex64)
+    off, wgt = _dsp.grid_plan(ind1, ind2, dim, dim)
+    # Gridding from the plan is exactly grid2D_c
+    ans = np.zeros((dim, dim), dtype=np.complex64)
+    buf = np.zeros_like(ans)
+    _dsp.grid2D_c(ans, ind1, ind2, dats[0])
+    _dsp.grid_plan_c(buf, off, wgt, dats[0])
+    assert np.all(buf == ans)
+    # Each slice's image is that of its own grid, recentred
+    out = np.empty((ns, dim, dim), dtype=np.float32)
+    _dsp.snap_images(out, off, wgt, dats, 3, 7, 1)
+    for s in range(ns):
+        grid = np.zeros_like(ans)
+        _dsp.grid2D_c(grid, ind1, ind2, dats[s])
+        img = np.roll(np.roll(np.fft.ifft2(grid).real, -3, axis=0), -7, axis=1)
+        assert np.allclose(out[s], img, atol=1e-6)
+    # Strided slices and more threads change nothing
+    out1 = np.empty_like(out)
+    _dsp.snap_images(out1, off, wgt, dats.T.copy().T, 3, 7, 3)
+    assert np.all(out1 == out)
+    with pytest.raises(ValueError):
+        _dsp.grid_plan_c(np.zeros((dim, dim // 2), dtype=np.complex64), off, wgt, dats[0])
+    with pytest.raises(ValueError):
+        _dsp.snap_images(out, off, wgt, dats[:, :10])
+
+
+def test_img_window():
+    import aipy.img as img
+    rng = np.random.RandomState(7)
+    n = 80
+    ints = []
+    for k in range(8):
+        uvw = rng.uniform(-8, 8, (3, n))
+        data = rng.normal(size=n) + 1j * rng.normal(size=n)
+        flags = rng.uniform(size=n) < 0.1
+        ints.append((10. * k, uvw, data, flags))
+    win = img.ImgWindow(size=16, res=1, mf_order=1, window=25.)
+    for k, (t, uvw, data, flags) in enumerate(ints):
+        win.add(t, uvw, data, [np.ones(n), 0.5 * np.ones(n)], flags=flags)
+        # The matrices are those of the integrations within the window
+        ans = img.Img(size=16, res=1, mf_order=1)
+        for t1, uvw1, data1, flags1 in ints[: k + 1]:
+            if t1 > t - 25:
+                ans.put(uvw1, data1, [np.ones(n), 0.5 * np.ones(n)], flags=flags1)
+        assert win.times() == [i[0] for i in ints[: k + 1] if i[0] > t - 25]
+        assert np.allclose(win.uv, ans.uv, atol=1e-5)
+        assert np.allclose(win.bm[1], ans.bm[1], atol=1e-5)
+    assert np.allclose(win.image((2, 3)), ans.image((2, 3)), atol=1e-6)
+    uvw = ints[-1][1]
+    assert np.allclose(win.get(uvw), ans.get(uvw), rtol=1e-4)
+    # Taking everything out leaves exact zeros
+    win.expire(100.)
+    assert win.times() == []
+    assert np.all(win.uv == 0) and np.all(win.bm[0] == 0)
+    # A negated add cancels to double precision rounding
+    off, wgt = _dsp.grid_plan(rng.uniform(-8, 8, n).astype(np.float32),
+                              rng.uniform(-8, 8, n).astype(np.float32), 16, 16)
+    buf = np.zeros((16, 16), dtype=np.complex128)
+    dat = (rng.normal(size=n) + 1j * rng.normal(size=n)).astype(np.complex64)
+    _dsp.grid_plan_c(buf, off, wgt, dat * 3)
+    base = buf.copy()
+    _dsp.grid_plan_c(buf, off, wgt, dat)
+    _dsp.grid_plan_c(buf, off, wgt, dat, -1)
+    assert np.allclose(buf, base, rtol=0, atol=1e-12)
+    with pytest.raises(ValueError):
+        _dsp.grid_plan_c(np.zeros((16, 16), dtype=np.complex64), off, wgt, dat, -1)
+
+
+@pytest.mark.parametrize("shape", [(32, 32), (24, 18), (15, 9)])
+def test_uv_image(shape):
+    rng = np.random.RandomState(6)
+    uv = (rng.normal(size=shape) + 1j * rng.normal(size=shape)).astype(np.complex64)
+    out = np.empty(shape, dtype=np.float32)
+    _dsp.uv_image(out, uv, 5, -2)
+    ans = np.roll(np.roll(np.fft.ifft2(uv).real, -5, axis=0), 2, axis=1)
+    assert np.allclose(out, ans, atol=1e-6)
+    # Half-plane of a Hermitian plane, as irfft2; threads change nothing
+    half = uv[:, : shape[1] // 2 + 1].astype(np.complex128)
+    out1 = np.empty_like(out)
+    _dsp.uv_image(out, half, 0, 0, 1)
+    _dsp.uv_image(out1, half, 0, 0, 3)
+    assert np.allclose(out, np.fft.irfft2(half, s=shape), atol=1e-6)
+    assert np.all(out == out1)
+    with pytest.raises(ValueError):
+        _dsp.uv_image(out, uv[:, :-1])
+    with pytest.raises(ValueError):
+        _dsp.uv_image(out, uv[:, ::2])
+
+
+@pytest.mark.parametrize("shape", [(1, 7), (97, 211), (300, 1000), (512, 384)])
+def test_uv_image_fft(shape):
+    """The native FFT (radix-2, or Bluestein for other lengths) agrees with
+    numpy's"""
+    rng = np.random.RandomState(7)
+    uv = rng.normal(size=shape) + 1j * rng.normal(size=shape)
+    ans = np.fft.ifft2(uv).real
+    for dtype in (np.complex64, np.complex128):
+        out = np.empty(shape, dtype=np.float32)
+        _dsp.uv_image(out, uv.astype(dtype), 0, 0, 2)
+        err = np.abs(out - ans).max() / np.abs(ans).max()
+        assert err < (1e-5 if dtype == np.complex64 else 1e-6)
+    half = uv[:, : shape[1] // 2 + 1]
+    out = np.empty(shape, dtype=np.float32)
+    _dsp.uv_image(out, half, 0, 0, 2)
+    ans = np.fft.irfft2(half, s=shape)
+    assert np.abs(out - ans).max() < 1e-6 * np.abs(ans).max()
+
+
+def test_rfi_kernels():
+    rng = np.random.RandomState(3)
+    nbl, nt, nc = 3, 64, 128
+    dat = (10 + 0.01 * np.arange(nc) + rng.normal(size=(nbl, nt, nc))).astype(np.float32)
+    dat[:, 10, 50] += 40
+    dat[:, 30] += 2.5
+    mask = np.zeros(dat.shape, dtype=np.bool_)
+    mask[:, 0, 5] = True
+    # The residual is in units of the noise, and 0 where flagged
+    z = np.empty_like(dat)
+    _dsp.rfi_medfilt(z, dat, mask, 2, 8)
+    assert np.all(z[:, 0, 5] == 0)
+    assert np.all(z[:, 10, 50] > 30)
+    assert abs(np.median(np.abs(z)) * 1.4826 - 1) < 0.05
+    # Sigma clipping finds the spike; SumThreshold the weak broadband row too
+    m = mask.copy()
+    _dsp.rfi_sigclip(m, z, 0, 5.0, 5)
+    assert np.all(m[:, 10, 50]) and not np.any(m[:, 30])
+    m = mask.copy()
+    _dsp.rfi_sumthreshold(m, z, 6.0, 32, 1.5, 1)
+    assert np.all(m[:, 10, 50]) and np.all(m[:, 0, 5])
+    assert m[:, 30].mean() > 0.9
+    assert m.sum() - m[:, 30].sum() < 20
+    # Threads change nothing
+    m1 = mask.copy()
+    _dsp.rfi_sumthreshold(m1, z, 6.0, 32, 1.5, 3)
+    assert np.all(m1 == m)
+    with pytest.raises(ValueError):
+        _dsp.rfi_sigclip(mask[:, :, ::2], z)
+    with pytest.raises(ValueError):
+        _dsp.rfi_medfilt(z, dat.astype(np.float64), mask)
+
+
+def test_stats():
+    buf = np.zeros((32, 32), dtype=np.complex64)
+    ind1 = np.array([5, 10.1, 14.5], dtype=np.float32)
+    ind2 = np.array([5, 10.1, 15.5], dtype=np.float32)
+    dat = np.ones(3, dtype=np.complex64)
+    _dsp.stats(enable=False, reset=True)
+    _dsp.grid2D_c(buf, ind1, ind2, dat)
+    assert all(v == 0 for v in _dsp.stats().values())
+    try:
+        _dsp.stats(enable=True)
+        _dsp.grid2D_c(buf, ind1, ind2, dat)
+        _dsp.grid2D_c_mt(buf, ind1, ind2, dat, 6, 2)
+        _dsp.degrid2D_c(buf, ind1, ind2, dat)
+        st = _dsp.stats(reset=True)
+    finally:
+        _dsp.stats(enable=False, reset=True)
+    assert st["grid_calls"] == 2 and st["grid_vis"] == 6 and st["grid_ns"] > 0
+    assert st["degrid_calls"] == 1 and st["degrid_vis"] == 3
+    assert all(v == 0 for v in _dsp.stats().values())
+
+
+def test_closure_kernels():
+    data = np.ones((2, 3, 4), dtype=np.complex64)
+    flags = np.zeros(data.shape, dtype=np.bool_)
+    out = np.empty((2, 1, 4), dtype=np.float32)
+    oflags = np.empty(out.shape, dtype=np.bool_)
+    _dsp.closure_phs(out, oflags, data, flags, np.array([[0, 1, 2]]))
+    assert np.all(out == 0) and not np.any(oflags)
+    with pytest.raises(ValueError):
+        _dsp.closure_phs(out, oflags, data, flags, np.array([[0, 1, 3]]))
+    with pytest.raises(ValueError):
+        _dsp.closure_amp(out, oflags, data, flags, np.array([[0, 1, 2]]))
+    with pytest.raises(ValueError):
+        _dsp.closure_phs(out, oflags, data.astype(np.complex128), flags, np.array([[0, 1, 2]]))
+
+
+@pytest.mark.parametrize("factor,order", [(1, 4), (4, 4), (7, 6)])
+def test_interp_fir(factor, order):
+    # Against the zero-stuffed convolution, row by row
+    import aipy.interp as interp
+    rng = np.random.RandomState(12)
+    ys = rng.normal(size=(5, 300)) + 1j * rng.normal(size=(5, 300))
+    step = 1.0 / factor
+    fir = interp.default_filter(np.arange(-order, order + step, step))
+    ans = []
+    for y in ys:
+        ye = interp.polyextend(y, order)
+        ss, wgts = interp.subsample(ye, factor)
+        ans.append(np.convolve(ss, fir, mode="valid") / np.convolve(wgts, fir, mode="valid"))
+    ans = np.array(ans)
+    out = np.empty(ans.shape, dtype=np.complex128)
+    _dsp.interp_fir(out, ys, fir, factor, order, 2, 3)
+    assert np.allclose(out, ans, rtol=1e-9, atol=1e-9)
+    out1 = np.empty(ans.real.shape)
+    _dsp.interp_fir(out1, ys.real.copy(), fir, factor, order, 2, 1)
+    assert np.allclose(out1, ans.real, rtol=1e-9, atol=1e-9)
+    rv = interp.interpolate(ys.real.reshape(5, 1, 300), factor, order=order)
+    assert rv.shape == (5, 1, ans.shape[1])
+    assert np.allclose(rv[:, 0], ans.real, rtol=1e-9, atol=1e-9)
+    with pytest.raises(ValueError):
+        _dsp.interp_fir(out, ys[:, :order - 1].copy(), fir, factor, order)
+    with pytest.raises(ValueError):
+        _dsp.interp_fir(out[:, 1:], ys, fir, factor, order)
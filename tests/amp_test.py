@@ -168,3 +168,36 @@ def test_passband_Antenna(generate_Antenna):
     assert pb.shape == (3,)
 
     return
+
+
+def test_sim_bls():
+    """Test the native all-baseline simulator against sim"""
+    freqs = np.arange(0.1, 0.2, 0.01)
+    bm = amp.Beam2DGaussian(freqs, 0.5, 0.25)
+    ants = [amp.Antenna(10.0 * k, 3.0 * k * k, 0.5 * k, bm, phsoff=[0.1 * k, 0.2],
+                        bp_r=np.array([0.5 * k, 1]), bp_i=np.array([0.1 * k]), amp=1 + k)
+            for k in range(4)]
+    aa = amp.AntennaArray(("0:00", "30:00"), ants)
+    aa.select_chans([1, 2, 4, 7])
+    aa.set_jultime(2454555.3)
+    srcs = [amp.RadioFixedBody(aa.sidereal_time() + 0.1 * k, aa.lat - 0.05 * k)
+            for k in range(3)]
+    for src in srcs:
+        src.compute(aa)
+    s_eqs = np.array([src.get_crds("eq", ncrd=3) for src in srcs]).transpose()
+    jys = np.outer([1.0, 2.0, 0.5], np.linspace(1, 2, 4))
+    aa.sim_cache(s_eqs, jys, mfreqs=np.array([0.1, 0.15, 0.2]),
+                 ionrefs=(np.array([0.001, 0, -0.002]), np.array([0, 0.001, 0.001])),
+                 srcshapes=(np.array([0.01, 0, 0.02]), np.array([0.005, 0, 0.01]),
+                            np.array([0, 0, 0.3])))
+    bls = [(0, 1), (0, 2), (1, 3), (2, 3), (1, 1)]
+    for pol in ("xx", "xy"):
+        aa.set_active_pol(pol)
+        sims = aa.sim_bls(bls, nthreads=2)
+        assert sims.shape == (len(bls), 4)
+        for k, (i, j) in enumerate(bls):
+            assert np.allclose(sims[k], aa.sim(i, j), rtol=1e-10, atol=1e-12)
+    with pytest.raises(RuntimeError):
+        aa.set_jultime(2454555.4)
+        aa.sim_bls(bls)
+    return
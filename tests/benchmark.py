@@ -0,0 +1,330 @@
+# -*- coding: utf-8 -*-
+"""
+Benchmarks of AIPY's native hot paths on fixed synthetic datasets.  Each
+case is timed over several repeats (set-up, such as copying an array a
+kernel works on in place, is not timed) and reported as its best and
+median time and the rate of work done.  Results are written as JSON, with
+the commit and platform they came from, so runs on different commits can
+be compared:
+
+    python tests/benchmark.py -o before.json
+    (change things)
+    python tests/benchmark.py -o after.json --compare before.json
+
+--compare prints the ratio of the best times for each case run in both,
+and with --fail-above exits nonzero if any case slowed by more than that
+ratio.  -k runs only the cases whose names contain one of the given
+strings; --quick runs small sizes only.
+"""
+
+from __future__ import print_function, division, absolute_import
+
+import argparse
+import json
+import os
+import platform
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+import numpy as np
+
+import aipy
+from aipy import _deconv, _dsp, miriad, utils
+
+RESULTS_VERSION = 1
+BENCHMARKS = []
+
+def benchmark(fn):
+    """Register a generator of cases: fn(quick, tmpdir) yields (name,
+    params, setup, run, items, unit) for each case, where run(setup())
+    does the timed work of `items` units."""
+    BENCHMARKS.append(fn)
+    return fn
+
+# clean
+
+def _clean_data(shape, dtype, seed=1):
+    """A dirty image/spectrum of a few point sources seen through a random
+    sampling, with its kernel."""
+    rng = np.random.RandomState(seed)
+    wgt = (rng.uniform(size=shape) > 0.3).astype(np.float64)
+    src = np.zeros(shape)
+    for k in range(8):
+        src[tuple(rng.randint(0, n) for n in shape)] = rng.uniform(1, 10)
+    im = np.fft.ifftn(np.fft.fftn(src) * wgt)
+    ker = np.fft.ifftn(wgt)
+    if not np.issubdtype(dtype, np.complexfloating): im, ker = im.real, ker.real
+    return im.astype(dtype), ker.astype(dtype)
+
+@benchmark
+def bench_clean(quick, tmpdir):
+    maxiter = 500
+    shapes = [(1024,), (128, 128)] if quick else [(1024,), (16384,), (128, 128), (512, 512)]
+    for shape in shapes:
+        for dtype in (np.float64, np.complex128):
+            im, ker = _clean_data(shape, dtype)
+            for mask in ('full', 'half'):
+                area = np.ones(shape, dtype=np.int_)
+                if mask == 'half': area[..., shape[-1]//2:] = 0
+                def setup(im=im):
+                    return im.copy(), np.zeros_like(im)
+                def run(s, ker=ker, area=area):
+                    _deconv.clean(s[0], ker, s[1], area, gain=.1, maxiter=maxiter,
+                        tol=0., stop_if_div=0)
+                params = {'shape':list(shape), 'dtype':np.dtype(dtype).name,
+                    'area':mask, 'maxiter':maxiter}
+                name = 'clean_%dd_%s_%s_%s' % (len(shape), np.dtype(dtype).name,
+                    'x'.join(map(str, shape)), mask)
+                yield name, params, setup, run, maxiter, 'iter'
+
+# gridding
+
+@benchmark
+def bench_grid(quick, tmpdir):
+    dim = 512
+    nviss = [10**4, 10**5] if quick else [10**4, 10**5, 10**6]
+    for nvis in nviss:
+        rng = np.random.RandomState(2)
+        ind1 = rng.uniform(0, dim, size=nvis).astype(np.float32)
+        ind2 = rng.uniform(0, dim, size=nvis).astype(np.float32)
+        dat = (rng.normal(size=nvis) + 1j * rng.normal(size=nvis)).astype(np.complex64)
+        buf = np.zeros((dim, dim), dtype=np.complex64)
+        _dsp.grid2D_c(buf, ind1, ind2, dat)
+        for footprint in (3, 6):
+            params = {'dim':dim, 'nvis':nvis, 'footprint':footprint}
+            def grid(s, ind1=ind1, ind2=ind2, dat=dat, footprint=footprint):
+                _dsp.grid2D_c(s, ind1, ind2, dat, footprint)
+            yield ('grid2D_c_%d_fp%d' % (nvis, footprint), params,
+                lambda: np.zeros((dim, dim), dtype=np.complex64), grid, nvis, 'vis')
+            def degrid(s, buf=buf, ind1=ind1, ind2=ind2, footprint=footprint):
+                _dsp.degrid2D_c(buf, ind1, ind2, s, footprint)
+            yield ('degrid2D_c_%d_fp%d' % (nvis, footprint), params,
+                lambda nvis=nvis: np.zeros(nvis, dtype=np.complex64), degrid, nvis, 'vis')
+
+# utils
+
+@benchmark
+def bench_add2array(quick, tmpdir):
+    shape = (1024, 1024)
+    ns = [10**5] if quick else [10**5, 10**6, 10**7]
+    for n in ns:
+        for dtype in (np.float32, np.complex64):
+            rng = np.random.RandomState(3)
+            ind = np.column_stack([rng.randint(0, s, size=n) for s in shape]).astype(np.int_)
+            data = rng.uniform(size=n).astype(dtype)
+            def run(a, ind=ind, data=data):
+                utils.add2array(a, ind, data)
+            params = {'shape':list(shape), 'n':n, 'dtype':np.dtype(dtype).name}
+            yield ('add2array_%d_%s' % (n, np.dtype(dtype).name), params,
+                lambda dtype=dtype: np.zeros(shape, dtype=dtype), run, n, 'sample')
+
+# imaging
+
+@benchmark
+def bench_image(quick, tmpdir):
+    shapes = [(256, 256), (300, 300)] if quick else [(256, 256), (300, 300), (1024, 1024), (1000, 1000)]
+    for shape in shapes:
+        rng = np.random.RandomState(5)
+        uv = (rng.normal(size=shape) + 1j * rng.normal(size=shape)).astype(np.complex64)
+        params = {'shape':list(shape)}
+        size = 'x'.join(map(str, shape))
+        out = lambda shape=shape: np.empty(shape, dtype=np.float32)
+        for nthreads in (1, 0):
+            def native(s, uv=uv, nthreads=nthreads):
+                _dsp.uv_image(s, uv, 3, 5, nthreads)
+            yield ('uv_image_%s_t%d' % (size, nthreads), dict(params, nthreads=nthreads),
+                out, native, uv.size, 'pixel')
+        # The numpy path Img.image takes without _dsp
+        def numpy(s, uv=uv):
+            s[:] = aipy.img.recenter(np.fft.ifft2(uv).real.astype(np.float32), (3, 5))
+        yield 'np_ifft2_%s' % size, params, out, numpy, uv.size, 'pixel'
+
+# MIRIAD
+
+def make_uv(filename, ntimes, nants, nchan, pols=(-5, -6), seed=4):
+    """Write a synthetic UV file with every baseline (autos included) of
+    nants antennas and every pol at each of ntimes integrations; return
+    the number of records."""
+    rng = np.random.RandomState(seed)
+    uv = miriad.UV(filename, status='new')
+    for name, typ in (('nchan', 'i'), ('pol', 'i'), ('nants', 'i'), ('lst', 'd'),
+                      ('sdf', 'd'), ('sfreq', 'd'), ('inttime', 'r')):
+        uv.add_var(name, typ)
+    uv['nchan'], uv['nants'], uv['inttime'] = nchan, nants, 10.
+    uv['sdf'], uv['sfreq'] = .1 / nchan, 1.
+    bls = [(i, j) for i in range(nants) for j in range(i, nants)]
+    nper = len(bls) * len(pols)
+    n = ntimes * nper
+    t = np.repeat(2459000.5 + np.arange(ntimes) * 10. / 86400, nper)
+    ij = np.tile(np.repeat(np.array(bls), len(pols), axis=0), (ntimes, 1))
+    pol = np.tile(pols, ntimes * len(bls))
+    data = (rng.normal(size=(n, nchan)) + 1j * rng.normal(size=(n, nchan))).astype(np.complex64)
+    flags = rng.uniform(size=(n, nchan)) < .05
+    uv.write_block(rng.normal(size=(n, 3)), t, ij, data, flags,
+        vars={'pol':pol, 'lst':(t % 1) * 2 * np.pi})
+    del uv
+    return n
+
+def _fresh(path):
+    if os.path.exists(path): shutil.rmtree(path)
+    return path
+
+@benchmark
+def bench_uv(quick, tmpdir):
+    nchan, nants, ntimes = (256, 8, 10) if quick else (1024, 16, 20)
+    src = os.path.join(tmpdir, 'bench_src.uv')
+    nrec = make_uv(_fresh(src), ntimes, nants, nchan)
+    mb = nrec * nchan * 8 / 1e6
+    params = {'nrec':nrec, 'nchan':nchan}
+    uv = miriad.UV(src)
+    uvw, t, ij, data, flags, v = uv.read_block(nrec, vars=['pol'])
+    del uv
+    dst = os.path.join(tmpdir, 'bench_dst.uv')
+    # The file is closed, flushing it, when the last reference goes inside
+    # the timed run
+    def new_uv():
+        uv = miriad.UV(_fresh(dst), status='new')
+        uv.add_var('nchan', 'i')
+        uv.add_var('pol', 'i')
+        uv['nchan'] = nchan
+        return [uv]
+    def write(s):
+        uv = s.pop()
+        for n in range(nrec):
+            uv['pol'] = int(v['pol'][n])
+            uv.write((uvw[n], t[n], (int(ij[n,0]), int(ij[n,1]))), data[n], flags[n])
+        del uv
+    yield 'uv_write', params, new_uv, write, mb, 'MB'
+    def write_block(s):
+        uv = s.pop()
+        uv.write_block(uvw, t, ij, data, flags, vars={'pol':v['pol']})
+        del uv
+    yield 'uv_write_block', params, new_uv, write_block, mb, 'MB'
+    def read(uv):
+        for p, d, f in uv.all(raw=True): pass
+    yield 'uv_read', params, lambda: miriad.UV(src), read, mb, 'MB'
+    def read_block(uv):
+        while len(uv.read_block(4096)[1]) > 0: pass
+    yield 'uv_read_block', params, lambda: miriad.UV(src), read_block, mb, 'MB'
+
+@benchmark
+def bench_read_files(quick, tmpdir):
+    nfiles, nchan, nants, ntimes = (2, 256, 8, 10) if quick else (4, 1024, 16, 20)
+    files = [os.path.join(tmpdir, 'bench_rf%d.uv' % k) for k in range(nfiles)]
+    nrec = sum([make_uv(_fresh(f), ntimes, nants, nchan, seed=k) for k, f in enumerate(files)])
+    mb = nrec * nchan * 8 / 1e6
+    for antstr in ('all', 'cross'):
+        params = {'nfiles':nfiles, 'nrec':nrec, 'nchan':nchan, 'ants':antstr, 'pol':'xx'}
+        def run(s, antstr=antstr):
+            miriad.read_files(files, antstr, 'xx')
+        yield 'read_files_%s' % antstr, params, lambda: None, run, mb, 'MB'
+
+# phasing
+
+@benchmark
+def bench_gen_phs(quick, tmpdir):
+    freqs = np.arange(.1, .2, .0001)
+    beam = aipy.fit.Beam(freqs)
+    ants = [aipy.fit.Antenna(x, y, 0, beam) for x, y in ((0, 0), (0, 100), (100, 0), (100, 100))]
+    aa = aipy.fit.AntennaArray(('45:00', '90:00'), ants)
+    aa.set_jultime(2455400.1)
+    for nsrc in (1, 100):
+        s_eqs = np.array([[0, 1, 0]] * nsrc).transpose()
+        def run(s, s_eqs=s_eqs):
+            aa.gen_phs(s_eqs, 0, 1)
+        yield ('gen_phs_%d' % nsrc, {'nsrc':nsrc, 'nchan':len(freqs)},
+            lambda: None, run, nsrc * len(freqs), 'phasor')
+
+# driver
+
+def time_case(setup, run, repeat, min_time):
+    """Best and median time of run(setup()) over at least repeat runs (and
+    at least min_time seconds of them), and the number of runs."""
+    times = []
+    while len(times) < repeat or (sum(times) < min_time and len(times) < 100 * repeat):
+        s = setup()
+        t0 = time.perf_counter() if hasattr(time, 'perf_counter') else time.time()
+        run(s)
+        t1 = time.perf_counter() if hasattr(time, 'perf_counter') else time.time()
+        times.append(t1 - t0)
+        del s
+    return min(times), float(np.median(times)), len(times)
+
+def run_info():
+    """Where the results came from: versions, platform and commit."""
+    try:
+        commit = subprocess.check_output(['git', 'rev-parse', 'HEAD'],
+            cwd=os.path.dirname(os.path.abspath(__file__)),
+            stderr=subprocess.STDOUT).decode().strip()
+    except(Exception): commit = None
+    return {'version':RESULTS_VERSION, 'aipy':aipy.__version__, 'commit':commit,
+        'python':platform.python_version(), 'numpy':np.__version__,
+        'platform':platform.platform(), 'machine':platform.machine(),
+        'cpus':os.cpu_count() if hasattr(os, 'cpu_count') else None,
+        'date':time.strftime('%Y-%m-%dT%H:%M:%S')}
+
+def run_benchmarks(keys=None, quick=False, repeat=5, min_time=.2, verbose=True):
+    """Run the registered cases (those whose names contain one of keys, if
+    given) and return the results as a JSON-ready dict."""
+    results = []
+    tmpdir = tempfile.mkdtemp(prefix='aipy_bench')
+    try:
+        for fn in BENCHMARKS:
+            for name, params, setup, run, items, unit in fn(quick, tmpdir):
+                if keys and not any([k in name for k in keys]): continue
+                best, median, n = time_case(setup, run, repeat, min_time)
+                results.append({'name':name, 'params':params, 'best':best,
+                    'median':median, 'repeat':n, 'items':items, 'unit':unit,
+                    'rate':items / best if best > 0 else None})
+                if verbose:
+                    print('%-36s %10.3f ms %10.3f ms  %12.4g %s/s' % (name,
+                        best * 1e3, median * 1e3, items / max(best, 1e-12), unit))
+                    sys.stdout.flush()
+    finally: shutil.rmtree(tmpdir, ignore_errors=True)
+    rv = run_info()
+    rv.update({'quick':quick, 'results':results})
+    return rv
+
+def compare(new, old):
+    """Print old/new ratios of the best times of the cases in both; return
+    {name: new best / old best}."""
+    prev = dict([(r['name'], r) for r in old['results']])
+    ratios = {}
+    print('%-36s %10s %10s %8s  (vs %s)' % ('case', 'old ms', 'new ms', 'speedup',
+        old.get('commit')))
+    for r in new['results']:
+        if not r['name'] in prev: continue
+        o = prev[r['name']]['best']
+        ratios[r['name']] = r['best'] / o if o > 0 else float('inf')
+        print('%-36s %10.3f %10.3f %8.2fx' % (r['name'], o * 1e3, r['best'] * 1e3,
+            o / r['best'] if r['best'] > 0 else float('inf')))
+    return ratios
+
+def main(args=None):
+    parser = argparse.ArgumentParser(description='Benchmark native AIPY hot paths.')
+    parser.add_argument('-o', '--output', help='Write the results to this JSON file.')
+    parser.add_argument('-k', '--key', action='append', default=[],
+        help='Only run cases whose names contain this; may be repeated.')
+    parser.add_argument('-r', '--repeat', type=int, default=5,
+        help='Least number of timed runs per case.  Default 5.')
+    parser.add_argument('--min-time', type=float, default=.2,
+        help='Least total seconds of timed runs per case.  Default .2.')
+    parser.add_argument('--quick', action='store_true', help='Small sizes only.')
+    parser.add_argument('--compare', help='Compare with the results in this JSON file.')
+    parser.add_argument('--fail-above', type=float, default=None,
+        help='With --compare, exit 1 if a case is this many times slower.')
+    opts = parser.parse_args(args)
+    res = run_benchmarks(opts.key, opts.quick, opts.repeat, opts.min_time)
+    if opts.output:
+        with open(opts.output, 'w') as fh: json.dump(res, fh, indent=1, sort_keys=True)
+    if opts.compare:
+        with open(opts.compare) as fh: ratios = compare(res, json.load(fh))
+        if opts.fail_above is not None and any([v > opts.fail_above for v in ratios.values()]):
+            return 1
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -40,11 +40,97 @@ def test_clean(init_deconv):
     return
 
 
+def test_clean_clark(init_deconv):
+    """Test that Clark clean runs and agrees with Hoegbom clean"""
+    data, bm = init_deconv
+    score0 = np.sqrt(np.average(data ** 2))
+    cln1, info1 = aipy.deconv.clean(data, bm, maxiter=2000, verbose=False)
+    cln2, info2 = aipy.deconv.clean(data, bm, maxiter=2000, algorithm='clark')
+    assert info2['term'] in ('tol', 'maxiter', 'divergence')
+    assert 0 < info2['iter'] <= 2000
+    # The minor cycles add components, with about the flux Hoegbom finds
+    assert np.count_nonzero(cln2) > 0
+    assert np.abs(cln2.sum() - cln1.sum()) < 0.1 * np.abs(cln1.sum())
+    assert info2['score'] < score0
+    assert info2['score'] < 2 * info1['score']
+    # The residual is exact after the final major cycle
+    res = data - np.fft.ifft2(np.fft.fft2(cln2) * np.fft.fft2(bm)).real
+    assert np.allclose(info2['res'], res)
+    with pytest.raises(ValueError):
+        aipy.deconv.clean(data, bm, algorithm='nope')
+
+    return
+
+
+def test_clean_clark_gaussian(init_deconv):
+    """Test that Clark clean converges with a beam peaked at its centre"""
+    data, bm = init_deconv
+    bm = aipy.img.gaussian_beam(2, shape=data.shape)
+    img = np.zeros(data.shape)
+    img[10, 10] = 10
+    img[20:25, 20:25] = 1
+    data = np.fft.ifft2(np.fft.fft2(img) * np.fft.fft2(bm)).real
+    score0 = np.sqrt(np.average(data ** 2))
+    cln, info = aipy.deconv.clean(data, bm, maxiter=2000, algorithm='clark')
+    assert np.count_nonzero(cln) > 0
+    assert info['score'] < 0.2 * score0
+    # Any one cycle's area would leave out the beam centre
+    area = np.ones(data.shape, dtype=np.int_)
+    area[0, 0] = 0
+    cln, info = aipy.deconv.clean(data, bm, area=area, maxiter=2000,
+                                  algorithm='clark')
+    assert np.count_nonzero(cln) > 0
+
+    return
+
+
+def test_clean_multiscale(init_deconv):
+    """Test that multi-scale clean runs and reduces the residual"""
+    data, bm = init_deconv
+    score0 = np.sqrt(np.average(data ** 2))
+    cln, info = aipy.deconv.clean(data, bm, maxiter=500, algorithm='multiscale',
+                                  scales=(0, 2, 4))
+    assert info['score'] < 0.1 * score0
+    res = data - np.fft.ifft2(np.fft.fft2(cln) * np.fft.fft2(bm)).real
+    assert np.allclose(info['res'], res)
+    with pytest.raises(ValueError):
+        aipy.deconv.clean(data.astype(np.complex64), bm.astype(np.complex64),
+                          algorithm='multiscale')
+
+    return
+
+
+def test_cotton_schwab():
+    """Test that Cotton-Schwab major cycles reduce the residual"""
+    im = aipy.img.Img(size=50, res=0.5)
+    u = np.random.uniform(-20, 20, size=500)
+    v = np.random.uniform(-20, 20, size=500)
+    uvw, data = im.append_hermitian((u, v, np.zeros_like(u)),
+                                    np.ones(u.shape, dtype=np.complex64))
+    im.put(uvw, data)
+    dirty = im.image()
+    mdl, info = aipy.deconv.cotton_schwab(im, uvw, data, ncycles=3, maxiter=500)
+    assert 1 <= info['cycles'] <= 3
+    assert info['res'].shape == dirty.shape
+    assert info['res_data'].shape == data.shape
+    assert info['score'] < np.sqrt(np.average(dirty ** 2))
+    assert np.abs(info['res_data']).mean() < 1
+
+    return
+
+
 def test_lsq(init_deconv):
     """Test that least squared deconvolution runs"""
     data, bm = init_deconv
     cln, info = aipy.deconv.lsq(data, bm, verbose=False)
-    assert True
+    assert info['term'] in ('maxiter', 'tol') and info['res'].shape == data.shape
+    # A stack gives what each image alone does
+    clns, infos = aipy.deconv.lsq(np.array([data, 0.5 * data]), bm, nthreads=2)
+    assert np.allclose(clns[0], cln) and np.allclose(infos['res'][0], info['res'])
+    assert infos['iter'][0] == info['iter'] and len(infos['term']) == 2
+    # Single precision images get single precision results
+    cln32, info32 = aipy.deconv.lsq(data.astype(np.float32), bm)
+    assert cln32.dtype == np.float32 and info32['res'].dtype == np.float32
 
     return
 
@@ -53,7 +139,11 @@ def test_mem(init_deconv):
     """Test the maximum entropy deconvolution runs"""
     data, bm = init_deconv
     cln, info = aipy.deconv.maxent(data, bm, np.var(data ** 2) * 0.5, verbose=False)
-    assert True
+    assert cln.dtype == data.dtype and info['res'].dtype == data.dtype
+    # Single precision images get single precision results
+    cln32, info32 = aipy.deconv.maxent(data.astype(np.float32), bm,
+                                       np.var(data ** 2) * 0.5, maxiter=5)
+    assert cln32.dtype == np.float32 and info32['res'].dtype == np.float32
 
     return
 
@@ -62,6 +152,61 @@ def test_anneal(init_deconv):
     """Test that simulated annealing deconvolution runs"""
     data, bm = init_deconv
     cln, info = aipy.deconv.anneal(data, bm, verbose=False)
-    assert True
+    assert cln.dtype == data.dtype and info['res'].dtype == data.dtype
+    # Single precision images get single precision results
+    cln32, info32 = aipy.deconv.anneal(data.astype(np.float32), bm, maxiter=5)
+    assert cln32.dtype == np.float32 and info32['res'].dtype == np.float32
+
+    return
+
+
+def test_delay_filter():
+    """Test the native delay filter against numpy and clean"""
+    rng = np.random.RandomState(4)
+    nchan = 96
+    fq = np.arange(nchan)
+    # Smooth foregrounds plus noise, with a few channels flagged
+    data = np.array([(1 + 0.5 * k) * np.exp(0.2j * np.pi * fq / nchan) for k in range(5)])
+    data += 0.01 * (rng.normal(size=data.shape) + 1j * rng.normal(size=data.shape))
+    wgts = np.ones(data.shape)
+    wgts[:, [10, 11, 50]] = 0
+    wgts[3] = 0
+    win = aipy.dsp.gen_window(nchan, 'blackman-harris')
+    mdl, res, info = aipy.deconv.delay_filter(data, wgts, 4, window='blackman-harris',
+        maxiter=1000, nthreads=2)
+    assert info['iter'][3] == 0 and np.all(mdl[3] == 0) and np.all(res[3] == 0)
+    area = np.zeros(nchan, dtype=np.int_)
+    area[:5] = area[-4:] = 1
+    for k in (0, 2, 4):
+        ker = np.fft.ifft(wgts[k] * win)
+        cmp, cinfo = aipy.deconv.clean(np.fft.ifft(data[k] * wgts[k] * win), ker,
+            area=area, tol=1e-9, maxiter=1000, stop_if_div=False)
+        assert np.allclose(mdl[k], np.fft.fft(cmp), atol=1e-9)
+        assert np.allclose(res[k], (data[k] - mdl[k]) * wgts[k])
+    # Away from the band edges, where the window is small, the foreground
+    # is removed down to the noise
+    assert np.abs(res[0, 20:-20]).max() < 0.1
+    # Shared weights and a single spectrum give the same model
+    mdl1, res1, info1 = aipy.deconv.delay_filter(data[0], wgts[0], area, window=win,
+        maxiter=1000)
+    assert np.allclose(mdl1, mdl[0], atol=1e-12)
+
+    return
+
+
+def test_clean_stats(init_deconv):
+    """Test the clean counters"""
+    data, bm = init_deconv
+    aipy._deconv.stats(enable=False, reset=True)
+    try:
+        aipy._deconv.stats(enable=True)
+        mdl, info = aipy.deconv.clean(data, bm, maxiter=50)
+        st = aipy._deconv.stats(reset=True)
+    finally:
+        aipy._deconv.stats(enable=False, reset=True)
+    assert st["clean_calls"] == 1 and st["clean_planes"] == 1
+    assert st["clean_iter"] == info["iter"]
+    assert st["clean_ns"] > 0
+    assert all(v == 0 for v in aipy._deconv.stats().values())
 
     return
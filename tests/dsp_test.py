@@ -11,3 +11,36 @@ def test_kaiser2():
     assert np.allclose(win[0], 0.01147993)
     assert np.allclose(win[1], 0.01192681)
     assert np.allclose(win[2], 0.01238142)
+
+
+def test_closure():
+    # Antenna gains cancel out of closure quantities; flags propagate
+    rng = np.random.RandomState(8)
+    nant, nt, npol, nc = 6, 3, 2, 40
+    ij = np.array([(i, j) for i in range(nant) for j in range(i, nant) if (i, j) != (1, 4)],
+                  dtype=np.int32)
+    g = rng.normal(size=(nant, nc)) + 1j * rng.normal(size=(nant, nc))
+    data = np.array([[[g[i] * np.conj(g[j])] * npol for i, j in ij]] * nt).astype(np.complex64)
+    flags = np.zeros(data.shape, dtype=np.bool_)
+    flags[1, 2, 0, 7] = True
+    ants, tri = dsp.closure_triangles(ij)
+    assert len(tri) == 20 - 4
+    assert all((1, 4) not in [(a, b), (b, c), (a, c)] for a, b, c in ants)
+    assert np.all(ij[tri[:, 0], 0] == ants[:, 0]) and np.all(ij[tri[:, 2], 1] == ants[:, 2])
+    phs, pf = dsp.closure_phases(data, tri, flags)
+    assert phs.shape == (nt, len(tri), npol, nc) and phs.dtype == np.float32
+    assert np.all(pf == np.any(flags[:, tri], axis=2))
+    assert np.all(np.abs(phs) < 1e-4) and np.all(phs[pf] == 0)
+    ants, quad = dsp.closure_quads(ij)
+    assert len(quad) == 2 * (15 - 6)
+    amp, af = dsp.closure_amps(np.ma.array(data, mask=flags), quad)
+    assert np.allclose(amp[~af], 1, rtol=1e-4)
+    assert np.all(af == np.any(flags[:, quad], axis=2))
+    # A phase on (0,1), baseline 1 after (0,0), shows in all its triangles;
+    # threads change nothing
+    data[:, 1] *= np.exp(0.5j)
+    phs1, _ = dsp.closure_phases(data, tri, flags, nthreads=1)
+    phs3, _ = dsp.closure_phases(data, tri, flags, nthreads=3)
+    assert np.all(phs1 == phs3)
+    has0 = tri[:, 0] == 1
+    assert np.allclose(phs1[:, has0][~pf[:, has0]], 0.5, atol=1e-4)
@@ -0,0 +1,51 @@
+# -*- coding: utf-8 -*-
+# Copyright (c) 2018 Aaron Parsons
+# Licensed under the GPLv3
+
+import subprocess
+import sys
+
+import pytest
+
+
+def _loaded(code):
+    """Names of the modules in sys.modules after running code in a fresh
+    interpreter"""
+    code += "\nimport sys\nprint(' '.join(sys.modules))"
+    out = subprocess.check_output([sys.executable, "-c", code])
+    return set(out.decode().split())
+
+
+def test_import_is_lazy():
+    mods = _loaded("import aipy")
+    for name in ("numpy", "scipy", "ephem", "healpy", "aipy.img", "aipy._src"):
+        assert name not in mods
+
+
+def test_num_threads_is_light():
+    mods = _loaded("import aipy\naipy.set_num_threads(aipy.get_num_threads())")
+    assert "aipy._pool" in mods
+    for name in ("numpy", "aipy._dsp", "aipy._deconv", "aipy.utils"):
+        assert name not in mods
+
+
+def test_miriad_only():
+    mods = _loaded("from aipy import miriad")
+    assert "aipy._miriad" in mods
+    for name in ("scipy", "ephem", "healpy", "aipy.fit", "aipy._src"):
+        assert name not in mods
+
+
+def test_lazy_attributes():
+    import aipy
+    assert aipy.const.c > 0
+    assert aipy.optimize is sys.modules["scipy.optimize"]
+    assert "_src" in dir(aipy)
+    with pytest.raises(AttributeError):
+        aipy.no_such_module
+    assert aipy._src.misc.src_data["Sun"][2] > 0
+    assert "nvss" in dir(aipy._src)
+    with pytest.raises(AttributeError):
+        aipy._src.no_such_catalog
+    cat = aipy.src.get_catalog(srcs=["cyg"], catalogs=["misc", "no_such_catalog"])
+    assert list(cat.keys()) == ["cyg"]
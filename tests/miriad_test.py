@@ -2,6 +2,8 @@
 # Copyright (c) 2010 Aaron Parsons
 # Licensed under the GPLv3
 
+import os
+
 import pytest
 import numpy as np
 
@@ -59,6 +61,25 @@ def test_maxchan():
     return
 
 
+def test_bl2ij_arrays():
+    """Test the array forms of bl2ij and ij2bl against the scalar ones"""
+    i = np.array([0, 3, 7, 254, 0, 300, 1500, 2000])
+    j = np.array([1, 3, 2, 254, 255, 2, 1600, 2046])
+    bl = miriad.ij2bl(i, j)
+    assert bl.dtype == np.int64 and bl.shape == i.shape
+    assert list(bl) == [miriad.ij2bl(int(a), int(b)) for a, b in zip(i, j)]
+    for b in (bl, bl.astype(np.float64), list(bl)):
+        ii, jj = miriad.bl2ij(b)
+        assert ii.dtype == np.int32
+        assert [(int(x), int(y)) for x, y in zip(ii, jj)] == \
+            [miriad.bl2ij(int(x)) for x in bl]
+    # Encoding orders each pair; shapes are kept and broadcast
+    ii, jj = miriad.bl2ij(bl.reshape((2, 4)))
+    assert ii.shape == (2, 4) and np.all(ii <= jj)
+    assert np.all(miriad.ij2bl(0, np.arange(3)) == [miriad.ij2bl(0, k) for k in range(3)])
+    return
+
+
 def test_immediate_corr(test_file_r):
     """Test immediate corr of a Miriad UV file"""
     filename1, filename2, data = test_file_r
@@ -74,6 +95,39 @@ def test_vartable_r(test_file_r):
     assert uv1.vartable["corr"] == "r"
     assert uv1.vartable["nchan"] == "i"
     assert uv1.vartable["pol"] == "i"
+    assert uv1.vartable == uv1._gen_vartable()
+    # Variables of the first record are there before the first read
+    assert uv1["pol"] == -5 and uv1.nchan == 4
+    preamble, d = uv1.read()
+    assert uv1["pol"] == -5 and np.all(d == data)
+    return
+
+
+def test_items_r(test_file_r):
+    """Test listing and reading header items in a Miriad UV file"""
+    filename1, filename2, data = test_file_r
+    history = "".join(["line %d of a long history\n" % k for k in range(2000)])
+    uv = miriad.UV(filename2, status="new")
+    uv["history"] = history
+    uv["interval"] = 0.25
+    uv["nchan0"] = 7
+    uv.add_var("nchan", "i")
+    uv["nchan"] = 4
+    uv.write((np.zeros(3), 12345.6789, (0, 1)), data)
+    del uv
+    uv = miriad.UV(filename2)
+    items = uv.items()
+    for k in ("history", "vartable", "obstype", "interval", "nchan0"):
+        assert k in items
+    assert "leakage" not in items
+    assert uv["history"] == history
+    assert uv["interval"] == 0.25 and uv["nchan0"] == 7
+    h = uv.haccess("interval", "read")
+    t, offset = _miriad.hread_init(h)
+    assert t == "d"
+    v = _miriad.hread_array(h, "d", offset)
+    _miriad.hdaccess(h)
+    assert v.dtype == np.float64 and list(v) == [0.25]
     return
 
 
@@ -100,6 +154,924 @@ def test_data_r(test_file_r):
     return
 
 
+def test_read_block_r(test_file_r):
+    """Test reading a block of records from a Miriad UV file"""
+    filename1, filename2, data = test_file_r
+    uv = miriad.UV(filename1)
+    uvw, t, ij, d, f, v = uv.read_block(5, vars=["pol"])
+    assert len(t) == 2
+    assert uvw.shape == (2, 3) and d.shape == (2, 4) and f.shape == (2, 4)
+    assert np.allclose(uvw, np.array([1, 2, 3], dtype=np.float64))
+    assert np.allclose(t, 12345.6789)
+    assert np.all(ij == [0, 1])
+    assert np.all(v["pol"] == [-5, -6])
+    for k in range(2):
+        assert np.allclose(d[k], data.data)
+        assert np.all(f[k] == data.mask)
+    assert f.dtype == np.bool_
+    # Raw flags, int32 or bool, valid where true unless masked
+    for dtype, masked in ((np.int32, False), (np.int32, True), (np.bool_, False)):
+        uv.rewind()
+        uvw, t, ij = np.empty((2, 3)), np.empty(2), np.empty((2, 2), dtype=np.int32)
+        d, f = np.empty((2, 4), dtype=np.complex64), np.empty((2, 4), dtype=dtype)
+        assert uv.raw_read_block(uvw, t, ij, d, f, None, masked) == 2
+        assert np.all(f.astype(np.bool_) == (data.mask if masked else ~data.mask))
+    # The end of the file gives an empty block
+    uvw, t, ij, d, f, v = uv.read_block(5)
+    assert len(t) == 0 and d.shape == (0, 4)
+    with pytest.raises(ValueError):
+        uv.raw_read_block(uvw, t, ij, d.astype(np.complex128), f.astype(np.int32))
+    return
+
+
+def test_write_block_r(test_file_r):
+    """Test writing a block of records to a Miriad UV file"""
+    filename1, filename2, data = test_file_r
+    uv = miriad.UV(filename2, status="new")
+    uv.add_var("nchan", "i")
+    uv.add_var("pol", "i")
+    uv["nchan"] = 4
+    n = 6
+    uvw = np.arange(3 * n, dtype=np.float64).reshape((n, 3))
+    t = 12345.6789 + np.arange(n)
+    ij = np.array([(0, 1), (0, 2), (1, 2)] * 2)
+    d = np.outer(np.arange(1, n + 1), data.data).astype(np.complex64)
+    f = np.tile(data.mask, (n, 1))
+    pol = np.array([-5, -5, -5, -6, -6, -6])
+    uv.write_block(uvw, t, ij, d, f, vars={"pol": pol})
+    with pytest.raises(ValueError):
+        uv.write_block(uvw, t, ij, d, f, vars={"nosuchvar": pol})
+    del uv
+    uv = miriad.UV(filename2)
+    uvw2, t2, ij2, d2, f2, v = uv.read_block(n + 1, vars=["pol"])
+    assert len(t2) == n
+    assert np.allclose(uvw2, uvw) and np.allclose(t2, t)
+    assert np.all(ij2 == ij) and np.all(v["pol"] == pol)
+    assert np.allclose(d2, d) and np.all(f2 == f)
+    return
+
+
+def test_stream_write_r(test_file_r):
+    """Test writing items that outgrow their i/o buffers several times"""
+    filename1, filename2, data = test_file_r
+    uv = miriad.UV(filename2, status="new")
+    uv.add_var("nchan", "i")
+    uv.add_var("pol", "i")
+    uv["nchan"] = 100
+    n = 4000
+    uvw = np.arange(3 * n, dtype=np.float64).reshape((n, 3))
+    t = 12345.6789 + np.arange(n) // 10
+    ij = np.array([(0, 1), (0, 2), (1, 2), (2, 2)] * (n // 4))
+    d = (np.arange(n * 100) + 1j).astype(np.complex64).reshape((n, 100))
+    f = (np.arange(n * 100) % 7 == 0).reshape((n, 100))
+    pol = np.repeat([-5, -6], n // 2)
+    uv.write_block(uvw, t, ij, d, f, vars={"pol": pol})
+    del uv
+    uv = miriad.UV(filename2)
+    uvw2, t2, ij2, d2, f2, v = uv.read_block(n, vars=["pol"])
+    assert len(t2) == n
+    assert np.allclose(uvw2, uvw) and np.allclose(t2, t)
+    assert np.all(ij2 == ij) and np.all(v["pol"] == pol)
+    assert np.all(d2 == d) and np.all(f2 == f)
+    return
+
+
+def test_to_cube_r(test_file_r):
+    """Test reading a Miriad UV file into a dense (time, bl, pol, chan) cube"""
+    filename1, filename2, data = test_file_r
+    uv = miriad.UV(filename2, status="new")
+    uv.add_var("nchan", "i")
+    uv.add_var("pol", "i")
+    uv["nchan"] = 4
+    uvw = np.array([1, 2, 3], dtype=np.float64)
+    written = {}
+    for n in (1, 0, 2):
+        for i, j in ((1, 2), (0, 1)):
+            for p in (-6, -5):
+                # One missing record, which must come back flagged
+                if (n, i, p) == (2, 1, -5): continue
+                uv["pol"] = p
+                d = np.ma.array(data.data + 10 * n + 1j * i, mask=[0, j == 2, 1, 0])
+                uv.write((uvw, 12345.5 + n, (i, j)), d)
+                written[(n, i, j, p)] = d
+    del uv
+    uv = miriad.UV(filename2)
+    d, f, t, ij, pols = uv.to_cube()
+    assert d.shape == f.shape == (3, 2, 2, 4) and d.dtype == np.complex64
+    assert np.allclose(t, 12345.5 + np.arange(3))
+    assert np.all(ij == [(0, 1), (1, 2)]) and np.all(pols == [-6, -5])
+    for n in range(3):
+        for b, (i, j) in enumerate(ij):
+            for k, p in enumerate(pols):
+                w = written.get((n, i, j, p))
+                if w is None:
+                    assert np.all(f[n, b, k]) and np.all(d[n, b, k] == 0)
+                else:
+                    assert np.allclose(d[n, b, k], w.data)
+                    assert np.all(f[n, b, k] == w.mask)
+    # The file is left rewound
+    (uvw2, t2, ij2), d2 = uv.read()
+    assert t2 == 12345.5 + 1
+    return
+
+
+def test_read_average_r(test_file_r):
+    """Test averaging a Miriad UV file in time and frequency while reading"""
+    filename1, filename2, data = test_file_r
+    uv = miriad.UV(filename2, status="new")
+    uv.add_var("nchan", "i")
+    uv.add_var("pol", "i")
+    uv["nchan"] = 4
+    t0 = 12345.5
+    for n in range(5):
+        for i, j in ((0, 1), (1, 2)):
+            for p in (-5, -6):
+                uv["pol"] = p
+                d = np.ma.array(np.arange(4) + 10 * n + 1j * p, mask=[n == 0, 0, 1, 1])
+                uv.write((np.array([n, 0, i], dtype=np.float64), t0 + n, (i, j)), d)
+    del uv
+    uv = miriad.UV(filename2)
+    with pytest.raises(RuntimeError):
+        uv.read_average(1)
+    uv.set_average(nt=2, nchan=2)
+    recs = []
+    while True:
+        r = uv.read_average(3)
+        if len(r[1]) == 0: break
+        assert len(r[1]) <= 3
+        recs.append(r)
+    uvw, t, ij, pol, d, f, w = [np.concatenate(x) for x in zip(*recs)]
+    # Bins of two integrations (the last one short), four averages each
+    assert np.allclose(t, np.repeat(t0 + np.array([0.5, 2.5, 4]), 4))
+    assert np.allclose(uvw[:, 0], np.repeat([0.5, 2.5, 4], 4))
+    assert np.allclose(uvw[:, 2], ij[:, 0])
+    assert np.all(ij == [(0, 1), (0, 1), (1, 2), (1, 2)] * 3)
+    assert np.all(pol == [-5, -6] * 6)
+    assert np.all(f[:, 1]) and np.all(w[:, 1] == 0) and np.all(d[:, 1] == 0)
+    assert not np.any(f[:, 0]) and np.all(w[:, 0] == [3] * 4 + [4] * 4 + [2] * 4)
+    # Channel 0 of bin 0 averages channel 1 of n=0 with channels 0 and 1 of n=1
+    assert np.allclose(d[:4, 0].real, 22 / 3.0)
+    assert np.allclose(d[4:8, 0].real, 25.5)
+    assert np.allclose(d[8:, 0].real, 40.5)
+    assert np.allclose(d[:, 0].imag, pol)
+    # A rewind starts over
+    uv.rewind()
+    assert np.allclose(uv.read_average(1)[1], t0 + 0.5)
+    return
+
+
+def test_seek_time_r(test_file_r):
+    """Test seeking by time through the record index"""
+    import os
+
+    filename1, filename2, data = test_file_r
+    uv = miriad.UV(filename2, status="new")
+    uv.add_var("nchan", "i")
+    uv.add_var("pol", "i")
+    uv.add_var("lst", "d")
+    uv["nchan"] = 4
+    uvw = np.array([1, 2, 3], dtype=np.float64)
+    t0 = 2459000.5
+    for k in range(40):
+        uv["lst"] = 0.01 * k
+        for p in range(3):
+            uv["pol"] = -5 - p
+            uv.write((uvw, t0 + k / 86400.0, (0, p)), data * (k + 1))
+    del uv
+
+    uv = miriad.UV(filename2)
+    ref = [(p, d, uv["pol"], uv["lst"]) for p, d in uv.all()]
+    for opened in range(2):
+        uv = miriad.UV(filename2)
+        for k in (33, 0, 17, 16, 39, 5):
+            uv.seek_time(t0 + (k - 0.5) / 86400.0)
+            for r in range(3 * k, min(3 * k + 7, len(ref))):
+                p, d = uv.read()
+                assert p[1] == ref[r][0][1] and p[2] == ref[r][0][2]
+                assert np.all(d == ref[r][1])
+                assert uv["pol"] == ref[r][2] and uv["lst"] == ref[r][3]
+        uv.seek_time(t0 + 1)
+        with pytest.raises(IOError):
+            uv.read()
+        # Seeking never writes to the data set; write_index keeps the
+        # index for the next open
+        if opened == 0:
+            assert not os.path.exists(os.path.join(filename2, "visindex"))
+            uv.write_index()
+        assert os.path.exists(os.path.join(filename2, "visindex"))
+    # Selecting does not move the read position, so records before the
+    # time range matching a later 'or' group still come back
+    t1, t2 = t0 + 9.5 / 86400.0, t0 + 12.5 / 86400.0
+    uv = miriad.UV(filename2)
+    uv.select("time", t1, t2)
+    uv.select("or", -1, -1)
+    uv.select("antennae", 0, 2)
+    got = [p[1] for p, d in uv.all()]
+    ans = [q[1] for q, d, pol, lst in ref if t1 <= q[1] <= t2 or q[2] == (0, 2)]
+    assert np.allclose(got, ans)
+    # An explicit forward seek skips what a lone time range discards
+    uv = miriad.UV(filename2)
+    uv.select("time", t1, t2)
+    uv.seek_time(t1, 1)
+    got = [p[1] for p, d in uv.all()]
+    assert np.allclose(got, [ref[r][0][1] for r in range(30, 39)])
+    return
+
+
+def test_decimate_r(test_file_r):
+    """Test decimation together with other selections"""
+    filename1, filename2, data = test_file_r
+    uv = miriad.UV(filename2, status="new")
+    uv.add_var("nchan", "i")
+    uv.add_var("pol", "i")
+    uv["nchan"] = 4
+    uvw = np.array([1, 2, 3], dtype=np.float64)
+    for k in range(30):
+        for p in (-5, -6):
+            uv["pol"] = p
+            uv.write((uvw, 12345.6789 + k, (0, 1)), data * (k + 1))
+    del uv
+    uv = miriad.UV(filename2)
+    ref = [(p[1], d, uv["pol"]) for p, d in uv.all()]
+    for n, phase in ((1, 0), (3, 1), (7, 6)):
+        uv = miriad.UV(filename2)
+        uv.select("polarization", -6, 0)
+        uv.select("decimate", n, phase)
+        got = [(p[1], d, uv["pol"]) for p, d in uv.all()]
+        want = [r for r in ref[1::2] if (int(round(r[0] - 12345.6789)) - phase) % n == 0]
+        assert len(got) == len(want)
+        for (t0, d0, p0), (t1, d1, p1) in zip(got, want):
+            assert t0 == t1 and np.all(d0 == d1) and p0 == p1 == -6
+        # Rewinding starts the count again
+        uv.rewind()
+        assert [p[1] for p, d in uv.all()] == [r[0] for r in got]
+    return
+
+
+def test_select_table_r(test_file_r):
+    """Test antennae and polarisation selections against the clause walk"""
+    filename1, filename2, data = test_file_r
+    uv = miriad.UV(filename2, status="new")
+    uv.add_var("nchan", "i")
+    uv.add_var("pol", "i")
+    uv.add_var("nants", "i")
+    uv["nchan"] = 4
+    uv["nants"] = 5
+    uvw = np.array([1, 2, 3], dtype=np.float64)
+    for k in range(3):
+        for i in range(5):
+            for j in range(i, 5):
+                for p in (-5, -6, -7, -8):
+                    uv["pol"] = p
+                    uv.write((uvw, 12345.6789 + k, (i, j)), data)
+    del uv
+
+    def sel(uv, walk):
+        # A visibility range selecting everything keeps the chain from
+        # being compiled into a table
+        if walk:
+            uv.select("visibility", 1, 10**9)
+        uv.select("antennae", 0, 1)
+        uv.select("polarization", -5, 0)
+        uv.select("or", -1, -1)
+        uv.select("antennae", 2, -1)
+        uv.select("polarization", -6, 0)
+        uv.select("polarization", -7, 0)
+        uv.select("or", -1, -1)
+        uv.select("auto", 0, 0)
+        uv.select("and", -1, -1)
+        uv.select("antennae", 3, -1, include=False)
+        uv.select("and", -1, -1)
+        uv.select("polarization", -8, 0, include=False)
+
+    got = []
+    for walk in (False, True):
+        uv = miriad.UV(filename2)
+        sel(uv, walk)
+        got.append([(p[1], p[2], uv["pol"]) for p, d in uv.all()])
+    assert len(got[0]) > 0 and got[0] == got[1]
+    for t, (i, j), p in got[0]:
+        assert 3 not in (i, j) and p != -8
+    uv = miriad.UV(filename2)
+    uv.select("polarization", -6, 0)
+    assert set(uv["pol"] for p, d in uv.all()) == {-6}
+    return
+
+
+def test_project_r(test_file_r):
+    """Test reading with only some variables unpacked"""
+    filename1, filename2, data = test_file_r
+    uv = miriad.UV(filename2, status="new")
+    uv.add_var("nchan", "i")
+    uv.add_var("pol", "i")
+    uv.add_var("lst", "d")
+    uv.add_var("systemp", "r")
+    uv["nchan"] = 4
+    uvw = np.array([1, 2, 3], dtype=np.float64)
+    for k in range(20):
+        uv["lst"] = 0.1 * k
+        uv["systemp"] = np.arange(8, dtype=np.float32) + k
+        for p in (-5, -6):
+            uv["pol"] = p
+            uv.write((uvw, 12345.6789 + k, (0, 1)), data * (k + 1))
+    del uv
+    uv = miriad.UV(filename2)
+    ref = [(p, d, uv["pol"], uv["lst"], uv["systemp"]) for p, d in uv.all()]
+    uv = miriad.UV(filename2)
+    uv.project(["pol"])
+    for r, (p, d) in enumerate(uv.all()):
+        assert p[1] == ref[r][0][1] and np.all(d == ref[r][1])
+        assert uv["pol"] == ref[r][2]
+        if r % 3 == 0:
+            assert uv["lst"] == ref[r][3]
+            assert np.all(uv["systemp"] == ref[r][4])
+    uv.rewind()
+    uv.project()
+    assert len([p for p, d in uv.all()]) == len(ref)
+    return
+
+
+def test_track_r(test_file_r):
+    """Test the native snapshot of tracked variables"""
+    filename1, filename2, data = test_file_r
+    uv = miriad.UV(filename2, status="new")
+    uv.add_var("nchan", "i")
+    uv.add_var("pol", "i")
+    uv.add_var("lst", "d")
+    uv.add_var("inttime", "r")
+    uv["nchan"] = 4
+    uv["inttime"] = 10.0
+    uvw = np.array([1, 2, 3], dtype=np.float64)
+    for k in range(10):
+        uv["lst"] = 0.1 * k
+        for p in (-5, -6):
+            uv["pol"] = p
+            uv.write((uvw, 12345.6789 + k, (0, 1)), data)
+    del uv
+    uv = miriad.UV(filename2)
+    ref = [(uv["pol"], uv["lst"], uv["inttime"]) for p, d in uv.all()]
+    uv.rewind()
+    uv.track(["pol", "lst", "inttime"])
+    snap = uv.tracked
+    assert snap.dtype == np.float64 and snap.shape == (3,)
+    for r, (p, d) in enumerate(uv.all()):
+        assert uv.tracked is snap
+        assert tuple(snap) == ref[r]
+    uv.rewind()
+    uvw, t, ij, d, f, v = uv.read_block(100)
+    assert sorted(v.keys()) == ["inttime", "lst", "pol"]
+    assert list(zip(v["pol"], v["lst"], v["inttime"])) == ref
+    with pytest.raises(ValueError):
+        uv.track(["corr"])
+    uv.track()
+    assert uv.tracked is None
+    uv.rewind()
+    uvw, t, ij, d, f, v = uv.read_block(100)
+    assert v == {}
+    return
+
+
+def test_read_into_r(test_file_r):
+    """Test reading and writing records through caller-supplied buffers"""
+    filename1, filename2, data = test_file_r
+    uv1 = miriad.UV(filename1)
+    uv2 = miriad.UV(filename2, status="new")
+    uv2.add_var("nchan", "i")
+    uv2.add_var("pol", "i")
+    uv2["nchan"] = 4
+    d = np.zeros((2, 4), dtype=np.complex64)
+    f = np.zeros((2, 4), dtype=np.bool_)
+    uvw = np.zeros(3)
+    for k in range(2):
+        (crd, t, bl), nread = uv1.raw_read_into(d[k], f[k], uvw, True)
+        assert nread == 4 and crd is uvw and bl == (0, 1)
+        assert np.allclose(uvw, [1, 2, 3])
+        uv2["pol"] = uv1["pol"]
+        uv2.raw_write_from((uvw, t, bl), d[k], f[k], True)
+    assert np.allclose(d, data.data)
+    assert np.all(f == data.mask)
+    (crd, t, bl), nread = uv1.raw_read_into(d[0], f[0])
+    assert nread == 0
+    with pytest.raises(ValueError):
+        uv1.raw_read_into(d[:, 0], f[:, 0])
+    with pytest.raises(ValueError):
+        uv1.raw_read_into(d[0], f[0, :3])
+    del uv2
+    uv2 = miriad.UV(filename2)
+    for k in range(2):
+        preamble, d, f = uv2.read(raw=True)
+        assert uv2["pol"] == [-5, -6][k]
+        assert np.allclose(d, data.data)
+        assert np.all(f == data.mask)
+    return
+
+
+def test_threaded_read_r(test_file_r):
+    """Test reading Miriad UV files from several threads at once"""
+    import threading
+
+    filename1, filename2, data = test_file_r
+    uv = miriad.UV(filename2, status="new")
+    uv.add_var("nchan", "i")
+    uv.add_var("pol", "i")
+    uv["nchan"] = 4
+    uvw = np.array([1, 2, 3], dtype=np.float64)
+    for k in range(200):
+        uv["pol"] = -5 - k % 4
+        uv.write((uvw, 12345.6789 + k, (0, 1)), data * (k + 1))
+    del uv
+
+    def read_all(filename):
+        uv = miriad.UV(filename)
+        out = []
+        while True:
+            try:
+                preamble, d, f = uv.read(raw=True)
+            except IOError:
+                break
+            out.append((preamble[1], uv["pol"], d.copy(), f.copy()))
+        return out
+
+    serial = [read_all(filename1), read_all(filename2)]
+    results = [None] * 8
+
+    def worker(k):
+        results[k] = read_all([filename1, filename2][k % 2])
+
+    threads = [threading.Thread(target=worker, args=(k,)) for k in range(8)]
+    for th in threads:
+        th.start()
+    for th in threads:
+        th.join()
+    for k in range(8):
+        ref = serial[k % 2]
+        assert len(results[k]) == len(ref)
+        for (t0, p0, d0, f0), (t1, p1, d1, f1) in zip(ref, results[k]):
+            assert t0 == t1 and p0 == p1
+            assert np.all(d0 == d1) and np.all(f0 == f1)
+
+    # Threads sharing one data set take turns: every record is read once
+    uv = miriad.UV(filename2)
+    times = []
+
+    def share():
+        while True:
+            (crd, t, bl), d, f, nread = uv.raw_read(4)
+            if nread == 0:
+                break
+            times.append(t)
+
+    threads = [threading.Thread(target=share) for k in range(4)]
+    for th in threads:
+        th.start()
+    for th in threads:
+        th.join()
+    assert np.allclose(sorted(times), 12345.6789 + np.arange(200))
+    return
+
+
+def test_bufsize_r(test_file_r):
+    """Test reading and writing with large item buffers"""
+    filename1, filename2, data = test_file_r
+    old = _miriad.set_bufsize(4 << 20)
+    try:
+        assert _miriad.set_bufsize(0) == 4 << 20
+        uv1 = miriad.UV(filename1)
+        uv2 = miriad.UV(filename2, status="new")
+        uv2.init_from_uv(uv1)
+        uv2.pipe(uv1)
+        del uv1, uv2
+    finally:
+        _miriad.set_bufsize(old)
+    assert _miriad.set_bufsize(0) == old
+    uv1, uv2 = miriad.UV(filename1), miriad.UV(filename2)
+    for (p1, d1), (p2, d2) in zip(uv1.all(), uv2.all()):
+        assert p1[1] == p2[1] and np.all(d1 == d2)
+    return
+
+
+def test_mapped_item_r(tmp_path):
+    """Test reading an item bigger than the mmap threshold, whole and in
+    unaligned pieces"""
+    filename = str(tmp_path / "items.uv")
+    a = np.arange(100003, dtype=np.float32) * 0.5 - 7
+    uv = miriad.UV(filename, status="new")
+    h = uv.haccess("blob", "write")
+    offset = _miriad.hwrite_init(h, "r")
+    assert _miriad.hwrite_array(h, "r", offset, a) == 4 * a.size
+    _miriad.hdaccess(h)
+    del uv
+    uv = miriad.UV(filename)
+    h = uv.haccess("blob", "read")
+    t, offset = _miriad.hread_init(h)
+    assert t == "r"
+    assert np.all(_miriad.hread_array(h, "r", offset) == a)
+    rng = np.random.RandomState(1)
+    for k in range(200):
+        i, n = rng.randint(0, a.size - 50), rng.randint(1, 50)
+        assert np.all(_miriad.hread_array(h, "r", offset + 4 * i, n) == a[i:i + n])
+    # The item holds big-endian values
+    assert _miriad.hread_array(h, "b", offset + 3, 9) == a.astype(">f4").tobytes()[3:12]
+    with pytest.raises(IOError):
+        _miriad.hread_array(h, "r", offset + 4 * (a.size - 2), 3)
+    with pytest.raises(IOError):
+        _miriad.hwrite_array(h, "r", offset, a[:4])
+    _miriad.hdaccess(h)
+    return
+
+
+def test_async_item_r(tmp_path):
+    """Test interleaved writes and reads on one item handle, which go
+    through the background write-behind and read-ahead"""
+    filename = str(tmp_path / "items.uv")
+    a = np.arange(100003, dtype=np.float64) * 0.25 - 3
+    n = a.size // 2
+    uv = miriad.UV(filename, status="new")
+    h = uv.haccess("blob", "write")
+    offset = _miriad.hwrite_init(h, "d")
+    rng = np.random.RandomState(2)
+    for i in range(0, n, 997):
+        m = min(997, n - i)
+        _miriad.hwrite_array(h, "d", offset + 8 * i, a[i:i + m])
+        if i > 5000:
+            k = rng.randint(0, i - 10)
+            assert np.all(_miriad.hread_array(h, "d", offset + 8 * k, 10) == a[k:k + 10])
+    assert np.all(_miriad.hread_array(h, "d", offset) == a[:n])
+    with pytest.raises(IOError):
+        _miriad.hread_array(h, "d", offset + 8 * (n - 1), 2)
+    _miriad.hdaccess(h)
+    # Appending, and reading across the old end
+    h = uv.haccess("blob", "append")
+    _miriad.hwrite_array(h, "d", offset + 8 * n, a[n:])
+    assert np.all(_miriad.hread_array(h, "d", offset + 8 * (n - 5), 10) == a[n - 5:n + 5])
+    _miriad.hdaccess(h)
+    del uv
+    uv = miriad.UV(filename)
+    h = uv.haccess("blob", "read")
+    assert np.all(_miriad.hread_array(h, "d", offset) == a)
+    _miriad.hdaccess(h)
+    return
+
+
+@pytest.mark.parametrize("itype, ftype", [("j", ">i2"), ("i", ">i4"),
+                                           ("r", ">f4"), ("d", ">f8")])
+def test_pack_item_r(tmp_path, itype, ftype):
+    """Test packing and unpacking items at odd lengths and offsets against
+    numpy's big-endian conversion"""
+    filename = str(tmp_path / "items.uv")
+    size = np.dtype(ftype).itemsize
+    # int2 values are held in int32 arrays
+    dtype = np.int32 if itype == "j" else np.dtype(ftype).newbyteorder("=")
+    rng = np.random.RandomState(3)
+    if np.dtype(ftype).kind == "i":
+        info = np.iinfo(ftype)
+        a = rng.randint(info.min, info.max, size=100011).astype(dtype)
+    else:
+        a = rng.normal(scale=1e3, size=100011).astype(dtype)
+    uv = miriad.UV(filename, status="new")
+    h = uv.haccess("blob", "write")
+    offset = _miriad.hwrite_init(h, itype)
+    pieces, pos = [], 0
+    for n in (1, 3, 7, 17, 100003):
+        for skip in (0, 1, 3):
+            # Slices starting off the vector alignment of the array
+            v = a[skip:skip + n]
+            _miriad.hwrite_array(h, itype, offset + size * pos, v)
+            pieces.append((pos, v))
+            pos += n
+    _miriad.hdaccess(h)
+    del uv
+    uv = miriad.UV(filename)
+    h = uv.haccess("blob", "read")
+    ref = np.concatenate([v for p, v in pieces])
+    raw = _miriad.hread_array(h, "b", offset, size * pos)
+    assert raw == ref.astype(ftype).tobytes()
+    for p, v in pieces:
+        for skip in (0, 1):
+            w = _miriad.hread_array(h, itype, offset + size * (p + skip), len(v) - skip)
+            assert w.dtype == dtype and np.all(w == v[skip:])
+    _miriad.hdaccess(h)
+    return
+
+
+def test_scratch():
+    """Test in-memory scratch files, past their limit and back"""
+    a = np.arange(600000, dtype=np.float32) * 0.5
+    _miriad.set_scratch("memory", 1)
+    try:
+        h1, h2 = _miriad.scropen(), _miriad.scropen()
+        _miriad.scrwrite(h2, a[:5], 10)
+        # The second write would take the file past 1 MB: it moves to disk
+        for k in range(3):
+            _miriad.scrwrite(h1, a[200000 * k:200000 * (k + 1)], 200000 * k)
+        b = np.empty(600000, dtype=np.float32)
+        _miriad.scrread(h1, b, 0)
+        assert np.all(b == a)
+        b = np.empty(20, dtype=np.float32)
+        _miriad.scrread(h1, b, 199993)
+        assert np.all(b == a[199993:200013])
+        b = np.empty(15, dtype=np.float32)
+        _miriad.scrread(h2, b, 0)
+        assert np.all(b[:10] == 0) and np.all(b[10:] == a[:5])
+        with pytest.raises(RuntimeError):
+            _miriad.scrread(h2, b, 10)
+        _miriad.scrclose(h1)
+        _miriad.scrclose(h2)
+    finally:
+        _miriad.set_scratch("disk")
+    with pytest.raises(ValueError):
+        _miriad.set_scratch("tape")
+    return
+
+
+def test_compress_r(test_file_r):
+    """Test writing and reading compressed visdata and flags"""
+    filename1, filename2, data = test_file_r
+    old = _miriad.set_compress(True)
+    try:
+        assert _miriad.set_compress() is True
+        uv1 = miriad.UV(filename1)
+        uv2 = miriad.UV(filename2, status="new")
+        uv2.init_from_uv(uv1)
+        uv2.pipe(uv1, raw=True)
+        del uv1, uv2
+    finally:
+        _miriad.set_compress(old)
+    with open(os.path.join(filename2, "visdata"), "rb") as fh:
+        assert fh.read(8) == b"MIRZIP01"
+    uv1, uv2 = miriad.UV(filename1), miriad.UV(filename2)
+    for (p1, d1, f1), (p2, d2, f2) in zip(uv1.all(raw=True), uv2.all(raw=True)):
+        assert p1[1] == p2[1] and np.all(d1 == d2) and np.all(f1 == f2)
+    del uv1, uv2
+    # Appending inflates the items first
+    uv2 = miriad.UV(filename2, status="append")
+    uv2.write(p2, d2, f2)
+    del uv2
+    uv2 = miriad.UV(filename2)
+    assert len(list(uv2.all())) == len(list(miriad.UV(filename1).all())) + 1
+    return
+
+
+def test_stats_r(test_file_r):
+    """Test the i/o and decoding counters"""
+    filename1, filename2, data = test_file_r
+    _miriad.stats(enable=False, reset=True)
+    try:
+        uv = miriad.UV(filename1)
+        list(uv.all())
+        del uv
+        assert all(v == 0 for v in _miriad.stats().values())
+        _miriad.stats(enable=True)
+        uv = miriad.UV(filename1)
+        uv.select("polarization", -6, 0)
+        assert len(list(uv.all())) == 1
+        del uv
+        st = _miriad.stats(reset=True)
+    finally:
+        _miriad.stats(enable=False, reset=True)
+    assert st["records_read"] == 1
+    assert st["records_skipped"] == 1
+    assert st["uvread_calls"] == 2
+    assert st["uvread_ns"] >= st["unpack_ns"] > 0
+    assert st["dread_calls"] > 0 and st["dread_bytes"] > 0
+    assert st["item.visdata.read_bytes"] > 0
+    assert st["item.visdata.write_bytes"] == 0
+    assert all(v == 0 for v in _miriad.stats().values())
+    return
+
+
+def test_pipe_block_r(test_file_r, tmp_path):
+    """Test the native block pipe against pipe"""
+    filename1, filename2, data = test_file_r
+    uv = miriad.UV(filename2, status="new")
+    uv.add_var("nchan", "i")
+    uv.add_var("pol", "i")
+    uv.add_var("lst", "d")
+    uv["nchan"] = 4
+    uvw = np.array([1, 2, 3], dtype=np.float64)
+    for k in range(30):
+        uv["lst"] = 0.1 * k
+        for p in (-5, -6):
+            uv["pol"] = p
+            uv.write((uvw, 12345.6789 + k, (0, 1)), data * (k + 1))
+    del uv
+
+    def mfunc(uv, p, d):
+        if uv["pol"] == -6 and int(round(p[1] - 12345.6789)) % 3 == 0:
+            return p, None
+        return p, d * 2
+
+    def bfunc(uv, uvw, t, ij, data, flags, v):
+        keep = (v["pol"] != -6) | (np.round(t - 12345.6789).astype(int) % 3 != 0)
+        return uvw, t, ij, data * 2, flags, keep
+
+    def contents(filename):
+        uv = miriad.UV(filename)
+        return [(p[1], d, uv["pol"], uv["lst"]) for p, d in uv.all()]
+
+    uvi = miriad.UV(filename2)
+    ref = str(tmp_path / "ref.uv")
+    uvo = miriad.UV(ref, status="new")
+    uvo.init_from_uv(uvi)
+    uvo.pipe(uvi, mfunc=mfunc)
+    del uvi, uvo
+    want = contents(ref)
+    assert len(want) == 50
+    for n, (nblock, threads) in enumerate(((1, False), (7, False), (7, True), (100, True))):
+        out = str(tmp_path / ("out%d.uv" % n))
+        uvi = miriad.UV(filename2)
+        uvi.track(["pol"])
+        uvo = miriad.UV(out, status="new")
+        uvo.init_from_uv(uvi)
+        assert uvo.pipe_block(uvi, bfunc, nblock=nblock, threads=threads) == 60
+        del uvi, uvo
+        got = contents(out)
+        assert len(got) == len(want)
+        for (t0, d0, p0, l0), (t1, d1, p1, l1) in zip(got, want):
+            assert t0 == t1 and np.all(d0 == d1) and np.all(d0.mask == d1.mask)
+            assert p0 == p1 and l0 == l1
+    # Without mfunc the records are copied
+    out = str(tmp_path / "copy.uv")
+    uvi = miriad.UV(filename2)
+    uvo = miriad.UV(out, status="new")
+    uvo.init_from_uv(uvi)
+    uvo.pipe_block(uvi)
+    del uvi, uvo
+    assert len(contents(out)) == 60
+    # With cal, gains are divided out natively before mfunc
+    gains = np.array([[[1 + 1j] * 4, [2] * 4], [[0.5j] * 4, [1] * 4]], dtype=np.complex64)
+    out = str(tmp_path / "cal.uv")
+    uvi = miriad.UV(filename2)
+    uvo = miriad.UV(out, status="new")
+    uvo.init_from_uv(uvi)
+    uvo.pipe_block(uvi, nblock=7, cal=(gains, [0.0], [-5, -6]), divide=True)
+    del uvi, uvo
+    got = contents(out)
+    assert len(got) == 60
+    for k, (t0, d0, p0, l0) in enumerate(got):
+        q = 0 if p0 == -5 else 1
+        g = gains[0, q] * np.conj(gains[1, q])
+        assert np.allclose(d0, data * (k // 2 + 1) / g) and np.all(d0.mask == data.mask)
+    return
+
+
+def test_fan_out_r(test_file_r, tmp_path):
+    """Test splitting a file among several in one pass"""
+    filename1, filename2, data = test_file_r
+    uv = miriad.UV(filename2, status="new")
+    for k, t in (("nchan", "i"), ("pol", "i"), ("nspect", "i"), ("nschan", "i"),
+                 ("ischan", "i"), ("sfreq", "d"), ("sdf", "d")):
+        uv.add_var(k, t)
+    uv["nchan"], uv["nspect"] = 4, 2
+    uv["nschan"], uv["ischan"] = np.array([2, 2]), np.array([1, 3])
+    uv["sfreq"], uv["sdf"] = np.array([1.0, 1.1]), np.array([0.01, 0.01])
+    uvw = np.array([1, 2, 3], dtype=np.float64)
+    for k in range(5):
+        for ij in ((0, 1), (0, 2), (1, 2)):
+            for p in (-5, -6):
+                uv["pol"] = p
+                uv.write((uvw, 12345.6789 + k, ij), data * (k + 1))
+    del uv
+    names = [str(tmp_path / ("fan%d.uv" % k)) for k in range(3)]
+    routes = [{"chans": (2, 4)}, {"pols": ["yy"]}, {"bls": [(2, 0)], "pols": [-5]}]
+    uv = miriad.UV(filename2)
+    outs = [(miriad.UV(n, status="new"), r) for n, r in zip(names, routes)]
+    assert uv.fan_out(outs, nblock=4, append2hist="FAN OUT\n") == 30
+    del outs
+    uv = miriad.UV(filename2)
+    ref = [(p, d, uv["pol"]) for p, d in uv.all()]
+    uv = miriad.UV(names[0])
+    got = [(p, d) for p, d in uv.all()]
+    assert len(got) == 30
+    assert uv["nchan"] == 2 and uv["nspect"] == 1 and uv["ischan"] == 1
+    assert np.isclose(uv["sfreq"], 1.1) and uv["history"].endswith("FAN OUT\n")
+    for (p0, d0), (p1, d1, pol) in zip(got, ref):
+        assert p0[1] == p1[1] and p0[2] == p1[2]
+        assert np.all(d0 == d1[2:]) and np.all(d0.mask == d1.mask[2:])
+    uv = miriad.UV(names[1])
+    got = [(p[1], p[2], uv["pol"], d) for p, d in uv.all()]
+    assert uv["nchan"] == 4 and len(got) == 15
+    want = [r for r in ref if r[2] == -6]
+    for (t, ij, pol, d), (p1, d1, pol1) in zip(got, want):
+        assert t == p1[1] and ij == p1[2] and pol == -6 and np.all(d == d1)
+    uv = miriad.UV(names[2])
+    got = [(p[2], uv["pol"]) for p, d in uv.all()]
+    assert got == [((0, 2), -5)] * 5
+    return
+
+
+def test_apply_gains():
+    """Test the native gain kernel against numpy"""
+    rng = np.random.RandomState(3)
+    nant, nchan, n = 4, 5, 12
+    gains = (rng.randn(2, nant, 2, nchan) + 1j * rng.randn(2, nant, 2, nchan)).astype(np.complex64)
+    times = np.array([10.0, 20.0])
+    ij = rng.randint(0, nant, (n, 2)).astype(np.int32)
+    pidx = rng.randint(0, 2, (n, 2)).astype(np.int32)
+    pidx[0] = -1
+    t = np.linspace(5, 25, n)
+    d0 = (rng.randn(n, nchan) + 1j * rng.randn(n, nchan)).astype(np.complex64)
+    d = miriad.apply_gains(d0.copy(), ij, t, gains, times, pidx=pidx, nthreads=3)
+    w = np.clip((t - 10) / 10.0, 0, 1)[:, None, None]
+    g = (1 - w) * gains[0][None] + w * gains[1][None]
+    r = np.arange(n)
+    want = d0 * g[r, ij[:, 0], pidx[:, 0]] * np.conj(g[r, ij[:, 1], pidx[:, 1]])
+    want[0] = d0[0]
+    assert np.allclose(d, want, rtol=1e-4, atol=1e-5)
+    # Dividing undoes it, flagging channels of zero gain
+    gains[:, 0, :, 1] = 0
+    d1 = miriad.apply_gains(d0.copy(), ij, t, gains, times, pidx=pidx)
+    f = np.zeros((n, nchan), dtype=np.bool_)
+    d2 = miriad.apply_gains(d1.copy(), ij, t, gains, times, pidx=pidx, flags=f, divide=True)
+    zero = (ij[:, 0] == 0) | (ij[:, 1] == 0)
+    zero[0] = False
+    assert np.all(f[zero, 1]) and np.all(d2[zero, 1] == 0)
+    f[zero, 1] = False
+    assert not np.any(f)
+    assert np.allclose(d2[~zero], d0[~zero], rtol=1e-3, atol=1e-4)
+    with pytest.raises(ValueError):
+        miriad.apply_gains(d0.copy(), ij + nant, t, gains, times, pidx=pidx)
+    return
+
+
+def test_columnar_r(test_file_r, tmp_path):
+    """Test the columnar cache against read_block"""
+    filename1, filename2, data = test_file_r
+    uv = miriad.UV(filename2, status="new")
+    uv.add_var("nchan", "i")
+    uv.add_var("pol", "i")
+    uv.add_var("lst", "d")
+    uv.add_var("sdf", "d")
+    uv["nchan"] = 4
+    uv["sdf"] = 0.1
+    uvw = np.array([1, 2, 3], dtype=np.float64)
+    for k in range(5):
+        uv["lst"] = 0.1 * k
+        for bl in ((0, 1), (0, 2), (1, 2)):
+            for p in (-5, -6):
+                uv["pol"] = p
+                uv.write((uvw * k, 12345.0 + k, bl), data * (k + bl[1]))
+    del uv
+
+    uvc = miriad.to_columnar(filename2, str(tmp_path / "cache"), vars=["lst"])
+    uv = miriad.UV(filename2)
+    uvw, t, ij, d, f, v = uv.read_block(100, vars=["pol", "lst"])
+    assert uvc.nrec == 30 and uvc.nchan == 4 and uvc.sorted
+    assert np.allclose(uvc.header["sdf"], 0.1)
+    assert np.all(uvc.t == t) and np.all(uvc.uvw == uvw) and np.all(uvc.ij == ij)
+    assert np.all(uvc.data == d) and np.all(uvc.flags == f)
+    assert np.all(uvc.pol == v["pol"]) and np.all(uvc.vars["lst"] == v["lst"])
+
+    # Opening again maps the same columns
+    uvc = miriad.UVColumnar(str(tmp_path / "cache"))
+    assert len(uvc.keys()) == 6 and (0, 2, -6) in uvc.keys()
+    rows = uvc.rows(0, 2, "yy")
+    assert isinstance(rows, slice)
+    sel = (ij[:, 0] == 0) & (ij[:, 1] == 2) & (v["pol"] == -6)
+    assert np.all(uvc.data[rows] == d[sel])
+    assert np.all(uvc.block(rows)[1] == t[sel])
+    rows = uvc.time_rows(12346.0, 12348.0)
+    assert rows == slice(6, 18)
+    assert np.all(uvc.block(rows)[5]["lst"] == v["lst"][6:18])
+    return
+
+
+def test_read_files_r(tmp_path):
+    """Test reading several Miriad UV files into per-baseline arrays"""
+    filenames = [str(tmp_path / ("f%d.uv" % k)) for k in range(3)]
+    uvw = np.array([1, 2, 3], dtype=np.float64)
+    for k, filename in enumerate(filenames):
+        uv = miriad.UV(filename, status="new")
+        for name, typ in (("nchan", "i"), ("pol", "i"), ("nants", "i"),
+                          ("lst", "d"), ("sdf", "d"), ("sfreq", "d"),
+                          ("inttime", "r")):
+            uv.add_var(name, typ)
+        uv["nchan"], uv["nants"], uv["sdf"], uv["sfreq"], uv["inttime"] = 4, 3, 0.1, 1.0, 1.0
+        for n in range(5):
+            uv["lst"] = k + 0.1 * n
+            for i, j in ((0, 1), (0, 2), (1, 2)):
+                for p in (-5, -6):
+                    uv["pol"] = p
+                    d = np.ma.array(np.arange(4) + 10 * n + 100 * k + 1j * j,
+                                    mask=[n % 2, 0, 0, p == -6])
+                    uv.write((uvw, 2459000.5 + k + n / 24.0, (i, j)), d)
+        del uv
+    info, data, flgs = miriad.read_files(filenames, "0_1,1_2", "xx", nthreads=2)
+    assert sorted(data.keys()) == [(0, 1, "xx"), (1, 2, "xx")]
+    assert np.allclose(info["times"], [2459000.5 + k + n / 24.0 for k in range(3) for n in range(5)])
+    assert np.allclose(info["lsts"], [k + 0.1 * n for k in range(3) for n in range(5)])
+    assert np.allclose(info["freqs"], [1.0, 1.1, 1.2, 1.3])
+    for (i, j, pol), d in data.items():
+        assert d.shape == (15, 4) and flgs[(i, j, pol)].shape == (15, 4)
+        for r in range(15):
+            k, n = divmod(r, 5)
+            assert np.allclose(d[r], np.arange(4) + 10 * n + 100 * k + 1j * j)
+            assert np.all(flgs[(i, j, pol)][r] == [n % 2, 0, 0, 0])
+    info, data2, flgs2 = miriad.read_files(filenames[0], "0_1", "yy", recast_as_array=False)
+    assert list(data2.keys()) == [(0, 1, "yy")] and len(data2[(0, 1, "yy")]) == 5
+    return
+
+
 def test_vartable_j(test_file_j):
     """Test accesing vartable data in a Miriad UV file"""
     filename, data = test_file_j
@@ -132,3 +1104,184 @@ def test_data_j(test_file_j):
     assert np.allclose(uvw, np.array([1, 2, 3], dtype=np.float64))
     assert np.allclose(np.abs(d - data), 0.0, atol=1e-4)
     return
+
+
+def test_scaled_j(tmp_path):
+    """Test the int16 scaling of corrmode j data"""
+    filename = str(tmp_path / "test2.uv")
+    rng = np.random.default_rng(4)
+    uv = miriad.UV(filename, status="new", corrmode="j")
+    uv.add_var("nchan", "i")
+    uv.add_var("pol", "i")
+    uv["pol"] = -5
+    uvw = np.array([1, 2, 3], dtype=np.float64)
+    recs = []
+    for k, nchan in enumerate((64, 64, 37, 37, 100)):
+        uv["nchan"] = nchan
+        d = (rng.standard_normal(nchan) + 1j * rng.standard_normal(nchan)) * (k + 0.5)
+        d = np.ma.array(d.astype(np.complex64), mask=np.zeros(nchan, dtype=bool))
+        if k == 3:
+            d[:] = 0
+        uv.write((uvw, 12345.6789 + k, (0, 1)), d)
+        recs.append(d.data)
+    del uv
+    uv = miriad.UV(filename)
+    got = [d for p, d in uv.all()]
+    assert len(got) == len(recs)
+    for d0, d1 in zip(got, recs):
+        # Each record is scaled so that its largest component is 32767
+        v = np.concatenate([d1.real, d1.imag]).astype(np.float32)
+        maxval = np.float32(max(np.abs(v).max(), 1))
+        q = (v * (np.float32(32767) / maxval)).astype(np.int32)
+        want = q.astype(np.float32) * (maxval / np.float32(32767))
+        n = d1.size
+        assert d0.size == n
+        assert np.allclose(d0.data.real, want[:n], rtol=0, atol=1e-6 * maxval)
+        assert np.allclose(d0.data.imag, want[n:], rtol=0, atol=1e-6 * maxval)
+    return
+
+
+def test_image_cube(tmp_path):
+    """Test streaming an image cube by planes and profiles"""
+    filename = str(tmp_path / "test.xy")
+    nx, ny, nchan = 8, 6, 5
+    cube = np.arange(nx * ny * nchan, dtype=np.float32).reshape(nchan, ny, nx)
+    with miriad.ImageCube(filename, "new", (nx, ny, nchan)) as im:
+        assert im.axlen == (nx, ny, nchan)
+        for k in range(nchan):
+            plane = np.ma.array(cube[k], mask=np.zeros((ny, nx), dtype=bool))
+            plane.mask[1, 2] = True
+            im.write_plane(k, plane)
+        im["bunit"] = "JY/BEAM"
+        im["crval3"] = 1.5e9
+        im["niters"] = 100
+    with miriad.ImageCube(filename) as im:
+        assert im.axlen == (nx, ny, nchan)
+        assert im["bunit"] == "JY/BEAM"
+        assert im["crval3"] == 1.5e9
+        assert im["niters"] == 100
+        with pytest.raises(KeyError):
+            im["no_such_item"]
+        for k in range(nchan):
+            p = im.read_plane(k)
+            assert p.shape == (ny, nx)
+            assert np.all(p.data == cube[k])
+            assert p.mask.sum() == 1 and p.mask[1, 2]
+        prof = im.read_profile(3, 4)
+        assert np.all(prof.data == cube[:, 4, 3])
+        assert not prof.mask.any()
+        assert np.all(im.read_profile(2, 1).mask)
+        sub = im.read("xy", (2,), blc=(2, 1, 0), trc=(6, 4, nchan))
+        assert np.all(sub.data == cube[2, 1:4, 2:6])
+        with pytest.raises(ValueError):
+            im.read("xy", ())
+    return
+
+
+def test_sma_to_uv(tmp_path):
+    """Test converting raw SMA data written from scratch"""
+    mir = tmp_path / "mir"
+    mir.mkdir()
+    tables = dict((k, np.dtype(f)) for k, (n, f) in miriad._sma_tables.items())
+    nint, nch = 3, (1, 4, 3)
+    inh = np.zeros(nint, dtype=tables["in"])
+    inh["inhid"] = np.arange(nint) + 10
+    inh["dhrs"] = np.arange(nint) + 1.0
+    inh["souid"] = [1, 1, 2]
+    inh["rinteg"] = 30
+    # One upper and one lower sideband baseline header per integration
+    blh = np.zeros(2 * nint, dtype=tables["bl"])
+    blh["blhid"] = np.arange(2 * nint) + 100
+    blh["inhid"] = np.repeat(inh["inhid"], 2)
+    blh["isb"] = [1, 0] * nint
+    blh["itel1"], blh["itel2"] = 1, 3
+    blh["u"], blh["v"], blh["w"] = 2.3, -1.0, 0.5
+    sph = np.zeros(2 * nint * len(nch), dtype=tables["sp"])
+    sph["blhid"] = np.repeat(blh["blhid"], len(nch))
+    sph["inhid"] = np.repeat(blh["inhid"], len(nch))
+    sph["iband"] = np.tile(np.arange(len(nch)), 2 * nint)
+    sph["nch"] = np.tile(nch, 2 * nint)
+    sph["fsky"] = np.tile([230.0, 229.5, 230.5], 2 * nint)
+    sph["fres"] = 0.8125
+    sph["wt"] = 1
+    sph["wt"][2 * len(nch) + 2] = -1
+    sph["nrec"] = 1
+    codes = np.zeros(3, dtype=tables["codes"])
+    for c, (name, icode, code) in zip(codes, [("ref_time", 0, "Jan 10, 2006"),
+                                            ("source", 1, "3c273"), ("source", 2, "3c279")]):
+        c["v_name"], c["icode"], c["code"], c["ncode"] = name, icode, code, len(code)
+    # sch_read, each record of a spectrum as scale * shorts
+    rng = np.random.RandomState(0)
+    want, sch = [], b""
+    for n in range(nint):
+        recs = b""
+        for s in np.nonzero(sph["inhid"] == inh["inhid"][n])[0]:
+            sph["dataoff"][s] = len(recs)
+            d = rng.randint(-1000, 1000, size=2 * sph["nch"][s]).astype(">i2")
+            scale = np.int16(-3)
+            recs += np.array([0, 0, 0, 0, scale], dtype=">i2").tobytes() + d.tobytes()
+            if sph["iband"][s] > 0 and blh["isb"][s // len(nch)] == 1:
+                want.append((d[0::2] - 1j * d[1::2]) * 2.0**scale)
+        sch += np.array([inh["inhid"][n]], dtype=">i4").tobytes() + b"I2-C"
+        sch += np.array([len(recs), len(recs)], dtype=">i4").tobytes() + recs
+    for k, name in (("in", "in_read"), ("bl", "bl_read"), ("sp", "sp_read"), ("codes", "codes_read")):
+        ({"in": inh, "bl": blh, "sp": sph, "codes": codes}[k]).tofile(str(mir / name))
+    (mir / "sch_read").write_bytes(sch)
+
+    hdr = miriad.read_sma_headers(str(mir))
+    assert np.all(hdr["sp"]["dataoff"] == sph["dataoff"])
+    assert sorted(hdr["sch"]) == list(inh["inhid"])
+    filename = str(tmp_path / "sma.uv")
+    assert miriad.sma_to_uv(str(mir), filename, sb=1, nblock=2, nthreads=2) == nint
+    want = np.array(want).reshape((nint, -1))
+    uv = miriad.UV(filename)
+    assert uv["nchan"] == 7 and uv["nspect"] == 2
+    assert np.allclose(uv["sdf"], 0.8125e-3)
+    assert np.allclose(uv["sfreq"], [229.5 - 1.5 * 0.8125e-3, 230.5 - 0.8125e-3])
+    srcs = []
+    for n, ((uvw, t, ij), d) in enumerate(uv.all()):
+        srcs.append(uv["source"])
+        assert ij == (0, 2)
+        assert np.isclose(t, 2453745.5 + (n + 1) / 24.0)
+        assert np.allclose(uvw, -np.array([2.3, -1.0, 0.5]) / 230.0 * 1e3)
+        assert np.allclose(d.data, want[n])
+        assert d.mask.sum() == (3 if n == 1 else 0)
+    assert srcs == ["3c273", "3c273", "3c279"]
+    return
+
+
+def test_jpl_index(tmp_path):
+    """Test indexing and querying a JPL line catalog"""
+    cat = tmp_path / "jpl"
+    cat.mkdir()
+    species = {28001: ("CO", [115271.2018, 230538.0, 345795.9899], " 1 2A3b5-2   1 2A1a7 3  "),
+               17002: ("NH3", [23694.4955, 230100.0, 345795.99], " 1 1 0 0 0 0 1 1 0 0 0 0")}
+    with open(str(cat / "catdir.cat"), "w") as fh:
+        for tag, (name, freqs, qn) in species.items():
+            fh.write("%6d %-13s%6d" % (tag, name, len(freqs)) + "%7.4f" * 7 % ((1.0,) * 7) + " 1\n")
+            with open(str(cat / ("c%06d.cat" % tag)), "w") as cf:
+                for n, f in enumerate(freqs):
+                    cf.write("%13.4f%8.4f%8.4f%2d%10.4f%3d%7d%4d%s\n" % (
+                        f, 0.05, -3.0 - n, 2, 1.5 * n, 3 + 2 * n, -tag if n == 0 else tag, 404, qn))
+    idx = miriad.jpl_index(str(cat), str(tmp_path / "index"))
+    assert len(idx) == 6
+    assert idx.species[28001]["name"] == "CO"
+    jc = miriad.JPLCatalog(str(tmp_path / "index"))
+    assert np.all(np.diff(jc.cols["freq"]) >= 0)
+    r = jc.query(230.0, 231.0)
+    assert list(r["tag"]) == [17002, 28001]
+    assert np.allclose(r["freq"], [230.1, 230.538])
+    assert np.allclose(r["err"], 0.05e-3)
+    r = jc.query([100.0, 230.2, 300.0], [120.0, 231.0, 301.0], strl=-4.5)
+    assert list(r["window"]) == [0, 1]
+    assert list(r["tag"]) == [-28001, 28001]
+    assert list(r["qn_upper"][0]) == [1, 2, 103, -25, -2, 0]
+    assert list(r["qn_lower"][0]) == [1, 2, 101, -17, 3, 0]
+    r = jc.query(0.0, 1e4, tags=[28001])
+    assert np.all(np.abs(r["tag"]) == 28001) and len(r["freq"]) == 3
+    assert np.allclose(r["lgint"], [-3.0, -4.0, -5.0])
+    assert len(jc.query(1.0, 2.0)["freq"]) == 0
+    (cat / "c017002.cat").write_text("not a catalog line\n")
+    with pytest.raises(ValueError):
+        miriad.jpl_index(str(cat), str(tmp_path / "index2"))
+    return
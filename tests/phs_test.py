@@ -235,6 +235,32 @@ def test_get_crds(source_catalog):
     return
 
 
+def test_compute_crds():
+    """Test the batch coordinates of aipy.phs.SrcCatalog.compute_crds"""
+    rng = np.random.RandomState(9)
+    srcs = [aipy.phs.RadioFixedBody(ra, dec, name="src%d" % k)
+            for k, (ra, dec) in enumerate(zip(rng.uniform(0, 2 * np.pi, 20),
+                                              rng.uniform(-1.4, 1.4, 20)))]
+    srcs.append(aipy.phs.RadioFixedBody("12:00", "-30:00", name="b1950", epoch=ephem.B1950))
+    srcs.append(aipy.phs.RadioSpecial("Sun"))
+    cat = aipy.phs.SrcCatalog(srcs)
+    aa = aipy.phs.ArrayLocation(("37:14", "-118:17"))
+    aa.set_jultime(2457000.5)
+    names = list(cat.keys())
+    jds = 2457000.5 + np.array([0.0, 0.3, 180.25])
+    eqs, tops = cat.compute_crds(aa, jds, nthreads=2)
+    assert eqs.shape == tops.shape == (3, 3, len(names))
+    assert aa.get_jultime() == 2457000.5
+    for i, t in enumerate(jds):
+        aa.set_jultime(t)
+        cat.compute(aa)
+        eq = cat.get_crds("eq", srcs=names)
+        assert np.allclose(eqs[i], eq, atol=1e-7)
+        e2t = aipy.coord.eq2top_m(-aa.sidereal_time(), aa.lat)
+        assert np.allclose(tops[i], np.dot(e2t, eqs[i]), atol=1e-12)
+    return
+
+
 def test_get(source_catalog):
     """Test retrieving source attributes from a aipy.phs.SrcCatalog() catalog"""
     srcs, cat = source_catalog
@@ -459,6 +485,39 @@ def test_antenna_array_gen_phs(test_antenna_array):
     return
 
 
+def test_antenna_array_gen_phs_bls(test_antenna_array):
+    ants, aa = test_antenna_array
+    aa.select_chans([1, 2, 3])
+    aa.set_jultime(2454555.3)
+    srcs = [aipy.phs.RadioFixedBody(aa.sidereal_time() + 0.1 * k, aa.lat - 0.05 * k)
+            for k in range(4)]
+    for src in srcs:
+        src.compute(aa)
+    seqs = np.array([src.get_crds("eq", ncrd=3) for src in srcs]).transpose()
+    ionref = (np.array([0.001, 0, -0.002, 0.0005]), np.array([0, 0.001, 0.001, 0]))
+    mfreq = np.array([0.1, 0.15, 0.2, 0.15])
+    srcshape = (np.array([0.01, 0, 0.02, 0.005]), np.array([0.005, 0, 0.01, 0.005]),
+                np.array([0, 0, 0.3, 1.0]))
+    bls = [(0, 1), (0, 2), (1, 3), (2, 3)]
+    phs = aa.gen_phs_bls(seqs, bls, mfreq=mfreq, ionref=ionref, srcshape=srcshape,
+                         resolve_src=True)
+    assert phs.shape == (4, 4, 3)
+    for k, (i, j) in enumerate(bls):
+        # The formula gen_phs has always used, from the Python pieces
+        u, v, w = aa.gen_uvw(i, j, src=seqs)
+        w = w + aa.refract(u, v, mfreq=mfreq.copy(), ionref=(ionref[0].copy(), ionref[1].copy()))
+        ans = np.exp(-1j * 2 * np.pi * (w + aa.get_phs_offset(i, j)))
+        ans *= aa.resolve_src(u, v, srcshape=tuple(a.copy() for a in srcshape))
+        assert np.allclose(phs[k], ans, rtol=0, atol=1e-12)
+        assert np.allclose(aa.gen_phs(seqs, i, j, mfreq=mfreq, ionref=ionref,
+                                      srcshape=srcshape, resolve_src=True), phs[k])
+    # One source gives one channel axis per baseline
+    phs = aa.gen_phs_bls(srcs[1], bls)
+    assert phs.shape == (4, 3)
+    assert np.allclose(phs[1], aa.gen_phs(srcs[1], 0, 2))
+    return
+
+
 def test_antenna_array_resolve_src(test_antenna_array):
     ants, aa = test_antenna_array
     # we get a runtime warning when x ~ 0
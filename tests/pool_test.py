@@ -0,0 +1,92 @@
+# -*- coding: utf-8 -*-
+# Copyright (c) 2018 Aaron Parsons
+# Licensed under the GPLv3
+
+import threading
+
+import aipy
+import aipy._deconv as _deconv
+import aipy._dsp as _dsp
+import aipy.utils as utils
+import numpy as np
+import pytest
+
+
+@pytest.fixture
+def num_threads():
+    n = aipy.get_num_threads()
+    yield
+    aipy.set_num_threads(n)
+
+
+def test_set_num_threads(num_threads):
+    n = aipy.get_num_threads()
+    assert n >= 1
+    assert aipy.set_num_threads(3) == n
+    assert aipy.get_num_threads() == 3
+    assert aipy.set_num_threads(0) == 3
+    assert aipy.get_num_threads() >= 1
+    with pytest.raises(ValueError):
+        aipy.set_num_threads(1 << 20)
+
+
+def test_setting_and_overrides(num_threads):
+    # nthreads=0 follows the setting; the results are those of one thread
+    rng = np.random.RandomState(5)
+    uv = (rng.normal(size=(48, 40)) + 1j * rng.normal(size=(48, 40))).astype(np.complex64)
+    ans = np.empty((48, 40), dtype=np.float32)
+    _dsp.uv_image(ans, uv, 3, 4, 1)
+    ims = rng.normal(size=(7, 16)).astype(np.float64)
+    ker = np.zeros(16)
+    ker[0], ker[1], ker[-1] = 1, 0.25, 0.25
+    area = np.ones(16, dtype=np.int64)
+    res1, mdl1 = ims.copy(), np.zeros_like(ims)
+    rv1 = _deconv.clean_batch(res1, ker, mdl1, area, maxiter=50, nthreads=1)
+    for n in (1, 2, 5):
+        aipy.set_num_threads(n)
+        for nthreads in (0, 3):
+            out = np.empty_like(ans)
+            _dsp.uv_image(out, uv, 3, 4, nthreads)
+            assert np.all(out == ans)
+            res, mdl = ims.copy(), np.zeros_like(ims)
+            rv = _deconv.clean_batch(res, ker, mdl, area, maxiter=50, nthreads=nthreads)
+            assert np.all(rv == rv1)
+            assert np.all(res == res1)
+            assert np.all(mdl == mdl1)
+    # Shares of add2array_flat are fixed by the thread count, not by who
+    # runs them
+    ind = rng.randint(0, 50, 100000)
+    data = rng.normal(size=100000)
+    a3 = np.zeros(50)
+    utils.add2array_flat(a3, ind, data, 3)
+    aipy.set_num_threads(3)
+    a0 = np.zeros(50)
+    utils.add2array_flat(a0, ind, data, 0)
+    assert np.all(a0 == a3)
+
+
+def test_concurrent_callers(num_threads):
+    # Loops started at once from several Python threads share the pool
+    aipy.set_num_threads(4)
+    rng = np.random.RandomState(6)
+    uvs = [(rng.normal(size=(32, 32)) + 1j * rng.normal(size=(32, 32))).astype(np.complex64)
+           for i in range(6)]
+    ans = []
+    for uv in uvs:
+        out = np.empty((32, 32), dtype=np.float32)
+        _dsp.uv_image(out, uv, 0, 0, 1)
+        ans.append(out)
+    ok = [True] * len(uvs)
+
+    def run(k):
+        out = np.empty((32, 32), dtype=np.float32)
+        for i in range(20):
+            _dsp.uv_image(out, uvs[k], 0, 0, 0)
+            ok[k] = ok[k] and bool(np.all(out == ans[k]))
+
+    threads = [threading.Thread(target=run, args=(k,)) for k in range(len(uvs))]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    assert all(ok)
@@ -0,0 +1,78 @@
+# -*- coding: utf-8 -*-
+# Licensed under the GPLv3
+
+import os
+import subprocess
+import sys
+
+import pytest
+import numpy as np
+
+from aipy import miriad
+
+SCRIPTS = os.path.join(os.path.dirname(os.path.dirname(os.path.abspath(__file__))),
+                       "scripts")
+
+CAL = """
+import aipy as a
+
+def get_aa(freqs):
+    beam = a.amp.Beam(freqs)
+    ants = [a.amp.Antenna(0, 0, 0, beam, amp=2.),
+            a.amp.Antenna(0, 100, 0, beam, amp=2.),
+            a.amp.Antenna(100, 0, 0, beam, amp=2.)]
+    return a.amp.AntennaArray(('45:00', '90:00'), ants)
+"""
+
+
+def _run(script, *args, **kwargs):
+    cmd = [sys.executable, os.path.join(SCRIPTS, script)] + list(args)
+    return subprocess.call(cmd, **kwargs)
+
+
+@pytest.fixture(scope="function")
+def test_uv(tmp_path):
+    """A small data set with circular, Stokes and linear records, and a
+    calibration file with a gain of 2 on every antenna"""
+    (tmp_path / "gain2_cal.py").write_text(CAL)
+    filename = str(tmp_path / "pols.uv")
+    uv = miriad.UV(filename, status="new")
+    for name, typ in (("nchan", "i"), ("nants", "i"), ("pol", "i"), ("sdf", "d"),
+                      ("sfreq", "d")):
+        uv.add_var(name, typ)
+    uv["nchan"], uv["nants"], uv["sdf"], uv["sfreq"] = 4, 3, 0.001, 0.1
+    pol = np.array([-1, -2, 1, -5])
+    n = len(pol)
+    d = ((1 + 2j) * np.arange(1, 4 * n + 1)).reshape((n, 4)).astype(np.complex64)
+    uv.write_block(np.zeros((n, 3)), 2454555.5 + np.zeros(n),
+                   np.array([(0, 1)] * n), d, np.zeros(d.shape, dtype=bool),
+                   vars={"pol": pol})
+    del uv
+    yield tmp_path, filename, pol, d
+
+
+def test_apply_cal_pols(test_uv):
+    """apply_cal divides out the passband of every polarization for
+    antennas without polarized gains"""
+    tmp_path, filename, pol, d = test_uv
+    rv = _run("apply_cal.py", "-C", "gain2_cal", "--no_phs", filename,
+              cwd=str(tmp_path))
+    assert rv == 0
+    uv = miriad.UV(filename + "C")
+    uvw, t, ij, d2, f2, v = uv.read_block(len(pol) + 1, vars=["pol"])
+    assert np.all(v["pol"] == pol)
+    assert np.allclose(d2, d / 4)
+    return
+
+
+def test_apply_bp_scale(test_uv):
+    """apply_bp scales the data by --scale, even a negative one"""
+    tmp_path, filename, pol, d = test_uv
+    rv = _run("apply_bp.py", "-l", "null", "--scale=-2", filename,
+              cwd=str(tmp_path))
+    assert rv == 0
+    uv = miriad.UV(filename + "b")
+    uvw, t, ij, d2, f2, v = uv.read_block(len(pol) + 1, vars=["pol"])
+    assert np.all(v["pol"] == pol)
+    assert np.allclose(d2, -2 * d)
+    return
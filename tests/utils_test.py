@@ -0,0 +1,86 @@
+# -*- coding: utf-8 -*-
+# Copyright (c) 2018 Aaron Parsons
+# Licensed under the GPLv3
+
+import aipy.utils as utils
+import numpy as np
+import pytest
+
+
+@pytest.mark.parametrize("dtype", [np.int32, np.float64, np.complex64])
+def test_add2array_flat(dtype):
+    rng = np.random.RandomState(3)
+    ind = np.array([rng.randint(-4, 4, 200), rng.randint(-5, 5, 200)]).T
+    data = (rng.normal(size=200) * 10).astype(dtype)
+    ans = np.zeros((4, 5), dtype=dtype)
+    utils.add2array(ans, ind, data)
+    a = np.zeros_like(ans)
+    flat = np.ravel_multi_index(ind.T, a.shape, mode="wrap")
+    utils.add2array_flat(a, flat, data)
+    assert np.all(a == ans)
+    # Negative flat indices count back from the end; data may be strided
+    a[:] = 0
+    utils.add2array_flat(a, flat - a.size, np.repeat(data, 2)[::2])
+    assert np.all(a == ans)
+    # Nothing is added if any index is out of range
+    a[:] = 0
+    flat[-1] = a.size
+    with pytest.raises(ValueError):
+        utils.add2array_flat(a, flat, data)
+    assert np.all(a == 0)
+    with pytest.raises(ValueError):
+        utils.add2array_flat(a.T, flat, data)
+
+
+@pytest.mark.parametrize("size", [100, 10 ** 6])
+def test_add2array_flat_threads(size):
+    # Private accumulators (small targets) and split targets (large ones)
+    # both give the one-thread sums; int32 indices work as well
+    rng = np.random.RandomState(4)
+    n = 300000
+    ind = rng.randint(-size, size, n).astype(np.int32)
+    data = rng.randint(-3, 4, n).astype(np.float64)
+    ans = np.zeros(size)
+    utils.add2array_flat(ans, ind.astype(np.int_), data)
+    for nthreads in (0, 3):
+        a = np.zeros(size)
+        utils.add2array_flat(a, ind, data, nthreads)
+        assert np.all(a == ans)
+    a = np.zeros(size, dtype=np.int64)
+    utils.add2array(a, ind.reshape(n, 1), data.astype(np.int64))
+    assert np.all(a == ans)
+    with pytest.raises(ValueError):
+        utils.add2array_flat(a, ind.astype(np.int16), data.astype(np.int64))
+
+
+@pytest.mark.parametrize("size", [100, 10 ** 6])
+def test_add2maps(size):
+    # Weights and weighted values go to all the maps in one pass, repeated
+    # pixels summing, with the one-thread sums on any thread count
+    rng = np.random.RandomState(7)
+    n = 300000
+    ind = rng.randint(-size, size, n)
+    wgts = rng.randint(0, 4, n).astype(np.float64)
+    vals = [rng.randint(-3, 4, n).astype(np.float64) for k in range(2)]
+    ans = [np.zeros(size) for k in range(3)]
+    utils.add2array_flat(ans[0], ind, wgts)
+    for k in range(2):
+        utils.add2array_flat(ans[k + 1], ind, wgts * vals[k])
+    for nthreads in (1, 0, 3):
+        maps = [np.zeros(size) for k in range(3)]
+        utils.add2maps(maps, ind.astype(np.int32), wgts, vals, nthreads)
+        for m, a in zip(maps, ans):
+            assert np.all(m == a)
+    maps = [np.zeros(size, dtype=np.float32) for k in range(3)]
+    utils.add2maps(maps, ind, np.broadcast_to(np.ones(1), (n,)), vals)
+    assert np.all(maps[1] == np.bincount(ind % size, vals[0], size))
+    # Nothing is added if any index is out of range; the maps must agree
+    maps = [np.zeros(size) for k in range(3)]
+    with pytest.raises(ValueError):
+        utils.add2maps(maps, np.append(ind, size), np.append(wgts, 1),
+                       [np.append(v, 1) for v in vals])
+    assert all(np.all(m == 0) for m in maps)
+    with pytest.raises(ValueError):
+        utils.add2maps(maps, ind, wgts, vals[:1])
+    with pytest.raises(ValueError):
+        utils.add2maps([maps[0], maps[1].astype(np.float32), maps[2]], ind, wgts, vals)